@@ -0,0 +1,102 @@
+/* The server of broadcast_test. Subscribers upgrade at /subscribe (or at /subscribe-deflate, sharing a compressor)
+ * and are subscribed to topics 0 to ?topics= - 1. Every binary message of a publisher at /publish is published to the
+ * topic of index its first 4 bytes hold (little endian), compressed with ?compress=1. A text message "stats" from a
+ * publisher is answered with the CPU time of the server so far, in JSON.
+ *
+ * Usage: broadcast_server [port] [ports], listening on ports from port on (9001 and 1 if not given) */
+
+#include "App.h"
+
+#include <sys/resource.h>
+
+#include <charconv>
+#include <cstring>
+#include <string>
+
+struct PerSocketData {
+    unsigned int topics = 0;
+    bool compress = false;
+};
+
+static unsigned int queryNumber(uWS::HttpRequest *req, std::string_view key) {
+    std::string_view value = req->getQuery(key);
+    unsigned int number = 0;
+    std::from_chars(value.data(), value.data() + value.length(), number);
+    return number;
+}
+
+static std::string topicName(unsigned int index) {
+    return "t" + std::to_string(index);
+}
+
+int main(int argc, char **argv) {
+    int port = argc > 1 ? atoi(argv[1]) : 9001;
+    int ports = argc > 2 ? atoi(argv[2]) : 1;
+
+    uWS::App app;
+
+    auto upgrade = [](auto *res, auto *req, auto *context) {
+        res->template upgrade<PerSocketData>({
+            .topics = queryNumber(req, "topics"),
+            .compress = queryNumber(req, "compress") != 0
+        }, req->getHeader("sec-websocket-key"),
+            req->getHeader("sec-websocket-protocol"),
+            req->getHeader("sec-websocket-extensions"),
+            context);
+    };
+
+    auto subscribe = [](auto *ws) {
+        PerSocketData *perSocketData = ws->getUserData();
+        for (unsigned int i = 0; i < perSocketData->topics; i++) {
+            ws->subscribe(topicName(i));
+        }
+    };
+
+    /* Slow subscribers are measured, not dropped */
+    for (uWS::CompressOptions compression : {uWS::DISABLED, uWS::SHARED_COMPRESSOR}) {
+        app.ws<PerSocketData>(compression == uWS::DISABLED ? "/subscribe" : "/subscribe-deflate", {
+            .compression = compression,
+            .maxPayloadLength = 16 * 1024,
+            .idleTimeout = 0,
+            .maxBackpressure = 64 * 1024 * 1024,
+            .closeOnBackpressureLimit = false,
+            .upgrade = upgrade,
+            .open = subscribe
+        });
+    }
+
+    app.ws<PerSocketData>("/publish", {
+        .compression = uWS::DISABLED,
+        .maxPayloadLength = 16 * 1024 * 1024,
+        .idleTimeout = 0,
+        .maxBackpressure = 64 * 1024 * 1024,
+        .upgrade = upgrade,
+        .message = [&app](auto *ws, std::string_view message, uWS::OpCode opCode) {
+            if (opCode == uWS::TEXT && message == "stats") {
+                rusage usage;
+                getrusage(RUSAGE_SELF, &usage);
+                long long cpu = (long long) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+                uWS::LoopMetricsSnapshot metrics = app.getMetrics();
+                ws->send("{\"cpu_us\": " + std::to_string(cpu) + ", \"messages_out\": " + std::to_string(metrics.messagesOut)
+                    + ", \"bytes_out\": " + std::to_string(metrics.bytesOut) + "}", uWS::TEXT);
+                return;
+            }
+
+            uint32_t topic = 0;
+            if (message.length() >= 4) {
+                memcpy(&topic, message.data(), 4);
+            }
+            app.publish(topicName(topic), message, uWS::BINARY, ws->getUserData()->compress);
+        }
+    });
+
+    for (int i = 0; i < ports; i++) {
+        app.listen(port + i, [port, i](auto *listen_socket) {
+            if (listen_socket) {
+                std::cout << "Listening on port " << port + i << std::endl;
+            }
+        });
+    }
+
+    app.run();
+}
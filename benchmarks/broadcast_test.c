@@ -1,196 +1,509 @@
-/* This benchmark establishes _connections_ number of WebSocket
-   clients, then iteratively performs the following:
+/* This benchmark sweeps the shapes of fan-out against broadcast_server. For every combination of subscribers per
+   topic, topics per subscriber, message size and compression it:
 
-   1. Send one message for every client.
-   2. Wait for the quadratic (_connections_^2) amount of responses from the server.
-   3. Once received all expected bytes, repeat by going to step 1.
+   1. Connects that many subscribers, each subscribed to every topic, and one publisher.
+   2. Publishes for a while, round robin over the topics, keeping a window of messages in flight. A message
+      is done once every subscriber got it.
+   3. Reports deliveries per second, publish to receive latency (p50, p99, p99.9 and max) and the CPU time
+      the server spent per delivered message.
 
-   Every 4 seconds we print the current average "iterations per second".
+   Messages are not parsed by subscribers, the n-th frame a subscriber gets is the n-th message published
+   (compressed or not), so compression costs the client nothing.
    */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <libusockets.h>
 int SSL;
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-unsigned char web_socket_request[26] = {130, 128 | 20, 1, 2, 3, 4};
+#include "histogram.h"
 
-char request[] = "GET / HTTP/1.1\r\n"
-                 "Upgrade: websocket\r\n"
-                 "Connection: Upgrade\r\n"
-                 "Sec-WebSocket-Key: x3JJHMbDL1EzLkh9GBhXDw==\r\n"
-                 "Host: server.example.com\r\n"
-                 "Sec-WebSocket-Version: 13\r\n\r\n";
 char *host;
 int port;
-int connections;
+/* Subscribers are spread over the ports from port on, beyond the ~64k connections one port takes from one address */
+int ports = 1;
+
+/* What we sweep, given as comma separated lists */
+int subscribers_list[32] = {10, 100, 1000, 10000}, num_subscribers = 4;
+int topics_list[32] = {1, 4, 32}, num_topics = 3;
+/* Around the 16 kB cork buffer, where publish turns into publishBig */
+int sizes_list[32] = {64, 1024, 16383, 16384, 65536}, num_sizes = 5;
+int compression_list[32] = {0, 1}, num_compression = 2;
+
+/* Seconds of publishing for every combination, messages in flight, and output as JSON lines */
+int seconds = 5;
+int window = 16;
+int json;
+
+/* Subscribers connecting at once */
+#define CONNECT_BATCH 512
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
 
-int satisfied_sockets;
-int iterations;
+enum {
+    PUBLISHER,
+    SUBSCRIBER
+};
 
-struct http_socket {
-    /* How far we have streamed our websocket request */
-    int offset;
+struct ws_socket {
+    int kind;
 
     /* How far we have streamed our upgrade request */
     int upgrade_offset;
-
-    /* Are we upgraded? */
     int is_upgraded;
 
-    /* Bytes received */
-    int bytes_received;
+    /* How far we have streamed the message being published, publisher only */
+    int offset;
+
+    /* Header of the frame being received, and what is left of its payload */
+    unsigned char header[10];
+    int header_length;
+    uint64_t payload_remaining;
+
+    /* Frames received in whole */
+    uint64_t frames;
 };
 
-/* We track upgraded websockets */
-void **web_sockets;
-int num_web_sockets;
+/* The combination being run */
+int subscribers, topics, size, compression;
+int combination;
+
+enum {
+    CONNECTING,
+    STATS_BEFORE,
+    RUNNING,
+    STATS_AFTER,
+    CLOSING
+} phase;
+
+struct us_socket_context_t *context;
+struct us_socket_t **sockets;
+int num_sockets, launched, upgraded;
+struct us_socket_t *publisher;
+
+char subscribe_request[512], publish_request[512];
+int subscribe_request_length, publish_request_length;
+
+/* A masked binary frame of size, masked with zeros so that its payload goes as it is */
+unsigned char *frame;
+int frame_length, frame_header_length;
+
+unsigned char stats_request[11] = {129, 128 | 5, 0, 0, 0, 0, 's', 't', 'a', 't', 's'};
+char stats_reply[256];
+int stats_reply_length;
+long long cpu_before;
+
+/* Of messages in flight, by sequence */
+#define RING 65536
+uint64_t sent_ns[RING];
+uint32_t remaining[RING];
+uint64_t published, completed, deliveries;
+int in_flight, publisher_busy;
+uint64_t start_ns, end_ns;
+struct histogram latency;
+
+void start_combination();
 
 /* We don't need any of these */
 void noop(struct us_loop_t *loop) {
 
 }
 
-void start_iteration() {
-    for (int i = 0; i < num_web_sockets; i++) {
-        struct us_socket_t *s = (struct us_socket_t *) web_sockets[i];
-        struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
+void connect_next(int kind) {
+    int target = kind == PUBLISHER ? port : port + launched++ % ports;
+    us_socket_context_connect(SSL, context, host, target, NULL, 0, sizeof(struct ws_socket));
+}
+
+void write_stats_request() {
+    stats_reply_length = 0;
+    us_socket_write(SSL, publisher, (char *) stats_request, sizeof(stats_request), 0);
+}
 
-        http_socket->offset = us_socket_write(SSL, s, (char *) web_socket_request, sizeof(web_socket_request), 0);
+/* Publishes until the window is full (or the publisher's socket is) */
+void publish_more() {
+    while (phase == RUNNING && !publisher_busy && in_flight < window) {
+        uint64_t sequence = published++;
+        uint32_t topic = (uint32_t) (sequence % topics);
+        memcpy(frame + frame_header_length, &topic, 4);
+
+        sent_ns[sequence % RING] = now_ns();
+        remaining[sequence % RING] = subscribers;
+        in_flight++;
+
+        struct ws_socket *ws = (struct ws_socket *) us_socket_ext(SSL, publisher);
+        ws->offset = us_socket_write(SSL, publisher, (char *) frame, frame_length, 0);
+        if (ws->offset < frame_length) {
+            publisher_busy = 1;
+        }
     }
 }
 
-void next_connection(struct us_socket_t *s) {
-    /* Add this connection to our array */
-    web_sockets[num_web_sockets++] = s;
+long long parse_cpu() {
+    stats_reply[stats_reply_length < 255 ? stats_reply_length : 255] = 0;
+    char *cpu = strstr(stats_reply, "\"cpu_us\": ");
+    return cpu ? atoll(cpu + 10) : 0;
+}
 
-    /* We could wait with this until properly upgraded */
-    if (--connections) {
-        us_socket_context_connect(SSL, us_socket_context(SSL, s), host, port, NULL, 0, sizeof(struct http_socket));
+void report(long long cpu_after) {
+    double elapsed = (end_ns - start_ns) / 1e9;
+    double cpu_ns_per_delivery = deliveries ? (double) (cpu_after - cpu_before) * 1000 / deliveries : 0;
+
+    if (json) {
+        printf("{\"subscribers\": %d, \"topics\": %d, \"size\": %d, \"compression\": %d, \"messages\": %llu, \"deliveries\": %llu, "
+            "\"deliveries_per_sec\": %.1f, \"p50_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu, \"max_us\": %llu, "
+            "\"server_cpu_ns_per_delivery\": %.1f}\n",
+            subscribers, topics, size, compression, (unsigned long long) completed, (unsigned long long) deliveries,
+            deliveries / elapsed, (unsigned long long) histogram_percentile(&latency, 0.5),
+            (unsigned long long) histogram_percentile(&latency, 0.99), (unsigned long long) histogram_percentile(&latency, 0.999),
+            (unsigned long long) latency.max, cpu_ns_per_delivery);
     } else {
-        printf("Running benchmark now...\n");
-        start_iteration();
+        printf("%8d subscribers %3d topics %6d bytes %s: %12.0f deliveries/sec, p50: %llu us, p99: %llu us, p99.9: %llu us, "
+            "max: %llu us, server CPU: %.1f ns/delivery\n",
+            subscribers, topics, size, compression ? "deflate" : "   none", deliveries / elapsed,
+            (unsigned long long) histogram_percentile(&latency, 0.5), (unsigned long long) histogram_percentile(&latency, 0.99),
+            (unsigned long long) histogram_percentile(&latency, 0.999), (unsigned long long) latency.max, cpu_ns_per_delivery);
+    }
+    fflush(stdout);
+}
+
+void end_combination(long long cpu_after) {
+    report(cpu_after);
+
+    phase = CLOSING;
+    for (int i = 0; i < num_sockets; i++) {
+        us_socket_close(SSL, sockets[i], 0, NULL);
+    }
+
+    combination++;
+    start_combination();
+}
+
+/* A subscriber got the next message whole */
+void on_delivery(struct ws_socket *ws) {
+    if (phase != RUNNING && phase != STATS_AFTER) {
+        return;
+    }
+
+    uint64_t sequence = ws->frames - 1;
+    histogram_record(&latency, (now_ns() - sent_ns[sequence % RING]) / 1000);
+    deliveries++;
+
+    if (!--remaining[sequence % RING]) {
+        completed++;
+        in_flight--;
+
+        /* Done publishing, but not before what is in flight came */
+        if (phase == RUNNING && now_ns() - start_ns >= (uint64_t) seconds * 1000000000) {
+            phase = STATS_AFTER;
+            end_ns = now_ns();
+        }
+        if (phase == STATS_AFTER) {
+            if (!in_flight) {
+                write_stats_request();
+            }
+            return;
+        }
+        publish_more();
+    }
+}
+
+/* The publisher got the stats it asked for */
+void on_stats() {
+    if (phase == STATS_BEFORE) {
+        cpu_before = parse_cpu();
+        phase = RUNNING;
+        start_ns = now_ns();
+        publish_more();
+    } else if (phase == STATS_AFTER) {
+        end_combination(parse_cpu());
+    }
+}
+
+void on_upgraded(struct us_socket_t *s, struct ws_socket *ws) {
+    ws->is_upgraded = 1;
+
+    if (ws->kind == PUBLISHER) {
+        /* Only then the subscribers, a batch at a time */
+        for (int i = 0; i < CONNECT_BATCH && launched < subscribers; i++) {
+            connect_next(SUBSCRIBER);
+        }
+    } else if (++upgraded == subscribers) {
+        phase = STATS_BEFORE;
+        write_stats_request();
+    } else if (launched < subscribers) {
+        connect_next(SUBSCRIBER);
+    }
+}
+
+/* Goes through server frames, for their boundaries only (and the payload of stats, for the publisher) */
+void parse_frames(struct ws_socket *ws, char *data, int length) {
+    while (length > 0) {
+        if (ws->payload_remaining) {
+            int chunk = ws->payload_remaining < (uint64_t) length ? (int) ws->payload_remaining : length;
+            if (ws->kind == PUBLISHER && stats_reply_length + chunk < (int) sizeof(stats_reply)) {
+                memcpy(stats_reply + stats_reply_length, data, chunk);
+                stats_reply_length += chunk;
+            }
+            ws->payload_remaining -= chunk;
+            data += chunk;
+            length -= chunk;
+        } else {
+            ws->header[ws->header_length++] = (unsigned char) *data++;
+            length--;
+
+            int needed = 2;
+            if (ws->header_length >= 2) {
+                int short_length = ws->header[1] & 127;
+                needed = short_length == 126 ? 4 : (short_length == 127 ? 10 : 2);
+            }
+            if (ws->header_length < needed) {
+                continue;
+            }
+
+            int short_length = ws->header[1] & 127;
+            uint64_t payload_length = short_length;
+            if (short_length >= 126) {
+                payload_length = 0;
+                for (int i = 2; i < needed; i++) {
+                    payload_length = (payload_length << 8) | ws->header[i];
+                }
+            }
+            ws->header_length = 0;
+            ws->payload_remaining = payload_length;
+        }
 
-        us_socket_timeout(SSL, s, LIBUS_TIMEOUT_GRANULARITY);
+        if (!ws->payload_remaining && !ws->header_length) {
+            ws->frames++;
+            if (ws->kind == PUBLISHER) {
+                on_stats();
+            } else {
+                on_delivery(ws);
+            }
+        }
     }
 }
 
-struct us_socket_t *on_http_socket_writable(struct us_socket_t *s) {
-    struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
+struct us_socket_t *on_ws_socket_writable(struct us_socket_t *s) {
+    struct ws_socket *ws = (struct ws_socket *) us_socket_ext(SSL, s);
+    char *request = ws->kind == PUBLISHER ? publish_request : subscribe_request;
+    int request_length = ws->kind == PUBLISHER ? publish_request_length : subscribe_request_length;
 
     /* Are we still not upgraded yet? */
-    if (http_socket->upgrade_offset < sizeof(request) - 1) {
-        http_socket->upgrade_offset += us_socket_write(SSL, s, request + http_socket->upgrade_offset, sizeof(request) - 1 - http_socket->upgrade_offset, 0);
-    } else {
-        /* Stream whatever is remaining of the request */
-        http_socket->offset += us_socket_write(SSL, s, (char *) web_socket_request + http_socket->offset, sizeof(web_socket_request) - http_socket->offset, 0);
+    if (ws->upgrade_offset < request_length) {
+        ws->upgrade_offset += us_socket_write(SSL, s, request + ws->upgrade_offset, request_length - ws->upgrade_offset, 0);
+    } else if (ws->kind == PUBLISHER && publisher_busy) {
+        /* Stream whatever is remaining of the message */
+        ws->offset += us_socket_write(SSL, s, (char *) frame + ws->offset, frame_length - ws->offset, 0);
+        if (ws->offset == frame_length) {
+            publisher_busy = 0;
+            publish_more();
+        }
     }
 
     return s;
 }
 
-struct us_socket_t *on_http_socket_close(struct us_socket_t *s, int code, void *reason) {
-
-    printf("Client was disconnected, exiting!\n");
-    exit(-1);
+struct us_socket_t *on_ws_socket_close(struct us_socket_t *s, int code, void *reason) {
+    if (phase != CLOSING) {
+        printf("Client was disconnected, exiting!\n");
+        exit(-1);
+    }
 
     return s;
 }
 
-struct us_socket_t *on_http_socket_end(struct us_socket_t *s) {
+struct us_socket_t *on_ws_socket_end(struct us_socket_t *s) {
     return us_socket_close(SSL, s, 0, NULL);
 }
 
-struct us_socket_t *on_http_socket_data(struct us_socket_t *s, char *data, int length) {
+struct us_socket_t *on_ws_socket_data(struct us_socket_t *s, char *data, int length) {
     /* Get socket extension and the socket's context's extension */
-    struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
+    struct ws_socket *ws = (struct ws_socket *) us_socket_ext(SSL, s);
 
     /* Are we already upgraded? */
-    if (http_socket->is_upgraded) {
-        http_socket->bytes_received += length;
-
-        if (http_socket->bytes_received == (sizeof(web_socket_request) - 4) * num_web_sockets) {
-            satisfied_sockets++;
-            http_socket->bytes_received = 0;
-
-            if (satisfied_sockets == num_web_sockets) {
-                iterations++;
-                satisfied_sockets = 0;
-
-                start_iteration();
-            }
-        }
+    if (ws->is_upgraded) {
+        parse_frames(ws, data, length);
     } else {
         /* We assume the server is not sending anything immediately following upgrade and that we get rnrn in one chunk */
-        if (length >= 4 && data[length - 1] == '\n' && data[length - 2] == '\r' && data[length - 3] == '\n' && data[length - 4] == '\r') {
-            http_socket->is_upgraded = 1;
-            next_connection(s);
+        if (length >= 4 && memcmp(data + length - 4, "\r\n\r\n", 4) == 0) {
+            on_upgraded(s, ws);
         }
     }
 
     return s;
 }
 
-struct us_socket_t *on_http_socket_open(struct us_socket_t *s, int is_client, char *ip, int ip_length) {
-    struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
+struct us_socket_t *on_ws_socket_open(struct us_socket_t *s, int is_client, char *ip, int ip_length) {
+    struct ws_socket *ws = (struct ws_socket *) us_socket_ext(SSL, s);
+    memset(ws, 0, sizeof(struct ws_socket));
 
-    /* Reset offsets */
-    http_socket->offset = 0;
-    http_socket->is_upgraded = 0;
-    http_socket->bytes_received = 0;
+    /* The first to open of a combination is its publisher */
+    ws->kind = num_sockets ? SUBSCRIBER : PUBLISHER;
+    sockets[num_sockets++] = s;
+    if (ws->kind == PUBLISHER) {
+        publisher = s;
+    }
 
     /* Send an upgrade request */
-    http_socket->upgrade_offset = us_socket_write(SSL, s, request, sizeof(request) - 1, 0);
+    char *request = ws->kind == PUBLISHER ? publish_request : subscribe_request;
+    int request_length = ws->kind == PUBLISHER ? publish_request_length : subscribe_request_length;
+    ws->upgrade_offset = us_socket_write(SSL, s, request, request_length, 0);
 
     return s;
 }
 
-struct us_socket_t *on_http_socket_timeout(struct us_socket_t *s) {
-    /* Print current statistics */
-    printf("Iterations/second (%d clients): %f\n", num_web_sockets, ((float)iterations) / LIBUS_TIMEOUT_GRANULARITY);
-
-    iterations = 0;
-    us_socket_timeout(SSL, s, LIBUS_TIMEOUT_GRANULARITY);
+struct us_socket_t *on_ws_socket_connect_error(struct us_socket_t *s, int code) {
+    printf("Could not connect, exiting!\n");
+    exit(-1);
 
     return s;
 }
 
+const char *upgrade_request_format = "GET %s HTTP/1.1\r\n"
+                 "Upgrade: websocket\r\n"
+                 "Connection: Upgrade\r\n"
+                 "Sec-WebSocket-Key: x3JJHMbDL1EzLkh9GBhXDw==\r\n"
+                 "%s"
+                 "Host: server.example.com\r\n"
+                 "Sec-WebSocket-Version: 13\r\n\r\n";
+
+/* The combination numbered combination, innermost subscribers, or exit if none is left */
+void start_combination() {
+    int total = num_subscribers * num_topics * num_sizes * num_compression;
+    if (combination == total) {
+        exit(0);
+    }
+
+    int i = combination;
+    subscribers = subscribers_list[i % num_subscribers];
+    i /= num_subscribers;
+    topics = topics_list[i % num_topics];
+    i /= num_topics;
+    size = sizes_list[i % num_sizes];
+    i /= num_sizes;
+    compression = compression_list[i % num_compression];
+
+    char path[64];
+    snprintf(path, sizeof(path), "%s?topics=%d", compression ? "/subscribe-deflate" : "/subscribe", topics);
+    subscribe_request_length = snprintf(subscribe_request, sizeof(subscribe_request), upgrade_request_format, path,
+        compression ? "Sec-WebSocket-Extensions: permessage-deflate\r\n" : "");
+    snprintf(path, sizeof(path), "/publish?compress=%d", compression);
+    publish_request_length = snprintf(publish_request, sizeof(publish_request), upgrade_request_format, path, "");
+
+    /* Compressible, like most of what is broadcast */
+    free(frame);
+    frame_header_length = size < 126 ? 6 : (size < 65536 ? 8 : 14);
+    frame_length = frame_header_length + (size < 4 ? 4 : size);
+    frame = calloc(frame_length, 1);
+    for (int j = frame_header_length; j < frame_length; j++) {
+        frame[j] = (unsigned char) "broadcast "[j % 10];
+    }
+    frame[0] = 130;
+    uint64_t payload_length = frame_length - frame_header_length;
+    if (frame_header_length == 6) {
+        frame[1] = 128 | (unsigned char) payload_length;
+    } else if (frame_header_length == 8) {
+        frame[1] = 128 | 126;
+        frame[2] = (unsigned char) (payload_length >> 8);
+        frame[3] = (unsigned char) payload_length;
+    } else {
+        frame[1] = 128 | 127;
+        for (int j = 0; j < 8; j++) {
+            frame[2 + j] = (unsigned char) (payload_length >> (56 - 8 * j));
+        }
+    }
+
+    free(sockets);
+    sockets = calloc(subscribers + 1, sizeof(struct us_socket_t *));
+    num_sockets = launched = upgraded = 0;
+    published = completed = deliveries = 0;
+    in_flight = publisher_busy = 0;
+    memset(&latency, 0, sizeof(latency));
+    phase = CONNECTING;
+
+    connect_next(PUBLISHER);
+}
+
+/* Parses a comma separated list of up to 32 numbers */
+int parse_list(char *arg, int *list) {
+    int count = 0;
+    for (char *token = strtok(arg, ","); token && count < 32; token = strtok(NULL, ",")) {
+        list[count++] = atoi(token);
+    }
+    return count;
+}
+
 int main(int argc, char **argv) {
 
+    /* Options may go anywhere, what is left is positional */
+    int positional = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--ports") && i + 1 < argc) {
+            ports = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--subscribers") && i + 1 < argc) {
+            num_subscribers = parse_list(argv[++i], subscribers_list);
+        } else if (!strcmp(argv[i], "--topics") && i + 1 < argc) {
+            num_topics = parse_list(argv[++i], topics_list);
+        } else if (!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+            num_sizes = parse_list(argv[++i], sizes_list);
+        } else if (!strcmp(argv[i], "--compression") && i + 1 < argc) {
+            num_compression = parse_list(argv[++i], compression_list);
+        } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            seconds = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--window") && i + 1 < argc) {
+            window = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--json")) {
+            json = 1;
+        } else {
+            argv[positional++] = argv[i];
+        }
+    }
+    argc = positional;
+
     /* Parse host and port */
-    if (argc != 5) {
-        printf("Usage: connections host port ssl\n");
+    if (argc != 4 || !num_subscribers || !num_topics || !num_sizes || !num_compression) {
+        printf("Usage: host port ssl [--ports n] [--subscribers 10,100,...] [--topics 1,4,...] [--sizes 64,16384,...] "
+            "[--compression 0,1] [--seconds s] [--window messages] [--json]\n");
         return 0;
     }
+    if (window < 1 || window > RING) {
+        window = window < 1 ? 1 : RING;
+    }
+    if (ports < 1) {
+        ports = 1;
+    }
 
-    port = atoi(argv[3]);
-    host = malloc(strlen(argv[2]) + 1);
-    memcpy(host, argv[2], strlen(argv[2]) + 1);
-    connections = atoi(argv[1]);
-    SSL = atoi(argv[4]);
-
-    /* Allocate room for every socket */
-    web_sockets = (void **) malloc(sizeof(void *) * connections);
+    port = atoi(argv[2]);
+    host = malloc(strlen(argv[1]) + 1);
+    memcpy(host, argv[1], strlen(argv[1]) + 1);
+    SSL = atoi(argv[3]);
 
     /* Create the event loop */
     struct us_loop_t *loop = us_create_loop(0, noop, noop, noop, 0);
 
     /* Create a socket context for HTTP */
     struct us_socket_context_options_t options = {};
-    struct us_socket_context_t *http_context = us_create_socket_context(SSL, loop, 0, options);
+    context = us_create_socket_context(SSL, loop, 0, options);
 
     /* Set up event handlers */
-    us_socket_context_on_open(SSL, http_context, on_http_socket_open);
-    us_socket_context_on_data(SSL, http_context, on_http_socket_data);
-    us_socket_context_on_writable(SSL, http_context, on_http_socket_writable);
-    us_socket_context_on_close(SSL, http_context, on_http_socket_close);
-    us_socket_context_on_timeout(SSL, http_context, on_http_socket_timeout);
-    us_socket_context_on_end(SSL, http_context, on_http_socket_end);
-
-    /* Start making HTTP connections */
-    us_socket_context_connect(SSL, http_context, host, port, NULL, 0, sizeof(struct http_socket));
+    us_socket_context_on_open(SSL, context, on_ws_socket_open);
+    us_socket_context_on_data(SSL, context, on_ws_socket_data);
+    us_socket_context_on_writable(SSL, context, on_ws_socket_writable);
+    us_socket_context_on_close(SSL, context, on_ws_socket_close);
+    us_socket_context_on_end(SSL, context, on_ws_socket_end);
+    us_socket_context_on_connect_error(SSL, context, on_ws_socket_connect_error);
+
+    start_combination();
 
     us_loop_run(loop);
 }
@@ -0,0 +1,88 @@
+/* The latency histogram shared by load_test and broadcast_test */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/* Log linear histogram of microseconds, exact below 32 then 16 buckets per power of two up to 2^40 */
+#define HISTOGRAM_LINEAR 32
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR + 35 * HISTOGRAM_SUB_BUCKETS)
+
+struct histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t count, sum, max;
+};
+
+static inline unsigned int histogram_bucket(uint64_t value) {
+    if (value < HISTOGRAM_LINEAR) {
+        return (unsigned int) value;
+    }
+    if (value >> 40) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    unsigned int bits = 0;
+    for (uint64_t v = value; v; v >>= 1) {
+        bits++;
+    }
+    unsigned int shift = bits - 5;
+    return HISTOGRAM_LINEAR + (shift - 1) * HISTOGRAM_SUB_BUCKETS + (unsigned int) ((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+static inline uint64_t histogram_highest(unsigned int bucket) {
+    if (bucket < HISTOGRAM_LINEAR) {
+        return bucket;
+    }
+    unsigned int shift = (bucket - HISTOGRAM_LINEAR) / HISTOGRAM_SUB_BUCKETS + 1;
+    uint64_t mantissa = (bucket - HISTOGRAM_LINEAR) % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+static inline void histogram_record(struct histogram *h, uint64_t value) {
+    h->counts[histogram_bucket(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+/* Also the samples a stall of value kept from being taken, one every expected interval */
+static inline void histogram_record_corrected(struct histogram *h, uint64_t value, uint64_t expected) {
+    histogram_record(h, value);
+    if (expected) {
+        for (uint64_t missing = value; missing > expected; ) {
+            missing -= expected;
+            histogram_record(h, missing);
+        }
+    }
+}
+
+static inline void histogram_add(struct histogram *to, const struct histogram *from) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        to->counts[i] += from->counts[i];
+    }
+    to->count += from->count;
+    to->sum += from->sum;
+    if (from->max > to->max) {
+        to->max = from->max;
+    }
+}
+
+static inline uint64_t histogram_percentile(const struct histogram *h, double fraction) {
+    uint64_t target = (uint64_t) (fraction * (double) h->count + 0.5), seen = 0;
+    if (target < 1) {
+        target = 1;
+    }
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS && h->count; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            uint64_t highest = histogram_highest(i);
+            return highest < h->max ? highest : h->max;
+        }
+    }
+    return h->max;
+}
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,72 @@
+/* Serves the same routes over HTTP/1.1 (TLS, port 3000) and HTTP/3 (port 9004) from one loop, for the two
+ * to be compared under the same load generator. See README.md for how to drive it */
+
+#ifdef LIBUS_USE_QUIC
+
+#include "../src/Http3App.h"
+
+#include <iostream>
+#include <string>
+
+/* 1 MB, sent as the stream or socket takes it */
+static std::string large(1024 * 1024, 'x');
+
+/* Generic over HttpResponse<true> and Http3Response, which share the writing contract */
+template <class APP>
+void routes(APP &app) {
+    app.get("/hello", [](auto *res, auto */*req*/) {
+        res->end("Hello world!");
+    }).get("/json", [](auto *res, auto *req) {
+        res->writeHeader("Content-Type", "application/json");
+        res->end(std::string("{\"query\":\"") + std::string(req->getQuery("q")) + "\"}");
+    }).post("/echo", [](auto *res, auto */*req*/) {
+        res->onAborted([]() {});
+        res->onData([res, body = std::string()](std::string_view chunk, bool fin) mutable {
+            body.append(chunk);
+            if (fin) {
+                res->end(body);
+            }
+        });
+    }).get("/large", [](auto *res, auto */*req*/) {
+        if (!res->tryEnd(large).second) {
+            res->onAborted([]() {});
+            res->onWritable([res](uintmax_t offset) {
+                return res->tryEnd(std::string_view(large).substr((size_t) offset), large.length()).first;
+            });
+        }
+    });
+}
+
+int main() {
+    uWS::SocketContextOptions options = {
+        .key_file_name = "misc/key.pem",
+        .cert_file_name = "misc/cert.pem",
+        .passphrase = "1234"
+    };
+
+    uWS::SSLApp http1(options);
+    routes(http1);
+    http1.listen(3000, [](auto *listen_socket) {
+        if (listen_socket) {
+            std::cout << "HTTP/1.1 on port 3000" << std::endl;
+        }
+    });
+
+    uWS::H3App http3(options);
+    routes(http3);
+    http3.listen(9004, [](auto *listen_socket) {
+        if (listen_socket) {
+            std::cout << "HTTP/3 on port 9004" << std::endl;
+        }
+    }).run();
+}
+
+#else
+
+#include <stdio.h>
+
+int main() {
+    printf("Compile with WITH_QUIC=1 WITH_BORINGSSL=1 in order to build this benchmark\n");
+}
+
+#endif
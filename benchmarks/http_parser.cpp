@@ -0,0 +1,230 @@
+/* This is a benchmark of the HTTP side parsers (requests, chunked bodies, multipart and queries).
+ * Every corpus is replayed through the parser and reported as ns/request, cycles/byte and allocations/request */
+
+#include "../src/HttpParser.h"
+#include "../src/Multipart.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#include <x86intrin.h>
+static inline unsigned long long cycles() {
+    return __rdtsc();
+}
+#define HAS_CYCLES 1
+#else
+static inline unsigned long long cycles() {
+    return 0;
+}
+#define HAS_CYCLES 0
+#endif
+
+/* Count every allocation made while parsing */
+static unsigned long long allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+struct Corpus {
+    const char *name;
+    /* Raw bytes, replayed as one read */
+    std::string data;
+    /* Requests (or units of work) in data */
+    unsigned int requests;
+};
+
+struct Result {
+    double nsPerRequest, cyclesPerByte, allocationsPerRequest;
+};
+
+static const char *browserHeaders =
+    "Host: localhost:3000\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n";
+
+static std::vector<Corpus> makeCorpora() {
+    std::vector<Corpus> corpora;
+
+    corpora.push_back({"browser GET", std::string("GET /index.html?lang=en&theme=dark HTTP/1.1\r\n") + browserHeaders + "\r\n", 1});
+
+    std::string cookie = "Cookie: ";
+    for (int i = 0; i < 40; i++) {
+        cookie += "session_token_" + std::to_string(i) + "=" + std::string(48, (char) ('a' + i % 26)) + "; ";
+    }
+    corpora.push_back({"large cookie", std::string("GET /account HTTP/1.1\r\n") + browserHeaders + cookie + "\r\n\r\n", 1});
+
+    std::string pipelined;
+    for (int i = 0; i < 16; i++) {
+        pipelined += "GET /plaintext HTTP/1.1\r\nHost: localhost\r\nAccept: text/plain\r\nConnection: keep-alive\r\n\r\n";
+    }
+    corpora.push_back({"pipelined x16", pipelined, 16});
+
+    std::string chunked = "POST /upload HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\nContent-Type: application/grpc-web\r\n\r\n";
+    for (int i = 0; i < 256; i++) {
+        chunked += "10\r\n0123456789abcdef\r\n";
+    }
+    chunked += "0\r\n\r\n";
+    corpora.push_back({"chunked POST", chunked, 1});
+
+    corpora.push_back({"websocket upgrade", "GET /chat HTTP/1.1\r\n"
+        "Host: localhost:9001\r\n"
+        "Connection: Upgrade\r\n"
+        "Upgrade: websocket\r\n"
+        "Origin: http://localhost:9001\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits\r\n"
+        "Sec-WebSocket-Protocol: chat, superchat\r\n\r\n", 1});
+
+    return corpora;
+}
+
+/* Replays data through fn, which must restore any bytes it mutates, iterations times */
+template <typename F>
+static Result run(std::string &buffer, size_t length, unsigned int requests, unsigned int iterations, F &&fn) {
+    /* Warm up */
+    for (unsigned int i = 0; i < iterations / 10 + 1; i++) {
+        fn(buffer, length);
+    }
+
+    unsigned long long allocationsBefore = allocations;
+    unsigned long long cyclesBefore = cycles();
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int i = 0; i < iterations; i++) {
+        fn(buffer, length);
+    }
+
+    auto stop = std::chrono::steady_clock::now();
+    unsigned long long cyclesTaken = cycles() - cyclesBefore;
+    unsigned long long allocationsTaken = allocations - allocationsBefore;
+
+    double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+    double totalRequests = (double) requests * iterations;
+    return {ns / totalRequests, (double) cyclesTaken / ((double) length * iterations), (double) allocationsTaken / totalRequests};
+}
+
+static void report(const char *parser, const char *corpus, size_t length, Result r) {
+    if (HAS_CYCLES) {
+        printf("%-16s %-20s %8zu B %10.1f ns/req %8.2f cycles/B %6.2f allocs/req\n", parser, corpus, length, r.nsPerRequest, r.cyclesPerByte, r.allocationsPerRequest);
+    } else {
+        printf("%-16s %-20s %8zu B %10.1f ns/req %8s cycles/B %6.2f allocs/req\n", parser, corpus, length, r.nsPerRequest, "n/a", r.allocationsPerRequest);
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned int iterations = argc > 1 ? (unsigned int) atoi(argv[1]) : 200000;
+
+    for (Corpus &corpus : makeCorpora()) {
+        /* The parser mutates (lower cases) the input and needs post padding */
+        std::string original = corpus.data;
+        std::string buffer = original;
+        buffer.append(uWS::MINIMUM_HTTP_POST_PADDING, '\0');
+
+        /* Constructed outside, so that we only measure parsing */
+        uWS::HttpParser parser;
+        unsigned int parsed = 0;
+
+        Result r = run(buffer, original.length(), corpus.requests, iterations, [&](std::string &buffer, size_t length) {
+            memcpy(buffer.data(), original.data(), length);
+            parser.consumePostPadded(buffer.data(), (unsigned int) length, &parsed, nullptr, [](void *user, uWS::HttpRequest *req) -> void * {
+                (*(unsigned int *) user)++;
+                /* Look at what a typical handler looks at */
+                req->getHeader(uWS::HeaderIndex::HOST);
+                req->getHeader("sec-fetch-mode");
+                return user;
+            }, [](void *user, std::string_view, bool) -> void * {
+                return user;
+            });
+        });
+        report("HttpParser", corpus.name, original.length(), r);
+    }
+
+    {
+        /* Tiny chunks, as sent by streaming shims */
+        std::string original;
+        for (int i = 0; i < 4096; i++) {
+            original += "10\r\n0123456789abcdef\r\n";
+        }
+        original += "0\r\n\r\n";
+        std::string buffer = original;
+
+        Result r = run(buffer, original.length(), 1, iterations / 100 + 1, [](std::string &buffer, size_t length) {
+            std::string_view data(buffer.data(), length);
+            uint64_t state = uWS::STATE_IS_CHUNKED;
+            std::string_view chunks[32];
+            while (uWS::getNextChunks(data, state, chunks, 32) == 32);
+        });
+        report("ChunkedEncoding", "4096 x 16 B chunks", original.length(), r);
+    }
+
+    {
+        std::string original = "------WebKitFormBoundary7MA4YWxkTrZu0gW\r\n"
+            "Content-Disposition: form-data; name=\"field\"\r\n\r\n"
+            "some value\r\n"
+            "------WebKitFormBoundary7MA4YWxkTrZu0gW\r\n"
+            "Content-Disposition: form-data; name=\"file\"; filename=\"a.bin\"\r\n"
+            "Content-Type: application/octet-stream\r\n\r\n" + std::string(16384, 'x') + "\r\n"
+            "------WebKitFormBoundary7MA4YWxkTrZu0gW--\r\n";
+        std::string buffer = original;
+
+        Result r = run(buffer, original.length(), 1, iterations / 10 + 1, [&original](std::string &buffer, size_t length) {
+            /* The parser mutates header names */
+            memcpy(buffer.data(), original.data(), length);
+            uWS::MultipartParser mp("multipart/form-data; boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW");
+            mp.setBody(std::string_view(buffer.data(), length));
+            std::pair<std::string_view, std::string_view> headers[10];
+            while (mp.getNextPart(headers).has_value());
+        });
+        report("MultipartParser", "form with 16 kB file", original.length(), r);
+    }
+
+    {
+        std::string original = "?utm_source=newsletter&utm_medium=email&utm_campaign=spring+sale&q=hello%20world%21&page=3&sort=price&order=asc&filter=in+stock";
+        std::string buffer = original;
+
+        Result r = run(buffer, original.length(), 1, iterations, [&original](std::string &buffer, size_t length) {
+            /* Decoding is in place */
+            memcpy(buffer.data(), original.data(), length);
+            uWS::QueryIndex index;
+            std::string_view query(buffer.data(), length);
+            index.get("q", query);
+            index.get("page", query);
+            index.get("filter", query);
+            index.get("missing", query);
+        });
+        report("QueryParser", "8 parameters", original.length(), r);
+    }
+
+    return 0;
+}
@@ -1,6 +1,13 @@
-/* This is a simple yet efficient WebSocket server benchmark much like WRK */
+/* This is a simple yet efficient WebSocket server benchmark much like WRK.
+ *
+ * Closed loop (the default) keeps one message in flight per connection. With --rate it is open loop: messages
+ * go out on a fixed schedule over all connections, whether or not echoes came back, and latency is taken from
+ * when a message was due rather than from when it went, so a stalled server is not hidden by the sender waiting
+ * on it (coordinated omission). In closed loop the same is corrected for after the fact, as HdrHistogram does,
+ * adding the samples that a stall kept from being sent. Reported every interval as p50, p99, p99.9 and max */
 
 #define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
 
 #ifdef __APPLE__
 #include <libkern/OSByteOrder.h>
@@ -32,6 +39,9 @@ int SSL;
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#include "histogram.h"
 
 /* Whatever type we selected (compressed or not) */
 unsigned char *web_socket_request;
@@ -111,8 +121,34 @@ char request_text[] = "GET / HTTP/1.1\r\n"
 char *host;
 int port;
 int connections;
+/* As asked for, connections counts down while connecting */
+int total_connections;
+
+/* Messages per second over all connections, 0 for closed loop */
+double rate;
+/* Seconds between reports, and of the whole run (0 runs until killed) */
+int interval_seconds = LIBUS_TIMEOUT_GRANULARITY;
+int duration_seconds;
+/* Reports as one JSON object per line, and a summary at the end */
+int json;
+/* Expected time between messages of a connection in closed loop, unless given the mean latency of the last interval */
+uint64_t expected_interval_us;
+int expected_interval_given;
+
+/* Of this interval and of the whole run, as sent (raw, closed loop only) and corrected for coordinated omission */
+struct histogram interval_raw, interval_corrected, total_raw, total_corrected;
+uint64_t responses, total_responses;
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
 
-int responses;
+/* Set once every connection is upgraded */
+uint64_t start_ns;
+uint64_t last_report_ns;
+int intervals;
 
 struct http_socket {
     /* How far we have streamed our websocket request */
@@ -124,8 +160,17 @@ struct http_socket {
     /* Whether or not we have received the upgrade response */
     int is_upgraded;
 
-    /* How many bytes we expect to be echoed back to us before we consider the echo done */
-    int outstanding_bytes;
+    /* Bytes of echo received towards the message in flight that is oldest */
+    int received_bytes;
+
+    /* Of all connections, for the schedule of open loop */
+    int index;
+
+    /* Messages due and written in whole (or being written at offset), and echoed back */
+    uint64_t due, written, echoed;
+
+    /* When the message in flight went, in closed loop (in open loop many are, and when they were due is what counts) */
+    uint64_t sent_ns;
 };
 
 /* We don't need any of these */
@@ -142,14 +187,138 @@ void on_post(struct us_loop_t *loop) {
 
 }
 
+/* When message number k of this connection is due, in open loop */
+uint64_t due_ns(struct http_socket *http_socket, uint64_t k) {
+    return start_ns + (uint64_t) (((double) k * total_connections + http_socket->index) * 1e9 / rate);
+}
+
+/* Writes what is due of our messages, stopping at backpressure (continued from writable) */
+void send_due(struct us_socket_t *s) {
+    struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
+
+    while (http_socket->written < http_socket->due) {
+        if (!http_socket->offset) {
+            http_socket->sent_ns = now_ns();
+        }
+        http_socket->offset += us_socket_write(SSL, s, (char *) web_socket_request + http_socket->offset, web_socket_request_size - http_socket->offset, http_socket->written + 1 < http_socket->due);
+        if (http_socket->offset < web_socket_request_size) {
+            return;
+        }
+        http_socket->offset = 0;
+        http_socket->written++;
+    }
+}
+
+/* One line per interval (and one for the whole run), latency in microseconds */
+void print_report(int summary, double seconds, uint64_t count, struct histogram *raw, struct histogram *corrected) {
+    unsigned long long p50 = histogram_percentile(corrected, 0.5), p99 = histogram_percentile(corrected, 0.99);
+    unsigned long long p999 = histogram_percentile(corrected, 0.999), max = corrected->max;
+
+    if (json) {
+        printf("{\"%s\": %d, \"seconds\": %.3f, \"mode\": \"%s\", \"rate\": %.0f, \"connections\": %d, \"messages\": %llu, "
+            "\"msg_per_sec\": %.1f, \"p50_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu, \"max_us\": %llu",
+            summary ? "summary" : "interval", intervals, seconds, rate ? "open" : "closed", rate, total_connections,
+            (unsigned long long) count, count / seconds, p50, p99, p999, max);
+        if (raw->count) {
+            printf(", \"raw_p50_us\": %llu, \"raw_p99_us\": %llu, \"raw_p999_us\": %llu, \"raw_max_us\": %llu",
+                (unsigned long long) histogram_percentile(raw, 0.5), (unsigned long long) histogram_percentile(raw, 0.99),
+                (unsigned long long) histogram_percentile(raw, 0.999), (unsigned long long) raw->max);
+        }
+        printf("}\n");
+    } else {
+        printf("%sMsg/sec: %f, p50: %llu us, p99: %llu us, p99.9: %llu us, max: %llu us", summary ? "Total " : "", count / seconds,
+            p50, p99, p999, max);
+        if (raw->count) {
+            printf(" (uncorrected p99: %llu us, max: %llu us)", (unsigned long long) histogram_percentile(raw, 0.99),
+                (unsigned long long) raw->max);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+void report(uint64_t now) {
+    double seconds = (now - last_report_ns) / 1e9;
+    intervals++;
+    print_report(0, seconds, responses, &interval_raw, &interval_corrected);
+
+    /* The mean of this interval is what the next one expects between messages, unless told */
+    if (!rate && !expected_interval_given && interval_raw.count) {
+        expected_interval_us = interval_raw.sum / interval_raw.count;
+    }
+
+    histogram_add(&total_raw, &interval_raw);
+    histogram_add(&total_corrected, &interval_corrected);
+    total_responses += responses;
+    memset(&interval_raw, 0, sizeof(interval_raw));
+    memset(&interval_corrected, 0, sizeof(interval_corrected));
+    responses = 0;
+    last_report_ns = now;
+
+    if (duration_seconds && now - start_ns >= (uint64_t) duration_seconds * 1000000000) {
+        print_report(1, (now - start_ns) / 1e9, total_responses, &total_raw, &total_corrected);
+        exit(0);
+    }
+}
+
+struct us_socket_t **sockets;
+
+/* Every millisecond: what is due in open loop, and reports */
+void on_tick(struct us_timer_t *t) {
+    uint64_t now = now_ns();
+
+    if (rate) {
+        /* Message k of connection i is due at k * connections + i over rate */
+        double scheduled = (now - start_ns) * rate / 1e9;
+        for (int i = 0; i < total_connections; i++) {
+            if (!sockets[i]) {
+                continue;
+            }
+            struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, sockets[i]);
+            if (scheduled >= http_socket->index) {
+                uint64_t due = (uint64_t) ((scheduled - http_socket->index) / total_connections) + 1;
+                if (due > http_socket->due) {
+                    http_socket->due = due;
+                    send_due(sockets[i]);
+                }
+            }
+        }
+    }
+
+    if (now - last_report_ns >= (uint64_t) interval_seconds * 1000000000) {
+        report(now);
+    }
+}
+
+void start_benchmark(struct us_socket_t *s) {
+    if (!json) {
+        printf("Running benchmark now...\n");
+        if (rate) {
+            printf("Open loop at %.0f msg/sec\n", rate);
+        } else {
+            printf("Closed loop\n");
+        }
+    }
+
+    start_ns = last_report_ns = now_ns();
+    struct us_timer_t *timer = us_create_timer(us_socket_context_loop(SSL, us_socket_context(SSL, s)), 0, 0);
+    us_timer_set(timer, on_tick, 1, 1);
+
+    /* Closed loop starts every connection off with one message */
+    if (!rate) {
+        for (int i = 0; i < total_connections; i++) {
+            if (sockets[i]) {
+                ((struct http_socket *) us_socket_ext(SSL, sockets[i]))->due = 1;
+                send_due(sockets[i]);
+            }
+        }
+    }
+}
+
 void next_connection(struct us_socket_t *s) {
     /* We could wait with this until properly upgraded */
     if (--connections) {
         us_socket_context_connect(SSL, us_socket_context(SSL, s), host, port, NULL, 0, sizeof(struct http_socket));
-    } else {
-        printf("Running benchmark now...\n");
-
-        us_socket_timeout(SSL, s, LIBUS_TIMEOUT_GRANULARITY);
     }
 }
 
@@ -164,15 +333,19 @@ struct us_socket_t *on_http_socket_writable(struct us_socket_t *s) {
         if (http_socket->upgrade_offset == upgrade_request_length) {
             next_connection(s);
         }
-    } else {
-        /* Stream whatever is remaining of the request */
-        http_socket->offset += us_socket_write(SSL, s, (char *) web_socket_request + http_socket->offset, web_socket_request_size - http_socket->offset, 0);
+    } else if (start_ns) {
+        /* Stream whatever is remaining of what is due */
+        send_due(s);
     }
 
     return s;
 }
 
 struct us_socket_t *on_http_socket_close(struct us_socket_t *s, int code, void *reason) {
+    struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
+    if (sockets[http_socket->index] == s) {
+        sockets[http_socket->index] = NULL;
+    }
 
     printf("Closed!\n");
 
@@ -183,36 +356,59 @@ struct us_socket_t *on_http_socket_end(struct us_socket_t *s) {
     return us_socket_close(SSL, s, 0, NULL);
 }
 
+/* The oldest message in flight was echoed back whole */
+void on_echo(struct us_socket_t *s, struct http_socket *http_socket) {
+    uint64_t now = now_ns();
+
+    if (rate) {
+        /* From when it was due, which is the correction */
+        uint64_t due = due_ns(http_socket, http_socket->echoed);
+        histogram_record(&interval_corrected, now > due ? (now - due) / 1000 : 0);
+    } else {
+        uint64_t raw = (now - http_socket->sent_ns) / 1000;
+        histogram_record(&interval_raw, raw);
+        histogram_record_corrected(&interval_corrected, raw, expected_interval_us);
+    }
+
+    http_socket->echoed++;
+    responses++;
+
+    /* Closed loop sends another message right away */
+    if (!rate) {
+        http_socket->due++;
+        send_due(s);
+    }
+}
+
 struct us_socket_t *on_http_socket_data(struct us_socket_t *s, char *data, int length) {
     /* Get socket extension and the socket's context's extension */
     struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
-    
-    if (http_socket->is_upgraded) {
 
-        /* If we are upgraded we now count to see if we receive the corect echo */
-        http_socket->outstanding_bytes -= length;
+    if (http_socket->is_upgraded) {
 
-        if (http_socket->outstanding_bytes == 0) {
-            /* We got exactly the correct amount of bytes back, send another message */
-            http_socket->offset = us_socket_write(SSL, s, (char *) web_socket_request, web_socket_request_size, 0);
-            http_socket->outstanding_bytes = web_socket_request_size - 4;
+        /* Server will echo back the same message minus 4 bytes for mask, in order */
+        int echo_size = web_socket_request_size - 4;
+        http_socket->received_bytes += length;
 
-            /* Increase stats */
-            responses++;
-        } else if (http_socket->outstanding_bytes < 0) {
-            /* This should never happen */
-            printf("ERROR: outstanding bytes negative!");
-            exit(0);
+        while (http_socket->received_bytes >= echo_size) {
+            if (http_socket->echoed == http_socket->written) {
+                /* This should never happen */
+                printf("ERROR: received more than was sent!");
+                exit(0);
+            }
+            http_socket->received_bytes -= echo_size;
+            on_echo(s, http_socket);
         }
     } else {
         /* We assume the last 4 bytes will be delivered in one chunk */
         if (length >= 4 && memcmp(data + length - 4, "\r\n\r\n", 4) == 0) {
-            /* We are upgraded so start sending the message for echoing */
-            http_socket->offset = us_socket_write(SSL, s, (char *) web_socket_request, web_socket_request_size, 0);
-
-            /* Server will echo back the same message minus 4 bytes for mask */
-            http_socket->outstanding_bytes = web_socket_request_size - 4;
             http_socket->is_upgraded = 1;
+
+            /* Starts once all of them are */
+            static int upgraded;
+            if (++upgraded == total_connections) {
+                start_benchmark(s);
+            }
         }
     }
 
@@ -223,9 +419,9 @@ struct us_socket_t *on_http_socket_open(struct us_socket_t *s, int is_client, ch
     struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
 
     /* Reset offsets */
-    http_socket->offset = 0;
-
-    http_socket->is_upgraded = 0;
+    memset(http_socket, 0, sizeof(struct http_socket));
+    http_socket->index = total_connections - connections;
+    sockets[http_socket->index] = s;
 
     /* Send an upgrade request */
     http_socket->upgrade_offset = us_socket_write(SSL, s, upgrade_request, upgrade_request_length, 0);
@@ -237,27 +433,45 @@ struct us_socket_t *on_http_socket_open(struct us_socket_t *s, int is_client, ch
 }
 
 struct us_socket_t *on_http_socket_timeout(struct us_socket_t *s) {
-    /* Print current statistics */
-    printf("Msg/sec: %f\n", ((float)responses) / LIBUS_TIMEOUT_GRANULARITY);
-
-    responses = 0;
-    us_socket_timeout(SSL, s, LIBUS_TIMEOUT_GRANULARITY);
-
     return s;
 }
 
 int main(int argc, char **argv) {
 
+    /* Options may go anywhere, what is left is positional */
+    int positional = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+            rate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--interval") && i + 1 < argc) {
+            interval_seconds = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--duration") && i + 1 < argc) {
+            duration_seconds = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--expected-interval-us") && i + 1 < argc) {
+            expected_interval_us = (uint64_t) atoll(argv[++i]);
+            expected_interval_given = 1;
+        } else if (!strcmp(argv[i], "--json")) {
+            json = 1;
+        } else {
+            argv[positional++] = argv[i];
+        }
+    }
+    argc = positional;
+
     /* Parse host and port */
     if (argc != 6 && argc != 7) {
-        printf("Usage: connections host port ssl deflate [payload_size_bytes]\n");
+        printf("Usage: connections host port ssl deflate [payload_size_bytes] [--rate msg_per_sec] [--interval seconds] [--duration seconds] [--expected-interval-us us] [--json]\n");
         return 0;
     }
+    if (interval_seconds < 1) {
+        interval_seconds = 1;
+    }
 
     port = atoi(argv[3]);
     host = malloc(strlen(argv[2]) + 1);
     memcpy(host, argv[2], strlen(argv[2]) + 1);
-    connections = atoi(argv[1]);
+    connections = total_connections = atoi(argv[1]);
+    sockets = calloc(total_connections, sizeof(struct us_socket_t *));
     SSL = atoi(argv[4]);
     if (atoi(argv[5])) {
         /* Set up deflate */
@@ -270,7 +484,9 @@ int main(int argc, char **argv) {
         /* Only if we are NOT using defalte can we support testing with 100mb for now */
         if (argc == 7) {
             int size_kb = atoi(argv[6]);
-            printf("Using message size of %d bytes\n", size_kb);
+            if (!json) {
+                printf("Using message size of %d bytes\n", size_kb);
+            }
 
             /* Size has to be in KB since the minimal size for medium is 1kb */
             if (size_kb <= 125) {
@@ -283,7 +499,9 @@ int main(int argc, char **argv) {
                 init_big_message(size_kb);
             }
         } else {
-            printf("Using message size of %d bytes\n", 20);
+            if (!json) {
+                printf("Using message size of %d bytes\n", 20);
+            }
         }
 
         web_socket_request = web_socket_request_text;
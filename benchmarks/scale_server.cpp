@@ -0,0 +1,125 @@
+/* The server of scale_test. Sockets stay idle once connected, at one of these configurations:
+ *
+ * /http                  keep-alive HTTP, answered "ok" (scale_test asks again before the idle timeout)
+ * /ws                    WebSocket without compression
+ * /ws-shared             permessage-deflate with the shared compressor and decompressor
+ * /ws-dedicated          with a dedicated compressor and decompressor of the default (biggest) windows
+ * /ws-dedicated-4kb      with a dedicated compressor and decompressor of 4 kB
+ *
+ * Compressing WebSockets are sent one compressed message as they open, so that a dedicated compressor exists as it
+ * would for any socket having sent something. A text message "subscribe" subscribes its WebSocket to topics 0 to
+ * ?topics= - 1 and is answered "subscribed", any other message is answered "ok" (scale_test sends one compressed, so
+ * that a dedicated decompressor exists too). Answers are never compressed. GET /memory answers the memory of the
+ * server in JSON: resident set from /proc (peak resident set elsewhere) and App::getMemoryStats.
+ *
+ * Usage: scale_server [port] [ports], listening on ports from port on (9001 and 1 if not given) */
+
+#include "App.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <charconv>
+#include <cstdio>
+#include <string>
+
+struct PerSocketData {
+    unsigned int topics = 0;
+};
+
+static unsigned int queryNumber(uWS::HttpRequest *req, std::string_view key) {
+    std::string_view value = req->getQuery(key);
+    unsigned int number = 0;
+    std::from_chars(value.data(), value.data() + value.length(), number);
+    return number;
+}
+
+/* Bytes resident, from /proc where we have it */
+static unsigned long long residentBytes() {
+    unsigned long long pages = 0, resident = 0;
+    if (FILE *statm = fopen("/proc/self/statm", "r")) {
+        int fields = fscanf(statm, "%llu %llu", &pages, &resident);
+        fclose(statm);
+        if (fields == 2) {
+            return resident * (unsigned long long) sysconf(_SC_PAGESIZE);
+        }
+    }
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (unsigned long long) usage.ru_maxrss;
+#else
+    return (unsigned long long) usage.ru_maxrss * 1024;
+#endif
+}
+
+int main(int argc, char **argv) {
+    int port = argc > 1 ? atoi(argv[1]) : 9001;
+    int ports = argc > 2 ? atoi(argv[2]) : 1;
+
+    uWS::App app;
+
+    app.get("/http", [](auto *res, auto */*req*/) {
+        res->end("ok");
+    });
+
+    app.get("/memory", [&app](auto *res, auto */*req*/) {
+        uWS::MemoryStats stats = app.getMemoryStats();
+        res->writeHeader("Content-Type", "application/json")->end("{\"rss\": " + std::to_string(residentBytes())
+            + ", \"http_sockets\": " + std::to_string(stats.httpSockets) + ", \"web_sockets\": " + std::to_string(stats.webSockets)
+            + ", \"zlib_bytes\": " + std::to_string(stats.zlibBytes) + ", \"backpressure_block_bytes\": " + std::to_string(stats.backPressureBlockBytes)
+            + ", \"topics\": " + std::to_string(stats.topics) + ", \"subscribers\": " + std::to_string(stats.subscribers) + "}");
+    });
+
+    struct Configuration {
+        const char *pattern;
+        uWS::CompressOptions compression;
+    };
+    for (Configuration configuration : {
+        Configuration{"/ws", uWS::DISABLED},
+        Configuration{"/ws-shared", (uWS::CompressOptions) (uWS::SHARED_COMPRESSOR | uWS::SHARED_DECOMPRESSOR)},
+        Configuration{"/ws-dedicated", (uWS::CompressOptions) (uWS::DEDICATED_COMPRESSOR | uWS::DEDICATED_DECOMPRESSOR)},
+        Configuration{"/ws-dedicated-4kb", (uWS::CompressOptions) (uWS::DEDICATED_COMPRESSOR_4KB | uWS::DEDICATED_DECOMPRESSOR_4KB)}
+    }) {
+        /* Idle is idle, no pings either way */
+        app.ws<PerSocketData>(configuration.pattern, {
+            .compression = configuration.compression,
+            .idleTimeout = 0,
+            .sendPingsAutomatically = false,
+            .upgrade = [](auto *res, auto *req, auto *context) {
+                res->template upgrade<PerSocketData>({
+                    .topics = queryNumber(req, "topics")
+                }, req->getHeader("sec-websocket-key"),
+                    req->getHeader("sec-websocket-protocol"),
+                    req->getHeader("sec-websocket-extensions"),
+                    context);
+            },
+            .open = [compression = configuration.compression](auto *ws) {
+                if (compression != uWS::DISABLED) {
+                    ws->send("welcome, welcome, welcome", uWS::TEXT, true);
+                }
+            },
+            .message = [](auto *ws, std::string_view message, uWS::OpCode opCode) {
+                if (opCode == uWS::TEXT && message == "subscribe") {
+                    for (unsigned int i = 0; i < ws->getUserData()->topics; i++) {
+                        ws->subscribe("t" + std::to_string(i));
+                    }
+                    ws->send("subscribed", uWS::TEXT);
+                } else {
+                    ws->send("ok", uWS::TEXT);
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < ports; i++) {
+        app.listen(port + i, [port, i](auto *listen_socket) {
+            if (listen_socket) {
+                std::cout << "Listening on port " << port + i << std::endl;
+            }
+        });
+    }
+
+    app.run();
+}
@@ -1,224 +1,413 @@
-/* This is a scalability test for testing million(s) of pinging connections */
+/* This benchmark measures what an idle socket costs scale_server, in one configuration per run (see scale_server.cpp):
+   idle keep-alive HTTP or idle WebSocket, without compression or with one of the compression options.
+
+   1. Asks the server for its memory before anything connects, as the baseline.
+   2. Ramps up to the number of connections, spread over source addresses (20k per address and port) and ports,
+      pausing every connections / --samples to ask for the memory again and report the bytes per socket since
+      the baseline, and since the sample before. Sockets count once their upgrade (or request) was answered.
+   3. With --topics, every WebSocket then subscribes to that many topics and the bytes per subscription are
+      reported, from the last sample.
+
+   Memory is the resident set of the server, along with what it accounts for (App::getMemoryStats). Resident
+   memory is rarely given back, so restart the server between runs.
+   */
+
+#define _POSIX_C_SOURCE 200809L
 
 #include <libusockets.h>
 int SSL;
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-#include <stdint.h>
-
-unsigned char web_socket_request[26] = {130, 128 | 20, 1, 2, 3, 4};
 
-char request[] = "GET / HTTP/1.1\r\n"
-                 "Upgrade: websocket\r\n"
-                 "Connection: Upgrade\r\n"
-                 "Sec-WebSocket-Key: x3JJHMbDL1EzLkh9GBhXDw==\r\n"
-                 "Host: server.example.com\r\n"
-                 "Sec-WebSocket-Version: 13\r\n\r\n";
 char *host;
 int port;
+/* Sockets are spread over the ports from port on, and over the source addresses */
+int ports = 1;
 int connections;
 
 /* All the ips we as client can use */
 char **ips;
 int num_ips;
 
-/* Send ping every 16 seconds */
-int WEBSOCKET_PING_INTERVAL = 8;
+/* What we measure, being a path of scale_server without its slash */
+char *config = "ws";
+int http, compress;
+int topics;
+int samples = 10;
+int json;
+
+/* HTTP is asked again this often, within the idle timeout of the server */
+int HTTP_KEEPALIVE_INTERVAL = 8;
 
-/* We only establish 20k connections per address */
+/* We only establish 20k connections per address (and port) */
 int CONNECTIONS_PER_ADDRESS = 20000;
 
-/* How many connections a time */
-int BATCH_CONNECT = 1;
+/* Sockets connecting at once */
+#define CONNECT_BATCH 512
+
+enum {
+    BASELINE,
+    RAMPING,
+    SAMPLING,
+    SUBSCRIBING,
+    SAMPLING_SUBSCRIBED
+} phase;
+
+struct scale_socket {
+    /* How far we have streamed our request, and the subscribe message */
+    int offset, subscribe_offset;
+    int is_upgraded, is_ready;
+
+    /* Header of the frame being received, and what is left of its payload */
+    unsigned char header[10];
+    int header_length;
+    uint64_t payload_remaining;
+};
 
-/* Currently open and alive connections */
-int opened_connections;
-/* Dead connections */
-int closed_connections;
+struct us_socket_context_t *context, *stats_context;
+struct us_socket_t **sockets;
+int launched, ready, subscribed, next_sample;
 
-struct http_socket {
-    /* How far we have streamed our websocket request */
-    int offset;
+char request[512];
+int request_length;
 
-    /* How far we have streamed our upgrade request */
-    int upgrade_offset;
-};
+/* "Hello" of RFC 7692, deflated and masked with zeros, for the server to inflate */
+unsigned char compressed_hello[13] = {128 | 64 | 1, 128 | 7, 0, 0, 0, 0, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00};
+unsigned char subscribe_message[15] = {129, 128 | 9, 0, 0, 0, 0, 's', 'u', 'b', 's', 'c', 'r', 'i', 'b', 'e'};
 
-struct us_socket_t *next_connection_failed = 0;
+char memory_request[] = "GET /memory HTTP/1.1\r\nHost: server.example.com\r\n\r\n";
+char memory_reply[1024];
+int memory_reply_length;
 
-/* We don't need any of these */
-void on_pre(struct us_loop_t *loop) {
+struct memory {
+    double rss, zlib_bytes, backpressure_block_bytes, subscribers;
+};
+struct memory baseline, last;
+int last_sockets;
 
+void connect_next() {
+    /* Swap address (and port) every CONNECTIONS_PER_ADDRESS */
+    int pair = launched++ / CONNECTIONS_PER_ADDRESS;
+    us_socket_context_connect(SSL, context, host, port + pair % ports, ips[pair / ports], 0, sizeof(struct scale_socket));
 }
 
-/* This is not HTTP POST, it is merely an event emitted post loop iteration */
-void on_post(struct us_loop_t *loop) {
-
+/* Connects up to the next sample, keeping a batch connecting */
+void connect_more() {
+    while (launched < next_sample && launched - ready < CONNECT_BATCH) {
+        connect_next();
+    }
 }
 
-void next_connection(struct us_socket_t *s) {
-    /* We could wait with this until properly upgraded */
-    if (--connections/* > BATCH_CONNECT*/) {
-        /* Swap address */
-        int address = opened_connections / CONNECTIONS_PER_ADDRESS;
+void request_memory() {
+    memory_reply_length = 0;
+    us_socket_context_connect(SSL, stats_context, host, port, NULL, 0, 0);
+}
 
-        if (us_socket_context_connect(SSL, us_socket_context(SSL, s), host, port, ips[address], 0, sizeof(struct http_socket)) == 0) {
-            printf("Next connection failed immediately\n");
+double parse_field(const char *key) {
+    char *field = strstr(memory_reply, key);
+    return field ? atof(field + strlen(key)) : 0;
+}
 
-            /* Try agsin next event loop iteration */
-            next_connection_failed = s;
-            us_wakeup_loop(us_socket_context_loop(0, us_socket_context(0, s)));
+void report_sample(struct memory *m) {
+    double bytes_per_socket = (m->rss - baseline.rss) / ready;
+    double marginal = ready > last_sockets ? (m->rss - last.rss) / (ready - last_sockets) : 0;
+    double zlib_per_socket = (m->zlib_bytes - baseline.zlib_bytes) / ready;
+    double blocks_per_socket = (m->backpressure_block_bytes - baseline.backpressure_block_bytes) / ready;
 
-        }
+    if (json) {
+        printf("{\"config\": \"%s\", \"sockets\": %d, \"rss\": %.0f, \"bytes_per_socket\": %.1f, \"marginal_bytes_per_socket\": %.1f, "
+            "\"zlib_bytes_per_socket\": %.1f, \"backpressure_block_bytes_per_socket\": %.1f}\n",
+            config, ready, m->rss, bytes_per_socket, marginal, zlib_per_socket, blocks_per_socket);
+    } else {
+        printf("%-16s %8d sockets: %8.1f bytes/socket (%8.1f since last sample), of which zlib %8.1f, backpressure blocks %6.1f\n",
+            config, ready, bytes_per_socket, marginal, zlib_per_socket, blocks_per_socket);
     }
+    fflush(stdout);
 }
 
-void on_wakeup(struct us_loop_t *loop) {
-    if (next_connection_failed) {
-        struct us_socket_t *s = next_connection_failed;
-        next_connection_failed = 0;
-        next_connection(s);
+void report_subscriptions(struct memory *m) {
+    double subscriptions = (double) ready * topics;
+    double bytes_per_subscription = (m->rss - last.rss) / subscriptions;
+
+    if (json) {
+        printf("{\"config\": \"%s\", \"sockets\": %d, \"topics\": %d, \"subscriptions\": %.0f, \"subscribers\": %.0f, \"rss\": %.0f, "
+            "\"bytes_per_subscription\": %.1f}\n", config, ready, topics, subscriptions, m->subscribers, m->rss, bytes_per_subscription);
+    } else {
+        printf("%-16s %8d sockets x %d topics: %8.1f bytes/subscription\n", config, ready, topics, bytes_per_subscription);
     }
+    fflush(stdout);
 }
 
-struct us_socket_t *on_http_socket_writable(struct us_socket_t *s) {
-    struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
-
-    /* Are we still not upgraded yet? */
-    if (http_socket->upgrade_offset < sizeof(request) - 1) {
-        http_socket->upgrade_offset += us_socket_write(SSL, s, request + http_socket->upgrade_offset, sizeof(request) - 1 - http_socket->upgrade_offset, 0);
+void write_subscribe(struct us_socket_t *s) {
+    struct scale_socket *scale_socket = (struct scale_socket *) us_socket_ext(SSL, s);
+    scale_socket->subscribe_offset += us_socket_write(SSL, s, (char *) subscribe_message + scale_socket->subscribe_offset,
+        sizeof(subscribe_message) - scale_socket->subscribe_offset, 0);
+}
 
-        /* Now we should be */
-        if (http_socket->upgrade_offset == sizeof(request) - 1) {
-            next_connection(s);
+/* The server answered with its memory */
+void on_memory() {
+    struct memory m = {parse_field("\"rss\": "), parse_field("\"zlib_bytes\": "), parse_field("\"backpressure_block_bytes\": "),
+        parse_field("\"subscribers\": ")};
+
+    if (phase == BASELINE) {
+        baseline = last = m;
+        phase = RAMPING;
+        connect_more();
+        return;
+    } else if (phase == SAMPLING) {
+        report_sample(&m);
+        last = m;
+        last_sockets = ready;
+    } else if (phase == SAMPLING_SUBSCRIBED) {
+        report_subscriptions(&m);
+        exit(0);
+    }
 
-            /* Make sure to send ping */
-            us_socket_timeout(SSL, s, WEBSOCKET_PING_INTERVAL);
+    if (ready == connections) {
+        if (!topics || http) {
+            exit(0);
         }
-    } else {
-        /* Stream whatever is remaining of the request */
-        http_socket->offset += us_socket_write(SSL, s, (char *) web_socket_request + http_socket->offset, sizeof(web_socket_request) - http_socket->offset, 0);
-        if (http_socket->offset == sizeof(web_socket_request)) {
-            /* Reset timeout if we managed to */
-            us_socket_timeout(SSL, s, WEBSOCKET_PING_INTERVAL);
+        phase = SUBSCRIBING;
+        for (int i = 0; i < ready; i++) {
+            write_subscribe(sockets[i]);
         }
+        return;
     }
 
-    return s;
+    /* On to the next sample */
+    next_sample += connections / samples;
+    if (next_sample > connections || connections - next_sample < connections / samples) {
+        next_sample = connections;
+    }
+    phase = RAMPING;
+    connect_more();
 }
 
-struct us_socket_t *on_http_socket_close(struct us_socket_t *s, int code, void *reason) {
+/* A socket was answered, and so is one the server holds as it is configured */
+void on_ready(struct us_socket_t *s, struct scale_socket *scale_socket) {
+    scale_socket->is_ready = 1;
+    sockets[ready++] = s;
 
-    closed_connections++;
-    if (closed_connections % 1000 == 0) {
-        printf("Alive: %d, dead: %d\n", opened_connections, closed_connections);
+    if (http) {
+        us_socket_timeout(SSL, s, HTTP_KEEPALIVE_INTERVAL);
     }
 
-    return s;
+    if (ready == next_sample) {
+        phase = SAMPLING;
+        request_memory();
+    } else {
+        connect_more();
+    }
 }
 
-struct us_socket_t *on_http_socket_end(struct us_socket_t *s) {
-    return us_socket_close(SSL, s, 0, NULL);
+/* An answer of the server, not compressed */
+void on_answer(struct us_socket_t *s, struct scale_socket *scale_socket) {
+    if (!scale_socket->is_ready) {
+        on_ready(s, scale_socket);
+    } else if (phase == SUBSCRIBING && ++subscribed == ready) {
+        phase = SAMPLING_SUBSCRIBED;
+        request_memory();
+    }
 }
 
-// should never get a response!
-struct us_socket_t *on_http_socket_data(struct us_socket_t *s, char *data, int length) {
-
-    // is this a broadcasted unix time in millis?
-    if (length % 10 == 0) {
-
-        // data sent first will come first, so it is oldest
+/* Goes through server frames, for their boundaries and whether they were compressed */
+void parse_frames(struct us_socket_t *s, struct scale_socket *scale_socket, char *data, int length) {
+    while (length > 0) {
+        if (scale_socket->payload_remaining) {
+            int chunk = scale_socket->payload_remaining < (uint64_t) length ? (int) scale_socket->payload_remaining : length;
+            scale_socket->payload_remaining -= chunk;
+            data += chunk;
+            length -= chunk;
+        } else {
+            scale_socket->header[scale_socket->header_length++] = (unsigned char) *data++;
+            length--;
+
+            int needed = 2;
+            if (scale_socket->header_length >= 2) {
+                int short_length = scale_socket->header[1] & 127;
+                needed = short_length == 126 ? 4 : (short_length == 127 ? 10 : 2);
+            }
+            if (scale_socket->header_length < needed) {
+                continue;
+            }
+
+            int short_length = scale_socket->header[1] & 127;
+            uint64_t payload_length = short_length;
+            if (short_length >= 126) {
+                payload_length = 0;
+                for (int i = 2; i < needed; i++) {
+                    payload_length = (payload_length << 8) | scale_socket->header[i];
+                }
+            }
+            scale_socket->header_length = 0;
+            scale_socket->payload_remaining = payload_length;
+        }
 
-        struct timespec ts;
-        timespec_get(&ts, TIME_UTC);
+        if (!scale_socket->payload_remaining && !scale_socket->header_length && !(scale_socket->header[0] & 64)) {
+            on_answer(s, scale_socket);
+        }
+    }
+}
 
-        int64_t millis = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+/* Offset of what follows the end of headers, or -1 */
+int headers_end(char *data, int length) {
+    for (int i = 3; i < length; i++) {
+        if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r') {
+            return i + 1;
+        }
+    }
+    return -1;
+}
 
+/* We don't need any of these */
+void noop(struct us_loop_t *loop) {
 
-        int64_t received_millis;
-        memcpy(&received_millis, data + 2, 8);
+}
 
-        static int counter;
-        static int max_latency;
-        static long average_latency;
+struct us_socket_t *on_scale_socket_writable(struct us_socket_t *s) {
+    struct scale_socket *scale_socket = (struct scale_socket *) us_socket_ext(SSL, s);
 
-        int latency = millis - received_millis;
+    /* Stream whatever is remaining of the request, or of the subscribe message */
+    if (scale_socket->offset < request_length) {
+        scale_socket->offset += us_socket_write(SSL, s, request + scale_socket->offset, request_length - scale_socket->offset, 0);
+    } else if (phase == SUBSCRIBING && scale_socket->subscribe_offset < (int) sizeof(subscribe_message)) {
+        write_subscribe(s);
+    }
 
-        average_latency += latency;
+    return s;
+}
 
-        if (max_latency < latency) {
-            max_latency = latency;
-        }
+struct us_socket_t *on_scale_socket_close(struct us_socket_t *s, int code, void *reason) {
+    printf("Client was disconnected at %d sockets, exiting!\n", ready);
+    exit(-1);
 
-        if (++counter % 10000 == 0) {
-            printf("Alive: %d, dead: %d\n", opened_connections, closed_connections);
-            printf("Max latency: %d ms\n", max_latency);
-            printf("Average latency: %ld ms\n\n", average_latency / 10000);
-            max_latency = 0;
-            average_latency = 0;
-        }
+    return s;
+}
 
+struct us_socket_t *on_scale_socket_end(struct us_socket_t *s) {
+    return us_socket_close(SSL, s, 0, NULL);
+}
 
+struct us_socket_t *on_scale_socket_data(struct us_socket_t *s, char *data, int length) {
+    struct scale_socket *scale_socket = (struct scale_socket *) us_socket_ext(SSL, s);
 
+    if (http) {
+        /* We assume the answer comes in one chunk, and take any as one */
+        if (!scale_socket->is_ready) {
+            on_ready(s, scale_socket);
+        }
+    } else if (scale_socket->is_upgraded) {
+        parse_frames(s, scale_socket, data, length);
+    } else {
+        /* We assume the end of the upgrade response comes in one chunk, frames may follow it */
+        int end = headers_end(data, length);
+        if (end != -1) {
+            scale_socket->is_upgraded = 1;
+            if (compress) {
+                /* Ready once the server inflated this (and answered) */
+                us_socket_write(SSL, s, (char *) compressed_hello, sizeof(compressed_hello), 0);
+            } else {
+                on_ready(s, scale_socket);
+            }
+            parse_frames(s, scale_socket, data + end, length - end);
+        }
     }
 
+    return s;
+}
+
+struct us_socket_t *on_scale_socket_open(struct us_socket_t *s, int is_client, char *ip, int ip_length) {
+    struct scale_socket *scale_socket = (struct scale_socket *) us_socket_ext(SSL, s);
+    memset(scale_socket, 0, sizeof(struct scale_socket));
 
+    /* Send an upgrade request (or a request) */
+    scale_socket->offset = us_socket_write(SSL, s, request, request_length, 0);
 
     return s;
 }
 
-struct us_socket_t *on_http_socket_open(struct us_socket_t *s, int is_client, char *ip, int ip_length) {
-    struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
+/* Keep-alive HTTP asks again, before the server times it out */
+struct us_socket_t *on_scale_socket_timeout(struct us_socket_t *s) {
+    struct scale_socket *scale_socket = (struct scale_socket *) us_socket_ext(SSL, s);
 
-    /* Display number of opened connections */
-    opened_connections++;
-    if (opened_connections % 1000 == 0) {
-        printf("Alive: %d, dead: %d\n", opened_connections, closed_connections);
-    }
+    scale_socket->offset = us_socket_write(SSL, s, request, request_length, 0);
+    us_socket_timeout(SSL, s, HTTP_KEEPALIVE_INTERVAL);
 
-    /* Send an upgrade request */
-    http_socket->upgrade_offset = us_socket_write(SSL, s, request, sizeof(request) - 1, 0);
-    if (http_socket->upgrade_offset == sizeof(request) - 1) {
-        next_connection(s);
+    return s;
+}
 
-        /* Make sure to send ping */
-        us_socket_timeout(SSL, s, WEBSOCKET_PING_INTERVAL);
-    }
+struct us_socket_t *on_scale_socket_connect_error(struct us_socket_t *s, int code) {
+    printf("Could not connect at %d sockets, exiting!\n", launched);
+    exit(-1);
 
     return s;
 }
 
-// here we should send a message as ping (part of the test)
-struct us_socket_t *on_http_socket_timeout(struct us_socket_t *s) {
-    struct http_socket *http_socket = (struct http_socket *) us_socket_ext(SSL, s);
+struct us_socket_t *on_stats_socket_open(struct us_socket_t *s, int is_client, char *ip, int ip_length) {
+    us_socket_write(SSL, s, memory_request, sizeof(memory_request) - 1, 0);
+    return s;
+}
 
-    /* Send ping here */
-    http_socket->offset = us_socket_write(SSL, s, (char *) web_socket_request, sizeof(web_socket_request), 0);
-    if (http_socket->offset == sizeof(web_socket_request)) {
-        /* Reset timeout if we managed to */
-        us_socket_timeout(SSL, s, WEBSOCKET_PING_INTERVAL);
+struct us_socket_t *on_stats_socket_data(struct us_socket_t *s, char *data, int length) {
+    if (memory_reply_length + length >= (int) sizeof(memory_reply)) {
+        length = (int) sizeof(memory_reply) - 1 - memory_reply_length;
+    }
+    memcpy(memory_reply + memory_reply_length, data, length);
+    memory_reply_length += length;
+    memory_reply[memory_reply_length] = 0;
+
+    /* The JSON is flat, it is done at its only closing brace */
+    if (strchr(memory_reply, '}')) {
+        us_socket_close(SSL, s, 0, NULL);
+        on_memory();
     }
 
     return s;
 }
 
-struct us_socket_t *on_http_socket_connect_error(struct us_socket_t *s, int code) {
+struct us_socket_t *on_stats_socket_close(struct us_socket_t *s, int code, void *reason) {
+    return s;
+}
 
-    printf("Connection failed\n");
+struct us_socket_t *on_stats_socket_end(struct us_socket_t *s) {
+    return us_socket_close(SSL, s, 0, NULL);
+}
 
-    next_connection(s);
+struct us_socket_t *on_stats_socket_connect_error(struct us_socket_t *s, int code) {
+    printf("Could not ask for memory, exiting!\n");
+    exit(-1);
 
     return s;
 }
 
 int main(int argc, char **argv) {
 
+    /* Options may go anywhere, what is left is positional */
+    int positional = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--config") && i + 1 < argc) {
+            config = argv[++i];
+        } else if (!strcmp(argv[i], "--ports") && i + 1 < argc) {
+            ports = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--topics") && i + 1 < argc) {
+            topics = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+            samples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--json")) {
+            json = 1;
+        } else {
+            argv[positional++] = argv[i];
+        }
+    }
+    argc = positional;
+
     /* Parse host and port */
     if (argc < 5) {
-        printf("Usage: connections host port ssl [ip ...]\n");
+        printf("Usage: connections host port ssl [ip ...] [--config http|ws|ws-shared|ws-dedicated|ws-dedicated-4kb] "
+            "[--ports n] [--topics n] [--samples n] [--json]\n");
         return 0;
     }
 
@@ -227,50 +416,71 @@ int main(int argc, char **argv) {
     memcpy(host, argv[2], strlen(argv[2]) + 1);
     connections = atoi(argv[1]);
     SSL = atoi(argv[4]);
+    if (ports < 1) {
+        ports = 1;
+    }
+    if (samples < 1 || samples > connections) {
+        samples = samples < 1 ? 1 : connections;
+    }
 
     /* Do we have ip addresses? */
     if (argc > 5) {
         ips = &argv[5];
         num_ips = argc - 5;
-
-        for (int i = 0; i < num_ips; i++) {
-            printf("%s\n", ips[i]);
-        }
     } else {
-        static char *default_ips[] = {""};
+        static char *default_ips[] = {NULL};
         ips = default_ips;
         num_ips = 1;
     }
 
     /* Check so that we have enough ip addresses */
-    if (num_ips <= connections / CONNECTIONS_PER_ADDRESS) {
-        printf("You'll need more IP addresses for this run\n");
+    if (connections < 1 || (long long) num_ips * ports * CONNECTIONS_PER_ADDRESS < connections) {
+        printf("You'll need more IP addresses (or --ports) for this run\n");
         return 0;
     }
 
+    http = !strcmp(config, "http");
+    compress = !strncmp(config, "ws-", 3);
+    if (http) {
+        request_length = snprintf(request, sizeof(request), "GET /http HTTP/1.1\r\nHost: server.example.com\r\n\r\n");
+    } else {
+        request_length = snprintf(request, sizeof(request), "GET /%s?topics=%d HTTP/1.1\r\n"
+                 "Upgrade: websocket\r\n"
+                 "Connection: Upgrade\r\n"
+                 "Sec-WebSocket-Key: x3JJHMbDL1EzLkh9GBhXDw==\r\n"
+                 "%s"
+                 "Host: server.example.com\r\n"
+                 "Sec-WebSocket-Version: 13\r\n\r\n", config, topics, compress ? "Sec-WebSocket-Extensions: permessage-deflate\r\n" : "");
+    }
+    sockets = calloc(connections, sizeof(struct us_socket_t *));
+
     /* Create the event loop */
-    struct us_loop_t *loop = us_create_loop(0, on_wakeup, on_pre, on_post, 0);
+    struct us_loop_t *loop = us_create_loop(0, noop, noop, noop, 0);
 
-    /* Create a socket context for HTTP */
+    /* Create a socket context for the sockets we measure, and one for asking for memory */
     struct us_socket_context_options_t options = {};
-    struct us_socket_context_t *http_context = us_create_socket_context(SSL, loop, 0, options);
+    context = us_create_socket_context(SSL, loop, 0, options);
+    stats_context = us_create_socket_context(SSL, loop, 0, options);
 
     /* Set up event handlers */
-    us_socket_context_on_open(SSL, http_context, on_http_socket_open);
-    us_socket_context_on_data(SSL, http_context, on_http_socket_data);
-    us_socket_context_on_writable(SSL, http_context, on_http_socket_writable);
-    us_socket_context_on_close(SSL, http_context, on_http_socket_close);
-    us_socket_context_on_timeout(SSL, http_context, on_http_socket_timeout);
-    us_socket_context_on_end(SSL, http_context, on_http_socket_end);
-    us_socket_context_on_connect_error(SSL, http_context, on_http_socket_connect_error);
-
-    /* Start making HTTP connections */
-    for (int i = 0; i < BATCH_CONNECT; i++) {
-        if (us_socket_context_connect(SSL, http_context, host, port, ips[0], 0, sizeof(struct http_socket)) == 0) {
-            printf("Connection failed immediately\n");
-            return 0;
-        }
-    }
+    us_socket_context_on_open(SSL, context, on_scale_socket_open);
+    us_socket_context_on_data(SSL, context, on_scale_socket_data);
+    us_socket_context_on_writable(SSL, context, on_scale_socket_writable);
+    us_socket_context_on_close(SSL, context, on_scale_socket_close);
+    us_socket_context_on_timeout(SSL, context, on_scale_socket_timeout);
+    us_socket_context_on_end(SSL, context, on_scale_socket_end);
+    us_socket_context_on_connect_error(SSL, context, on_scale_socket_connect_error);
+
+    us_socket_context_on_open(SSL, stats_context, on_stats_socket_open);
+    us_socket_context_on_data(SSL, stats_context, on_stats_socket_data);
+    us_socket_context_on_close(SSL, stats_context, on_stats_socket_close);
+    us_socket_context_on_end(SSL, stats_context, on_stats_socket_end);
+    us_socket_context_on_connect_error(SSL, stats_context, on_stats_socket_connect_error);
+
+    /* The baseline, then the first sample */
+    next_sample = connections / samples;
+    phase = BASELINE;
+    request_memory();
 
     us_loop_run(loop);
 }
@@ -0,0 +1,319 @@
+/* This is a benchmark of the data structures behind pub/sub and routing, without sockets. TopicTree is driven with
+ * subscribe, publish, drain and freeSubscriber under churn, and HttpRouter with add and route over 10 to 10000 routes
+ * mixing static, parameter and wildcard patterns. Reported as ns/op, cache misses/op (from perf counters, where the
+ * kernel lets us) and bytes held per subscription or route */
+
+#include "../src/TopicTree.h"
+#include "../src/HttpRouter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Bytes the heap holds for us, where the allocator tells us the size of what it gave */
+static long long heldBytes = 0;
+
+static void *counted(void *p) {
+    if (!p) {
+        throw std::bad_alloc();
+    }
+#ifdef __GLIBC__
+    heldBytes += (long long) malloc_usable_size(p);
+#endif
+    return p;
+}
+
+static void uncounted(void *p) {
+#ifdef __GLIBC__
+    if (p) {
+        heldBytes -= (long long) malloc_usable_size(p);
+    }
+#endif
+    free(p);
+}
+
+void *operator new(size_t size) {
+    return counted(malloc(size ? size : 1));
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    size_t a = (size_t) alignment;
+    return counted(aligned_alloc(a, (size + a - 1) / a * a));
+}
+
+void operator delete(void *p) noexcept {
+    uncounted(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    uncounted(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    uncounted(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    uncounted(p);
+}
+
+/* Last level cache misses of this thread, while counting */
+struct CacheMisses {
+    int fd = -1;
+
+    CacheMisses() {
+#ifdef __linux__
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CacheMisses() {
+#ifdef __linux__
+        if (fd != -1) {
+            close(fd);
+        }
+#endif
+    }
+
+    void start() {
+#ifdef __linux__
+        if (fd != -1) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    /* -1 if not available */
+    long long stop() {
+        long long count = -1;
+#ifdef __linux__
+        if (fd != -1) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+                count = -1;
+            }
+        }
+#endif
+        return count;
+    }
+};
+
+static CacheMisses cacheMisses;
+
+struct Result {
+    double nsPerOp, missesPerOp;
+};
+
+/* Runs fn once, which does ops operations */
+template <typename F>
+static Result run(unsigned long long ops, F &&fn) {
+    cacheMisses.start();
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto stop = std::chrono::steady_clock::now();
+    long long misses = cacheMisses.stop();
+
+    double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+    return {ns / (double) ops, misses < 0 ? -1 : (double) misses / (double) ops};
+}
+
+/* Bytes per item, as held after less than before */
+static void report(const char *structure, const char *operation, Result r, double bytesPerItem = -1) {
+    char misses[32] = "n/a", bytes[32] = "";
+    if (r.missesPerOp >= 0) {
+        snprintf(misses, sizeof(misses), "%.2f", r.missesPerOp);
+    }
+#ifdef __GLIBC__
+    if (bytesPerItem >= 0) {
+        snprintf(bytes, sizeof(bytes), "%8.1f B/item", bytesPerItem);
+    }
+#else
+    (void) bytesPerItem;
+#endif
+    printf("%-10s %-44s %10.1f ns/op %8s misses/op %s\n", structure, operation, r.nsPerOp, misses, bytes);
+}
+
+/* Xorshift, so that every run makes the same choices */
+static uint32_t randomState = 0x9e3779b9;
+static uint32_t random(uint32_t range) {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState % range;
+}
+
+/* Most traffic goes to few topics: half of the picks are of the first 1/16 */
+static uint32_t skewed(uint32_t range) {
+    return random(2) ? random(range / 16 + 1) : random(range);
+}
+
+static void benchmarkTopicTree(unsigned int numSubscribers, unsigned int numTopics, unsigned int topicsPerSubscriber) {
+    char name[64];
+    unsigned long long delivered = 0;
+
+    uWS::TopicTree<std::string, std::string_view> topicTree([&delivered](uWS::Subscriber *, std::string &message, auto) {
+        delivered += message.length();
+        return false;
+    });
+
+    std::vector<std::string> topics;
+    for (unsigned int i = 0; i < numTopics; i++) {
+        topics.push_back("room/" + std::to_string(i) + "/messages");
+    }
+
+    std::vector<uWS::Subscriber *> subscribers(numSubscribers);
+    long long heldBefore = heldBytes;
+    Result r = run((unsigned long long) numSubscribers * topicsPerSubscriber, [&]() {
+        for (uWS::Subscriber *&s : subscribers) {
+            s = topicTree.createSubscriber();
+            for (unsigned int i = 0; i < topicsPerSubscriber; i++) {
+                topicTree.subscribe(s, topics[skewed(numTopics)]);
+            }
+        }
+    });
+    snprintf(name, sizeof(name), "subscribe %u x %u of %u topics", numSubscribers, topicsPerSubscriber, numTopics);
+    report("TopicTree", name, r, (double) (heldBytes - heldBefore) / ((double) numSubscribers * topicsPerSubscriber));
+
+    /* As a loop iteration would, a batch of publishes then a drain. Every delivery is work too, so fewer of
+     * them the more subscribers there are */
+    unsigned int publishes = std::clamp<unsigned int>(50000000 / numSubscribers, 500, 200000);
+    std::string message(64, 'm');
+    delivered = 0;
+    r = run(publishes, [&]() {
+        for (unsigned int i = 0; i < publishes; i++) {
+            topicTree.publish(nullptr, topics[skewed(numTopics)], std::string(message));
+            if (i % 16 == 15) {
+                topicTree.drain();
+            }
+        }
+        topicTree.drain();
+    });
+    snprintf(name, sizeof(name), "publish + drain (%.1f deliveries each)", (double) delivered / message.length() / publishes);
+    report("TopicTree", name, r);
+
+    /* Subscribers leaving and joining while others publish */
+    unsigned int churn = std::min<unsigned int>(publishes, numSubscribers);
+    r = run(churn, [&]() {
+        for (unsigned int i = 0; i < churn; i++) {
+            uWS::Subscriber *&s = subscribers[random(numSubscribers)];
+            topicTree.freeSubscriber(s);
+            s = topicTree.createSubscriber();
+            for (unsigned int j = 0; j < topicsPerSubscriber; j++) {
+                topicTree.subscribe(s, topics[skewed(numTopics)]);
+            }
+            topicTree.publish(nullptr, topics[skewed(numTopics)], std::string(message));
+            if (i % 16 == 15) {
+                topicTree.drain();
+            }
+        }
+        topicTree.drain();
+    });
+    snprintf(name, sizeof(name), "churn (free, subscribe %u, publish)", topicsPerSubscriber);
+    report("TopicTree", name, r);
+
+    r = run(numSubscribers, [&]() {
+        for (uWS::Subscriber *s : subscribers) {
+            topicTree.freeSubscriber(s);
+        }
+    });
+    report("TopicTree", "freeSubscriber", r);
+}
+
+static void benchmarkHttpRouter(unsigned int numRoutes) {
+    char name[64];
+    uWS::HttpRouter<int> router;
+
+    /* 60% static, 30% with parameters and 10% wildcards, and URLs to them in the same mix */
+    std::vector<std::string> patterns, urls;
+    for (unsigned int i = 0; i < numRoutes; i++) {
+        std::string n = std::to_string(i);
+        switch (i % 10) {
+        case 0:
+            patterns.push_back("/static/" + n + "/*");
+            urls.push_back("/static/" + n + "/css/site.css");
+            break;
+        case 1: case 2: case 3:
+            patterns.push_back("/api/v1/resource" + n + "/:id/items/:item");
+            urls.push_back("/api/v1/resource" + n + "/12345/items/678");
+            break;
+        default:
+            patterns.push_back("/api/v1/resource" + n + "/list");
+            urls.push_back("/api/v1/resource" + n + "/list");
+        }
+    }
+
+    unsigned long long matched = 0;
+    long long heldBefore = heldBytes;
+    Result r = run(numRoutes, [&]() {
+        for (std::string &pattern : patterns) {
+            router.add({"GET"}, pattern, [&matched](auto *) {
+                matched++;
+                return true;
+            });
+        }
+    });
+    snprintf(name, sizeof(name), "add %u routes", numRoutes);
+    report("HttpRouter", name, r, (double) (heldBytes - heldBefore) / numRoutes);
+
+    std::vector<unsigned int> picks(1 << 16);
+    for (unsigned int &pick : picks) {
+        pick = random(numRoutes);
+    }
+
+    unsigned int lookups = std::clamp<unsigned int>(100000000 / numRoutes, 10000, 1000000);
+    for (bool frozen : {false, true}) {
+        if (frozen) {
+            router.freeze();
+        }
+        r = run(lookups, [&]() {
+            for (unsigned int i = 0; i < lookups; i++) {
+                router.route("GET", urls[picks[i & 0xffff]]);
+            }
+        });
+        snprintf(name, sizeof(name), "route over %u routes%s", numRoutes, frozen ? " (frozen)" : "");
+        report("HttpRouter", name, r);
+    }
+
+    if (matched != 2ull * lookups) {
+        printf("Error: %llu of %u routed\n", matched, 2 * lookups);
+        exit(1);
+    }
+}
+
+int main() {
+    if (cacheMisses.fd == -1) {
+        printf("Cache misses are not available (perf_event_open), see /proc/sys/kernel/perf_event_paranoid\n");
+    }
+
+    for (unsigned int numSubscribers : {1000, 100000}) {
+        benchmarkTopicTree(numSubscribers, 1000, 4);
+    }
+    benchmarkTopicTree(10000, 10, 1);
+
+    for (unsigned int numRoutes : {10, 100, 1000, 10000}) {
+        benchmarkHttpRouter(numRoutes);
+    }
+}
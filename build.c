@@ -60,6 +60,12 @@ int main(int argc, char **argv) {
         strcat(LDFLAGS, " -luv");
     }
 
+    // WITH_IO_URING=1 builds with io_uring as event-loop (Linux only, cleartext only)
+    if (env_is("WITH_IO_URING", "1")) {
+        strcat(CXXFLAGS, " -DLIBUS_USE_IO_URING");
+        strcat(LDFLAGS, " -luring");
+    }
+
     // WITH_ASIO=1 builds with ASIO as event-loop
     if (env_is("WITH_ASIO", "1")) {
         strcat(CXXFLAGS, " -pthread");
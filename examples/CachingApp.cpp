@@ -11,7 +11,10 @@ int main() {
         /* A cached response with 5 seconds of lifetime */
         std::cout << "Filling cache now" << std::endl;
         res->end("This is a response");
-    }, 5).listen(8080, [](bool success) {
+    }, 5).get("/negotiated", [](auto *res, auto */*req*/) {
+        /* Cached apart per Accept-Encoding, at most 16 MB of cache in total */
+        res->end("This is a negotiated response");
+    }, 30, {"accept-encoding"}).setCacheBudget(16 * 1024 * 1024).listen(8080, [](bool success) {
         if (success) {
             std::cout << "Listening on port 8080" << std::endl;
         } else {
@@ -1,22 +1,26 @@
-// This example is broken and doesn't do anything. It is a potential interface for a future potential client.
+/* Connects to an echo server (like EchoServer) and sends a message every time one comes back */
 
 #include "ClientApp.h"
 #include <iostream>
 
 int main() {
     uWS::ClientApp app({
-        .open = [](/*auto *ws*/) {
+        .open = [](auto *ws) {
             std::cout << "Hello and welcome to client" << std::endl;
+            ws->send("Hello", uWS::OpCode::TEXT);
         },
-        .message = [](/*auto *ws, auto message*/) {
-
+        .message = [](auto *ws, std::string_view message, uWS::OpCode opCode) {
+            ws->send(message, opCode);
         },
-        .close = [](/*auto *ws*/) {
+        .close = [](auto */*ws*/, int /*code*/, std::string_view /*message*/) {
             std::cout << "bye" << std::endl;
+        },
+        .failed = [](int */*userData*/, std::string_view reason) {
+            std::cout << "Failed: " << reason << std::endl;
         }
     });
-    
+
     app.connect("ws://localhost:3000", "protocol");
-    
+
     app.run();
 }
@@ -3,7 +3,7 @@
 
 int main() {
     /* Note that SSL is disabled unless you build with WITH_OPENSSL=1 */
-    uWS::LocalCluster({
+    uWS::SSLLocalCluster({
         .key_file_name = "misc/key.pem",
         .cert_file_name = "misc/cert.pem",
         .passphrase = "1234"
@@ -6,7 +6,6 @@
 #include <fstream>
 
 /* This is an example serving a video over HTTP3, and echoing posted data back */
-/* Todo: use onWritable and tryEnd instead of end */
 int main() {
 
 	/* Read video file to memory */
@@ -44,8 +43,16 @@ int main() {
 	}).get("/*", [&buffer](auto *res, auto *req) {
 	    res->end("<html><h1>Welcome to HTTP3! <a href=\"video.mp4\">Go see a movie</a></html></h1>");
 	}).get("/video.mp4", [&buffer](auto *res, auto *req) {
-		/* Send back a video */
-	    res->end({&buffer[0], buffer.size()});
+		/* Send back a video, as much at a time as the stream takes */
+		std::string_view video(buffer.data(), buffer.size());
+		if (!res->tryEnd(video).second) {
+			res->onWritable([res, video](uintmax_t offset) {
+				return res->tryEnd(video.substr((size_t) offset), video.length()).first;
+			});
+			res->onAborted([]() {
+				std::cout << "Video stream was aborted" << std::endl;
+			});
+		}
 	}).post("/*", [](auto *res, auto *req) {
 
 		std::cout << "Got POST request at " << req->getHeader(":path") << std::endl;
@@ -1,11 +1,7 @@
 /* This is a simple HTTP(S) web server much like Python's SimpleHTTPServer */
 
 #include <App.h>
-
-/* Helpers for this example */
-#include "helpers/AsyncFileReader.h"
-#include "helpers/AsyncFileStreamer.h"
-#include "helpers/Middleware.h"
+#include <iostream>
 
 /* optparse */
 #define OPTPARSE_IMPLEMENTATION
@@ -60,15 +56,12 @@ int main(int argc, char **argv) {
         goto fail;
     }
 
-    AsyncFileStreamer asyncFileStreamer(root);
-
     /* Either serve over HTTP or HTTPS */
     uWS::SocketContextOptions empty_ssl_options = {};
     if (memcmp(&ssl_options, &empty_ssl_options, sizeof(empty_ssl_options))) {
         /* HTTPS */
-        uWS::SSLApp(ssl_options).get("/*", [&asyncFileStreamer](auto *res, auto *req) {
-            serveFile(res, req);
-            asyncFileStreamer.streamFile(res, req->getUrl());
+        uWS::SSLApp(ssl_options).serveStatic("/", root).any("/*", [](auto *res, auto */*req*/) {
+            res->writeStatus("404 Not Found")->end("Not found");
         }).listen(port, [port, root](auto *token) {
             if (token) {
                 std::cout << "Serving " << root << " over HTTPS a " << port << std::endl;
@@ -76,9 +69,8 @@ int main(int argc, char **argv) {
         }).run();
     } else {
         /* HTTP */
-        uWS::App().get("/*", [&asyncFileStreamer](auto *res, auto *req) {
-            serveFile(res, req);
-            asyncFileStreamer.streamFile(res, req->getUrl());
+        uWS::App().serveStatic("/", root).any("/*", [](auto *res, auto */*req*/) {
+            res->writeStatus("404 Not Found")->end("Not found");
         }).listen(port, [port, root](auto *token) {
             if (token) {
                 std::cout << "Serving " << root << " over HTTP a " << port << std::endl;
@@ -0,0 +1,18 @@
+/* Serves /api/ from an upstream on port 8080 (with /api/ taken off), everything else from here */
+
+#include "ReverseProxy.h"
+
+int main() {
+    /* One proxy per loop, for its pool of upstream connections */
+    uWS::ReverseProxy proxy({.host = "127.0.0.1", .port = 8080});
+
+    uWS::App().any("/api/*", [&proxy](auto *res, auto *req) {
+        proxy.forward(res, req, req->getFullUrl().substr(4));
+    }).get("/*", [](auto *res, auto */*req*/) {
+        res->end("Hello from the edge!");
+    }).listen(3000, [](auto *listen_socket) {
+        if (listen_socket) {
+            std::cout << "Listening on port " << 3000 << std::endl;
+        }
+    }).run();
+}
@@ -1,80 +1,510 @@
+/* Runs an example against fake sockets, all in process. By default it serves the same HTTP request on every read and
+ * prints requests per second. With UWS_PROFILE set it is a profile instead: synthetic traffic for a number of loop
+ * iterations, then the syscalls made, the bytes of each, and the writes per request or message.
+ *
+ * UWS_PROFILE=http           HelloWorld and the like, UWS_PROFILE_PIPELINE requests per read
+ * UWS_PROFILE=websocket      EchoServer and the like, upgrade then UWS_PROFILE_PIPELINE messages per read
+ *                            of UWS_PROFILE_MESSAGE_SIZE bytes
+ * UWS_PROFILE=broadcast      Broadcast and the like, upgrade then nothing but what timers publish
+ * UWS_PROFILE_CONNECTIONS    connections (10)
+ * UWS_PROFILE_ITERATIONS     loop iterations (100000), each one a millisecond to timers
+ *
+ * Timers run on that clock, but for the timeout sweep (every 4 seconds) which never runs, so nothing times out.
+ *
+ * UWS_REPLAY=capture         replays what Loop::captureTraffic recorded instead, connection by connection, every
+ *                            read as it was received, then reports the same. As fast as it goes (timers ticking a
+ *                            millisecond per iteration) or with UWS_REPLAY_PACED=1 at the pace it was recorded */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include <sys/timerfd.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <errno.h>
+#include <unistd.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "TrafficCapture.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define NUM_SOCKETS 10
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+ssize_t __real_sendmsg(int sockfd, const struct msghdr *msg, int flags);
+int __real_timerfd_create(int clockid, int flags);
+int __real_timerfd_settime(int fd, int flags, const struct itimerspec *new_value, struct itimerspec *old_value);
+
+#define MAX_SOCKETS 1024
+static int num_sockets = 10;
 uint64_t listen_socket_epoll_data = 0;
-epoll_event ready_events[NUM_SOCKETS] = {};
+epoll_event ready_events[MAX_SOCKETS] = {};
 static int accepted_sockets = 0;
 
+/* What the profile feeds, and counts */
+enum {
+	NO_PROFILE,
+	HTTP,
+	WEBSOCKET,
+	BROADCAST,
+	REPLAY
+};
+static int profile = NO_PROFILE;
+static int pipeline = 1;
+static long long iterations = 100000;
+static int message_size = 20;
+
+static const char http_request[] =
+    "GET /joyent/http-parser HTTP/1.1\r\n"
+    "Host: github.com\r\n"
+    "DNT: 1\r\n"
+    "Accept-Encoding: gzip, deflate, sdch\r\n"
+    "Accept-Language: ru-RU,ru;q=0.8,en-US;q=0.6,en;q=0.4\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_10_1) "
+        "AppleWebKit/537.36 (KHTML, like Gecko) "
+        "Chrome/39.0.2171.65 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+        "image/webp,*/*;q=0.8\r\n"
+    "Referer: https://github.com/joyent/http-parser\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n\r\n";
+
+static const char upgrade_request[] =
+    "GET / HTTP/1.1\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Key: x3JJHMbDL1EzLkh9GBhXDw==\r\n"
+    "Host: server.example.com\r\n"
+    "Sec-WebSocket-Version: 13\r\n\r\n";
+
+/* What every read of a connection gets (once upgraded, for WebSockets) */
+static char *traffic;
+static size_t traffic_length;
+static int upgraded[MAX_SOCKETS];
+
+/* Calls and bytes of every syscall we see, since warm up */
+enum {
+	SYS_EPOLL_WAIT,
+	SYS_EPOLL_CTL,
+	SYS_ACCEPT4,
+	SYS_RECV,
+	SYS_SEND,
+	SYS_SENDTO,
+	SYS_SENDMSG,
+	SYS_WRITEV,
+	SYS_READ_TIMER,
+	SYS_TIMERFD_SETTIME,
+	NUM_SYSCALLS
+};
+static const char *syscall_names[NUM_SYSCALLS] = {"epoll_wait", "epoll_ctl", "accept4", "recv", "send", "sendto", "sendmsg",
+	"writev", "read (timerfd)", "timerfd_settime"};
+static unsigned long long calls[NUM_SYSCALLS], bytes[NUM_SYSCALLS];
+
+/* Requests or messages fed, or deliveries of what fast timers published */
+static unsigned long long units;
+
+/* Timers are fake file descriptors too, fired on a clock of one millisecond per iteration */
+#define FIRST_TIMER 400
+#define MAX_TIMERS 64
+#define SWEEP_INTERVAL_MS 4000
+struct timer {
+	uint64_t epoll_data;
+	long long next_ms, interval_ms;
+	uint64_t expirations;
+	int registered, armed;
+};
+static struct timer timers[MAX_TIMERS];
+static int num_timers = 0;
+static long long now_ms = 0, iteration = 0;
+
+/* Replayed connections, by slot (file descriptor 501 onwards), with what they are yet to read */
+struct replayed {
+	unsigned int connection;
+	const char *data;
+	size_t length;
+	int in_use, eof;
+};
+static uWS::TrafficCaptureReader capture;
+static uWS::CapturedRecord next_record;
+static int has_next_record = 0, paced = 0;
+static struct replayed slots[MAX_SOCKETS];
+static std::unordered_map<unsigned int, int> slot_of;
+static std::vector<int> free_slots, pending_accepts;
+static unsigned long long replayed_connections = 0, replayed_bytes = 0;
+static long long started_us = 0;
+
+static long long monotonic_us() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ll + ts.tv_nsec / 1000;
+}
+
+static void count(int sys, size_t length) {
+	calls[sys]++;
+	bytes[sys] += length;
+}
+
+static void init() {
+	static int initialized = 0;
+	if (initialized) {
+		return;
+	}
+	initialized = 1;
+
+	const char *value = getenv("UWS_REPLAY");
+	if (value) {
+		if (!capture.open(value)) {
+			fprintf(stderr, "Error: %s is no capture\n", value);
+			exit(1);
+		}
+		profile = REPLAY;
+		paced = getenv("UWS_REPLAY_PACED") && atoi(getenv("UWS_REPLAY_PACED"));
+		has_next_record = capture.next(next_record);
+		for (int i = MAX_SOCKETS; i--; ) {
+			free_slots.push_back(i);
+		}
+		num_sockets = 0;
+		started_us = monotonic_us();
+		return;
+	}
+
+	value = getenv("UWS_PROFILE");
+	if (!value) {
+		return;
+	}
+	profile = !strcmp(value, "websocket") ? WEBSOCKET : (!strcmp(value, "broadcast") ? BROADCAST : HTTP);
+	if ((value = getenv("UWS_PROFILE_PIPELINE"))) {
+		pipeline = atoi(value) > 0 ? atoi(value) : 1;
+	}
+	if ((value = getenv("UWS_PROFILE_ITERATIONS"))) {
+		iterations = atoll(value);
+	}
+	if ((value = getenv("UWS_PROFILE_CONNECTIONS"))) {
+		num_sockets = atoi(value) < 1 ? 1 : (atoi(value) > MAX_SOCKETS ? MAX_SOCKETS : atoi(value));
+	}
+	if ((value = getenv("UWS_PROFILE_MESSAGE_SIZE"))) {
+		message_size = atoi(value) < 0 ? 0 : (atoi(value) > 65535 ? 65535 : atoi(value));
+	}
+
+	if (profile == HTTP) {
+		traffic_length = (sizeof(http_request) - 1) * pipeline;
+		traffic = (char *) malloc(traffic_length);
+		for (int i = 0; i < pipeline; i++) {
+			memcpy(traffic + i * (sizeof(http_request) - 1), http_request, sizeof(http_request) - 1);
+		}
+	} else if (profile == WEBSOCKET) {
+		/* Masked with zeros, so the payload goes as it is */
+		size_t header_length = message_size < 126 ? 6 : 8;
+		traffic_length = (header_length + message_size) * pipeline;
+		traffic = (char *) malloc(traffic_length);
+		for (int i = 0; i < pipeline; i++) {
+			unsigned char *frame = (unsigned char *) traffic + i * (header_length + message_size);
+			memset(frame, 0, header_length);
+			memset(frame + header_length, 'T', message_size);
+			frame[0] = 130;
+			if (header_length == 6) {
+				frame[1] = (unsigned char) (128 | message_size);
+			} else {
+				frame[1] = 128 | 126;
+				frame[2] = (unsigned char) (message_size >> 8);
+				frame[3] = (unsigned char) message_size;
+			}
+		}
+	}
+}
+
+static const char *unit_name() {
+	return profile == HTTP ? "request" : (profile == WEBSOCKET ? "message" : (profile == REPLAY ? "read" : "delivery"));
+}
+
+static const char *units_name() {
+	return profile == HTTP ? "requests" : (profile == WEBSOCKET ? "messages" : (profile == REPLAY ? "reads" : "deliveries"));
+}
+
+static void report() {
+	unsigned long long writes = calls[SYS_SEND] + calls[SYS_SENDTO] + calls[SYS_SENDMSG] + calls[SYS_WRITEV];
+	unsigned long long written = bytes[SYS_SEND] + bytes[SYS_SENDTO] + bytes[SYS_SENDMSG] + bytes[SYS_WRITEV];
+	unsigned long long syscalls = 0;
+	for (int i = 0; i < NUM_SYSCALLS; i++) {
+		syscalls += calls[i];
+	}
+	double per = units ? 1.0 / units : 0;
+
+	if (profile == REPLAY) {
+		double seconds = (monotonic_us() - started_us) / 1000000.0;
+		printf("Replayed %llu connections, %llu bytes in %llu reads, in %.3f s (%.1f MB/s)%s\n", replayed_connections,
+			replayed_bytes, units, seconds, seconds > 0 ? replayed_bytes / seconds / 1000000.0 : 0.0, paced ? " as paced" : "");
+	} else {
+		printf("%s profile: %d connections, %d per read, %lld iterations, %llu %s\n",
+			profile == HTTP ? "HTTP" : (profile == WEBSOCKET ? "WebSocket" : "Broadcast"), num_sockets, pipeline, iterations, units, units_name());
+	}
+	printf("%-16s %12s %12s %12s\n", "syscall", "calls", "per unit", "bytes/call");
+	for (int i = 0; i < NUM_SYSCALLS; i++) {
+		if (calls[i]) {
+			printf("%-16s %12llu %12.3f %12.1f\n", syscall_names[i], calls[i], calls[i] * per, (double) bytes[i] / calls[i]);
+		}
+	}
+	printf("syscalls per %s: %.3f\n", unit_name(), syscalls * per);
+	printf("writes per %s: %.3f\n", unit_name(), writes * per);
+	printf("bytes out per %s: %.1f\n", unit_name(), written * per);
+	printf("bytes per write: %.1f\n", writes ? (double) written / writes : 0.0);
+}
+
+static struct timer *get_timer(int fd) {
+	return fd >= FIRST_TIMER && fd < FIRST_TIMER + num_timers ? &timers[fd - FIRST_TIMER] : NULL;
+}
+
 int __wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+	init();
+	count(SYS_EPOLL_CTL, 0);
 
 	// the listen socket
 	if (fd == 500) {
 		listen_socket_epoll_data = event->data.u64;
 		return 0;
+	} else if (fd > 500 && profile == REPLAY && op == EPOLL_CTL_DEL) {
+		/* Closed by the server, what is left of it is dropped */
+		struct replayed *slot = &slots[fd - 500 - 1];
+		if (slot->in_use) {
+			slot_of.erase(slot->connection);
+			slot->in_use = 0;
+			free_slots.push_back(fd - 500 - 1);
+		}
+		return 0;
 	} else {
 		if (fd < 500) {
-
+			struct timer *timer = get_timer(fd);
+			if (timer && event) {
+				timer->epoll_data = event->data.u64;
+				timer->registered = op != EPOLL_CTL_DEL;
+			}
 		} else {
 			// on our FDs
 			ready_events[fd - 500 - 1].data.u64 = event->data.u64;
 			ready_events[fd - 500 - 1].events = EPOLLIN;
 		}
-		
+
 		return 0;
 	}
 }
 
+static int fire_timers(struct epoll_event *events, int maxevents);
+
+/* Hands out the records of the capture in order, as many at once as we can without reordering any connection */
+static int replay(struct epoll_event *events, int maxevents) {
+	count(SYS_EPOLL_WAIT, 0);
+	if (paced) {
+		now_ms = (monotonic_us() - started_us) / 1000;
+	} else {
+		now_ms++;
+	}
+
+	/* Accepted on their own, before anything else */
+	if (pending_accepts.size()) {
+		events[0].events = EPOLLIN;
+		events[0].data.u64 = listen_socket_epoll_data;
+		return 1;
+	}
+
+	int ready = fire_timers(events, maxevents);
+
+	/* What was not read whole the last time */
+	for (int i = 0; i < MAX_SOCKETS && ready < maxevents; i++) {
+		if (slots[i].in_use && (slots[i].length || slots[i].eof)) {
+			events[ready++] = ready_events[i];
+		}
+	}
+	int left_over = ready;
+
+	while (has_next_record && ready < maxevents) {
+		if (paced) {
+			long long due = started_us + (long long) next_record.microseconds, now = monotonic_us();
+			if (due > now) {
+				if (ready) {
+					break;
+				}
+				usleep((useconds_t) (due - now));
+			}
+		}
+
+		if (next_record.kind == uWS::TrafficCapture::OPEN) {
+			/* Connections past what we have slots for are not replayed */
+			if (free_slots.size()) {
+				int index = free_slots.back();
+				free_slots.pop_back();
+				slots[index] = {next_record.connection, NULL, 0, 1, 0};
+				slot_of[next_record.connection] = index;
+				pending_accepts.push_back(index);
+				replayed_connections++;
+			}
+			has_next_record = capture.next(next_record);
+			break;
+		}
+
+		auto it = slot_of.find(next_record.connection);
+		if (it != slot_of.end()) {
+			struct replayed *slot = &slots[it->second];
+			if (slot->length || slot->eof) {
+				break;
+			}
+			if (next_record.kind == uWS::TrafficCapture::DATA) {
+				slot->data = next_record.data.data();
+				slot->length = next_record.data.length();
+				replayed_bytes += slot->length;
+				units++;
+			} else {
+				slot->eof = 1;
+			}
+			events[ready++] = ready_events[it->second];
+		}
+		has_next_record = capture.next(next_record);
+	}
+
+	if (!ready && !left_over && !has_next_record && !pending_accepts.size()) {
+		report();
+		exit(0);
+	}
+	if (!ready && pending_accepts.size()) {
+		events[0].events = EPOLLIN;
+		events[0].data.u64 = listen_socket_epoll_data;
+		return 1;
+	}
+	return ready;
+}
+
 int __wrap_epoll_wait(int epfd, struct epoll_event *events,
                int maxevents, int timeout) {
+	init();
 
-	if (accepted_sockets != NUM_SOCKETS) {
+	if (accepted_sockets != num_sockets) {
 		events[0].events = EPOLLIN;
 		events[0].data.u64 = listen_socket_epoll_data;
 		return 1;
-	} else {
-		for (int i = 0; i < NUM_SOCKETS; i++) {
+	}
+
+	if (profile == NO_PROFILE) {
+		for (int i = 0; i < num_sockets; i++) {
 			events[i] = ready_events[i];
 		}
-		return NUM_SOCKETS;
+		return num_sockets;
+	}
+
+	if (profile == REPLAY) {
+		return replay(events, maxevents);
+	}
+
+	/* The first iterations upgrade and warm up */
+	if (iteration++ == 2) {
+		memset(calls, 0, sizeof(calls));
+		memset(bytes, 0, sizeof(bytes));
+		units = 0;
+	} else if (iteration == iterations + 3) {
+		report();
+		exit(0);
 	}
+	count(SYS_EPOLL_WAIT, 0);
+	now_ms++;
+
+	int ready = fire_timers(events, maxevents);
+	for (int i = 0; i < num_sockets && ready < maxevents; i++) {
+		/* Broadcast subscribers only ever send their upgrade */
+		if (profile != BROADCAST || !upgraded[i]) {
+			events[ready++] = ready_events[i];
+		}
+	}
+	return ready;
+}
+
+static int fire_timers(struct epoll_event *events, int maxevents) {
+	int ready = 0;
+	for (int i = 0; i < num_timers && ready < maxevents; i++) {
+		struct timer *timer = &timers[i];
+		if (timer->registered && timer->armed && timer->next_ms <= now_ms && timer->interval_ms != SWEEP_INTERVAL_MS) {
+			timer->expirations++;
+			if (timer->interval_ms) {
+				timer->next_ms += timer->interval_ms;
+			} else {
+				timer->armed = 0;
+			}
+			/* What fast timers publish goes to every connection */
+			if (profile == BROADCAST && timer->interval_ms && timer->interval_ms < 1000) {
+				units += num_sockets;
+			}
+			events[ready].events = EPOLLIN;
+			events[ready++].data.u64 = timer->epoll_data;
+		}
+	}
+	return ready;
 }
 
 int __wrap_recv(int sockfd, void *buf, size_t len, int flags) {
-	const char request[] =
-    "GET /joyent/http-parser HTTP/1.1\r\n"
-    "Host: github.com\r\n"
-    "DNT: 1\r\n"
-    "Accept-Encoding: gzip, deflate, sdch\r\n"
-    "Accept-Language: ru-RU,ru;q=0.8,en-US;q=0.6,en;q=0.4\r\n"
-    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_10_1) "
-        "AppleWebKit/537.36 (KHTML, like Gecko) "
-        "Chrome/39.0.2171.65 Safari/537.36\r\n"
-    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
-        "image/webp,*/*;q=0.8\r\n"
-    "Referer: https://github.com/joyent/http-parser\r\n"
-    "Connection: keep-alive\r\n"
-    "Cache-Control: max-age=0\r\n\r\n";
+	init();
+
+	if (profile == NO_PROFILE) {
+		memcpy(buf, http_request, sizeof(http_request) - 1);
+		return sizeof(http_request) - 1;
+	}
+
+	count(SYS_RECV, 0);
+	int index = sockfd - 500 - 1;
+	if (profile == REPLAY) {
+		struct replayed *slot = &slots[index];
+		if (!slot->in_use || (!slot->length && !slot->eof)) {
+			errno = EAGAIN;
+			return -1;
+		}
+		if (!slot->length) {
+			slot->eof = 0;
+			return 0;
+		}
+		size_t length = slot->length < len ? slot->length : len;
+		memcpy(buf, slot->data, length);
+		slot->data += length;
+		slot->length -= length;
+		bytes[SYS_RECV] += length;
+		return (int) length;
+	}
+
+	const char *data = traffic;
+	size_t length = traffic_length;
+	if (profile != HTTP && !upgraded[index]) {
+		upgraded[index] = 1;
+		data = upgrade_request;
+		length = sizeof(upgrade_request) - 1;
+	} else if (profile == BROADCAST) {
+		errno = EAGAIN;
+		return -1;
+	} else {
+		units += pipeline;
+	}
 
-	memcpy(buf, request, sizeof(request) - 1);
-	return sizeof(request) - 1;
+	if (length > len) {
+		length = len;
+	}
+	memcpy(buf, data, length);
+	bytes[SYS_RECV] += length;
+	return (int) length;
 }
 
 int __wrap_send(int sockfd, const void *buf, size_t len, int flags) {
+	init();
+
+	if (profile != NO_PROFILE) {
+		count(SYS_SEND, len);
+		return len;
+	}
+
 	static int sent = 0;
 	static clock_t lastTime = clock();
 	if (++sent == 1000000) {
@@ -89,6 +519,71 @@ int __wrap_send(int sockfd, const void *buf, size_t len, int flags) {
 	return len;
 }
 
+ssize_t __wrap_sendto(int sockfd, const void *buf, size_t len, int flags, const struct sockaddr *dest_addr, socklen_t addrlen) {
+	count(SYS_SENDTO, len);
+	return len;
+}
+
+ssize_t __wrap_sendmsg(int sockfd, const struct msghdr *msg, int flags) {
+	if (sockfd <= 500) {
+		return __real_sendmsg(sockfd, msg, flags);
+	}
+	size_t length = 0;
+	for (size_t i = 0; i < msg->msg_iovlen; i++) {
+		length += msg->msg_iov[i].iov_len;
+	}
+	count(SYS_SENDMSG, length);
+	return length;
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt) {
+	if (fd <= 500) {
+		return __real_writev(fd, iov, iovcnt);
+	}
+	size_t length = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		length += iov[i].iov_len;
+	}
+	count(SYS_WRITEV, length);
+	return length;
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count_) {
+	struct timer *timer = get_timer(fd);
+	if (!timer || count_ < 8) {
+		return __real_read(fd, buf, count_);
+	}
+	count(SYS_READ_TIMER, 8);
+	memcpy(buf, &timer->expirations, 8);
+	timer->expirations = 0;
+	return 8;
+}
+
+int __wrap_timerfd_create(int clockid, int flags) {
+	init();
+	if (profile == NO_PROFILE || num_timers == MAX_TIMERS) {
+		return __real_timerfd_create(clockid, flags);
+	}
+	memset(&timers[num_timers], 0, sizeof(struct timer));
+	return FIRST_TIMER + num_timers++;
+}
+
+int __wrap_timerfd_settime(int fd, int flags, const struct itimerspec *new_value, struct itimerspec *old_value) {
+	struct timer *timer = get_timer(fd);
+	if (!timer) {
+		return __real_timerfd_settime(fd, flags, new_value, old_value);
+	}
+	count(SYS_TIMERFD_SETTIME, 0);
+	if (old_value) {
+		memset(old_value, 0, sizeof(struct itimerspec));
+	}
+	long long value_ms = new_value->it_value.tv_sec * 1000 + new_value->it_value.tv_nsec / 1000000;
+	timer->interval_ms = new_value->it_interval.tv_sec * 1000 + new_value->it_interval.tv_nsec / 1000000;
+	timer->armed = new_value->it_value.tv_sec || new_value->it_value.tv_nsec;
+	timer->next_ms = now_ms + (value_ms ? value_ms : 1);
+	return 0;
+}
+
 int __wrap_bind() {
 	return 0;
 }
@@ -98,7 +593,18 @@ int __wrap_setsockopt() {
 }
 
 int __wrap_accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
-	if (accepted_sockets < NUM_SOCKETS) {
+	init();
+	count(SYS_ACCEPT4, 0);
+	if (profile == REPLAY) {
+		if (!pending_accepts.size()) {
+			errno = EAGAIN;
+			return -1;
+		}
+		int index = pending_accepts.front();
+		pending_accepts.erase(pending_accepts.begin());
+		return index + 501;
+	}
+	if (accepted_sockets < num_sockets) {
 		accepted_sockets++;
 		return accepted_sockets + 500;
 	} else {
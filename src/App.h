@@ -20,10 +20,16 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 
+#include <cstddef>
 #include <string>
 #include <charconv>
 #include <string_view>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 namespace uWS {
     /* Safari 15.0 - 15.3 has a completely broken compression implementation (client_no_context_takeover not
      * properly implemented) - so we fully disable compression for this browser :-(
@@ -60,6 +66,9 @@ namespace uWS {
 #include "WebSocketContext.h"
 #include "WebSocket.h"
 #include "PerMessageDeflate.h"
+#include "PubSubBus.h"
+#include "StaticFiles.h"
+#include "TLSSessionCache.h"
 
 namespace uWS {
 
@@ -73,20 +82,35 @@ namespace uWS {
         const char *ssl_ciphers = nullptr;      // SSL 密码套件列表
         int ssl_prefer_low_memory_usage = 0;    // 是否优先考虑低内存使用
 
+        /* Ours, past what uSockets takes: sessions resumed by every app sharing it, see TLSSessionCache.h */
+        TLSSessionCache *session_cache = nullptr;
+
         // 这是一个转换操作符，允许将 SocketContextOptions 对象隐式转换为 us_socket_context_options_t 类型
         /* Conversion operator used internally */
         operator struct us_socket_context_options_t() const {
             struct us_socket_context_options_t socket_context_options;
-            memcpy(&socket_context_options, this, sizeof(SocketContextOptions));
+            memcpy(&socket_context_options, this, sizeof(struct us_socket_context_options_t));
             return socket_context_options;
         }
     };
 
     // 确保 us_socket_context_options_t 和 SocketContextOptions 的大小相同
-    static_assert(sizeof(struct us_socket_context_options_t) == sizeof(SocketContextOptions), "Mismatching uSockets/uWebSockets ABI");
+    static_assert(offsetof(SocketContextOptions, session_cache) == sizeof(struct us_socket_context_options_t), "Mismatching uSockets/uWebSockets ABI");
+
+/* What a socket takes of ours, past what uSockets takes: always the ext, and a side block of the loop (or the heap,
+ * if it does not fit in one) while it has per request handlers or fragment and deflate state */
+struct SocketExtSizes {
+    size_t http, webSocket;
+    size_t httpSideBlock, webSocketSideBlock, sideBlockCell;
+};
+
+template <bool> struct TemplatedLocalCluster;
 
 template <bool SSL, typename BuilderPatternReturnType>
 struct TemplatedApp {
+    template <bool> friend struct TemplatedLocalCluster;
+    template <bool> friend struct TemplatedHandoff;
+
 private:
     /* The app always owns at least one http context, but creates websocket contexts on demand */
     HttpContext<SSL> *httpContext;
@@ -95,17 +119,46 @@ private:
 
     std::vector<void *> webSocketContexts;
 
+    /* The bus we receive cross-thread publishes from, if joined */
+    PubSubBus *bus = nullptr;
+    unsigned int busLane = 0;
+
+    /* Told of every socket we listen on, such as by a LocalCluster steering connections */
+    MoveOnlyFunction<void(us_listen_socket_t *)> listenObserver = nullptr;
+
+    us_listen_socket_t *observeListen(us_listen_socket_t *listenSocket) {
+        if (listenSocket && listenObserver) {
+            listenObserver(listenSocket);
+        }
+        return listenSocket;
+    }
+
+    void joinBusLane(PubSubBus *bus) {
+        this->bus = bus;
+        busLane = bus->join([this](std::string_view topic, const SharedBuffer &message, OpCode opCode, bool compress) {
+            /* Nobody can be subscribed before the first WebSocket route */
+            if (topicTree) {
+                publish(topic, message, opCode, compress);
+            }
+        });
+    }
+
 public:
 
     TopicTree<TopicTreeMessage, TopicTreeBigMessage> *topicTree = nullptr;
 
-    /* Server name */
+    /* Server name. Its connections resume with the session_cache of the app, as OpenSSL keeps to the context
+     * they began with for that, and never with one of their own */
     BuilderPatternReturnType &&addServerName(std::string hostname_pattern, SocketContextOptions options = {}) {
 
         /* Do nothing if not even on SSL */
         if constexpr (SSL) {
-            /* First we create a new router for this domain */
+            /* First we create a new router for this domain (unless all route with the default one) */
+#ifndef UWS_NO_SNI_ROUTING
             auto *domainRouter = new HttpRouter<typename HttpContextData<SSL>::RouterData>();
+#else
+            void *domainRouter = nullptr;
+#endif
 
             us_socket_context_add_server_name(SSL, (struct us_socket_context_t *) httpContext, hostname_pattern.c_str(), options, domainRouter);
         }
@@ -146,35 +199,167 @@ public:
         return us_socket_context_get_native_handle(SSL, (struct us_socket_context_t *) httpContext);
     }
 
+    /* Serves HTTP/2 next to HTTP/1.1 on the listen sockets of this app: over TLS as agreed by ALPN (when built
+     * against OpenSSL), in cleartext with prior knowledge or by h2c upgrade. HTTP/2 has routes of its own,
+     * added to the context returned (created on first call) */
+    Http2Context<SSL> *http2() {
+#ifdef UWS_NO_HTTP2
+        static_assert(SSL && !SSL, "App::http2 is compiled out by UWS_NO_HTTP2");
+#endif
+        HttpContextData<SSL> *httpContextData = httpContext->getSocketContextData();
+        if (!httpContextData->http2Context) {
+            Http2Context<SSL> *http2Context = Http2Context<SSL>::create((us_socket_context_t *) httpContext);
+            httpContextData->http2Context = http2Context;
+
+            /* Freed with our websocket contexts, but not one of them when migrating */
+            webSocketContextDeleters.push_back([http2Context]() {
+                http2Context->free();
+            });
+
+            if constexpr (SSL) {
+#ifdef LIBUS_USE_OPENSSL
+                if (SSL_CTX *ctx = (SSL_CTX *) getNativeHandle()) {
+                    SSL_CTX_set_alpn_select_cb(ctx, Http2Context<SSL>::selectProtocol, nullptr);
+                }
+#endif
+            }
+        }
+        return httpContextData->http2Context;
+    }
+
     /* Attaches a "filter" function to track socket connections/disconnections */
     BuilderPatternReturnType &&filter(MoveOnlyFunction<void(HttpResponse<SSL> *, int)> &&filterHandler) {
+#ifdef UWS_NO_HTTP_FILTERS
+        static_assert(SSL && !SSL, "App::filter is compiled out by UWS_NO_HTTP_FILTERS");
+#endif
         httpContext->filter(std::move(filterHandler));
 
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
+    /* Limits the rate of connections and requests of every remote address (behind a proxy with UWS_WITH_PROXY,
+     * of every source address), turning them away before anything is parsed (see RateLimiter.h) */
+    BuilderPatternReturnType &&rateLimit(RateLimiterOptions options) {
+        httpContext->getSocketContextData()->rateLimiter = std::make_unique<RateLimiter>(options);
+
+        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    }
+
+    /* Routes declared from now on keep histograms of their latency (route matched to end) and of bytes sent,
+     * with the count of those aborted, by our loop only. Call it on every child app too, see getRouteStats */
+    BuilderPatternReturnType &&routeMetrics() {
+        httpContext->getSocketContextData()->recordRouteMetrics = true;
+
+        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    }
+
     /* Publishes a message to all websocket contexts - conceptually as if publishing to the one single
      * TopicTree of this app (technically there are many TopicTrees, however the concept is that one
      * app has one conceptual Topic tree) */
     bool publish(std::string_view topic, std::string_view message, OpCode opCode, bool compress = false) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) Loop::get());
+
         /* Anything big bypasses corking efforts */
-        if (message.length() >= LoopData::CORK_BUFFER_SIZE) {
-            return topicTree->publishBig(nullptr, topic, {message, opCode, compress}, [](Subscriber *s, TopicTreeBigMessage &message) {
-                auto *ws = (WebSocket<SSL, true, int> *) s->user;
+        if (message.length() >= loopData->corkBufferSize) {
+            /* Deflate once, for every subscriber sharing the compressor */
+            if (compress && opCode < 3) {
+                return publish(topic, PreparedMessage(message, opCode, true));
+            }
 
-                /* Send will drain if needed */
-                ws->send(message.message, (OpCode)message.opCode, message.compress);
-            });
+            /* Copy once, so that subscribers with backpressure can all reference the same buffer */
+            if constexpr (!SSL) {
+                return publish(topic, SharedBuffer::copy(message), opCode, compress);
+            }
+
+            /* Topics keeping a history keep its frame on the side */
+            if (TopicHistory *history = topicTree->lookupHistory(topic)) {
+                history->push(PreparedMessage::frameOf(message, opCode));
+            }
+            loopData->observeMessage(message.length());
+            std::string frame;
+            return topicTree->publishBig(nullptr, topic, {message, opCode, compress}, [&frame](Subscriber *s, TopicTreeBigMessage &bigMessage) {
+                return sendBigToSubscriber<SSL>(s, bigMessage, bigMessage.message, frame);
+            }, message.length());
         } else {
-            return topicTree->publish(nullptr, topic, {std::string(message), opCode, compress});
+            /* Topics keeping a history keep its frame on the side */
+            if (TopicHistory *history = topicTree->lookupHistory(topic)) {
+                history->push(PreparedMessage::frameOf(message, opCode));
+            }
+            loopData->observeMessage(message.length());
+            return topicTree->publish(nullptr, topic, {std::string(message), opCode, compress}, message.length());
         }
     }
 
-    /* Returns number of subscribers for this topic, or 0 for failure.
-     * This function should probably be optimized a lot in future releases,
-     * it could be O(1) with a hash map of fullnames and their counts. */
+    /* Publishes a shared buffer, see above. Big messages are sent to every subscriber without copying */
+    bool publish(std::string_view topic, const SharedBuffer &message, OpCode opCode, bool compress = false) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) Loop::get());
+        if (message.length() < loopData->corkBufferSize || (compress && opCode < 3)) {
+            return publish(topic, message.view(), opCode, compress);
+        }
+        if (TopicHistory *history = topicTree->lookupHistory(topic)) {
+            history->push(PreparedMessage::frameOf(message.view(), opCode));
+        }
+        loopData->observeMessage(message.length());
+
+        std::string frame;
+        return topicTree->publishBig(nullptr, topic, {message.view(), opCode, compress}, [&message, &frame](Subscriber *s, TopicTreeBigMessage &bigMessage) {
+            return sendBigToSubscriber<SSL>(s, bigMessage, message, frame);
+        }, message.length());
+    }
+
+    /* Publishes a prepared message, framed and compressed once no matter the number of subscribers */
+    bool publish(std::string_view topic, const PreparedMessage &message) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) Loop::get());
+        loopData->observeMessage(message.getMessage().length());
+
+        if (TopicHistory *history = topicTree->lookupHistory(topic)) {
+            history->push(message.frame);
+        }
+
+        std::string frame;
+        return topicTree->publishBig(nullptr, topic, {message.getMessage(), message.getOpCode(), message.isCompressed()}, [&message, &frame](Subscriber *s, TopicTreeBigMessage &bigMessage) {
+            return sendBigToSubscriber<SSL>(s, bigMessage, message, frame);
+        }, message.getMessage().length());
+    }
+
+    /* Receives every message published to bus, from any thread, as if published to this app.
+     * Call on the thread of this app, which leaves the bus again when freed */
+    BuilderPatternReturnType &&joinBus(PubSubBus &bus) {
+        if (this->bus) {
+            this->bus->leave(busLane);
+        }
+        joinBusLane(&bus);
+
+        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    }
+
+    /* Keeps the last maxMessages published to topic for late joiners and reconnects to catch up on, see
+     * WebSocket::subscribeFrom. The topic stays without subscribers, until called again with 0 */
+    BuilderPatternReturnType &&keepHistory(std::string_view topic, unsigned int maxMessages) {
+        if (!topicTree) {
+            std::cerr << "Error: App::keepHistory needs a WebSocket or event stream route first!" << std::endl;
+            std::terminate();
+        }
+        topicTree->setHistory(topic, maxMessages);
+
+        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    }
+
+    /* Number of the last message published to topic while keeping a history, 0 if none */
+    uint64_t topicSequence(std::string_view topic) {
+        TopicHistory *history = topicTree ? topicTree->lookupHistory(topic) : nullptr;
+        return history ? history->lastSequence() : 0;
+    }
+
+    /* Sends a message of its own to each of many WebSockets of this app, without topics (see WebSocket::sendBatch) */
+    template <typename UserData>
+    SendBatchResult sendBatch(const std::vector<std::pair<WebSocket<SSL, true, UserData> *, std::string_view>> &batch, OpCode opCode = OpCode::BINARY, bool compress = false) {
+        return WebSocket<SSL, true, UserData>::sendBatch(batch, opCode, compress);
+    }
+
+    /* Returns number of subscribers for this topic, or 0 for failure. One lookup */
     unsigned int numSubscribers(std::string_view topic) {
-        Topic *t = topicTree->lookupTopic(topic);
+        Topic *t = topicTree ? topicTree->lookupTopic(topic) : nullptr;
         if (t) {
             return (unsigned int) t->size();
         }
@@ -182,7 +367,35 @@ public:
         return 0;
     }
 
+    /* What topicMetrics reports of a topic, valid for the duration of the callback */
+    struct TopicMetrics {
+        std::string_view topic;
+        unsigned int subscribers;
+        TopicStats stats;
+        /* Of the subscriber furthest behind */
+        unsigned int maxBackpressure;
+    };
+
+    /* Reports every topic. Counters are read as they are, the backpressure takes one look per subscriber */
+    void topicMetrics(MoveOnlyFunction<void(const TopicMetrics &)> cb) {
+        if (!topicTree) {
+            return;
+        }
+        topicTree->iterateTopics([&cb](Topic *topic) {
+            unsigned int maxBackpressure = 0;
+            for (Subscriber *s : *topic) {
+                maxBackpressure = std::max(maxBackpressure, ((AsyncSocket<SSL> *) s->user)->getBufferedAmount());
+            }
+            cb({topic->name, (unsigned int) topic->size(), topic->stats, maxBackpressure});
+        });
+    }
+
     ~TemplatedApp() {
+        /* Nothing more is delivered to us */
+        if (bus) {
+            bus->leave(busLane);
+        }
+
         /* Let's just put everything here */
         if (httpContext) {
             httpContext->free();
@@ -216,15 +429,31 @@ public:
         webSocketContextDeleters = std::move(other.webSocketContextDeleters);
 
         webSocketContexts = std::move(other.webSocketContexts);
+        listenObserver = std::move(other.listenObserver);
 
         /* Move TopicTree */
         topicTree = other.topicTree;
         other.topicTree = nullptr;
+
+        /* The bus delivers to the app it joined with */
+        if (other.bus) {
+            other.bus->leave(other.busLane);
+            joinBusLane(other.bus);
+            other.bus = nullptr;
+        }
     }
 
     TemplatedApp(SocketContextOptions options = {}) {
         httpContext = HttpContext<SSL>::create(Loop::get(), options);
 
+#ifdef LIBUS_USE_OPENSSL
+        if constexpr (SSL) {
+            if (httpContext && options.session_cache) {
+                options.session_cache->attach((SSL_CTX *) getNativeHandle());
+            }
+        }
+#endif
+
         /* Register default handler for 404 (can be overridden by user) */
         this->any("/*", [](auto *res, auto */*req*/) {
 		    res->writeStatus("404 File Not Found");
@@ -247,21 +476,50 @@ public:
         /* 64kb backpressure is probably good */
         unsigned int maxBackpressure = 64 * 1024;
         bool closeOnBackpressureLimit = false;
+        /* Of every channel of WebSocket::sendOnChannel, over which it drops, 0 for only maxBackpressure */
+        unsigned int maxChannelBackpressure = 0;
         /* This one depends on kernel timeouts and is a bad default */
         bool resetIdleTimeoutOnSend = false;
+        /* Hold small sends made outside of corks for up to this many microseconds (or bytes, at most 4 kB),
+         * writing them out together. Trades latency for syscalls, disabled by default */
+        unsigned int coalesceMicroseconds = 0;
+        unsigned int coalesceBytes = CorkSlice::SIZE;
         /* A good default, esp. for newcomers */
         bool sendPingsAutomatically = true;
         /* Maximum socket lifetime in minutes before forced closure (defaults to disabled) */
         unsigned short maxLifetime = 0;
+        /* Dedicated compressors are made on first use. Unused for this many seconds (checked on idle timeouts)
+         * they are given back to a pool of the loop, and the next message starts over without context (0 keeps them) */
+        unsigned int compressorIdleTimeout = 0;
+        /* Send uncompressed what deflate would not shrink (judged by sampled entropy, and the recent ratio
+         * of the socket), even if asked to compress. See Loop::getCompressionStats */
+        bool adaptiveCompression = false;
+        /* Subscribers with backpressure take only the newest batched message of every topic, skipping
+         * older ones (last value conflation, such as for market data). See TopicStats::conflated */
+        bool conflate = false;
+        /* Batched messages to topics starting with this go out ahead of the others of a drain, such as
+         * control messages passing bulk updates. Empty to keep the order published */
+        std::string priorityTopicPrefix = {};
         MoveOnlyFunction<void(HttpResponse<SSL> *, HttpRequest *, struct us_socket_context_t *)> upgrade = nullptr;
         MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *)> open = nullptr;
         MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *, std::string_view, OpCode)> message = nullptr;
+        /* Opt-in, instead of message: all messages complete in one read at once, corked, in order. Views stay
+         * valid for the call only. Control frames and streamed fragments in between cut the batch short */
+        MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *, std::span<const WebSocketMessage>)> messages = nullptr;
+        /* Opt-in: messages not received in one go are streamed here as they arrive instead of being
+         * buffered up for message, with fin set on the last piece. Compressed messages are always buffered */
+        MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *, std::string_view, OpCode, bool)> fragment = nullptr;
+        /* Opt-in: binary messages beginning with a channel header (see WebSocket::sendOnChannel) go here by channel,
+         * without it, instead of to message or messages. Messages without one still go there */
+        MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *, unsigned int, std::string_view)> channelMessage = nullptr;
         MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *, std::string_view, OpCode)> dropped = nullptr;
         MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *)> drain = nullptr;
         MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *, std::string_view)> ping = nullptr;
         MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *, std::string_view)> pong = nullptr;
         MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *, std::string_view, int, int)> subscription = nullptr;
         MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *, int, std::string_view)> close = nullptr;
+        /* A WebSocket moved here from another app by migrate, as the new pointer to it */
+        MoveOnlyFunction<void(WebSocket<SSL, true, UserData> *)> migrated = nullptr;
     };
 
     /* Closes all sockets including listen sockets. */
@@ -270,12 +528,113 @@ public:
         for (void *webSocketContext : webSocketContexts) {
             us_socket_context_close(SSL, (struct us_socket_context_t *) webSocketContext);
         }
+        if (Http2Context<SSL> *http2Context = httpContext->getSocketContextData()->http2Context) {
+            us_socket_context_close(SSL, http2Context->getSocketContext());
+        }
 
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
+    /* The TopicTree shared by every WebSocket route and event stream of this app, drained every loop iteration */
+    void initTopicTree() {
+        if (topicTree) {
+            return;
+        }
+
+        bool needsUncork = false;
+        topicTree = new TopicTree<TopicTreeMessage, TopicTreeBigMessage>([needsUncork](Subscriber *s, TopicTreeMessage &message, TopicTree<TopicTreeMessage, TopicTreeBigMessage>::IteratorFlags flags) mutable {
+            /* Subscriber's user is the socket */
+            /* Unfortunately we need to cast is to PerSocketData = int
+             * since many different WebSocketContexts use the same
+             * TopicTree now */
+            auto *ws = (WebSocket<SSL, true, int> *) s->user;
+            /* Or an HttpResponse streaming events, either of them an AsyncSocket */
+            AsyncSocket<SSL> *asyncSocket = (AsyncSocket<SSL> *) s->user;
+
+            /* If this is the first message we try and cork */
+            if (flags & TopicTree<TopicTreeMessage, TopicTreeBigMessage>::IteratorFlags::FIRST) {
+                if (asyncSocket->canCork() && !asyncSocket->isCorked()) {
+                    asyncSocket->cork();
+                    needsUncork = true;
+                }
+            }
+
+            typename WebSocket<SSL, true, int>::SendStatus status;
+            if (s->kind != SUBSCRIBER_WEBSOCKET) {
+                /* Event streams take it as the data of an event, framed once for all of them, channels as theirs */
+                status = sendToSubscriber<SSL>(s, message.message, message.compress, message.eventFrame) ? WebSocket<SSL, true, int>::SendStatus::DROPPED : WebSocket<SSL, true, int>::SendStatus::SUCCESS;
+            } else {
+                /* Subscribers sharing the compressor of the loop all get the same deflated bytes, so deflate once */
+                if (message.compress && ws->hasAdaptiveCompression() && !message.sampled) {
+                    message.sampled = true;
+                    message.incompressible = looksIncompressible(message.message);
+                }
+
+                bool skipCompression = message.compress && message.incompressible && ws->hasAdaptiveCompression();
+                if (skipCompression) {
+                    LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) Loop::get());
+                    loopData->compressionStats.skippedMessages++;
+                    loopData->compressionStats.skippedBytes += message.message.length();
+                    status = ws->send(message.message, (OpCode)message.opCode, false);
+                } else if (message.compress && message.opCode < 3 && message.message.length() && ws->hasSharedCompressor()) {
+                    if (message.deflated.empty()) {
+                        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) Loop::get());
+                        message.deflated = loopData->deflationStream->deflate(loopData->zlibContext, message.message, true);
+                    }
+                    status = ws->sendMessage(message.message, message.deflated, (OpCode) message.opCode, true, true);
+                } else {
+                    status = ws->send(message.message, (OpCode)message.opCode, message.compress);
+                }
+            }
+
+            /* If we ever overstep maxBackpresure, exit immediately */
+            if (WebSocket<SSL, true, int>::SendStatus::DROPPED == status) {
+                if (needsUncork) {
+                    asyncSocket->uncork();
+                    needsUncork = false;
+                }
+                /* Stop draining */
+                return true;
+            }
+
+            /* If this is the last message we uncork if we are corked */
+            if (flags & TopicTree<TopicTreeMessage, TopicTreeBigMessage>::IteratorFlags::LAST) {
+                /* We should not uncork in all cases? */
+                if (needsUncork) {
+                    asyncSocket->uncork();
+                }
+            }
+
+            /* Success */
+            return false;
+        });
+
+        /* Conflating subscribers do so while they have backpressure */
+        topicTree->isBehind = [](Subscriber *s) {
+            return ((AsyncSocket<SSL> *) s->user)->getBufferedAmount() > 0;
+        };
+
+        /* And hook it up with the loop */
+        /* We empty for both pre and post just to make sure, after what user hooks published */
+        Loop::get()->addPostHandler(topicTree, [topicTree = topicTree](Loop */*loop*/) {
+            /* Commit pub/sub batches every loop iteration */
+            topicTree->drain();
+        }, LoopHooks::LATE_PRIORITY);
+
+        Loop::get()->addPreHandler(topicTree, [topicTree = topicTree](Loop */*loop*/) {
+            /* Commit pub/sub batches every loop iteration */
+            topicTree->drain();
+        }, LoopHooks::LATE_PRIORITY);
+
+        /* Responses stream events with it */
+        httpContext->getSocketContextData()->topicTree = topicTree;
+    }
+
     template <typename UserData>
     BuilderPatternReturnType &&ws(std::string pattern, WebSocketBehavior<UserData> &&behavior) {
+#ifdef UWS_NO_WEBSOCKET_UPGRADE
+        static_assert(sizeof(UserData) && false, "App::ws is compiled out by UWS_NO_WEBSOCKET_UPGRADE");
+#endif
         /* Don't compile if alignment rules cannot be satisfied */
         static_assert(alignof(UserData) <= LIBUS_EXT_ALIGNMENT,
         "µWebSockets cannot satisfy UserData alignment requirements. You need to recompile µSockets with LIBUS_EXT_ALIGNMENT adjusted accordingly.");
@@ -302,59 +661,7 @@ public:
             std::terminate();
         }
 
-        /* If we don't have a TopicTree yet, create one now */
-        if (!topicTree) {
-
-            bool needsUncork = false;
-            topicTree = new TopicTree<TopicTreeMessage, TopicTreeBigMessage>([needsUncork](Subscriber *s, TopicTreeMessage &message, TopicTree<TopicTreeMessage, TopicTreeBigMessage>::IteratorFlags flags) mutable {
-                /* Subscriber's user is the socket */
-                /* Unfortunately we need to cast is to PerSocketData = int
-                 * since many different WebSocketContexts use the same
-                 * TopicTree now */
-                auto *ws = (WebSocket<SSL, true, int> *) s->user;
-
-                /* If this is the first message we try and cork */
-                if (flags & TopicTree<TopicTreeMessage, TopicTreeBigMessage>::IteratorFlags::FIRST) {
-                    if (ws->canCork() && !ws->isCorked()) {
-                        ((AsyncSocket<SSL> *)ws)->cork();
-                        needsUncork = true;
-                    }
-                }
-
-                /* If we ever overstep maxBackpresure, exit immediately */
-                if (WebSocket<SSL, true, int>::SendStatus::DROPPED == ws->send(message.message, (OpCode)message.opCode, message.compress)) {
-                    if (needsUncork) {
-                        ((AsyncSocket<SSL> *)ws)->uncork();
-                        needsUncork = false;
-                    }
-                    /* Stop draining */
-                    return true;
-                }
-
-                /* If this is the last message we uncork if we are corked */
-                if (flags & TopicTree<TopicTreeMessage, TopicTreeBigMessage>::IteratorFlags::LAST) {
-                    /* We should not uncork in all cases? */
-                    if (needsUncork) {
-                        ((AsyncSocket<SSL> *)ws)->uncork();
-                    }
-                }
-
-                /* Success */
-                return false;
-            });
-
-            /* And hook it up with the loop */
-            /* We empty for both pre and post just to make sure */
-            Loop::get()->addPostHandler(topicTree, [topicTree = topicTree](Loop */*loop*/) {
-                /* Commit pub/sub batches every loop iteration */
-                topicTree->drain();
-            });
-
-            Loop::get()->addPreHandler(topicTree, [topicTree = topicTree](Loop */*loop*/) {
-                /* Commit pub/sub batches every loop iteration */
-                topicTree->drain();
-            });
-        }
+        initTopicTree();
 
         /* Every route has its own websocket context with its own behavior and user data type */
         auto *webSocketContext = WebSocketContext<SSL, true, UserData>::create(Loop::get(), (us_socket_context_t *) httpContext, topicTree);
@@ -378,29 +685,41 @@ public:
 
             /* Initialize loop's deflate inflate streams */
             if (!loopData->zlibContext) {
-                loopData->zlibContext = new ZlibContext;
+                loopData->zlibContext = new ZlibContext(loopData->memoryResource);
                 loopData->inflationStream = new InflationStream(CompressOptions::DEDICATED_DECOMPRESSOR);
                 loopData->deflationStream = new DeflationStream(CompressOptions::DEDICATED_COMPRESSOR);
             }
         }
 
         /* Copy all handlers */
+        webSocketContext->getExt()->pattern = pattern;
         webSocketContext->getExt()->openHandler = std::move(behavior.open);
         webSocketContext->getExt()->messageHandler = std::move(behavior.message);
+        webSocketContext->getExt()->messagesHandler = std::move(behavior.messages);
+        webSocketContext->getExt()->channelMessageHandler = std::move(behavior.channelMessage);
+        webSocketContext->getExt()->fragmentHandler = std::move(behavior.fragment);
         webSocketContext->getExt()->droppedHandler = std::move(behavior.dropped);
         webSocketContext->getExt()->drainHandler = std::move(behavior.drain);
         webSocketContext->getExt()->subscriptionHandler = std::move(behavior.subscription);
         webSocketContext->getExt()->closeHandler = std::move(behavior.close);
         webSocketContext->getExt()->pingHandler = std::move(behavior.ping);
         webSocketContext->getExt()->pongHandler = std::move(behavior.pong);
+        webSocketContext->getExt()->migratedHandler = std::move(behavior.migrated);
 
         /* Copy settings */
         webSocketContext->getExt()->maxPayloadLength = behavior.maxPayloadLength;
         webSocketContext->getExt()->maxBackpressure = behavior.maxBackpressure;
+        webSocketContext->getExt()->maxChannelBackpressure = behavior.maxChannelBackpressure;
         webSocketContext->getExt()->closeOnBackpressureLimit = behavior.closeOnBackpressureLimit;
         webSocketContext->getExt()->resetIdleTimeoutOnSend = behavior.resetIdleTimeoutOnSend;
+        webSocketContext->getExt()->coalesceMicroseconds = behavior.coalesceMicroseconds;
+        webSocketContext->getExt()->coalesceBytes = behavior.coalesceBytes;
         webSocketContext->getExt()->sendPingsAutomatically = behavior.sendPingsAutomatically;
         webSocketContext->getExt()->maxLifetime = behavior.maxLifetime;
+        webSocketContext->getExt()->compressorIdleTimeout = behavior.compressorIdleTimeout;
+        webSocketContext->getExt()->adaptiveCompression = behavior.adaptiveCompression;
+        webSocketContext->getExt()->drainPolicy = (uint8_t) ((behavior.conflate ? DRAIN_CONFLATE : DRAIN_ALL) | (behavior.priorityTopicPrefix.length() ? DRAIN_PRIORITY : DRAIN_ALL));
+        webSocketContext->getExt()->priorityTopicPrefix = behavior.priorityTopicPrefix;
         webSocketContext->getExt()->compression = behavior.compression;
 
         /* Calculate idleTimeoutCompnents */
@@ -409,26 +728,26 @@ public:
         httpContext->onHttp("GET", pattern, [webSocketContext, behavior = std::move(behavior)](auto *res, auto *req) mutable {
 
             /* If we have this header set, it's a websocket */
-            std::string_view secWebSocketKey = req->getHeader("sec-websocket-key");
+            std::string_view secWebSocketKey = req->getHeader(HeaderIndex::SEC_WEBSOCKET_KEY);
             if (secWebSocketKey.length() == 24) {
 
                 /* Emit upgrade handler */
                 if (behavior.upgrade) {
 
                     /* Nasty, ugly Safari 15 hack */
-                    if (hasBrokenCompression(req->getHeader("user-agent"))) {
-                        std::string_view secWebSocketExtensions = req->getHeader("sec-websocket-extensions");
+                    if (hasBrokenCompression(req->getHeader(HeaderIndex::USER_AGENT))) {
+                        std::string_view secWebSocketExtensions = req->getHeader(HeaderIndex::SEC_WEBSOCKET_EXTENSIONS);
                         memset((void *) secWebSocketExtensions.data(), ' ', secWebSocketExtensions.length());
                     }
 
                     behavior.upgrade(res, req, (struct us_socket_context_t *) webSocketContext);
                 } else {
                     /* Default handler upgrades to WebSocket */
-                    std::string_view secWebSocketProtocol = req->getHeader("sec-websocket-protocol");
-                    std::string_view secWebSocketExtensions = req->getHeader("sec-websocket-extensions");
+                    std::string_view secWebSocketProtocol = req->getHeader(HeaderIndex::SEC_WEBSOCKET_PROTOCOL);
+                    std::string_view secWebSocketExtensions = req->getHeader(HeaderIndex::SEC_WEBSOCKET_EXTENSIONS);
 
                     /* Safari 15 hack */
-                    if (hasBrokenCompression(req->getHeader("user-agent"))) {
+                    if (hasBrokenCompression(req->getHeader(HeaderIndex::USER_AGENT))) {
                         secWebSocketExtensions = "";
                     }
 
@@ -449,6 +768,9 @@ public:
 
     /* Browse to a server name, changing the router to this domain */
     BuilderPatternReturnType &&domain(std::string serverName) {
+#ifdef UWS_NO_SNI_ROUTING
+        static_assert(SSL && !SSL, "App::domain is compiled out by UWS_NO_SNI_ROUTING");
+#endif
         HttpContextData<SSL> *httpContextData = httpContext->getSocketContextData();
 
         void *domainRouter = us_socket_context_find_server_name_userdata(SSL, (struct us_socket_context_t *) httpContext, serverName.c_str());
@@ -463,6 +785,18 @@ public:
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
+    /* Compiles the routes of the current router (see domain) into a flat matching table.
+     * Call this after registering all routes; adding or removing routes undoes it */
+    BuilderPatternReturnType &&freezeRoutes() {
+        if (httpContext) {
+            httpContext->getSocketContextData()->currentRouter->freeze();
+            if (Http2Context<SSL> *http2Context = httpContext->getSocketContextData()->http2Context) {
+                http2Context->freeze();
+            }
+        }
+        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    }
+
     BuilderPatternReturnType &&get(std::string pattern, MoveOnlyFunction<void(HttpResponse<SSL> *, HttpRequest *)> &&handler) {
         if (httpContext) {
             httpContext->onHttp("GET", pattern, std::move(handler));
@@ -470,6 +804,19 @@ public:
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
+    /* A GET route streaming Server-Sent Events, for clients that cannot speak WebSocket (such as behind proxies
+     * that refuse the upgrade). The handler gets the response already streaming, to subscribe to topics: a publish
+     * then reaches the WebSocket and event stream subscribers alike, see HttpResponse::startEventStream */
+    BuilderPatternReturnType &&eventStream(std::string pattern, MoveOnlyFunction<void(HttpResponse<SSL> *, HttpRequest *)> &&handler, unsigned int maxBackpressure = 64 * 1024) {
+        if (httpContext) {
+            initTopicTree();
+            httpContext->onHttp("GET", pattern, [handler = std::move(handler), maxBackpressure](HttpResponse<SSL> *res, HttpRequest *req) mutable {
+                handler(res->startEventStream(maxBackpressure), req);
+            });
+        }
+        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    }
+
     BuilderPatternReturnType &&post(std::string pattern, MoveOnlyFunction<void(HttpResponse<SSL> *, HttpRequest *)> &&handler) {
         if (httpContext) {
             httpContext->onHttp("POST", pattern, std::move(handler));
@@ -526,6 +873,23 @@ public:
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
+#ifndef _WIN32
+    /* Serves the files under root for GET and HEAD of prefix/ and everything below it, yielding to later routes
+     * for anything that is not a file there (see StaticFiles.h). Each app (so each loop) holds its own files */
+    BuilderPatternReturnType &&serveStatic(std::string prefix, std::string root, StaticFiles::Options options = {}) {
+        while (prefix.length() && prefix.back() == '/') {
+            prefix.pop_back();
+        }
+        auto staticFiles = std::make_shared<StaticFiles>(std::move(root), prefix.length(), std::move(options));
+        get(prefix + "/*", [staticFiles](HttpResponse<SSL> *res, HttpRequest *req) {
+            staticFiles->serve(res, req);
+        });
+        return head(prefix + "/*", [staticFiles](HttpResponse<SSL> *res, HttpRequest *req) {
+            staticFiles->serve(res, req, true);
+        });
+    }
+#endif
+
     /* This one catches any method */
     BuilderPatternReturnType &&any(std::string pattern, MoveOnlyFunction<void(HttpResponse<SSL> *, HttpRequest *)> &&handler) {
         if (httpContext) {
@@ -539,7 +903,7 @@ public:
         if (!host.length()) {
             return listen(port, std::move(handler));
         }
-        handler(httpContext ? httpContext->listen(host.c_str(), port, 0) : nullptr);
+        handler(httpContext ? observeListen(httpContext->listen(host.c_str(), port, 0)) : nullptr);
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
@@ -548,77 +912,191 @@ public:
         if (!host.length()) {
             return listen(port, options, std::move(handler));
         }
-        handler(httpContext ? httpContext->listen(host.c_str(), port, options) : nullptr);
+        handler(httpContext ? observeListen(httpContext->listen(host.c_str(), port, options)) : nullptr);
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
     /* Port, callback */
     BuilderPatternReturnType &&listen(int port, MoveOnlyFunction<void(us_listen_socket_t *)> &&handler) {
-        handler(httpContext ? httpContext->listen(nullptr, port, 0) : nullptr);
+        handler(httpContext ? observeListen(httpContext->listen(nullptr, port, 0)) : nullptr);
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
     /* Port, options, callback */
     BuilderPatternReturnType &&listen(int port, int options, MoveOnlyFunction<void(us_listen_socket_t *)> &&handler) {
-        handler(httpContext ? httpContext->listen(nullptr, port, options) : nullptr);
+        handler(httpContext ? observeListen(httpContext->listen(nullptr, port, options)) : nullptr);
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
     /* options, callback, path to unix domain socket */
     BuilderPatternReturnType &&listen(int options, MoveOnlyFunction<void(us_listen_socket_t *)> &&handler, std::string path) {
-        handler(httpContext ? httpContext->listen(path.c_str(), options) : nullptr);
+        handler(httpContext ? observeListen(httpContext->listen(path.c_str(), options)) : nullptr);
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
     /* callback, path to unix domain socket */
     BuilderPatternReturnType &&listen(MoveOnlyFunction<void(us_listen_socket_t *)> &&handler, std::string path) {
-        handler(httpContext ? httpContext->listen(path.c_str(), 0) : nullptr);
+        handler(httpContext ? observeListen(httpContext->listen(path.c_str(), 0)) : nullptr);
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
+#ifndef _WIN32
+    /* Listens on fd, already bound and listening, such as inherited or handed over by a predecessor (see Handoff.h).
+     * uSockets cannot wrap an fd, so we listen on an ephemeral port and put fd in place of that socket */
+    BuilderPatternReturnType &&adoptListenSocket(LIBUS_SOCKET_DESCRIPTOR fd, MoveOnlyFunction<void(us_listen_socket_t *)> &&handler) {
+        us_listen_socket_t *listenSocket = httpContext ? httpContext->listen("127.0.0.1", 0, 0) : nullptr;
+        if (listenSocket) {
+            us_loop_t *loop = (us_loop_t *) httpContext->getLoop();
+            us_poll_t *p = (us_poll_t *) listenSocket;
+            us_poll_stop(p, loop);
+            if (dup2(fd, us_poll_fd(p)) == -1) {
+                us_poll_start(p, loop, LIBUS_SOCKET_READABLE);
+                us_listen_socket_close(SSL, listenSocket);
+                listenSocket = nullptr;
+            } else {
+                fcntl(us_poll_fd(p), F_SETFL, fcntl(us_poll_fd(p), F_GETFL, 0) | O_NONBLOCK);
+                us_poll_start(p, loop, LIBUS_SOCKET_READABLE);
+            }
+        }
+        ::close(fd);
+        handler(observeListen(listenSocket));
+        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    }
+#endif
+
     /* Register event handler for accepted FD. Can be used together with adoptSocket. */
     BuilderPatternReturnType &&preOpen(LIBUS_SOCKET_DESCRIPTOR (*handler)(struct us_socket_context_t *, LIBUS_SOCKET_DESCRIPTOR)) {
         httpContext->onPreOpen(handler);
         return std::move(static_cast<BuilderPatternReturnType &&>(*this));
     }
 
+    /* Hands connections accepted by this app to the apps added here (each on a loop of its own thread),
+     * picked as set by balanceChildApps */
     BuilderPatternReturnType &&addChildApp(BuilderPatternReturnType *app) {
         /* Add this app to httpContextData list over child apps and set onPreOpen */
         httpContext->getSocketContextData()->childApps.push_back((void *) app);
-        
+        httpContext->getSocketContextData()->childLoops.push_back((LoopData *) us_loop_ext((us_loop_t *) app->getLoop()));
+
         httpContext->onPreOpen([](struct us_socket_context_t *context, LIBUS_SOCKET_DESCRIPTOR fd) -> LIBUS_SOCKET_DESCRIPTOR {
             
             HttpContext<SSL> *httpContext = (HttpContext<SSL> *) context;
+            HttpContextData<SSL> *httpContextData = httpContext->getSocketContextData();
 
-            if (httpContext->getSocketContextData()->childApps.empty()) {
+            if (httpContextData->childApps.empty()) {
                 return fd;
             }
 
-            //std::cout << "Distributing fd: " << fd << " from context: " << context << std::endl;
+            unsigned int index = httpContextData->pickChildApp();
+            BuilderPatternReturnType *receivingApp = (BuilderPatternReturnType *) httpContextData->childApps[index];
 
-            unsigned int *roundRobin = &httpContext->getSocketContextData()->roundRobin;
+            /* Counted as the child's until it adopted it, so that picking right after sees it */
+            LoopData *loopData = httpContextData->childLoops[index];
+            loopData->handedOff.fetch_add(1, std::memory_order_relaxed);
+            receivingApp->getLoop()->defer([fd, receivingApp, loopData]() {
+                receivingApp->adoptSocket(fd);
+                loopData->handedOff.fetch_sub(1, std::memory_order_relaxed);
+            });
 
-            //std::cout << "Round robin is: " << *roundRobin << " and size of apps is: " << httpContext->getSocketContextData()->childApps.size() << std::endl;
+            return fd + 1;
+        });
+        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    }
 
-            BuilderPatternReturnType *receivingApp = (BuilderPatternReturnType *) httpContext->getSocketContextData()->childApps[*roundRobin];
+    /* How addChildApp picks the child for a connection, round robin by default. Loads are published by
+     * the loops of the children, read as they are without locking */
+    BuilderPatternReturnType &&balanceChildApps(ChildAppBalancing balancing) {
+        httpContext->getSocketContextData()->childAppBalancing = balancing;
+        httpContext->getSocketContextData()->childAppBalancer = nullptr;
+        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    }
 
+    /* Or by a balancer of your own, given the load of every child in the order added */
+    BuilderPatternReturnType &&balanceChildApps(MoveOnlyFunction<unsigned int(const std::vector<LoopLoad> &)> &&balancer) {
+        httpContext->getSocketContextData()->childAppBalancer = std::move(balancer);
+        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    }
 
-            //std::cout << "Loop is " << receivingApp->getLoop() << std::endl;
+    /* Moves ws to targetApp, an app with the same WebSocket routes on a loop of its own (such as a child app), keeping
+     * its connection, protocol state, backpressure, subscriptions and user data. It arrives there as another pointer,
+     * handed to the migrated handler of its route, and is closed here without a close event. Anything published
+     * while on its way is missed. Returns false, leaving ws be, if it cannot go (see WebSocketContext::emigrate) */
+    template <typename UserData>
+    bool migrate(WebSocket<SSL, true, UserData> *ws, BuilderPatternReturnType *targetApp) {
+        void *webSocketContext = us_socket_context(SSL, (us_socket_t *) ws);
+        size_t index = 0;
+        while (index < webSocketContexts.size() && webSocketContexts[index] != webSocketContext) {
+            index++;
+        }
+        if (index >= webSocketContexts.size() || index >= targetApp->webSocketContexts.size()) {
+            return false;
+        }
 
+        auto migrant = WebSocketContext<SSL, true, UserData>::emigrate((us_socket_t *) ws);
+        if (!migrant) {
+            return false;
+        }
 
-            receivingApp->getLoop()->defer([fd, receivingApp]() {
-                //std::cout << "About to adopt socket " << fd << " on receivingApp " << receivingApp << std::endl;
-                receivingApp->adoptSocket(fd);
-                //std::cout << "Done " << std::endl;
-            });
+        auto *targetContext = (WebSocketContext<SSL, true, UserData> *) targetApp->webSocketContexts[index];
+        targetApp->getLoop()->defer([targetContext, migrant = std::move(migrant)]() mutable {
+            WebSocketContext<SSL, true, UserData>::immigrate(targetContext, std::move(migrant));
+        });
+        return true;
+    }
+
+    /* Sizes of what our sockets take, WebSockets with UserData of ws<UserData> */
+    template <typename UserData = void>
+    static constexpr SocketExtSizes getExtSizes() {
+        size_t userDataSize = 0;
+        if constexpr (!std::is_void_v<UserData>) {
+            userDataSize = sizeof(UserData);
+        }
+        return {sizeof(HttpResponseData<SSL>), sizeof(WebSocketData) + userDataSize,
+            sizeof(HttpResponseHandlers), sizeof(WebSocketSideBlock), LoopData::SIDE_BLOCK_SIZE};
+    }
 
-            if (++(*roundRobin) == httpContext->getSocketContextData()->childApps.size()) {
-                *roundRobin = 0;
+    /* Counters of our loop and of the loops of our child apps added together, from any thread without locking */
+    LoopMetricsSnapshot getMetrics() {
+        LoopMetricsSnapshot metrics = getLoop()->getMetrics();
+        if (httpContext) {
+            for (LoopData *loopData : httpContext->getSocketContextData()->childLoops) {
+                metrics += loopData->metrics.snapshot();
             }
+        }
+        return metrics;
+    }
 
-            return fd + 1;
-        });
-        return std::move(static_cast<BuilderPatternReturnType &&>(*this));
+    /* Metrics of our routes and of those of our child apps, merged by method and pattern (not by URL). From any
+     * thread without locking once routes are declared, the histograms are read as they are being recorded */
+    std::vector<RouteStats> getRouteStats() {
+        std::vector<RouteStats> merged;
+        if (httpContext) {
+            HttpContextData<SSL> *httpContextData = httpContext->getSocketContextData();
+            mergeRouteStats(merged, httpContextData->routeMetrics);
+            for (void *childApp : httpContextData->childApps) {
+                TemplatedApp *child = static_cast<TemplatedApp *>((BuilderPatternReturnType *) childApp);
+                if (child->httpContext) {
+                    mergeRouteStats(merged, child->httpContext->getSocketContextData()->routeMetrics);
+                }
+            }
+        }
+        return merged;
+    }
+
+    /* Memory of our loop and of the loops of our child apps added together, like getMetrics, with what our TopicTree
+     * holds. From the thread of this app (only the loops are safe to read from any thread) */
+    MemoryStats getMemoryStats() {
+        MemoryStats stats = getLoop()->getMemoryStats();
+        if (httpContext) {
+            for (LoopData *loopData : httpContext->getSocketContextData()->childLoops) {
+                stats += loopData->getMemoryStats();
+            }
+        }
+        if (topicTree) {
+            stats.topics = topicTree->getNumTopics();
+            stats.subscribers = topicTree->getNumSubscribers();
+            stats.outgoingMessages = topicTree->getNumOutgoingMessages();
+        }
+        return stats;
     }
 
     /* adopt an externally accepted socket */
@@ -641,6 +1119,7 @@ public:
 }
 
 #include "CachingApp.h"
+#include "Coroutine.h"
 
 namespace uWS {
     typedef uWS::CachingApp<false> App;
@@ -25,12 +25,27 @@
  * to signal error with -1 (which is how the entire UNIX syscalling is built). */
 
 #include <cstring>
+#include <cerrno>
 #include <iostream>
+#include <span>
+#include <string_view>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+/* With io_uring, uSockets submits every socket operation of an iteration at once and receives into its provided
+ * buffers. Then we must not write to descriptors behind its back, nor change their polls */
+#ifdef LIBUS_USE_IO_URING
+#define UWS_NO_DIRECT_SOCKET_IO
+#endif
 
 #include "libusockets.h"
 
 #include "LoopData.h"
 #include "AsyncSocketData.h"
+#include "Tracepoints.h"
 
 namespace uWS {
 
@@ -48,9 +63,13 @@ struct AsyncSocket {
     template <bool> friend struct HttpContext;
     template <bool, bool, typename> friend struct WebSocketContext;
     template <bool, typename> friend struct TemplatedAppBase;
-    template <bool, typename> friend struct WebSocketContextData;
+    template <bool, typename, bool> friend struct WebSocketContextData;
     template <typename, typename> friend struct TopicTree;
     template <bool> friend struct HttpResponse;
+    template <bool, typename> friend struct TemplatedClientApp;
+    template <bool> friend struct TemplatedCluster;
+    template <bool> friend struct Http2Context;
+    template <bool> friend struct TemplatedReverseProxy;
 
 private:
     /* Helper, do not use directly (todo: move to uSockets or de-crazify) */
@@ -91,6 +110,29 @@ protected:
         return (AsyncSocketData<SSL> *) us_socket_ext(SSL, (us_socket_t *) this);
     }
 
+    /* Counts bytes that made it to the socket as bytes out of the loop, and as written past their channels */
+    void countWritten(size_t written) {
+        getLoopData()->metrics.bytesOut.add((unsigned long long) written);
+        getAsyncSocketData()->buffer.onWritten(written);
+    }
+
+    /* Everything written to the socket goes through here, or counts itself like these do */
+    int writeToSocket(const char *data, int length, int msgMore) {
+        int written = us_socket_write(SSL, (us_socket_t *) this, data, length, msgMore);
+        if (written > 0) {
+            countWritten((size_t) written);
+        }
+        return written;
+    }
+
+    int writeToSocket(const char *header, int headerLength, const char *payload, int payloadLength) {
+        int written = us_socket_write2(SSL, (us_socket_t *) this, header, headerLength, payload, payloadLength);
+        if (written > 0) {
+            countWritten((size_t) written);
+        }
+        return written;
+    }
+
     /* Socket timeout */
     void timeout(unsigned int seconds) {
         us_socket_timeout(SSL, (us_socket_t *) this, seconds);
@@ -98,29 +140,191 @@ protected:
 
     /* Shutdown socket without any automatic drainage */
     void shutdown() {
+        /* Except for our cork slice, which was accounted for as written */
+        flushCorkSlice();
         us_socket_shutdown(SSL, (us_socket_t *) this);
     }
 
-    /* Experimental pause */
+    /* Sends FIN and closes, if nothing we were given is left to write once our cork slice is flushed. Otherwise
+     * this is up to whoever drains us. Returns whether we closed */
+    bool closeIfDrained() {
+        flushCorkSlice();
+        if (getBufferedAmount()) {
+            return false;
+        }
+        us_socket_shutdown(SSL, (us_socket_t *) this);
+        /* We need to force close after sending FIN since we want to hinder
+         * clients from keeping to send their huge data */
+        close();
+        return true;
+    }
+
+    /* Experimental pause, holding back what is parked of our reads too */
     us_socket_t *pause() {
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+        asyncSocketData->pausedByUser = true;
+        if (asyncSocketData->parkedRead) {
+            asyncSocketData->parkedRead->held = true;
+        }
         throttle_helper(1);
         return (us_socket_t *) this;
     }
 
-    /* Experimental resume */
+    /* Experimental resume. Reads we paused for the read budget or shedding stay so until handed back */
     us_socket_t *resume() {
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+        asyncSocketData->pausedByUser = false;
+        if (asyncSocketData->parkedRead) {
+            asyncSocketData->parkedRead->held = false;
+            if (asyncSocketData->parkedRead->paused) {
+                return (us_socket_t *) this;
+            }
+        }
         throttle_helper(0);
         return (us_socket_t *) this;
     }
 
+    /* Once all of what was parked is handed back, resuming what we paused unless the application paused it since */
+    static void parkedReadDone(void *s, bool paused) {
+        AsyncSocketData<SSL> *asyncSocketData = ((AsyncSocket<SSL> *) s)->getAsyncSocketData();
+        asyncSocketData->parkedRead = nullptr;
+        if (paused && !asyncSocketData->pausedByUser) {
+            ((AsyncSocket<SSL> *) s)->throttle_helper(0);
+        }
+    }
+
+    /* Cuts a read down to the read budget of the loop, parking the rest to be handed back to onData after the
+     * handlers of this iteration. Reads arriving while we have some parked are parked behind it, returning false */
+    bool takeReadBudget(char *data, int &length, us_socket_t *(*onData)(us_socket_t *, char *, int)) {
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+        if (asyncSocketData->parkedRead) {
+            /* Parked empty by shedding, it has no handler yet */
+            asyncSocketData->parkedRead->onData = onData;
+            asyncSocketData->parkedRead->data.append(data, (size_t) length);
+            return false;
+        }
+
+        LoopData *loopData = getLoopData();
+        if (!loopData->readBudget || (unsigned int) length <= loopData->readBudget) {
+            return true;
+        }
+
+        /* Over budget too many iterations in a row, we wait an iteration with our reads paused */
+        bool inARow = asyncSocketData->overBudgetStreak && asyncSocketData->overBudgetIteration + 1 == loopData->readIteration;
+        asyncSocketData->overBudgetStreak = inARow ? (uint8_t) std::min<unsigned int>(asyncSocketData->overBudgetStreak + 1u, 255u) : 1;
+        asyncSocketData->overBudgetIteration = loopData->readIteration;
+        bool paused = loopData->readBudgetPauseAfter && asyncSocketData->overBudgetStreak >= loopData->readBudgetPauseAfter;
+
+        asyncSocketData->parkedRead = loopData->parkRead(this, onData, parkedReadDone, data + loopData->readBudget, (size_t) length - loopData->readBudget, paused, asyncSocketData->pausedByUser);
+        if (paused) {
+            asyncSocketData->overBudgetStreak = 0;
+            throttle_helper(1);
+        }
+
+        length = (int) loopData->readBudget;
+        return true;
+    }
+
     /* Immediately close socket */
     us_socket_t *close() {
         return us_socket_close(SSL, (us_socket_t *) this, 0, nullptr);
     }
 
+    /* Pieces gathered per syscall, besides the cork buffer */
+    static constexpr int MAX_GATHER = 16;
+
     void corkUnchecked() {
         /* What if another socket is corked? */
         getLoopData()->corkedSocket = this;
+        takeCorkSlice();
+    }
+
+    /* Moves anything in our cork slice to the front of the (empty) cork buffer */
+    void takeCorkSlice() {
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+        if (asyncSocketData->corkSlice) {
+            LoopData *loopData = getLoopData();
+            memcpy(loopData->corkBuffer + loopData->corkOffset, asyncSocketData->corkSlice->data, asyncSocketData->corkSlice->length);
+            loopData->corkOffset += asyncSocketData->corkSlice->length;
+            asyncSocketData->corkSlice->socket = nullptr;
+            asyncSocketData->corkSlice = nullptr;
+        }
+    }
+
+    /* Writes off our cork slice, buffering what did not make it */
+    void flushCorkSlice() {
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+        CorkSlice *slice = asyncSocketData->corkSlice;
+        if (!slice) {
+            return;
+        }
+        slice->socket = nullptr;
+        asyncSocketData->corkSlice = nullptr;
+
+        if (us_socket_is_closed(SSL, (us_socket_t *) this)) {
+            return;
+        }
+
+        int written = writeToSocket(slice->data, (int) slice->length, 0);
+        if (written < (int) slice->length) {
+            asyncSocketData->buffer.append(slice->data + written, slice->length - (unsigned int) written);
+        }
+    }
+
+    static void flushCorkSlice(void *s) {
+        ((AsyncSocket<SSL> *) s)->flushCorkSlice();
+    }
+
+    /* Returns room for length bytes in our cork slice, if another socket holds the cork buffer and we have no backpressure */
+    char *sliceCork(size_t length) {
+        LoopData *loopData = getLoopData();
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+        if (!loopData->corkedSocket || loopData->corkedSocket == this || asyncSocketData->buffer.length()) {
+            return nullptr;
+        }
+
+        CorkSlice *slice = asyncSocketData->corkSlice;
+        if (!slice) {
+            if (length > CorkSlice::SIZE) {
+                return nullptr;
+            }
+            slice = asyncSocketData->corkSlice = loopData->acquireCorkSlice(this, flushCorkSlice);
+        } else if (CorkSlice::SIZE - slice->length < length) {
+            return nullptr;
+        }
+
+        char *data = slice->data + slice->length;
+        slice->length += (unsigned int) length;
+        return data;
+    }
+
+    /* Returns room for length bytes in our slice, which is held for up to microseconds before being written out
+     * (by the loop), unless we are corked, have backpressure or do not fit in maxBytes even after flushing it */
+    char *coalesce(size_t length, unsigned int microseconds, unsigned int maxBytes) {
+        LoopData *loopData = getLoopData();
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+        maxBytes = std::min<unsigned int>(maxBytes, CorkSlice::SIZE);
+        if (loopData->corkedSocket || asyncSocketData->buffer.length() || length > maxBytes) {
+            return nullptr;
+        }
+
+        CorkSlice *slice = asyncSocketData->corkSlice;
+        if (slice && slice->length + length > maxBytes) {
+            /* Full, the rest starts over */
+            flushCorkSlice();
+            if (asyncSocketData->buffer.length()) {
+                return nullptr;
+            }
+            slice = nullptr;
+        }
+        if (!slice) {
+            slice = asyncSocketData->corkSlice = loopData->acquireCorkSlice(this, flushCorkSlice);
+            slice->deadline = LoopData::now() + microseconds;
+        }
+
+        char *data = slice->data + slice->length;
+        slice->length += (unsigned int) length;
+        return data;
     }
 
     void uncorkWithoutSending() {
@@ -129,7 +333,8 @@ protected:
         }
     }
 
-    /* Cork this socket. Only one socket may ever be corked per-loop at any given time */
+    /* Cork this socket. Only one socket may ever be corked per-loop at any given time,
+     * others written to meanwhile cork into slices of their own (see sliceCork) */
     void cork() {
         /* Extra check for invalid corking of others */
         if (getLoopData()->corkOffset && getLoopData()->corkedSocket != this) {
@@ -138,7 +343,9 @@ protected:
         }
 
         /* What if another socket is corked? */
+        UWS_TRACE(socket__cork, this);
         getLoopData()->corkedSocket = this;
+        takeCorkSlice();
     }
 
     /* Returns whether we are corked or not */
@@ -157,7 +364,9 @@ protected:
         LoopData *loopData = getLoopData();
         BackPressure &backPressure = getAsyncSocketData()->buffer;
         size_t existingBackpressure = backPressure.length();
-        if ((!existingBackpressure) && (isCorked() || canCork()) && (loopData->corkOffset + size < LoopData::CORK_BUFFER_SIZE)) {
+        /* Corking moves our slice, if any, to the cork buffer */
+        size_t sliced = getAsyncSocketData()->corkSlice ? getAsyncSocketData()->corkSlice->length : 0;
+        if ((!existingBackpressure) && (isCorked() || canCork()) && (loopData->corkOffset + sliced + size < loopData->corkBufferSize)) {
             /* Cork automatically if we can */
             if (isCorked()) {
                 char *sendBuffer = loopData->corkBuffer + loopData->corkOffset;
@@ -169,8 +378,14 @@ protected:
                 loopData->corkOffset += (unsigned int) size;
                 return {sendBuffer, SendBufferAttribute::NEEDS_UNCORK};
             }
+        } else if (char *sendBuffer = sliceCork(size)) {
+            return {sendBuffer, SendBufferAttribute::NEEDS_NOTHING};
         } else {
 
+            /* Our slice goes in front of anything new */
+            flushCorkSlice();
+            existingBackpressure = backPressure.length();
+
             /* If we are corked and there is already data in the cork buffer,
             mark how much is ours and reset it */
             unsigned int ourCorkOffset = 0;
@@ -179,22 +394,100 @@ protected:
                 loopData->corkOffset = 0;
             }
 
-            /* Fallback is to use the backpressure as buffer */
-            backPressure.resize(ourCorkOffset + existingBackpressure + size);
+            /* Fallback is to use the backpressure as buffer, with corkbuffer in front */
+            backPressure.append(loopData->corkBuffer, ourCorkOffset);
 
-            /* And copy corkbuffer in front */
-            memcpy((char *) backPressure.data() + existingBackpressure, loopData->corkBuffer, ourCorkOffset);
-
-            return {(char *) backPressure.data() + ourCorkOffset + existingBackpressure, SendBufferAttribute::NEEDS_DRAIN};
+            return {backPressure.allocate(size), SendBufferAttribute::NEEDS_DRAIN};
         }
     }
 
+    /* What we were given to write and did not write yet: our backpressure, the cork buffer while we hold it and
+     * our cork slice */
+    size_t getPendingAmount() {
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+        return asyncSocketData->buffer.length() + (isCorked() ? getLoopData()->corkOffset : 0) +
+            (asyncSocketData->corkSlice ? asyncSocketData->corkSlice->length : 0);
+    }
+
     /* Returns the user space backpressure. */
     unsigned int getBufferedAmount() {
-        /* We return the actual amount of bytes in backbuffer, including pendingRemoval */
+        /* We return the actual amount of bytes in backbuffer */
         return (unsigned int) getAsyncSocketData()->buffer.totalLength();
     }
 
+    /* Writes off as much backpressure as possible, two segments per syscall for non-SSL.
+     * Returns whether all of it was written. */
+    bool drainBackPressure(int nextLength) {
+        BackPressure &backPressure = getAsyncSocketData()->buffer;
+        while (backPressure.length()) {
+            std::string_view segments[2];
+            unsigned int numSegments = backPressure.segments(segments, 2);
+            bool more = numSegments == 2 || backPressure.length() > segments[0].length();
+
+            int attempted = (int) segments[0].length(), written;
+            if (!SSL && numSegments == 2) {
+                attempted += (int) segments[1].length();
+                written = writeToSocket(segments[0].data(), (int) segments[0].length(), segments[1].data(), (int) segments[1].length());
+            } else {
+                written = writeToSocket(segments[0].data(), (int) segments[0].length(), more || nextLength);
+            }
+
+            backPressure.erase((size_t) written);
+            if (written < attempted) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /* Whether we queue above average while this loop or the process is over its backpressure budget */
+    bool queuesOverBackPressureBudget() {
+        LoopData *loopData = getLoopData();
+        size_t buffered = getAsyncSocketData()->buffer.length();
+        BackPressureBudget &budget = BackPressureBudget::get();
+        size_t maxProcessBytes = BackPressureBudget::maxProcessBytes.load(std::memory_order_relaxed);
+        bool overBudget = (loopData->maxLoopBackPressure && budget.loopBytes > loopData->maxLoopBackPressure) ||
+            (maxProcessBytes && BackPressureBudget::processBytes.load(std::memory_order_relaxed) > maxProcessBytes);
+        return buffered && overBudget && buffered >= budget.average();
+    }
+
+    /* Keeps reads paused by shedding held, looked at by the loop every iteration */
+    static bool stillShed(void *s) {
+        return ((AsyncSocket<SSL> *) s)->queuesOverBackPressureBudget();
+    }
+
+    /* Asks the loop's shedding policy about us if we queue above average while over budget, closing us or pausing our
+     * reads if so told. Returns what the policy said (SHED_DROP is up to the caller) */
+    BackPressureShedding shedOverBackPressureBudget() {
+        LoopData *loopData = getLoopData();
+        if (!loopData->shedPolicy) {
+            return SHED_NOTHING;
+        }
+
+        if (!queuesOverBackPressureBudget() || us_socket_is_closed(SSL, (us_socket_t *) this)) {
+            return SHED_NOTHING;
+        }
+
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+        BackPressureShedding shedding = loopData->shedPolicy(asyncSocketData->buffer.length(), BackPressureBudget::get().average());
+        if (shedding == SHED_CLOSE) {
+            close();
+        } else if (shedding == SHED_PAUSE) {
+            /* Paused as if over the read budget, parking nothing unless already parked, and held until we drained
+             * below average or the budget is met again. We keep draining meanwhile, as writes are not paused */
+            if (!asyncSocketData->parkedRead) {
+                asyncSocketData->parkedRead = loopData->parkRead(this, nullptr, parkedReadDone, "", 0, true, asyncSocketData->pausedByUser);
+                throttle_helper(1);
+            } else if (!asyncSocketData->parkedRead->paused) {
+                asyncSocketData->parkedRead->paused = true;
+                throttle_helper(1);
+            }
+            asyncSocketData->parkedRead->shed = stillShed;
+        }
+        return shedding;
+    }
+
     /* Returns the text representation of an IPv4 or IPv6 address */
     std::string_view addressAsText(std::string_view binary) {
         static thread_local char buf[64];
@@ -242,16 +535,21 @@ protected:
         LoopData *loopData = getLoopData();
         AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
 
-        /* We are limited if we have a per-socket buffer */
-        if (asyncSocketData->buffer.length()) {
-            /* Write off as much as we can */
-            int written = us_socket_write(SSL, (us_socket_t *) this, asyncSocketData->buffer.data(), (int) asyncSocketData->buffer.length(), /*nextLength != 0 | */length);
+        /* Another socket holds the cork buffer, so cork into a slice of our own */
+        if (length) {
+            if (char *slice = sliceCork((size_t) length)) {
+                memcpy(slice, src, (size_t) length);
+                return {length, false};
+            }
+        }
 
-            /* On failure return, otherwise continue down the function */
-            if ((unsigned int) written < asyncSocketData->buffer.length()) {
+        /* Anything in our slice goes first */
+        flushCorkSlice();
 
-                /* Update buffering (todo: we can do better here if we keep track of what happens to this guy later on) */
-                asyncSocketData->buffer.erase((unsigned int) written);
+        /* We are limited if we have a per-socket buffer */
+        if (asyncSocketData->buffer.length()) {
+            /* Write off as much as we can, on failure return, otherwise continue down the function */
+            if (!drainBackPressure(length)) {
 
                 if (optionally) {
                     /* Thankfully we can exit early here */
@@ -265,35 +563,40 @@ protected:
             }
 
             /* At this point we simply have no buffer and can continue as normal */
-            asyncSocketData->buffer.clear();
         }
 
         if (length) {
             if (loopData->corkedSocket == this) {
                 /* We are corked */
-                if (LoopData::CORK_BUFFER_SIZE - loopData->corkOffset >= (unsigned int) length) {
+                if (loopData->corkBufferSize - loopData->corkOffset >= (unsigned int) length) {
                     /* If the entire chunk fits in cork buffer */
                     memcpy(loopData->corkBuffer + loopData->corkOffset, src, (unsigned int) length);
                     loopData->corkOffset += (unsigned int) length;
                     /* Fall through to default return */
                 } else {
+                    /* We spill past the cork buffer. Flush it along with this chunk, and stay corked
+                     * on success so that following writes (like pipelined responses) keep being batched */
+
                     /* Strategy differences between SSL and non-SSL regarding syscall minimizing */
-                    if constexpr (false) {
-                        /* Cork up as much as we can */
-                        unsigned int stripped = LoopData::CORK_BUFFER_SIZE - loopData->corkOffset;
+                    if constexpr (SSL) {
+                        /* Cork up as much as we can, sending full records */
+                        unsigned int stripped = loopData->corkBufferSize - loopData->corkOffset;
                         memcpy(loopData->corkBuffer + loopData->corkOffset, src, stripped);
-                        loopData->corkOffset = LoopData::CORK_BUFFER_SIZE;
+                        loopData->corkOffset = loopData->corkBufferSize;
 
                         auto [written, failed] = uncork(src + stripped, length - (int) stripped, optionally);
+                        if (!failed) {
+                            corkUnchecked();
+                        }
                         return {written + (int) stripped, failed};
+                    } else {
+                        /* For non-SSL we send both in one writev */
+                        return spill(src, length, optionally);
                     }
-
-                    /* For non-SSL we take the penalty of two syscalls */
-                    return uncork(src, length, optionally);
                 }
             } else {
                 /* We are not corked */
-                int written = us_socket_write(SSL, (us_socket_t *) this, src, length, nextLength != 0);
+                int written = writeToSocket(src, length, nextLength != 0);
 
                 /* Did we fail? */
                 if (written < length) {
@@ -303,11 +606,6 @@ protected:
                     }
 
                     /* Fall back to worst possible case (should be very rare for HTTP) */
-                    /* At least we can reserve room for next chunk if we know it up front */
-                    if (nextLength) {
-                        asyncSocketData->buffer.reserve(asyncSocketData->buffer.length() + (size_t) (length - written + nextLength));
-                    }
-
                     /* Buffer this chunk */
                     asyncSocketData->buffer.append(src + written, (size_t) (length - written));
 
@@ -322,12 +620,253 @@ protected:
         return {length, false};
     }
 
+    /* Writes a shared buffer, after anything corked and in one syscall with it. Whatever does not make it
+     * is queued by reference instead of by copy. SSL has to encrypt, so it copies like any other write. */
+    std::pair<int, bool> write(const SharedBuffer &buffer) {
+        int length = (int) buffer.length();
+        if constexpr (SSL) {
+            return write(buffer.data(), length);
+        }
+
+        /* Fake success if closed, simple fix to allow uncork of closed socket to succeed */
+        if (us_socket_is_closed(SSL, (us_socket_t *) this)) {
+            return {length, false};
+        }
+
+        LoopData *loopData = getLoopData();
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+
+        /* Anything in our slice goes first */
+        flushCorkSlice();
+
+        /* Queue behind any backpressure we could not drain */
+        if (asyncSocketData->buffer.length() && !drainBackPressure(length)) {
+            asyncSocketData->buffer.append(buffer, 0);
+            return {length, true};
+        }
+
+        int corked = 0;
+        if (loopData->corkedSocket == this) {
+            corked = (int) loopData->corkOffset;
+            loopData->corkOffset = 0;
+        }
+
+        int written = writeToSocket(loopData->corkBuffer, corked, buffer.data(), length);
+        if (written == corked + length) {
+            return {length, false};
+        }
+
+        /* We have backpressure, so there is no point in staying corked */
+        uncorkWithoutSending();
+
+        if (written < corked) {
+            asyncSocketData->buffer.append(loopData->corkBuffer + written, (size_t) (corked - written));
+            written = 0;
+        } else {
+            written -= corked;
+        }
+
+        asyncSocketData->buffer.append(buffer, (size_t) written);
+        return {length, true};
+    }
+
+    /* Writes many pieces as if one, without joining them. Pieces fitting in the cork buffer (or our slice) are copied
+     * there, anything bigger goes out after the cork buffer in one gathering syscall per MAX_GATHER pieces (non-SSL only).
+     * Only bytes of pieces are returned as written, and like write, whatever did not make it is buffered unless optionally */
+    std::pair<int, bool> write(std::span<const std::string_view> pieces, bool optionally = false) {
+        size_t length = 0;
+        for (std::string_view piece : pieces) {
+            length += piece.length();
+        }
+
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+
+        bool gather = false;
+#if !defined(_WIN32) && !defined(UWS_NO_DIRECT_SOCKET_IO)
+        LoopData *loopData = getLoopData();
+        if constexpr (!SSL) {
+            bool fitsCork = isCorked() && loopData->corkBufferSize - loopData->corkOffset >= length;
+            bool fitsSlice = loopData->corkedSocket && !isCorked() && !asyncSocketData->buffer.length() &&
+                CorkSlice::SIZE - (asyncSocketData->corkSlice ? asyncSocketData->corkSlice->length : 0) >= length;
+            gather = !fitsCork && !fitsSlice && !us_socket_is_closed(SSL, (us_socket_t *) this);
+        }
+#endif
+
+        if (!gather) {
+            /* So that SSL encrypts all pieces as one record */
+            bool corkedHere = SSL && canCork() && !asyncSocketData->buffer.length();
+            if (corkedHere) {
+                cork();
+            }
+
+            int written = 0;
+            for (size_t i = 0; i < pieces.size(); i++) {
+                auto [pieceWritten, failed] = write(pieces[i].data(), (int) pieces[i].length(), optionally);
+                written += pieceWritten;
+                if (failed) {
+                    if (optionally) {
+                        return {written, true};
+                    }
+                    /* The rest queues behind the piece that failed */
+                    while (++i < pieces.size()) {
+                        asyncSocketData->buffer.append(pieces[i].data(), pieces[i].length());
+                    }
+                    return {(int) length, true};
+                }
+            }
+
+            if (corkedHere) {
+                return {written, uncork().second};
+            }
+            return {written, false};
+        }
+
+#if !defined(_WIN32) && !defined(UWS_NO_DIRECT_SOCKET_IO)
+        /* Anything in our slice goes first */
+        flushCorkSlice();
+
+        /* Queue behind any backpressure we could not drain */
+        if (asyncSocketData->buffer.length() && !drainBackPressure((int) length)) {
+            if (optionally) {
+                return {0, true};
+            }
+            for (std::string_view piece : pieces) {
+                asyncSocketData->buffer.append(piece.data(), piece.length());
+            }
+            return {(int) length, true};
+        }
+
+        size_t corked = 0;
+        if (isCorked()) {
+            corked = loopData->corkOffset;
+            loopData->corkOffset = 0;
+        }
+
+        int fd = (int) (intptr_t) us_socket_get_native_handle(SSL, (us_socket_t *) this);
+        size_t corkedSent = 0, written = 0;
+        bool blocked = false;
+        while (!blocked && (corkedSent < corked || written < length)) {
+            struct iovec iov[MAX_GATHER + 1];
+            int numIov = 0;
+            size_t batch = 0;
+
+            if (corkedSent < corked) {
+                iov[numIov++] = {loopData->corkBuffer + corkedSent, corked - corkedSent};
+                batch += corked - corkedSent;
+            }
+            size_t skip = written;
+            for (size_t i = 0; i < pieces.size() && numIov <= MAX_GATHER; i++) {
+                if (skip >= pieces[i].length()) {
+                    skip -= pieces[i].length();
+                    continue;
+                }
+                iov[numIov++] = {(void *) (pieces[i].data() + skip), pieces[i].length() - skip};
+                batch += pieces[i].length() - skip;
+                skip = 0;
+            }
+
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = (decltype(msg.msg_iovlen)) numIov;
+#ifdef MSG_NOSIGNAL
+            ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+#else
+            ssize_t sent = sendmsg(fd, &msg, 0);
+#endif
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+
+            size_t sentBytes = sent > 0 ? (size_t) sent : 0;
+            if (sentBytes) {
+                countWritten(sentBytes);
+            }
+            size_t fromCork = std::min(sentBytes, corked - corkedSent);
+            corkedSent += fromCork;
+            written += sentBytes - fromCork;
+            blocked = sentBytes < batch;
+        }
+
+        if (!blocked) {
+            return {(int) written, false};
+        }
+
+        /* We have backpressure, so there is no point in staying corked */
+        uncorkWithoutSending();
+
+        /* uSockets only polls for writable once one of its own writes fail, so finish with those */
+        if (corkedSent < corked) {
+            int corkWritten = writeToSocket(loopData->corkBuffer + corkedSent, (int) (corked - corkedSent), 0);
+            asyncSocketData->buffer.append(loopData->corkBuffer + corkedSent + corkWritten, corked - corkedSent - (size_t) corkWritten);
+        }
+
+        size_t skip = written;
+        for (std::string_view piece : pieces) {
+            if (skip >= piece.length()) {
+                skip -= piece.length();
+                continue;
+            }
+            if (!asyncSocketData->buffer.length()) {
+                int pieceWritten = writeToSocket(piece.data() + skip, (int) (piece.length() - skip), 0);
+                written += (size_t) pieceWritten;
+                skip += (size_t) pieceWritten;
+                if (skip == piece.length()) {
+                    skip = 0;
+                    continue;
+                }
+            }
+            if (optionally) {
+                return {(int) written, true};
+            }
+            asyncSocketData->buffer.append(piece.data() + skip, piece.length() - skip);
+            skip = 0;
+        }
+
+        return {(int) length, written < length};
+#else
+        return {0, true};
+#endif
+    }
+
+    /* Writes cork buffer and src in one syscall (non-SSL only), buffering anything that did not make it.
+     * The cork buffer is already accounted for, so only bytes of src are returned as written. */
+    std::pair<int, bool> spill(const char *src, int length, bool optionally) {
+        LoopData *loopData = getLoopData();
+        AsyncSocketData<SSL> *asyncSocketData = getAsyncSocketData();
+
+        int corked = (int) loopData->corkOffset;
+        loopData->corkOffset = 0;
+
+        int written = writeToSocket(loopData->corkBuffer, corked, src, length);
+        if (written == corked + length) {
+            return {length, false};
+        }
+
+        /* We have backpressure, so there is no point in staying corked */
+        loopData->corkedSocket = nullptr;
+
+        if (written < corked) {
+            asyncSocketData->buffer.append(loopData->corkBuffer + written, (size_t) (corked - written));
+            written = 0;
+        } else {
+            written -= corked;
+        }
+
+        if (optionally) {
+            return {written, true};
+        }
+
+        asyncSocketData->buffer.append(src + written, (size_t) (length - written));
+        return {length, true};
+    }
+
     /* Uncork this socket and flush or buffer any corked and/or passed data. It is essential to remember doing this. */
     /* It does NOT count bytes written from cork buffer (they are already accounted for in the write call responsible for its corking)! */
     std::pair<int, bool> uncork(const char *src = nullptr, int length = 0, bool optionally = false) {
         LoopData *loopData = getLoopData();
 
         if (loopData->corkedSocket == this) {
+            UWS_TRACE(socket__uncork, this, loopData->corkOffset);
             loopData->corkedSocket = nullptr;
 
             if (loopData->corkOffset) {
@@ -18,51 +18,386 @@
 #ifndef UWS_ASYNCSOCKETDATA_H
 #define UWS_ASYNCSOCKETDATA_H
 
-#include <string>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+#include "SharedBuffer.h"
+#include "LoopData.h"
+#include "Tracepoints.h"
 
 namespace uWS {
 
+/* Backpressure is queued in a list of blocks. Bytes once queued are never moved, written blocks go back to the
+ * BackPressurePool for whichever socket queues next */
+struct BackPressureBlock {
+    BackPressureBlock *next;
+    /* Written from offset up to length, capacity follows this header */
+    unsigned int offset, length, capacity;
+    /* A block referencing a SharedBuffer holds no capacity of its own */
+    SharedBuffer::Control *shared;
+    /* Where this block goes back to, see Loop::setMemoryResource */
+    std::pmr::memory_resource *resource;
+
+    char *data() {
+        return shared ? (char *) shared->data : (char *) (this + 1);
+    }
+
+    size_t size() {
+        return sizeof(BackPressureBlock) + (shared ? 0 : capacity);
+    }
+};
+
+struct BackPressurePool {
+    /* Including the block header */
+    static const unsigned int BLOCK_SIZE = 16 * 1024;
+    static const unsigned int BLOCK_CAPACITY = BLOCK_SIZE - (unsigned int) sizeof(BackPressureBlock);
+
+    /* Idle blocks kept around for reuse, anything above this is freed */
+    static const unsigned int MAX_IDLE_BLOCKS = 256;
+
+    /* A thread runs at most one loop, so per thread is per loop and needs no locking */
+    static BackPressurePool &get() {
+        static thread_local BackPressurePool pool;
+        return pool;
+    }
+
+    /* Blocks larger than BLOCK_CAPACITY are allocated as needed, and never pooled */
+    BackPressureBlock *acquire(size_t capacity) {
+        BackPressureBlock *block;
+        if (capacity <= BLOCK_CAPACITY && idleBlocks.size()) {
+            block = idleBlocks.back();
+            idleBlocks.pop_back();
+        } else {
+            capacity = capacity < BLOCK_CAPACITY ? BLOCK_CAPACITY : capacity;
+            block = (BackPressureBlock *) resource->allocate(sizeof(BackPressureBlock) + capacity, alignof(BackPressureBlock));
+            block->capacity = (unsigned int) capacity;
+            block->resource = resource;
+            bytes += sizeof(BackPressureBlock) + capacity;
+        }
+        block->next = nullptr;
+        block->offset = block->length = 0;
+        block->shared = nullptr;
+        return block;
+    }
+
+    /* References (part of) a shared buffer, full from the start */
+    BackPressureBlock *acquire(const SharedBuffer &buffer, size_t offset) {
+        BackPressureBlock *block = (BackPressureBlock *) resource->allocate(sizeof(BackPressureBlock), alignof(BackPressureBlock));
+        block->next = nullptr;
+        block->offset = (unsigned int) offset;
+        block->length = block->capacity = (unsigned int) buffer.length();
+        block->shared = SharedBuffer::retain(buffer.getControl());
+        block->resource = resource;
+        bytes += block->size();
+        return block;
+    }
+
+    void release(BackPressureBlock *block) {
+        if (block->shared) {
+            SharedBuffer::release(block->shared);
+            deallocate(block);
+        } else if (block->capacity == BLOCK_CAPACITY && block->resource == resource && idleBlocks.size() < MAX_IDLE_BLOCKS) {
+            idleBlocks.push_back(block);
+        } else {
+            deallocate(block);
+        }
+    }
+
+    static void deallocate(BackPressureBlock *block) {
+        get().bytes -= block->size();
+        block->resource->deallocate(block, block->size(), alignof(BackPressureBlock));
+    }
+
+    /* Blocks from then on come from resource, idle ones of the previous resource go back to it */
+    void setResource(std::pmr::memory_resource *resource) {
+        trim();
+        this->resource = resource;
+    }
+
+    std::pmr::memory_resource *getResource() {
+        return resource;
+    }
+
+    /* Frees all idle blocks */
+    void trim() {
+        for (BackPressureBlock *block : idleBlocks) {
+            deallocate(block);
+        }
+        idleBlocks.clear();
+    }
+
+    ~BackPressurePool() {
+        trim();
+    }
+
+    /* Held in blocks by the sockets of this thread and by us, idle ones included */
+    size_t bytes = 0;
+
+private:
+    std::vector<BackPressureBlock *> idleBlocks;
+    std::pmr::memory_resource *resource = std::pmr::new_delete_resource();
+};
+
+/* Bytes queued as backpressure by the sockets of this loop (kept per thread, like BackPressurePool), and by the whole process.
+ * The process counter is shared by all loops, so it is only updated in steps of PROCESS_STEP */
+struct BackPressureBudget {
+    static const long long PROCESS_STEP = 64 * 1024;
+
+    static inline std::atomic<size_t> processBytes = 0;
+    /* Set by Loop::setBackPressureBudget, 0 for unlimited */
+    static inline std::atomic<size_t> maxProcessBytes = 0;
+
+    size_t loopBytes = 0;
+    /* Number of non-empty queues, for the average */
+    size_t loopQueues = 0;
+    long long processDelta = 0;
+
+    static BackPressureBudget &get() {
+        static thread_local BackPressureBudget budget;
+        return budget;
+    }
+
+    void update(size_t before, size_t after) {
+#ifdef UWS_USDT
+        /* The highest bit differs, from 64 KB */
+        if (std::max(before, after) >= 65536 && (before ^ after) > std::min(before, after)) {
+            UWS_TRACE(backpressure__threshold, before, after);
+        }
+#endif
+        loopBytes = loopBytes - before + after;
+        loopQueues = loopQueues - (before != 0) + (after != 0);
+        processDelta += (long long) after - (long long) before;
+        if (processDelta >= PROCESS_STEP || processDelta <= -PROCESS_STEP) {
+            processBytes.fetch_add((size_t) processDelta, std::memory_order_relaxed);
+            processDelta = 0;
+        }
+    }
+
+    size_t average() {
+        return loopQueues ? loopBytes / loopQueues : 0;
+    }
+};
+
+/* The bytes of every channel not yet written, for WebSockets multiplexing channels (see WebSocket::sendOnChannel).
+ * A message is marked with where it ends in the bytes of the socket, and taken off once written past that */
+struct BackPressureChannels {
+    struct Mark {
+        uint64_t end;
+        uint32_t channel, length;
+    };
+
+    /* Bytes written since we were made, see AsyncSocket::writeToSocket */
+    uint64_t written = 0;
+    std::deque<Mark> marks;
+    std::vector<size_t> queued;
+
+    /* A message of channel was just sent, with pending bytes of the socket (it last) not written yet */
+    void mark(unsigned int channel, size_t length, size_t pending) {
+        if (!pending) {
+            return;
+        }
+        length = std::min(length, pending);
+        if (queued.size() <= channel) {
+            queued.resize(channel + 1);
+        }
+        queued[channel] += length;
+        marks.push_back({written + pending, channel, (uint32_t) length});
+    }
+
+    void onWritten(size_t length) {
+        written += length;
+        while (marks.size() && marks.front().end <= written) {
+            queued[marks.front().channel] -= marks.front().length;
+            marks.pop_front();
+        }
+    }
+
+    size_t length(unsigned int channel) {
+        return channel < queued.size() ? queued[channel] : 0;
+    }
+};
+
 struct BackPressure {
-    std::string buffer;
-    unsigned int pendingRemoval = 0;
-    BackPressure(BackPressure &&other) {
-        buffer = std::move(other.buffer);
-        pendingRemoval = other.pendingRemoval;
+private:
+    BackPressureBlock *head = nullptr, *tail = nullptr;
+    size_t queued = 0;
+    /* Made by the first message sent on a channel */
+    std::unique_ptr<BackPressureChannels> channels;
+
+    BackPressureBlock *link(BackPressureBlock *block) {
+        if (tail) {
+            tail->next = block;
+        } else {
+            head = block;
+        }
+        tail = block;
+        return block;
+    }
+
+    BackPressureBlock *grow(size_t capacity) {
+        return link(BackPressurePool::get().acquire(capacity));
+    }
+
+public:
+    BackPressure(BackPressure &&other) : head(other.head), tail(other.tail), queued(other.queued), channels(std::move(other.channels)) {
+        other.head = other.tail = nullptr;
+        other.queued = 0;
     }
     BackPressure() = default;
+    BackPressure(const BackPressure &) = delete;
+    BackPressure &operator=(const BackPressure &) = delete;
+
+    ~BackPressure() {
+        clear();
+    }
+
     void append(const char *data, size_t length) {
-        buffer.append(data, length);
+        BackPressureBudget::get().update(queued, queued + length);
+        queued += length;
+        while (length) {
+            BackPressureBlock *block = tail;
+            if (!block || block->length == block->capacity) {
+                block = grow(length);
+            }
+            size_t chunk = std::min<size_t>(length, block->capacity - block->length);
+            memcpy(block->data() + block->length, data, chunk);
+            block->length += (unsigned int) chunk;
+            data += chunk;
+            length -= chunk;
+        }
+    }
+
+    /* Queues buffer from offset by reference, without copying it */
+    void append(const SharedBuffer &buffer, size_t offset) {
+        if (offset == buffer.length()) {
+            return;
+        }
+        BackPressureBudget::get().update(queued, queued + buffer.length() - offset);
+        queued += buffer.length() - offset;
+        link(BackPressurePool::get().acquire(buffer, offset));
+    }
+
+    /* Queues length contiguous bytes for the caller to fill in */
+    char *allocate(size_t length) {
+        BackPressureBlock *block = tail;
+        if (!block || block->capacity - block->length < length) {
+            block = grow(length);
+        }
+        char *data = block->data() + block->length;
+        block->length += (unsigned int) length;
+        BackPressureBudget::get().update(queued, queued + length);
+        queued += length;
+        return data;
+    }
+
+    /* Removes length written bytes from the front */
+    void erase(size_t length) {
+        BackPressureBudget::get().update(queued, queued - length);
+        queued -= length;
+        while (length) {
+            size_t available = head->length - head->offset;
+            if (length < available) {
+                head->offset += (unsigned int) length;
+                return;
+            }
+            length -= available;
+            BackPressureBlock *next = head->next;
+            BackPressurePool::get().release(head);
+            head = next;
+        }
+        /* Keep the empty tail for reuse, unless we emptied it */
+        if (!head) {
+            tail = nullptr;
+        } else if (head->offset == head->length && !head->next && !head->shared) {
+            head->offset = head->length = 0;
+        }
     }
-    void erase(unsigned int length) {
-        pendingRemoval += length;
-        /* Always erase a minimum of 1/32th the current backpressure */
-        if (pendingRemoval > (buffer.length() >> 5)) {
-            buffer.erase(0, pendingRemoval);
-            pendingRemoval = 0;
+
+    /* Fills in up to max queued segments from the front, returning how many, for use with vectored writes */
+    unsigned int segments(std::string_view *out, unsigned int max) {
+        unsigned int numSegments = 0;
+        for (BackPressureBlock *block = head; block && numSegments < max; block = block->next) {
+            if (block->length != block->offset) {
+                out[numSegments++] = std::string_view(block->data() + block->offset, block->length - block->offset);
+            }
         }
+        return numSegments;
     }
+
     size_t length() {
-        return buffer.length() - pendingRemoval;
+        return queued;
     }
-    void clear() {
-        pendingRemoval = 0;
-        buffer.clear();
+
+    BackPressureChannels &getChannels() {
+        if (!channels) {
+            channels = std::make_unique<BackPressureChannels>();
+        }
+        return *channels;
     }
-    void reserve(size_t length) {
-        buffer.reserve(length + pendingRemoval);
+
+    size_t getChannelLength(unsigned int channel) {
+        return channels ? channels->length(channel) : 0;
     }
-    void resize(size_t length) {
-        buffer.resize(length + pendingRemoval);
+
+    /* Written bytes to count against our channels, if we have any */
+    void onWritten(size_t length) {
+        if (channels) {
+            channels->onWritten(length);
+        }
     }
-    const char *data() {
-        return buffer.data() + pendingRemoval;
+
+    void clear() {
+        while (head) {
+            BackPressureBlock *next = head->next;
+            BackPressurePool::get().release(head);
+            head = next;
+        }
+        tail = nullptr;
+        if (queued) {
+            BackPressureBudget::get().update(queued, 0);
+            queued = 0;
+        }
     }
     size_t size() {
         return length();
     }
-    /* The total length, incuding pending removal */
+    /* Nothing is pending removal, queued bytes are removed as soon as written */
     size_t totalLength() {
-        return buffer.length();
+        return queued;
+    }
+
+    /* Moving to another thread (see WebSocket migration), whose budget counts us from then on. Blocks of
+     * a loop's own memory resource must not outlive it, so they are copied to the heap */
+    void leaveBudget() {
+        BackPressureBudget::get().update(queued, 0);
+        for (BackPressureBlock **link = &head; *link; link = &(*link)->next) {
+            BackPressureBlock *block = *link;
+            BackPressurePool::get().bytes -= block->size();
+            if (block->resource != std::pmr::new_delete_resource()) {
+                BackPressureBlock *copy = (BackPressureBlock *) std::pmr::new_delete_resource()->allocate(block->size(), alignof(BackPressureBlock));
+                memcpy((void *) copy, (void *) block, block->size());
+                copy->resource = std::pmr::new_delete_resource();
+                block->resource->deallocate(block, block->size(), alignof(BackPressureBlock));
+                *link = copy;
+                if (tail == block) {
+                    tail = copy;
+                }
+            }
+        }
+    }
+
+    void joinBudget() {
+        BackPressureBudget::get().update(0, queued);
+        for (BackPressureBlock *block = head; block; block = block->next) {
+            BackPressurePool::get().bytes += block->size();
+        }
     }
 };
 
@@ -73,6 +408,20 @@ struct AsyncSocketData {
     /* This will do for now */
     BackPressure buffer;
 
+    /* Held while another socket holds the cork buffer, and we have no backpressure */
+    CorkSlice *corkSlice = nullptr;
+
+    /* Coroutines bound to this socket, if any */
+    CoroutineLink *coroutines = nullptr;
+
+    /* What we read past the read budget of the loop and is yet to be handed back, if any */
+    ParkedRead *parkedRead = nullptr;
+    /* Reads paused by the application, as opposed to by the read budget or shedding */
+    bool pausedByUser = false;
+    /* Iterations in a row we read past the budget, as of the last of them */
+    uint32_t overBudgetIteration = 0;
+    uint8_t overBudgetStreak = 0;
+
     /* Allow move constructing us */
     AsyncSocketData(BackPressure &&backpressure) : buffer(std::move(backpressure)) {
 
@@ -80,6 +429,52 @@ struct AsyncSocketData {
 
     /* Or emppty */
     AsyncSocketData() = default;
+
+    /* A closed socket is skipped when flushing slices */
+    ~AsyncSocketData() {
+        if (corkSlice) {
+            corkSlice->socket = nullptr;
+        }
+        if (parkedRead) {
+            parkedRead->socket = nullptr;
+        }
+        abortCoroutines();
+    }
+
+    /* Each is unlinked before it is told, and may be destroyed right away */
+    void abortCoroutines() {
+        while (coroutines) {
+            CoroutineLink *link = coroutines;
+            link->unlink();
+            link->abort(link);
+        }
+    }
+
+    /* As our socket closes: aborts our coroutines, and if some of them are running, as when they closed us, the rest
+     * of us lives on until the last of them suspends or returns. Then release(socket) is called to destroy us instead
+     * of the caller doing so, which it must only do if this returns false */
+    bool holdForCoroutines(void (*release)(void *socket), void *socket) {
+        CoroutineHold *hold = nullptr;
+        while (coroutines) {
+            CoroutineLink *link = coroutines;
+            link->unlink();
+            if (link->abort(link)) {
+                if (!hold) {
+                    hold = new CoroutineHold{0, release, socket};
+                }
+                link->hold = hold;
+                hold->holders++;
+            }
+        }
+        return hold;
+    }
+
+    /* They are on their own from here */
+    void detachCoroutines() {
+        while (coroutines) {
+            coroutines->unlink();
+        }
+    }
 };
 
 }
@@ -0,0 +1,82 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_BODYCOLLECTOR_H
+#define UWS_BODYCOLLECTOR_H
+
+/* The state of HttpResponse::collectBody, fed the chunks of its onData */
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "LoopData.h"
+
+namespace uWS {
+
+struct BodyCollector {
+    size_t maxBytes;
+    /* Pooled by the loop, taken once a body does not arrive in one piece */
+    std::string body;
+    bool collecting = false, rejected = false;
+
+    BodyCollector(size_t maxBytes) : maxBytes(maxBytes) {}
+
+    /* Remaining is what Content-Length says is left as of before this chunk, UINT64_MAX if unknown. Hands the
+     * whole body to handler with the last chunk. False if the body is (or would be) over maxBytes, the body is
+     * then rejected and later chunks are ignored */
+    template <typename Handler>
+    bool collect(LoopData *loopData, uint64_t remaining, std::string_view chunk, bool fin, Handler &&handler) {
+        if (rejected) {
+            return true;
+        }
+
+        if (!collecting) {
+            if ((remaining != UINT64_MAX && remaining > maxBytes) || chunk.length() > maxBytes) {
+                rejected = true;
+                return false;
+            }
+            if (fin) {
+                handler(chunk);
+                return true;
+            }
+            body = loopData->acquireBodyBuffer();
+            if (remaining != UINT64_MAX) {
+                body.reserve(remaining);
+            }
+            collecting = true;
+        }
+
+        if (body.length() + chunk.length() > maxBytes) {
+            rejected = true;
+            loopData->releaseBodyBuffer(std::move(body));
+            return false;
+        }
+        body.append(chunk);
+
+        if (fin) {
+            handler(std::string_view(body));
+            loopData->releaseBodyBuffer(std::move(body));
+            collecting = false;
+        }
+        return true;
+    }
+};
+
+}
+
+#endif // UWS_BODYCOLLECTOR_H
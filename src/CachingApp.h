@@ -2,31 +2,45 @@
 #define UWS_CACHINGAPP_H
 
 #include "App.h"
+#include "SharedCache.h"
+#include <algorithm>
 #include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <functional>
 #include <string_view>
+#include <vector>
 
 namespace uWS {
 
+/* Transparent, so that keys we own can be looked up by views into the request */
 struct StringViewHash {
+    using is_transparent = void;
+
     size_t operator()(std::string_view sv) const {
         return std::hash<std::string_view>{}(sv);
     }
 };
 
 struct StringViewEqual {
+    using is_transparent = void;
+
     bool operator()(std::string_view sv1, std::string_view sv2) const {
         return sv1 == sv2;
     }
 };
 
+template <bool SSL> class Cache;
 
-
-class CachingHttpResponse {
+/* What a cached handler writes to: the body, generated once for every request waiting on it (single-flight).
+ * Requests missing the cache while it is generated wait here instead of running the handler again.
+ * Ending may evict us right away (we may be over budget on our own), so do not touch us after end */
+template <bool SSL>
+class TemplatedCachingHttpResponse {
 public:
-    CachingHttpResponse(uWS::HttpResponse<false> *res)
-        : res(res) {}
+    TemplatedCachingHttpResponse(Cache<SSL> *cache, std::string_view vary) : cache(cache), vary(vary) {}
 
     void write(std::string_view data) {
         buffer.append(data);
@@ -34,26 +48,372 @@ public:
 
     void end(std::string_view data = "", bool closeConnection = false) {
         buffer.append(data);
+        SharedBuffer body = SharedBuffer::copy(buffer);
+        std::string().swap(buffer);
+        complete(std::move(body), static_cast<LoopData *>(us_loop_ext((us_loop_t *) uWS::Loop::get()))->cacheTimepoint, closeConnection);
+    }
+
+    /* Completes us with body as generated at created, by us or (through the shared cache) someone else */
+    void complete(SharedBuffer body, time_t created, bool closeConnection = false) {
+        this->body = std::move(body);
+        this->created = created;
+        completed = true;
+        generatingSince = 0;
+
+        /* Other loops waiting on us first, they have yet to be woken up */
+        if (claimed) {
+            claimed = false;
+            cache->publish(this);
+        }
+
+        /* End for all queued up sockets also, each in one corked burst */
+        std::vector<HttpResponse<SSL> *> ending;
+        ending.swap(waiters);
+        for (HttpResponse<SSL> *res : ending) {
+            /* No longer ours to hear of, even if ending takes a while */
+            res->onAborted([]() {});
+            res->cork([res, this, closeConnection]() {
+                respond(res, closeConnection);
+            });
+        }
+
+        cache->completed(this);
+    }
+
+    /* Completed and not older than secondsToExpiry */
+    bool isFresh(time_t now) const {
+        return completed && created + secondsToExpiry > now;
+    }
+
+    /* Ends res once completed, or leaves it be if aborted before that. Once nobody here waits for what we
+     * claimed, other loops are not kept waiting on it either */
+    void wait(HttpResponse<SSL> *res) {
+        waiters.push_back(res);
+        res->onAborted([this, res]() {
+            for (size_t i = 0; i < waiters.size(); i++) {
+                if (waiters[i] == res) {
+                    waiters[i] = waiters.back();
+                    waiters.pop_back();
+                    break;
+                }
+            }
+            if (waiters.empty() && claimed) {
+                claimed = false;
+                cache->release(this);
+            }
+        });
+    }
 
-        // end for all queued up sockets also
-        res->end(buffer);
+    /* Given up on, here or by whoever claimed us elsewhere: what waits so far gets a 504, and any claim of
+     * ours is released. A handler generating us may still end us */
+    void abandon() {
+        if (claimed) {
+            claimed = false;
+            cache->release(this);
+        }
+
+        std::vector<HttpResponse<SSL> *> ending;
+        ending.swap(waiters);
+        for (HttpResponse<SSL> *res : ending) {
+            res->onAborted([]() {});
+            res->cork([res]() {
+                res->writeStatus("504 Gateway Timeout")->end();
+            });
+        }
+    }
+
+    /* Generating again, to the same waiters as before (none, if we were completed) */
+    void reset() {
+        buffer.clear();
+        completed = false;
+    }
 
-        created = time(0);
+    bool isCompleted() const {
+        return completed;
+    }
 
-        std::ignore = closeConnection;
+    /* Ends res with what we hold */
+    void respond(HttpResponse<SSL> *res, bool closeConnection = false) {
+        if (vary.length()) {
+            res->writeHeader("Vary", vary);
+        }
+        res->end(body, closeConnection);
     }
 
 public:
-    uWS::HttpResponse<false>* res; // should be a vector of waiting sockets
+    /* Responses waiting for us to complete, in the order they came */
+    std::vector<HttpResponse<SSL> *> waiters;
 
+    std::string buffer; // written so far
+    SharedBuffer body; // once completed, sent as is to every response
+    time_t created = 0;
+    unsigned int secondsToExpiry = 0;
+    bool completed = false;
 
-    std::string buffer; // body
-    time_t created;
+private:
+    friend class Cache<SSL>;
+
+    Cache<SSL> *cache;
+    /* Names of the headers we were keyed on, as told to clients */
+    std::string vary;
+
+    /* Our key, owned by the map, and our place in the recency list (only while completed) */
+    const std::string *key = nullptr;
+    TemplatedCachingHttpResponse *prev = nullptr, *next = nullptr;
+    /* Bytes we were accounted with on completion */
+    size_t weight = 0;
+    /* Ours to fill the shared cache with */
+    bool claimed = false;
+    /* When our handler began generating us here, 0 if it is not */
+    time_t generatingSince = 0;
 };
 
-typedef std::unordered_map<std::string_view, CachingHttpResponse *, 
-                       StringViewHash, 
-                       StringViewEqual> CacheType;
+typedef TemplatedCachingHttpResponse<false> CachingHttpResponse;
+
+template <bool SSL>
+using CacheType = std::unordered_map<std::string, std::unique_ptr<TemplatedCachingHttpResponse<SSL>>,
+                       StringViewHash,
+                       StringViewEqual>;
+
+/* The entries of one CachingApp, bounded in bytes. Completed entries are kept in least recently used order
+ * and evicted from its front once over budget; entries being generated are never evicted (their waiters
+ * point to them). Expired entries are dropped once a second, from the date timer, rather than on next hit.
+ * So are the waiters of handlers taking longer than GENERATE_TIMEOUT_S */
+template <bool SSL>
+class Cache {
+public:
+    typedef TemplatedCachingHttpResponse<SSL> Entry;
+
+    /* Per entry bookkeeping we count on top of key and body */
+    static const size_t ENTRY_OVERHEAD = sizeof(Entry) + 64;
+
+    static const unsigned int GENERATE_TIMEOUT_S = 30;
+
+    Cache() : loop(Loop::get()), handle(std::make_shared<Handle>()) {
+        handle->cache = this;
+        handle->loop = loop;
+        loop->addDateHandler(this, [this](Loop *) {
+            time_t now = static_cast<LoopData *>(us_loop_ext((us_loop_t *) loop))->cacheTimepoint;
+            expire(now);
+            if (shared) {
+                shared->expire(now);
+            }
+        });
+    }
+
+    ~Cache() {
+        loop->removeDateHandler(this);
+        setShared(nullptr);
+        std::lock_guard<std::mutex> lock(handle->mutex);
+        handle->cache = nullptr;
+    }
+
+    /* Misses look here before generating, and fills go here too */
+    void setShared(SharedCache *sharedCache) {
+        if (shared) {
+            shared->leave(reader);
+        }
+        shared = sharedCache;
+        reader = shared ? shared->join() : nullptr;
+    }
+
+    /* Completes entry from the shared cache, or has it completed on this loop once whoever claimed it there
+     * filled it. Returns false if it is ours to generate (and fill) */
+    bool claimShared(Entry *entry, time_t now) {
+        if (!shared) {
+            return false;
+        }
+
+        /* We, and the entry, may be gone by the time whoever claimed it is done */
+        SharedBuffer body;
+        time_t created = 0;
+        switch (shared->claim(reader, *entry->key, now, body, created, [handle = handle, key = *entry->key](const SharedBuffer *body, time_t created) mutable {
+            std::lock_guard<std::mutex> lock(handle->mutex);
+            if (!handle->cache) {
+                return;
+            }
+            handle->loop->defer([handle, key = std::move(key), body = body ? std::optional<SharedBuffer>(*body) : std::nullopt, created]() {
+                if (handle->cache) {
+                    handle->cache->filledShared(key, body ? &*body : nullptr, created);
+                }
+            });
+        })) {
+        case SharedCache::HIT:
+            entry->complete(std::move(body), created);
+            return true;
+        case SharedCache::WAIT:
+            return true;
+        default:
+            entry->claimed = true;
+            return false;
+        }
+    }
+
+    /* Called by entries we claimed as they complete */
+    void publish(Entry *entry) {
+        shared->fill(*entry->key, entry->body, entry->created, entry->secondsToExpiry);
+    }
+
+    /* Called by entries we claimed as they give up */
+    void release(Entry *entry) {
+        shared->release(*entry->key);
+    }
+
+    /* What we waited on elsewhere was filled, or given up on (without body). Unless generated here since */
+    void filledShared(const std::string &key, const SharedBuffer *body, time_t created) {
+        Entry *entry = find(key);
+        if (!entry || entry->isCompleted() || entry->claimed || entry->generatingSince) {
+            return;
+        }
+        if (body) {
+            entry->complete(*body, created);
+        } else {
+            /* Nobody here holds it, the next request generates it anew */
+            entry->abandon();
+            erase(entry);
+        }
+    }
+
+    /* Our handler is about to generate entry */
+    void generating(Entry *entry, time_t now) {
+        entry->generatingSince = now;
+        generatingEntries.push_back(entry);
+    }
+
+    Entry *find(std::string_view key) {
+        auto it = entries.find(key);
+        return it == entries.end() ? nullptr : it->second.get();
+    }
+
+    /* A new entry being generated under key */
+    Entry *insert(std::string_view key, std::string_view vary, unsigned int secondsToExpiry) {
+        auto [it, inserted] = entries.emplace(std::string(key), std::make_unique<Entry>(this, vary));
+        Entry *entry = it->second.get();
+        entry->key = &it->first;
+        entry->secondsToExpiry = secondsToExpiry;
+        return entry;
+    }
+
+    /* Hit, so last to be evicted */
+    void touch(Entry *entry) {
+        if (entry != tail) {
+            unlink(entry);
+            link(entry);
+        }
+    }
+
+    /* Stale entry to generate again, in place */
+    void regenerate(Entry *entry) {
+        unlink(entry);
+        totalBytes -= entry->weight;
+        entry->weight = 0;
+        entry->reset();
+    }
+
+    /* Called by entries as they end */
+    void completed(Entry *entry) {
+        generatingEntries.erase(std::remove(generatingEntries.begin(), generatingEntries.end(), entry), generatingEntries.end());
+        entry->weight = entry->key->length() + entry->body.length() + ENTRY_OVERHEAD;
+        totalBytes += entry->weight;
+        link(entry);
+
+        while (totalBytes > maxBytes && head) {
+            erase(head);
+        }
+    }
+
+    /* Drops every completed entry no longer fresh at now, and the waiters of those generated for too long.
+     * Those arriving later wait another GENERATE_TIMEOUT_S */
+    void expire(time_t now) {
+        for (Entry *entry = head; entry; ) {
+            Entry *next = entry->next;
+            if (!entry->isFresh(now)) {
+                erase(entry);
+            }
+            entry = next;
+        }
+        for (Entry *entry : generatingEntries) {
+            if (entry->generatingSince + GENERATE_TIMEOUT_S <= now) {
+                entry->generatingSince = now;
+                entry->abandon();
+            }
+        }
+    }
+
+    void setMaxBytes(size_t bytes) {
+        maxBytes = bytes;
+        while (totalBytes > maxBytes && head) {
+            erase(head);
+        }
+    }
+
+    size_t getTotalBytes() const {
+        return totalBytes;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    /* Reused for building keys out of the request, so that hits do not allocate */
+    std::string keyBuffer;
+
+private:
+    void link(Entry *entry) {
+        entry->prev = tail;
+        entry->next = nullptr;
+        if (tail) {
+            tail->next = entry;
+        } else {
+            head = entry;
+        }
+        tail = entry;
+    }
+
+    /* Only completed entries are linked */
+    void unlink(Entry *entry) {
+        if (!entry->isCompleted()) {
+            return;
+        }
+        if (entry->prev) {
+            entry->prev->next = entry->next;
+        } else {
+            head = entry->next;
+        }
+        if (entry->next) {
+            entry->next->prev = entry->prev;
+        } else {
+            tail = entry->prev;
+        }
+        entry->prev = entry->next = nullptr;
+    }
+
+    void erase(Entry *entry) {
+        unlink(entry);
+        totalBytes -= entry->weight;
+        /* By iterator, since the key we hold is the one being destroyed */
+        entries.erase(entries.find(*entry->key));
+    }
+
+    /* What fills from other threads find us by, if we are still there */
+    struct Handle {
+        std::mutex mutex;
+        Cache *cache;
+        Loop *loop;
+    };
+
+    Loop *loop;
+    std::shared_ptr<Handle> handle;
+    SharedCache *shared = nullptr;
+    SharedCache::Reader *reader = nullptr;
+    CacheType<SSL> entries;
+    /* Least recently used first */
+    Entry *head = nullptr, *tail = nullptr;
+    /* Being generated by our handlers */
+    std::vector<Entry *> generatingEntries;
+    size_t totalBytes = 0;
+    size_t maxBytes = 64 * 1024 * 1024;
+};
 
 // we can also derive from H3app later on
 template <bool SSL>
@@ -64,52 +424,97 @@ public:
     using uWS::TemplatedAppBase<SSL, CachingApp<SSL>>::get;
 
     CachingApp(const CachingApp &other) = delete;
-    CachingApp(CachingApp<SSL> &&other) : uWS::TemplatedAppBase<SSL, CachingApp<SSL>>(std::move(other)) {
-        // also move the cache
+    /* Handlers hold on to the cache rather than to us, so it moves along as is */
+    CachingApp(CachingApp<SSL> &&other) : uWS::TemplatedAppBase<SSL, CachingApp<SSL>>(std::move(other)), cache(std::move(other.cache)) {
+
     }
 
     ~CachingApp() {
 
     }
 
-    // variant 1: only taking URL into account
-    CachingApp &&get(const std::string& url, uWS::MoveOnlyFunction<void(CachingHttpResponse*, uWS::HttpRequest*)> &&handler, unsigned int secondsToExpiry) {
-        ((uWS::TemplatedAppBase<SSL, CachingApp<SSL>> *)this)->get(url, [this, handler = std::move(handler), secondsToExpiry](auto* res, auto* req) mutable {
+    /* Cached GET: the first request missing url (plus the values of varyHeaders, lowercase names) runs the
+     * handler, every other one arriving until it ends waits for its response, and for secondsToExpiry after
+     * that they are answered from memory, with a Vary listing varyHeaders */
+    CachingApp &&get(const std::string& url, uWS::MoveOnlyFunction<void(TemplatedCachingHttpResponse<SSL>*, uWS::HttpRequest*)> &&handler, unsigned int secondsToExpiry, std::vector<std::string> varyHeaders = {}) {
+        std::string vary;
+        for (const std::string &header : varyHeaders) {
+            vary.append(vary.length() ? ", " : "").append(header);
+        }
+
+        ((uWS::TemplatedAppBase<SSL, CachingApp<SSL>> *)this)->get(url, [cache = cache.get(), handler = std::move(handler), secondsToExpiry, varyHeaders = std::move(varyHeaders), vary = std::move(vary)](auto* res, auto* req) mutable {
             /* We need to know the cache key and the time of now */
             std::string_view cache_key = req->getFullUrl();
+            if (varyHeaders.size()) {
+                cache->keyBuffer.assign(cache_key);
+                for (const std::string &header : varyHeaders) {
+                    /* Absent and empty are told apart, since neither is a valid header value */
+                    std::string_view value = req->getHeader(header);
+                    cache->keyBuffer.append(1, value.data() ? '\0' : '\1').append(value);
+                }
+                cache_key = cache->keyBuffer;
+            }
             time_t now = static_cast<LoopData *>(us_loop_ext((us_loop_t *)uWS::Loop::get()))->cacheTimepoint;
 
-            auto it = cache.find(cache_key);
-            if (it != cache.end()) {
-
-                if (it->second->created + secondsToExpiry > now) {
-                    res->end(it->second->buffer); // tryEnd!
+            TemplatedCachingHttpResponse<SSL> *cachingRes = cache->find(cache_key);
+            if (cachingRes) {
+                /* Completed and still valid, use it */
+                if (cachingRes->isFresh(now)) {
+                    cache->touch(cachingRes);
+                    cachingRes->respond(res); // tryEnd!
                     return;
                 }
 
-                /* We are no longer valid, delete old cache and fall through to create a new entry */
-                delete it->second;
-
-                // is the cache completed? if not, add yourself to the waiting list of sockets to that cache
+                /* Not completed yet, add ourselves to the waiting list of sockets to it */
+                if (!cachingRes->isCompleted()) {
+                    cachingRes->wait(res);
+                    return;
+                }
 
-                // if the cache completed? ok, is it still valid? use it
+                /* We are no longer valid, generate again in place with us as the first waiter */
+                cache->regenerate(cachingRes);
+                cachingRes->secondsToExpiry = secondsToExpiry;
+                cachingRes->wait(res);
+                if (!cache->claimShared(cachingRes, now)) {
+                    cache->generating(cachingRes, now);
+                    handler(cachingRes, req);
+                }
+                return;
             }
 
             // immediately take the place in the cache
-            CachingHttpResponse *cachingRes;
-            cache[cache_key] = (cachingRes = new CachingHttpResponse(res));
+            cachingRes = cache->insert(cache_key, vary, secondsToExpiry);
+            cachingRes->wait(res);
 
-            handler(cachingRes, req);
+            if (!cache->claimShared(cachingRes, now)) {
+                cache->generating(cachingRes, now);
+                handler(cachingRes, req);
+            }
         });
         return std::move(*this);
     }
 
-    // variant 2: taking URL and a list of headers into account
-    // todo
+    /* Total bytes (keys, bodies and bookkeeping) the cache may hold before evicting least recently used */
+    CachingApp &&setCacheBudget(size_t bytes) {
+        cache->setMaxBytes(bytes);
+        return std::move(*this);
+    }
+
+    /* Shares the responses of this app with the others using sharedCache (one per loop, typically), which
+     * has to outlive them. Do this before listening */
+    CachingApp &&setSharedCache(SharedCache *sharedCache) {
+        cache->setShared(sharedCache);
+        return std::move(*this);
+    }
+
+    size_t getCacheBytes() {
+        return cache->getTotalBytes();
+    }
 
 private:
-    CacheType cache;
+    /* On the heap, since our handlers point to it */
+    std::unique_ptr<Cache<SSL>> cache = std::make_unique<Cache<SSL>>();
 };
 
 }
-#endif
\ No newline at end of file
+#endif
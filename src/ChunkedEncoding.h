@@ -39,43 +39,54 @@ namespace uWS {
         return state & STATE_SIZE_MASK;
     }
 
-    /* Reads hex number until CR or out of data to consume. Updates state. Returns bytes consumed. */
-    inline void consumeHexNumber(std::string_view &data, uint64_t &state) {
-        /* Consume everything higher than 32 */
-        while (data.length() && data.data()[0] > 32) {
-
-            unsigned char digit = (unsigned char)data.data()[0];
-            if (digit >= 'a') {
-                digit = (unsigned char) (digit - ('a' - ':'));
-            } else if (digit >= 'A') {
-                digit = (unsigned char) (digit - ('A' - ':'));
-            }
+    /* Maps hex digits to their value, everything else to 0xff */
+    struct HexTable {
+        unsigned char values[256];
 
-            unsigned int number = ((unsigned int) digit - (unsigned int) '0');
-
-            if (number > 16 || (chunkSize(state) & STATE_SIZE_OVERFLOW)) {
-                state = STATE_IS_ERROR;
-                return;
+        constexpr HexTable() : values() {
+            for (int i = 0; i < 256; i++) {
+                values[i] = 0xff;
             }
+            for (int i = 0; i < 10; i++) {
+                values['0' + i] = (unsigned char) i;
+            }
+            for (int i = 0; i < 6; i++) {
+                values['a' + i] = values['A' + i] = (unsigned char) (10 + i);
+            }
+        }
+    };
 
-            // extract state bits
-            uint64_t bits = /*state &*/ STATE_IS_CHUNKED;
-
-            state = (state & STATE_SIZE_MASK) * 16ull + number;
+    inline constexpr HexTable hexTable;
 
-            state |= bits;
-            data.remove_prefix(1);
+    /* Reads hex number until CR or out of data to consume. Updates state. Returns bytes consumed. */
+    inline void consumeHexNumber(std::string_view &data, uint64_t &state) {
+        const unsigned char *p = (const unsigned char *) data.data(), *end = p + data.length();
+
+        /* Consume everything higher than 32, which must all be hex digits */
+        if (p != end && *p > 32) {
+            uint64_t size = chunkSize(state);
+            do {
+                unsigned char number = hexTable.values[*p];
+                if (number == 0xff || (size & STATE_SIZE_OVERFLOW)) {
+                    state = STATE_IS_ERROR;
+                    return;
+                }
+                size = size * 16ull + number;
+            } while (++p != end && *p > 32);
+            state = size | STATE_IS_CHUNKED;
         }
+
         /* Consume everything not /n */
-        while (data.length() && data.data()[0] != '\n') {
-            data.remove_prefix(1);
+        const unsigned char *newLine = (const unsigned char *) memchr(p, '\n', (size_t) (end - p));
+        if (!newLine) {
+            data.remove_prefix(data.length());
+            return;
         }
+
         /* Now we stand on \n so consume it and enable size */
-        if (data.length()) {
-            state += 2; // include the two last /r/n
-            state |= STATE_HAS_SIZE | STATE_IS_CHUNKED;
-            data.remove_prefix(1);
-        }
+        state += 2; // include the two last /r/n
+        state |= STATE_HAS_SIZE | STATE_IS_CHUNKED;
+        data.remove_prefix((size_t) (newLine + 1 - (const unsigned char *) data.data()));
     }
 
     inline void decChunkSize(uint64_t &state, unsigned int by) {
@@ -190,6 +201,20 @@ namespace uWS {
         return std::nullopt;
     }
 
+    /* Fills chunks with up to maxChunks results of getNextChunk, returning how many.
+     * Returns less than maxChunks only when all data was consumed or the state is invalid. */
+    static unsigned int getNextChunks(std::string_view &data, uint64_t &state, std::string_view *chunks, unsigned int maxChunks, bool trailer = false) {
+        unsigned int numChunks = 0;
+        while (numChunks < maxChunks) {
+            std::optional<std::string_view> chunk = getNextChunk(data, state, trailer);
+            if (!chunk.has_value()) {
+                break;
+            }
+            chunks[numChunks++] = chunk.value();
+        }
+        return numChunks;
+    }
+
     /* This is really just a wrapper for convenience */
     struct ChunkIterator {
 
@@ -1,36 +1,349 @@
-#include "MoveOnlyFunction.h"
-#include "WebSocketContext.h"
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_CLIENTAPP_H
+#define UWS_CLIENTAPP_H
+
+/* A ClientApp makes WebSocket client connections on the thread local Loop. Sockets connect and do the
+ * HTTP upgrade in a minimal handshake context, then are adopted by a WebSocketContext<SSL, false, UserData>
+ * (masking what they send) and from there on behave like server sockets: corked on data, with the same
+ * backpressure, drain and timeout handling. Any number of connects can be in flight at once.
+ * Clients do not offer permessage-deflate and have no pub/sub */
+
+#include <algorithm>
+#include <random>
 #include <string>
+#include <string_view>
+
+#include "App.h"
+#include "ClientHandshake.h"
 
 namespace uWS {
 
-    struct WebSocketClientBehavior {
-        MoveOnlyFunction<void()> open;
-        MoveOnlyFunction<void()> message;
-        MoveOnlyFunction<void()> close;
-        //MoveOnlyFunction<void()> failed;
+const std::string_view ERR_CONNECT("Could not connect");
+const std::string_view ERR_INVALID_URL("Invalid WebSocket URL");
+const std::string_view ERR_CONNECT_TIMEOUT("Timed out connecting");
+const std::string_view ERR_HANDSHAKE_ENDED("Connection ended during handshake");
+const std::string_view ERR_HANDSHAKE_REFUSED("Upgrade refused by server");
+
+/* The same settings and events as a server WebSocketBehavior, minus upgrade and pub/sub */
+template <bool SSL, typename UserData>
+struct WebSocketClientBehavior {
+    /* Maximum message size we can receive */
+    unsigned int maxPayloadLength = 16 * 1024;
+    /* 2 minutes timeout is good */
+    unsigned short idleTimeout = 120;
+    /* 64kb backpressure is probably good */
+    unsigned int maxBackpressure = 64 * 1024;
+    bool closeOnBackpressureLimit = false;
+    bool resetIdleTimeoutOnSend = false;
+    unsigned int coalesceMicroseconds = 0;
+    unsigned int coalesceBytes = CorkSlice::SIZE;
+    bool sendPingsAutomatically = true;
+    unsigned short maxLifetime = 0;
+    /* Seconds to connect and get the upgrade response */
+    unsigned short connectTimeout = 10;
+    MoveOnlyFunction<void(WebSocket<SSL, false, UserData> *)> open = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, false, UserData> *, std::string_view, OpCode)> message = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, false, UserData> *, std::string_view, OpCode, bool)> fragment = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, false, UserData> *, std::string_view, OpCode)> dropped = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, false, UserData> *)> drain = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, false, UserData> *, std::string_view)> ping = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, false, UserData> *, std::string_view)> pong = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, false, UserData> *, int, std::string_view)> close = nullptr;
+    /* Connecting or upgrading failed. Gets the user data given to connect, which is destructed right after */
+    MoveOnlyFunction<void(UserData *, std::string_view)> failed = nullptr;
+};
 
+template <bool SSL, typename UserData = int>
+struct TemplatedClientApp {
+private:
+    /* Responses bigger than this are not upgrades we want */
+    static constexpr unsigned int MAX_HANDSHAKE_LENGTH = 4096;
+    /* WebSocketProtocol may touch bytes before and after what it parses, like in the receive buffer of uSockets */
+    static constexpr unsigned int CONSUME_PADDING = 32;
+
+    /* Per socket until upgraded. Backpressure of the request is kept like for any AsyncSocket */
+    struct ClientSocketData : AsyncSocketData<SSL> {
+        /* The request until written, then the response until complete */
+        std::string handshake;
+        char secWebSocketKey[24];
+        UserData userData;
+
+        ClientSocketData(std::string &&request, UserData &&userData) : handshake(std::move(request)), userData(std::move(userData)) {}
+    };
+
+    struct ClientContextData {
+        WebSocketContext<SSL, false, UserData> *webSocketContext = nullptr;
+        MoveOnlyFunction<void(UserData *, std::string_view)> failedHandler = nullptr;
+        unsigned short connectTimeout = 0;
     };
 
-    struct ClientApp {
+    /* Sockets connect with room for the WebSocket they become, so that adopting them is (usually) in place */
+    static constexpr int SOCKET_EXT_SIZE = (int) std::max(sizeof(ClientSocketData), sizeof(WebSocketData) + sizeof(UserData));
 
-        WebSocketContext<0, false, int> *webSocketContext;
-        // behöver ett nytt http context med minimal klient, som slår om till den riktiga websocketcontext
-        // om samma storlek på httpsocket och websocket blir det enkel övergång
+    us_socket_context_t *clientContext = nullptr;
+    WebSocketContext<SSL, false, UserData> *webSocketContext = nullptr;
 
-        ClientApp(WebSocketClientBehavior &&behavior) {
-            //webSocketContext = WebSocketContext<0, false, int>::create();
+    static ClientContextData *getClientContextData(us_socket_t *s) {
+        return (ClientContextData *) us_socket_context_ext(SSL, us_socket_context(SSL, s));
+    }
+
+    /* Reports and destructs a socket that never made it to WebSocket */
+    static void fail(us_socket_t *s, std::string_view reason) {
+        ClientSocketData *clientSocketData = (ClientSocketData *) us_socket_ext(SSL, s);
+        ClientContextData *clientContextData = getClientContextData(s);
+        if (clientContextData->failedHandler) {
+            clientContextData->failedHandler(&clientSocketData->userData, reason);
+        }
+        clientSocketData->~ClientSocketData();
+    }
+
+    /* 16 random bytes, base64 encoded */
+    static void generateKey(char secWebSocketKey[24]) {
+        static thread_local std::mt19937 random{std::random_device{}()};
+        const char *b64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int i = 0; i < 21; i++) {
+            secWebSocketKey[i] = b64[random() & 63];
         }
+        /* The last 2 bits of the 22nd character are padding */
+        secWebSocketKey[21] = b64[random() & 48];
+        secWebSocketKey[22] = secWebSocketKey[23] = '=';
+    }
+
+    /* Hands the socket over to our WebSocketContext, emits open and parses whatever followed the response */
+    static us_socket_t *upgrade(us_socket_t *s, std::string_view tail) {
+        ClientSocketData *clientSocketData = (ClientSocketData *) us_socket_ext(SSL, s);
+        WebSocketContext<SSL, false, UserData> *webSocketContext = getClientContextData(s)->webSocketContext;
+        WebSocketContextData<SSL, UserData, false> *webSocketContextData = webSocketContext->getExt();
+
+        /* The tail points into our buffer, which is about to go */
+        std::string padded(CONSUME_PADDING + tail.length() + CONSUME_PADDING, 0);
+        memcpy(padded.data() + CONSUME_PADDING, tail.data(), tail.length());
+
+        UserData userData(std::move(clientSocketData->userData));
+        BackPressure backpressure(std::move(clientSocketData->buffer));
+        clientSocketData->~ClientSocketData();
+
+        /* Adopting a socket invalidates it, do not rely on it directly to carry any data */
+        WebSocket<SSL, false, UserData> *webSocket = (WebSocket<SSL, false, UserData> *) us_socket_context_adopt_socket(SSL,
+                    (us_socket_context_t *) webSocketContext, s, sizeof(WebSocketData) + sizeof(UserData));
+        webSocket->init(false, CompressOptions::DISABLED, std::move(backpressure));
+
+        WebSocketContext<SSL, false, UserData>::startTimers(webSocket);
+
+        new (webSocket->getUserData()) UserData(std::move(userData));
+
+        /* From here on the same as data arriving in the WebSocketContext */
+        AsyncSocket<SSL> *asyncSocket = (AsyncSocket<SSL> *) webSocket;
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) webSocket);
+        asyncSocket->cork();
+
+        if (webSocketContextData->openHandler) {
+            webSocketContextData->openHandler(webSocket);
+        }
+
+        if (tail.length() && !us_socket_is_closed(SSL, (us_socket_t *) webSocket) && !webSocketData->isShuttingDown) {
+            WebSocketProtocol<false, WebSocketContext<SSL, false, UserData>>::consume(padded.data() + CONSUME_PADDING, (unsigned int) tail.length(), (WebSocketState<false> *) (WebSocketState<true> *) webSocketData, webSocket);
+        }
+
+        asyncSocket->uncork();
+        if (asyncSocket->getBufferedAmount() == 0 && webSocketData->isShuttingDown && !webSocketData->offloaded) {
+            asyncSocket->shutdown();
+        }
+
+        return (us_socket_t *) webSocket;
+    }
+
+    void init() {
+        us_socket_context_on_open(SSL, clientContext, [](us_socket_t *s, int /*isClient*/, char */*ip*/, int /*ipLength*/) {
+            ClientSocketData *clientSocketData = (ClientSocketData *) us_socket_ext(SSL, s);
+
+            /* Backpressure of this is drained in writable, the buffer now collects the response */
+            ((AsyncSocket<SSL> *) s)->write(clientSocketData->handshake.data(), (int) clientSocketData->handshake.length());
+            clientSocketData->handshake.clear();
 
-        ClientApp &&connect(std::string url, std::string protocol = "") {
+            us_socket_timeout(SSL, s, getClientContextData(s)->connectTimeout);
+            return s;
+        });
 
+        us_socket_context_on_data(SSL, clientContext, [](us_socket_t *s, char *data, int length) {
+            ClientSocketData *clientSocketData = (ClientSocketData *) us_socket_ext(SSL, s);
+
+            /* Only the end of the buffer can complete the response */
+            size_t searchFrom = std::max<size_t>(clientSocketData->handshake.length(), 3) - 3;
+            clientSocketData->handshake.append(data, (size_t) length);
+            size_t responseLength = clientSocketData->handshake.find("\r\n\r\n", searchFrom);
+
+            if (responseLength == std::string::npos) {
+                if (clientSocketData->handshake.length() > MAX_HANDSHAKE_LENGTH) {
+                    return us_socket_close(SSL, s, (int) ERR_HANDSHAKE_REFUSED.length(), (void *) ERR_HANDSHAKE_REFUSED.data());
+                }
+                return s;
+            }
+
+            if (!ClientHandshake::isAcceptedUpgrade(std::string_view(clientSocketData->handshake.data(), responseLength), clientSocketData->secWebSocketKey)) {
+                return us_socket_close(SSL, s, (int) ERR_HANDSHAKE_REFUSED.length(), (void *) ERR_HANDSHAKE_REFUSED.data());
+            }
+
+            return upgrade(s, std::string_view(clientSocketData->handshake).substr(responseLength + 4));
+        });
+
+        us_socket_context_on_writable(SSL, clientContext, [](us_socket_t *s) {
+            ((AsyncSocket<SSL> *) s)->write(nullptr, 0);
+            return s;
+        });
+
+        us_socket_context_on_close(SSL, clientContext, [](us_socket_t *s, int code, void *reason) {
+            fail(s, reason ? std::string_view((char *) reason, (size_t) code) : ERR_HANDSHAKE_ENDED);
+            return s;
+        });
+
+        us_socket_context_on_connect_error(SSL, clientContext, [](us_socket_t *s, int /*code*/) {
+            fail(s, ERR_CONNECT);
+            return s;
+        });
+
+        us_socket_context_on_end(SSL, clientContext, [](us_socket_t *s) {
+            return us_socket_close(SSL, s, (int) ERR_HANDSHAKE_ENDED.length(), (void *) ERR_HANDSHAKE_ENDED.data());
+        });
+
+        us_socket_context_on_timeout(SSL, clientContext, [](us_socket_t *s) {
+            if (us_socket_is_established(SSL, s)) {
+                return us_socket_close(SSL, s, (int) ERR_CONNECT_TIMEOUT.length(), (void *) ERR_CONNECT_TIMEOUT.data());
+            }
+            /* Still connecting, there is no close event for this */
+            fail(s, ERR_CONNECT_TIMEOUT);
+            return us_socket_close_connecting(SSL, s);
+        });
+    }
+
+public:
+    TemplatedClientApp(WebSocketClientBehavior<SSL, UserData> &&behavior, SocketContextOptions options = {}) {
+        /* Same limits as for server sockets */
+        if (behavior.idleTimeout && behavior.idleTimeout < 8) {
+            std::cerr << "Error: idleTimeout must be either 0 or greater than 8!" << std::endl;
+            std::terminate();
+        }
+        if (behavior.idleTimeout > 240 * 4) {
+            std::cerr << "Error: idleTimeout must not be greater than 960 seconds!" << std::endl;
+            std::terminate();
+        }
+        if (behavior.maxLifetime > 240) {
+            std::cerr << "Error: maxLifetime must not be greater than 240 minutes!" << std::endl;
+            std::terminate();
+        }
+
+        clientContext = us_create_socket_context(SSL, (us_loop_t *) Loop::get(), sizeof(ClientContextData), options);
+        if (!clientContext) {
+            return;
+        }
+        ClientContextData *clientContextData = new (us_socket_context_ext(SSL, clientContext)) ClientContextData;
+        init();
+
+        webSocketContext = WebSocketContext<SSL, false, UserData>::create(Loop::get(), clientContext, nullptr);
+        clientContextData->webSocketContext = webSocketContext;
+        clientContextData->failedHandler = std::move(behavior.failed);
+        clientContextData->connectTimeout = behavior.connectTimeout;
+
+        /* Copy all handlers */
+        webSocketContext->getExt()->openHandler = std::move(behavior.open);
+        webSocketContext->getExt()->messageHandler = std::move(behavior.message);
+        webSocketContext->getExt()->fragmentHandler = std::move(behavior.fragment);
+        webSocketContext->getExt()->droppedHandler = std::move(behavior.dropped);
+        webSocketContext->getExt()->drainHandler = std::move(behavior.drain);
+        webSocketContext->getExt()->closeHandler = std::move(behavior.close);
+        webSocketContext->getExt()->pingHandler = std::move(behavior.ping);
+        webSocketContext->getExt()->pongHandler = std::move(behavior.pong);
+
+        /* Copy settings */
+        webSocketContext->getExt()->maxPayloadLength = behavior.maxPayloadLength;
+        webSocketContext->getExt()->maxBackpressure = behavior.maxBackpressure;
+        webSocketContext->getExt()->closeOnBackpressureLimit = behavior.closeOnBackpressureLimit;
+        webSocketContext->getExt()->resetIdleTimeoutOnSend = behavior.resetIdleTimeoutOnSend;
+        webSocketContext->getExt()->coalesceMicroseconds = behavior.coalesceMicroseconds;
+        webSocketContext->getExt()->coalesceBytes = behavior.coalesceBytes;
+        webSocketContext->getExt()->sendPingsAutomatically = behavior.sendPingsAutomatically;
+        webSocketContext->getExt()->maxLifetime = behavior.maxLifetime;
+        webSocketContext->getExt()->compression = DISABLED;
+        webSocketContext->getExt()->calculateIdleTimeoutCompnents(behavior.idleTimeout);
+    }
+
+    TemplatedClientApp(TemplatedClientApp &&other) : clientContext(other.clientContext), webSocketContext(other.webSocketContext) {
+        other.clientContext = nullptr;
+        other.webSocketContext = nullptr;
+    }
+
+    ~TemplatedClientApp() {
+        if (webSocketContext) {
+            webSocketContext->free();
+        }
+        if (clientContext) {
+            ((ClientContextData *) us_socket_context_ext(SSL, clientContext))->~ClientContextData();
+            us_socket_context_free(SSL, clientContext);
+        }
+    }
+
+    bool constructorFailed() {
+        return !clientContext || !webSocketContext;
+    }
+
+    /* Starts connecting to ws://host[:port][/path] (wss:// for SSL), returning right away. The result is
+     * either open or failed, for every call. UserData is moved into the socket once it is a WebSocket */
+    TemplatedClientApp &&connect(std::string url, std::string protocol = "", UserData userData = {}) {
+        WebSocketUrl parsed;
+        bool valid = parsed.parse(url, SSL);
+
+        us_socket_t *s = valid ? us_socket_context_connect(SSL, clientContext, std::string(parsed.host).c_str(), parsed.port, nullptr, 0, SOCKET_EXT_SIZE) : nullptr;
+        if (!s) {
+            ClientContextData *clientContextData = (ClientContextData *) us_socket_context_ext(SSL, clientContext);
+            if (clientContextData->failedHandler) {
+                clientContextData->failedHandler(&userData, valid ? ERR_CONNECT : ERR_INVALID_URL);
+            }
             return std::move(*this);
         }
 
-        void run() {
+        char secWebSocketKey[24];
+        generateKey(secWebSocketKey);
 
+        std::string request;
+        request.append("GET ").append(parsed.path).append(" HTTP/1.1\r\nHost: ").append(parsed.authority)
+            .append("\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: ").append(secWebSocketKey, 24)
+            .append("\r\nSec-WebSocket-Version: 13\r\n");
+        if (protocol.length()) {
+            request.append("Sec-WebSocket-Protocol: ").append(protocol).append("\r\n");
         }
+        request.append("\r\n");
 
-    };
+        ClientSocketData *clientSocketData = new (us_socket_ext(SSL, s)) ClientSocketData(std::move(request), std::move(userData));
+        memcpy(clientSocketData->secWebSocketKey, secWebSocketKey, 24);
+
+        us_socket_timeout(SSL, s, ((ClientContextData *) us_socket_context_ext(SSL, clientContext))->connectTimeout);
+        return std::move(*this);
+    }
+
+    void run() {
+        Loop::get()->run();
+    }
+};
+
+typedef TemplatedClientApp<false> ClientApp;
+typedef TemplatedClientApp<true> SSLClientApp;
+
+}
 
-}
\ No newline at end of file
+#endif // UWS_CLIENTAPP_H
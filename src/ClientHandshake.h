@@ -0,0 +1,129 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_CLIENTHANDSHAKE_H
+#define UWS_CLIENTHANDSHAKE_H
+
+/* What ClientApp parses of its URLs and of the upgrade response, without sockets */
+
+#include <algorithm>
+#include <string_view>
+
+#include "WebSocketHandshake.h"
+
+namespace uWS {
+
+struct WebSocketUrl {
+    /* Host as sent in the Host header, with brackets and port */
+    std::string_view authority;
+    /* Host to connect to, without brackets */
+    std::string_view host;
+    std::string_view path = "/";
+    int port = 0;
+
+    /* ws://host[:port][/path], wss:// if SSL. False if not one of those */
+    bool parse(std::string_view url, bool SSL) {
+        std::string_view scheme = SSL ? "wss://" : "ws://";
+        if (url.substr(0, scheme.length()) != scheme) {
+            return false;
+        }
+        url.remove_prefix(scheme.length());
+        authority = url.substr(0, url.find('/'));
+        path = authority.length() < url.length() ? url.substr(authority.length()) : "/";
+
+        /* Brackets are for IPv6 hosts */
+        host = authority;
+        port = SSL ? 443 : 80;
+        size_t portSeparator = authority.rfind(':');
+        bool valid = true;
+        if (portSeparator != std::string_view::npos && authority.find(']', portSeparator) == std::string_view::npos) {
+            host = authority.substr(0, portSeparator);
+            port = 0;
+            for (char c : authority.substr(portSeparator + 1)) {
+                valid = valid && c >= '0' && c <= '9' && (port = port * 10 + c - '0') <= 65535;
+            }
+        }
+        if (host.length() > 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.length() - 2);
+        }
+        return valid && host.length() && port;
+    }
+};
+
+namespace ClientHandshake {
+
+static inline bool equalsCaseInsensitive(std::string_view a, std::string_view b) {
+    return a.length() == b.length() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return (x | 32) == (y | 32);
+    });
+}
+
+/* Value without the whitespace around it */
+static inline std::string_view trim(std::string_view value) {
+    value.remove_prefix(std::min(value.find_first_not_of(" \t"), value.length()));
+    return value.substr(0, value.find_last_not_of(" \t") + 1);
+}
+
+/* Whether the comma separated list has token */
+static inline bool hasToken(std::string_view list, std::string_view token) {
+    while (list.length()) {
+        size_t comma = std::min(list.find(','), list.length());
+        if (equalsCaseInsensitive(trim(list.substr(0, comma)), token)) {
+            return true;
+        }
+        list.remove_prefix(std::min(comma + 1, list.length()));
+    }
+    return false;
+}
+
+/* Response holds everything up to, not including, the empty line. It is an upgrade to websocket (RFC 6455 4.1)
+ * accepting the key we sent */
+static inline bool isAcceptedUpgrade(std::string_view response, const char secWebSocketKey[24]) {
+    if (response.length() < 12 || response.substr(0, 9) != "HTTP/1.1 " || response.substr(9, 3) != "101") {
+        return false;
+    }
+
+    char secWebSocketAccept[29] = {};
+    WebSocketHandshake::generate(secWebSocketKey, secWebSocketAccept);
+
+    bool upgrade = false, connection = false, accepted = false;
+    for (size_t lineEnd = response.find("\r\n"); lineEnd != std::string_view::npos && lineEnd + 2 < response.length(); ) {
+        size_t lineStart = lineEnd + 2;
+        lineEnd = response.find("\r\n", lineStart);
+        std::string_view line = response.substr(lineStart, lineEnd - lineStart);
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            continue;
+        }
+        std::string_view name = line.substr(0, colon), value = trim(line.substr(colon + 1));
+        if (equalsCaseInsensitive(name, "upgrade")) {
+            upgrade = equalsCaseInsensitive(value, "websocket");
+        } else if (equalsCaseInsensitive(name, "connection")) {
+            connection = hasToken(value, "upgrade");
+        } else if (equalsCaseInsensitive(name, "sec-websocket-accept")) {
+            accepted = value == std::string_view(secWebSocketAccept, 28);
+        }
+    }
+    return upgrade && connection && accepted;
+}
+
+}
+
+}
+
+#endif // UWS_CLIENTHANDSHAKE_H
@@ -0,0 +1,608 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_CLUSTER_H
+#define UWS_CLUSTER_H
+
+/* A Cluster bridges the pub/sub of apps running on many nodes. Every node connects out to the nodes
+ * listed as its peers and learns which topics they have subscribers for, then forwards what is published
+ * to those topics only. Frames for a peer are batched and written once per event loop iteration over a
+ * persistent connection, and injected into the app of the receiving node like any local publish.
+ * See cluster/README.md for the wire format */
+
+#include "App.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace uWS {
+
+struct ClusterOptions {
+    /* Unique among all nodes */
+    std::string nodeId;
+    /* Where other nodes connect to us, 0 to only connect out */
+    int port = 0;
+    const char *host = nullptr;
+    /* Nodes we forward to, as host:port or [ipv6]:port. May include ourselves */
+    std::vector<std::string> peers;
+    /* Bytes queued for a peer before we drop the connection (and reconnect) */
+    size_t maxBackpressure = 64 * 1024 * 1024;
+    /* Batches are written at the end of every iteration, or once this big */
+    size_t maxBatchBytes = 256 * 1024;
+    /* Seconds a heartbeat may wait for its answer before we drop the connection, 0 to never */
+    unsigned int heartbeatTimeout = 30;
+};
+
+struct ClusterPeerStats {
+    std::string address;
+    /* Empty until the peer said hello */
+    std::string nodeId;
+    bool connected;
+    /* Topics the peer has subscribers for */
+    size_t interests;
+    /* Batched and not yet written, plus backpressure */
+    size_t queuedBytes;
+    unsigned long long sentMessages, receivedMessages, reconnects;
+    /* Milliseconds our last heartbeat took to be answered, having waited behind everything queued
+     * before it. Or the time the outstanding one has waited so far, if longer */
+    long long lagMilliseconds;
+};
+
+template <bool SSL>
+struct TemplatedCluster {
+    static constexpr uint32_t MAX_FRAME_LENGTH = 64 * 1024 * 1024;
+
+private:
+    enum FrameType : unsigned char {
+        HELLO,
+        INTEREST,
+        UNINTEREST,
+        PUBLISH,
+        PING,
+        PONG
+    };
+
+    /* Little endian length of type and payload, then type */
+    static constexpr size_t FRAME_HEADER_LENGTH = 5;
+    static constexpr unsigned int MAX_RECONNECT_DELAY = 30;
+
+    /* A node we connect out to */
+    struct Peer {
+        std::string address, host;
+        int port = 0;
+        std::string nodeId;
+        us_socket_t *socket = nullptr;
+        /* Said hello */
+        bool connected = false;
+        /* Turned out to be us */
+        bool isSelf = false;
+        /* Its interests, as subscriptions in routes */
+        Subscriber *interest = nullptr;
+        /* Seconds until we connect again, and the delay after that */
+        unsigned int reconnectIn = 0, reconnectDelay = 1;
+        /* Milliseconds, pingSentAt is 0 while no heartbeat is outstanding */
+        long long pingSentAt = 0, lag = 0;
+        unsigned long long sentMessages = 0, reconnects = 0;
+    };
+
+    /* Every link, in or out */
+    struct LinkData : AsyncSocketData<SSL> {
+        /* Set when we connected out, nullptr for links from other nodes */
+        Peer *peer = nullptr;
+        /* Links in only take frames after hello */
+        bool greeted = false;
+        /* What links in have published to us, by node */
+        unsigned long long *received = nullptr;
+        std::string batch;
+        /* An incomplete frame */
+        std::string input;
+    };
+
+    us_socket_context_t *context = nullptr;
+    us_listen_socket_t *listenSocket = nullptr;
+    us_timer_t *timer = nullptr;
+    ClusterOptions options;
+    std::vector<std::unique_ptr<Peer>> peers;
+    std::vector<us_socket_t *> inbound;
+    std::map<std::string, unsigned long long, std::less<>> received;
+
+    /* One subscriber per peer, so matching (wildcards included) is what it is locally */
+    TopicTree<std::string, std::string_view> routes;
+    TopicTree<TopicTreeMessage, TopicTreeBigMessage> *localTopics = nullptr;
+    /* Whoever observed the app's topics before us, still told */
+    std::function<void(std::string_view topic, bool added)> previousTopicObserver;
+    MoveOnlyFunction<bool(std::string_view, std::string_view, OpCode, bool)> publishLocally;
+    bool closing = false;
+
+    static TemplatedCluster *getCluster(us_socket_t *s) {
+        return *(TemplatedCluster **) us_socket_context_ext(SSL, us_socket_context(SSL, s));
+    }
+
+    static LinkData *getLinkData(us_socket_t *s) {
+        return (LinkData *) us_socket_ext(SSL, s);
+    }
+
+    /* A link that never got established, there is no close event for it */
+    static void connectFailed(us_socket_t *s) {
+        LinkData *linkData = getLinkData(s);
+        getCluster(s)->disconnected(linkData->peer);
+        linkData->~LinkData();
+    }
+
+    static long long milliseconds() {
+        return LoopData::now() / 1000;
+    }
+
+    static void appendLittleEndian(std::string &out, uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out.push_back((char) (value >> (8 * i)));
+        }
+    }
+
+    static uint64_t readLittleEndian(const char *data, int bytes) {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value |= (uint64_t) (unsigned char) data[i] << (8 * i);
+        }
+        return value;
+    }
+
+    /* Frames are batched, and written once per iteration */
+    void queue(us_socket_t *s, FrameType type, std::string_view payload, std::string_view more = {}) {
+        LinkData *linkData = getLinkData(s);
+        appendLittleEndian(linkData->batch, 1 + payload.length() + more.length(), 4);
+        linkData->batch.push_back((char) type);
+        linkData->batch.append(payload);
+        linkData->batch.append(more);
+
+        if (linkData->batch.length() >= options.maxBatchBytes) {
+            flush(s);
+        }
+    }
+
+    void flush(us_socket_t *s) {
+        LinkData *linkData = getLinkData(s);
+        if (linkData->batch.empty() || us_socket_is_closed(SSL, s)) {
+            return;
+        }
+
+        ((AsyncSocket<SSL> *) s)->write(linkData->batch.data(), (int) linkData->batch.length());
+        linkData->batch.clear();
+    }
+
+    /* Closing is left to here, as it changes routes (which we might be publishing through) */
+    void flushAll() {
+        for (auto &peer : peers) {
+            if (peer->socket) {
+                flush(peer->socket);
+
+                /* A peer not keeping up is better off reconnecting than taking all our memory */
+                if (((AsyncSocket<SSL> *) peer->socket)->getBufferedAmount() > options.maxBackpressure) {
+                    us_socket_close(SSL, peer->socket, 0, nullptr);
+                }
+            }
+        }
+        for (us_socket_t *s : inbound) {
+            flush(s);
+        }
+    }
+
+    void connect(Peer *peer) {
+        us_socket_t *s = us_socket_context_connect(SSL, context, peer->host.c_str(), peer->port, nullptr, 0, sizeof(LinkData));
+        if (!s) {
+            disconnected(peer);
+            return;
+        }
+        LinkData *linkData = new (us_socket_ext(SSL, s)) LinkData;
+        linkData->peer = peer;
+        peer->socket = s;
+        us_socket_timeout(SSL, s, 10);
+    }
+
+    /* Forgets what the peer was interested in, and connects again later */
+    void disconnected(Peer *peer) {
+        peer->socket = nullptr;
+        peer->connected = false;
+        peer->pingSentAt = peer->lag = 0;
+
+        routes.freeSubscriber(peer->interest);
+        peer->interest = routes.createSubscriber();
+        peer->interest->user = peer;
+
+        if (!closing && !peer->isSelf) {
+            peer->reconnectIn = peer->reconnectDelay;
+            peer->reconnectDelay = std::min(peer->reconnectDelay * 2, MAX_RECONNECT_DELAY);
+            peer->reconnects++;
+        }
+    }
+
+    /* Whatever a link needs once a second */
+    void tick() {
+        long long now = milliseconds();
+        for (auto &peer : peers) {
+            if (peer->isSelf) {
+                continue;
+            }
+            if (!peer->socket) {
+                if (!peer->reconnectIn || !--peer->reconnectIn) {
+                    connect(peer.get());
+                }
+            } else if (peer->connected) {
+                if (!peer->pingSentAt) {
+                    /* Waits behind everything queued, answered once all of it was published */
+                    peer->pingSentAt = now;
+                    std::string timestamp;
+                    appendLittleEndian(timestamp, (uint64_t) now, 8);
+                    queue(peer->socket, PING, timestamp);
+                } else {
+                    peer->lag = std::max(peer->lag, now - peer->pingSentAt);
+                    if (options.heartbeatTimeout && peer->lag > (long long) options.heartbeatTimeout * 1000) {
+                        us_socket_close(SSL, peer->socket, 0, nullptr);
+                    }
+                }
+            }
+        }
+    }
+
+    us_socket_t *handleFrame(us_socket_t *s, FrameType type, std::string_view payload) {
+        LinkData *linkData = getLinkData(s);
+        Peer *peer = linkData->peer;
+
+        if (type == HELLO) {
+            /* Listed ourselves as a peer, or were told to */
+            if (payload == options.nodeId) {
+                if (peer) {
+                    peer->isSelf = true;
+                }
+                return us_socket_close(SSL, s, 0, nullptr);
+            }
+
+            if (peer) {
+                peer->nodeId = payload;
+                peer->connected = true;
+                peer->reconnectDelay = 1;
+                us_socket_timeout(SSL, s, 0);
+                return s;
+            }
+
+            /* Tell them who we are and what we have subscribers for, then every change to that */
+            linkData->greeted = true;
+            linkData->received = &received.emplace(std::string(payload), 0).first->second;
+            queue(s, HELLO, options.nodeId);
+            localTopics->iterateTopics([this, s](Topic *topic) {
+                queue(s, INTEREST, topic->name);
+            });
+            us_socket_timeout(SSL, s, 0);
+            return s;
+        }
+
+        if (peer ? !peer->connected : !linkData->greeted) {
+            return us_socket_close(SSL, s, 0, nullptr);
+        }
+
+        switch (type) {
+        case INTEREST:
+        case UNINTEREST:
+            if (peer) {
+                if (type == INTEREST) {
+                    routes.subscribe(peer->interest, payload);
+                } else {
+                    routes.unsubscribe(peer->interest, payload);
+                }
+            }
+            break;
+        case PUBLISH:
+            if (!peer && payload.length() >= 3) {
+                unsigned char flags = (unsigned char) payload[0];
+                size_t topicLength = (size_t) readLittleEndian(payload.data() + 1, 2);
+                if (topicLength > payload.length() - 3) {
+                    return us_socket_close(SSL, s, 0, nullptr);
+                }
+                (*linkData->received)++;
+                publishLocally(payload.substr(3, topicLength), payload.substr(3 + topicLength), (OpCode) (flags & 0x7f), flags & 0x80);
+            }
+            break;
+        case PING:
+            if (!peer) {
+                queue(s, PONG, payload);
+            }
+            break;
+        case PONG:
+            if (peer && payload.length() == 8 && peer->pingSentAt) {
+                peer->lag = milliseconds() - (long long) readLittleEndian(payload.data(), 8);
+                peer->pingSentAt = 0;
+            }
+            break;
+        default:
+            /* Newer frames we do not know of are skipped */
+            break;
+        }
+        return s;
+    }
+
+    void init() {
+        us_socket_context_on_open(SSL, context, [](us_socket_t *s, int isClient, char */*ip*/, int /*ipLength*/) {
+            TemplatedCluster *cluster = getCluster(s);
+            if (isClient) {
+                cluster->queue(s, HELLO, cluster->options.nodeId);
+                cluster->flush(s);
+            } else {
+                /* Some node connected to publish to us, it says hello first */
+                new (us_socket_ext(SSL, s)) LinkData;
+                cluster->inbound.push_back(s);
+                us_socket_timeout(SSL, s, 10);
+            }
+            return s;
+        });
+
+        us_socket_context_on_data(SSL, context, [](us_socket_t *s, char *data, int length) {
+            TemplatedCluster *cluster = getCluster(s);
+            LinkData *linkData = getLinkData(s);
+
+            /* Frames are handled in place, only an incomplete one is buffered */
+            std::string_view input(data, (size_t) length);
+            bool buffered = linkData->input.length();
+            if (buffered) {
+                linkData->input.append(data, (size_t) length);
+                input = linkData->input;
+            }
+
+            size_t consumed = 0;
+            while (input.length() - consumed >= FRAME_HEADER_LENGTH) {
+                uint32_t frameLength = (uint32_t) readLittleEndian(input.data() + consumed, 4);
+                if (!frameLength || frameLength > MAX_FRAME_LENGTH) {
+                    return us_socket_close(SSL, s, 0, nullptr);
+                }
+                if (input.length() - consumed - 4 < frameLength) {
+                    break;
+                }
+                FrameType type = (FrameType) input[consumed + 4];
+                std::string_view payload = input.substr(consumed + FRAME_HEADER_LENGTH, frameLength - 1);
+                consumed += 4 + frameLength;
+
+                s = cluster->handleFrame(s, type, payload);
+                if (us_socket_is_closed(SSL, s)) {
+                    return s;
+                }
+            }
+
+            if (buffered) {
+                linkData->input.erase(0, consumed);
+            } else {
+                linkData->input.assign(input.substr(consumed));
+            }
+            return s;
+        });
+
+        us_socket_context_on_writable(SSL, context, [](us_socket_t *s) {
+            ((AsyncSocket<SSL> *) s)->write(nullptr, 0);
+            return s;
+        });
+
+        us_socket_context_on_close(SSL, context, [](us_socket_t *s, int /*code*/, void */*reason*/) {
+            TemplatedCluster *cluster = getCluster(s);
+            LinkData *linkData = getLinkData(s);
+            if (linkData->peer) {
+                cluster->disconnected(linkData->peer);
+            } else {
+                auto it = std::find(cluster->inbound.begin(), cluster->inbound.end(), s);
+                if (it != cluster->inbound.end()) {
+                    *it = cluster->inbound.back();
+                    cluster->inbound.pop_back();
+                }
+            }
+            linkData->~LinkData();
+            return s;
+        });
+
+        us_socket_context_on_connect_error(SSL, context, [](us_socket_t *s, int /*code*/) {
+            connectFailed(s);
+            return s;
+        });
+
+        us_socket_context_on_end(SSL, context, [](us_socket_t *s) {
+            return us_socket_close(SSL, s, 0, nullptr);
+        });
+
+        /* Connecting, or saying hello, took too long */
+        us_socket_context_on_timeout(SSL, context, [](us_socket_t *s) {
+            if (us_socket_is_established(SSL, s)) {
+                return us_socket_close(SSL, s, 0, nullptr);
+            }
+            connectFailed(s);
+            return us_socket_close_connecting(SSL, s);
+        });
+    }
+
+public:
+    /* Bridges the pub/sub of app, which must already have its WebSocket routes. Publish with
+     * publish below, rather than on app, to reach other nodes. Must not outlive app */
+    template <typename APP>
+    TemplatedCluster(APP &app, ClusterOptions clusterOptions, SocketContextOptions socketOptions = {})
+        : options(std::move(clusterOptions)), routes([](Subscriber *, std::string &, auto) { return false; }) {
+
+        if (!app.topicTree) {
+            std::cerr << "Error: Cluster needs the app to have its WebSocket routes first!" << std::endl;
+            std::terminate();
+        }
+        if (!options.nodeId.length()) {
+            std::cerr << "Error: Cluster needs a nodeId!" << std::endl;
+            std::terminate();
+        }
+
+        for (std::string &address : options.peers) {
+            size_t colon = address.rfind(':');
+            int port = colon == std::string::npos ? 0 : atoi(address.c_str() + colon + 1);
+            if (port <= 0 || port > 65535 || colon == 0) {
+                std::cerr << "Error: Cluster peer " << address << " is not host:port!" << std::endl;
+                std::terminate();
+            }
+            Peer *peer = new Peer;
+            peer->address = address;
+            peer->host = address.substr(0, colon);
+            if (peer->host.length() >= 2 && peer->host.front() == '[' && peer->host.back() == ']') {
+                peer->host = peer->host.substr(1, peer->host.length() - 2);
+            }
+            peer->port = port;
+            peer->interest = routes.createSubscriber();
+            peer->interest->user = peer;
+            peers.emplace_back(peer);
+        }
+
+        context = us_create_socket_context(SSL, (us_loop_t *) Loop::get(), sizeof(TemplatedCluster *), socketOptions);
+        if (!context) {
+            return;
+        }
+        *(TemplatedCluster **) us_socket_context_ext(SSL, context) = this;
+        init();
+
+        localTopics = app.topicTree;
+        previousTopicObserver = std::move(localTopics->topicObserver);
+        localTopics->topicObserver = [this](std::string_view topic, bool added) {
+            if (previousTopicObserver) {
+                previousTopicObserver(topic, added);
+            }
+            for (us_socket_t *s : inbound) {
+                if (getLinkData(s)->greeted) {
+                    queue(s, added ? INTEREST : UNINTEREST, topic);
+                }
+            }
+        };
+        publishLocally = [&app](std::string_view topic, std::string_view message, OpCode opCode, bool compress) {
+            return app.publish(topic, message, opCode, compress);
+        };
+
+        if (options.port) {
+            listenSocket = us_socket_context_listen(SSL, context, options.host, options.port, 0, sizeof(LinkData));
+        }
+
+        for (auto &peer : peers) {
+            connect(peer.get());
+        }
+
+        timer = us_create_timer((us_loop_t *) Loop::get(), 1, sizeof(TemplatedCluster *));
+        *(TemplatedCluster **) us_timer_ext(timer) = this;
+        us_timer_set(timer, [](us_timer_t *t) {
+            (*(TemplatedCluster **) us_timer_ext(t))->tick();
+        }, 1000, 1000);
+
+        /* Batches go out once per iteration */
+        Loop::get()->addPostHandler(this, [this](Loop */*loop*/) {
+            flushAll();
+        });
+    }
+
+    TemplatedCluster(const TemplatedCluster &) = delete;
+    TemplatedCluster &operator=(const TemplatedCluster &) = delete;
+
+    ~TemplatedCluster() {
+        closing = true;
+        if (!context) {
+            for (auto &peer : peers) {
+                routes.freeSubscriber(peer->interest);
+            }
+            return;
+        }
+
+        Loop::get()->removePostHandler(this);
+        us_timer_close(timer);
+        localTopics->topicObserver = std::move(previousTopicObserver);
+
+        if (listenSocket) {
+            us_listen_socket_close(SSL, listenSocket);
+        }
+        /* Closes every link */
+        us_socket_context_close(SSL, context);
+
+        for (auto &peer : peers) {
+            routes.freeSubscriber(peer->interest);
+        }
+        us_socket_context_free(SSL, context);
+    }
+
+    /* Did we fail to create the socket context, or to listen */
+    bool constructorFailed() {
+        return !context || (options.port && !listenSocket);
+    }
+
+    /* Publishes to the local app and to every peer with subscribers for topic. Returns whether anyone,
+     * here or on some peer, is subscribed */
+    bool publish(std::string_view topic, std::string_view message, OpCode opCode = BINARY, bool compress = false) {
+        if (topic.length() > UINT16_MAX) {
+            std::cerr << "Error: Cluster topics must be shorter than 64kb!" << std::endl;
+            std::terminate();
+        }
+
+        bool local = publishLocally(topic, message, opCode, compress);
+        if (!context) {
+            return local;
+        }
+
+        /* Framed once, copied into the batch of every peer interested */
+        std::string header;
+        header.push_back((char) ((unsigned char) opCode | (compress ? 0x80 : 0)));
+        appendLittleEndian(header, topic.length(), 2);
+        header.append(topic);
+
+        bool remote = routes.publishBig(nullptr, topic, std::string_view(message), [this, &header](Subscriber *s, std::string_view &message) {
+            Peer *peer = (Peer *) s->user;
+            if (peer->connected) {
+                peer->sentMessages++;
+                queue(peer->socket, PUBLISH, header, message);
+            }
+        });
+
+        return local || remote;
+    }
+
+    std::vector<ClusterPeerStats> getPeerStats() {
+        std::vector<ClusterPeerStats> stats;
+        for (auto &peer : peers) {
+            if (peer->isSelf) {
+                continue;
+            }
+            size_t queuedBytes = 0;
+            if (peer->socket && !us_socket_is_closed(SSL, peer->socket)) {
+                queuedBytes = getLinkData(peer->socket)->batch.length() + ((AsyncSocket<SSL> *) peer->socket)->getBufferedAmount();
+            }
+            auto it = received.find(peer->nodeId);
+            stats.push_back({
+                peer->address,
+                peer->nodeId,
+                peer->connected,
+                peer->interest->topics.size(),
+                queuedBytes,
+                peer->sentMessages,
+                it == received.end() ? 0 : it->second,
+                peer->reconnects,
+                peer->pingSentAt ? std::max(peer->lag, milliseconds() - peer->pingSentAt) : peer->lag
+            });
+        }
+        return stats;
+    }
+};
+
+typedef TemplatedCluster<false> Cluster;
+typedef TemplatedCluster<true> SSLCluster;
+
+}
+
+#endif // UWS_CLUSTER_H
@@ -0,0 +1,130 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_COMPRESSIONPOOL_H
+#define UWS_COMPRESSIONPOOL_H
+
+/* A CompressionPool deflates and inflates big messages on threads of its own, so that they do not
+ * stall the event loop. One pool can serve any number of loops, see Loop::setCompressionPool.
+ * Only sockets with a shared compressor or decompressor (no sliding window kept between
+ * messages) can be offloaded, everything else is compressed inline like before */
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "MoveOnlyFunction.h"
+#include "PerMessageDeflate.h"
+
+namespace uWS {
+
+/* Work of a loop handed to the pool, completed on the loop in the order it was handed over */
+struct OffloadedJob {
+    /* The socket, or null if it closed while we were busy */
+    void *owner;
+    /* Set on the loop once the pool is done */
+    bool done;
+    MoveOnlyFunction<void()> complete;
+};
+
+struct CompressionPool {
+private:
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<MoveOnlyFunction<void()>> jobs;
+    bool stopping = false;
+
+    /* Every thread has its own context and streams, used like the shared ones of a loop (reset every time) */
+    struct ThreadContext {
+        ZlibContext zlibContext;
+        DeflationStream deflationStream{CompressOptions::DEDICATED_COMPRESSOR};
+        InflationStream inflationStream{CompressOptions::DEDICATED_DECOMPRESSOR};
+    };
+
+    static ThreadContext &getThreadContext() {
+        static thread_local ThreadContext threadContext;
+        return threadContext;
+    }
+
+public:
+    CompressionPool(unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency() / 2)) {
+        for (unsigned int i = 0; i < numThreads; i++) {
+            threads.emplace_back([this]() {
+                while (true) {
+                    MoveOnlyFunction<void()> job;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        condition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                        if (jobs.empty()) {
+                            return;
+                        }
+                        job = std::move(jobs.front());
+                        jobs.pop_front();
+                    }
+                    job();
+                }
+            });
+        }
+    }
+
+    /* Finishes what is queued, then joins. Loops using the pool must be done with it */
+    ~CompressionPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+
+    void submit(MoveOnlyFunction<void()> &&job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.emplace_back(std::move(job));
+        }
+        condition.notify_one();
+    }
+
+    /* To be called from within a job, the same as the shared compressor of a loop would do */
+    static std::string deflate(std::string_view raw) {
+        ThreadContext &threadContext = getThreadContext();
+        return std::string(threadContext.deflationStream.deflate(&threadContext.zlibContext, raw, true));
+    }
+
+    /* Compressed must have 9 bytes of padding after its end, like for the shared decompressor of a loop */
+    static std::optional<std::string> inflate(std::string_view compressed, size_t maxPayloadLength) {
+        ThreadContext &threadContext = getThreadContext();
+        std::optional<std::string_view> inflated = threadContext.inflationStream.inflate(&threadContext.zlibContext, compressed, maxPayloadLength, true);
+        if (!inflated.has_value()) {
+            return std::nullopt;
+        }
+        return std::string(*inflated);
+    }
+};
+
+}
+
+#endif // UWS_COMPRESSIONPOOL_H
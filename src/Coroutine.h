@@ -0,0 +1,168 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_COROUTINE_H
+#define UWS_COROUTINE_H
+
+/* Handlers written as C++20 coroutines returning Task, which await the body, writability or time on the
+ * loop instead of chaining onData, onWritable and timers:
+ *
+ *     app.post("/echo", [](auto *res, auto *req) -> uWS::Task {
+ *         std::string body = co_await res->body();
+ *         co_await uWS::Loop::get()->sleep(10);
+ *         res->end(body);
+ *     });
+ *
+ * A Task runs right away, until it first awaits, then on the loop. Its frame comes from the loop and
+ * goes back once it is done (see Task.h). A Task taking an HttpResponse or WebSocket is bound to it: if the
+ * socket closes (or the request is aborted) while the Task awaits one of these, it is destroyed right where it
+ * awaits, never to be resumed, locals running their destructors. If it closes while the Task runs, as when the
+ * Task closed it, the socket can still be used (writing nowhere) until the Task next awaits, and is destroyed
+ * there. Once the response is ended it is on its own. Just like with onData, the body must be awaited before anything else is, and just like in any
+ * handler, the HttpRequest is gone once the Task first suspends */
+
+#if defined(__cpp_impl_coroutine)
+
+#include <string>
+#include <type_traits>
+
+#include "Task.h"
+#include "Loop.h"
+#include "HttpResponse.h"
+#include "WebSocket.h"
+
+namespace uWS {
+
+/* Binds Tasks to the first HttpResponse or WebSocket among their arguments, frames from the loop of this thread */
+struct SocketBinding {
+    template <typename T>
+    static CoroutineLink **links(T &arg) {
+        if constexpr (std::is_pointer_v<T>) {
+            using S = std::remove_cv_t<std::remove_pointer_t<T>>;
+            if constexpr (std::is_base_of_v<AsyncSocket<true>, S>) {
+                return arg ? &((AsyncSocketData<true> *) us_socket_ext(true, (us_socket_t *) arg))->coroutines : nullptr;
+            } else if constexpr (std::is_base_of_v<AsyncSocket<false>, S>) {
+                return arg ? &((AsyncSocketData<false> *) us_socket_ext(false, (us_socket_t *) arg))->coroutines : nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    static LoopData *loopData() {
+        return (LoopData *) us_loop_ext((us_loop_t *) Loop::get());
+    }
+};
+
+using Task = BasicTask<SocketBinding>;
+
+/* The whole body of the request */
+template <bool SSL>
+struct HttpBodyAwaiter {
+    HttpResponse<SSL> *res;
+    std::string body = {};
+
+    bool await_ready() {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<Task::promise_type> handle) {
+        if (handle.promise().suspend(Task::promise_type::BODY, this)) {
+            res->onData([this, promise = &handle.promise()](std::string_view chunk, bool fin) {
+                body.append(chunk);
+                if (fin) {
+                    promise->resume();
+                }
+            });
+        }
+        return true;
+    }
+
+    std::string await_resume() {
+        return std::move(body);
+    }
+};
+
+/* Until backpressure drained, giving the write offset to resume from like onWritable does */
+template <bool SSL>
+struct HttpWritableAwaiter {
+    HttpResponse<SSL> *res;
+    bool drained;
+    uintmax_t offset = 0;
+
+    bool await_ready() {
+        return drained;
+    }
+
+    bool await_suspend(std::coroutine_handle<Task::promise_type> handle) {
+        if (handle.promise().suspend(Task::promise_type::WRITABLE, this)) {
+            /* Awaiting again from within is put back as ours by onWritable, which is why we check */
+            res->onWritable([res = res, promise = &handle.promise()](uintmax_t offset) {
+                if (promise->awaiting == Task::promise_type::WRITABLE) {
+                    ((HttpWritableAwaiter *) promise->awaiter)->offset = offset;
+                    res->onWritable(nullptr);
+                    promise->resume();
+                }
+                return true;
+            });
+        }
+        return true;
+    }
+
+    uintmax_t await_resume() {
+        return drained ? res->getWriteOffset() : offset;
+    }
+};
+
+/* A timer of its own, closed once it fired or we were aborted */
+struct SleepAwaiter {
+    /* Closed through the awaiter pointer by cancel */
+    us_timer_t *timer = nullptr;
+    Loop *loop;
+    unsigned int milliseconds;
+
+    bool await_ready() {
+        return !milliseconds;
+    }
+
+    bool await_suspend(std::coroutine_handle<Task::promise_type> handle) {
+        if (handle.promise().suspend(Task::promise_type::SLEEP, this, [](void *awaiter) {
+            us_timer_close(((SleepAwaiter *) awaiter)->timer);
+        })) {
+            timer = us_create_timer((us_loop_t *) loop, 0, sizeof(Task::promise_type *));
+            *(Task::promise_type **) us_timer_ext(timer) = &handle.promise();
+            us_timer_set(timer, [](us_timer_t *t) {
+                Task::promise_type *promise = *(Task::promise_type **) us_timer_ext(t);
+                us_timer_close(t);
+                promise->resume();
+            }, (int) milliseconds, 0);
+        }
+        return true;
+    }
+
+    void await_resume() {}
+};
+
+inline SleepAwaiter Loop::sleep(unsigned int milliseconds) {
+    return {nullptr, this, milliseconds};
+}
+
+}
+
+#endif
+
+#endif // UWS_COROUTINE_H
@@ -0,0 +1,165 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_DEFERQUEUE_H
+#define UWS_DEFERQUEUE_H
+
+/* A DeferQueue takes callbacks from any thread for one thread to run, without locks. Pushing is one
+ * exchange of the tail (Vyukov's intrusive queue, with a stub node so that it is never empty), popping
+ * is free of atomics read-modify-writes unless emptied. Nodes are recycled: the consumer hands them back
+ * in a stack which the next pusher runs out of takes whole, keeping them in a cache of its thread */
+
+#include <atomic>
+#include <thread>
+
+#include "MoveOnlyFunction.h"
+
+namespace uWS {
+
+struct DeferQueue {
+private:
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        MoveOnlyFunction<void()> cb;
+    };
+
+    /* Nodes taken from a consumer, of any queue */
+    struct NodeCache {
+        Node *nodes = nullptr;
+
+        ~NodeCache() {
+            while (nodes) {
+                Node *next = nodes->next.load(std::memory_order_relaxed);
+                delete nodes;
+                nodes = next;
+            }
+        }
+    };
+
+    static NodeCache &nodeCache() {
+        static thread_local NodeCache cache;
+        return cache;
+    }
+
+    /* Producers and the consumer on cache lines of their own, padded rather than aligned since we live
+     * in LoopData (which uSockets aligns to 16 bytes only) */
+    std::atomic<Node *> tail;
+    char tailPadding[64 - sizeof(std::atomic<Node *>)];
+    Node *head;
+    Node stub;
+    /* Pushed to by the consumer only, taken whole by producers, so there is no ABA */
+    char headPadding[64];
+    std::atomic<Node *> freeNodes{nullptr};
+
+    void link(Node *node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node *prev = tail.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /* The next of node, waiting out a push that exchanged the tail but has yet to link */
+    Node *nextOf(Node *node) {
+        Node *next = node->next.load(std::memory_order_acquire);
+        while (!next && tail.load(std::memory_order_acquire) != node) {
+            std::this_thread::yield();
+            next = node->next.load(std::memory_order_acquire);
+        }
+        return next;
+    }
+
+    /* Returns nullptr if empty */
+    Node *pop() {
+        Node *node = head;
+        Node *next = nextOf(node);
+        if (node == &stub) {
+            if (!next) {
+                return nullptr;
+            }
+            head = node = next;
+            next = nextOf(node);
+        }
+        if (!next) {
+            /* The last one, put the stub behind it so that it can be taken */
+            link(&stub);
+            next = nextOf(node);
+        }
+        head = next;
+        return node;
+    }
+
+    void recycle(Node *node) {
+        node->cb = nullptr;
+        Node *top = freeNodes.load(std::memory_order_relaxed);
+        do {
+            node->next.store(top, std::memory_order_relaxed);
+        } while (!freeNodes.compare_exchange_weak(top, node, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+public:
+    DeferQueue() : tail(&stub), head(&stub) {
+
+    }
+
+    DeferQueue(const DeferQueue &) = delete;
+    DeferQueue &operator=(const DeferQueue &) = delete;
+
+    /* Callbacks never run are dropped */
+    ~DeferQueue() {
+        while (Node *node = pop()) {
+            delete node;
+        }
+        Node *node = freeNodes.load(std::memory_order_acquire);
+        while (node) {
+            Node *next = node->next.load(std::memory_order_relaxed);
+            delete node;
+            node = next;
+        }
+    }
+
+    /* Any thread */
+    void push(MoveOnlyFunction<void()> &&cb) {
+        NodeCache &cache = nodeCache();
+        if (!cache.nodes) {
+            cache.nodes = freeNodes.exchange(nullptr, std::memory_order_acquire);
+        }
+
+        Node *node = cache.nodes;
+        if (node) {
+            cache.nodes = node->next.load(std::memory_order_relaxed);
+        } else {
+            node = new Node;
+        }
+        node->cb = std::move(cb);
+        link(node);
+    }
+
+    /* Consumer thread only. Runs everything pushed so far and while running, returns how many */
+    unsigned int run() {
+        unsigned int ran = 0;
+        while (Node *node = pop()) {
+            node->cb();
+            recycle(node);
+            ran++;
+        }
+        return ran;
+    }
+};
+
+}
+
+#endif // UWS_DEFERQUEUE_H
@@ -0,0 +1,81 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_EVENTSTREAM_H
+#define UWS_EVENTSTREAM_H
+
+/* Server-Sent Events (text/event-stream), as HttpResponse::startEventStream streams them. What is published to
+ * the topics of an event stream is framed once per publish, as the data of one event, and that frame is written
+ * to every event stream the publish reaches */
+
+#include "TopicTree.h"
+
+#include <string>
+#include <string_view>
+
+namespace uWS {
+
+/* Appends one event to out. Every line of data (split at CR, LF or CRLF) becomes a data field, so that the client
+ * joins them back with LF. Event and id are single lines, anything after a line break is not sent */
+inline void frameEvent(std::string &out, std::string_view data, std::string_view event = {}, std::string_view id = {}) {
+    auto field = [&out](std::string_view name, std::string_view value) {
+        out.append(name);
+        out.append(": ", 2);
+        out.append(value);
+        out.push_back('\n');
+    };
+
+    if (event.length()) {
+        field("event", event.substr(0, event.find_first_of("\r\n")));
+    }
+    if (id.length()) {
+        field("id", id.substr(0, id.find_first_of("\r\n")));
+    }
+
+    for (;;) {
+        size_t lineBreak = data.find_first_of("\r\n");
+        field("data", data.substr(0, lineBreak));
+        if (lineBreak == std::string_view::npos) {
+            break;
+        }
+        lineBreak += (data[lineBreak] == '\r' && lineBreak + 1 < data.length() && data[lineBreak + 1] == '\n') ? 2u : 1u;
+        data.remove_prefix(lineBreak);
+    }
+
+    /* The blank line dispatches it */
+    out.push_back('\n');
+}
+
+/* Writes frame to the event stream subscriber s is of, returning true if it was dropped for being over its
+ * maxBackpressure. Defined by HttpResponse.h */
+template <bool SSL>
+bool sendEventFrame(Subscriber *s, std::string_view frame);
+
+/* Delivers a published message to event stream subscriber s, framing it into frame unless an earlier subscriber
+ * of the same publish did so already */
+template <bool SSL>
+bool sendEvent(Subscriber *s, std::string_view message, std::string &frame) {
+    if (frame.empty()) {
+        frameEvent(frame, message);
+    }
+    return sendEventFrame<SSL>(s, frame);
+}
+
+}
+
+#endif // UWS_EVENTSTREAM_H
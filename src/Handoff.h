@@ -0,0 +1,338 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_HANDOFF_H
+#define UWS_HANDOFF_H
+
+/* A Handoff passes the listen sockets of a running process to its successor over a Unix socket, so that
+ * deploying a new binary never stops accepting, nor drops what is queued to be accepted. The successor
+ * takes them at startup and listens on them with adoptListenSocket, while we stop listening and drain:
+ * every response closes its connection from then on. Optionally, idle keep-alive connections are handed
+ * over too as they time out, instead of being closed. WebSockets stay with us until they close.
+ *
+ *     uWS::Handoff handoff(app, {.path = "/run/app.handoff", .connections = true});
+ *     if (!handoff.take([](auto *listenSocket) { ... })) {
+ *         app.listen(3000, [](auto *listenSocket) { ... });
+ *     }
+ *     handoff.offer({listenSockets...}, []() { close WebSockets, timers, and let the loop end });
+ */
+
+#ifndef _WIN32
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "App.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace uWS {
+
+struct HandoffOptions {
+    /* The Unix socket we offer our sockets on, and take those of a predecessor from */
+    std::string path;
+    /* Also hand over idle keep-alive connections as they time out (cleartext only) */
+    bool connections = false;
+};
+
+template <bool SSL>
+struct TemplatedHandoff {
+    typedef std::conditional_t<SSL, SSLApp, App> AppType;
+
+private:
+    /* Every message is one byte of kind, with any fds */
+    enum Kind : char {
+        /* Successor to predecessor, once connected */
+        TAKE = 'T',
+        LISTEN = 'L',
+        /* All listen sockets were sent */
+        LISTENED = 'D',
+        CONNECTION = 'C'
+    };
+    static constexpr unsigned int MAX_FDS = 64;
+
+    AppType *app;
+    HandoffOptions options;
+
+    /* Offering: the socket we wait for a successor on, and the successor once connected */
+    us_socket_context_t *context = nullptr;
+    us_listen_socket_t *offerSocket = nullptr;
+    us_socket_t *successor = nullptr;
+    std::vector<us_listen_socket_t *> listenSockets;
+    MoveOnlyFunction<void()> handedOff;
+
+    /* Taking: connections keep coming until the predecessor is gone */
+    std::thread receiver;
+
+    static bool sendFds(int channel, char kind, const int *fds, unsigned int count) {
+        struct iovec iov = {&kind, 1};
+        char control[CMSG_SPACE(MAX_FDS * sizeof(int))];
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (count) {
+            memset(control, 0, sizeof(control));
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+            memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+        }
+        ssize_t sent;
+        do {
+            sent = sendmsg(channel, &msg, MSG_NOSIGNAL);
+        } while (sent == -1 && errno == EINTR);
+        return sent == 1;
+    }
+
+    /* Blocking, the number of fds received or -1 once the channel is gone */
+    static int receiveFds(int channel, char &kind, int *fds) {
+        struct iovec iov = {&kind, 1};
+        char control[CMSG_SPACE(MAX_FDS * sizeof(int))];
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t received;
+        do {
+            received = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+        } while (received == -1 && errno == EINTR);
+        if (received <= 0) {
+            return -1;
+        }
+
+        int count = 0;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                int n = (int) ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                memcpy(fds + count, CMSG_DATA(cmsg), (size_t) n * sizeof(int));
+                count += n;
+            }
+        }
+        return count;
+    }
+
+    HttpContextData<SSL> *getHttpContextData() {
+        return (HttpContextData<SSL> *) us_socket_context_ext(SSL, (us_socket_context_t *) app->httpContext);
+    }
+
+    static TemplatedHandoff *getHandoff(us_socket_t *s) {
+        return *(TemplatedHandoff **) us_socket_context_ext(0, us_socket_context(0, s));
+    }
+
+    /* Our successor asked, it gets every listen socket and we stop listening */
+    void handOver(us_socket_t *s) {
+        int channel = us_poll_fd((us_poll_t *) s);
+        std::vector<int> fds;
+        for (us_listen_socket_t *listenSocket : listenSockets) {
+            fds.push_back(us_poll_fd((us_poll_t *) listenSocket));
+        }
+        for (size_t i = 0; i < fds.size(); i += MAX_FDS) {
+            if (!sendFds(channel, LISTEN, fds.data() + i, (unsigned int) std::min<size_t>(MAX_FDS, fds.size() - i))) {
+                /* They got none or some, either way they are not taking over */
+                us_socket_close(0, s, 0, nullptr);
+                return;
+            }
+        }
+        if (!sendFds(channel, LISTENED, nullptr, 0)) {
+            us_socket_close(0, s, 0, nullptr);
+            return;
+        }
+
+        /* It is theirs now, what the kernel queued included */
+        successor = s;
+        for (us_listen_socket_t *listenSocket : listenSockets) {
+            us_listen_socket_close(SSL, listenSocket);
+        }
+        listenSockets.clear();
+        us_listen_socket_close(0, offerSocket);
+        offerSocket = nullptr;
+
+        HttpContextData<SSL> *httpContextData = getHttpContextData();
+        httpContextData->draining = true;
+        if (options.connections && !SSL) {
+            httpContextData->idleHandler = [this](us_socket_t *connection) {
+                int fd = us_poll_fd((us_poll_t *) connection);
+                if (successor) {
+                    /* Their copy outlives our close, the client sees nothing */
+                    sendFds(us_poll_fd((us_poll_t *) successor), CONNECTION, &fd, 1);
+                }
+            };
+        }
+
+        if (handedOff) {
+            handedOff();
+        }
+    }
+
+public:
+    TemplatedHandoff(AppType &app, HandoffOptions options) : app(&app), options(std::move(options)) {
+
+    }
+
+    TemplatedHandoff(const TemplatedHandoff &) = delete;
+    TemplatedHandoff &operator=(const TemplatedHandoff &) = delete;
+
+    /* Waits until the predecessor (if we took from one) is gone */
+    ~TemplatedHandoff() {
+        if (receiver.joinable()) {
+            receiver.join();
+        }
+        if (context) {
+            getHttpContextData()->idleHandler = nullptr;
+            if (offerSocket) {
+                us_listen_socket_close(0, offerSocket);
+            }
+            us_socket_context_close(0, context);
+            us_socket_context_free(0, context);
+        }
+    }
+
+    /* Takes the listen sockets of a predecessor, handler is called for every one like for listen.
+     * False if nobody offers any, then listen as usual. Blocks until they are sent */
+    bool take(MoveOnlyFunction<void(us_listen_socket_t *)> &&handler) {
+        int channel = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        struct sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        if (channel == -1 || options.path.length() >= sizeof(address.sun_path)) {
+            if (channel != -1) {
+                ::close(channel);
+            }
+            return false;
+        }
+        memcpy(address.sun_path, options.path.data(), options.path.length());
+        char kind = TAKE;
+        if (connect(channel, (struct sockaddr *) &address, sizeof(address)) || write(channel, &kind, 1) != 1) {
+            ::close(channel);
+            return false;
+        }
+
+        std::vector<int> fds;
+        int received[MAX_FDS];
+        int count;
+        while ((count = receiveFds(channel, kind, received)) >= 0 && kind == LISTEN) {
+            fds.insert(fds.end(), received, received + count);
+        }
+        if (count < 0 || kind != LISTENED) {
+            for (int fd : fds) {
+                ::close(fd);
+            }
+            ::close(channel);
+            return false;
+        }
+
+        for (int fd : fds) {
+            app->adoptListenSocket(fd, [&handler](us_listen_socket_t *listenSocket) {
+                handler(listenSocket);
+            });
+        }
+
+        /* Idle connections follow one by one, adopted on our loop, until the predecessor exits */
+        Loop *loop = app->getLoop();
+        AppType *app = this->app;
+        receiver = std::thread([channel, loop, app]() {
+            char kind;
+            int received[MAX_FDS];
+            int count;
+            while ((count = receiveFds(channel, kind, received)) >= 0) {
+                for (int i = 0; i < count; i++) {
+                    int fd = received[i];
+                    if (kind != CONNECTION) {
+                        ::close(fd);
+                        continue;
+                    }
+                    loop->defer([app, fd]() {
+                        app->adoptSocket(fd);
+                    });
+                }
+            }
+            ::close(channel);
+        });
+        return true;
+    }
+
+    /* Offers listenSockets to whoever takes them next, then handedOff is called. False if we cannot */
+    bool offer(std::vector<us_listen_socket_t *> listenSockets, MoveOnlyFunction<void()> &&handedOff = nullptr) {
+        this->listenSockets = std::move(listenSockets);
+        this->handedOff = std::move(handedOff);
+
+        if (!context) {
+            context = us_create_socket_context(0, (us_loop_t *) app->getLoop(), sizeof(TemplatedHandoff *), {});
+            if (!context) {
+                return false;
+            }
+            *(TemplatedHandoff **) us_socket_context_ext(0, context) = this;
+
+            us_socket_context_on_open(0, context, [](us_socket_t *s, int /*isClient*/, char */*ip*/, int /*ipLength*/) {
+                /* Whoever connects asks right away, or is gone */
+                us_socket_timeout(0, s, 10);
+                return s;
+            });
+            us_socket_context_on_data(0, context, [](us_socket_t *s, char *data, int length) {
+                TemplatedHandoff *handoff = getHandoff(s);
+                if (length && data[0] == TAKE && !handoff->successor && handoff->offerSocket) {
+                    us_socket_timeout(0, s, 0);
+                    handoff->handOver(s);
+                }
+                return s;
+            });
+            us_socket_context_on_writable(0, context, [](us_socket_t *s) {
+                return s;
+            });
+            us_socket_context_on_close(0, context, [](us_socket_t *s, int /*code*/, void */*reason*/) {
+                TemplatedHandoff *handoff = getHandoff(s);
+                if (handoff->successor == s) {
+                    handoff->successor = nullptr;
+                }
+                return s;
+            });
+            us_socket_context_on_end(0, context, [](us_socket_t *s) {
+                return us_socket_close(0, s, 0, nullptr);
+            });
+            us_socket_context_on_timeout(0, context, [](us_socket_t *s) {
+                return us_socket_close(0, s, 0, nullptr);
+            });
+        }
+
+        if (!offerSocket) {
+            /* A previous one of us may have left it behind */
+            unlink(options.path.c_str());
+            offerSocket = us_socket_context_listen_unix(0, context, options.path.c_str(), 0, 0);
+        }
+        return offerSocket;
+    }
+};
+
+typedef TemplatedHandoff<false> Handoff;
+typedef TemplatedHandoff<true> SSLHandoff;
+
+}
+
+#endif
+
+#endif // UWS_HANDOFF_H
@@ -0,0 +1,142 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_HEADERINDEX_H
+#define UWS_HEADERINDEX_H
+
+/* Well-known request headers are classified into fixed slots while parsing,
+ * using a perfect hash that is verified to be collision free at compile time */
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace uWS {
+
+struct HeaderIndex {
+    /* Keep in sync with names below */
+    enum Header : unsigned char {
+        HOST,
+        CONNECTION,
+        CONTENT_LENGTH,
+        TRANSFER_ENCODING,
+        UPGRADE,
+        EXPECT,
+        COOKIE,
+        USER_AGENT,
+        ACCEPT,
+        ACCEPT_ENCODING,
+        ACCEPT_LANGUAGE,
+        CONTENT_TYPE,
+        AUTHORIZATION,
+        ORIGIN,
+        REFERER,
+        SEC_WEBSOCKET_KEY,
+        SEC_WEBSOCKET_VERSION,
+        SEC_WEBSOCKET_PROTOCOL,
+        SEC_WEBSOCKET_EXTENSIONS,
+        CACHE_CONTROL,
+        IF_NONE_MATCH,
+        IF_MODIFIED_SINCE,
+        RANGE,
+        X_FORWARDED_FOR,
+        NUM_HEADERS
+    };
+
+    static constexpr std::string_view names[NUM_HEADERS] = {
+        "host",
+        "connection",
+        "content-length",
+        "transfer-encoding",
+        "upgrade",
+        "expect",
+        "cookie",
+        "user-agent",
+        "accept",
+        "accept-encoding",
+        "accept-language",
+        "content-type",
+        "authorization",
+        "origin",
+        "referer",
+        "sec-websocket-key",
+        "sec-websocket-version",
+        "sec-websocket-protocol",
+        "sec-websocket-extensions",
+        "cache-control",
+        "if-none-match",
+        "if-modified-since",
+        "range",
+        "x-forwarded-for"
+    };
+
+private:
+    static const unsigned int HASH_BITS = 6;
+    static const unsigned char EMPTY = 0xff;
+
+    /* First, last and middle byte plus length scrambled into HASH_BITS bits */
+    static constexpr unsigned int hash(std::string_view key) {
+        uint32_t features = (uint32_t) (unsigned char) key[0] | (uint32_t) (unsigned char) key[key.length() - 1] << 8
+            | (uint32_t) (key.length() & 0xff) << 16 | (uint32_t) (unsigned char) key[key.length() >> 1] << 24;
+        return (uint32_t) (features * 544159176u) >> (32 - HASH_BITS);
+    }
+
+    struct Table {
+        unsigned char slots[1 << HASH_BITS];
+        bool perfect;
+    };
+
+    static constexpr Table buildTable() {
+        Table t = {};
+        t.perfect = true;
+        for (unsigned int i = 0; i < (1 << HASH_BITS); i++) {
+            t.slots[i] = EMPTY;
+        }
+        for (unsigned char i = 0; i < NUM_HEADERS; i++) {
+            unsigned int h = hash(names[i]);
+            if (t.slots[h] != EMPTY) {
+                t.perfect = false;
+            }
+            t.slots[h] = i;
+        }
+        return t;
+    }
+
+public:
+    /* Defined below, once the class is complete */
+    static const Table table;
+
+    /* Returns the slot of a lower cased header, or NUM_HEADERS if it is not well-known */
+    static inline unsigned int classify(std::string_view lowerCasedHeader) {
+        if (lowerCasedHeader.length() < 4) {
+            return NUM_HEADERS;
+        }
+        unsigned char slot = table.slots[hash(lowerCasedHeader)];
+        if (slot != EMPTY && names[slot].length() == lowerCasedHeader.length()
+            && !memcmp(names[slot].data(), lowerCasedHeader.data(), lowerCasedHeader.length())) {
+            return slot;
+        }
+        return NUM_HEADERS;
+    }
+};
+
+inline constexpr HeaderIndex::Table HeaderIndex::table = HeaderIndex::buildTable();
+static_assert(HeaderIndex::table.perfect, "HeaderIndex hash has collisions, pick another multiplier");
+
+}
+
+#endif // UWS_HEADERINDEX_H
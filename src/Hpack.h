@@ -0,0 +1,455 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_HPACK_H
+#define UWS_HPACK_H
+
+/* HPACK (RFC 7541), the header compression of HTTP/2. The decoder keeps the dynamic table the peer fills. The
+ * encoder only ever refers to the static table (indexed for the common statuses, names otherwise) and so never
+ * has to track what the peer has evicted, at the cost of repeating values; responses are mostly fresh values */
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+
+namespace uWS {
+
+namespace hpack {
+
+struct StaticEntry {
+    std::string_view name, value;
+};
+
+/* Appendix A, index 1 is the first */
+static constexpr StaticEntry staticTable[61] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"}, {":path", "/index.html"},
+    {":scheme", "http"}, {":scheme", "https"}, {":status", "200"}, {":status", "204"}, {":status", "206"},
+    {":status", "304"}, {":status", "400"}, {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""},
+    {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""}, {"date", ""},
+    {"etag", ""}, {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""}, {"if-match", ""},
+    {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""},
+    {"last-modified", ""}, {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""}, {"retry-after", ""},
+    {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""}, {"transfer-encoding", ""},
+    {"user-agent", ""}, {"vary", ""}, {"via", ""}, {"www-authenticate", ""}
+};
+
+struct HuffmanCode {
+    uint32_t code;
+    unsigned char length;
+};
+
+/* Appendix B, EOS last */
+static constexpr HuffmanCode huffmanCodes[257] = {
+        {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28},
+        {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+        {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28},
+        {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+        {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+        {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+        {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10},
+        {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+        {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6},
+        {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+        {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+        {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+        {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7},
+        {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+        {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+        {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+        {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5},
+        {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+        {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+        {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+        {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14},
+        {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+        {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23},
+        {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+        {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23},
+        {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+        {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+        {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+        {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+        {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+        {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22},
+        {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+        {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23},
+        {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+        {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21},
+        {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+        {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+        {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+        {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+        {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+        {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+        {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+        {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+        {0x3fffffff, 30}
+};
+
+/* Decodes 4 bits at a time: from any of the 256 inner nodes of the code tree, where each nibble leads and
+ * what symbol it completes on the way (codes are at least 5 bits, so at most one) */
+struct HuffmanDecoder {
+    enum : unsigned char {
+        EMITS = 1,
+        /* Ending here leaves at most 7 bits of padding, of the EOS prefix */
+        ACCEPTS = 2,
+        FAILS = 4
+    };
+
+    struct Transition {
+        unsigned char node, flags, symbol;
+    } transitions[256][16];
+
+    HuffmanDecoder() {
+        /* The tree, inner nodes numbered in the order made, a leaf as 256 + symbol */
+        unsigned short children[256][2] = {};
+        unsigned int numNodes = 1;
+        for (unsigned int symbol = 0; symbol < 257; symbol++) {
+            unsigned int node = 0;
+            for (int bit = huffmanCodes[symbol].length - 1; bit >= 0; bit--) {
+                unsigned int direction = (huffmanCodes[symbol].code >> bit) & 1;
+                if (!bit) {
+                    children[node][direction] = (unsigned short) (256 + symbol);
+                } else {
+                    if (!children[node][direction]) {
+                        children[node][direction] = (unsigned short) numNodes++;
+                    }
+                    node = children[node][direction];
+                }
+            }
+        }
+
+        /* Padding is the all-ones path from the root, of up to 7 bits */
+        bool accepting[256] = {};
+        for (unsigned int node = 0, depth = 0; depth < 8 && node < 256; depth++) {
+            accepting[node] = true;
+            node = children[node][1];
+        }
+
+        for (unsigned int node = 0; node < numNodes; node++) {
+            for (unsigned int nibble = 0; nibble < 16; nibble++) {
+                Transition transition = {0, 0, 0};
+                unsigned int current = node;
+                for (int bit = 3; bit >= 0; bit--) {
+                    current = children[current][(nibble >> bit) & 1];
+                    if (current == 256 + 256) {
+                        transition.flags = FAILS;
+                        break;
+                    }
+                    if (current >= 256) {
+                        transition.flags |= EMITS;
+                        transition.symbol = (unsigned char) (current - 256);
+                        current = 0;
+                    }
+                }
+                if (!(transition.flags & FAILS)) {
+                    transition.node = (unsigned char) current;
+                    transition.flags |= accepting[current] ? ACCEPTS : 0;
+                }
+                transitions[node][nibble] = transition;
+            }
+        }
+    }
+
+    static const HuffmanDecoder &get() {
+        static const HuffmanDecoder decoder;
+        return decoder;
+    }
+
+    /* Appends what in decodes to out, returns false if it is not a valid encoding */
+    bool decode(std::string_view in, std::string &out) const {
+        unsigned char node = 0, flags = ACCEPTS;
+        for (char byte : in) {
+            unsigned char c = (unsigned char) byte;
+            for (unsigned int nibble : {(unsigned int) c >> 4, (unsigned int) c & 15}) {
+                const Transition &transition = transitions[node][nibble];
+                if (transition.flags & FAILS) {
+                    return false;
+                }
+                if (transition.flags & EMITS) {
+                    out += (char) transition.symbol;
+                }
+                node = transition.node;
+                flags = transition.flags;
+            }
+        }
+        return flags & ACCEPTS;
+    }
+};
+
+/* Length of the Huffman encoding of in, in bytes */
+inline size_t huffmanLength(std::string_view in) {
+    size_t bits = 0;
+    for (char byte : in) {
+        unsigned char c = (unsigned char) byte;
+        bits += huffmanCodes[c].length;
+    }
+    return (bits + 7) / 8;
+}
+
+inline void huffmanEncode(std::string_view in, std::string &out) {
+    uint64_t bits = 0;
+    unsigned int numBits = 0;
+    for (char byte : in) {
+        unsigned char c = (unsigned char) byte;
+        bits = (bits << huffmanCodes[c].length) | huffmanCodes[c].code;
+        numBits += huffmanCodes[c].length;
+        while (numBits >= 8) {
+            numBits -= 8;
+            out += (char) (bits >> numBits);
+        }
+    }
+    /* Padded with the most significant bits of EOS */
+    if (numBits) {
+        out += (char) ((bits << (8 - numBits)) | (0xff >> numBits));
+    }
+}
+
+/* Integer of an N-bit prefix, the rest of the first byte given by first (5.1) */
+inline void encodeInteger(std::string &out, unsigned char first, unsigned int prefixBits, uint64_t value) {
+    uint64_t max = (1u << prefixBits) - 1;
+    if (value < max) {
+        out += (char) (first | value);
+        return;
+    }
+    out += (char) (first | max);
+    value -= max;
+    while (value >= 128) {
+        out += (char) ((value & 127) | 128);
+        value >>= 7;
+    }
+    out += (char) value;
+}
+
+/* Returns false if truncated or beyond 2^32 */
+inline bool decodeInteger(std::string_view &in, unsigned int prefixBits, uint64_t &value) {
+    if (!in.length()) {
+        return false;
+    }
+    uint64_t max = (1u << prefixBits) - 1;
+    value = (unsigned char) in[0] & max;
+    in.remove_prefix(1);
+    if (value < max) {
+        return true;
+    }
+    /* Zero continuations would otherwise shift past 64 bits, 28 covers everything up to UINT32_MAX */
+    for (unsigned int shift = 0; in.length() && shift <= 28; shift += 7) {
+        unsigned char c = (unsigned char) in[0];
+        in.remove_prefix(1);
+        value += (uint64_t) (c & 127) << shift;
+        if (value > UINT32_MAX) {
+            return false;
+        }
+        if (!(c & 128)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* A string literal, Huffman encoded if that is shorter (5.2) */
+inline void encodeString(std::string &out, std::string_view string) {
+    size_t huffman = huffmanLength(string);
+    if (huffman < string.length()) {
+        encodeInteger(out, 0x80, 7, huffman);
+        huffmanEncode(string, out);
+    } else {
+        encodeInteger(out, 0, 7, string.length());
+        out.append(string);
+    }
+}
+
+}
+
+struct HpackDecoder {
+private:
+    struct Entry {
+        std::string name, value;
+    };
+    /* Newest first, index 62 */
+    std::deque<Entry> dynamicTable;
+    size_t tableSize = 0;
+    /* What the peer may use, up to what we allowed in our settings */
+    size_t maxTableSize;
+    size_t allowedTableSize;
+    /* Literals being decoded */
+    std::string name, value;
+
+    void evict(size_t limit) {
+        while (tableSize > limit) {
+            tableSize -= 32 + dynamicTable.back().name.length() + dynamicTable.back().value.length();
+            dynamicTable.pop_back();
+        }
+    }
+
+    void insert(std::string_view entryName, std::string_view entryValue) {
+        size_t size = 32 + entryName.length() + entryValue.length();
+        /* Evicting may free what we insert from, so copy first (4.4) */
+        Entry entry {std::string(entryName), std::string(entryValue)};
+        evict(size > maxTableSize ? 0 : maxTableSize - size);
+        if (size <= maxTableSize) {
+            dynamicTable.push_front(std::move(entry));
+            tableSize += size;
+        }
+    }
+
+    bool lookup(uint64_t index, std::string_view &entryName, std::string_view &entryValue) {
+        if (!index) {
+            return false;
+        }
+        if (index <= 61) {
+            entryName = hpack::staticTable[index - 1].name;
+            entryValue = hpack::staticTable[index - 1].value;
+            return true;
+        }
+        if (index - 62 >= dynamicTable.size()) {
+            return false;
+        }
+        entryName = dynamicTable[index - 62].name;
+        entryValue = dynamicTable[index - 62].value;
+        return true;
+    }
+
+    bool decodeString(std::string_view &in, std::string &out) {
+        if (!in.length()) {
+            return false;
+        }
+        bool huffman = in[0] & 0x80;
+        uint64_t length;
+        if (!hpack::decodeInteger(in, 7, length) || length > in.length()) {
+            return false;
+        }
+        out.clear();
+        std::string_view string = in.substr(0, length);
+        in.remove_prefix(length);
+        if (huffman) {
+            return hpack::HuffmanDecoder::get().decode(string, out);
+        }
+        out.assign(string.data(), string.length());
+        return true;
+    }
+
+public:
+    /* The SETTINGS_HEADER_TABLE_SIZE we sent */
+    HpackDecoder(size_t allowedTableSize = 4096) : maxTableSize(allowedTableSize), allowedTableSize(allowedTableSize) {}
+
+    /* Calls field(name, value) for every field of a complete block, views only valid within field. All of it is
+     * always decoded, the table must stay in step with the peer. Returns false on a decoding error, after which the
+     * connection cannot go on (4.3) */
+    template <typename F>
+    bool decode(std::string_view block, F &&field) {
+        bool mayUpdateSize = true;
+        while (block.length()) {
+            unsigned char first = (unsigned char) block[0];
+            std::string_view entryName, entryValue;
+            uint64_t index;
+
+            if (first & 0x80) {
+                /* Indexed (6.1) */
+                if (!hpack::decodeInteger(block, 7, index) || !lookup(index, entryName, entryValue)) {
+                    return false;
+                }
+                mayUpdateSize = false;
+                field(entryName, entryValue);
+                continue;
+            }
+
+            if ((first & 0xe0) == 0x20) {
+                /* Dynamic table size update, only at the start (6.3) */
+                if (!mayUpdateSize || !hpack::decodeInteger(block, 5, index) || index > allowedTableSize) {
+                    return false;
+                }
+                maxTableSize = index;
+                evict(maxTableSize);
+                continue;
+            }
+            mayUpdateSize = false;
+
+            /* Literal with incremental indexing (6.2.1), without (6.2.2) or never indexed (6.2.3) */
+            bool indexing = (first & 0xc0) == 0x40;
+            if (!hpack::decodeInteger(block, indexing ? 6 : 4, index)) {
+                return false;
+            }
+            if (index) {
+                if (!lookup(index, entryName, entryValue)) {
+                    return false;
+                }
+                name.assign(entryName.data(), entryName.length());
+            } else if (!decodeString(block, name)) {
+                return false;
+            }
+            if (!decodeString(block, value)) {
+                return false;
+            }
+            if (indexing) {
+                insert(name, value);
+            }
+            field(std::string_view(name), std::string_view(value));
+        }
+        return true;
+    }
+
+    size_t getTableSize() {
+        return tableSize;
+    }
+};
+
+struct HpackEncoder {
+    /* Of the name in the static table, 0 if none */
+    static unsigned int nameIndex(std::string_view name) {
+        for (unsigned int i = 0; i < 61; i++) {
+            if (hpack::staticTable[i].name == name) {
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+
+    /* Indexed for the statuses in the static table, otherwise a literal of its name */
+    static void encodeStatus(std::string &out, std::string_view status) {
+        for (unsigned int i = 7; i < 14; i++) {
+            if (hpack::staticTable[i].value == status) {
+                hpack::encodeInteger(out, 0x80, 7, i + 1);
+                return;
+            }
+        }
+        hpack::encodeInteger(out, 0, 4, 8);
+        hpack::encodeString(out, status);
+    }
+
+    /* Literal without indexing, of the static name if there is one. Name is lower cased */
+    static void encode(std::string &out, std::string_view name, std::string_view value) {
+        if (unsigned int index = nameIndex(name)) {
+            hpack::encodeInteger(out, 0, 4, index);
+        } else {
+            out += (char) 0;
+            hpack::encodeString(out, name);
+        }
+        hpack::encodeString(out, value);
+    }
+};
+
+}
+
+#endif // UWS_HPACK_H
@@ -0,0 +1,386 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_HTTP2CONTEXT_H
+#define UWS_HTTP2CONTEXT_H
+
+/* HTTP/2 next to HTTP/1.1 on the same listen sockets: connections beginning with the preface of HTTP/2 (with prior
+ * knowledge, or over TLS once ALPN agreed on h2) and h2c upgrades are adopted by this child context of the
+ * HttpContext, where an Http2Session frames them. Requests are routed by an HttpRouter of their own */
+
+#include "Loop.h"
+#include "AsyncSocket.h"
+#include "HttpParser.h"
+#include "HttpRouter.h"
+#include "Http2Response.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/* ALPN is the only thing we need of the TLS library */
+#ifdef LIBUS_USE_OPENSSL
+#include <openssl/ssl.h>
+#endif
+
+namespace uWS {
+
+template <bool> struct HttpResponseData;
+
+template <bool SSL>
+struct Http2ContextData {
+    template <bool> friend struct Http2Context;
+private:
+    struct RouterData {
+        Http2Response *httpResponse;
+        Http2Request *httpRequest;
+    };
+
+    HttpRouter<RouterData> router;
+    Http2SessionHandlers handlers;
+};
+
+template <bool SSL>
+struct Http2SocketData : AsyncSocketData<SSL> {
+    Http2Session session;
+
+    Http2SocketData(BackPressure &&backpressure, Http2SessionHandlers *handlers) : AsyncSocketData<SSL>(std::move(backpressure)), session(handlers) {}
+};
+
+template <bool SSL>
+struct Http2Context {
+    template<bool, typename> friend struct TemplatedAppBase;
+    template<bool> friend struct HttpContext;
+private:
+    Http2Context() = delete;
+
+    /* Same as HttpContext, for connections without streams open, and as HttpResponse for those with */
+    static const int HTTP_IDLE_TIMEOUT_S = 10;
+    static const int HTTP_TIMEOUT_S = 10;
+
+    us_socket_context_t *getSocketContext() {
+        return (us_socket_context_t *) this;
+    }
+
+    Http2ContextData<SSL> *getSocketContextData() {
+        return (Http2ContextData<SSL> *) us_socket_context_ext(SSL, getSocketContext());
+    }
+
+    static Http2SocketData<SSL> *getSocketData(us_socket_t *s) {
+        return (Http2SocketData<SSL> *) us_socket_ext(SSL, s);
+    }
+
+    static LoopData *getLoopData(us_socket_t *s) {
+        return (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, s)));
+    }
+
+    /* A request upgraded from HTTP/1.1, copied since the socket holding it is about to be adopted */
+    struct UpgradedRequest {
+        std::string method, url;
+        std::vector<std::pair<std::string, std::string>> headers;
+
+        std::string_view getCaseSensitiveMethod() {
+            return method;
+        }
+
+        std::string_view getFullUrl() {
+            return url;
+        }
+
+        std::string_view getHeader(std::string_view key) {
+            for (auto &[k, v] : headers) {
+                if (k == key) {
+                    return v;
+                }
+            }
+            return {};
+        }
+
+        auto begin() {
+            return headers.begin();
+        }
+
+        auto end() {
+            return headers.end();
+        }
+    };
+
+    /* HTTP2-Settings is base64url without padding (RFC 4648 5) */
+    static bool decodeBase64Url(std::string_view in, std::string &out) {
+        unsigned int bits = 0, numBits = 0;
+        for (char c : in) {
+            unsigned int value;
+            if (c >= 'A' && c <= 'Z') {
+                value = (unsigned int) (c - 'A');
+            } else if (c >= 'a' && c <= 'z') {
+                value = (unsigned int) (c - 'a' + 26);
+            } else if (c >= '0' && c <= '9') {
+                value = (unsigned int) (c - '0' + 52);
+            } else if (c == '-') {
+                value = 62;
+            } else if (c == '_') {
+                value = 63;
+            } else if (c == '=') {
+                break;
+            } else {
+                return false;
+            }
+            bits = (bits << 6) | value;
+            numBits += 6;
+            if (numBits >= 8) {
+                numBits -= 8;
+                out += (char) (bits >> numBits);
+            }
+        }
+        return true;
+    }
+
+    /* Takes a socket of the HttpContext as it is, between requests */
+    us_socket_t *adopt(us_socket_t *s) {
+        HttpResponseData<SSL> *httpResponseData = (HttpResponseData<SSL> *) us_socket_ext(SSL, s);
+
+        /* Flush our cork slice, if any, it does not survive the socket being adopted */
+        ((AsyncSocket<SSL> *) s)->flushCorkSlice();
+        BackPressure backpressure(std::move(((AsyncSocketData<SSL> *) httpResponseData)->buffer));
+        httpResponseData->~HttpResponseData<SSL>();
+
+        bool wasCorked = ((AsyncSocket<SSL> *) s)->isCorked();
+        us_socket_t *adopted = us_socket_context_adopt_socket(SSL, getSocketContext(), s, sizeof(Http2SocketData<SSL>));
+        if (wasCorked) {
+            ((AsyncSocket<SSL> *) adopted)->corkUnchecked();
+        }
+
+        Http2SocketData<SSL> *socketData = new (us_socket_ext(SSL, adopted)) Http2SocketData<SSL>(std::move(backpressure), &getSocketContextData()->handlers);
+        socketData->session.user = adopted;
+        us_socket_timeout(SSL, adopted, HTTP_IDLE_TIMEOUT_S);
+        return adopted;
+    }
+
+    /* A connection that began with the preface, data being its first read */
+    us_socket_t *adoptPreface(us_socket_t *s, char *data, int length) {
+        return onData(adopt(s), data, length);
+    }
+
+    /* Upgrades an HTTP/1.1 request without body asking for h2c (RFC 7540 3.2), which goes on as stream 1.
+     * Returns the socket it now is, or nullptr if it was not upgraded */
+    us_socket_t *upgrade(us_socket_t *s, HttpRequest *req) {
+        std::string settings;
+        if (!decodeBase64Url(req->getHeader("http2-settings"), settings)) {
+            return nullptr;
+        }
+        UpgradedRequest upgraded = {std::string(req->getCaseSensitiveMethod()), std::string(req->getFullUrl()), {}};
+        for (auto [key, value] : *req) {
+            upgraded.headers.emplace_back(key, value);
+        }
+
+        std::string_view response = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+        ((AsyncSocket<SSL> *) s)->write(response.data(), (int) response.length());
+
+        us_socket_t *adopted = adopt(s);
+        if (!getSocketData(adopted)->session.upgrade(&upgraded, settings)) {
+            us_socket_close(SSL, adopted, 0, nullptr);
+        }
+        return adopted;
+    }
+
+    static us_socket_t *onData(us_socket_t *s, char *data, int length) {
+        if (!getSocketData(s)->session.consume(std::string_view(data, (size_t) length))) {
+            /* GOAWAY went out, or the peer is not speaking HTTP/2 */
+            us_socket_shutdown(SSL, s);
+            return us_socket_close(SSL, s, 0, nullptr);
+        }
+        return s;
+    }
+
+    Http2Context<SSL> *init() {
+        Http2ContextData<SSL> *contextData = getSocketContextData();
+
+        contextData->handlers.request = [contextData](Http2Response *res, Http2Request *req) {
+            ((LoopData *) us_loop_ext((us_loop_t *) Loop::get()))->metrics.requests.add();
+            contextData->router.getUserData() = {res, req};
+            return contextData->router.route(req->getCaseSensitiveMethod(), req->getUrl());
+        };
+
+        /* Sessions write once per event, or as streams fill FLUSH_SIZE. A connection is given the idle timeout
+         * of HTTP/1.1 while it has no streams. While it has, only a peer that stops taking what we write is timed
+         * out, from when backpressure began until it drains (see on_writable) */
+        contextData->handlers.write = [](Http2Session *session, std::string_view data) {
+            AsyncSocket<SSL> *asyncSocket = (AsyncSocket<SSL> *) session->user;
+            bool hadBackPressure = asyncSocket->getBufferedAmount();
+            auto [written, failed] = asyncSocket->write(data.data(), (int) data.length());
+            if (failed) {
+                if (!hadBackPressure) {
+                    asyncSocket->timeout(HTTP_TIMEOUT_S);
+                }
+            } else {
+                asyncSocket->timeout((unsigned int) (session->getNumStreams() ? 0 : HTTP_IDLE_TIMEOUT_S));
+            }
+            return !failed;
+        };
+
+        us_socket_context_on_data(SSL, getSocketContext(), [](us_socket_t *s, char *data, int length) {
+            LoopData *loopData = getLoopData(s);
+            loopData->noteEvent();
+            loopData->metrics.bytesIn.add((unsigned long long) length);
+
+            return onData(s, data, length);
+        });
+
+        /* Once the socket took all we had, streams go on where flow control and the transport held them */
+        us_socket_context_on_writable(SSL, getSocketContext(), [](us_socket_t *s) {
+            AsyncSocket<SSL> *asyncSocket = (AsyncSocket<SSL> *) s;
+            asyncSocket->write(nullptr, 0, true, 0);
+            if (!asyncSocket->getBufferedAmount()) {
+                Http2Session &session = getSocketData(s)->session;
+                asyncSocket->timeout((unsigned int) (session.getNumStreams() ? 0 : HTTP_IDLE_TIMEOUT_S));
+                session.drain();
+            }
+            return s;
+        });
+
+        us_socket_context_on_close(SSL, getSocketContext(), [](us_socket_t *s, int /*code*/, void */*reason*/) {
+            Http2SocketData<SSL> *socketData = getSocketData(s);
+
+            /* Every stream still open is aborted */
+            socketData->session.abort();
+            socketData->~Http2SocketData<SSL>();
+
+            LoopData *loopData = getLoopData(s);
+            loopData->connections.fetch_sub(1, std::memory_order_relaxed);
+            loopData->metrics.closed.add();
+            return s;
+        });
+
+        /* HTTP/2 has no half closed connections either */
+        us_socket_context_on_end(SSL, getSocketContext(), [](us_socket_t *s) {
+            return us_socket_close(SSL, s, 0, nullptr);
+        });
+
+        us_socket_context_on_timeout(SSL, getSocketContext(), [](us_socket_t *s) {
+            return us_socket_close(SSL, s, 0, nullptr);
+        });
+
+        return this;
+    }
+
+public:
+    static Http2Context *create(us_socket_context_t *parentSocketContext) {
+        Http2Context *http2Context = (Http2Context *) us_create_child_socket_context(SSL, parentSocketContext, sizeof(Http2ContextData<SSL>));
+        if (!http2Context) {
+            return nullptr;
+        }
+
+        new ((Http2ContextData<SSL> *) us_socket_context_ext(SSL, (us_socket_context_t *) http2Context)) Http2ContextData<SSL>();
+        return http2Context->init();
+    }
+
+    void free() {
+        getSocketContextData()->~Http2ContextData<SSL>();
+        us_socket_context_free(SSL, getSocketContext());
+    }
+
+#ifdef LIBUS_USE_OPENSSL
+    /* Offers h2 ahead of http/1.1, to clients that offer it */
+    static int selectProtocol(struct ssl_st *, const unsigned char **out, unsigned char *outLength, const unsigned char *in, unsigned int inLength, void *) {
+        static const unsigned char protocols[] = "\x02h2\x08http/1.1";
+        if (SSL_select_next_proto((unsigned char **) out, outLength, protocols, sizeof(protocols) - 1, in, inLength) != OPENSSL_NPN_NEGOTIATED) {
+            return SSL_TLSEXT_ERR_NOACK;
+        }
+        return SSL_TLSEXT_ERR_OK;
+    }
+#endif
+
+    /* Generic for get, post, any, etc. Same as HttpContext::onHttp */
+    void onHttp(std::string method, std::string pattern, MoveOnlyFunction<void(Http2Response *, Http2Request *)> &&handler) {
+        Http2ContextData<SSL> *contextData = getSocketContextData();
+
+        std::vector<std::string> methods = {method};
+        uint32_t priority = method == "*" ? contextData->router.LOW_PRIORITY : contextData->router.MEDIUM_PRIORITY;
+
+        /* If we are passed nullptr then remove this */
+        if (!handler) {
+            contextData->router.remove(methods[0], pattern, priority);
+            return;
+        }
+
+        /* Record this route's parameter offsets */
+        RouteParameters parameterOffsets(pattern);
+
+        contextData->router.add(methods, pattern, [handler = std::move(handler), parameterOffsets = std::move(parameterOffsets)](auto *r) mutable {
+            auto user = r->getUserData();
+            user.httpRequest->setYield(false);
+            user.httpRequest->setParameters(r->getParameters());
+            user.httpRequest->setParameterOffsets(&parameterOffsets);
+
+            handler(user.httpResponse, user.httpRequest);
+
+            /* If any handler yielded, the router will keep looking for a suitable handler */
+            return !user.httpRequest->getYield();
+        }, priority);
+    }
+
+    /* Compiles the routes into a flat matching table, see HttpRouter::freeze */
+    void freeze() {
+        getSocketContextData()->router.freeze();
+    }
+
+    Http2Context *get(std::string pattern, MoveOnlyFunction<void(Http2Response *, Http2Request *)> &&handler) {
+        onHttp("GET", std::move(pattern), std::move(handler));
+        return this;
+    }
+
+    Http2Context *post(std::string pattern, MoveOnlyFunction<void(Http2Response *, Http2Request *)> &&handler) {
+        onHttp("POST", std::move(pattern), std::move(handler));
+        return this;
+    }
+
+    Http2Context *put(std::string pattern, MoveOnlyFunction<void(Http2Response *, Http2Request *)> &&handler) {
+        onHttp("PUT", std::move(pattern), std::move(handler));
+        return this;
+    }
+
+    Http2Context *del(std::string pattern, MoveOnlyFunction<void(Http2Response *, Http2Request *)> &&handler) {
+        onHttp("DELETE", std::move(pattern), std::move(handler));
+        return this;
+    }
+
+    Http2Context *patch(std::string pattern, MoveOnlyFunction<void(Http2Response *, Http2Request *)> &&handler) {
+        onHttp("PATCH", std::move(pattern), std::move(handler));
+        return this;
+    }
+
+    Http2Context *head(std::string pattern, MoveOnlyFunction<void(Http2Response *, Http2Request *)> &&handler) {
+        onHttp("HEAD", std::move(pattern), std::move(handler));
+        return this;
+    }
+
+    Http2Context *options(std::string pattern, MoveOnlyFunction<void(Http2Response *, Http2Request *)> &&handler) {
+        onHttp("OPTIONS", std::move(pattern), std::move(handler));
+        return this;
+    }
+
+    /* This one catches any method */
+    Http2Context *any(std::string pattern, MoveOnlyFunction<void(Http2Response *, Http2Request *)> &&handler) {
+        onHttp("*", std::move(pattern), std::move(handler));
+        return this;
+    }
+};
+
+}
+
+#endif // UWS_HTTP2CONTEXT_H
@@ -0,0 +1,276 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_HTTP2REQUEST_H
+#define UWS_HTTP2REQUEST_H
+
+/* For HeaderIndex, QueryIndex and UWS_HTTP_MAX_HEADERS_COUNT, the same as HTTP/1.1 */
+#include "HttpParser.h"
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace uWS {
+
+    /* The header block of a stream as HPACK decoded it, copied in since the decoder reuses what it decodes into.
+     * One per session, reused for every block. Like HttpRequest only valid within the handler it is given to */
+    struct Http2Request {
+        friend struct Http2Session;
+
+    private:
+        struct Field {
+            unsigned int offset, keyLength, valueLength;
+        };
+        struct Header {
+            std::string_view key, value;
+        } headers[UWS_HTTP_MAX_HEADERS_COUNT];
+        Field fields[UWS_HTTP_MAX_HEADERS_COUNT];
+        unsigned int numHeaders = 0;
+        /* Names and values end to end */
+        std::string buffer;
+        /* Pseudo headers, :path split at its query */
+        enum {
+            METHOD,
+            PATH,
+            AUTHORITY,
+            SCHEME,
+            NUM_PSEUDO_HEADERS
+        };
+        Field pseudoFields[NUM_PSEUDO_HEADERS];
+        std::string_view method, path, authority, scheme;
+        unsigned int querySeparator = 0;
+        bool malformed = false, didYield = false;
+        /* Index into headers plus one for every well-known header, 0 if not present */
+        unsigned char knownHeaders[HeaderIndex::NUM_HEADERS];
+        QueryIndex queryIndex;
+        std::pair<int, std::string_view *> currentParameters;
+        RouteParameters *currentParameterOffsets = nullptr;
+
+        void reset() {
+            numHeaders = 0;
+            buffer.clear();
+            memset(pseudoFields, 0, sizeof(pseudoFields));
+            malformed = false;
+            queryIndex.reset();
+            currentParameterOffsets = nullptr;
+        }
+
+        /* Takes one decoded field. Whatever is malformed (RFC 9113 8.2, 8.3) is noted, the block is decoded in
+         * full regardless */
+        void add(std::string_view key, std::string_view value) {
+            if (malformed) {
+                return;
+            }
+            Field field = {(unsigned int) buffer.length(), (unsigned int) key.length(), (unsigned int) value.length()};
+
+            if (key.length() && key[0] == ':') {
+                int pseudo = key == ":method" ? METHOD : key == ":path" ? PATH : key == ":authority" ? AUTHORITY : key == ":scheme" ? SCHEME : -1;
+                /* Pseudo headers all come first, once each */
+                if (pseudo == -1 || numHeaders || pseudoFields[pseudo].keyLength) {
+                    malformed = true;
+                    return;
+                }
+                pseudoFields[pseudo] = field;
+                buffer.append(key).append(value);
+                return;
+            }
+
+            for (char c : key) {
+                if (c >= 'A' && c <= 'Z') {
+                    malformed = true;
+                    return;
+                }
+            }
+            /* Connection specific headers have no meaning here, but te: trailers */
+            if (key == "connection" || key == "keep-alive" || key == "proxy-connection" || key == "transfer-encoding"
+                || key == "upgrade" || (key == "te" && value != "trailers") || !key.length()) {
+                malformed = true;
+                return;
+            }
+            /* More than we keep fails the request, as in HTTP/1.1 */
+            if (numHeaders == UWS_HTTP_MAX_HEADERS_COUNT) {
+                malformed = true;
+                return;
+            }
+            fields[numHeaders++] = field;
+            buffer.append(key).append(value);
+        }
+
+        /* Views everything taken, returns false if malformed */
+        bool finish() {
+            if (malformed) {
+                return false;
+            }
+            auto view = [this](Field field) {
+                return std::string_view(buffer.data() + field.offset + field.keyLength, field.valueLength);
+            };
+            method = view(pseudoFields[METHOD]);
+            path = view(pseudoFields[PATH]);
+            authority = view(pseudoFields[AUTHORITY]);
+            scheme = view(pseudoFields[SCHEME]);
+            /* CONNECT has no :path nor :scheme */
+            if (!method.length() || (method != "CONNECT" && (!path.length() || !scheme.length()))) {
+                return false;
+            }
+
+            memset(knownHeaders, 0, sizeof(knownHeaders));
+            for (unsigned int i = 0; i < numHeaders; i++) {
+                headers[i] = {std::string_view(buffer.data() + fields[i].offset, fields[i].keyLength), view(fields[i])};
+                unsigned int slot = HeaderIndex::classify(headers[i].key);
+                if (slot != HeaderIndex::NUM_HEADERS && !knownHeaders[slot]) {
+                    knownHeaders[slot] = (unsigned char) (i + 1);
+                }
+            }
+
+            size_t separator = path.find('?');
+            querySeparator = (unsigned int) (separator == std::string_view::npos ? path.length() : separator);
+            return true;
+        }
+
+    public:
+        bool getYield() {
+            return didYield;
+        }
+
+        /* If you do not want to handle this route */
+        void setYield(bool yield) {
+            didYield = yield;
+        }
+
+        /* Iteration over headers (key, value), pseudo headers left out */
+        struct HeaderIterator {
+            Header *ptr;
+
+            bool operator!=(const HeaderIterator &other) const {
+                return ptr != other.ptr;
+            }
+
+            HeaderIterator &operator++() {
+                ptr++;
+                return *this;
+            }
+
+            std::pair<std::string_view, std::string_view> operator*() const {
+                return {ptr->key, ptr->value};
+            }
+        };
+
+        HeaderIterator begin() {
+            return {headers};
+        }
+
+        HeaderIterator end() {
+            return {headers + numHeaders};
+        }
+
+        /* O(1) lookup of well-known headers. Host is also :authority, the way HTTP/2 sends it */
+        std::string_view getHeader(HeaderIndex::Header header) {
+            if (knownHeaders[header]) {
+                return headers[knownHeaders[header] - 1].value;
+            }
+            if (header == HeaderIndex::HOST) {
+                return authority;
+            }
+            return std::string_view(nullptr, 0);
+        }
+
+        /* Field names are always lower case in HTTP/2 */
+        std::string_view getHeader(std::string_view lowerCasedHeader) {
+            unsigned int slot = HeaderIndex::classify(lowerCasedHeader);
+            if (slot != HeaderIndex::NUM_HEADERS) {
+                return getHeader((HeaderIndex::Header) slot);
+            }
+            if (lowerCasedHeader.length() && lowerCasedHeader[0] == ':') {
+                if (lowerCasedHeader == ":method") {
+                    return method;
+                } else if (lowerCasedHeader == ":path") {
+                    return path;
+                } else if (lowerCasedHeader == ":authority") {
+                    return authority;
+                } else if (lowerCasedHeader == ":scheme") {
+                    return scheme;
+                }
+            }
+            for (unsigned int i = 0; i < numHeaders; i++) {
+                if (headers[i].key == lowerCasedHeader) {
+                    return headers[i].value;
+                }
+            }
+            return std::string_view(nullptr, 0);
+        }
+
+        std::string_view getUrl() {
+            return path.substr(0, querySeparator);
+        }
+
+        std::string_view getFullUrl() {
+            return path;
+        }
+
+        /* Upper cased, as sent */
+        std::string_view getMethod() {
+            return method;
+        }
+
+        std::string_view getCaseSensitiveMethod() {
+            return method;
+        }
+
+        /* Returns the raw querystring as a whole, still encoded */
+        std::string_view getQuery() {
+            if (querySeparator < path.length()) {
+                return path.substr(querySeparator + 1);
+            }
+            return std::string_view(nullptr, 0);
+        }
+
+        /* Finds and decodes the URI component. The query is indexed once per request */
+        std::string_view getQuery(std::string_view key) {
+            return queryIndex.get(key, path.substr(querySeparator));
+        }
+
+        void setParameters(std::pair<int, std::string_view *> parameters) {
+            currentParameters = parameters;
+        }
+
+        void setParameterOffsets(RouteParameters *offsets) {
+            currentParameterOffsets = offsets;
+        }
+
+        std::string_view getParameter(std::string_view name) {
+            if (!currentParameterOffsets) {
+                return {nullptr, 0};
+            }
+            int index = currentParameterOffsets->find(name);
+            if (index == -1) {
+                return {nullptr, 0};
+            }
+            return getParameter((unsigned short) index);
+        }
+
+        std::string_view getParameter(unsigned short index) {
+            if (currentParameters.first < (int) index) {
+                return {};
+            }
+            return currentParameters.second[index];
+        }
+    };
+}
+
+#endif // UWS_HTTP2REQUEST_H
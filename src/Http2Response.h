@@ -0,0 +1,268 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_HTTP2RESPONSE_H
+#define UWS_HTTP2RESPONSE_H
+
+#include "Http2Session.h"
+
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <utility>
+
+namespace uWS {
+
+    /* Is a stream of an Http2Session. Writes follow the contract of HttpResponse: write and end buffer what the
+     * stream does not take, tryEnd takes what it can and leaves the rest to be retried from onWritable at
+     * getWriteOffset. What a stream takes is bounded by the flow control windows of the peer, and by the
+     * transport while it is backed up */
+    struct Http2Response {
+    private:
+        Http2StreamData *getStreamData() {
+            return (Http2StreamData *) this;
+        }
+
+        /* Nothing more goes once ended, or once the stream is gone under us */
+        bool isDone() {
+            return getStreamData()->state & (Http2StreamData::HTTP_END_CALLED | Http2StreamData::HTTP_CLOSED);
+        }
+
+        /* Writes or buffers all of data, ending the stream after it if fin */
+        bool writeOrBuffer(std::string_view data, bool fin) {
+            Http2StreamData *streamData = getStreamData();
+            streamData->offset += data.length();
+            if (!streamData->backpressure.length()) {
+                data.remove_prefix(streamData->session->writeData(streamData, data, fin));
+            }
+            if (data.length() && !(streamData->state & Http2StreamData::HTTP_CLOSED)) {
+                streamData->backpressure.append(data.data(), data.length());
+                return false;
+            }
+            return true;
+        }
+
+        static bool equalsLowerCased(std::string_view key, std::string_view lowerCased) {
+            if (key.length() != lowerCased.length()) {
+                return false;
+            }
+            for (size_t i = 0; i < key.length(); i++) {
+                if ((key[i] >= 'A' && key[i] <= 'Z' ? (char) (key[i] | 32) : key[i]) != lowerCased[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /* Lower cased, as HTTP/2 requires, and HPACK encoded into out */
+        static void encodeField(std::string &out, std::string_view key, std::string_view value) {
+            char lowerCased[256];
+            if (key.length() <= sizeof(lowerCased)) {
+                for (size_t i = 0; i < key.length(); i++) {
+                    lowerCased[i] = (key[i] >= 'A' && key[i] <= 'Z') ? (char) (key[i] | 32) : key[i];
+                }
+                HpackEncoder::encode(out, std::string_view(lowerCased, key.length()), value);
+            } else {
+                std::string copy(key);
+                for (char &c : copy) {
+                    c = (c >= 'A' && c <= 'Z') ? (char) (c | 32) : c;
+                }
+                HpackEncoder::encode(out, copy, value);
+            }
+        }
+
+    public:
+        /* Resets the stream (CANCEL), onAborted is emitted */
+        void close() {
+            Http2Session *session = getStreamData()->session;
+            if (!(getStreamData()->state & Http2StreamData::HTTP_CLOSED)) {
+                session->resetStream(getStreamData(), Http2Session::CANCEL);
+            }
+            session->finish();
+        }
+
+        /* Everything written within handler goes out together */
+        Http2Response *cork(MoveOnlyFunction<void()> &&handler) {
+            Http2Session *session = getStreamData()->session;
+            session->depth++;
+            handler();
+            session->depth--;
+            session->finish();
+            return this;
+        }
+
+        void endWithoutBody(std::optional<size_t> reportedContentLength = std::nullopt, bool /*closeConnection*/ = false) {
+            Http2StreamData *streamData = getStreamData();
+            if (isDone()) {
+                return;
+            }
+            Http2Session *session = streamData->session;
+            streamData->markDone();
+            session->sendHeaders(streamData, true, reportedContentLength);
+            session->finish();
+        }
+
+        /* Only the code of status goes out, HTTP/2 has no reason phrase */
+        Http2Response *writeStatus(std::string_view status) {
+            Http2StreamData *streamData = getStreamData();
+
+            /* Nothing is done if headers already sent */
+            if (!(streamData->state & Http2StreamData::HTTP_HEADERS_SENT) && status.length() >= 3) {
+                memcpy(streamData->status, status.data(), 3);
+            }
+            return this;
+        }
+
+        /* Field names are lower cased. Connection specific headers have no place in HTTP/2 and are left out */
+        Http2Response *writeHeader(std::string_view key, std::string_view value) {
+            Http2StreamData *streamData = getStreamData();
+            if (streamData->state & Http2StreamData::HTTP_HEADERS_SENT) {
+                return this;
+            }
+            if (equalsLowerCased(key, "connection") || equalsLowerCased(key, "keep-alive") || equalsLowerCased(key, "transfer-encoding")) {
+                return this;
+            }
+            if (equalsLowerCased(key, "content-length")) {
+                streamData->state |= Http2StreamData::HTTP_CONTENT_LENGTH_WRITTEN;
+            }
+            encodeField(streamData->headers, key, value);
+            return this;
+        }
+
+        Http2Response *writeHeader(std::string_view key, uint64_t value) {
+            char buffer[20];
+            char *end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+            return writeHeader(key, std::string_view(buffer, (size_t) (end - buffer)));
+        }
+
+        /* Sent after the body, as gRPC has its status. Written once the body began, up until the end */
+        Http2Response *writeTrailer(std::string_view key, std::string_view value) {
+            if (!isDone()) {
+                encodeField(getStreamData()->trailers, key, value);
+            }
+            return this;
+        }
+
+        /* Writes what the stream takes of data, up to totalSize of body in all (data.length() if 0). Returns
+         * whether all of data went, and whether the response is done. Retry from onWritable with what is left
+         * past getWriteOffset */
+        std::pair<bool, bool> tryEnd(std::string_view data, uintmax_t totalSize = 0, bool /*closeConnection*/ = false) {
+            Http2StreamData *streamData = getStreamData();
+            if (isDone()) {
+                return {true, true};
+            }
+            Http2Session *session = streamData->session;
+            if (!totalSize) {
+                totalSize = streamData->offset + data.length();
+            }
+            if (!totalSize && !streamData->trailers.length()) {
+                endWithoutBody(0);
+                return {true, true};
+            }
+            session->sendHeaders(streamData, false, totalSize);
+
+            std::pair<bool, bool> result = {false, false};
+            if (!streamData->backpressure.length()) {
+                std::string_view body = data.substr(0, (size_t) std::min<uintmax_t>(data.length(), totalSize - streamData->offset));
+                size_t written = session->writeData(streamData, body, streamData->offset + body.length() == totalSize);
+                streamData->offset += written;
+
+                if (streamData->offset >= totalSize) {
+                    streamData->markDone();
+                    result = {true, true};
+                } else {
+                    result = {written == data.length(), false};
+                }
+            }
+            if (!result.second) {
+                streamData->state |= Http2StreamData::HTTP_WRITE_BLOCKED;
+            }
+            session->finish();
+            return result;
+        }
+
+        /* Streams a chunk of the body, buffering what the stream does not take. Returns false on backpressure */
+        bool write(std::string_view data) {
+            Http2StreamData *streamData = getStreamData();
+            if (isDone()) {
+                return false;
+            }
+            Http2Session *session = streamData->session;
+            session->sendHeaders(streamData, false, std::nullopt);
+            bool wrote = writeOrBuffer(data, false);
+            if (!wrote) {
+                streamData->state |= Http2StreamData::HTTP_WRITE_BLOCKED;
+            }
+            session->finish();
+            return wrote;
+        }
+
+        /* Ends the response, buffering what the stream does not take. The stream ends once all went */
+        void end(std::string_view data = {}, bool /*closeConnection*/ = false) {
+            Http2StreamData *streamData = getStreamData();
+            if (isDone()) {
+                return;
+            }
+            Http2Session *session = streamData->session;
+
+            bool wroteBefore = streamData->state & Http2StreamData::HTTP_HEADERS_SENT;
+            if (!wroteBefore && !data.length() && !streamData->trailers.length()) {
+                endWithoutBody(0);
+                return;
+            }
+            session->sendHeaders(streamData, false, wroteBefore ? std::nullopt : std::optional<uintmax_t>(data.length()));
+            streamData->markDone();
+            writeOrBuffer(data, true);
+            session->finish();
+        }
+
+        uintmax_t getWriteOffset() {
+            return getStreamData()->offset;
+        }
+
+        bool hasResponded() {
+            return getStreamData()->state & Http2StreamData::HTTP_END_CALLED;
+        }
+
+        /* The stream id, unique within its session */
+        uint32_t getStreamId() {
+            return getStreamData()->id;
+        }
+
+        /* Attach handler for aborted HTTP request */
+        Http2Response *onAborted(ResponseHandler<void()> &&handler) {
+            getStreamData()->onAborted = std::move(handler);
+            return this;
+        }
+
+        /* Attach a read handler for data sent. Will be called with FIN set true if last segment. */
+        Http2Response *onData(ResponseHandler<void(std::string_view, bool)> &&handler) {
+            getStreamData()->onData = std::move(handler);
+            return this;
+        }
+
+        /* Called with getWriteOffset once the stream takes more, after what end or write buffered went */
+        Http2Response *onWritable(ResponseHandler<bool(uintmax_t)> &&handler) {
+            getStreamData()->onWritable = std::move(handler);
+            return this;
+        }
+    };
+
+}
+
+#endif // UWS_HTTP2RESPONSE_H
@@ -0,0 +1,936 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_HTTP2SESSION_H
+#define UWS_HTTP2SESSION_H
+
+/* The HTTP/2 framing layer (RFC 9113) of one connection, without any socket: it consumes what was read and leaves
+ * what is to be written in output, for Http2Context to write, and for tests to read. Streams are responses
+ * (Http2Response) of requests routed like any other. Bodies are sent within the flow control windows of the
+ * peer, what they do not take waits in the BackPressure of the stream, as does everything while the transport is
+ * backed up. What the peer sends we take as fast as it comes, so our windows are only replenished */
+
+#include "Hpack.h"
+#include "Http2Request.h"
+#include "AsyncSocketData.h"
+#include "MoveOnlyFunction.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace uWS {
+
+struct Http2Session;
+struct Http2Response;
+
+struct Http2StreamData {
+    friend struct Http2Session;
+    friend struct Http2Response;
+
+private:
+    enum : unsigned char {
+        /* Headers went out, with the first of the body (or without one) */
+        HTTP_HEADERS_SENT = 1,
+        /* Ended, the stream ends once backpressure drained */
+        HTTP_END_CALLED = 2,
+        /* END_STREAM sent */
+        HTTP_SHUT_DOWN = 4,
+        /* Content-length written by hand */
+        HTTP_CONTENT_LENGTH_WRITTEN = 8,
+        /* END_STREAM received, the request is whole */
+        HTTP_REMOTE_CLOSED = 16,
+        /* Gone from the session, freed once out of whatever called us */
+        HTTP_CLOSED = 32,
+        /* A write was short, onWritable is due once the stream takes more */
+        HTTP_WRITE_BLOCKED = 64
+    };
+
+    ResponseHandler<void()> onAborted = nullptr;
+    ResponseHandler<void(std::string_view, bool)> onData = nullptr;
+    ResponseHandler<bool(uintmax_t)> onWritable = nullptr;
+
+    Http2Session *session;
+    uint32_t id;
+
+    /* Only the code of the status goes in :status */
+    char status[3] = {'2', '0', '0'};
+    unsigned char state = 0;
+
+    /* Headers and trailers written so far, HPACK encoded as they are written (the encoder keeps no state) */
+    std::string headers, trailers;
+
+    /* What the peer still takes of us, and what it may still send us */
+    int64_t sendWindow;
+    int64_t receiveWindow;
+
+    /* Write offset, of the body */
+    uintmax_t offset = 0;
+
+    BackPressure backpressure;
+
+    Http2StreamData(Http2Session *session, uint32_t id, int64_t sendWindow, int64_t receiveWindow)
+        : session(session), id(id), sendWindow(sendWindow), receiveWindow(receiveWindow) {}
+
+    /* When we are done with a response we mark it like so */
+    void markDone() {
+        onAborted = nullptr;
+        /* Nor do we emit writable while draining behind the scenes */
+        onWritable = nullptr;
+        state |= HTTP_END_CALLED;
+    }
+
+    /* Same as HttpResponseData::callOnWritable, onWritable may be reset (by ending) from within */
+    bool callOnWritable(uintmax_t offset) {
+        ResponseHandler<bool(uintmax_t)> borrowedOnWritable = std::move(onWritable);
+        onWritable = [](uintmax_t) {return true;};
+
+        bool ret = borrowedOnWritable(offset);
+
+        if (onWritable) {
+            onWritable = std::move(borrowedOnWritable);
+        }
+        return ret;
+    }
+};
+
+/* One per context, shared by all of its sessions */
+struct Http2SessionHandlers {
+    /* Routes a request, returns false if nothing handled it */
+    MoveOnlyFunction<bool(Http2Response *, Http2Request *)> request = nullptr;
+    /* Writes out what a session has for it, returns false if the transport had to buffer some of it */
+    MoveOnlyFunction<bool(Http2Session *, std::string_view)> write = nullptr;
+};
+
+struct Http2Session {
+    friend struct Http2Response;
+
+    static constexpr std::string_view PREFACE = {"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24};
+
+    enum FrameType : unsigned char {
+        DATA,
+        HEADERS,
+        PRIORITY,
+        RST_STREAM,
+        SETTINGS,
+        PUSH_PROMISE,
+        PING,
+        GOAWAY,
+        WINDOW_UPDATE,
+        CONTINUATION
+    };
+
+    enum : unsigned char {
+        FLAG_END_STREAM = 1,
+        FLAG_ACK = 1,
+        FLAG_END_HEADERS = 4,
+        FLAG_PADDED = 8,
+        FLAG_PRIORITY = 32
+    };
+
+    enum ErrorCode : uint32_t {
+        NO_ERROR_CODE,
+        PROTOCOL_ERROR,
+        INTERNAL_ERROR,
+        FLOW_CONTROL_ERROR,
+        SETTINGS_TIMEOUT,
+        STREAM_CLOSED,
+        FRAME_SIZE_ERROR,
+        REFUSED_STREAM,
+        CANCEL,
+        COMPRESSION_ERROR,
+        CONNECT_ERROR,
+        ENHANCE_YOUR_CALM
+    };
+
+    enum Setting : uint16_t {
+        HEADER_TABLE_SIZE = 1,
+        ENABLE_PUSH,
+        MAX_CONCURRENT_STREAMS,
+        INITIAL_WINDOW_SIZE,
+        MAX_FRAME_SIZE,
+        MAX_HEADER_LIST_SIZE
+    };
+
+    /* What we settle for, streams beyond MAX_STREAMS at once are refused */
+    static const unsigned int MAX_STREAMS = 100;
+    static const unsigned int STREAM_WINDOW = 256 * 1024;
+    static const unsigned int CONNECTION_WINDOW = 1024 * 1024;
+    /* Of the frames we take, and of a header block in all before it is decoded */
+    static const unsigned int MAX_FRAME = 16384;
+    static const unsigned int MAX_HEADER_BLOCK = 64 * 1024;
+    /* Output is written out at the latest when this large, to have the transport tell of backpressure */
+    static const unsigned int FLUSH_SIZE = 64 * 1024;
+    /* Streams the peer may reset per window (rapid reset, CVE-2023-44487), and control frames we may answer while
+     * the transport is blocked, before it is told to ENHANCE_YOUR_CALM and closed */
+    static const unsigned int MAX_RESETS = 200;
+    static const unsigned int RESET_WINDOW_MS = 1000;
+    static const unsigned int MAX_QUEUED_CONTROL_FRAMES = 1000;
+
+    static const int64_t DEFAULT_WINDOW = 65535;
+    static const int64_t MAX_WINDOW = 0x7fffffff;
+
+private:
+    Http2SessionHandlers *handlers;
+    HpackDecoder decoder;
+    /* Reused for every header block */
+    Http2Request request;
+
+    std::map<uint32_t, Http2StreamData *> streams;
+    std::vector<Http2StreamData *> closedStreams;
+
+    /* A frame split across reads, what we are to write, a header block awaiting CONTINUATION */
+    std::string input, output, headerBlock;
+    uint32_t headerStream = 0;
+    unsigned char headerFlags = 0;
+
+    /* Highest stream the peer opened */
+    uint32_t lastStreamId = 0;
+
+    int64_t sendWindow = DEFAULT_WINDOW;
+    int64_t receiveWindow = CONNECTION_WINDOW;
+    int64_t peerInitialWindow = DEFAULT_WINDOW;
+    unsigned int peerMaxFrameSize = 16384;
+
+    /* Nesting of event handling, streams are freed at the outermost */
+    unsigned int depth = 0;
+    bool prefaceReceived = false, settingsReceived = false;
+    /* GOAWAY sent, on an error of the connection or to have the peer go (then taking no more streams) */
+    bool failed = false, goingAway = false;
+    bool transportBlocked = false;
+
+    /* Counted against MAX_RESETS since windowStart, and against MAX_QUEUED_CONTROL_FRAMES until drained */
+    unsigned int resets = 0, queuedControlFrames = 0;
+    std::chrono::steady_clock::time_point windowStart;
+
+    static uint32_t readUint32(const char *data) {
+        return ((uint32_t) (unsigned char) data[0] << 24) | ((uint32_t) (unsigned char) data[1] << 16)
+            | ((uint32_t) (unsigned char) data[2] << 8) | (uint32_t) (unsigned char) data[3];
+    }
+
+    static void appendUint32(std::string &out, uint32_t value) {
+        char bytes[4] = {(char) (value >> 24), (char) (value >> 16), (char) (value >> 8), (char) value};
+        out.append(bytes, 4);
+    }
+
+    void writeFrameHeader(size_t length, FrameType type, unsigned char flags, uint32_t streamId) {
+        char header[5] = {(char) (length >> 16), (char) (length >> 8), (char) length, (char) type, (char) flags};
+        output.append(header, 5);
+        appendUint32(output, streamId);
+    }
+
+    void writeFrame(FrameType type, unsigned char flags, uint32_t streamId, std::string_view payload) {
+        writeFrameHeader(payload.length(), type, flags, streamId);
+        output.append(payload.data(), payload.length());
+    }
+
+    void writeUint32Frame(FrameType type, uint32_t streamId, uint32_t value) {
+        writeFrameHeader(4, type, 0, streamId);
+        appendUint32(output, value);
+    }
+
+    /* A header block, in as many frames as the peer needs */
+    void writeHeaderBlock(uint32_t streamId, std::string_view block, bool endStream) {
+        FrameType type = HEADERS;
+        do {
+            std::string_view fragment = block.substr(0, peerMaxFrameSize);
+            block.remove_prefix(fragment.length());
+            writeFrame(type, (unsigned char) ((block.length() ? 0 : FLAG_END_HEADERS) | (endStream && type == HEADERS ? FLAG_END_STREAM : 0)), streamId, fragment);
+            type = CONTINUATION;
+        } while (block.length());
+    }
+
+    /* Returns false, having told the peer why we are done (5.4.1). Whatever is read after is ignored */
+    bool connectionError(ErrorCode code) {
+        if (!failed) {
+            failed = true;
+            writeFrameHeader(8, GOAWAY, 0, 0);
+            appendUint32(output, lastStreamId);
+            appendUint32(output, code);
+        }
+        return false;
+    }
+
+    /* Returns false past MAX_RESETS streams reset by the peer this window */
+    bool countReset() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - windowStart >= std::chrono::milliseconds((long long) RESET_WINDOW_MS)) {
+            windowStart = now;
+            resets = 0;
+        }
+        return ++resets <= MAX_RESETS || connectionError(ENHANCE_YOUR_CALM);
+    }
+
+    /* Returns false past MAX_QUEUED_CONTROL_FRAMES answered since the transport last took all of it */
+    bool countControlFrame() {
+        return !transportBlocked || ++queuedControlFrames <= MAX_QUEUED_CONTROL_FRAMES || connectionError(ENHANCE_YOUR_CALM);
+    }
+
+    void closeStream(Http2StreamData *stream, bool aborted) {
+        if (stream->state & Http2StreamData::HTTP_CLOSED) {
+            return;
+        }
+        stream->state |= Http2StreamData::HTTP_CLOSED;
+        streams.erase(stream->id);
+        closedStreams.push_back(stream);
+
+        stream->backpressure.clear();
+        stream->onData = nullptr;
+        stream->onWritable = nullptr;
+        ResponseHandler<void()> onAborted = std::move(stream->onAborted);
+        stream->onAborted = nullptr;
+        if (aborted && onAborted) {
+            onAborted();
+        }
+    }
+
+    /* Resets the stream for an error of it alone, or on cancel (5.4.2) */
+    void resetStream(Http2StreamData *stream, ErrorCode code) {
+        writeUint32Frame(RST_STREAM, stream->id, code);
+        closeStream(stream, true);
+    }
+
+    /* We sent END_STREAM. A request still sending is told to stop, its response made it pointless (8.1) */
+    void endStream(Http2StreamData *stream) {
+        stream->state |= Http2StreamData::HTTP_SHUT_DOWN;
+        if (!(stream->state & Http2StreamData::HTTP_REMOTE_CLOSED)) {
+            writeUint32Frame(RST_STREAM, stream->id, NO_ERROR_CODE);
+        }
+        closeStream(stream, false);
+    }
+
+    /* Sends the headers written so far, with content-length if known and not written by hand */
+    void sendHeaders(Http2StreamData *stream, bool endsStream, std::optional<uintmax_t> contentLength) {
+        if (stream->state & (Http2StreamData::HTTP_HEADERS_SENT | Http2StreamData::HTTP_CLOSED)) {
+            return;
+        }
+        stream->state |= Http2StreamData::HTTP_HEADERS_SENT;
+
+        std::string block;
+        block.reserve(stream->headers.length() + 16);
+        HpackEncoder::encodeStatus(block, std::string_view(stream->status, 3));
+        block.append(stream->headers);
+        if (contentLength && !(stream->state & Http2StreamData::HTTP_CONTENT_LENGTH_WRITTEN)) {
+            char buffer[20];
+            char *end = std::to_chars(buffer, buffer + sizeof(buffer), *contentLength).ptr;
+            HpackEncoder::encode(block, "content-length", std::string_view(buffer, (size_t) (end - buffer)));
+        }
+        writeHeaderBlock(stream->id, block, endsStream);
+        std::string().swap(stream->headers);
+
+        if (endsStream) {
+            endStream(stream);
+        }
+    }
+
+    /* Frames what the windows take of data, ending the stream (with its trailers) if fin and all of it went.
+     * Returns how much went, nothing while the transport is backed up */
+    size_t writeData(Http2StreamData *stream, std::string_view data, bool fin) {
+        if (transportBlocked || (stream->state & (Http2StreamData::HTTP_SHUT_DOWN | Http2StreamData::HTTP_CLOSED))) {
+            return 0;
+        }
+        size_t length = (size_t) std::max<int64_t>(0, std::min<int64_t>((int64_t) data.length(), std::min(stream->sendWindow, sendWindow)));
+        stream->sendWindow -= (int64_t) length;
+        sendWindow -= (int64_t) length;
+
+        bool ends = fin && length == data.length();
+        bool endsHere = ends && !stream->trailers.length();
+        for (size_t at = 0; at < length; ) {
+            size_t chunk = std::min<size_t>(length - at, peerMaxFrameSize);
+            writeFrame(DATA, endsHere && at + chunk == length ? FLAG_END_STREAM : 0, stream->id, data.substr(at, chunk));
+            at += chunk;
+        }
+        if (endsHere && !length) {
+            writeFrameHeader(0, DATA, FLAG_END_STREAM, stream->id);
+        }
+        if (ends) {
+            if (stream->trailers.length()) {
+                writeHeaderBlock(stream->id, stream->trailers, true);
+            }
+            endStream(stream);
+        }
+
+        if (output.length() >= FLUSH_SIZE) {
+            flush();
+        }
+        return length;
+    }
+
+    /* Sends what waited of a stream, then has it write more if it wants to */
+    void drainStream(Http2StreamData *stream) {
+        std::string_view segment;
+        while (stream->backpressure.segments(&segment, 1)) {
+            bool last = segment.length() == stream->backpressure.length() && (stream->state & Http2StreamData::HTTP_END_CALLED);
+            size_t written = writeData(stream, segment, last);
+            if (stream->state & Http2StreamData::HTTP_CLOSED) {
+                return;
+            }
+            stream->backpressure.erase(written);
+            if (written < segment.length()) {
+                return;
+            }
+        }
+
+        if (stream->state & Http2StreamData::HTTP_END_CALLED) {
+            /* Ended with nothing waiting, while the transport was backed up */
+            writeData(stream, {}, true);
+        } else if ((stream->state & Http2StreamData::HTTP_WRITE_BLOCKED) && stream->onWritable && stream->sendWindow > 0 && sendWindow > 0 && !transportBlocked) {
+            stream->state &= (unsigned char) ~Http2StreamData::HTTP_WRITE_BLOCKED;
+            stream->callOnWritable(stream->offset);
+        }
+    }
+
+    /* Every stream, in order, as long as there is room. Handlers may close any of them as we go */
+    void drainStreams() {
+        for (uint32_t id = 0; !transportBlocked && sendWindow > 0; ) {
+            auto it = streams.upper_bound(id);
+            if (it == streams.end()) {
+                break;
+            }
+            id = it->first;
+            drainStream(it->second);
+        }
+    }
+
+    /* Writes out what we have. Streams gone are only freed at the outermost call, no handler may still hold them */
+    void flush() {
+        if (output.length()) {
+            transportBlocked = !handlers->write(this, output);
+            output.clear();
+        }
+    }
+
+    void finish() {
+        if (depth) {
+            return;
+        }
+        flush();
+        for (Http2StreamData *stream : closedStreams) {
+            delete stream;
+        }
+        closedStreams.clear();
+    }
+
+    Http2StreamData *findStream(uint32_t streamId) {
+        auto it = streams.find(streamId);
+        return it == streams.end() ? nullptr : it->second;
+    }
+
+    /* Emits the end of the request body, once */
+    void endRequest(Http2StreamData *stream) {
+        stream->state |= Http2StreamData::HTTP_REMOTE_CLOSED;
+        if (stream->onData) {
+            ResponseHandler<void(std::string_view, bool)> onData = std::move(stream->onData);
+            stream->onData = nullptr;
+            onData({nullptr, 0}, true);
+        }
+    }
+
+    /* Emits the request parsed into request on a new stream */
+    void emitRequest(uint32_t streamId, bool endsStream) {
+        Http2StreamData *stream = new Http2StreamData(this, streamId, peerInitialWindow, STREAM_WINDOW);
+        streams[streamId] = stream;
+        if (endsStream) {
+            stream->state |= Http2StreamData::HTTP_REMOTE_CLOSED;
+        }
+
+        if (!handlers->request((Http2Response *) stream, &request)) {
+            /* We have to reset this stream since we have no handler for it */
+            resetStream(stream, CANCEL);
+            return;
+        }
+        if (stream->state & Http2StreamData::HTTP_CLOSED) {
+            return;
+        }
+
+        /* Same rule as for HTTP/1.1 */
+        if (!(stream->state & Http2StreamData::HTTP_END_CALLED) && !stream->onAborted) {
+            std::cerr << "Error: Returning from a request handler without responding or attaching an abort handler is forbidden!" << std::endl;
+            std::terminate();
+        }
+
+        /* A request without body still has its end emitted, as in HTTP/1.1 */
+        if (endsStream) {
+            endRequest(stream);
+        }
+    }
+
+    bool processHeaderBlock(uint32_t streamId, unsigned char flags, std::string_view block) {
+        request.reset();
+        if (!decoder.decode(block, [this](std::string_view key, std::string_view value) {
+            request.add(key, value);
+        })) {
+            return connectionError(COMPRESSION_ERROR);
+        }
+
+        /* Trailers, which end the request. We have no use for them */
+        if (Http2StreamData *stream = findStream(streamId)) {
+            if (stream->state & Http2StreamData::HTTP_REMOTE_CLOSED) {
+                resetStream(stream, STREAM_CLOSED);
+                return true;
+            }
+            if (!(flags & FLAG_END_STREAM)) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            endRequest(stream);
+            return true;
+        }
+
+        /* Peers open streams of odd ids, ever higher (5.1.1) */
+        if (!(streamId & 1) || streamId <= lastStreamId) {
+            return connectionError(PROTOCOL_ERROR);
+        }
+        lastStreamId = streamId;
+
+        if (streams.size() >= MAX_STREAMS || goingAway) {
+            if (!countControlFrame()) {
+                return false;
+            }
+            writeUint32Frame(RST_STREAM, streamId, REFUSED_STREAM);
+            return true;
+        }
+        if (!request.finish()) {
+            if (!countControlFrame()) {
+                return false;
+            }
+            writeUint32Frame(RST_STREAM, streamId, PROTOCOL_ERROR);
+            return true;
+        }
+        emitRequest(streamId, flags & FLAG_END_STREAM);
+        return true;
+    }
+
+    /* Replenishes the window of the connection once half of it was used */
+    void received(size_t length) {
+        receiveWindow -= (int64_t) length;
+        if (receiveWindow <= CONNECTION_WINDOW / 2) {
+            writeUint32Frame(WINDOW_UPDATE, 0, (uint32_t) (CONNECTION_WINDOW - receiveWindow));
+            receiveWindow = CONNECTION_WINDOW;
+        }
+    }
+
+    /* Strips padding (6.1), returns false if there is not room for it */
+    static bool unpad(std::string_view &payload, unsigned char flags) {
+        if (!(flags & FLAG_PADDED)) {
+            return true;
+        }
+        if (!payload.length() || (unsigned char) payload[0] >= payload.length()) {
+            return false;
+        }
+        size_t padding = (unsigned char) payload[0];
+        payload = payload.substr(1, payload.length() - 1 - padding);
+        return true;
+    }
+
+    bool processSettings(unsigned char flags, std::string_view payload, bool acknowledge = true) {
+        if (flags & FLAG_ACK) {
+            return payload.length() ? connectionError(FRAME_SIZE_ERROR) : true;
+        }
+        if (payload.length() % 6) {
+            return connectionError(FRAME_SIZE_ERROR);
+        }
+        int64_t delta = 0;
+        for (; payload.length(); payload.remove_prefix(6)) {
+            uint16_t setting = (uint16_t) (((unsigned char) payload[0] << 8) | (unsigned char) payload[1]);
+            uint32_t value = readUint32(payload.data() + 2);
+            switch (setting) {
+            case ENABLE_PUSH:
+                if (value > 1) {
+                    return connectionError(PROTOCOL_ERROR);
+                }
+                break;
+            case INITIAL_WINDOW_SIZE:
+                if (value > MAX_WINDOW) {
+                    return connectionError(FLOW_CONTROL_ERROR);
+                }
+                delta += (int64_t) value - peerInitialWindow;
+                peerInitialWindow = value;
+                break;
+            case MAX_FRAME_SIZE:
+                if (value < 16384 || value > 16777215) {
+                    return connectionError(PROTOCOL_ERROR);
+                }
+                peerMaxFrameSize = value;
+                break;
+            default:
+                /* The encoder keeps no table, we push nothing and take any header list */
+                break;
+            }
+        }
+
+        /* Applies to every stream open, as a change in its window (6.9.2) */
+        if (delta) {
+            for (auto &[id, stream] : streams) {
+                stream->sendWindow += delta;
+                if (stream->sendWindow > MAX_WINDOW) {
+                    return connectionError(FLOW_CONTROL_ERROR);
+                }
+            }
+        }
+        if (acknowledge) {
+            if (!countControlFrame()) {
+                return false;
+            }
+            writeFrameHeader(0, SETTINGS, FLAG_ACK, 0);
+            settingsReceived = true;
+        }
+        if (delta > 0) {
+            drainStreams();
+        }
+        return true;
+    }
+
+    bool processFrame(FrameType type, unsigned char flags, uint32_t streamId, std::string_view payload) {
+        /* A header block is continued by nothing else (6.10), and the peer settles first (3.4) */
+        if ((headerStream && (type != CONTINUATION || streamId != headerStream)) || (!settingsReceived && type != SETTINGS)) {
+            return connectionError(PROTOCOL_ERROR);
+        }
+
+        switch (type) {
+        case DATA: {
+            if (!streamId) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            size_t length = payload.length();
+            if (receiveWindow < (int64_t) length) {
+                return connectionError(FLOW_CONTROL_ERROR);
+            }
+            if (!unpad(payload, flags)) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            Http2StreamData *stream = findStream(streamId);
+            if (!stream) {
+                if (streamId > lastStreamId) {
+                    return connectionError(PROTOCOL_ERROR);
+                }
+                /* In flight as we closed it */
+                received(length);
+                return true;
+            }
+            if ((stream->state & Http2StreamData::HTTP_REMOTE_CLOSED) || stream->receiveWindow < (int64_t) length) {
+                resetStream(stream, (stream->state & Http2StreamData::HTTP_REMOTE_CLOSED) ? STREAM_CLOSED : FLOW_CONTROL_ERROR);
+                received(length);
+                return true;
+            }
+            stream->receiveWindow -= (int64_t) length;
+
+            bool fin = flags & FLAG_END_STREAM;
+            if (fin) {
+                stream->state |= Http2StreamData::HTTP_REMOTE_CLOSED;
+            }
+            if (stream->onData) {
+                if (fin) {
+                    ResponseHandler<void(std::string_view, bool)> onData = std::move(stream->onData);
+                    stream->onData = nullptr;
+                    onData(payload, true);
+                } else {
+                    stream->onData(payload, false);
+                }
+            }
+            if (!(stream->state & (Http2StreamData::HTTP_CLOSED | Http2StreamData::HTTP_REMOTE_CLOSED)) && stream->receiveWindow <= STREAM_WINDOW / 2) {
+                writeUint32Frame(WINDOW_UPDATE, streamId, (uint32_t) (STREAM_WINDOW - stream->receiveWindow));
+                stream->receiveWindow = STREAM_WINDOW;
+            }
+            received(length);
+            return true;
+        }
+        case HEADERS: {
+            if (!streamId || !unpad(payload, flags)) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            /* Priorities are deprecated (5.3.2), we serve in order */
+            if (flags & FLAG_PRIORITY) {
+                if (payload.length() < 5) {
+                    return connectionError(FRAME_SIZE_ERROR);
+                }
+                payload.remove_prefix(5);
+            }
+            if (!(flags & FLAG_END_HEADERS)) {
+                headerBlock.assign(payload.data(), payload.length());
+                headerStream = streamId;
+                headerFlags = flags;
+                return true;
+            }
+            return processHeaderBlock(streamId, flags, payload);
+        }
+        case CONTINUATION: {
+            if (!headerStream) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            if (headerBlock.length() + payload.length() > MAX_HEADER_BLOCK) {
+                return connectionError(ENHANCE_YOUR_CALM);
+            }
+            headerBlock.append(payload.data(), payload.length());
+            if (!(flags & FLAG_END_HEADERS)) {
+                return true;
+            }
+            headerStream = 0;
+            bool ok = processHeaderBlock(streamId, headerFlags, headerBlock);
+            std::string().swap(headerBlock);
+            return ok;
+        }
+        case PRIORITY:
+            if (!streamId) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            return payload.length() == 5 ? true : connectionError(FRAME_SIZE_ERROR);
+        case RST_STREAM: {
+            if (!streamId || streamId > lastStreamId) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            if (payload.length() != 4) {
+                return connectionError(FRAME_SIZE_ERROR);
+            }
+            if (!countReset()) {
+                return false;
+            }
+            if (Http2StreamData *stream = findStream(streamId)) {
+                closeStream(stream, true);
+            }
+            return true;
+        }
+        case SETTINGS:
+            if (streamId) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            return processSettings(flags, payload);
+        case PING:
+            if (streamId) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            if (payload.length() != 8) {
+                return connectionError(FRAME_SIZE_ERROR);
+            }
+            if (!(flags & FLAG_ACK)) {
+                if (!countControlFrame()) {
+                    return false;
+                }
+                writeFrame(PING, FLAG_ACK, 0, payload);
+            }
+            return true;
+        case GOAWAY:
+            /* Streams it did not get to are not ours to retry, the peer closes once done with the rest */
+            if (streamId) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            return payload.length() >= 8 ? true : connectionError(FRAME_SIZE_ERROR);
+        case WINDOW_UPDATE: {
+            if (payload.length() != 4) {
+                return connectionError(FRAME_SIZE_ERROR);
+            }
+            uint32_t increment = readUint32(payload.data()) & 0x7fffffff;
+            if (!streamId) {
+                if (!increment) {
+                    return connectionError(PROTOCOL_ERROR);
+                }
+                sendWindow += increment;
+                if (sendWindow > MAX_WINDOW) {
+                    return connectionError(FLOW_CONTROL_ERROR);
+                }
+                drainStreams();
+                return true;
+            }
+            Http2StreamData *stream = findStream(streamId);
+            if (!stream) {
+                return streamId > lastStreamId ? connectionError(PROTOCOL_ERROR) : true;
+            }
+            stream->sendWindow += increment;
+            if (!increment || stream->sendWindow > MAX_WINDOW) {
+                resetStream(stream, increment ? FLOW_CONTROL_ERROR : PROTOCOL_ERROR);
+                return true;
+            }
+            if (sendWindow > 0) {
+                drainStream(stream);
+            }
+            return true;
+        }
+        case PUSH_PROMISE:
+            /* Only servers push */
+            return connectionError(PROTOCOL_ERROR);
+        default:
+            /* Unknown frames are ignored (4.1) */
+            return true;
+        }
+    }
+
+    bool parse(std::string_view data) {
+        if (input.length()) {
+            input.append(data.data(), data.length());
+            data = input;
+        }
+
+        size_t consumed = 0;
+        if (!prefaceReceived) {
+            size_t length = std::min(data.length(), PREFACE.length());
+            if (data.substr(0, length) != PREFACE.substr(0, length)) {
+                return connectionError(PROTOCOL_ERROR);
+            }
+            /* Or kept for once it is all here */
+            if (length == PREFACE.length()) {
+                prefaceReceived = true;
+                consumed = length;
+            }
+        }
+
+        while (prefaceReceived && data.length() - consumed >= 9) {
+            const char *header = data.data() + consumed;
+            size_t length = ((size_t) (unsigned char) header[0] << 16) | ((size_t) (unsigned char) header[1] << 8) | (unsigned char) header[2];
+            if (length > MAX_FRAME) {
+                return connectionError(FRAME_SIZE_ERROR);
+            }
+            if (data.length() - consumed < 9 + length) {
+                break;
+            }
+            if (!processFrame((FrameType) header[3], (unsigned char) header[4], readUint32(header + 5) & 0x7fffffff, data.substr(consumed + 9, length))) {
+                return false;
+            }
+            consumed += 9 + length;
+        }
+
+        /* What is left waits for the rest of it */
+        if (data.data() == input.data()) {
+            input.erase(0, consumed);
+        } else {
+            input.assign(data.data() + consumed, data.length() - consumed);
+        }
+        return true;
+    }
+
+public:
+    /* Our preface, SETTINGS and the window of the connection, is out with the first flush */
+    Http2Session(Http2SessionHandlers *handlers) : handlers(handlers) {
+        writeFrameHeader(18, SETTINGS, 0, 0);
+        for (auto [setting, value] : {std::pair<uint16_t, uint32_t>{MAX_CONCURRENT_STREAMS, MAX_STREAMS}, {INITIAL_WINDOW_SIZE, STREAM_WINDOW}, {ENABLE_PUSH, 0}}) {
+            output += (char) (setting >> 8);
+            output += (char) setting;
+            appendUint32(output, value);
+        }
+        writeUint32Frame(WINDOW_UPDATE, 0, (uint32_t) (CONNECTION_WINDOW - DEFAULT_WINDOW));
+    }
+
+    Http2Session(const Http2Session &) = delete;
+
+    ~Http2Session() {
+        for (auto &[id, stream] : streams) {
+            delete stream;
+        }
+        for (Http2StreamData *stream : closedStreams) {
+            delete stream;
+        }
+    }
+
+    /* Whoever writes output for us, such as the socket */
+    void *user = nullptr;
+
+    /* Takes what was read. Returns false once the connection is done, with GOAWAY written, and should be closed */
+    bool consume(std::string_view data) {
+        if (failed) {
+            return false;
+        }
+        depth++;
+        bool ok = parse(data);
+        depth--;
+        finish();
+        return ok;
+    }
+
+    /* An HTTP/1.1 request upgraded to h2c (3.2 of RFC 7540), which is stream 1 and has no body (we do not upgrade
+     * those). Settings are the payload of HTTP2-Settings, decoded, which the 101 acknowledged. The peer still
+     * sends its preface after. Returns false if they are not valid */
+    template <typename R>
+    bool upgrade(R *req, std::string_view settings) {
+        depth++;
+        bool ok = processSettings(0, settings, false);
+        if (ok) {
+            request.reset();
+            request.add(":method", req->getCaseSensitiveMethod());
+            request.add(":scheme", "http");
+            request.add(":path", req->getFullUrl());
+            request.add(":authority", req->getHeader("host"));
+            for (auto [key, value] : *req) {
+                if (key != "host" && key != "connection" && key != "upgrade" && key != "http2-settings" && key != "keep-alive"
+                    && key != "proxy-connection" && key != "transfer-encoding" && key != "te") {
+                    request.add(key, value);
+                }
+            }
+            lastStreamId = 1;
+            if (request.finish()) {
+                emitRequest(1, true);
+            } else {
+                writeUint32Frame(RST_STREAM, 1, PROTOCOL_ERROR);
+            }
+        }
+        depth--;
+        finish();
+        return ok;
+    }
+
+    /* The transport took all it had buffered, so we write what waited and let streams write more */
+    void drain() {
+        transportBlocked = false;
+        queuedControlFrames = 0;
+        depth++;
+        drainStreams();
+        depth--;
+        finish();
+    }
+
+    /* The transport is gone, every stream still open is aborted */
+    void abort() {
+        depth++;
+        while (streams.size()) {
+            closeStream(streams.begin()->second, true);
+        }
+        depth--;
+        output.clear();
+        for (Http2StreamData *stream : closedStreams) {
+            delete stream;
+        }
+        closedStreams.clear();
+    }
+
+    /* Stops taking streams, those open still finish (6.8). The peer closes once it has their responses */
+    void goAway() {
+        if (!failed && !goingAway) {
+            goingAway = true;
+            writeFrameHeader(8, GOAWAY, 0, 0);
+            appendUint32(output, lastStreamId);
+            appendUint32(output, NO_ERROR_CODE);
+            finish();
+        }
+    }
+
+    size_t getNumStreams() {
+        return streams.size();
+    }
+
+    /* Output not yet written, if any */
+    std::string_view getOutput() {
+        return output;
+    }
+};
+
+}
+
+#endif // UWS_HTTP2SESSION_H
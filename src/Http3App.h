@@ -1,3 +1,6 @@
+#ifndef UWS_H3APP_H
+#define UWS_H3APP_H
+
 #include "App.h"
 
 #include "Http3Response.h"
@@ -13,9 +16,9 @@ namespace uWS {
             /* This conversion should not be needed */
             us_quic_socket_context_options_t h3options = {};
 
-            h3options.key_file_name = strdup(options.key_file_name);
-            h3options.cert_file_name = strdup(options.cert_file_name);
-            h3options.passphrase = strdup(options.passphrase);
+            h3options.key_file_name = options.key_file_name ? strdup(options.key_file_name) : nullptr;
+            h3options.cert_file_name = options.cert_file_name ? strdup(options.cert_file_name) : nullptr;
+            h3options.passphrase = options.passphrase ? strdup(options.passphrase) : nullptr;
 
             /* Create the http3 context */
             http3Context = Http3Context::create((us_loop_t *)Loop::get(), h3options);
@@ -137,4 +140,6 @@ namespace uWS {
             uWS::Loop::get()->run();
         }
     };
-}
\ No newline at end of file
+}
+
+#endif
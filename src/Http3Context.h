@@ -1,3 +1,5 @@
+#ifndef UWS_H3CONTEXT_H
+#define UWS_H3CONTEXT_H
 
 extern "C" {
 #include "quic.h"
@@ -5,6 +7,11 @@ extern "C" {
 
 #include "Http3ContextData.h"
 #include "Http3ResponseData.h"
+#include "Http3Response.h"
+#include "Http3Request.h"
+
+#include <string>
+#include <vector>
 
 namespace uWS {
     struct Http3Context {
@@ -17,7 +24,7 @@ namespace uWS {
             us_quic_socket_context_on_stream_data(context, [](us_quic_stream_t *s, char *data, int length) {
 
                 Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext(s);
-                
+
                 /* We never emit FIN here */
                 if (responseData->onData) {
                     responseData->onData({data, (size_t) length}, false);
@@ -26,132 +33,97 @@ namespace uWS {
             us_quic_socket_context_on_stream_end(context, [](us_quic_stream_t *s) {
 
                 Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext(s);
-                
-                /* Emit FIN to app */
+
+                /* Emit FIN to app, once (the request is whole, so no more of it) */
                 if (responseData->onData) {
-                    responseData->onData({nullptr, 0}, true);
+                    ResponseHandler<void(std::string_view, bool)> onData = std::move(responseData->onData);
+                    responseData->onData = nullptr;
+                    onData({nullptr, 0}, true);
                 }
-
-                /* Have we written our entire backpressure, if any? */
-                // if (responseData->buffer.length() && (responseData->bufferOffset == (int) responseData->buffer.length())) {
-                //     printf("We got FIN and we have no backpressure, closing stream now!\n");
-                //     //us_quic_stream_close(s);
-                // } else {
-                //     //printf("We got FIN but we have data to write, so keeping connection half-closed!\n");
-                // }
-
             });
-            us_quic_socket_context_on_stream_open(context, [](us_quic_stream_t *s, int is_client) {
-
-                printf("Stream open!\n");
-
+            us_quic_socket_context_on_stream_open(context, [](us_quic_stream_t *s, int /*is_client*/) {
                 /* Inplace init our per stream data */
                 new (us_quic_stream_ext(s)) Http3ResponseData();
             });
-            us_quic_socket_context_on_close(context, [](us_quic_socket_t *s) {
-                printf("QUIC socket disconnected!\n");
+            us_quic_socket_context_on_close(context, [](us_quic_socket_t */*s*/) {
+                /* Every stream of it is closed on its own */
             });
             us_quic_socket_context_on_stream_writable(context, [](us_quic_stream_t *s) {
-                Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext(s);
-
-                /* Either we handle the streaming or we let the application handle it */
-                if (responseData->onWritable) {
-                    responseData->onWritable(responseData->offset);
-                } else {
-                    int written = us_quic_stream_write(s, (char *) responseData->backpressure.data(), responseData->backpressure.length());
-                    responseData->backpressure.erase(written);
-
-                    if (responseData->backpressure.length() == 0) {
-                        printf("wrote until end, shutting down now!\n");
-                        us_quic_stream_shutdown(s);
-                        us_quic_stream_close(s);
-                    }
-                }
+                ((Http3Response *) s)->drain();
             });
             us_quic_socket_context_on_stream_headers(context, [](us_quic_stream_t *s) {
 
                 /* This is the main place of start for requests */
                 Http3ContextData *contextData = (Http3ContextData *) us_quic_socket_context_ext(us_quic_socket_context(us_quic_stream_socket(s)));
 
-                Http3Request *req = nullptr;
-
-                std::string_view upperCasedMethod = req->getHeader(":method");
-                std::string_view path = req->getHeader(":path");
-                
-                contextData->router.getUserData() = {(Http3Response *) s, (Http3Request *) nullptr};
-                contextData->router.route(upperCasedMethod, path);
+                /* Viewing the headers QPACK decoded, valid only for as long as we are in here */
+                Http3Request req;
+                if (!req.parse()) {
+                    us_quic_stream_close(s);
+                    return;
+                }
 
+                contextData->router.getUserData() = {(Http3Response *) s, &req};
+                if (!contextData->router.route(req.getCaseSensitiveMethod(), req.getUrl())) {
+                    /* We have to reset this stream since we have no handler for it */
+                    us_quic_stream_close(s);
+                }
             });
-            us_quic_socket_context_on_open(context, [](us_quic_socket_t *s, int is_client) {
-                printf("QUIC socket connected!\n");
+            us_quic_socket_context_on_open(context, [](us_quic_socket_t */*s*/, int /*is_client*/) {
+                /* Nothing until a stream opens */
             });
             us_quic_socket_context_on_stream_close(context, [](us_quic_stream_t *s) {
 
-                printf("Stream closed!\n");
-
-                //lsquic_stream_has_unacked_data
-
                 Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext(s);
-                
+
+                /* Signal broken HTTP request only if we have a pending request */
                 if (responseData->onAborted) {
                     responseData->onAborted();
                 }
 
-                //printf("Freeing per stream data in on_stream_close in uws!\n");
-
                 responseData->~Http3ResponseData();
             });
 
             return (Http3Context *) context;
-
-            // call init here after setting the ext to Http3ContextData
         }
 
         us_quic_listen_socket_t *listen(const char *host, int port) {
-            /* The listening socket is the actual UDP socket used */
-            us_quic_listen_socket_t *listen_socket = us_quic_socket_context_listen((us_quic_socket_context_t *) this, host, port, sizeof(Http3ResponseData));
+            /* Routes are added by now, routing from here on is flat */
+            ((Http3ContextData *) us_quic_socket_context_ext((us_quic_socket_context_t *) this))->router.freeze();
 
-            //printf("Listen socket is: %p\n", listen_socket);
-
-            return listen_socket;
+            /* The listening socket is the actual UDP socket used */
+            return us_quic_socket_context_listen((us_quic_socket_context_t *) this, host, port, sizeof(Http3ResponseData));
         }
 
         void init() {
-            // set all callbacks here
-
-
-
             Http3ContextData *contextData = (Http3ContextData *) us_quic_socket_context_ext((us_quic_socket_context_t *) this);
 
-            //printf("init: %p\n", contextData);
-
             new (contextData) Http3ContextData();
-
         }
 
-        // generic for get, post, any, etc
-        void onHttp(std::string method, std::string path, MoveOnlyFunction<void(Http3Response *, Http3Request *)> &&cb) {
-            // modifies the router we own as part of Http3ContextData, used in callbacks set in init
-        
+        /* Generic for get, post, any, etc. Same as HttpContext::onHttp */
+        void onHttp(std::string method, std::string pattern, MoveOnlyFunction<void(Http3Response *, Http3Request *)> &&handler) {
             Http3ContextData *contextData = (Http3ContextData *) us_quic_socket_context_ext((us_quic_socket_context_t *) this);
 
-            /* Todo: This is ugly, fix */
-            std::vector<std::string> methods;
-            if (method == "*") {
-                methods = {"*"}; //bug! needs to be upper cased!
-                // router.upperCasedMethods;
-            } else {
-                methods = {method};
-            }
+            std::vector<std::string> methods = {method};
+            uint32_t priority = method == "*" ? contextData->router.LOW_PRIORITY : contextData->router.MEDIUM_PRIORITY;
 
-            contextData->router.add(methods, path, [handler = std::move(cb)](HttpRouter<Http3ContextData::RouterData> *router) mutable {
+            /* Record this route's parameter offsets */
+            RouteParameters parameterOffsets(pattern);
 
+            contextData->router.add(methods, pattern, [handler = std::move(handler), parameterOffsets = std::move(parameterOffsets)](HttpRouter<Http3ContextData::RouterData> *router) mutable {
                 Http3ContextData::RouterData &routerData = router->getUserData();
+                routerData.req->setYield(false);
+                routerData.req->setParameters(router->getParameters());
+                routerData.req->setParameterOffsets(&parameterOffsets);
 
                 handler(routerData.res, routerData.req);
 
-                return true;
-            });
+                /* If any handler yielded, the router will keep looking for a suitable handler */
+                return !routerData.req->getYield();
+            }, priority);
         }
     };
-}
\ No newline at end of file
+}
+
+#endif
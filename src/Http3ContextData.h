@@ -1,9 +1,11 @@
-#include "HttpRouter.h"
+#ifndef UWS_H3CONTEXTDATA_H
+#define UWS_H3CONTEXTDATA_H
 
-struct Http3Response;
-struct Http3Request;
+#include "HttpRouter.h"
 
 namespace uWS {
+    struct Http3Response;
+    struct Http3Request;
 
     struct Http3ContextData {
         struct RouterData {
@@ -12,10 +14,8 @@ namespace uWS {
         };
 
         HttpRouter<RouterData> router;
-
-        Http3ContextData() {
-            //printf("Constructing http3contextdata: %p\n", this);
-        }
     };
-    
-}
\ No newline at end of file
+
+}
+
+#endif
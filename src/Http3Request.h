@@ -1,22 +1,214 @@
+#ifndef UWS_H3REQUEST_H
+#define UWS_H3REQUEST_H
+
 extern "C" {
 #include "quic.h"
 }
 
+/* For HeaderIndex, QueryIndex and UWS_HTTP_MAX_HEADERS_COUNT, the same as HTTP/1.1 */
+#include "HttpParser.h"
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
 namespace uWS {
 
+    /* The headers of a stream as decoded by QPACK, viewed where the decoder left them. Like HttpRequest,
+     * only valid within the handler it is given to */
     struct Http3Request {
+        friend struct Http3Context;
+
+    private:
+        struct Header {
+            std::string_view key, value;
+        } headers[UWS_HTTP_MAX_HEADERS_COUNT];
+        unsigned int numHeaders = 0;
+        /* Pseudo headers, :path split at its query */
+        std::string_view method, path, authority, scheme;
+        unsigned int querySeparator = 0;
+        bool didYield = false;
+        /* Index into headers plus one for every well-known header, 0 if not present */
+        unsigned char knownHeaders[HeaderIndex::NUM_HEADERS];
+        QueryIndex queryIndex;
+        std::pair<int, std::string_view *> currentParameters;
+        RouteParameters *currentParameterOffsets = nullptr;
 
-        std::string_view getHeader(std::string_view key) {
-            for (int i = 0, more = 1; more; i++) {
-                char *name, *value;
-                int name_length, value_length;
-                if ((more = us_quic_socket_context_get_header(nullptr, i, &name, &name_length, &value, &value_length))) {
-                    if (name_length == (int) key.length() && !memcmp(name, key.data(), key.length())) {
-                        return {value, (size_t) value_length};
+        /* Takes the headers decoded for the stream being emitted, returns false if malformed (RFC 9114 4.3.1)
+         * or more than we keep */
+        bool parse() {
+            memset(knownHeaders, 0, sizeof(knownHeaders));
+
+            char *name, *value;
+            int nameLength, valueLength;
+            for (int i = 0; us_quic_socket_context_get_header(nullptr, i, &name, &nameLength, &value, &valueLength); i++) {
+                std::string_view key(name, (size_t) nameLength), val(value, (size_t) valueLength);
+
+                if (key.length() && key[0] == ':') {
+                    /* Pseudo headers all come first */
+                    if (numHeaders) {
+                        return false;
                     }
+                    if (key == ":method") {
+                        method = val;
+                    } else if (key == ":path") {
+                        path = val;
+                    } else if (key == ":authority") {
+                        authority = val;
+                    } else if (key == ":scheme") {
+                        scheme = val;
+                    } else {
+                        return false;
+                    }
+                    continue;
+                }
+
+                if (numHeaders == UWS_HTTP_MAX_HEADERS_COUNT) {
+                    return false;
+                }
+                unsigned int slot = HeaderIndex::classify(key);
+                if (slot != HeaderIndex::NUM_HEADERS && !knownHeaders[slot]) {
+                    knownHeaders[slot] = (unsigned char) (numHeaders + 1);
+                }
+                headers[numHeaders++] = {key, val};
+            }
+
+            if (!method.length() || (!path.length() && method != "CONNECT")) {
+                return false;
+            }
+            size_t separator = path.find('?');
+            querySeparator = (unsigned int) (separator == std::string_view::npos ? path.length() : separator);
+            return true;
+        }
+
+    public:
+        bool getYield() {
+            return didYield;
+        }
+
+        /* If you do not want to handle this route */
+        void setYield(bool yield) {
+            didYield = yield;
+        }
+
+        /* Iteration over headers (key, value), pseudo headers left out */
+        struct HeaderIterator {
+            Header *ptr;
+
+            bool operator!=(const HeaderIterator &other) const {
+                return ptr != other.ptr;
+            }
+
+            HeaderIterator &operator++() {
+                ptr++;
+                return *this;
+            }
+
+            std::pair<std::string_view, std::string_view> operator*() const {
+                return {ptr->key, ptr->value};
+            }
+        };
+
+        HeaderIterator begin() {
+            return {headers};
+        }
+
+        HeaderIterator end() {
+            return {headers + numHeaders};
+        }
+
+        /* O(1) lookup of well-known headers. Host is also :authority, the way HTTP/3 sends it */
+        std::string_view getHeader(HeaderIndex::Header header) {
+            if (knownHeaders[header]) {
+                return headers[knownHeaders[header] - 1].value;
+            }
+            if (header == HeaderIndex::HOST) {
+                return authority;
+            }
+            return std::string_view(nullptr, 0);
+        }
+
+        /* Field names are always lower case in HTTP/3 */
+        std::string_view getHeader(std::string_view lowerCasedHeader) {
+            unsigned int slot = HeaderIndex::classify(lowerCasedHeader);
+            if (slot != HeaderIndex::NUM_HEADERS) {
+                return getHeader((HeaderIndex::Header) slot);
+            }
+            if (lowerCasedHeader.length() && lowerCasedHeader[0] == ':') {
+                if (lowerCasedHeader == ":method") {
+                    return method;
+                } else if (lowerCasedHeader == ":path") {
+                    return path;
+                } else if (lowerCasedHeader == ":authority") {
+                    return authority;
+                } else if (lowerCasedHeader == ":scheme") {
+                    return scheme;
                 }
             }
-            return {nullptr, 0};
+            for (unsigned int i = 0; i < numHeaders; i++) {
+                if (headers[i].key == lowerCasedHeader) {
+                    return headers[i].value;
+                }
+            }
+            return std::string_view(nullptr, 0);
+        }
+
+        std::string_view getUrl() {
+            return path.substr(0, querySeparator);
+        }
+
+        std::string_view getFullUrl() {
+            return path;
+        }
+
+        /* Upper cased, as sent */
+        std::string_view getMethod() {
+            return method;
+        }
+
+        std::string_view getCaseSensitiveMethod() {
+            return method;
+        }
+
+        /* Returns the raw querystring as a whole, still encoded */
+        std::string_view getQuery() {
+            if (querySeparator < path.length()) {
+                return path.substr(querySeparator + 1);
+            }
+            return std::string_view(nullptr, 0);
+        }
+
+        /* Finds and decodes the URI component. The query is indexed once per request */
+        std::string_view getQuery(std::string_view key) {
+            return queryIndex.get(key, path.substr(querySeparator));
+        }
+
+        void setParameters(std::pair<int, std::string_view *> parameters) {
+            currentParameters = parameters;
+        }
+
+        void setParameterOffsets(RouteParameters *offsets) {
+            currentParameterOffsets = offsets;
+        }
+
+        std::string_view getParameter(std::string_view name) {
+            if (!currentParameterOffsets) {
+                return {nullptr, 0};
+            }
+            int index = currentParameterOffsets->find(name);
+            if (index == -1) {
+                return {nullptr, 0};
+            }
+            return getParameter((unsigned short) index);
+        }
+
+        std::string_view getParameter(unsigned short index) {
+            if (currentParameters.first < (int) index) {
+                return {};
+            }
+            return currentParameters.second[index];
         }
     };
-}
\ No newline at end of file
+}
+
+#endif
@@ -1,120 +1,254 @@
+#ifndef UWS_H3RESPONSE_H
+#define UWS_H3RESPONSE_H
+
 extern "C" {
 #include "quic.h"
 }
 
 #include "Http3ResponseData.h"
 
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <utility>
+
 namespace uWS {
 
-    /* Is a quic stream */
+    /* Is a quic stream. Writes follow the contract of HttpResponse: write and end buffer what the stream does
+     * not take, tryEnd takes what it can and leaves the rest to be retried from onWritable at getWriteOffset */
     struct Http3Response {
+        friend struct Http3Context;
 
-        // this one is AsyncSocket, so it has to translate to the stream - abrupt stream termination
-        void close() {
-            //us_quic_stream_close((us_quic_stream_t *) this);
+    private:
+        Http3ResponseData *getResponseData() {
+            return (Http3ResponseData *) us_quic_stream_ext((us_quic_stream_t *) this);
         }
 
-        void endWithoutBody(std::optional<size_t> reportedContentLength = std::nullopt, bool closeConnection = false) {
+        /* Sends the headers written so far, with content-length if known and not written by hand. Without a
+         * body the stream ends with them */
+        void sendHeaders(bool hasBody, std::optional<uintmax_t> contentLength) {
+            Http3ResponseData *responseData = getResponseData();
+            if (responseData->state & Http3ResponseData::HTTP_HEADERS_SENT) {
+                return;
+            }
+            responseData->state |= Http3ResponseData::HTTP_HEADERS_SENT;
+
+            us_quic_socket_context_set_header(nullptr, 0, ":status", 7, responseData->status, 3);
+            int index = 1;
+            const char *header = responseData->headers.data(), *end = header + responseData->headers.length();
+            while (header < end) {
+                uint16_t keyLength, valueLength;
+                memcpy(&keyLength, header, 2);
+                memcpy(&valueLength, header + 2, 2);
+                us_quic_socket_context_set_header(nullptr, index++, header + 4, keyLength, header + 4 + keyLength, valueLength);
+                header += 4 + keyLength + valueLength;
+            }
+
+            char contentLengthString[20];
+            if (contentLength && !(responseData->state & Http3ResponseData::HTTP_CONTENT_LENGTH_WRITTEN)) {
+                char *contentLengthEnd = std::to_chars(contentLengthString, contentLengthString + sizeof(contentLengthString), *contentLength).ptr;
+                us_quic_socket_context_set_header(nullptr, index++, "content-length", 14, contentLengthString, (int) (contentLengthEnd - contentLengthString));
+            }
 
+            us_quic_socket_context_send_headers(nullptr, (us_quic_stream_t *) this, index, hasBody);
+            if (!hasBody) {
+                responseData->state |= Http3ResponseData::HTTP_SHUT_DOWN;
+            }
+            std::string().swap(responseData->headers);
         }
 
-        Http3Response *writeStatus(std::string_view status) {
-            Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext((us_quic_stream_t *) this);
+        /* Returns how much the stream took */
+        size_t writeToStream(std::string_view data) {
+            if (!data.length()) {
+                return 0;
+            }
+            int written = us_quic_stream_write((us_quic_stream_t *) this, (char *) data.data(), (int) data.length());
+            return written > 0 ? (size_t) written : 0;
+        }
 
-            /* Nothing is done if status already written */
-            if (responseData->headerOffset == 0) {
-                us_quic_socket_context_set_header(nullptr, 0, (char *) ":status", 7, status.data(), status.length());
-                responseData->headerOffset = 1;
+        /* Writes or buffers all of data */
+        bool writeOrBuffer(std::string_view data) {
+            Http3ResponseData *responseData = getResponseData();
+            responseData->offset += data.length();
+            if (!responseData->backpressure.length()) {
+                data.remove_prefix(writeToStream(data));
+            }
+            if (data.length()) {
+                responseData->backpressure.append(data.data(), data.length());
+                return false;
             }
+            return true;
+        }
 
-            return this;
+        /* Every request has its own stream, so we conceptually serve requests like in HTTP 1.0 */
+        void shutdownIfDrained() {
+            Http3ResponseData *responseData = getResponseData();
+            if ((responseData->state & (Http3ResponseData::HTTP_END_CALLED | Http3ResponseData::HTTP_SHUT_DOWN)) == Http3ResponseData::HTTP_END_CALLED && !responseData->backpressure.length()) {
+                responseData->state |= Http3ResponseData::HTTP_SHUT_DOWN;
+                us_quic_stream_shutdown((us_quic_stream_t *) this);
+            }
         }
 
-        Http3Response *writeHeader(std::string_view key, std::string_view value) {
-            Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext((us_quic_stream_t *) this);
+        /* The stream takes more: backpressure first, then whoever waits in onWritable */
+        void drain() {
+            Http3ResponseData *responseData = getResponseData();
+            std::string_view segment;
+            while (responseData->backpressure.segments(&segment, 1)) {
+                size_t written = writeToStream(segment);
+                responseData->backpressure.erase(written);
+                if (written < segment.length()) {
+                    return;
+                }
+            }
 
-            writeStatus("200 OK");
+            if (responseData->state & Http3ResponseData::HTTP_END_CALLED) {
+                shutdownIfDrained();
+            } else if (responseData->onWritable) {
+                responseData->callOnWritable(responseData->offset);
+            }
+        }
 
-            us_quic_socket_context_set_header(nullptr, responseData->headerOffset++, key.data(), key.length(), value.data(), value.length());
+    public:
+        /* Resets the stream, abruptly (onAborted is emitted) */
+        void close() {
+            us_quic_stream_close((us_quic_stream_t *) this);
+        }
 
+        /* QUIC packs writes by itself, this only runs handler */
+        Http3Response *cork(MoveOnlyFunction<void()> &&handler) {
+            handler();
             return this;
         }
 
-        std::pair<bool, bool> tryEnd(std::string_view data, uintmax_t totalSize = 0) {
-            Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext((us_quic_stream_t *) this);
-
-            writeStatus("200 OK");
-
-            us_quic_socket_context_send_headers(nullptr, (us_quic_stream_t *) this, responseData->headerOffset, data.length() > 0);
-
-
-            unsigned int written = us_quic_stream_write((us_quic_stream_t *) this, (char *) data.data(), (int) data.length());
+        void endWithoutBody(std::optional<size_t> reportedContentLength = std::nullopt, bool /*closeConnection*/ = false) {
+            Http3ResponseData *responseData = getResponseData();
+            if (responseData->state & Http3ResponseData::HTTP_END_CALLED) {
+                return;
+            }
+            sendHeaders(false, reportedContentLength);
+            responseData->markDone();
+            shutdownIfDrained();
+        }
 
-            if (written == data.length()) {
-                return {true, true};
-            } else {
+        /* Only the code of status goes out, HTTP/3 has no reason phrase */
+        Http3Response *writeStatus(std::string_view status) {
+            Http3ResponseData *responseData = getResponseData();
 
-                responseData->offset = written;
+            /* Nothing is done if headers already sent */
+            if (!(responseData->state & Http3ResponseData::HTTP_HEADERS_SENT) && status.length() >= 3) {
+                memcpy(responseData->status, status.data(), 3);
+            }
+            return this;
+        }
 
-                return {true, false};
+        /* Field names are lower cased, as HTTP/3 requires */
+        Http3Response *writeHeader(std::string_view key, std::string_view value) {
+            Http3ResponseData *responseData = getResponseData();
+            if ((responseData->state & Http3ResponseData::HTTP_HEADERS_SENT) || key.length() > UINT16_MAX || value.length() > UINT16_MAX) {
+                return this;
             }
 
+            uint16_t lengths[2] = {(uint16_t) key.length(), (uint16_t) value.length()};
+            size_t at = responseData->headers.length();
+            responseData->headers.append((char *) lengths, 4).append(key).append(value);
+            for (char *c = responseData->headers.data() + at + 4, *end = c + key.length(); c < end; c++) {
+                if (*c >= 'A' && *c <= 'Z') {
+                    *c |= 32;
+                }
+            }
+            if (std::string_view(responseData->headers.data() + at + 4, key.length()) == "content-length") {
+                responseData->state |= Http3ResponseData::HTTP_CONTENT_LENGTH_WRITTEN;
+            }
+            return this;
+        }
 
-            return {true, true};
+        Http3Response *writeHeader(std::string_view key, uint64_t value) {
+            char buffer[20];
+            char *end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+            return writeHeader(key, std::string_view(buffer, (size_t) (end - buffer)));
         }
 
-        /* Idnetical */
-        Http3Response *write(std::string_view data) {
+        /* Writes what the stream takes of data, up to totalSize of body in all (data.length() if 0). Returns
+         * whether all of data went, and whether the response is done. Retry from onWritable with what is left
+         * past getWriteOffset */
+        std::pair<bool, bool> tryEnd(std::string_view data, uintmax_t totalSize = 0, bool /*closeConnection*/ = false) {
+            Http3ResponseData *responseData = getResponseData();
+            if (responseData->state & Http3ResponseData::HTTP_END_CALLED) {
+                return {true, true};
+            }
+            if (!totalSize) {
+                totalSize = responseData->offset + data.length();
+            }
+            sendHeaders(totalSize > 0, totalSize);
 
+            if (responseData->backpressure.length()) {
+                return {false, false};
+            }
+            size_t written = writeToStream(data.substr(0, (size_t) std::min<uintmax_t>(data.length(), totalSize - responseData->offset)));
+            responseData->offset += written;
 
-            return this;
+            if (responseData->offset >= totalSize) {
+                responseData->markDone();
+                shutdownIfDrained();
+                return {true, true};
+            }
+            return {written == data.length(), false};
         }
 
-        /* Identical */
-        void end(std::string_view data = {}, bool closeConnection = false) {
+        /* Streams a chunk of the body, buffering what the stream does not take. Returns false on backpressure */
+        bool write(std::string_view data) {
+            Http3ResponseData *responseData = getResponseData();
+            if (responseData->state & Http3ResponseData::HTTP_END_CALLED) {
+                return false;
+            }
+            sendHeaders(true, std::nullopt);
+            return writeOrBuffer(data);
+        }
 
-            Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext((us_quic_stream_t *) this);
+        /* Ends the response, buffering what the stream does not take. Shut down once all went */
+        void end(std::string_view data = {}, bool /*closeConnection*/ = false) {
+            Http3ResponseData *responseData = getResponseData();
+            if (responseData->state & Http3ResponseData::HTTP_END_CALLED) {
+                return;
+            }
 
-            /* If not already written */
-            writeStatus("200 OK");
-            
-            // has body is determined by the ending so this is perfect here
-            us_quic_socket_context_send_headers(nullptr, (us_quic_stream_t *) this, responseData->headerOffset, data.length() > 0);
+            /* Has body is determined by the ending so this is perfect here */
+            bool wroteBefore = responseData->state & Http3ResponseData::HTTP_HEADERS_SENT;
+            sendHeaders(data.length() > 0, wroteBefore ? std::nullopt : std::optional<uintmax_t>(data.length()));
+            if (data.length()) {
+                writeOrBuffer(data);
+            }
+            responseData->markDone();
+            shutdownIfDrained();
+        }
 
-            /* Write body and shutdown (unknown if content-length must be present?) */
-            unsigned int written = us_quic_stream_write((us_quic_stream_t *) this, (char *) data.data(), (int) data.length());
+        uintmax_t getWriteOffset() {
+            return getResponseData()->offset;
+        }
 
-            /* Buffer up remains */
-            if (written != data.length()) {
-                responseData->backpressure.append(data.data() + written, data.length() - written);
-            } else {
-                /* Every request has its own stream, so we conceptually serve requests like in HTTP 1.0 */
-                us_quic_stream_shutdown((us_quic_stream_t *) this);
-            }
+        bool hasResponded() {
+            return getResponseData()->state & Http3ResponseData::HTTP_END_CALLED;
         }
 
         /* Attach handler for aborted HTTP request */
-        Http3Response *onAborted(MoveOnlyFunction<void()> &&handler) {
-            Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext((us_quic_stream_t *) this);
-
-            responseData->onAborted = std::move(handler);
+        Http3Response *onAborted(ResponseHandler<void()> &&handler) {
+            getResponseData()->onAborted = std::move(handler);
             return this;
         }
 
         /* Attach a read handler for data sent. Will be called with FIN set true if last segment. */
-        Http3Response *onData(MoveOnlyFunction<void(std::string_view, bool)> &&handler) {
-            Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext((us_quic_stream_t *) this);
-
-            responseData->onData = std::move(handler);
+        Http3Response *onData(ResponseHandler<void(std::string_view, bool)> &&handler) {
+            getResponseData()->onData = std::move(handler);
             return this;
         }
 
-        Http3Response *onWritable(MoveOnlyFunction<bool(uintmax_t)> &&handler) {
-            Http3ResponseData *responseData = (Http3ResponseData *) us_quic_stream_ext((us_quic_stream_t *) this);
-
-            responseData->onWritable = std::move(handler);
+        /* Called with getWriteOffset once the stream takes more, after what end or write buffered went */
+        Http3Response *onWritable(ResponseHandler<bool(uintmax_t)> &&handler) {
+            getResponseData()->onWritable = std::move(handler);
             return this;
         }
     };
 
-}
\ No newline at end of file
+}
+
+#endif
@@ -3,23 +3,60 @@
 
 #include "MoveOnlyFunction.h"
 #include "AsyncSocketData.h"
+#include <string>
 #include <string_view>
 
 namespace uWS {
     struct Http3ResponseData {
+        enum : unsigned char {
+            /* Headers went out with the first of the body (or without one) */
+            HTTP_HEADERS_SENT = 1,
+            /* Ended, the stream is shut down once backpressure drained */
+            HTTP_END_CALLED = 2,
+            /* Shut down (FIN sent with the headers, or after the body) */
+            HTTP_SHUT_DOWN = 4,
+            /* Content-length written by hand */
+            HTTP_CONTENT_LENGTH_WRITTEN = 8
+        };
 
-        MoveOnlyFunction<void()> onAborted = nullptr;
-        MoveOnlyFunction<void(std::string_view, bool)> onData = nullptr;
-        MoveOnlyFunction<bool(uintmax_t)> onWritable = nullptr;
+        ResponseHandler<void()> onAborted = nullptr;
+        ResponseHandler<void(std::string_view, bool)> onData = nullptr;
+        ResponseHandler<bool(uintmax_t)> onWritable = nullptr;
 
-        /* Status is always first header just like for h1 */
-        unsigned int headerOffset = 0;
-        
-        /* Write offset */
+        /* Only the code of the status goes in :status */
+        char status[3] = {'2', '0', '0'};
+        unsigned char state = 0;
+
+        /* Headers end to end as name, value, each led by its length in 2 bytes. Kept until sent, since QPACK
+         * encodes them only then */
+        std::string headers;
+
+        /* Write offset, of the body */
         uintmax_t offset = 0;
 
         BackPressure backpressure;
+
+        /* When we are done with a response we mark it like so */
+        void markDone() {
+            onAborted = nullptr;
+            /* Nor do we emit writable while draining behind the scenes */
+            onWritable = nullptr;
+            state |= HTTP_END_CALLED;
+        }
+
+        /* Same as HttpResponseData::callOnWritable, onWritable may be reset (by ending) from within */
+        bool callOnWritable(uintmax_t offset) {
+            ResponseHandler<bool(uintmax_t)> borrowedOnWritable = std::move(onWritable);
+            onWritable = [](uintmax_t) {return true;};
+
+            bool ret = borrowedOnWritable(offset);
+
+            if (onWritable) {
+                onWritable = std::move(borrowedOnWritable);
+            }
+            return ret;
+        }
     };
 }
 
-#endif
\ No newline at end of file
+#endif
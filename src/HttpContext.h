@@ -25,11 +25,18 @@
 #include "HttpResponseData.h"
 #include "AsyncSocket.h"
 #include "WebSocketData.h"
+#include "Http2Context.h"
+#include "Tracepoints.h"
 
+#include <cstring>
 #include <string_view>
 #include <iostream>
 #include "MoveOnlyFunction.h"
 
+#ifdef __linux__
+#include <sys/socket.h>
+#endif
+
 namespace uWS {
 template<bool> struct HttpResponse;
 
@@ -66,21 +73,113 @@ private:
         return (HttpContextData<SSL> *) us_socket_context_ext(SSL, getSocketContext(s));
     }
 
+    /* Of the loop of s, if profiling */
+    static LoopProfile *getProfile(us_socket_t *s) {
+        return ((LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, s))))->profile.get();
+    }
+
+    /* Charges the rate limiter of the app for a read beginning a request (every request, but for those pipelined
+     * after it in the same read), and behind a proxy the connection on its first read. Returns false having
+     * answered 429 or closed */
+    static bool rateLimit(us_socket_t *s, HttpContextData<SSL> *httpContextData, HttpResponseData<SSL> *httpResponseData, char *data, int length) {
+        RateLimiter *rateLimiter = httpContextData->rateLimiter.get();
+        LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, s)));
+
+#ifdef UWS_WITH_PROXY
+        if (!httpResponseData->addressHash) {
+            /* HttpParser parses it again as it goes, we only peek at the address ahead of it. One split
+             * across reads is waited for, but taken as the address of the proxy if continued past a read */
+            if (!httpResponseData->proxyParser.parse(std::string_view(data, (size_t) length)).first && !httpResponseData->hasBufferedData()) {
+                return true;
+            }
+            std::string_view address = httpResponseData->proxyParser.getSourceAddress();
+            if (!address.length()) {
+                address = ((AsyncSocket<SSL> *) s)->getRemoteAddress();
+            }
+            httpResponseData->addressHash = rateLimiter->hash(address);
+            if (!rateLimiter->admitConnection(httpResponseData->addressHash)) {
+                loopData->metrics.rateLimited.add();
+                us_socket_close(SSL, s, 0, nullptr);
+                return false;
+            }
+        }
+#else
+        (void) data;
+        (void) length;
+#endif
+
+        if (!httpResponseData->addressHash || !rateLimiter->limitsRequests()) {
+            return true;
+        }
+        if ((httpResponseData->state & HttpResponseData<SSL>::HTTP_RESPONSE_PENDING) || httpResponseData->hasBufferedData() || httpResponseData->getRemainingBodyLength()) {
+            return true;
+        }
+
+        if (!rateLimiter->admitRequest(httpResponseData->addressHash)) {
+            loopData->metrics.rateLimited.add();
+            std::string_view response = httpErrorResponses[HTTP_ERROR_429_TOO_MANY_REQUESTS];
+            ((AsyncSocket<SSL> *) s)->writeToSocket(response.data(), (int) response.length(), false);
+            us_socket_shutdown(SSL, s);
+            us_socket_close(SSL, s, 0, nullptr);
+            return false;
+        }
+        return true;
+    }
+
     /* Init the HttpContext by registering libusockets event handlers */
     HttpContext<SSL> *init() {
         /* Handle socket connections */
-        us_socket_context_on_open(SSL, getSocketContext(), [](us_socket_t *s, int /*is_client*/, char */*ip*/, int /*ip_length*/) {
+        us_socket_context_on_open(SSL, getSocketContext(), [](us_socket_t *s, int is_client, char *ip, int ip_length) {
             /* Any connected socket should timeout until it has a request */
             us_socket_timeout(SSL, s, HTTP_IDLE_TIMEOUT_S);
 
+            /* Counted until closed, as HTTP or as the WebSocket it upgraded to */
+            LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, s)));
+            loopData->connections.fetch_add(1, std::memory_order_relaxed);
+            loopData->metrics.accepted.add();
+            loopData->noteEvent();
+            if (loopData->trafficCapture && !is_client) {
+                loopData->trafficCapture->onOpen((uint64_t) us_poll_fd((struct us_poll_t *) s));
+            }
+
+#ifdef SO_BUSY_POLL
+            if (loopData->socketBusyPollMicroseconds) {
+                int fd = (int) us_poll_fd((struct us_poll_t *) s);
+                setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &loopData->socketBusyPollMicroseconds, sizeof(int));
+#ifdef SO_PREFER_BUSY_POLL
+                int prefer = 1;
+                setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(int));
+#endif
+            }
+#endif
+
             /* Init socket ext */
             new (us_socket_ext(SSL, s)) HttpResponseData<SSL>;
 
             /* Call filter */
             HttpContextData<SSL> *httpContextData = getSocketContextDataS(s);
+#ifndef UWS_NO_HTTP_FILTERS
             for (auto &f : httpContextData->filterHandlers) {
                 f((HttpResponse<SSL> *) s, 1);
             }
+#endif
+
+            /* An address over its rate of connections is closed before anything is read. Behind a proxy the
+             * address is only known from the first read (see rateLimit) */
+#ifndef UWS_WITH_PROXY
+            if (httpContextData->rateLimiter && ip_length) {
+                HttpResponseData<SSL> *httpResponseData = (HttpResponseData<SSL> *) us_socket_ext(SSL, s);
+                httpResponseData->addressHash = httpContextData->rateLimiter->hash(std::string_view(ip, (size_t) ip_length));
+                if (!httpContextData->rateLimiter->admitConnection(httpResponseData->addressHash)) {
+                    loopData->metrics.rateLimited.add();
+                    us_socket_close(SSL, s, 0, nullptr);
+                }
+            }
+#else
+            (void) httpContextData;
+            (void) ip;
+            (void) ip_length;
+#endif
 
             return s;
         });
@@ -91,24 +190,43 @@ private:
             HttpResponseData<SSL> *httpResponseData = (HttpResponseData<SSL> *) us_socket_ext(SSL, s);
 
             /* Call filter */
+#ifndef UWS_NO_HTTP_FILTERS
             HttpContextData<SSL> *httpContextData = getSocketContextDataS(s);
             for (auto &f : httpContextData->filterHandlers) {
                 f((HttpResponse<SSL> *) s, -1);
             }
+#endif
 
             /* Signal broken HTTP request only if we have a pending request */
-            if (httpResponseData->onAborted) {
-                httpResponseData->onAborted();
+            if (auto *onAborted = httpResponseData->getOnAborted()) {
+                ProfiledHandler profiled(getProfile(s), "aborted", httpResponseData->routeLabel);
+                (*onAborted)();
+            }
+            /* An event stream leaves its topics */
+            ((HttpResponse<SSL> *) s)->releaseEventStream();
+            if (httpResponseData->routeMetrics) {
+                httpResponseData->routeMetrics->abort();
             }
 
-            /* Destruct socket ext */
-            httpResponseData->~HttpResponseData<SSL>();
+            /* Destruct socket ext, unless a Task running on us (which closed us) still needs it until it suspends */
+            auto release = [](void *s) {
+                ((HttpResponseData<SSL> *) us_socket_ext(SSL, (us_socket_t *) s))->~HttpResponseData<SSL>();
+            };
+            if (!httpResponseData->holdForCoroutines(release, s)) {
+                release(s);
+            }
+            LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, s)));
+            loopData->connections.fetch_sub(1, std::memory_order_relaxed);
+            loopData->metrics.closed.add();
+            if (loopData->trafficCapture) {
+                loopData->trafficCapture->onClose((uint64_t) us_poll_fd((struct us_poll_t *) s));
+            }
 
             return s;
         });
 
-        /* Handle HTTP data streams */
-        us_socket_context_on_data(SSL, getSocketContext(), [](us_socket_t *s, char *data, int length) {
+        /* Handle HTTP data streams, and what was parked of them over the read budget (see Loop::setReadBudget) */
+        static us_socket_t *(*onData)(us_socket_t *, char *, int) = [](us_socket_t *s, char *data, int length) {
 
             // total overhead is about 210k down to 180k
             // ~210k req/sec is the original perf with write in data
@@ -116,6 +234,18 @@ private:
             // ~190k req/sec is with http parsing
             // ~180k - 190k req/sec is with varying routing
 
+            LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, s)));
+
+            /* What was parked was counted and let through as it was read */
+            bool resumed = loopData->resumingRead;
+            if (!resumed) {
+                loopData->noteEvent();
+                loopData->metrics.bytesIn.add((unsigned long long) length);
+                if (loopData->trafficCapture) {
+                    loopData->trafficCapture->onData((uint64_t) us_poll_fd((struct us_poll_t *) s), {data, (size_t) length});
+                }
+            }
+
             HttpContextData<SSL> *httpContextData = getSocketContextDataS(s);
 
             /* Do not accept any data while in shutdown state */
@@ -125,11 +255,30 @@ private:
 
             HttpResponseData<SSL> *httpResponseData = (HttpResponseData<SSL> *) us_socket_ext(SSL, s);
 
+            if (!resumed && httpContextData->rateLimiter && !rateLimit(s, httpContextData, httpResponseData, data, length)) {
+                return s;
+            }
+
+#ifndef UWS_NO_HTTP2
+            /* HTTP/2 with prior knowledge, or as agreed by ALPN, begins with its preface between requests */
+            if (!resumed && httpContextData->http2Context && length >= 4 && !memcmp(data, "PRI ", 4) && !httpResponseData->hasBufferedData()
+                && !(httpResponseData->state & HttpResponseData<SSL>::HTTP_RESPONSE_PENDING) && !((AsyncSocket<SSL> *) s)->getBufferedAmount()) {
+                return httpContextData->http2Context->adoptPreface(s, data, length);
+            }
+#endif
+
+            /* Past the read budget the rest is parked, behind what we parked before */
+            if (!resumed && !((AsyncSocket<SSL> *) s)->takeReadBudget(data, length, onData)) {
+                return s;
+            }
+
             /* Cork this socket */
             ((AsyncSocket<SSL> *) s)->cork();
 
+#ifndef UWS_NO_WEBSOCKET_UPGRADE
             /* Mark that we are inside the parser now */
             httpContextData->isParsingHttp = true;
+#endif
 
             // clients need to know the cursor after http parse, not servers!
             // how far did we read then? we need to know to continue with websocket parsing data? or?
@@ -157,22 +306,41 @@ private:
                     return nullptr;
                 }
 
+#ifndef UWS_NO_HTTP2
+                /* Cleartext HTTP/2 by upgrade, for requests without body (they go on as stream 1) */
+                if constexpr (!SSL) {
+                    if (httpContextData->http2Context && httpRequest->getHeader(HeaderIndex::UPGRADE) == "h2c"
+                        && httpRequest->getHeader("http2-settings").data() && !httpRequest->getHeader(HeaderIndex::TRANSFER_ENCODING).data()
+                        && (!httpRequest->getHeader(HeaderIndex::CONTENT_LENGTH).length() || httpRequest->getHeader(HeaderIndex::CONTENT_LENGTH) == "0")) {
+                        httpContextData->upgradedHttp2 = httpContextData->http2Context->upgrade((us_socket_t *) s, httpRequest);
+                        if (httpContextData->upgradedHttp2) {
+                            return nullptr;
+                        }
+                    }
+                }
+#endif
+
                 /* Mark pending request and emit it */
+                UWS_TRACE(http__request, httpRequest->getCaseSensitiveMethod().data(), httpRequest->getCaseSensitiveMethod().length(),
+                    httpRequest->getUrl().data(), httpRequest->getUrl().length());
                 httpResponseData->state = HttpResponseData<SSL>::HTTP_RESPONSE_PENDING;
+                ((LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s))))->metrics.requests.add();
 
                 /* Mark this response as connectionClose if ancient or connection: close */
-                if (httpRequest->isAncient() || httpRequest->getHeader("connection").length() == 5) {
+                if (httpRequest->isAncient() || httpRequest->getHeader(HeaderIndex::CONNECTION).length() == 5) {
                     httpResponseData->state |= HttpResponseData<SSL>::HTTP_CONNECTION_CLOSE;
                 }
 
                 /* Select the router based on SNI (only possible for SSL) */
                 auto *selectedRouter = &httpContextData->router;
+#ifndef UWS_NO_SNI_ROUTING
                 if constexpr (SSL) {
                     void *domainRouter = us_socket_server_name_userdata(SSL, (struct us_socket_t *) s);
                     if (domainRouter) {
                         selectedRouter = (decltype(selectedRouter)) domainRouter;
                     }
                 }
+#endif
 
                 /* Route the method and URL */
                 selectedRouter->getUserData() = {(HttpResponse<SSL> *) s, httpRequest};
@@ -182,11 +350,13 @@ private:
                     return nullptr;
                 }
 
+#ifndef UWS_NO_WEBSOCKET_UPGRADE
                 /* First of all we need to check if this socket was deleted due to upgrade */
                 if (httpContextData->upgradedWebSocket) {
                     /* We differ between closed and upgraded below */
                     return nullptr;
                 }
+#endif
 
                 /* Was the socket closed? */
                 if (us_socket_is_closed(SSL, (struct us_socket_t *) s)) {
@@ -198,15 +368,16 @@ private:
                     return nullptr;
                 }
 
-                /* Returning from a request handler without responding or attaching an onAborted handler is ill-use */
-                if (!((HttpResponse<SSL> *) s)->hasResponded() && !httpResponseData->onAborted) {
+                /* Returning from a request handler without responding or attaching an onAborted handler is ill-use.
+                 * A coroutine still answering is fine, it is aborted with us */
+                if (!((HttpResponse<SSL> *) s)->hasResponded() && !httpResponseData->getOnAborted() && !httpResponseData->coroutines) {
                     /* Throw exception here? */
                     std::cerr << "Error: Returning from a request handler without responding or attaching an abort handler is forbidden!" << std::endl;
                     std::terminate();
                 }
 
                 /* If we have not responded and we have a data handler, we need to timeout to enfore client sending the data */
-                if (!((HttpResponse<SSL> *) s)->hasResponded() && httpResponseData->inStream) {
+                if (!((HttpResponse<SSL> *) s)->hasResponded() && httpResponseData->getInStream()) {
                     us_socket_timeout(SSL, (us_socket_t *) s, HTTP_IDLE_TIMEOUT_S);
                 }
 
@@ -215,7 +386,7 @@ private:
 
             }, [httpResponseData](void *user, std::string_view data, bool fin) -> void * {
                 /* We always get an empty chunk even if there is no data */
-                if (httpResponseData->inStream) {
+                if (auto *inStream = httpResponseData->getInStream()) {
 
                     /* Todo: can this handle timeout for non-post as well? */
                     if (fin) {
@@ -232,7 +403,10 @@ private:
                     }
 
                     /* We might respond in the handler, so do not change timeout after this */
-                    httpResponseData->inStream(data, fin);
+                    {
+                        ProfiledHandler profiled(getProfile((us_socket_t *) user), "data", httpResponseData->routeLabel);
+                        (*inStream)(data, fin);
+                    }
 
                     /* Was the socket closed? */
                     if (us_socket_is_closed(SSL, (struct us_socket_t *) user)) {
@@ -246,20 +420,23 @@ private:
 
                     /* If we were given the last data chunk, reset data handler to ensure following
                      * requests on the same socket won't trigger any previously registered behavior */
-                    if (fin) {
-                        httpResponseData->inStream = nullptr;
+                    if (fin && httpResponseData->handlers) {
+                        httpResponseData->handlers->inStream = nullptr;
+                        httpResponseData->releaseHandlers();
                     }
                 }
                 return user;
             });
 
+#ifndef UWS_NO_WEBSOCKET_UPGRADE
             /* Mark that we are no longer parsing Http */
             httpContextData->isParsingHttp = false;
+#endif
 
             /* If we got fullptr that means the parser wants us to close the socket from error (same as calling the errorHandler) */
             if (returnedSocket == FULLPTR) {
                 /* For errors, we only deliver them "at most once". We don't care if they get halfways delivered or not. */
-                us_socket_write(SSL, s, httpErrorResponses[err].data(), (int) httpErrorResponses[err].length(), false);
+                ((AsyncSocket<SSL> *) s)->writeToSocket(httpErrorResponses[err].data(), (int) httpErrorResponses[err].length(), false);
                 us_socket_shutdown(SSL, s);
                 /* Close any socket on HTTP errors */
                 us_socket_close(SSL, s, 0, nullptr);
@@ -280,18 +457,24 @@ private:
                 /* We need to check if we should close this socket here now */
                 if (httpResponseData->state & HttpResponseData<SSL>::HTTP_CONNECTION_CLOSE) {
                     if ((httpResponseData->state & HttpResponseData<SSL>::HTTP_RESPONSE_PENDING) == 0) {
-                        if (((AsyncSocket<SSL> *) s)->getBufferedAmount() == 0) {
-                            ((AsyncSocket<SSL> *) s)->shutdown();
-                            /* We need to force close after sending FIN since we want to hinder
-                             * clients from keeping to send their huge data */
-                            ((AsyncSocket<SSL> *) s)->close();
-                        }
+                        ((AsyncSocket<SSL> *) s)->closeIfDrained();
                     }
                 }
 
                 return (us_socket_t *) returnedSocket;
             }
 
+#ifndef UWS_NO_HTTP2
+            /* Likewise for h2c, the session wrote its response to the socket while corked */
+            if (httpContextData->upgradedHttp2) {
+                AsyncSocket<SSL> *asyncSocket = (AsyncSocket<SSL> *) httpContextData->upgradedHttp2;
+                httpContextData->upgradedHttp2 = nullptr;
+                asyncSocket->uncork();
+                return (us_socket_t *) asyncSocket;
+            }
+#endif
+
+#ifndef UWS_NO_WEBSOCKET_UPGRADE
             /* If we upgraded, check here (differ between nullptr close and nullptr upgrade) */
             if (httpContextData->upgradedWebSocket) {
                 /* This path is only for upgraded websockets */
@@ -303,7 +486,7 @@ private:
                 /* If we succeeded in uncorking, check if we have sent WebSocket FIN */
                 if (!failed) {
                     WebSocketData *webSocketData = (WebSocketData *) asyncSocket->getAsyncSocketData();
-                    if (webSocketData->isShuttingDown) {
+                    if (webSocketData->isShuttingDown && !webSocketData->offloaded) {
                         /* In that case, also send TCP FIN (this is similar to what we have in ws drain handler) */
                         asyncSocket->shutdown();
                     }
@@ -315,13 +498,15 @@ private:
                 /* Return the new upgraded websocket */
                 return (us_socket_t *) asyncSocket;
             }
+#endif
 
             /* It is okay to uncork a closed socket and we need to */
             ((AsyncSocket<SSL> *) s)->uncork();
 
             /* We cannot return nullptr to the underlying stack in any case */
             return s;
-        });
+        };
+        us_socket_context_on_data(SSL, getSocketContext(), onData);
 
         /* Handle HTTP write out (note: SSL_read may trigger this spuriously, the app need to handle spurious calls) */
         us_socket_context_on_writable(SSL, getSocketContext(), [](us_socket_t *s) {
@@ -330,13 +515,17 @@ private:
             HttpResponseData<SSL> *httpResponseData = (HttpResponseData<SSL> *) asyncSocket->getAsyncSocketData();
 
             /* Ask the developer to write data and return success (true) or failure (false), OR skip sending anything and return success (true). */
-            if (httpResponseData->onWritable) {
+            if (httpResponseData->getOnWritable()) {
                 /* We are now writable, so hang timeout again, the user does not have to do anything so we should hang until end or tryEnd rearms timeout */
                 us_socket_timeout(SSL, s, 0);
 
                 /* We expect the developer to return whether or not write was successful (true).
                  * If write was never called, the developer should still return true so that we may drain. */
-                bool success = httpResponseData->callOnWritable(httpResponseData->offset);
+                bool success;
+                {
+                    ProfiledHandler profiled(getProfile(s), "writable", httpResponseData->routeLabel);
+                    success = httpResponseData->callOnWritable(httpResponseData->offset);
+                }
 
                 /* The developer indicated that their onWritable failed. */
                 if (!success) {
@@ -355,12 +544,7 @@ private:
             /* Should we close this connection after a response - and is this response really done? */
             if (httpResponseData->state & HttpResponseData<SSL>::HTTP_CONNECTION_CLOSE) {
                 if ((httpResponseData->state & HttpResponseData<SSL>::HTTP_RESPONSE_PENDING) == 0) {
-                    if (asyncSocket->getBufferedAmount() == 0) {
-                        asyncSocket->shutdown();
-                        /* We need to force close after sending FIN since we want to hinder
-                         * clients from keeping to send their huge data */
-                        asyncSocket->close();
-                    }
+                    asyncSocket->closeIfDrained();
                 }
             }
 
@@ -384,6 +568,15 @@ private:
 
             /* Force close rather than gracefully shutdown and risk confusing the client with a complete download */
             AsyncSocket<SSL> *asyncSocket = (AsyncSocket<SSL> *) s;
+
+            /* An idle keep-alive connection may go on in another process, which holds it past our close */
+            HttpContextData<SSL> *httpContextData = getSocketContextDataS(s);
+            HttpResponseData<SSL> *httpResponseData = (HttpResponseData<SSL> *) asyncSocket->getAsyncSocketData();
+            if (httpContextData->idleHandler && !(httpResponseData->state & HttpResponseData<SSL>::HTTP_RESPONSE_PENDING)
+                && !asyncSocket->getBufferedAmount() && !httpResponseData->hasBufferedData()) {
+                httpContextData->idleHandler(s);
+            }
+
             return asyncSocket->close();
 
         });
@@ -442,37 +635,48 @@ public:
         }
 
         /* Record this route's parameter offsets */
-        std::map<std::string, unsigned short, std::less<>> parameterOffsets;
-        unsigned short offset = 0;
-        for (unsigned int i = 0; i < pattern.length(); i++) {
-            if (pattern[i] == ':') {
-                i++;
-                unsigned int start = i;
-                while (i < pattern.length() && pattern[i] != '/') {
-                    i++;
-                }
-                parameterOffsets[std::string(pattern.data() + start, i - start)] = offset;
-                //std::cout << "<" << std::string(pattern.data() + start, i - start) << "> is offset " << offset;
-                offset++;
-            }
+        RouteParameters parameterOffsets(pattern);
+
+        /* And its metrics, if asked for (upgrades end as WebSockets, not as responses) */
+        RouteMetrics *routeMetrics = nullptr;
+        if (httpContextData->recordRouteMetrics && !upgrade) {
+            routeMetrics = httpContextData->routeMetrics.emplace_back(std::make_unique<RouteMetrics>(method, pattern)).get();
         }
 
-        httpContextData->currentRouter->add(methods, pattern, [handler = std::move(handler), parameterOffsets = std::move(parameterOffsets)](auto *r) mutable {
+        /* What stalls of it are reported as, if profiling, also those of the handlers the response was given */
+        const std::string *label = httpContextData->routeLabels.emplace_back(std::make_unique<std::string>(method + " " + pattern)).get();
+
+        httpContextData->currentRouter->add(methods, pattern, [handler = std::move(handler), parameterOffsets = std::move(parameterOffsets), routeMetrics, label](auto *r) mutable {
             auto user = r->getUserData();
             user.httpRequest->setYield(false);
             user.httpRequest->setParameters(r->getParameters());
             user.httpRequest->setParameterOffsets(&parameterOffsets);
 
+            /* Timed from here on, until ended (or aborted) */
+            HttpResponseData<SSL> *httpResponseData = (HttpResponseData<SSL> *) us_socket_ext(SSL, (us_socket_t *) user.httpResponse);
+            if (routeMetrics) {
+                httpResponseData->routeMetrics = routeMetrics;
+                httpResponseData->routeMatchedAt = LoopData::now();
+            }
+            httpResponseData->routeLabel = label;
+
             /* Middleware? Automatically respond to expectations */
-            std::string_view expect = user.httpRequest->getHeader("expect");
+            std::string_view expect = user.httpRequest->getHeader(HeaderIndex::EXPECT);
             if (expect.length() && expect == "100-continue") {
                 user.httpResponse->writeContinue();
             }
 
-            handler(user.httpResponse, user.httpRequest);
+            {
+                LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) user.httpResponse)));
+                ProfiledHandler profiled(loopData->profile.get(), "http", label);
+                handler(user.httpResponse, user.httpRequest);
+            }
 
             /* If any handler yielded, the router will keep looking for a suitable handler. */
             if (user.httpRequest->getYield()) {
+                if (routeMetrics && httpResponseData->routeMetrics == routeMetrics) {
+                    httpResponseData->routeMetrics = nullptr;
+                }
                 return false;
             }
             return true;
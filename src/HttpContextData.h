@@ -20,18 +20,61 @@
 
 #include "HttpRouter.h"
 
+#include <memory>
 #include <vector>
 #include "MoveOnlyFunction.h"
+#include "LoopData.h"
+#include "RateLimiter.h"
+#include "RouteMetrics.h"
+
+/* Features the HTTP hot path checks for on every read or request can be compiled out one by one, or all of them
+ * with UWS_HTTP_ONLY, so that a request goes parse, route and respond without looking for them:
+ * UWS_NO_SNI_ROUTING - server names keep their certificates, but all of them route with the default router
+ * UWS_NO_HTTP_FILTERS - no App::filter
+ * UWS_NO_WEBSOCKET_UPGRADE - no App::ws nor HttpResponse::upgrade, and no bookkeeping for them while parsing
+ * UWS_NO_HTTP2 - no App::http2, neither by preface nor by h2c upgrade */
+#ifdef UWS_HTTP_ONLY
+#ifndef UWS_NO_SNI_ROUTING
+#define UWS_NO_SNI_ROUTING
+#endif
+#ifndef UWS_NO_HTTP_FILTERS
+#define UWS_NO_HTTP_FILTERS
+#endif
+#ifndef UWS_NO_WEBSOCKET_UPGRADE
+#define UWS_NO_WEBSOCKET_UPGRADE
+#endif
+#ifndef UWS_NO_HTTP2
+#define UWS_NO_HTTP2
+#endif
+#endif
 
 namespace uWS {
 template<bool> struct HttpResponse;
 struct HttpRequest;
+template<bool> struct Http2Context;
+template <typename, typename> struct TopicTree;
+struct TopicTreeMessage;
+struct TopicTreeBigMessage;
+
+/* How an acceptor picks the child app for a connection, see App::addChildApp */
+enum ChildAppBalancing {
+    ROUND_ROBIN,
+    /* Fewest connections open or on their way */
+    LEAST_CONNECTIONS,
+    /* Most punctual 1 second timer, a loop busy with work rather than sockets */
+    LEAST_LAG,
+    /* The better of two picked at random (power of two choices), which does not herd onto one loop
+     * while every connection handed to it is still on its way */
+    LEAST_CONNECTIONS_OF_TWO,
+    LEAST_LAG_OF_TWO
+};
 
 template <bool SSL>
 struct alignas(16) HttpContextData {
     template <bool> friend struct HttpContext;
     template <bool> friend struct HttpResponse;
     template <bool, typename> friend struct TemplatedAppBase;
+    template <bool> friend struct TemplatedHandoff;
 private:
     std::vector<MoveOnlyFunction<void(HttpResponse<SSL> *, int)>> filterHandlers;
 
@@ -48,11 +91,99 @@ private:
     /* This is the default router for default SNI or non-SSL */
     HttpRouter<RouterData> router;
     void *upgradedWebSocket = nullptr;
+    /* Same as upgradedWebSocket, for h2c upgrades */
+    void *upgradedHttp2 = nullptr;
     bool isParsingHttp = false;
 
+    /* Takes connections speaking HTTP/2, if App::http2 was called */
+    Http2Context<SSL> *http2Context = nullptr;
+
+    /* Of the App, once it has one, for responses streaming events to subscribe with */
+    TopicTree<TopicTreeMessage, TopicTreeBigMessage> *topicTree = nullptr;
+
+    /* Set once our listen sockets went to a successor, every response then closes its connection */
+    bool draining = false;
+    /* Given idle keep-alive connections as they time out, right before they are closed (see Handoff.h) */
+    MoveOnlyFunction<void(us_socket_t *)> idleHandler = nullptr;
+
+    /* Connections and requests over their rate are turned away before anything is parsed, if set */
+    std::unique_ptr<RateLimiter> rateLimiter;
+
+    /* Histograms of the routes declared once App::routeMetrics was called, recorded by our loop only */
+    bool recordRouteMetrics = false;
+    std::vector<std::unique_ptr<RouteMetrics>> routeMetrics;
+    /* What stalls of every route are reported as, for as long as responses may point to them */
+    std::vector<std::unique_ptr<std::string>> routeLabels;
+
     /* If we are main acceptor, distribute to these apps */
     std::vector<void *> childApps;
+    std::vector<LoopData *> childLoops;
     unsigned int roundRobin = 0;
+
+    ChildAppBalancing childAppBalancing = ROUND_ROBIN;
+    /* Given the load of every child, returns the index of the one to take the connection */
+    MoveOnlyFunction<unsigned int(const std::vector<LoopLoad> &)> childAppBalancer = nullptr;
+    std::vector<LoopLoad> childLoads;
+    uint32_t randomState = 0x9e3779b9;
+
+    static unsigned int metric(LoopLoad load, bool lag) {
+        return lag ? load.lagMicroseconds : load.connections;
+    }
+
+    /* Xorshift, which is plenty for sampling */
+    unsigned int random(unsigned int range) {
+        randomState ^= randomState << 13;
+        randomState ^= randomState >> 17;
+        randomState ^= randomState << 5;
+        return randomState % range;
+    }
+
+    /* The child to get the next connection, on the acceptor */
+    unsigned int pickChildApp() {
+        unsigned int count = (unsigned int) childLoops.size();
+        unsigned int start = roundRobin;
+        if (++roundRobin == count) {
+            roundRobin = 0;
+        }
+
+        if (childAppBalancer) {
+            childLoads.clear();
+            for (LoopData *loopData : childLoops) {
+                childLoads.push_back(loopData->getLoad());
+            }
+            return std::min(childAppBalancer(childLoads), count - 1);
+        }
+
+        bool lag = childAppBalancing == LEAST_LAG || childAppBalancing == LEAST_LAG_OF_TWO;
+        switch (childAppBalancing) {
+        case ROUND_ROBIN:
+            return start;
+        case LEAST_CONNECTIONS_OF_TWO:
+        case LEAST_LAG_OF_TWO: {
+            if (count < 3) {
+                break;
+            }
+            unsigned int a = random(count), b = random(count - 1);
+            b += b >= a;
+            return metric(childLoops[b]->getLoad(), lag) < metric(childLoops[a]->getLoad(), lag) ? b : a;
+        }
+        default:
+            break;
+        }
+
+        /* The least of all, ties going round robin */
+        unsigned int best = start;
+        unsigned int bestMetric = metric(childLoops[start]->getLoad(), lag);
+        for (unsigned int i = 1; i < count && bestMetric; i++) {
+            unsigned int index = (start + i) % count;
+            unsigned int m = metric(childLoops[index]->getLoad(), lag);
+            if (m < bestMetric) {
+                best = index;
+                bestMetric = m;
+            }
+        }
+        return best;
+    }
 };
 
 }
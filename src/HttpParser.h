@@ -28,14 +28,28 @@
 #include <climits>
 #include <string_view>
 #include <map>
+#include <vector>
 #include "MoveOnlyFunction.h"
 #include "ChunkedEncoding.h"
 
 #include "BloomFilter.h"
+#include "HeaderIndex.h"
 #include "ProxyParser.h"
 #include "QueryParser.h"
+#include "RouteParameters.h"
 #include "HttpErrors.h"
 
+/* Header scanning is done in blocks of 16 or 32 bytes where we have the instructions for it,
+ * otherwise we fall back to SWAR (8 bytes at a time). This is decided at compile time. */
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace uWS {
 
 /* We require at least this much post padding */
@@ -52,6 +66,7 @@ static const size_t MAX_FALLBACK_SIZE = (size_t) atoi(optional_ptr(getenv("UWS_H
 #ifndef UWS_HTTP_MAX_HEADERS_COUNT
 #define UWS_HTTP_MAX_HEADERS_COUNT 100
 #endif
+static_assert(UWS_HTTP_MAX_HEADERS_COUNT <= 256, "Well-known header slots index headers by unsigned char");
 
 struct HttpRequest {
 
@@ -65,8 +80,12 @@ private:
     unsigned int querySeparator;
     bool didYield;
     BloomFilter bf;
+    /* Index into headers for every well-known header, 0 if not present (0 is the request line) */
+    unsigned char knownHeaders[HeaderIndex::NUM_HEADERS];
+    /* Built on first getQuery(key) */
+    QueryIndex queryIndex;
     std::pair<int, std::string_view *> currentParameters;
-    std::map<std::string, unsigned short, std::less<>> *currentParameterOffsets = nullptr;
+    RouteParameters *currentParameterOffsets = nullptr;
 
 public:
     bool isAncient() {
@@ -112,7 +131,20 @@ public:
         didYield = yield;
     }
 
+    /* O(1) lookup of well-known headers, no string compares */
+    std::string_view getHeader(HeaderIndex::Header header) {
+        if (knownHeaders[header]) {
+            return headers[knownHeaders[header]].value;
+        }
+        return std::string_view(nullptr, 0);
+    }
+
     std::string_view getHeader(std::string_view lowerCasedHeader) {
+        /* Well-known headers never touch the bloom filter */
+        unsigned int slot = HeaderIndex::classify(lowerCasedHeader);
+        if (slot != HeaderIndex::NUM_HEADERS) {
+            return getHeader((HeaderIndex::Header) slot);
+        }
         if (bf.mightHave(lowerCasedHeader)) {
             for (Header *h = headers; (++h)->key.length(); ) {
                 if (h->key.length() == lowerCasedHeader.length() && !strncmp(h->key.data(), lowerCasedHeader.data(), lowerCasedHeader.length())) {
@@ -155,19 +187,19 @@ public:
         }
     }
 
-    /* Finds and decodes the URI component. */
+    /* Finds and decodes the URI component. The query is indexed once per request. */
     std::string_view getQuery(std::string_view key) {
         /* Raw querystring including initial '?' sign */
         std::string_view queryString = std::string_view(headers->value.data() + querySeparator, headers->value.length() - querySeparator);
 
-        return getDecodedQueryValue(key, queryString);
+        return queryIndex.get(key, queryString);
     }
 
     void setParameters(std::pair<int, std::string_view *> parameters) {
         currentParameters = parameters;
     }
 
-    void setParameterOffsets(std::map<std::string, unsigned short, std::less<>> *offsets) {
+    void setParameterOffsets(RouteParameters *offsets) {
         currentParameterOffsets = offsets;
     }
 
@@ -175,11 +207,11 @@ public:
         if (!currentParameterOffsets) {
             return {nullptr, 0};
         }
-        auto it = currentParameterOffsets->find(name);
-        if (it == currentParameterOffsets->end()) {
+        int index = currentParameterOffsets->find(name);
+        if (index == -1) {
             return {nullptr, 0};
         }
-        return getParameter(it->second);
+        return getParameter((unsigned short) index);
     }
 
     std::string_view getParameter(unsigned short index) {
@@ -192,10 +224,60 @@ public:
 
 };
 
+/* Fixed size blocks for buffering partial request headers, shared by the parsers of the loop of this thread.
+ * A connection only holds a block while it has a partial request. */
+struct FallbackPool {
+    /* Room for MAX_FALLBACK_SIZE plus post padding */
+    static size_t blockSize() {
+        return MAX_FALLBACK_SIZE + MINIMUM_HTTP_POST_PADDING;
+    }
+
+    /* Idle blocks kept around for reuse, anything above this is freed */
+    static const unsigned int MAX_IDLE_BLOCKS = 256;
+
+    static FallbackPool &get() {
+        static thread_local FallbackPool pool;
+        return pool;
+    }
+
+    char *acquire() {
+        if (idleBlocks.size()) {
+            char *block = idleBlocks.back();
+            idleBlocks.pop_back();
+            return block;
+        }
+        bytes += blockSize();
+        return new char[blockSize()];
+    }
+
+    void release(char *block) {
+        if (idleBlocks.size() < MAX_IDLE_BLOCKS) {
+            idleBlocks.push_back(block);
+        } else {
+            bytes -= blockSize();
+            delete [] block;
+        }
+    }
+
+    /* Held by the parsers of this thread and by us, idle blocks included */
+    size_t bytes = 0;
+
+    ~FallbackPool() {
+        for (char *block : idleBlocks) {
+            delete [] block;
+        }
+    }
+
+private:
+    std::vector<char *> idleBlocks;
+};
+
 struct HttpParser {
 
 private:
-    std::string fallback;
+    /* Borrowed from FallbackPool only while we have a partial request */
+    char *fallback = nullptr;
+    unsigned int fallbackLength = 0;
     /* This guy really has only 30 bits since we reserve two highest bits to chunked encoding parsing state */
     uint64_t remainingStreamingBytes = 0;
 
@@ -237,6 +319,116 @@ private:
         hasMore(x, 'z');
     }
 
+#if defined(__AVX2__) || defined(__SSE4_2__) || defined(__ARM_NEON) || defined(__aarch64__)
+#define UWS_HTTP_SIMD_SCAN
+
+    /* Index of lowest set bit, mask must be non-zero */
+    static inline unsigned int lowestBit(uint64_t mask) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, mask);
+        return (unsigned int) index;
+#else
+        return (unsigned int) __builtin_ctzll(mask);
+#endif
+    }
+
+#if defined(__AVX2__)
+    static const unsigned int SIMD_SCAN_WIDTH = 32;
+
+    /* Signed range check is fine since bytes above 127 compare as negative and fail */
+    static inline __m256i inRange(__m256i v, char low, char high) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8((char) (low - 1))), _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (high + 1)), v));
+    }
+
+    /* Lower cases and returns length of leading [A-Za-z0-9-] run within this block */
+    static inline unsigned int fieldNameSpan(char *p) {
+        __m256i v = _mm256_loadu_si256((__m256i *) p);
+        __m256i lowered = _mm256_or_si256(v, _mm256_set1_epi8(32));
+        __m256i alpha = inRange(lowered, 'a', 'z');
+        __m256i valid = _mm256_or_si256(_mm256_or_si256(alpha, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-'))), inRange(v, '0', '9'));
+        uint32_t invalidMask = ~(uint32_t) _mm256_movemask_epi8(valid);
+        unsigned int span = invalidMask ? lowestBit(invalidMask) : 32;
+
+        /* Only touch the field name itself, never what follows the colon */
+        uint32_t upperMask = (uint32_t) _mm256_movemask_epi8(_mm256_andnot_si256(_mm256_cmpeq_epi8(lowered, v), alpha));
+        if (span < 32) {
+            upperMask &= (1u << span) - 1;
+        }
+        if (upperMask) {
+            __m256i keep = _mm256_cmpgt_epi8(_mm256_set1_epi8((char) span), _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31));
+            _mm256_storeu_si256((__m256i *) p, _mm256_blendv_epi8(v, _mm256_blendv_epi8(v, lowered, alpha), keep));
+        }
+        return span;
+    }
+
+    /* Returns length of leading run of bytes above 31 within this block */
+    static inline unsigned int fieldValueSpan(char *p) {
+        __m256i v = _mm256_loadu_si256((__m256i *) p);
+        uint32_t ctlMask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(31)), v));
+        return ctlMask ? lowestBit(ctlMask) : 32;
+    }
+#elif defined(__SSE4_2__)
+    static const unsigned int SIMD_SCAN_WIDTH = 16;
+
+    static inline __m128i inRange(__m128i v, char low, char high) {
+        return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char) (low - 1))), _mm_cmplt_epi8(v, _mm_set1_epi8((char) (high + 1))));
+    }
+
+    static inline unsigned int fieldNameSpan(char *p) {
+        __m128i v = _mm_loadu_si128((__m128i *) p);
+        __m128i lowered = _mm_or_si128(v, _mm_set1_epi8(32));
+        __m128i alpha = inRange(lowered, 'a', 'z');
+        __m128i valid = _mm_or_si128(_mm_or_si128(alpha, _mm_cmpeq_epi8(v, _mm_set1_epi8('-'))), inRange(v, '0', '9'));
+        uint32_t invalidMask = ~(uint32_t) _mm_movemask_epi8(valid) & 0xffff;
+        unsigned int span = invalidMask ? lowestBit(invalidMask) : 16;
+
+        uint32_t upperMask = (uint32_t) _mm_movemask_epi8(_mm_andnot_si128(_mm_cmpeq_epi8(lowered, v), alpha)) & ((1u << span) - 1);
+        if (upperMask) {
+            __m128i keep = _mm_cmplt_epi8(_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm_set1_epi8((char) span));
+            _mm_storeu_si128((__m128i *) p, _mm_blendv_epi8(v, _mm_blendv_epi8(v, lowered, alpha), keep));
+        }
+        return span;
+    }
+
+    static inline unsigned int fieldValueSpan(char *p) {
+        __m128i v = _mm_loadu_si128((__m128i *) p);
+        uint32_t ctlMask = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(31)), v));
+        return ctlMask ? lowestBit(ctlMask) : 16;
+    }
+#else
+    static const unsigned int SIMD_SCAN_WIDTH = 16;
+
+    /* NEON lacks movemask, so narrow every byte of the comparison into a nibble */
+    static inline uint64_t nibbleMask(uint8x16_t cmp) {
+        return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0);
+    }
+
+    static inline unsigned int fieldNameSpan(char *p) {
+        uint8x16_t v = vld1q_u8((uint8_t *) p);
+        uint8x16_t lowered = vorrq_u8(v, vdupq_n_u8(32));
+        uint8x16_t alpha = vcleq_u8(vsubq_u8(lowered, vdupq_n_u8('a')), vdupq_n_u8('z' - 'a'));
+        uint8x16_t digit = vcleq_u8(vsubq_u8(v, vdupq_n_u8('0')), vdupq_n_u8(9));
+        uint8x16_t valid = vorrq_u8(vorrq_u8(alpha, digit), vceqq_u8(v, vdupq_n_u8('-')));
+        uint64_t invalidMask = ~nibbleMask(valid);
+        unsigned int span = invalidMask ? (lowestBit(invalidMask) >> 2) : 16;
+
+        uint8x16_t keep = vcltq_u8(vcombine_u8(vcreate_u8(0x0706050403020100ull), vcreate_u8(0x0f0e0d0c0b0a0908ull)), vdupq_n_u8((uint8_t) span));
+        uint8x16_t upper = vandq_u8(vandq_u8(alpha, keep), vmvnq_u8(vceqq_u8(lowered, v)));
+        if (nibbleMask(upper)) {
+            vst1q_u8((uint8_t *) p, vbslq_u8(upper, lowered, v));
+        }
+        return span;
+    }
+
+    static inline unsigned int fieldValueSpan(char *p) {
+        uint64_t ctlMask = nibbleMask(vcltq_u8(vld1q_u8((uint8_t *) p), vdupq_n_u8(32)));
+        return ctlMask ? (lowestBit(ctlMask) >> 2) : 16;
+    }
+#endif
+#endif
+
     /* RFC 9110 5.6.2. Tokens */
     /* Hyphen is not checked here as it is very common */
     static inline bool isUnlikelyFieldNameByte(unsigned char c)
@@ -262,6 +454,17 @@ private:
     }
     
     static inline void *consumeFieldName(char *p) {
+#ifdef UWS_HTTP_SIMD_SCAN
+        /* Validate and lower case whole blocks; fence and post padding keep these loads in bounds */
+        unsigned int span;
+        do {
+            span = fieldNameSpan(p);
+            p += span;
+        } while (span == SIMD_SCAN_WIDTH);
+        if (*p == ':') {
+            return (void *)p;
+        }
+#else
         /* Best case fast path (particularly useful with clang) */
         while (true) {
             while ((*p >= 65) & (*p <= 90)) [[likely]] {
@@ -281,6 +484,7 @@ private:
                 break;
             }
         }
+#endif
 
         /* Generic */
         while (isFieldNameByteFastLowercased(*(unsigned char *)p)) {
@@ -311,17 +515,24 @@ private:
                     if (memcmp(" HTTP/1.1\r\n", data, 11) == 0) {
                         return data + 11;
                     }
-                    /* If we stand at the post padded CR, we have fragmented input so try again later */
-                    if (data[0] == '\r') {
-                        return nullptr;
+                    /* If we stand at the post padded CR, we have fragmented input so try again later.
+                     * The same goes for input fragmented anywhere within the version */
+                    for (int i = 0; i < 11; i++) {
+                        if (data[i] == '\r' && (i != 9 || data[10] != '\n')) {
+                            return nullptr;
+                        }
+                        if (data[i] != " HTTP/1.1\r\n"[i]) {
+                            break;
+                        }
                     }
                     /* This is an error */
                     return (char *) 0x1;
                 }
             }
         }
-        /* If we stand at the post padded CR, we have fragmented input so try again later */
-        if (data[0] == '\r') {
+        /* If we stand at the post padded CR, we have fragmented input so try again later
+         * (this includes input fragmented right after the method) */
+        if (data[0] == '\r' || (data[0] == 32 && data[1] == '\r')) {
             return nullptr;
         }
         return (char *) 0x1;
@@ -332,6 +543,14 @@ private:
      * Field values containing CR, LF, or NUL characters are invalid and dangerous [...]
      * Field values containing other CTL characters are also invalid. */
     static inline void *tryConsumeFieldValue(char *p) {
+#ifdef UWS_HTTP_SIMD_SCAN
+        unsigned int span;
+        do {
+            span = fieldValueSpan(p);
+            p += span;
+        } while (span == SIMD_SCAN_WIDTH);
+        return (void *)p;
+#else
         for (; true; p += 8) {
             uint64_t word;
             memcpy(&word, p, sizeof(uint64_t));
@@ -340,6 +559,7 @@ private:
                 return (void *)p;
             }
         }
+#endif
     }
 
     /* End is only used for the proxy parser. The HTTP parser recognizes "\ra" as invalid "\r\n" scan and breaks. */
@@ -450,6 +670,39 @@ private:
         return 0;
     }
 
+    /* Emits every chunk in data with as few calls to dataHandler as possible. The chunk payloads are
+     * moved together in place, over the already consumed chunk size lines, and emitted as one view.
+     * The end of the body is emitted as fin, together with whatever data preceded it. */
+    static void consumeChunks(std::string_view &dataToConsume, uint64_t &remainingStreamingBytes, void *user, MoveOnlyFunction<void *(void *, std::string_view, bool)> &dataHandler) {
+        std::string_view chunks[32];
+        char *batch = nullptr;
+        size_t batchLength = 0;
+
+        unsigned int numChunks;
+        do {
+            numChunks = getNextChunks(dataToConsume, remainingStreamingBytes, chunks, 32);
+            for (unsigned int i = 0; i < numChunks; i++) {
+                if (!chunks[i].length()) {
+                    dataHandler(user, std::string_view(batch, batchLength), true);
+                    batch = nullptr;
+                    batchLength = 0;
+                } else if (!batch) {
+                    batch = (char *) chunks[i].data();
+                    batchLength = chunks[i].length();
+                } else {
+                    if (batch + batchLength != chunks[i].data()) {
+                        memmove(batch + batchLength, chunks[i].data(), chunks[i].length());
+                    }
+                    batchLength += chunks[i].length();
+                }
+            }
+        } while (numChunks == 32);
+
+        if (batch) {
+            dataHandler(user, std::string_view(batch, batchLength), false);
+        }
+    }
+
     /* This is the only caller of getHeaders and is thus the deepest part of the parser.
      * From here we return either [consumed, user] for "keep going",
       * or [consumed, nullptr] for "break; I am closed or upgraded to websocket"
@@ -479,14 +732,22 @@ private:
             /* Store HTTP version (ancient 1.0 or 1.1) */
             req->ancientHttp = false;
 
-            /* Add all headers to bloom filter */
+            /* Classify well-known headers into their slots (first occurrence wins), add the rest to bloom filter */
             req->bf.reset();
+            memset(req->knownHeaders, 0, sizeof(req->knownHeaders));
             for (HttpRequest::Header *h = req->headers; (++h)->key.length(); ) {
-                req->bf.add(h->key);
+                unsigned int slot = HeaderIndex::classify(h->key);
+                if (slot != HeaderIndex::NUM_HEADERS) {
+                    if (!req->knownHeaders[slot]) {
+                        req->knownHeaders[slot] = (unsigned char) (h - req->headers);
+                    }
+                } else {
+                    req->bf.add(h->key);
+                }
             }
             
             /* Break if no host header (but we can have empty string which is different from nullptr) */
-            if (!req->getHeader("host").data()) {
+            if (!req->getHeader(HeaderIndex::HOST).data()) {
                 return {HTTP_ERROR_400_BAD_REQUEST, FULLPTR};
             }
 
@@ -495,8 +756,8 @@ private:
             * the Transfer-Encoding overrides the Content-Length. Such a message might indicate an attempt
             * to perform request smuggling (Section 11.2) or response splitting (Section 11.1) and
             * ought to be handled as an error. */
-            std::string_view transferEncodingString = req->getHeader("transfer-encoding");
-            std::string_view contentLengthString = req->getHeader("content-length");
+            std::string_view transferEncodingString = req->getHeader(HeaderIndex::TRANSFER_ENCODING);
+            std::string_view contentLengthString = req->getHeader(HeaderIndex::CONTENT_LENGTH);
             if (transferEncodingString.length() && contentLengthString.length()) {
                 /* Returning fullptr is the same as calling the errorHandler */
                 /* We could be smart and set an error in the context along with this, to indicate what 
@@ -507,6 +768,7 @@ private:
             /* Parse query */
             const char *querySeparatorPtr = (const char *) memchr(req->headers->value.data(), '?', req->headers->value.length());
             req->querySeparator = (unsigned int) ((querySeparatorPtr ? querySeparatorPtr : req->headers->value.data() + req->headers->value.length()) - req->headers->value.data());
+            req->queryIndex.reset();
 
             /* If returned socket is not what we put in we need
              * to break here as we either have upgraded to
@@ -545,9 +807,7 @@ private:
                 if (!CONSUME_MINIMALLY) {
                     /* Go ahead and parse it (todo: better heuristics for emitting FIN to the app level) */
                     std::string_view dataToConsume(data, length);
-                    for (auto chunk : uWS::ChunkIterator(&dataToConsume, &remainingStreamingBytes)) {
-                        dataHandler(user, chunk, chunk.length() == 0);
-                    }
+                    consumeChunks(dataToConsume, remainingStreamingBytes, user, dataHandler);
                     if (isParsingInvalidChunkedEncoding(remainingStreamingBytes)) {
                         return {HTTP_ERROR_400_BAD_REQUEST, FULLPTR};
                     }
@@ -589,7 +849,33 @@ private:
         return {consumedTotal, user};
     }
 
+    void releaseFallback() {
+        if (fallback) {
+            FallbackPool::get().release(fallback);
+            fallback = nullptr;
+            fallbackLength = 0;
+        }
+    }
+
 public:
+    /* Part of a request is held, waiting for the rest */
+    bool hasBufferedData() const {
+        return fallbackLength;
+    }
+
+    /* While a body streams in, what of it is still to come including the chunk being emitted, or UINT64_MAX if chunked */
+    uint64_t getRemainingBodyLength() const {
+        return isParsingChunkedEncoding(remainingStreamingBytes) ? UINT64_MAX : remainingStreamingBytes;
+    }
+
+    HttpParser() = default;
+    HttpParser(const HttpParser &) = delete;
+    HttpParser &operator=(const HttpParser &) = delete;
+
+    ~HttpParser() {
+        releaseFallback();
+    }
+
     std::pair<unsigned int, void *> consumePostPadded(char *data, unsigned int length, void *user, void *reserved, MoveOnlyFunction<void *(void *, HttpRequest *)> &&requestHandler, MoveOnlyFunction<void *(void *, std::string_view, bool)> &&dataHandler) {
 
         /* This resets BloomFilter by construction, but later we also reset it again.
@@ -601,9 +887,7 @@ public:
             /* It's either chunked or with a content-length */
             if (isParsingChunkedEncoding(remainingStreamingBytes)) {
                 std::string_view dataToConsume(data, length);
-                for (auto chunk : uWS::ChunkIterator(&dataToConsume, &remainingStreamingBytes)) {
-                    dataHandler(user, chunk, chunk.length() == 0);
-                }
+                consumeChunks(dataToConsume, remainingStreamingBytes, user, dataHandler);
                 if (isParsingInvalidChunkedEncoding(remainingStreamingBytes)) {
                     return {HTTP_ERROR_400_BAD_REQUEST, FULLPTR};
                 }
@@ -630,17 +914,17 @@ public:
                 }
             }
 
-        } else if (fallback.length()) {
-            unsigned int had = (unsigned int) fallback.length();
+        } else if (fallbackLength) {
+            unsigned int had = fallbackLength;
 
-            size_t maxCopyDistance = std::min<size_t>(MAX_FALLBACK_SIZE - fallback.length(), (size_t) length);
+            size_t maxCopyDistance = std::min<size_t>(MAX_FALLBACK_SIZE - fallbackLength, (size_t) length);
 
-            /* We don't want fallback to be short string optimized, since we want to move it */
-            fallback.reserve(fallback.length() + maxCopyDistance + std::max<unsigned int>(MINIMUM_HTTP_POST_PADDING, sizeof(std::string)));
-            fallback.append(data, maxCopyDistance);
+            /* The block always has room for post padding past MAX_FALLBACK_SIZE */
+            memcpy(fallback + fallbackLength, data, maxCopyDistance);
+            fallbackLength += (unsigned int) maxCopyDistance;
 
             // break here on break
-            std::pair<unsigned int, void *> consumed = fenceAndConsumePostPadded<true>(fallback.data(), (unsigned int) fallback.length(), user, reserved, &req, requestHandler, dataHandler);
+            std::pair<unsigned int, void *> consumed = fenceAndConsumePostPadded<true>(fallback, fallbackLength, user, reserved, &req, requestHandler, dataHandler);
             if (consumed.second != user) {
                 return consumed;
             }
@@ -650,7 +934,7 @@ public:
                 /* This logic assumes that we consumed everything in fallback buffer.
                  * This is critically important, as we will get an integer overflow in case
                  * of "had" being larger than what we consumed, and that we would drop data */
-                fallback.clear();
+                releaseFallback();
                 data += consumed.first - had;
                 length -= consumed.first - had;
 
@@ -658,9 +942,7 @@ public:
                     /* It's either chunked or with a content-length */
                     if (isParsingChunkedEncoding(remainingStreamingBytes)) {
                         std::string_view dataToConsume(data, length);
-                        for (auto chunk : uWS::ChunkIterator(&dataToConsume, &remainingStreamingBytes)) {
-                            dataHandler(user, chunk, chunk.length() == 0);
-                        }
+                        consumeChunks(dataToConsume, remainingStreamingBytes, user, dataHandler);
                         if (isParsingInvalidChunkedEncoding(remainingStreamingBytes)) {
                             return {HTTP_ERROR_400_BAD_REQUEST, FULLPTR};
                         }
@@ -688,7 +970,7 @@ public:
                 }
 
             } else {
-                if (fallback.length() == MAX_FALLBACK_SIZE) {
+                if (fallbackLength == MAX_FALLBACK_SIZE) {
                     return {HTTP_ERROR_431_REQUEST_HEADER_FIELDS_TOO_LARGE, FULLPTR};
                 }
                 return {0, user};
@@ -705,7 +987,9 @@ public:
 
         if (length) {
             if (length < MAX_FALLBACK_SIZE) {
-                fallback.append(data, length);
+                fallback = FallbackPool::get().acquire();
+                memcpy(fallback, data, length);
+                fallbackLength = length;
             } else {
                 return {HTTP_ERROR_431_REQUEST_HEADER_FIELDS_TOO_LARGE, FULLPTR};
             }
@@ -25,18 +25,33 @@
 #include "HttpContext.h"
 #include "HttpContextData.h"
 #include "Utilities.h"
+#include "PreparedResponse.h"
+#include "BodyCollector.h"
 
 #include "WebSocketExtensions.h"
 #include "WebSocketHandshake.h"
 #include "WebSocket.h"
 #include "WebSocketContextData.h"
+#include "EventStream.h"
 
 #include "MoveOnlyFunction.h"
+#include "Tracepoints.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
 
 /* todo: tryWrite is missing currently, only send smaller segments with write */
 
 namespace uWS {
 
+template <bool> struct HttpBodyAwaiter;
+template <bool> struct HttpWritableAwaiter;
+
 /* Some pre-defined status constants to use with writeStatus */
 static const char *HTTP_200_OK = "200 OK";
 
@@ -47,61 +62,243 @@ template <bool SSL>
 struct HttpResponse : public AsyncSocket<SSL> {
     /* Solely used for getHttpResponseData() */
     template <bool, typename> friend struct TemplatedAppBase;
+    template <bool> friend struct HttpContext;
+    template <bool S> friend bool sendEventFrame(Subscriber *s, std::string_view frame);
     typedef AsyncSocket<SSL> Super;
 private:
     HttpResponseData<SSL> *getHttpResponseData() {
         return (HttpResponseData<SSL> *) Super::getAsyncSocketData();
     }
 
-    /* Write an unsigned 32-bit integer in hex */
-    void writeUnsignedHex(unsigned int value) {
+    /* Hands what was copied into a reservation of the send buffer to the socket, as the reservation needs */
+    void releaseSendBuffer(SendBufferAttribute sendBufferAttribute) {
+        if (sendBufferAttribute == SendBufferAttribute::NEEDS_DRAIN) {
+            Super::write(nullptr, 0);
+        } else if (sendBufferAttribute == SendBufferAttribute::NEEDS_UNCORK) {
+            Super::uncork();
+        }
+    }
+
+    /* Writes pieces of the head with one reservation of the send buffer and one pass over it, rather than a
+     * write (and its checks) per piece */
+    void writeHead(std::initializer_list<std::string_view> pieces) {
+        /* Same as writing to a closed socket */
+        if (us_socket_is_closed(SSL, (us_socket_t *) this)) {
+            return;
+        }
+
+        size_t length = 0;
+        for (std::string_view piece : pieces) {
+            length += piece.length();
+        }
+
+        auto [sendBuffer, sendBufferAttribute] = Super::getSendBuffer(length);
+        for (std::string_view piece : pieces) {
+            if (piece.length()) {
+                memcpy(sendBuffer, piece.data(), piece.length());
+                sendBuffer += piece.length();
+            }
+        }
+
+        releaseSendBuffer(sendBufferAttribute);
+    }
+
+    /* The status line, unless written already (then empty). Written by whoever asks */
+    std::string_view takeStatusLine() {
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+        if (httpResponseData->state & HttpResponseData<SSL>::HTTP_STATUS_CALLED) {
+            return {};
+        }
+        httpResponseData->state |= HttpResponseData<SSL>::HTTP_STATUS_CALLED;
+        return "HTTP/1.1 200 OK\r\n";
+    }
+
+    /* Date is always written, once per request */
+    std::string_view getDate() {
+        return std::string_view(Super::getLoopData()->date, 29);
+    }
+
+    /* You can disable this altogether, we only expose major version */
+    std::string_view getMark() {
+#ifndef UWS_HTTPRESPONSE_NO_WRITEMARK
+        if (!Super::getLoopData()->noMark) {
+            return "uWebSockets: 20\r\n";
+        }
+#endif
+        return {};
+    }
+
+    /* Chunked: the first chunk ends the head, with status (if not yet written), date, mark and transfer-encoding,
+     * all in one reservation */
+    void writeChunkHead(size_t length) {
         /* Buf really only needs to be 8 long but building with
          * -mavx2, GCC still wants to overstep it so made it 16 */
         char buf[16];
-        int length = utils::u32toaHex(value, buf);
+        std::string_view hex(buf, (size_t) utils::u32toaHex((unsigned int) length, buf));
 
-        /* For now we do this copy */
-        Super::write(buf, length);
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+        /* Each chunk is hex CRLF data CRLF, the last CRLF written in front of the next head or the terminator. Only
+         * data is body */
+        httpResponseData->chunkedBytes += length;
+        if (!(httpResponseData->state & HttpResponseData<SSL>::HTTP_WRITE_CALLED)) {
+            httpResponseData->state |= HttpResponseData<SSL>::HTTP_WRITE_CALLED;
+            writeHead({takeStatusLine(), "Date: ", getDate(), "\r\n", getMark(), "Transfer-Encoding: chunked\r\n\r\n", hex, "\r\n"});
+        } else {
+            writeHead({"\r\n", hex, "\r\n"});
+        }
     }
 
-    /* Write an unsigned 64-bit integer */
-    void writeUnsigned64(uint64_t value) {
-        char buf[20];
-        int length = utils::u64toa(value, buf);
+    /* Write one chunk as is */
+    bool internalWrite(std::string_view data) {
+        if (Super::shedOverBackPressureBudget() == SHED_CLOSE) {
+            return false;
+        }
 
-        /* For now we do this copy */
-        Super::write(buf, length);
+        writeStatus(HTTP_200_OK);
+
+        /* Do not allow sending 0 chunks, they mark end of response */
+        if (!data.length()) {
+            /* If you called us, then according to you it was fine to call us so it's fine to still call us */
+            return true;
+        }
+
+        writeChunkHead(data.length());
+
+        auto [written, failed] = Super::write(data.data(), (int) data.length());
+        if (failed) {
+            Super::timeout(HTTP_TIMEOUT_S);
+        }
+
+        /* If we did not fail the write, accept more */
+        return !failed;
     }
 
-    /* Called only once per request */
-    void writeMark() {
-        /* Date is always written */
-        writeHeader("Date", std::string_view(((LoopData *) us_loop_ext(us_socket_context_loop(SSL, (us_socket_context(SSL, (us_socket_t *) this)))))->date, 29));
+    /* The body begins after compress(): Vary, and if compressing Content-Encoding and a stream to do it with */
+    bool beginCompression(bool compress) {
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
 
-        /* You can disable this altogether */
-#ifndef UWS_HTTPRESPONSE_NO_WRITEMARK
-        if (!Super::getLoopData()->noMark) {
-            /* We only expose major version */
-            writeHeader("uWebSockets", "20");
+        httpResponseData->state &= ~(HttpResponseData<SSL>::HTTP_COMPRESS_NEGOTIATED | HttpResponseData<SSL>::HTTP_COMPRESS_GZIP);
+        writeHeader("Vary", "Accept-Encoding");
+        if (!compress) {
+            return false;
         }
-#endif
+
+        writeHeader("Content-Encoding", "gzip");
+        httpResponseData->gzipLoopData = Super::getLoopData();
+        httpResponseData->gzipStream = httpResponseData->gzipLoopData->acquireGzipStream();
+        return true;
+    }
+
+    /* For bodies we send as they are, even after compress() */
+    void passCompression() {
+        if (getHttpResponseData()->state & HttpResponseData<SSL>::HTTP_COMPRESS_NEGOTIATED) {
+            beginCompression(false);
+        }
+    }
+
+    /* Compresses pieces, flushed as asked by the last one, into the buffer of the loop */
+    std::string_view compressPieces(std::span<const std::string_view> pieces, GzipStream::Flush flush) {
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+
+        std::string &out = httpResponseData->gzipLoopData->gzipBuffer;
+        out.clear();
+        for (size_t i = 0; i < pieces.size(); i++) {
+            httpResponseData->gzipStream->compress(pieces[i], i + 1 == pieces.size() ? flush : GzipStream::NO_FLUSH, out);
+        }
+        if (!pieces.size()) {
+            httpResponseData->gzipStream->compress({}, flush, out);
+        }
+        if (flush == GzipStream::FINISH) {
+            httpResponseData->releaseGzipStream();
+        }
+        return out;
+    }
+
+    /* Ends a body being compressed with pieces, whichever way it is ended */
+    bool endCompression(std::span<const std::string_view> pieces, bool closeConnection) {
+        std::string_view compressed = compressPieces(pieces, GzipStream::FINISH);
+        return internalEnd(compressed, compressed.length(), false, true, closeConnection);
     }
 
     /* Returns true on success, indicating that it might be feasible to write more data.
      * Will start timeout if stream reaches totalSize or write failure. */
     bool internalEnd(std::string_view data, uintmax_t totalSize, bool optional, bool allowContentLength = true, bool closeConnection = false) {
+        return internalEndPieces(std::span<const std::string_view>(&data, 1), totalSize, optional, allowContentLength, closeConnection);
+    }
+
+    /* Writes pieces of the body, one piece as is or many gathered (see AsyncSocket::write) */
+    std::pair<size_t, bool> writePieces(std::span<const std::string_view> pieces, bool optional) {
+        if (pieces.size() != 1) {
+            auto [written, failed] = Super::write(pieces, optional);
+            return {(size_t) written, failed};
+        }
+
+        /* uSockets only deals with int sizes, so pass chunks of max signed int size */
+        std::string_view data = pieces[0];
+        size_t written = 0;
+        bool failed = false;
+        while (written < data.length() && !failed) {
+            auto writtenFailed = Super::write(data.data() + written, (int) std::min<size_t>(data.length() - written, INT_MAX), optional);
+
+            written += (size_t) writtenFailed.first;
+            failed = writtenFailed.second;
+        }
+        return {written, failed};
+    }
+
+    /* Our subscriber while streaming events, or null */
+    Subscriber *getEventSubscriber() {
+        HttpResponseHandlers *handlers = getHttpResponseData()->handlers;
+        return handlers ? handlers->eventSubscriber : nullptr;
+    }
+
+    /* Writes what was published to our topics, unless over maxBackpressure (if any). Returns true if dropped */
+    bool sendPublishedEvent(std::string_view frame) {
+        unsigned int maxBackpressure = getHttpResponseData()->handlers->eventMaxBackpressure;
+        if (maxBackpressure && Super::getBufferedAmount() > maxBackpressure) {
+            return true;
+        }
+        internalWrite(frame);
+        return false;
+    }
+
+    /* Ends streaming events, as the response ends or the connection closes */
+    void releaseEventStream() {
+        if (Subscriber *s = getEventSubscriber()) {
+            HttpContext<SSL>::getSocketContextDataS((us_socket_t *) this)->topicTree->freeSubscriber(s);
+            getHttpResponseData()->handlers->eventSubscriber = nullptr;
+        }
+    }
+
+    bool internalEndPieces(std::span<const std::string_view> pieces, uintmax_t totalSize, bool optional, bool allowContentLength = true, bool closeConnection = false) {
+        UWS_TRACE(http__end, this, totalSize, closeConnection);
+
+        /* Ending the response ends its event stream */
+        releaseEventStream();
+
+        /* Responses cannot drop bytes, but we might be closed or paused while over the backpressure budget */
+        if (Super::shedOverBackPressureBudget() == SHED_CLOSE) {
+            return false;
+        }
+
         /* Write status if not already done */
         writeStatus(HTTP_200_OK);
 
+        size_t length = 0;
+        for (std::string_view piece : pieces) {
+            length += piece.length();
+        }
+
         /* If no total size given then assume this chunk is everything */
         if (!totalSize) {
-            totalSize = data.length();
+            totalSize = length;
         }
 
         HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
 
-        /* In some cases, such as when refusing huge data we want to close the connection when drained */
-        if (closeConnection) {
+        /* In some cases, such as when refusing huge data we want to close the connection when drained.
+         * Draining after a handoff, clients are to reconnect to our successor */
+        if (closeConnection || ((HttpContext<SSL> *) us_socket_context(SSL, (us_socket_t *) this))->getSocketContextData()->draining) {
 
             /* HTTP 1.1 must send this back unless the client already sent it to us.
              * It is a connection close when either of the two parties say so but the
@@ -120,13 +317,11 @@ private:
             /* We do not have tryWrite-like functionalities, so ignore optional in this path */
 
             /* Do not allow sending 0 chunk here */
-            if (data.length()) {
-                Super::write("\r\n", 2);
-                writeUnsignedHex((unsigned int) data.length());
-                Super::write("\r\n", 2);
+            if (length) {
+                writeChunkHead(length);
 
                 /* Ignoring optional for now */
-                Super::write(data.data(), (int) data.length());
+                writePieces(pieces, false);
             }
 
             /* Terminating 0 chunk */
@@ -138,11 +333,7 @@ private:
             if (!Super::isCorked()) {
                 if (httpResponseData->state & HttpResponseData<SSL>::HTTP_CONNECTION_CLOSE) {
                     if ((httpResponseData->state & HttpResponseData<SSL>::HTTP_RESPONSE_PENDING) == 0) {
-                        if (((AsyncSocket<SSL> *) this)->getBufferedAmount() == 0) {
-                            ((AsyncSocket<SSL> *) this)->shutdown();
-                            /* We need to force close after sending FIN since we want to hinder
-                                * clients from keeping to send their huge data */
-                            ((AsyncSocket<SSL> *) this)->close();
+                        if (((AsyncSocket<SSL> *) this)->closeIfDrained()) {
                             return true;
                         }
                     }
@@ -155,17 +346,15 @@ private:
         } else {
             /* Write content-length on first call */
             if (!(httpResponseData->state & HttpResponseData<SSL>::HTTP_END_CALLED)) {
-                /* Write mark, this propagates to WebSockets too */
-                writeMark();
-
-                /* WebSocket upgrades does not allow content-length */
+                /* Write status (if not yet written), date and mark in the same reservation, this propagates to
+                 * WebSockets too. WebSocket upgrades does not allow content-length */
                 if (allowContentLength) {
                     /* Even zero is a valid content-length */
-                    Super::write("Content-Length: ", 16);
-                    writeUnsigned64(totalSize);
-                    Super::write("\r\n\r\n", 4);
+                    char buf[20];
+                    std::string_view contentLength(buf, (size_t) utils::u64toa(totalSize, buf));
+                    writeHead({takeStatusLine(), "Date: ", getDate(), "\r\n", getMark(), "Content-Length: ", contentLength, "\r\n\r\n"});
                 } else {
-                    Super::write("\r\n", 2);
+                    writeHead({takeStatusLine(), "Date: ", getDate(), "\r\n", getMark(), "\r\n"});
                 }
 
                 /* Mark end called */
@@ -176,20 +365,12 @@ private:
              * if it failed to drain any prior failed header writes */
 
             /* Write as much as possible without causing backpressure */
-            size_t written = 0;
-            bool failed = false;
-            while (written < data.length() && !failed) {
-                /* uSockets only deals with int sizes, so pass chunks of max signed int size */
-                auto writtenFailed = Super::write(data.data() + written, (int) std::min<size_t>(data.length() - written, INT_MAX), optional);
-
-                written += (size_t) writtenFailed.first;
-                failed = writtenFailed.second;
-            }
+            auto [written, failed] = writePieces(pieces, optional);
 
             httpResponseData->offset += written;
 
             /* Success is when we wrote the entire thing without any failures */
-            bool success = written == data.length() && !failed;
+            bool success = written == length && !failed;
 
             /* If we are now at the end, start a timeout. Also start a timeout if we failed. */
             if (!success || httpResponseData->offset == totalSize) {
@@ -204,12 +385,7 @@ private:
                 if (!Super::isCorked()) {
                     if (httpResponseData->state & HttpResponseData<SSL>::HTTP_CONNECTION_CLOSE) {
                         if ((httpResponseData->state & HttpResponseData<SSL>::HTTP_RESPONSE_PENDING) == 0) {
-                            if (((AsyncSocket<SSL> *) this)->getBufferedAmount() == 0) {
-                                ((AsyncSocket<SSL> *) this)->shutdown();
-                                /* We need to force close after sending FIN since we want to hinder
-                                * clients from keeping to send their huge data */
-                                ((AsyncSocket<SSL> *) this)->close();
-                            }
+                            ((AsyncSocket<SSL> *) this)->closeIfDrained();
                         }
                     }
                 }
@@ -219,6 +395,67 @@ private:
         }
     }
 
+#ifndef _WIN32
+    /* Sends the body from the file, at start plus what we already sent, until length. Uses sendfile(2) for
+     * cleartext on Linux (unless uSockets uses io_uring) and pread otherwise. Returns false on backpressure or error (then we are closed). */
+    bool pumpFile(int fd, uintmax_t start, uintmax_t length) {
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+
+        /* Anything corked or buffered, such as our headers, goes first */
+        if (Super::isCorked() && Super::uncork().second) {
+            return false;
+        }
+        if (Super::write(nullptr, 0).second) {
+            return false;
+        }
+
+        while (httpResponseData->offset < length) {
+            uintmax_t remaining = length - httpResponseData->offset;
+
+#if defined(__linux__) && !defined(UWS_NO_DIRECT_SOCKET_IO)
+            if constexpr (!SSL) {
+                off_t position = (off_t) (start + httpResponseData->offset);
+                ssize_t sent = sendfile((int) (intptr_t) Super::getNativeHandle(), fd, &position, (size_t) std::min<uintmax_t>(remaining, 1 << 30));
+                if (sent > 0) {
+                    httpResponseData->offset += (uintmax_t) sent;
+                    Super::getLoopData()->metrics.bytesOut.add((unsigned long long) sent);
+                    continue;
+                }
+                if (sent < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (sent == 0 || errno != EAGAIN) {
+                    /* The file is shorter than we said, or broken */
+                    Super::close();
+                    return false;
+                }
+                /* uSockets only polls for writable once one of its own writes fail, so let the next block do that */
+            }
+#endif
+
+            static thread_local char block[LoopData::CORK_BUFFER_SIZE];
+            ssize_t bytes = pread(fd, block, (size_t) std::min<uintmax_t>(remaining, sizeof(block)), (off_t) (start + httpResponseData->offset));
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes <= 0) {
+                Super::close();
+                return false;
+            }
+
+            /* Optionally, so that nothing is buffered. We return here for the rest when writable */
+            auto [written, failed] = Super::write(block, (int) bytes, true);
+            httpResponseData->offset += (uintmax_t) written;
+            if (failed) {
+                Super::timeout(HTTP_TIMEOUT_S);
+                return false;
+            }
+        }
+
+        return true;
+    }
+#endif
+
 public:
     /* If we have proxy support; returns the proxed source address as reported by the proxy. */
 #ifdef UWS_WITH_PROXY
@@ -237,18 +474,22 @@ public:
     void upgrade(UserData &&userData, std::string_view secWebSocketKey, std::string_view secWebSocketProtocol,
             std::string_view secWebSocketExtensions,
             struct us_socket_context_t *webSocketContext) {
+#ifdef UWS_NO_WEBSOCKET_UPGRADE
+        static_assert(sizeof(UserData) && false, "HttpResponse::upgrade is compiled out by UWS_NO_WEBSOCKET_UPGRADE");
+#endif
 
         /* Extract needed parameters from WebSocketContextData */
         WebSocketContextData<SSL, UserData> *webSocketContextData = (WebSocketContextData<SSL, UserData> *) us_socket_context_ext(SSL, webSocketContext);
 
-        /* Note: OpenSSL can be used here to speed this up somewhat */
-        char secWebSocketAccept[29] = {};
+        /* Hardware SHA1 where we have it, the head up to here goes in one reservation */
+        char secWebSocketAccept[28];
         WebSocketHandshake::generate(secWebSocketKey.data(), secWebSocketAccept);
 
-        writeStatus("101 Switching Protocols")
-            ->writeHeader("Upgrade", "websocket")
-            ->writeHeader("Connection", "Upgrade")
-            ->writeHeader("Sec-WebSocket-Accept", secWebSocketAccept);
+        writeHeaders("101 Switching Protocols", {
+            {"Upgrade", "websocket"},
+            {"Connection", "Upgrade"},
+            {"Sec-WebSocket-Accept", std::string_view(secWebSocketAccept, 28)}
+        });
 
         /* Select first subprotocol if present */
         if (secWebSocketProtocol.length()) {
@@ -306,6 +547,9 @@ public:
         /* Grab the httpContext from res */
         HttpContext<SSL> *httpContext = (HttpContext<SSL> *) us_socket_context(SSL, (struct us_socket_t *) this);
 
+        /* Flush our cork slice, if any, it does not survive the socket being adopted */
+        Super::flushCorkSlice();
+
         /* Move any backpressure out of HttpResponse */
         BackPressure backpressure(std::move(((AsyncSocketData<SSL> *) getHttpResponseData())->buffer));
 
@@ -326,6 +570,7 @@ public:
 
         /* Initialize websocket with any moved backpressure intact */
         webSocket->init(perMessageDeflate, compressOptions, std::move(backpressure));
+        ((LoopData *) us_loop_ext(us_socket_context_loop(SSL, (us_socket_context_t *) webSocketContext)))->webSockets.fetch_add(1, std::memory_order_relaxed);
 
         /* We should only mark this if inside the parser; if upgrading "async" we cannot set this */
         HttpContextData<SSL> *httpContextData = httpContext->getSocketContextData();
@@ -334,17 +579,15 @@ public:
             httpContextData->upgradedWebSocket = webSocket;
         }
 
-        /* Arm maxLifetime timeout */
-        us_socket_long_timeout(SSL, (us_socket_t *) webSocket, webSocketContextData->maxLifetime);
-
-        /* Arm idleTimeout */
-        us_socket_timeout(SSL, (us_socket_t *) webSocket, webSocketContextData->idleTimeoutComponents.first);
+        /* Arm idleTimeout and maxLifetime */
+        WebSocketContext<SSL, true, UserData>::startTimers(webSocket);
 
         /* Move construct the UserData right before calling open handler */
         new (webSocket->getUserData()) UserData(std::move(userData));
 
         /* Emit open event and start the timeout */
         if (webSocketContextData->openHandler) {
+            ProfiledHandler profiled(((LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) webSocket))))->profile.get(), "open", &webSocketContextData->pattern);
             webSocketContextData->openHandler(webSocket);
         }
     }
@@ -391,36 +634,66 @@ public:
         /* Update status */
         httpResponseData->state |= HttpResponseData<SSL>::HTTP_STATUS_CALLED;
 
-        Super::write("HTTP/1.1 ", 9);
-        Super::write(status.data(), (int) status.length());
-        Super::write("\r\n", 2);
+        writeHead({"HTTP/1.1 ", status, "\r\n"});
         return this;
     }
 
-    /* Write an HTTP header with string value */
+    /* Write an HTTP header with string value (with the status line, if not yet written) */
     HttpResponse *writeHeader(std::string_view key, std::string_view value) {
-        writeStatus(HTTP_200_OK);
-
-        Super::write(key.data(), (int) key.length());
-        Super::write(": ", 2);
-        Super::write(value.data(), (int) value.length());
-        Super::write("\r\n", 2);
+        writeHead({takeStatusLine(), key, ": ", value, "\r\n"});
         return this;
     }
 
     /* Write an HTTP header with unsigned int value */
     HttpResponse *writeHeader(std::string_view key, uint64_t value) {
-        writeStatus(HTTP_200_OK);
+        char buf[20];
+        writeHead({takeStatusLine(), key, ": ", std::string_view(buf, (size_t) utils::u64toa(value, buf)), "\r\n"});
+        return this;
+    }
+
+    /* Write the status (unless written already) and any number of headers with one reservation of the send buffer */
+    HttpResponse *writeHeaders(std::string_view status, std::initializer_list<std::pair<std::string_view, std::string_view>> headers) {
+        /* Same as writing to a closed socket */
+        if (us_socket_is_closed(SSL, (us_socket_t *) this)) {
+            return this;
+        }
+
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+        bool withStatus = !(httpResponseData->state & HttpResponseData<SSL>::HTTP_STATUS_CALLED);
+        httpResponseData->state |= HttpResponseData<SSL>::HTTP_STATUS_CALLED;
+
+        size_t length = withStatus ? status.length() + 11 : 0;
+        for (auto &[key, value] : headers) {
+            length += key.length() + value.length() + 4;
+        }
+
+        auto [sendBuffer, sendBufferAttribute] = Super::getSendBuffer(length);
+        if (withStatus) {
+            memcpy(sendBuffer, "HTTP/1.1 ", 9);
+            memcpy(sendBuffer + 9, status.data(), status.length());
+            memcpy(sendBuffer + 9 + status.length(), "\r\n", 2);
+            sendBuffer += status.length() + 11;
+        }
+        for (auto &[key, value] : headers) {
+            memcpy(sendBuffer, key.data(), key.length());
+            memcpy(sendBuffer + key.length(), ": ", 2);
+            memcpy(sendBuffer + key.length() + 2, value.data(), value.length());
+            memcpy(sendBuffer + key.length() + 2 + value.length(), "\r\n", 2);
+            sendBuffer += key.length() + value.length() + 4;
+        }
 
-        Super::write(key.data(), (int) key.length());
-        Super::write(": ", 2);
-        writeUnsigned64(value);
-        Super::write("\r\n", 2);
+        releaseSendBuffer(sendBufferAttribute);
         return this;
     }
 
     /* End without a body (no content-length) or end with a spoofed content-length. */
     void endWithoutBody(std::optional<size_t> reportedContentLength = std::nullopt, bool closeConnection = false) {
+        passCompression();
+        /* A written body being compressed is chunked, there is no length to report */
+        if (getHttpResponseData()->gzipStream) {
+            endCompression({}, closeConnection);
+            return;
+        }
         if (reportedContentLength.has_value()) {
             internalEnd({nullptr, 0}, reportedContentLength.value(), false, true, closeConnection);
         } else {
@@ -430,40 +703,227 @@ public:
 
     /* End the response with an optional data chunk. Always starts a timeout. */
     void end(std::string_view data = {}, bool closeConnection = false) {
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+
+        /* Too small, or not likely to get any smaller, goes as is */
+        if (httpResponseData->state & HttpResponseData<SSL>::HTTP_COMPRESS_NEGOTIATED) {
+            beginCompression((httpResponseData->state & HttpResponseData<SSL>::HTTP_COMPRESS_GZIP) && data.length() >= httpResponseData->compressMinSize && !looksIncompressible(data));
+        }
+        if (httpResponseData->gzipStream) {
+            endCompression(std::span<const std::string_view>(&data, 1), closeConnection);
+            return;
+        }
         internalEnd(data, data.length(), false, true, closeConnection);
     }
 
+    /* Opts this response in to gzip, if req accepts it (and zlib is there). Bodies ended in one go are compressed
+     * if at least minSize bytes and not looking incompressible. Written ones are compressed as they go, flushed
+     * every write. tryEnd, sendFile and prepared bodies go out as they are, unless ending what a write began compressing.
+     * Call before the body begins */
+    HttpResponse *compress(HttpRequest *req, unsigned int minSize = 256) {
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+
+        if (!GzipStream::AVAILABLE || (httpResponseData->state & (HttpResponseData<SSL>::HTTP_WRITE_CALLED | HttpResponseData<SSL>::HTTP_END_CALLED))) {
+            return this;
+        }
+        httpResponseData->state |= HttpResponseData<SSL>::HTTP_COMPRESS_NEGOTIATED;
+        if (utils::acceptedCodings(req->getHeader("accept-encoding")) & utils::CODING_GZIP) {
+            httpResponseData->state |= HttpResponseData<SSL>::HTTP_COMPRESS_GZIP;
+            httpResponseData->compressMinSize = minSize;
+        }
+        return this;
+    }
+
+    /* End the response with a PreparedResponse. If nothing has been written yet this is a
+     * single copy of the prepared bytes with the cached Date patched in. Always starts a timeout. */
+    void end(const PreparedResponse &preparedResponse) {
+        passCompression();
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+
+        /* Headers went out with an earlier write or end, only the body can follow as they did */
+        if (httpResponseData->state & (HttpResponseData<SSL>::HTTP_WRITE_CALLED | HttpResponseData<SSL>::HTTP_END_CALLED)) {
+            std::string_view body = preparedResponse.getBody();
+            if (httpResponseData->gzipStream) {
+                endCompression(std::span<const std::string_view>(&body, 1), false);
+            } else {
+                internalEnd(body, body.length(), false);
+            }
+            return;
+        }
+
+        /* Status or headers already written, take the slow path with what we have */
+        if (httpResponseData->state & HttpResponseData<SSL>::HTTP_STATUS_CALLED) {
+            std::string_view headers = preparedResponse.getHeaders();
+            Super::write(headers.data(), (int) headers.length());
+            internalEnd(preparedResponse.getBody(), preparedResponse.getBody().length(), false);
+            return;
+        }
+
+        LoopData *loopData = Super::getLoopData();
+        bool withMark = !loopData->noMark;
+        auto [sendBuffer, sendBufferAttribute] = Super::getSendBuffer(preparedResponse.length(withMark));
+        preparedResponse.copyTo(sendBuffer, loopData->date, withMark);
+
+        httpResponseData->state |= HttpResponseData<SSL>::HTTP_STATUS_CALLED | HttpResponseData<SSL>::HTTP_END_CALLED;
+        httpResponseData->offset = preparedResponse.getBody().length();
+        httpResponseData->markDone();
+
+        releaseSendBuffer(sendBufferAttribute);
+        Super::timeout(HTTP_TIMEOUT_S);
+
+        /* We need to check if we should close this socket here now */
+        if (!Super::isCorked()) {
+            if (httpResponseData->state & HttpResponseData<SSL>::HTTP_CONNECTION_CLOSE) {
+                ((AsyncSocket<SSL> *) this)->closeIfDrained();
+            }
+        }
+    }
+
+    /* End the response with a shared body. Whatever does not make it out right away is queued by reference
+     * instead of by copy (except for SSL, which has to encrypt it). Always starts a timeout. */
+    void end(const SharedBuffer &body, bool closeConnection = false) {
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+
+        /* Compressing is copying anyways */
+        if (httpResponseData->state & HttpResponseData<SSL>::HTTP_COMPRESS_GZIP || httpResponseData->gzipStream) {
+            end(body.view(), closeConnection);
+            return;
+        }
+        passCompression();
+
+        /* Empty, chunked or resumed bodies take the regular path */
+        if (!body.length() || (httpResponseData->state & (HttpResponseData<SSL>::HTTP_WRITE_CALLED | HttpResponseData<SSL>::HTTP_END_CALLED))) {
+            internalEnd(body.view(), body.length(), false, true, closeConnection);
+            return;
+        }
+
+        /* Status and headers, with the length of what follows (failing only if that got us closed) */
+        internalEnd({}, body.length(), false, true, closeConnection);
+        if (us_socket_is_closed(SSL, (us_socket_t *) this)) {
+            return;
+        }
+
+        Super::write(body);
+        httpResponseData->offset += body.length();
+        Super::timeout(HTTP_TIMEOUT_S);
+        httpResponseData->markDone();
+
+        /* We need to check if we should close this socket here now */
+        if (!Super::isCorked()) {
+            if (httpResponseData->state & HttpResponseData<SSL>::HTTP_CONNECTION_CLOSE) {
+                if ((httpResponseData->state & HttpResponseData<SSL>::HTTP_RESPONSE_PENDING) == 0) {
+                    ((AsyncSocket<SSL> *) this)->closeIfDrained();
+                }
+            }
+        }
+    }
+
     /* Try and end the response. Returns [true, true] on success.
      * Starts a timeout in some cases. Returns [ok, hasResponded] */
     std::pair<bool, bool> tryEnd(std::string_view data, uintmax_t totalSize = 0, bool closeConnection = false) {
+        passCompression();
+        /* Chunked after a compressed write, which cannot fail and has no total size */
+        if (getHttpResponseData()->gzipStream) {
+            return {endCompression(std::span<const std::string_view>(&data, 1), closeConnection), hasResponded()};
+        }
         return {internalEnd(data, totalSize, true, true, closeConnection), hasResponded()};
     }
 
+    /* Ends the response with a body made of many pieces, without joining them */
+    void end(std::span<const std::string_view> pieces, bool closeConnection = false) {
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+
+        if (httpResponseData->state & HttpResponseData<SSL>::HTTP_COMPRESS_NEGOTIATED) {
+            size_t length = 0;
+            for (std::string_view piece : pieces) {
+                length += piece.length();
+            }
+            beginCompression((httpResponseData->state & HttpResponseData<SSL>::HTTP_COMPRESS_GZIP) && length >= httpResponseData->compressMinSize);
+        }
+        if (httpResponseData->gzipStream) {
+            endCompression(pieces, closeConnection);
+            return;
+        }
+        internalEndPieces(pieces, 0, false, true, closeConnection);
+    }
+
+    /* Like tryEnd, with a body made of many pieces. On failure, resume from getWriteOffset() like with tryEnd */
+    std::pair<bool, bool> tryEnd(std::span<const std::string_view> pieces, uintmax_t totalSize = 0, bool closeConnection = false) {
+        passCompression();
+        if (getHttpResponseData()->gzipStream) {
+            return {endCompression(pieces, closeConnection), hasResponded()};
+        }
+        return {internalEndPieces(pieces, totalSize, true, true, closeConnection), hasResponded()};
+    }
+
     /* Write parts of the response in chunking fashion. Starts timeout if failed. */
     bool write(std::string_view data) {
+        return write(std::span<const std::string_view>(&data, 1));
+    }
+
+    /* Write many pieces as one chunk, without joining them */
+    bool write(std::span<const std::string_view> pieces) {
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+
+        if (httpResponseData->state & HttpResponseData<SSL>::HTTP_COMPRESS_NEGOTIATED) {
+            beginCompression(httpResponseData->state & HttpResponseData<SSL>::HTTP_COMPRESS_GZIP);
+        }
+        if (httpResponseData->gzipStream) {
+            return internalWrite(compressPieces(pieces, GzipStream::SYNC_FLUSH));
+        }
+        if (pieces.size() == 1) {
+            return internalWrite(pieces[0]);
+        }
+
+        if (Super::shedOverBackPressureBudget() == SHED_CLOSE) {
+            return false;
+        }
+
         writeStatus(HTTP_200_OK);
 
-        /* Do not allow sending 0 chunks, they mark end of response */
-        if (!data.length()) {
-            /* If you called us, then according to you it was fine to call us so it's fine to still call us */
+        size_t length = 0;
+        for (std::string_view piece : pieces) {
+            length += piece.length();
+        }
+
+        if (!length) {
             return true;
         }
 
+        writeChunkHead(length);
+
+        auto [written, failed] = Super::write(pieces);
+        if (failed) {
+            Super::timeout(HTTP_TIMEOUT_S);
+        }
+
+        /* If we did not fail the write, accept more */
+        return !failed;
+    }
+
+    /* Write a shared buffer as one chunk. Any part of it that ends up as backpressure references the buffer
+     * instead of copying it (except for SSL, which has to encrypt it) */
+    bool write(const SharedBuffer &data) {
         HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
 
-        if (!(httpResponseData->state & HttpResponseData<SSL>::HTTP_WRITE_CALLED)) {
-            /* Write mark on first call to write */
-            writeMark();
+        if (httpResponseData->state & HttpResponseData<SSL>::HTTP_COMPRESS_GZIP || httpResponseData->gzipStream) {
+            return write(data.view());
+        }
+        passCompression();
 
-            writeHeader("Transfer-Encoding", "chunked");
-            httpResponseData->state |= HttpResponseData<SSL>::HTTP_WRITE_CALLED;
+        if (Super::shedOverBackPressureBudget() == SHED_CLOSE) {
+            return false;
         }
 
-        Super::write("\r\n", 2);
-        writeUnsignedHex((unsigned int) data.length());
-        Super::write("\r\n", 2);
+        writeStatus(HTTP_200_OK);
 
-        auto [written, failed] = Super::write(data.data(), (int) data.length());
+        if (!data.length()) {
+            return true;
+        }
+
+        writeChunkHead(data.length());
+
+        auto [written, failed] = Super::write(data);
         if (failed) {
             Super::timeout(HTTP_TIMEOUT_S);
         }
@@ -531,12 +991,7 @@ public:
             HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
             if (httpResponseData->state & HttpResponseData<SSL>::HTTP_CONNECTION_CLOSE) {
                 if ((httpResponseData->state & HttpResponseData<SSL>::HTTP_RESPONSE_PENDING) == 0) {
-                    if (((AsyncSocket<SSL> *) this)->getBufferedAmount() == 0) {
-                        ((AsyncSocket<SSL> *) this)->shutdown();
-                        /* We need to force close after sending FIN since we want to hinder
-                        * clients from keeping to send their huge data */
-                        ((AsyncSocket<SSL> *) this)->close();
-                    }
+                    ((AsyncSocket<SSL> *) this)->closeIfDrained();
                 }
             }
         } else {
@@ -547,32 +1002,227 @@ public:
         return this;
     }
 
+#ifndef _WIN32
+    /* Ends the response with length bytes of the open file fd, from offset, with Content-Length. Cleartext sockets
+     * use sendfile(2) on Linux, no bytes pass through user space. Backpressure is handled through onWritable,
+     * which must not be replaced until done. The fd must stay open until hasResponded() or onAborted. */
+    HttpResponse *sendFile(int fd, uintmax_t offset, uintmax_t length) {
+        passCompression();
+        /* Status (unless already written), headers and Content-Length, corked so that they go out together.
+         * Nothing may be held in the cork buffer once the kernel sends from the file, so pumpFile uncorks */
+        bool corked = !Super::isCorked() && Super::canCork();
+        if (corked) {
+            Super::cork();
+        }
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+        internalEnd({nullptr, 0}, length, true);
+        if (!length) {
+            if (corked) {
+                Super::uncork();
+            }
+            return this;
+        }
+
+        if (pumpFile(fd, offset, length)) {
+            internalEnd({nullptr, 0}, length, false);
+        } else if (!us_socket_is_closed(SSL, (us_socket_t *) this)) {
+            httpResponseData->getHandlers(Super::getLoopData()).onWritable = [this, fd, offset, length](uintmax_t) {
+                if (!pumpFile(fd, offset, length)) {
+                    return false;
+                }
+                /* Marks us done, timeouts and closes if we should */
+                internalEnd({nullptr, 0}, length, false);
+                return true;
+            };
+        }
+        return this;
+    }
+
+    /* Ends the response with the file fd of fileSize bytes, or the byte range asked for by range (the value
+     * of the Range header, if any) as 206 Partial Content, or with 416 if the range cannot be satisfied. */
+    HttpResponse *sendFile(int fd, uintmax_t fileSize, std::string_view range) {
+        uint64_t first = 0, last = 0;
+        switch (utils::parseByteRange(range, fileSize, first, last)) {
+            case utils::RANGE_NOT_SATISFIABLE: {
+                char contentRange[32] = "bytes */";
+                int length = 8 + utils::u64toa(fileSize, contentRange + 8);
+                writeStatus("416 Range Not Satisfiable");
+                writeHeader("Content-Range", std::string_view(contentRange, (size_t) length));
+                internalEnd({nullptr, 0}, 0, false);
+                return this;
+            }
+            case utils::RANGE_SATISFIABLE: {
+                char contentRange[80] = "bytes ";
+                int length = 6 + utils::u64toa(first, contentRange + 6);
+                contentRange[length++] = '-';
+                length += utils::u64toa(last, contentRange + length);
+                contentRange[length++] = '/';
+                length += utils::u64toa(fileSize, contentRange + length);
+                writeStatus("206 Partial Content");
+                writeHeader("Accept-Ranges", "bytes");
+                writeHeader("Content-Range", std::string_view(contentRange, (size_t) length));
+                return sendFile(fd, first, last - first + 1);
+            }
+            default:
+                writeHeader("Accept-Ranges", "bytes");
+                return sendFile(fd, 0, fileSize);
+        }
+    }
+#endif
+
     /* Attach handler for writable HTTP response */
-    HttpResponse *onWritable(MoveOnlyFunction<bool(uintmax_t)> &&handler) {
+    HttpResponse *onWritable(ResponseHandler<bool(uintmax_t)> &&handler) {
         HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
 
-        httpResponseData->onWritable = std::move(handler);
+        /* Resetting takes no side block */
+        if (handler || httpResponseData->handlers) {
+            httpResponseData->getHandlers(Super::getLoopData()).onWritable = std::move(handler);
+        }
         return this;
     }
 
     /* Attach handler for aborted HTTP request */
-    HttpResponse *onAborted(MoveOnlyFunction<void()> &&handler) {
+    HttpResponse *onAborted(ResponseHandler<void()> &&handler) {
         HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
 
-        httpResponseData->onAborted = std::move(handler);
+        if (handler || httpResponseData->handlers) {
+            httpResponseData->getHandlers(Super::getLoopData()).onAborted = std::move(handler);
+        }
+        return this;
+    }
+
+    /* Runs task on the task pool of the loop, then continuation(res, result) on the loop, corked. The
+     * continuation is skipped if the request was aborted or responded to in the meantime, and so is the
+     * task if it has not started yet. Returns false if the pool is full, to respond with 503 or similar */
+    template <typename Task, typename Continuation>
+    bool offload(Task &&task, Continuation &&continuation) {
+        HttpResponseHandlers &handlers = getHttpResponseData()->getHandlers(Super::getLoopData());
+
+        if (!handlers.taskToken) {
+            handlers.taskToken = std::make_shared<TaskToken>();
+        }
+        /* Waiting on a task is responding later, the token is what keeps us safe from aborts */
+        if (!handlers.onAborted) {
+            handlers.onAborted = []() {};
+        }
+
+        Loop *loop = (Loop *) us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) this));
+        return loop->offload(std::forward<Task>(task), [this, continuation = std::forward<Continuation>(continuation)](auto &&... result) mutable {
+            cork([&]() {
+                continuation(this, std::forward<decltype(result)>(result)...);
+            });
+        }, handlers.taskToken);
+    }
+
+    /* Streams Server-Sent Events (text/event-stream) from here on: 200 with the headers for it, then what is sent
+     * with sendEvent and what is published to the topics subscribed to, as data events. The stream stays open
+     * until end() or an abort. Published messages reaching it while it has more than maxBackpressure bytes
+     * buffered are dropped for it, as for a WebSocket (0 is unlimited, as there). Needs the TopicTree of the App,
+     * see App::eventStream */
+    HttpResponse *startEventStream(unsigned int maxBackpressure = 64 * 1024) {
+        HttpContextData<SSL> *httpContextData = HttpContext<SSL>::getSocketContextDataS((us_socket_t *) this);
+        if (!httpContextData->topicTree) {
+            std::cerr << "Error: HttpResponse::startEventStream needs a TopicTree, see App::eventStream!" << std::endl;
+            std::terminate();
+        }
+
+        HttpResponseHandlers &handlers = getHttpResponseData()->getHandlers(Super::getLoopData());
+        if (handlers.eventSubscriber) {
+            return this;
+        }
+        handlers.eventSubscriber = httpContextData->topicTree->createSubscriber();
+        handlers.eventSubscriber->user = this;
+        handlers.eventSubscriber->kind = SUBSCRIBER_EVENT_STREAM;
+        handlers.eventMaxBackpressure = maxBackpressure;
+
+        /* Streaming is responding later, an abort only ends the stream */
+        if (!handlers.onAborted) {
+            handlers.onAborted = []() {};
+        }
+
+        writeStatus(HTTP_200_OK);
+        writeHeader("Content-Type", "text/event-stream");
+        writeHeader("Cache-Control", "no-cache");
+
+        /* A comment, so that the head goes out and the client sees the stream open */
+        internalWrite(":\n\n");
         return this;
     }
 
+    /* Subscribes the event stream to topic. Returns false if not streaming events */
+    bool subscribe(std::string_view topic) {
+        Subscriber *s = getEventSubscriber();
+        if (!s) {
+            return false;
+        }
+        HttpContext<SSL>::getSocketContextDataS((us_socket_t *) this)->topicTree->subscribe(s, topic);
+        return true;
+    }
+
+    /* Unsubscribes the event stream from topic. Returns false if it was not subscribed */
+    bool unsubscribe(std::string_view topic) {
+        Subscriber *s = getEventSubscriber();
+        if (!s) {
+            return false;
+        }
+        return std::get<0>(HttpContext<SSL>::getSocketContextDataS((us_socket_t *) this)->topicTree->unsubscribe(s, topic));
+    }
+
+    /* Sends one event to this stream alone, with optional event type and id (the client's Last-Event-ID when it
+     * reconnects). Unlike published messages it is never dropped. Returns false on backpressure */
+    bool sendEvent(std::string_view data, std::string_view event = {}, std::string_view id = {}) {
+        std::string frame;
+        frameEvent(frame, data, event, id);
+        return internalWrite(frame);
+    }
+
+#if defined(__cpp_impl_coroutine)
+    /* co_await in a Task for the whole body of the request, instead of onData (see Coroutine.h) */
+    HttpBodyAwaiter<SSL> body() {
+        return {this};
+    }
+
+    /* co_await in a Task until backpressure drained, for the offset to resume from like with onWritable */
+    HttpWritableAwaiter<SSL> writable() {
+        return {this, Super::getBufferedAmount() == 0};
+    }
+#endif
+
+    /* Collects the body of the request into one piece for handler, of at most maxBytes or else answered with 413 and
+     * closed (handler never called) as soon as Content-Length tells, or the chunks add up to, that much. A body that
+     * arrived in one read is handed over where it lies, without a copy. Others are collected in a buffer pooled by
+     * the loop, reserved up front from Content-Length. The piece is only valid within handler. Attach onAborted as
+     * with onData, which this replaces */
+    void collectBody(size_t maxBytes, MoveOnlyFunction<void(std::string_view)> &&handler) {
+        HttpResponseData<SSL> *httpResponseData = getHttpResponseData();
+        LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) this)));
+
+        onData([this, httpResponseData, loopData, handler = std::move(handler), collector = BodyCollector(maxBytes)](std::string_view chunk, bool fin) mutable {
+            /* Remaining is as of before the first chunk is taken off of it */
+            if (!collector.collect(loopData, httpResponseData->getRemainingBodyLength(), chunk, fin, handler)) {
+                writeStatus("413 Payload Too Large")->end(std::string_view(), true);
+            }
+        });
+    }
+
     /* Attach a read handler for data sent. Will be called with FIN set true if last segment. */
-    void onData(MoveOnlyFunction<void(std::string_view, bool)> &&handler) {
+    void onData(ResponseHandler<void(std::string_view, bool)> &&handler) {
         HttpResponseData<SSL> *data = getHttpResponseData();
-        data->inStream = std::move(handler);
+        if (handler || data->handlers) {
+            data->getHandlers(Super::getLoopData()).inStream = std::move(handler);
+        }
 
         /* Always reset this counter here */
         data->received_bytes_per_timeout = 0;
     }
 };
 
+/* Declared by EventStream.h, for what is published to an event stream */
+template <bool SSL>
+bool sendEventFrame(Subscriber *s, std::string_view frame) {
+    return ((HttpResponse<SSL> *) s->user)->sendPublishedEvent(frame);
+}
+
 }
 
 #endif // UWS_HTTPRESPONSE_H
@@ -23,41 +23,139 @@
 #include "HttpParser.h"
 #include "AsyncSocketData.h"
 #include "ProxyParser.h"
+#include "RouteMetrics.h"
 
 #include "MoveOnlyFunction.h"
+#include "TaskPool.h"
+
+#include <memory>
 
 namespace uWS {
 
+struct Subscriber;
+
+/* Handlers of the request in flight and what it offloaded, in a side block taken from the loop on first use
+ * and given back once the response is done. Idle keep-alive connections do not carry any of it */
+struct HttpResponseHandlers {
+    ResponseHandler<bool(uintmax_t)> onWritable;
+    ResponseHandler<void()> onAborted;
+    ResponseHandler<void(std::string_view, bool)> inStream; // onData
+    /* Shared with tasks offloaded by this request, if any */
+    std::shared_ptr<TaskToken> taskToken;
+    /* Of the TopicTree, while streaming events (see HttpResponse::startEventStream) */
+    Subscriber *eventSubscriber = nullptr;
+    unsigned int eventMaxBackpressure = 0;
+
+    bool empty() {
+        return !onWritable && !onAborted && !inStream && !taskToken && !eventSubscriber;
+    }
+};
+
 template <bool SSL>
 struct HttpResponseData : AsyncSocketData<SSL>, HttpParser {
     template <bool> friend struct HttpResponse;
     template <bool> friend struct HttpContext;
 
+    /* Our handlers, taken from the side blocks of loopData if we have none yet */
+    HttpResponseHandlers &getHandlers(LoopData *loopData) {
+        if (!handlers) {
+            if constexpr (sizeof(HttpResponseHandlers) <= LoopData::SIDE_BLOCK_SIZE) {
+                handlers = new (loopData->sideBlocks.allocate()) HttpResponseHandlers;
+            } else {
+                handlers = new HttpResponseHandlers;
+            }
+        }
+        return *handlers;
+    }
+
+    /* Gives the side block back once nothing is left in it (or right away, as we go) */
+    void releaseHandlers(bool force = false) {
+        if (handlers && (force || handlers->empty())) {
+            if constexpr (sizeof(HttpResponseHandlers) <= LoopData::SIDE_BLOCK_SIZE) {
+                handlers->~HttpResponseHandlers();
+                SlabPool::free(handlers);
+            } else {
+                delete handlers;
+            }
+            handlers = nullptr;
+        }
+    }
+
+    /* Null checked access to the handlers, for those who only look */
+    ResponseHandler<bool(uintmax_t)> *getOnWritable() {
+        return handlers && handlers->onWritable ? &handlers->onWritable : nullptr;
+    }
+
+    ResponseHandler<void()> *getOnAborted() {
+        return handlers && handlers->onAborted ? &handlers->onAborted : nullptr;
+    }
+
+    ResponseHandler<void(std::string_view, bool)> *getInStream() {
+        return handlers && handlers->inStream ? &handlers->inStream : nullptr;
+    }
+
     /* When we are done with a response we mark it like so */
     void markDone() {
-        onAborted = nullptr;
-        /* Also remove onWritable so that we do not emit when draining behind the scenes. */
-        onWritable = nullptr;
+        if (handlers) {
+            handlers->onAborted = nullptr;
+            /* Also remove onWritable so that we do not emit when draining behind the scenes. */
+            handlers->onWritable = nullptr;
+        }
 
         /* We are done with this request */
         state &= ~HttpResponseData<SSL>::HTTP_RESPONSE_PENDING;
+        if (routeMetrics) {
+            routeMetrics->end((uint64_t) (LoopData::now() - routeMatchedAt), offset + chunkedBytes);
+            routeMetrics = nullptr;
+        }
+        chunkedBytes = 0;
+
+        /* What it offloaded must not touch the next one, nor may its coroutines be aborted by it */
+        cancelTasks();
+        this->detachCoroutines();
+        releaseGzipStream();
+
+        /* Unless the body is still streamed in, that was all of the side block */
+        releaseHandlers();
     }
 
-    /* Caller of onWritable. It is possible onWritable calls markDone so we need to borrow it. */
+    /* Compressing, if we were, is over */
+    void releaseGzipStream() {
+        if (gzipStream) {
+            gzipLoopData->releaseGzipStream(gzipStream);
+            gzipStream = nullptr;
+        }
+    }
+
+    void cancelTasks() {
+        if (handlers && handlers->taskToken) {
+            handlers->taskToken->cancelled.store(true, std::memory_order_relaxed);
+            handlers->taskToken = nullptr;
+        }
+    }
+
+    ~HttpResponseData() {
+        cancelTasks();
+        releaseGzipStream();
+        releaseHandlers(true);
+    }
+
+    /* Caller of onWritable (which we must have). It is possible onWritable calls markDone so we need to borrow it,
+     * and the side block may have gone back by the time it returns */
     bool callOnWritable(uintmax_t offset) {
         /* Borrow real onWritable */
-        MoveOnlyFunction<bool(uintmax_t)> borrowedOnWritable = std::move(onWritable);
+        ResponseHandler<bool(uintmax_t)> borrowedOnWritable = std::move(handlers->onWritable);
 
         /* Set onWritable to placeholder */
-        onWritable = [](uintmax_t) {return true;};
+        handlers->onWritable = [](uintmax_t) {return true;};
 
         /* Run borrowed onWritable */
         bool ret = borrowedOnWritable(offset);
 
         /* If we still have onWritable (the placeholder) then move back the real one */
-        if (onWritable) {
+        if (getOnWritable()) {
             /* We haven't reset onWritable, so give it back */
-            onWritable = std::move(borrowedOnWritable);
+            handlers->onWritable = std::move(borrowedOnWritable);
         }
 
         return ret;
@@ -69,15 +167,25 @@ private:
         HTTP_WRITE_CALLED = 2, // used
         HTTP_END_CALLED = 4, // used
         HTTP_RESPONSE_PENDING = 8, // used
-        HTTP_CONNECTION_CLOSE = 16 // used
+        HTTP_CONNECTION_CLOSE = 16, // used
+        /* compress() was called, so we Vary on Accept-Encoding once the body begins */
+        HTTP_COMPRESS_NEGOTIATED = 32,
+        /* and the client accepts gzip */
+        HTTP_COMPRESS_GZIP = 64
     };
 
-    /* Per socket event handlers */
-    MoveOnlyFunction<bool(uintmax_t)> onWritable;
-    MoveOnlyFunction<void()> onAborted;
-    MoveOnlyFunction<void(std::string_view, bool)> inStream; // onData
+    /* Per request event handlers, while we have any */
+    HttpResponseHandlers *handlers = nullptr;
     /* Outgoing offset */
     uintmax_t offset = 0;
+    /* Of a chunked body, which offset does not count: the data of its chunks, without their framing */
+    uintmax_t chunkedBytes = 0;
+
+    /* While compressing a body, from the pool of its loop */
+    GzipStream *gzipStream = nullptr;
+    LoopData *gzipLoopData = nullptr;
+    /* Bodies ended in one go smaller than this are sent as they are */
+    unsigned int compressMinSize = 0;
 
     /* Let's track number of bytes since last timeout reset in data handler */
     unsigned int received_bytes_per_timeout = 0;
@@ -85,6 +193,15 @@ private:
     /* Current state (content-length sent, status sent, write called, etc */
     int state = 0;
 
+    /* Of the remote address, for the rate limiter of the app (0 if none, or not yet known) */
+    uint64_t addressHash = 0;
+
+    /* Of the route the request in flight matched, and when (in LoopData::now), if it records metrics */
+    RouteMetrics *routeMetrics = nullptr;
+    long long routeMatchedAt = 0;
+    /* Of the route the request in flight matched, what stalls of its handlers are reported as */
+    const std::string *routeLabel = nullptr;
+
 #ifdef UWS_WITH_PROXY
     ProxyParser proxyParser;
 #endif
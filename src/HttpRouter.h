@@ -30,6 +30,7 @@
 #include <iostream>
 
 #include "MoveOnlyFunction.h"
+#include "Tracepoints.h"
 
 namespace uWS {
 
@@ -98,6 +99,66 @@ private:
         }), std::move(newNode))->get();
     }
 
+    /* The frozen (flattened) matching table. Every node keeps its children in one contiguous
+     * block, in the same order as the tree, with names stored back to back in flatNames */
+    struct FlatNode {
+        uint32_t nameOffset, nameLength, nameHash;
+        uint32_t firstChild, numChildren;
+        uint32_t firstHandler, numHandlers;
+        /* Static, parameter or wildcard */
+        unsigned char kind;
+    };
+    static const unsigned char FLAT_STATIC = 0, FLAT_PARAMETER = 1, FLAT_WILDCARD = 2;
+    std::vector<FlatNode> flatNodes;
+    std::vector<uint32_t> flatHandlers;
+    std::string flatNames;
+    bool frozen = false;
+    uint32_t urlSegmentHashes[MAX_URL_SEGMENTS];
+
+    /* FNV-1a, it only needs to tell segments apart before the final compare */
+    static inline uint32_t segmentHash(std::string_view segment) {
+        uint32_t hash = 2166136261u;
+        for (char c : segment) {
+            hash = (hash ^ (unsigned char) c) * 16777619u;
+        }
+        return hash;
+    }
+
+    /* Fills in flatNodes[index] from node, reserving a contiguous block for its children */
+    void flatten(Node *node, uint32_t index) {
+        uint32_t firstChild = (uint32_t) flatNodes.size();
+        flatNodes.resize(flatNodes.size() + node->children.size());
+
+        FlatNode &flatNode = flatNodes[index];
+        flatNode.nameOffset = (uint32_t) flatNames.length();
+        flatNode.nameLength = (uint32_t) node->name.length();
+        flatNode.nameHash = segmentHash(node->name);
+        flatNode.firstChild = firstChild;
+        flatNode.numChildren = (uint32_t) node->children.size();
+        flatNode.firstHandler = (uint32_t) flatHandlers.size();
+        flatNode.numHandlers = (uint32_t) node->handlers.size();
+        flatNode.kind = FLAT_STATIC;
+        if (node->name.length() && node->name[0] == '*') {
+            flatNode.kind = FLAT_WILDCARD;
+        } else if (node->name.length() && node->name[0] == ':') {
+            flatNode.kind = FLAT_PARAMETER;
+        }
+        flatNames.append(node->name);
+        flatHandlers.insert(flatHandlers.end(), node->handlers.begin(), node->handlers.end());
+
+        for (uint32_t i = 0; i < node->children.size(); i++) {
+            flatten(node->children[i].get(), firstChild + i);
+        }
+    }
+
+    /* Mutating the tree invalidates the table */
+    void thaw() {
+        frozen = false;
+        flatNodes.clear();
+        flatHandlers.clear();
+        flatNames.clear();
+    }
+
     /* Basically a pre-allocated stack */
     struct RouteParameters {
         friend struct HttpRouter;
@@ -159,6 +220,11 @@ private:
                 /* Update currentUrl */
                 currentUrl = currentUrl.substr(segmentLength);
             }
+
+            /* The frozen table compares hashes before names */
+            if (frozen) {
+                urlSegmentHashes[urlSegment] = segmentHash(urlSegmentVector[urlSegment]);
+            }
         }
         /* In any case we return it */
         return {urlSegmentVector[urlSegment], false};
@@ -206,6 +272,47 @@ private:
         return false;
     }
 
+    /* Same as executeHandlers, but walks the frozen table */
+    bool executeFlatHandlers(uint32_t parent, int urlSegment) {
+
+        auto [segment, isStop] = getUrlSegment(urlSegment);
+
+        const FlatNode &parentNode = flatNodes[parent];
+        if (isStop) {
+            for (uint32_t i = parentNode.firstHandler; i < parentNode.firstHandler + parentNode.numHandlers; i++) {
+                if (handlers[flatHandlers[i] & HANDLER_MASK](this)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        uint32_t hash = urlSegmentHashes[urlSegment];
+        for (uint32_t child = parentNode.firstChild; child < parentNode.firstChild + parentNode.numChildren; child++) {
+            /* Handlers may not modify the router, so this reference stays valid */
+            const FlatNode &p = flatNodes[child];
+            if (p.kind == FLAT_WILDCARD) {
+                for (uint32_t i = p.firstHandler; i < p.firstHandler + p.numHandlers; i++) {
+                    if (handlers[flatHandlers[i] & HANDLER_MASK](this)) {
+                        return true;
+                    }
+                }
+            } else if (p.kind == FLAT_PARAMETER && segment.length()) {
+                routeParameters.push(segment);
+                if (executeFlatHandlers(child, urlSegment + 1)) {
+                    return true;
+                }
+                routeParameters.pop();
+            } else if (p.kind == FLAT_STATIC && p.nameHash == hash && p.nameLength == segment.length()
+                && !memcmp(flatNames.data() + p.nameOffset, segment.data(), segment.length())) {
+                if (executeFlatHandlers(child, urlSegment + 1)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
     /* Scans for one matching handler, returning the handler and its priority or UINT32_MAX for not found */
     uint32_t findHandler(std::string method, std::string pattern, uint32_t priority) {
         for (std::unique_ptr<Node> &node : root.children) {
@@ -253,12 +360,43 @@ public:
         return userData;
     }
 
+    /* Compiles the matching tree into a contiguous table used by route until the next add or remove.
+     * Call this once all routes are registered. */
+    void freeze() {
+        thaw();
+        flatNodes.resize(1);
+        flatten(&root, 0);
+        frozen = true;
+    }
+
+    bool isFrozen() {
+        return frozen;
+    }
+
     /* Fast path */
     bool route(std::string_view method, std::string_view url) {
+        UWS_TRACE(http__route, method.data(), method.length(), url.data(), url.length());
+
         /* Reset url parsing cache */
         setUrl(url);
         routeParameters.reset();
 
+        if (frozen) {
+            /* Method nodes are the children of root, ANY method being last */
+            const FlatNode &rootNode = flatNodes[0];
+            for (uint32_t child = rootNode.firstChild; child < rootNode.firstChild + rootNode.numChildren; child++) {
+                const FlatNode &p = flatNodes[child];
+                if (p.nameLength == method.length() && !memcmp(flatNames.data() + p.nameOffset, method.data(), method.length())) {
+                    if (executeFlatHandlers(child, 0)) {
+                        return true;
+                    } else {
+                        break;
+                    }
+                }
+            }
+            return executeFlatHandlers(rootNode.firstChild + rootNode.numChildren - 1, 0);
+        }
+
         /* Begin by finding the method node */
         for (auto &p : root.children) {
             if (p->name == method) {
@@ -279,6 +417,7 @@ public:
     void add(std::vector<std::string> methods, std::string pattern, MoveOnlyFunction<bool(HttpRouter *)> &&handler, uint32_t priority = MEDIUM_PRIORITY) {
         /* First remove existing handler */
         remove(methods[0], pattern, priority);
+        thaw();
         
         for (std::string method : methods) {
             /* Lookup method */
@@ -364,6 +503,8 @@ public:
             return;
         }
 
+        thaw();
+
         /* Cull the entire tree */
         /* For all nodes in depth first tree traveral;
          * if node contains handler - remove the handler -
@@ -1,64 +1,291 @@
-/* This header is highly experimental and needs refactorings but will do for now */
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_LOCALCLUSTER_H
+#define UWS_LOCALCLUSTER_H
+
+/* A LocalCluster runs one App per thread, every one set up by the same callback, and shares incoming
+ * connections among them. With REUSE_PORT every thread listens on its own and the kernel picks one per
+ * connection, optionally the one pinned to the CPU the connection came in on. With HANDOFF accepting
+ * threads pass connections on round robin through a ring per loop, waking each loop once per batch.
+ * Threads are pinned to the CPUs we may run on and allocate from the memory node of their CPU */
+
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <thread>
-#include <algorithm>
-#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "App.h"
+#include "MpscRing.h"
+
+#ifdef __linux__
+#include <linux/filter.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#endif
 
-unsigned int roundRobin = 0;
-unsigned int hardwareConcurrency = std::thread::hardware_concurrency();
-std::vector<std::thread *> threads(hardwareConcurrency);
-std::vector<uWS::SSLApp *> apps;
-std::mutex m;
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 namespace uWS {
-struct LocalCluster {
 
-    //std::vector<std::thread *> threads = std::thread::hardware_concurrency();
-    //std::vector<uWS::SSLApp *> apps;
-    //std::mutex m;
+enum LocalClusterBalancing {
+    /* Every thread listens, the kernel balances (the default) */
+    REUSE_PORT,
+    /* Whoever accepts passes the connection to the next thread in turn */
+    HANDOFF
+};
+
+struct LocalClusterOptions {
+    /* Number of threads, 0 for one per CPU we may run on */
+    unsigned int threads = 0;
+    LocalClusterBalancing balancing = REUSE_PORT;
+    /* REUSE_PORT on Linux: connections go to the thread pinned to the CPU handling them (by a classic BPF
+     * program per port), which keeps a connection on one core from interrupt to send. Implies pinThreads */
+    bool steerByCpu = false;
+    /* Thread i runs on the i:th CPU we may run on, wrapping around */
+    bool pinThreads = true;
+    /* Allocate from the memory node of the CPU a thread runs on, even under an interleaving policy */
+    bool numaLocal = true;
+    /* HANDOFF: connections a loop holds for another, beyond which it keeps them */
+    size_t handoffCapacity = 1024;
+};
+
+template <bool SSL>
+struct TemplatedLocalCluster {
+    typedef std::conditional_t<SSL, SSLApp, App> AppType;
+
+private:
+    struct Worker {
+        Worker(size_t capacity) : accepted(capacity) {}
+
+        TemplatedLocalCluster *cluster;
+        unsigned int index;
+        /* -1 if not pinned */
+        int cpu = -1;
+        std::thread thread;
+        AppType *app = nullptr;
+        Loop *loop = nullptr;
+
+        /* Connections handed to us, and whether a wakeup for them is on its way */
+        MpscRing<LIBUS_SOCKET_DESCRIPTOR> accepted;
+        std::atomic<bool> wakeupPending{false};
+        /* Until our loop returned, after which nothing more is handed to us */
+        std::atomic<bool> running{true};
+        /* Our turn to hand off to, round robin from ourselves */
+        unsigned int next = 0;
+    };
+
+    LocalClusterOptions clusterOptions;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<int> cpus;
+
+    /* Setups done so far, run in order if steering (the kernel numbers listeners in the order they listen) */
+    std::atomic<unsigned int> ready{0};
+
+    /* The preOpen handler is a plain function, finding us through the thread it runs on */
+    static inline thread_local Worker *localWorker = nullptr;
+
+    static std::vector<int> allowedCpus() {
+        std::vector<int> allowed;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (!sched_getaffinity(0, sizeof(set), &set)) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET((size_t) cpu, &set)) {
+                    allowed.push_back(cpu);
+                }
+            }
+        }
+#endif
+        return allowed;
+    }
+
+    static void pin(Worker *worker, bool numaLocal) {
+#ifdef __linux__
+        if (worker->cpu != -1) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((size_t) worker->cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+        /* Pinned, the loop and everything of it is first touched (and so placed) on our node */
+        if (numaLocal) {
+            syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0);
+        }
+#else
+        (void) worker;
+        (void) numaLocal;
+#endif
+    }
+
+    /* Returns the listener of the thread pinned to the CPU a connection arrived on: ld cpu, then a
+     * jeq and ret per thread, falling back to cpu modulo the number of threads */
+    void steer(us_listen_socket_t *listenSocket) {
+#ifdef __linux__
+        std::vector<sock_filter> program;
+        program.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t) (SKF_AD_OFF + SKF_AD_CPU)));
+        for (std::unique_ptr<Worker> &worker : workers) {
+            program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t) worker->cpu, 0, 1));
+            program.push_back(BPF_STMT(BPF_RET | BPF_K, worker->index));
+        }
+        program.push_back(BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t) workers.size()));
+        program.push_back(BPF_STMT(BPF_RET | BPF_A, 0));
+
+        sock_fprog fprog = {(unsigned short) program.size(), program.data()};
+        int fd = (int) us_poll_fd((struct us_poll_t *) listenSocket);
+        /* Replaces the program of the whole group, with the very same one (or fails on unix sockets) */
+        setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &fprog, sizeof(fprog));
+#else
+        (void) listenSocket;
+#endif
+    }
+
+    static LIBUS_SOCKET_DESCRIPTOR handoff(struct us_socket_context_t *, LIBUS_SOCKET_DESCRIPTOR fd) {
+        Worker *self = localWorker;
+        std::vector<std::unique_ptr<Worker>> &workers = self->cluster->workers;
+        Worker *target = workers[self->next].get();
+        self->next = (self->next + 1) % (unsigned int) workers.size();
+
+        /* Ours, or theirs is done or full, we keep it */
+        if (target == self || !target->running.load(std::memory_order_relaxed) || !target->accepted.push(fd)) {
+            return fd;
+        }
+        if (!target->wakeupPending.exchange(true)) {
+            us_wakeup_loop((us_loop_t *) target->loop);
+        }
+        return (LIBUS_SOCKET_DESCRIPTOR) -1;
+    }
 
+    static void adoptHandedOff(Worker *worker) {
+        /* Anything pushed after this wakes us up again */
+        worker->wakeupPending.store(false);
 
-    static void loadBalancer() {
-        static std::atomic<unsigned int> roundRobin = 0; // atomic fetch_add
+        LIBUS_SOCKET_DESCRIPTOR fd;
+        while (worker->accepted.pop(fd)) {
+            worker->app->adoptSocket(fd);
+        }
     }
 
-    LocalCluster(SocketContextOptions options = {}, std::function<void(uWS::SSLApp &)> cb = nullptr) {
-        std::transform(threads.begin(), threads.end(), threads.begin(), [options, &cb](std::thread *) {
+    void run(Worker *worker, SocketContextOptions options, const std::function<void(AppType &)> &cb) {
+        localWorker = worker;
+        pin(worker, clusterOptions.numaLocal);
+
+        bool steering = clusterOptions.steerByCpu && clusterOptions.balancing == REUSE_PORT;
+        while (steering && ready.load() != worker->index) {
+            std::this_thread::yield();
+        }
+
+        AppType *app = worker->app = new AppType(options);
+        worker->loop = app->getLoop();
+        if (steering) {
+            app->listenObserver = [this](us_listen_socket_t *listenSocket) {
+                steer(listenSocket);
+            };
+        }
 
-            return new std::thread([options, &cb]() {
+        cb(*app);
 
-                // lock this
-                m.lock();
-                apps.emplace_back(new uWS::SSLApp(options));
-                uWS::SSLApp *app = apps.back();
+        if (clusterOptions.balancing == HANDOFF) {
+            app->preOpen(handoff);
+            worker->next = (worker->index + 1) % (unsigned int) workers.size();
+            worker->loop->addPreHandler(worker, [worker](Loop *) {
+                adoptHandedOff(worker);
+            });
+        }
+
+        /* Nobody hands off to a loop not yet there */
+        ready.fetch_add(1);
+        while (ready.load() != workers.size()) {
+            std::this_thread::yield();
+        }
 
-                cb(*app);
-                
-                app->preOpen([](struct us_socket_context_t *context, LIBUS_SOCKET_DESCRIPTOR fd) -> LIBUS_SOCKET_DESCRIPTOR {
+        app->run();
+        worker->running.store(false);
 
-                    std::ignore = context;
+        if (clusterOptions.balancing == HANDOFF) {
+            worker->loop->removePreHandler(worker);
+        }
+        delete app;
+        worker->app = nullptr;
+    }
 
-                    /* Distribute this socket in round robin fashion */
-                    //std::cout << "About to load balance " << fd << " to " << roundRobin << std::endl;
+public:
+    /* Runs cb on every thread, with an App of its own, and then its loop. Returns once every loop returned */
+    TemplatedLocalCluster(SocketContextOptions options, std::function<void(AppType &)> cb, LocalClusterOptions clusterOptions = {}) : clusterOptions(clusterOptions) {
+        cpus = allowedCpus();
+        unsigned int threads = clusterOptions.threads;
+        if (!threads) {
+            threads = cpus.size() ? (unsigned int) cpus.size() : std::max(1u, std::thread::hardware_concurrency());
+        }
 
-                    auto receivingApp = apps[roundRobin];
-                    apps[roundRobin]->getLoop()->defer([fd, receivingApp]() {
-                        receivingApp->adoptSocket(fd);
-                    });
+        for (unsigned int i = 0; i < threads; i++) {
+            workers.emplace_back(new Worker(clusterOptions.handoffCapacity));
+            Worker *worker = workers.back().get();
+            worker->cluster = this;
+            worker->index = i;
+            if ((clusterOptions.pinThreads || clusterOptions.steerByCpu) && cpus.size()) {
+                worker->cpu = cpus[i % cpus.size()];
+            }
+        }
 
-                    roundRobin = (roundRobin + 1) % hardwareConcurrency;
-                    return (LIBUS_SOCKET_DESCRIPTOR) -1;
-                });
-                m.unlock();
-                app->run();
-                std::cout << "Fallthrough!" << std::endl;
-                delete app;
+        for (std::unique_ptr<Worker> &worker : workers) {
+            worker->thread = std::thread([this, worker = worker.get(), options, &cb]() {
+                run(worker, options, cb);
             });
-        });
+        }
+
+        for (std::unique_ptr<Worker> &worker : workers) {
+            worker->thread.join();
+        }
+
+        /* Handed to a loop that was done already */
+        for (std::unique_ptr<Worker> &worker : workers) {
+            LIBUS_SOCKET_DESCRIPTOR fd;
+            while (worker->accepted.pop(fd)) {
+#ifdef _WIN32
+                closesocket(fd);
+#else
+                close(fd);
+#endif
+            }
+        }
+    }
+
+    TemplatedLocalCluster(const TemplatedLocalCluster &) = delete;
+    TemplatedLocalCluster &operator=(const TemplatedLocalCluster &) = delete;
 
-        std::for_each(threads.begin(), threads.end(), [](std::thread *t) {
-            t->join();
-        });
+    /* Number of threads run */
+    size_t size() const {
+        return workers.size();
     }
 };
-}
\ No newline at end of file
+
+typedef TemplatedLocalCluster<false> LocalCluster;
+typedef TemplatedLocalCluster<true> SSLLocalCluster;
+
+}
+
+#endif // UWS_LOCALCLUSTER_H
@@ -21,43 +21,105 @@
 /* The loop is lazily created per-thread and run with run() */
 
 #include "LoopData.h"
+#include "AsyncSocketData.h"
+#include "HttpParser.h"
 #include <libusockets.h>
 #include <iostream>
+#include <memory>
+#include <type_traits>
 
 namespace uWS {
+struct SleepAwaiter;
+
 struct Loop {
 private:
     static void wakeupCb(us_loop_t *loop) {
         LoopData *loopData = (LoopData *) us_loop_ext(loop);
 
-        /* Swap current deferQueue */
-        loopData->deferMutex.lock();
-        int oldDeferQueue = loopData->currentDeferQueue;
-        loopData->currentDeferQueue = (loopData->currentDeferQueue + 1) % 2;
-        loopData->deferMutex.unlock();
+        /* Anything deferred after this wakes us up again. Exchanging rather than storing acquires whatever was
+         * pushed before the producer saw the wakeup pending, so that the queue run below cannot miss it */
+        loopData->wakeupPending.exchange(false, std::memory_order_acq_rel);
+        if (loopData->profile) {
+            loopData->profile->beginDefers();
+        }
+        unsigned int ran = loopData->deferQueue.run();
+        if (loopData->profile) {
+            loopData->profile->endDefers();
+        }
+        if (ran) {
+            loopData->metrics.defersRun.add(ran);
+            loopData->noteEvent();
+        }
+    }
 
-        /* Drain the queue */
-        for (auto &x : loopData->deferQueues[oldDeferQueue]) {
+    /* Runs what our own thread deferred, leaving anything deferred from within for the next time */
+    static void runLocalDefers(LoopData *loopData) {
+        if (loopData->profile) {
+            loopData->profile->beginDefers();
+        }
+        loopData->runningDefers.swap(loopData->localDefers);
+        for (auto &x : loopData->runningDefers) {
             x();
         }
-        loopData->deferQueues[oldDeferQueue].clear();
+        loopData->runningDefers.clear();
+        if (loopData->profile) {
+            loopData->profile->endDefers();
+        }
     }
 
     static void preCb(us_loop_t *loop) {
         LoopData *loopData = (LoopData *) us_loop_ext(loop);
 
-        for (auto &p : loopData->preHandlers) {
-            p.second((Loop *) loop);
+        loopData->preHandlers.run((Loop *) loop);
+
+        /* Defers made from here on until postCb run there, since we are about to poll */
+        loopData->dispatching = true;
+
+        /* Spinning is polling with a wakeup already pending, so that the poll returns right away */
+        if (loopData->busyPollMicroseconds && loopData->beforePoll()) {
+            us_wakeup_loop(loop);
+        }
+
+        if (loopData->profile) {
+            loopData->profile->beforePoll();
         }
     }
 
     static void postCb(us_loop_t *loop) {
         LoopData *loopData = (LoopData *) us_loop_ext(loop);
 
-        for (auto &p : loopData->postHandlers) {
-            p.second((Loop *) loop);
+        if (loopData->busyPollMicroseconds) {
+            loopData->afterPoll();
+        }
+
+        loopData->dispatching = false;
+        if (loopData->localDefers.size()) {
+            runLocalDefers(loopData);
+        }
+
+        /* What was read past the read budget, round robin */
+        loopData->resumeParkedReads();
+
+        loopData->postHandlers.run((Loop *) loop);
+
+        /* Everything written while another socket was corked goes out now, coalesced sends once due */
+        if (long long nextDeadline = loopData->flushCorkSlices()) {
+            int ms = (int) ((nextDeadline - LoopData::now() + 999) / 1000);
+            us_timer_set(loopData->coalesceTimer, [](struct us_timer_t *) {}, ms > 0 ? ms : 1, 0);
         }
 
+        /* Nothing is corked in between iterations */
+        loopData->resizeCorkBuffer();
+        loopData->metrics.backPressure.value.store(BackPressureBudget::get().loopBytes, std::memory_order_relaxed);
+        loopData->metrics.backPressureBlockBytes.value.store(BackPressurePool::get().bytes, std::memory_order_relaxed);
+        loopData->metrics.fallbackBytes.value.store(FallbackPool::get().bytes, std::memory_order_relaxed);
+        loopData->metrics.zlibBytes.value.store((unsigned long long) std::max<long long>(ZlibMemory::threadBytes(), 0), std::memory_order_relaxed);
+
+        if (loopData->profile) {
+            loopData->profile->afterIteration();
+        }
+        loopData->retiredProfiles.clear();
+
         /* After every event loop iteration, we must not hold the cork buffer */
         if (loopData->corkedSocket) {
             std::cerr << "Error: Cork buffer must not be held across event loop iterations!" << std::endl;
@@ -83,8 +145,15 @@ private:
         us_timer_set(loopData->dateTimer, [](struct us_timer_t *t) {
             LoopData *loopData;
             memcpy(&loopData, us_timer_ext(t), sizeof(LoopData *));
+            if (loopData->profile) {
+                loopData->profile->noteEvent();
+            }
             loopData->updateDate();
+            loopData->dateHandlers.run((Loop *) us_timer_loop(t));
+            loopData->tick();
+            loopData->timingWheel.advance();
         }, 1000, 1000);
+        loopData->coalesceTimer = us_create_timer((struct us_loop_t *) loop, 1, 0);
 
         return loop;
     }
@@ -128,8 +197,19 @@ public:
     void free() {
         LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
 
+        /* Offloaded jobs still running will defer to us */
+        while (loopData->offloadsInFlight.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
         /* Stop and free dateTimer first */
         us_timer_close(loopData->dateTimer);
+        us_timer_close(loopData->coalesceTimer);
+
+        /* Idle backpressure blocks of our memory resource go back to it while it is still here */
+        if (BackPressurePool::get().getResource() == loopData->memoryResource) {
+            BackPressurePool::get().setResource(std::pmr::new_delete_resource());
+        }
 
         loopData->~LoopData();
         /* uSockets will track whether this loop is owned by us or a borrowed alien loop */
@@ -139,44 +219,251 @@ public:
         getLazyLoop().loop = nullptr;
     }
 
-    void addPostHandler(void *key, MoveOnlyFunction<void(Loop *)> &&handler) {
+    /* Lower priority runs first (see LoopHooks), equal ones in the order added */
+    void addPostHandler(void *key, MoveOnlyFunction<void(Loop *)> &&handler, int priority = LoopHooks::DEFAULT_PRIORITY) {
         LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
 
-        loopData->postHandlers.emplace(key, std::move(handler));
+        loopData->postHandlers.add(key, std::move(handler), priority);
     }
 
-    /* Bug: what if you remove a handler while iterating them? */
+    /* May be called from within any handler, itself included */
     void removePostHandler(void *key) {
         LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
 
-        loopData->postHandlers.erase(key);
+        loopData->postHandlers.remove(key);
     }
 
-    void addPreHandler(void *key, MoveOnlyFunction<void(Loop *)> &&handler) {
+    void addPreHandler(void *key, MoveOnlyFunction<void(Loop *)> &&handler, int priority = LoopHooks::DEFAULT_PRIORITY) {
         LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
 
-        loopData->preHandlers.emplace(key, std::move(handler));
+        loopData->preHandlers.add(key, std::move(handler), priority);
     }
 
-    /* Bug: what if you remove a handler while iterating them? */
     void removePreHandler(void *key) {
         LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
 
-        loopData->preHandlers.erase(key);
+        loopData->preHandlers.remove(key);
+    }
+
+    /* Called once a second with the date (and cacheTimepoint) just updated */
+    void addDateHandler(void *key, MoveOnlyFunction<void(Loop *)> &&handler) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        loopData->dateHandlers.add(key, std::move(handler));
+    }
+
+    void removeDateHandler(void *key) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        loopData->dateHandlers.remove(key);
     }
 
     /* Defer this callback on Loop's thread of execution */
     void defer(MoveOnlyFunction<void()> &&cb) {
         LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
 
-        //if (std::thread::get_id() == ) // todo: add fast path for same thread id
-        loopData->deferMutex.lock();
-        loopData->deferQueues[loopData->currentDeferQueue].emplace_back(std::move(cb));
-        loopData->deferMutex.unlock();
+        /* Our own thread, in between pre and post, needs no wakeup as postCb is coming */
+        if (getLazyLoop().loop == this && loopData->dispatching) {
+            loopData->localDefers.emplace_back(std::move(cb));
+            return;
+        }
+
+        /* One wakeup for any number of defers until the loop runs them */
+        loopData->metrics.deferred.fetch_add(1, std::memory_order_relaxed);
+        loopData->deferQueue.push(std::move(cb));
+        if (!loopData->wakeupPending.exchange(true, std::memory_order_acq_rel)) {
+            us_wakeup_loop((us_loop_t *) this);
+        }
+    }
+
+    /* Opt-in busy polling, trading a core for latency: after an event we keep polling without blocking for up to
+     * spinMicroseconds (0 to turn it off), as long as events are arriving closer together than that. Accepted
+     * sockets get SO_BUSY_POLL (and SO_PREFER_BUSY_POLL) of socketMicroseconds, where the kernel supports it */
+    void setBusyPoll(unsigned int spinMicroseconds, int socketMicroseconds = 0) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        loopData->busyPollMicroseconds = spinMicroseconds;
+        loopData->socketBusyPollMicroseconds = socketMicroseconds;
+        loopData->lastEventAt = loopData->averageEventGap = 0;
+    }
+
+    /* Counters of this loop, from any thread */
+    LoopMetricsSnapshot getMetrics() {
+        return ((LoopData *) us_loop_ext((us_loop_t *) this))->metrics.snapshot();
+    }
+
+    /* Sockets of this loop and what its pools hold, from any thread (pools as of the end of the last iteration) */
+    MemoryStats getMemoryStats() {
+        return ((LoopData *) us_loop_ext((us_loop_t *) this))->getMemoryStats();
+    }
+
+    /* Opt-in profiling of this loop's iterations (see LoopProfile.h). Handlers that hold the loop for at least
+     * stallThresholdMicroseconds, or iterations if no one handler did, are stalls: the longest are kept, and all are
+     * passed to onStall as they end. 0 turns it off, also from within a handler or onStall */
+    void setProfiling(unsigned int stallThresholdMicroseconds, MoveOnlyFunction<void(const LoopStall &)> &&onStall = nullptr) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        if (!stallThresholdMicroseconds) {
+            loopData->stopProfiling();
+            return;
+        }
+        if (!loopData->profile) {
+            loopData->profile = std::make_unique<LoopProfile>(stallThresholdMicroseconds);
+        }
+        loopData->profile->stallThresholdMicroseconds = stallThresholdMicroseconds;
+        loopData->profile->setOnStall(std::move(onStall));
+    }
+
+    /* Records what server connections of this loop receive from here on, and when, to path (see TrafficCapture.h)
+     * for replaying with libEpollBenchmarker. Data past maxBytes is not recorded, if not 0. Returns false if path
+     * cannot be written, nullptr stops capturing */
+    bool captureTraffic(const char *path, unsigned long long maxBytes = 0) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        loopData->trafficCapture.reset();
+        if (!path) {
+            return true;
+        }
+        FILE *file = fopen(path, "wb");
+        if (!file) {
+            return false;
+        }
+        loopData->trafficCapture = std::make_unique<TrafficCapture>(file, maxBytes);
+        return true;
+    }
+
+    /* From any thread, while profiling. Empty if not */
+    LoopProfileSnapshot getProfile() {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        return loopData->profile ? loopData->profile->snapshot() : LoopProfileSnapshot();
+    }
+
+    /* This loop's only */
+    BusyPollStats getBusyPollStats() {
+        return ((LoopData *) us_loop_ext((us_loop_t *) this))->busyPollStats;
+    }
+
+    /* How busy this loop is, from any thread */
+    LoopLoad getLoad() {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
 
-        us_wakeup_loop((us_loop_t *) this);
+        return loopData->getLoad();
     }
 
+    /* How much was deflated on this loop, and how much adaptive compression skipped */
+    CompressionStats getCompressionStats() {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        return loopData->compressionStats;
+    }
+
+    /* Compress and decompress messages of at least threshold bytes on pool, instead of on this loop.
+     * The pool can be shared with other loops and must outlive them, nullptr to stop offloading */
+    void setCompressionPool(CompressionPool *pool, size_t threshold = 64 * 1024) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        loopData->compressionPool = pool;
+        loopData->offloadThreshold = threshold;
+    }
+
+    /* Runs work on the compression pool (skipped if empty), then complete on this loop. Completions
+     * are emitted in the order work was offloaded, which keeps the messages of every socket in order */
+    void offload(void *owner, MoveOnlyFunction<void()> &&work, MoveOnlyFunction<void()> &&complete) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        OffloadedJob *job = new OffloadedJob{owner, !work, std::move(complete)};
+        loopData->offloadedJobs.push_back(job);
+
+        if (work) {
+            loopData->offloadsInFlight.fetch_add(1, std::memory_order_relaxed);
+            loopData->compressionPool->submit([this, job, work = std::move(work)]() mutable {
+                work();
+                defer([this, job]() {
+                    job->done = true;
+                    completeOffloaded();
+                });
+                ((LoopData *) us_loop_ext((us_loop_t *) this))->offloadsInFlight.fetch_sub(1, std::memory_order_release);
+            });
+        } else {
+            completeOffloaded();
+        }
+    }
+
+    /* Run tasks of offload on pool instead of the shared one. The pool must outlive this loop */
+    void setTaskPool(TaskPool *pool) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        loopData->taskPool = pool;
+    }
+
+    /* Runs task on the task pool, then continuation with what it returned (if anything) on this loop.
+     * Both are skipped once token is cancelled, the task if it has not started yet. Returns false,
+     * running neither, if the pool is full. Continuations of tasks are not ordered among each other */
+    template <typename Task, typename Continuation>
+    bool offload(Task &&task, Continuation &&continuation, std::shared_ptr<TaskToken> token = nullptr) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+        TaskPool *pool = loopData->taskPool ? loopData->taskPool : &TaskPool::shared();
+
+        loopData->offloadsInFlight.fetch_add(1, std::memory_order_relaxed);
+        bool submitted = pool->submit([this, token, task = std::forward<Task>(task), continuation = std::forward<Continuation>(continuation)]() mutable {
+            if (!token || !token->cancelled.load(std::memory_order_relaxed)) {
+                if constexpr (std::is_void_v<std::invoke_result_t<Task &>>) {
+                    task();
+                    defer([token = std::move(token), continuation = std::move(continuation)]() mutable {
+                        if (!token || !token->cancelled.load(std::memory_order_relaxed)) {
+                            continuation();
+                        }
+                    });
+                } else {
+                    defer([token = std::move(token), continuation = std::move(continuation), result = task()]() mutable {
+                        if (!token || !token->cancelled.load(std::memory_order_relaxed)) {
+                            continuation(std::move(result));
+                        }
+                    });
+                }
+            }
+            ((LoopData *) us_loop_ext((us_loop_t *) this))->offloadsInFlight.fetch_sub(1, std::memory_order_release);
+        });
+        if (!submitted) {
+            loopData->offloadsInFlight.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return submitted;
+    }
+
+    /* The owner closed, its completions must never be called */
+    void cancelOffloaded(void *owner) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        for (OffloadedJob *job : loopData->offloadedJobs) {
+            if (job->owner == owner) {
+                job->owner = nullptr;
+                job->complete = nullptr;
+            }
+        }
+    }
+
+private:
+    void completeOffloaded() {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+
+        /* Completions can offload more, which goes to the back */
+        while (!loopData->offloadedJobs.empty() && loopData->offloadedJobs.front()->done) {
+            OffloadedJob *job = loopData->offloadedJobs.front();
+            loopData->offloadedJobs.pop_front();
+            if (job->complete) {
+                job->complete();
+            }
+            delete job;
+        }
+    }
+
+public:
+#if defined(__cpp_impl_coroutine)
+    /* co_await in a Task to resume on this loop after milliseconds (see Coroutine.h) */
+    SleepAwaiter sleep(unsigned int milliseconds);
+#endif
+
     /* Actively block and run this loop */
     void run() {
         us_loop_run((us_loop_t *) this);
@@ -192,6 +479,78 @@ public:
     void setSilent(bool silent) {
         ((LoopData *) us_loop_ext((us_loop_t *) this))->noMark = silent;
     }
+
+    /* Sets the cork buffer size (4 kB - 1 MB, default 16 kB). Messages under it are corked and
+     * published through the TopicTree, bigger ones are sent directly. Takes effect once nothing is corked */
+    void setCorkBufferSize(unsigned int size) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+        loopData->minAdaptiveCorkBufferSize = loopData->maxAdaptiveCorkBufferSize = 0;
+        loopData->setCorkBufferSize(size);
+    }
+
+    /* Lets the cork buffer size follow the largest published message, within these bounds */
+    void setAdaptiveCorkBufferSize(unsigned int minSize, unsigned int maxSize) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+        loopData->minAdaptiveCorkBufferSize = std::max<unsigned int>(minSize, LoopData::MIN_CORK_BUFFER_SIZE);
+        loopData->maxAdaptiveCorkBufferSize = std::min<unsigned int>(std::max<unsigned int>(maxSize, loopData->minAdaptiveCorkBufferSize), LoopData::MAX_CORK_BUFFER_SIZE);
+        loopData->observedMessages = loopData->largestObservedMessage = 0;
+    }
+
+    unsigned int getCorkBufferSize() {
+        return ((LoopData *) us_loop_ext((us_loop_t *) this))->corkBufferSize;
+    }
+
+    /* Takes the cork buffer, zlib scratch space and backpressure blocks of this loop from resource, which
+     * must outlive the loop. Call from the thread of the loop, before it runs (nothing may be corked) */
+    void setMemoryResource(std::pmr::memory_resource *resource) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+        loopData->setMemoryResource(resource);
+        BackPressurePool::get().setResource(resource);
+    }
+
+    /* Same, with a HugePageResource of the node of this thread that lives as long as the loop */
+    void useHugePages() {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+        if (!loopData->hugePageResource) {
+            std::unique_ptr<HugePageResource> resource = std::make_unique<HugePageResource>();
+            setMemoryResource(resource.get());
+            loopData->hugePageResource = std::move(resource);
+        }
+    }
+
+    std::pmr::memory_resource *getMemoryResource() {
+        return ((LoopData *) us_loop_ext((us_loop_t *) this))->memoryResource;
+    }
+
+    /* Bounds the backpressure of all sockets of this loop, and of all loops of the process (0 for unlimited).
+     * While over budget, sockets queuing more than the average one are shed as the policy says when written to */
+    void setBackPressureBudget(size_t maxLoopBytes, size_t maxProcessBytes, MoveOnlyFunction<BackPressureShedding(size_t buffered, size_t average)> &&policy) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+        loopData->maxLoopBackPressure = maxLoopBytes;
+        loopData->shedPolicy = std::move(policy);
+        BackPressureBudget::maxProcessBytes.store(maxProcessBytes, std::memory_order_relaxed);
+    }
+
+    /* Same, applying one policy to every socket queuing above average */
+    void setBackPressureBudget(size_t maxLoopBytes, size_t maxProcessBytes = 0, BackPressureShedding shedding = SHED_DROP) {
+        setBackPressureBudget(maxLoopBytes, maxProcessBytes, [shedding](size_t, size_t) {
+            return shedding;
+        });
+    }
+
+    /* Bounds what an HTTP or WebSocket read is handed at a time (0 for unbounded), so that one socket sending a lot
+     * does not hold up the others. The rest is handed back a budget at a time after the handlers of this iteration,
+     * round robin. Sockets over budget pauseAfter iterations in a row get their reads paused an iteration (0 for never) */
+    void setReadBudget(unsigned int bytes, unsigned int pauseAfter = 0) {
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) this);
+        loopData->readBudget = bytes;
+        loopData->readBudgetPauseAfter = pauseAfter;
+    }
+
+    /* Bytes of backpressure queued by sockets of this loop */
+    size_t getBackPressure() {
+        return BackPressureBudget::get().loopBytes;
+    }
 };
 
 /* Can be called from any thread to run the thread local loop */
@@ -19,31 +19,266 @@
 #define UWS_LOOPDATA_H
 
 #include <thread>
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <vector>
 #include <mutex>
-#include <map>
+#include <deque>
+#include <atomic>
 #include <ctime>
 #include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <cstring>
 
 #include "PerMessageDeflate.h"
 #include "MoveOnlyFunction.h"
+#include "CompressionPool.h"
+#include "TaskPool.h"
+#include "TimingWheel.h"
+#include "DeferQueue.h"
+#include "SlabPool.h"
+#include "MemoryResource.h"
+#include "SocketRegistry.h"
+#include "LoopHooks.h"
+#include "LoopProfile.h"
+#include "TrafficCapture.h"
+#include "Utilities.h"
 
 struct us_timer_t;
+struct us_socket_t;
 
 namespace uWS {
 
 struct Loop;
 
+/* A socket written to while another socket holds the cork buffer corks into a slice of its own.
+ * Slices are pooled per loop and flushed together after the handlers of this iteration */
+struct CorkSlice {
+    static const unsigned int SIZE = 4 * 1024;
+
+    /* Null once flushed, or if the socket closed before that */
+    void *socket;
+    void (*flush)(void *socket);
+    /* Coalesced slices are held until this time (see LoopData::now), others are flushed after this iteration */
+    long long deadline;
+    unsigned int length;
+    char data[SIZE];
+};
+
+/* Socket data held by running coroutines after their socket closed (see AsyncSocketData::holdForCoroutines),
+ * deleted by the last of them */
+struct CoroutineHold {
+    unsigned int holders;
+    void (*release)(void *socket);
+    void *socket;
+};
+
+/* A coroutine answering a socket or run by a loop (see Task.h), aborted if either goes away before it is done.
+ * Abort returns whether the coroutine is running, in which case it is destroyed once it next suspends */
+struct CoroutineLink {
+    /* Whatever points to us, null while unlinked */
+    CoroutineLink **pprev = nullptr, *next = nullptr;
+    bool (*abort)(CoroutineLink *link) = nullptr;
+    /* Set if we were running as our socket closed, released by us once we are done */
+    CoroutineHold *hold = nullptr;
+
+    void link(CoroutineLink *&head) {
+        pprev = &head;
+        next = head;
+        if (head) {
+            head->pprev = &next;
+        }
+        head = this;
+    }
+
+    void unlink() {
+        if (pprev) {
+            *pprev = next;
+            if (next) {
+                next->pprev = pprev;
+            }
+            pprev = nullptr;
+            next = nullptr;
+        }
+    }
+};
+
+/* What a socket read past the read budget of its loop (see Loop::setReadBudget), handed back to its on_data handler
+ * a budget at a time after the handlers of this iteration, round robin with the others parked */
+struct ParkedRead {
+    /* Handlers may write this far before and after what they are handed, as into the receive buffer */
+    static const unsigned int PADDING = 32;
+
+    /* Null if the socket closed before all of it was handed back */
+    void *socket;
+    us_socket_t *(*onData)(us_socket_t *, char *, int);
+    /* Called as the last of it was handed back, with whether we paused reads of the socket in the meantime */
+    void (*done)(void *socket, bool paused);
+    bool paused;
+    /* Paused by the application (see AsyncSocket::pause), nothing is handed back until resumed */
+    bool held;
+    /* Not yet handed back from offset on, reads arriving meanwhile are appended */
+    size_t offset;
+    std::string data;
+    /* Set by shedding, the socket is held for as long as this says it still queues more than its share */
+    bool (*shed)(void *socket) = nullptr;
+};
+
+/* What a loop publishes of how busy it is, for balancing connections among loops (see App::addChildApp) */
+struct LoopLoad {
+    /* Sockets open, and handed to the loop but not yet adopted */
+    unsigned int connections;
+    /* How late the last tick of the 1 second date timer fired */
+    unsigned int lagMicroseconds;
+};
+
+/* Where a busy polling loop (see Loop::setBusyPoll) spent its time waiting for events */
+struct BusyPollStats {
+    /* Polls that returned right away so that we kept spinning, and polls that blocked */
+    unsigned long long spins = 0, blocks = 0;
+    /* Up to the first event of the poll (or its end, if none) */
+    unsigned long long spinMicroseconds = 0, blockedMicroseconds = 0;
+};
+
+/* Counters of one or more loops, as read at some point (see LoopMetrics) */
+struct LoopMetricsSnapshot {
+    unsigned long long accepted = 0, closed = 0, requests = 0;
+    /* Read from and handed to sockets (HTTP and WebSocket, framing included) */
+    unsigned long long bytesIn = 0, bytesOut = 0;
+    /* Complete WebSocket messages received, and sent */
+    unsigned long long messagesIn = 0, messagesOut = 0;
+    /* Queued as backpressure, as of the end of the last iteration */
+    unsigned long long backPressure = 0;
+    /* Callbacks deferred from other threads not yet run */
+    unsigned long long deferQueueDepth = 0;
+    /* Connections and requests turned away by the rate limiter of an app (see App::rateLimit) */
+    unsigned long long rateLimited = 0;
+
+    LoopMetricsSnapshot &operator+=(const LoopMetricsSnapshot &other) {
+        accepted += other.accepted;
+        closed += other.closed;
+        requests += other.requests;
+        bytesIn += other.bytesIn;
+        bytesOut += other.bytesOut;
+        messagesIn += other.messagesIn;
+        messagesOut += other.messagesOut;
+        backPressure += other.backPressure;
+        deferQueueDepth += other.deferQueueDepth;
+        rateLimited += other.rateLimited;
+        return *this;
+    }
+};
+
+/* Where the memory of a loop goes, from counters kept as it allocates rather than by walking anything, so that it can
+ * be polled often (see Loop::getMemoryStats and App::getMemoryStats) */
+struct MemoryStats {
+    /* Open sockets, as HTTP (HTTP/2 included) and as WebSocket */
+    unsigned long long httpSockets = 0, webSockets = 0;
+    /* Queued as backpressure, and held in blocks for it (idle ones included) */
+    unsigned long long backPressureBytes = 0, backPressureBlockBytes = 0;
+    /* Held by zlib for compression streams, and for their scratch buffers */
+    unsigned long long zlibBytes = 0;
+    /* Held for partial HTTP requests (idle blocks included) */
+    unsigned long long fallbackBytes = 0;
+    /* Callbacks deferred from other threads not yet run */
+    unsigned long long deferQueueDepth = 0;
+    /* Of the TopicTree of an App, none for a loop */
+    unsigned long long topics = 0, subscribers = 0, outgoingMessages = 0;
+
+    MemoryStats &operator+=(const MemoryStats &other) {
+        httpSockets += other.httpSockets;
+        webSockets += other.webSockets;
+        backPressureBytes += other.backPressureBytes;
+        backPressureBlockBytes += other.backPressureBlockBytes;
+        zlibBytes += other.zlibBytes;
+        fallbackBytes += other.fallbackBytes;
+        deferQueueDepth += other.deferQueueDepth;
+        topics += other.topics;
+        subscribers += other.subscribers;
+        outgoingMessages += other.outgoingMessages;
+        return *this;
+    }
+};
+
+/* Counters kept by every loop on its hot paths, written by the loop only (but for deferred) as plain relaxed stores
+ * and read by any thread without locking. Padded rather than aligned (LoopData is aligned to 16 bytes only) so that
+ * readers never share a cache line with the rest of what the loop writes */
+struct LoopMetrics {
+    struct Counter {
+        std::atomic<unsigned long long> value{0};
+
+        /* Our loop only, no read-modify-write needed */
+        void add(unsigned long long n = 1) {
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        unsigned long long get() const {
+            return value.load(std::memory_order_relaxed);
+        }
+    };
+
+private:
+    char leadingPadding[64];
+
+public:
+    Counter accepted, closed, requests, bytesIn, bytesOut, messagesIn, messagesOut, backPressure, rateLimited;
+    /* Held by the pools of our thread, as of the end of the last iteration like backPressure */
+    Counter backPressureBlockBytes, fallbackBytes, zlibBytes;
+    /* Pushed to by other threads (see Loop::defer), so counted with fetch_add, run by us */
+    std::atomic<unsigned long long> deferred{0};
+    Counter defersRun;
+
+private:
+    char trailingPadding[64];
+
+public:
+    /* Any thread */
+    LoopMetricsSnapshot snapshot() const {
+        LoopMetricsSnapshot snapshot;
+        snapshot.accepted = accepted.get();
+        snapshot.closed = closed.get();
+        snapshot.requests = requests.get();
+        snapshot.bytesIn = bytesIn.get();
+        snapshot.bytesOut = bytesOut.get();
+        snapshot.messagesIn = messagesIn.get();
+        snapshot.messagesOut = messagesOut.get();
+        snapshot.backPressure = backPressure.get();
+        snapshot.rateLimited = rateLimited.get();
+        unsigned long long run = defersRun.get(), pushed = deferred.load(std::memory_order_relaxed);
+        snapshot.deferQueueDepth = pushed > run ? pushed - run : 0;
+        return snapshot;
+    }
+};
+
+/* What the shedding policy does with a socket queuing more than its share, while over the backpressure budget.
+ * Only WebSockets can drop messages, HTTP responses cannot drop bytes so they ignore SHED_DROP */
+enum BackPressureShedding {
+    SHED_NOTHING,
+    /* Drop the message being sent, as if over maxBackpressure */
+    SHED_DROP,
+    /* Close the socket */
+    SHED_CLOSE,
+    /* Pause the socket's reads, as over the read budget, until it queues no more than its share or the budget is met */
+    SHED_PAUSE
+};
+
 struct alignas(16) LoopData {
     friend struct Loop;
 private:
-    std::mutex deferMutex;
-    int currentDeferQueue = 0;
-    std::vector<MoveOnlyFunction<void()>> deferQueues[2];
+    /* Deferred from other threads, which wake us up once until we ran them */
+    DeferQueue deferQueue;
+    std::atomic<bool> wakeupPending{false};
+    /* Deferred from our own thread while dispatching events, run once done (no wakeup needed) */
+    std::vector<MoveOnlyFunction<void()>> localDefers, runningDefers;
+    bool dispatching = false;
 
-    /* Map from void ptr to handler */
-    std::map<void *, MoveOnlyFunction<void(Loop *)>> postHandlers, preHandlers;
+    /* Keyed by void ptr, run by priority then in order added */
+    LoopHooks postHandlers, preHandlers;
+    /* Run once a second, right after the date is updated */
+    LoopHooks dateHandlers;
 
 public:
     LoopData() {
@@ -51,39 +286,50 @@ public:
     }
 
     ~LoopData() {
+        /* Nothing resumes what is left of our coroutines, and their frames must go back before our pools go */
+        while (coroutines) {
+            CoroutineLink *link = coroutines;
+            link->unlink();
+            link->abort(link);
+        }
+
         /* If we have had App.ws called with compression we need to clear this */
         if (zlibContext) {
             delete zlibContext;
             delete inflationStream;
             delete deflationStream;
         }
-        delete [] corkBuffer;
+        memoryResource->deallocate(corkBuffer, corkBufferSize);
+        for (CorkSlice *slice : corkSlices) {
+            delete slice;
+        }
+        for (CorkSlice *slice : idleCorkSlices) {
+            delete slice;
+        }
+        for (OffloadedJob *job : offloadedJobs) {
+            delete job;
+        }
+        for (ParkedRead *parkedRead : parkedReads) {
+            delete parkedRead;
+        }
+        for (ParkedRead *parkedRead : pausedReads) {
+            delete parkedRead;
+        }
+        for (DeflationStream *deflationStream : idleDeflationStreams) {
+            delete deflationStream;
+        }
+        for (GzipStream *gzipStream : idleGzipStreams) {
+            delete gzipStream;
+        }
+        delete socketRegistry;
     }
 
+    /* Mostly only the seconds digits change */
     void updateDate() {
+        time_t previous = cacheTimepoint;
         cacheTimepoint = time(0);
-        struct tm tstruct = {};
-#ifdef _WIN32
-        /* Micro, fucking soft never follows spec. */
-        gmtime_s(&tstruct, &cacheTimepoint);
-#else
-        gmtime_r(&cacheTimepoint, &tstruct);
-#endif
-        static const char wday_name[][4] = {
-            "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
-        };
-        static const char mon_name[][4] = {
-            "Jan", "Feb", "Mar", "Apr", "May", "Jun",
-            "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
-        };
-        snprintf(date, 32, "%.3s, %.2u %.3s %.4u %.2u:%.2u:%.2u GMT",
-            wday_name[tstruct.tm_wday],
-            tstruct.tm_mday % 99,
-            mon_name[tstruct.tm_mon],
-            (1900 + tstruct.tm_year) % 9999,
-            tstruct.tm_hour % 99,
-            tstruct.tm_min % 99,
-            tstruct.tm_sec % 99);
+        utils::updateHttpDate((int64_t) previous, (int64_t) cacheTimepoint, date);
+        date[29] = 0;
     }
 
     char date[32];
@@ -92,20 +338,406 @@ public:
     /* Be silent */
     bool noMark = false;
 
-    /* Good 16k for SSL perf. */
+    /* Good 16k for SSL perf. The default, see setCorkBufferSize */
     static const unsigned int CORK_BUFFER_SIZE = 16 * 1024;
+    /* A cork slice must always fit in the cork buffer */
+    static constexpr unsigned int MIN_CORK_BUFFER_SIZE = CorkSlice::SIZE;
+    static constexpr unsigned int MAX_CORK_BUFFER_SIZE = 1024 * 1024;
+    /* Messages observed before adapting the size */
+    static constexpr unsigned int CORK_ADAPT_WINDOW = 4096;
+
+    /* Large buffers of this loop come from here, see Loop::setMemoryResource */
+    std::pmr::memory_resource *memoryResource = std::pmr::new_delete_resource();
+    std::unique_ptr<HugePageResource> hugePageResource;
 
     /* Cork data */
-    char *corkBuffer = new char[CORK_BUFFER_SIZE];
+    unsigned int corkBufferSize = CORK_BUFFER_SIZE;
+    char *corkBuffer = (char *) memoryResource->allocate(CORK_BUFFER_SIZE);
     unsigned int corkOffset = 0;
     void *corkedSocket = nullptr;
 
+    /* Resizing is deferred until nothing is corked, 0 if none is pending */
+    unsigned int nextCorkBufferSize = 0;
+
+    /* Bounds of the adaptive cork buffer, 0 if it is fixed */
+    unsigned int minAdaptiveCorkBufferSize = 0, maxAdaptiveCorkBufferSize = 0;
+    unsigned int observedMessages = 0, largestObservedMessage = 0;
+
+    void setCorkBufferSize(unsigned int size) {
+        nextCorkBufferSize = std::min<unsigned int>(std::max<unsigned int>(size, MIN_CORK_BUFFER_SIZE), MAX_CORK_BUFFER_SIZE);
+        resizeCorkBuffer();
+    }
+
+    void resizeCorkBuffer() {
+        if (!nextCorkBufferSize || corkedSocket || corkOffset) {
+            return;
+        }
+        if (nextCorkBufferSize != corkBufferSize) {
+            memoryResource->deallocate(corkBuffer, corkBufferSize);
+            corkBuffer = (char *) memoryResource->allocate(nextCorkBufferSize);
+            corkBufferSize = nextCorkBufferSize;
+        }
+        nextCorkBufferSize = 0;
+    }
+
+    /* The cork buffer moves over now, zlib scratch space once first needed */
+    void setMemoryResource(std::pmr::memory_resource *resource) {
+        if (corkedSocket || corkOffset) {
+            std::cerr << "Error: The memory resource cannot change while corked!" << std::endl;
+            std::terminate();
+        }
+        char *buffer = (char *) resource->allocate(corkBufferSize);
+        memoryResource->deallocate(corkBuffer, corkBufferSize);
+        corkBuffer = buffer;
+        memoryResource = resource;
+    }
+
+    /* Lets the cork buffer follow the largest message of every window, so that it goes the fast path */
+    void observeMessage(size_t length) {
+        if (!maxAdaptiveCorkBufferSize) {
+            return;
+        }
+        largestObservedMessage = std::max<unsigned int>(largestObservedMessage, (unsigned int) std::min<size_t>(length, MAX_CORK_BUFFER_SIZE));
+        if (++observedMessages == CORK_ADAPT_WINDOW) {
+            /* Room for framing, rounded up to a power of two */
+            unsigned int size = MIN_CORK_BUFFER_SIZE;
+            while (size < largestObservedMessage + 16 && size < maxAdaptiveCorkBufferSize) {
+                size *= 2;
+            }
+            nextCorkBufferSize = std::min<unsigned int>(std::max<unsigned int>(size, minAdaptiveCorkBufferSize), maxAdaptiveCorkBufferSize);
+            observedMessages = largestObservedMessage = 0;
+        }
+    }
+
+    /* Slices handed out this iteration, and idle ones kept for reuse */
+    std::vector<CorkSlice *> corkSlices, idleCorkSlices;
+
+    CorkSlice *acquireCorkSlice(void *socket, void (*flush)(void *)) {
+        CorkSlice *slice;
+        if (idleCorkSlices.size()) {
+            slice = idleCorkSlices.back();
+            idleCorkSlices.pop_back();
+        } else {
+            slice = new CorkSlice;
+        }
+        slice->socket = socket;
+        slice->flush = flush;
+        slice->deadline = 0;
+        slice->length = 0;
+        corkSlices.push_back(slice);
+        return slice;
+    }
+
+    /* Monotonic microseconds, for coalescing deadlines */
+    static long long now() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /* Called after every iteration, flushing may not cork. Coalesced slices not yet due are kept,
+     * returns the earliest deadline among them, or 0 if none */
+    long long flushCorkSlices() {
+        long long currentTime = 0, nextDeadline = 0;
+        size_t kept = 0;
+        for (CorkSlice *slice : corkSlices) {
+            if (slice->socket && slice->deadline) {
+                if (!currentTime) {
+                    currentTime = now();
+                }
+                if (slice->deadline > currentTime) {
+                    nextDeadline = nextDeadline ? std::min(nextDeadline, slice->deadline) : slice->deadline;
+                    corkSlices[kept++] = slice;
+                    continue;
+                }
+            }
+            if (slice->socket) {
+                slice->flush(slice->socket);
+            }
+            idleCorkSlices.push_back(slice);
+        }
+        corkSlices.resize(kept);
+        return nextDeadline;
+    }
+
+    /* Bytes of a read consumed at a time, 0 for all of them. Sockets over budget this many iterations in a row
+     * get their reads paused for an iteration, 0 for never (see Loop::setReadBudget) */
+    unsigned int readBudget = 0, readBudgetPauseAfter = 0;
+    /* Counted by resumeParkedReads, for telling iterations in a row */
+    uint32_t readIteration = 0;
+    /* Set while handing back parked reads, which were counted and let through before being parked */
+    bool resumingRead = false;
+    /* Handed back after the handlers of this iteration, and held until the next one for paused sockets */
+    std::deque<ParkedRead *> parkedReads;
+    std::vector<ParkedRead *> pausedReads;
+    /* What handlers are handed back, padded */
+    std::string parkedReadBuffer;
+
+    ParkedRead *parkRead(void *socket, us_socket_t *(*onData)(us_socket_t *, char *, int), void (*done)(void *, bool), const char *data, size_t length, bool paused, bool held = false) {
+        ParkedRead *parkedRead = new ParkedRead{socket, onData, done, paused, held, 0, std::string(data, length)};
+        if (paused) {
+            pausedReads.push_back(parkedRead);
+        } else {
+            parkedReads.push_back(parkedRead);
+        }
+        return parkedRead;
+    }
+
+    /* Called after every iteration, before post handlers so that what is published meanwhile is drained with
+     * the rest. Every parked read gets one budget per round until all of them are handed back */
+    void resumeParkedReads() {
+        readIteration++;
+
+        while (parkedReads.size()) {
+            ParkedRead *parkedRead = parkedReads.front();
+            parkedReads.pop_front();
+
+            /* Looked at again every iteration until resumed, or drained below its share */
+            if (parkedRead->socket && (parkedRead->held || (parkedRead->shed && parkedRead->shed(parkedRead->socket)))) {
+                pausedReads.push_back(parkedRead);
+                continue;
+            }
+
+            size_t length = parkedRead->data.length() - parkedRead->offset;
+            if (parkedRead->socket && length) {
+                length = readBudget ? std::min<size_t>(length, readBudget) : length;
+                parkedReadBuffer.resize(std::max<size_t>(parkedReadBuffer.length(), length + 2 * ParkedRead::PADDING));
+                memcpy(parkedReadBuffer.data() + ParkedRead::PADDING, parkedRead->data.data() + parkedRead->offset, length);
+                parkedRead->offset += length;
+
+                resumingRead = true;
+                parkedRead->onData((us_socket_t *) parkedRead->socket, parkedReadBuffer.data() + ParkedRead::PADDING, (int) length);
+                resumingRead = false;
+            }
+
+            if (parkedRead->socket && parkedRead->offset < parkedRead->data.length()) {
+                parkedReads.push_back(parkedRead);
+                continue;
+            }
+            if (parkedRead->socket) {
+                parkedRead->done(parkedRead->socket, parkedRead->paused);
+            }
+            delete parkedRead;
+        }
+
+        /* Those parked with their reads paused this iteration are handed back after the next one */
+        for (ParkedRead *parkedRead : pausedReads) {
+            parkedReads.push_back(parkedRead);
+        }
+        pausedReads.clear();
+    }
+
+    /* Backpressure allowed for all sockets of this loop together, 0 for unlimited */
+    size_t maxLoopBackPressure = 0;
+    /* Asked about sockets queuing above average while over budget (this loop's or the process') */
+    MoveOnlyFunction<BackPressureShedding(size_t buffered, size_t average)> shedPolicy;
+
     /* Per message deflate data */
     ZlibContext *zlibContext = nullptr;
     InflationStream *inflationStream = nullptr;
     DeflationStream *deflationStream = nullptr;
 
+    /* Deflated and skipped messages of this loop */
+    CompressionStats compressionStats;
+
+    /* Dedicated compressors given back by idle or closed sockets, reset and kept for the next ones */
+    static constexpr unsigned int MAX_IDLE_DEFLATION_STREAMS = 256;
+    std::vector<DeflationStream *> idleDeflationStreams;
+
+    DeflationStream *acquireDeflationStream(CompressOptions compressOptions) {
+        for (size_t i = idleDeflationStreams.size(); i--; ) {
+            if (idleDeflationStreams[i]->compressOptions == compressOptions) {
+                DeflationStream *deflationStream = idleDeflationStreams[i];
+                idleDeflationStreams[i] = idleDeflationStreams.back();
+                idleDeflationStreams.pop_back();
+                return deflationStream;
+            }
+        }
+        return new DeflationStream(compressOptions);
+    }
+
+    void releaseDeflationStream(DeflationStream *deflationStream) {
+        if (idleDeflationStreams.size() < MAX_IDLE_DEFLATION_STREAMS) {
+            deflationStream->reset();
+            idleDeflationStreams.push_back(deflationStream);
+        } else {
+            delete deflationStream;
+        }
+    }
+
+    /* Streams of compressed HTTP responses (see HttpResponse::compress), kept for the next ones */
+    static constexpr unsigned int MAX_IDLE_GZIP_STREAMS = 64;
+    std::vector<GzipStream *> idleGzipStreams;
+    /* What responses compress to, valid until the next one compresses */
+    std::string gzipBuffer;
+
+    GzipStream *acquireGzipStream() {
+        if (idleGzipStreams.size()) {
+            GzipStream *gzipStream = idleGzipStreams.back();
+            idleGzipStreams.pop_back();
+            return gzipStream;
+        }
+        return new GzipStream;
+    }
+
+    void releaseGzipStream(GzipStream *gzipStream) {
+        if (idleGzipStreams.size() < MAX_IDLE_GZIP_STREAMS) {
+            gzipStream->reset();
+            idleGzipStreams.push_back(gzipStream);
+        } else {
+            delete gzipStream;
+        }
+    }
+
+    /* Bodies of requests being collected (see HttpResponse::collectBody), kept with their capacity for the next ones */
+    static constexpr unsigned int MAX_IDLE_BODY_BUFFERS = 64;
+    static constexpr size_t MAX_IDLE_BODY_CAPACITY = 1024 * 1024;
+    std::vector<std::string> idleBodyBuffers;
+
+    std::string acquireBodyBuffer() {
+        if (idleBodyBuffers.size()) {
+            std::string body = std::move(idleBodyBuffers.back());
+            idleBodyBuffers.pop_back();
+            return body;
+        }
+        return {};
+    }
+
+    void releaseBodyBuffer(std::string &&body) {
+        if (idleBodyBuffers.size() < MAX_IDLE_BODY_BUFFERS && body.capacity() <= MAX_IDLE_BODY_CAPACITY) {
+            body.clear();
+            idleBodyBuffers.push_back(std::move(body));
+        }
+    }
+
+    /* Messages of at least offloadThreshold bytes are compressed on this pool, if any */
+    CompressionPool *compressionPool = nullptr;
+    size_t offloadThreshold = 0;
+    /* In the order they were offloaded, completed from the front */
+    std::deque<OffloadedJob *> offloadedJobs;
+    /* Jobs still running on the pool, which will defer to us */
+    std::atomic<unsigned int> offloadsInFlight = 0;
+    /* Where Loop::offload runs tasks, the shared pool if null */
+    TaskPool *taskPool = nullptr;
+
+    /* Frames of coroutines run by this loop (see Task.h), larger ones are from the heap */
+    static constexpr size_t COROUTINE_FRAME_CLASSES = 4, MIN_COROUTINE_FRAME = 256;
+    SlabPool coroutineFrames[COROUTINE_FRAME_CLASSES] = {MIN_COROUTINE_FRAME, MIN_COROUTINE_FRAME << 1, MIN_COROUTINE_FRAME << 2, MIN_COROUTINE_FRAME << 3};
+    /* Coroutines of this loop not done yet */
+    CoroutineLink *coroutines = nullptr;
+
+    /* Side blocks of sockets, for state they only have at times (see HttpResponseData and WebSocketData) */
+    static constexpr size_t SIDE_BLOCK_SIZE = 192;
+    SlabPool sideBlocks{SIDE_BLOCK_SIZE};
+
+    /* Idle timeouts, pings and lifetimes of WebSockets, ticked with the date */
+    TimingWheel timingWheel;
+
+    /* Handles other threads send to our WebSockets with, made on first use */
+    SocketRegistry *socketRegistry = nullptr;
+
+    /* Our counters, read by App::getMetrics */
+    LoopMetrics metrics;
+
+    /* Busy polling: we keep polling without blocking for up to busyPollMicroseconds after the last event,
+     * as long as events have been arriving closer together than that */
+    unsigned int busyPollMicroseconds = 0;
+    /* SO_BUSY_POLL of accepted sockets, 0 to leave it */
+    int socketBusyPollMicroseconds = 0;
+    bool spinning = false;
+    unsigned int pollEvents = 0;
+    long long polledAt = 0, firstEventAt = 0, lastEventAt = 0, averageEventGap = 0;
+    BusyPollStats busyPollStats;
+
+    /* Iterations of this loop, if profiled (see Loop::setProfiling) */
+    std::unique_ptr<LoopProfile> profile;
+    /* Profiles stopped while a handler or onStall of theirs ran, freed once the iteration is over */
+    std::vector<std::unique_ptr<LoopProfile>> retiredProfiles;
+
+    void stopProfiling() {
+        if (profile && profile->busy()) {
+            retiredProfiles.push_back(std::move(profile));
+        }
+        profile.reset();
+    }
+
+    /* What connections of this loop receive, if captured (see Loop::captureTraffic) */
+    std::unique_ptr<TrafficCapture> trafficCapture;
+
+    /* Called as events are dispatched, for busy polling to tell arrivals from spins */
+    void noteEvent() {
+        if (busyPollMicroseconds && !pollEvents++) {
+            firstEventAt = now();
+        }
+        if (profile) {
+            profile->noteEvent();
+        }
+    }
+
+    /* Right before polling, returns whether the poll should not block */
+    bool beforePoll() {
+        polledAt = now();
+        pollEvents = 0;
+        long long budget = busyPollMicroseconds;
+        spinning = lastEventAt && polledAt - lastEventAt < budget && averageEventGap < budget;
+        return spinning;
+    }
+
+    /* Right after dispatching what the poll returned */
+    void afterPoll() {
+        long long waited = (pollEvents ? firstEventAt : now()) - polledAt;
+        if (spinning) {
+            busyPollStats.spins++;
+            busyPollStats.spinMicroseconds += (unsigned long long) waited;
+        } else {
+            busyPollStats.blocks++;
+            busyPollStats.blockedMicroseconds += (unsigned long long) waited;
+        }
+
+        if (pollEvents) {
+            long long gap = lastEventAt ? firstEventAt - lastEventAt : busyPollMicroseconds;
+            averageEventGap = (averageEventGap * 7 + gap) / 8;
+            lastEventAt = firstEventAt;
+        }
+    }
+
+    /* Written by this loop (handedOff also by whoever hands us sockets), read from any thread */
+    std::atomic<unsigned int> connections{0}, handedOff{0}, lagMicroseconds{0};
+    /* Of connections, those that are WebSockets */
+    std::atomic<unsigned int> webSockets{0};
+    /* When the date timer last ticked */
+    long long lastTick = 0;
+
+    /* Any thread */
+    MemoryStats getMemoryStats() const {
+        MemoryStats stats;
+        unsigned int webSockets = this->webSockets.load(std::memory_order_relaxed);
+        unsigned int connections = this->connections.load(std::memory_order_relaxed);
+        stats.httpSockets = connections > webSockets ? connections - webSockets : 0;
+        stats.webSockets = webSockets;
+        stats.backPressureBytes = metrics.backPressure.get();
+        stats.backPressureBlockBytes = metrics.backPressureBlockBytes.get();
+        stats.zlibBytes = metrics.zlibBytes.get();
+        stats.fallbackBytes = metrics.fallbackBytes.get();
+        stats.deferQueueDepth = metrics.snapshot().deferQueueDepth;
+        return stats;
+    }
+
+    LoopLoad getLoad() const {
+        return {connections.load(std::memory_order_relaxed) + handedOff.load(std::memory_order_relaxed), lagMicroseconds.load(std::memory_order_relaxed)};
+    }
+
+    /* Every second, noting how late that is */
+    void tick() {
+        long long tickedAt = now();
+        if (lastTick) {
+            long long lag = tickedAt - lastTick - 1000000;
+            lagMicroseconds.store(lag > 0 ? (unsigned int) std::min<long long>(lag, UINT32_MAX) : 0, std::memory_order_relaxed);
+        }
+        lastTick = tickedAt;
+    }
+
     us_timer_t *dateTimer;
+    /* Wakes the loop for coalesced slices */
+    us_timer_t *coalesceTimer;
 };
 
 }
@@ -0,0 +1,142 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_LOOPHOOKS_H
+#define UWS_LOOPHOOKS_H
+
+/* Hooks run every iteration (or every second), by priority then in order of registration, off a flat list.
+ * Removal is O(1): the slot of the key is emptied, and empty slots are dropped once the list is not running.
+ * Hooks added while running join it once done, hooks removed while running (themselves included) are
+ * skipped from then on and destroyed once done */
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include "MoveOnlyFunction.h"
+
+namespace uWS {
+
+struct Loop;
+
+struct LoopHooks {
+    /* Lower runs first. Hooks of users run at DEFAULT_PRIORITY, pub/sub drains at LATE_PRIORITY */
+    static constexpr int EARLY_PRIORITY = -100;
+    static constexpr int DEFAULT_PRIORITY = 0;
+    static constexpr int LATE_PRIORITY = 100;
+
+private:
+    struct Hook {
+        /* Null once removed */
+        void *key;
+        int priority;
+        MoveOnlyFunction<void(Loop *)> handler;
+    };
+
+    std::vector<Hook> hooks, pending;
+    /* Slot in hooks of every key in there */
+    std::unordered_map<void *, size_t> slots;
+    size_t removed = 0;
+    bool running = false;
+
+    /* Drops empty slots and inserts what is pending, then finds the slots anew */
+    void settle() {
+        if (removed) {
+            hooks.erase(std::remove_if(hooks.begin(), hooks.end(), [](const Hook &hook) {
+                return !hook.key;
+            }), hooks.end());
+            removed = 0;
+        }
+        for (Hook &hook : pending) {
+            if (hook.key) {
+                hooks.insert(std::upper_bound(hooks.begin(), hooks.end(), hook.priority, [](int priority, const Hook &other) {
+                    return priority < other.priority;
+                }), std::move(hook));
+            }
+        }
+        pending.clear();
+
+        slots.clear();
+        for (size_t i = 0; i < hooks.size(); i++) {
+            slots[hooks[i].key] = i;
+        }
+    }
+
+public:
+    /* Same as emplace in a map, a key already added keeps its hook */
+    void add(void *key, MoveOnlyFunction<void(Loop *)> &&handler, int priority = DEFAULT_PRIORITY) {
+        if (has(key)) {
+            return;
+        }
+        pending.push_back({key, priority, std::move(handler)});
+        if (!running) {
+            settle();
+        }
+    }
+
+    void remove(void *key) {
+        auto it = slots.find(key);
+        if (it != slots.end()) {
+            Hook &hook = hooks[it->second];
+            hook.key = nullptr;
+            /* It may be the very hook running right now */
+            if (!running) {
+                hook.handler = nullptr;
+            }
+            slots.erase(it);
+            removed++;
+            return;
+        }
+        for (Hook &hook : pending) {
+            if (hook.key == key) {
+                hook.key = nullptr;
+                hook.handler = nullptr;
+            }
+        }
+    }
+
+    bool has(void *key) {
+        return slots.count(key) || std::any_of(pending.begin(), pending.end(), [key](const Hook &hook) {
+            return hook.key == key;
+        });
+    }
+
+    size_t size() {
+        return slots.size() + (size_t) std::count_if(pending.begin(), pending.end(), [](const Hook &hook) {
+            return hook.key != nullptr;
+        });
+    }
+
+    void run(Loop *loop) {
+        running = true;
+        for (size_t i = 0, count = hooks.size(); i < count; i++) {
+            if (hooks[i].key) {
+                hooks[i].handler(loop);
+            }
+        }
+        running = false;
+
+        if (removed || pending.size()) {
+            settle();
+        }
+    }
+};
+
+}
+
+#endif // UWS_LOOPHOOKS_H
@@ -0,0 +1,262 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_LOOPPROFILE_H
+#define UWS_LOOPPROFILE_H
+
+/* How healthy a loop is, iteration by iteration: how long dispatching what a poll returned takes, how much of that is
+ * spent in handlers of the application, and which handlers held the loop the longest (see Loop::setProfiling) */
+
+#include "RouteMetrics.h"
+#include "MoveOnlyFunction.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace uWS {
+
+/* A handler, or a whole iteration, that held the loop for at least the stall threshold */
+struct LoopStall {
+    /* As LoopProfile::now, when it began, and for how long */
+    long long startedAt = 0;
+    unsigned long long microseconds = 0;
+    /* "http", "open", "message", "drain", "close" or "defer" for handlers, "iteration" for iterations that stalled
+     * without any one handler doing so */
+    const char *kind = "";
+    /* Method and pattern of the HTTP route, or the pattern of the WebSocket route */
+    std::string label;
+};
+
+struct LoopProfileSnapshot {
+    /* Per iteration: from its first event until done with what the poll returned (defers and flushing included),
+     * of that the time in handlers, and the events dispatched */
+    HistogramSnapshot iterationMicroseconds, handlerMicroseconds, events;
+    /* Draining deferred callbacks, of the iterations that ran any */
+    HistogramSnapshot deferMicroseconds;
+    /* Waiting for the first event of every poll */
+    unsigned long long pollMicroseconds = 0;
+    /* All stalls, and the longest of them, longest first */
+    unsigned long long stallCount = 0;
+    std::vector<LoopStall> stalls;
+
+    unsigned long long iterations() const {
+        return iterationMicroseconds.count;
+    }
+
+    /* Not in handlers: parsing, framing, writing, timers */
+    unsigned long long libraryMicroseconds() const {
+        return iterationMicroseconds.sum > handlerMicroseconds.sum ? iterationMicroseconds.sum - handlerMicroseconds.sum : 0;
+    }
+};
+
+/* Written by its loop only, read by any thread like LoopMetrics */
+struct LoopProfile {
+    static constexpr size_t MAX_STALLS = 16;
+
+    /* Monotonic microseconds, same as LoopData::now */
+    static long long now() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /* Replaceable for tests */
+    long long (*clock)() = now;
+    unsigned int stallThresholdMicroseconds;
+    /* Called on the loop as stalls end (see setOnStall) */
+    MoveOnlyFunction<void(const LoopStall &)> onStall;
+
+    LoopProfile(unsigned int stallThresholdMicroseconds) : stallThresholdMicroseconds(stallThresholdMicroseconds) {}
+
+    /* Right before polling. Iterations begun before profiling was turned on are not recorded */
+    void beforePoll() {
+        polledAt = clock();
+        firstEventAt = 0;
+        iterationEvents = 0;
+        iterationHandlers = iterationDefers = 0;
+        ranDefers = stalled = false;
+    }
+
+    void noteEvent() {
+        if (!iterationEvents++ && !firstEventAt) {
+            firstEventAt = clock();
+        }
+    }
+
+    /* Handlers nest (a message handler closing its socket runs the close handler), only the outermost is timed */
+    void beginHandler(const char *kind, const std::string *label) {
+        if (depth++) {
+            return;
+        }
+        handlerStartedAt = clock();
+        if (!firstEventAt) {
+            firstEventAt = handlerStartedAt;
+        }
+        handlerKind = kind;
+        handlerLabel = label;
+    }
+
+    /* Returns the microseconds of the handler, if outermost */
+    long long endHandler() {
+        if (--depth) {
+            return 0;
+        }
+        long long microseconds = clock() - handlerStartedAt;
+        iterationHandlers += microseconds;
+        if (microseconds >= stallThresholdMicroseconds) {
+            stall(handlerKind, handlerLabel, handlerStartedAt, microseconds);
+        }
+        return microseconds;
+    }
+
+    void beginDefers() {
+        beginHandler("defer", nullptr);
+    }
+
+    void endDefers() {
+        iterationDefers += endHandler();
+        ranDefers = true;
+    }
+
+    /* Once done with the iteration, flushing included */
+    void afterIteration() {
+        if (!polledAt) {
+            return;
+        }
+        long long doneAt = clock(), startedAt = firstEventAt ? firstEventAt : doneAt;
+        long long busy = doneAt - startedAt;
+
+        iterationMicroseconds.record((uint64_t) busy);
+        handlerMicroseconds.record((uint64_t) iterationHandlers);
+        events.record(iterationEvents);
+        if (ranDefers) {
+            deferMicroseconds.record((uint64_t) iterationDefers);
+        }
+        Histogram::add(pollMicroseconds, (unsigned long long) (startedAt - polledAt));
+
+        if (busy >= stallThresholdMicroseconds && !stalled) {
+            stall("iteration", nullptr, startedAt, busy);
+        }
+        polledAt = 0;
+    }
+
+    /* Any thread */
+    LoopProfileSnapshot snapshot() const {
+        LoopProfileSnapshot out;
+        iterationMicroseconds.snapshot(out.iterationMicroseconds);
+        handlerMicroseconds.snapshot(out.handlerMicroseconds);
+        events.snapshot(out.events);
+        deferMicroseconds.snapshot(out.deferMicroseconds);
+        out.pollMicroseconds = pollMicroseconds.load(std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(stallsMutex);
+        out.stallCount = stallCount;
+        out.stalls = stalls;
+        std::sort(out.stalls.begin(), out.stalls.end(), [](const LoopStall &a, const LoopStall &b) {
+            return a.microseconds > b.microseconds;
+        });
+        return out;
+    }
+
+    /* Whether a handler is being timed or onStall is running, so that we must not be freed from under it */
+    bool busy() const {
+        return depth || reporting;
+    }
+
+    /* From within onStall too, where it is only replaced once that returns */
+    void setOnStall(MoveOnlyFunction<void(const LoopStall &)> &&onStall) {
+        if (reporting) {
+            pendingOnStall = std::move(onStall);
+            replacingOnStall = true;
+            return;
+        }
+        this->onStall = std::move(onStall);
+    }
+
+private:
+    Histogram iterationMicroseconds, handlerMicroseconds, events, deferMicroseconds;
+    std::atomic<unsigned long long> pollMicroseconds{0};
+
+    long long polledAt = 0, firstEventAt = 0, handlerStartedAt = 0;
+    long long iterationHandlers = 0, iterationDefers = 0;
+    unsigned int iterationEvents = 0, depth = 0;
+    bool ranDefers = false, stalled = false;
+    bool reporting = false, replacingOnStall = false;
+    MoveOnlyFunction<void(const LoopStall &)> pendingOnStall;
+    const char *handlerKind = "";
+    const std::string *handlerLabel = nullptr;
+
+    /* Stalls are few, so they are locked rather than lock free */
+    mutable std::mutex stallsMutex;
+    unsigned long long stallCount = 0;
+    std::vector<LoopStall> stalls;
+
+    void stall(const char *kind, const std::string *label, long long startedAt, long long microseconds) {
+        stalled = true;
+        LoopStall stall = {startedAt, (unsigned long long) microseconds, kind, label ? *label : std::string()};
+        {
+            std::lock_guard<std::mutex> lock(stallsMutex);
+            stallCount++;
+            if (stalls.size() < MAX_STALLS) {
+                stalls.push_back(stall);
+            } else {
+                auto shortest = std::min_element(stalls.begin(), stalls.end(), [](const LoopStall &a, const LoopStall &b) {
+                    return a.microseconds < b.microseconds;
+                });
+                if (shortest->microseconds < stall.microseconds) {
+                    *shortest = stall;
+                }
+            }
+        }
+        if (onStall) {
+            reporting = true;
+            onStall(stall);
+            reporting = false;
+            if (replacingOnStall) {
+                onStall = std::move(pendingOnStall);
+                pendingOnStall = nullptr;
+                replacingOnStall = false;
+            }
+        }
+    }
+};
+
+/* Times a handler for as long as it is in scope, if profiling */
+struct ProfiledHandler {
+    LoopProfile *profile;
+
+    ProfiledHandler(LoopProfile *profile, const char *kind, const std::string *label = nullptr) : profile(profile) {
+        if (profile) {
+            profile->beginHandler(kind, label);
+        }
+    }
+
+    ~ProfiledHandler() {
+        if (profile) {
+            profile->endHandler();
+        }
+    }
+
+    ProfiledHandler(const ProfiledHandler &) = delete;
+    ProfiledHandler &operator=(const ProfiledHandler &) = delete;
+};
+
+}
+
+#endif // UWS_LOOPPROFILE_H
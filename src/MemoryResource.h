@@ -0,0 +1,209 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_MEMORYRESOURCE_H
+#define UWS_MEMORYRESOURCE_H
+
+/* The large buffers of a loop (cork buffer, zlib scratch space and backpressure blocks) are taken from a
+ * std::pmr::memory_resource, see Loop::setMemoryResource. Any resource can be plugged in, this one carves
+ * them from 2 MB arenas backed by huge pages where the system has them, so that the hot buffers of a loop
+ * share a few TLB entries, and binds the arenas to the NUMA node of the loop's thread */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace uWS {
+
+struct HugePageResource : std::pmr::memory_resource {
+    static constexpr size_t ARENA_SIZE = 2 * 1024 * 1024;
+
+    /* Power of two size classes, anything above MAX_SIZE (or aligned above MIN_SIZE) goes upstream */
+    static constexpr size_t MIN_SIZE = 64;
+    static constexpr size_t MAX_SIZE = 1024 * 1024;
+    static constexpr unsigned int NUM_CLASSES = 15;
+
+private:
+    struct Arena {
+        void *memory;
+        /* Explicitly huge, rather than hinted transparently huge (or from upstream) */
+        bool mapped, huge;
+    };
+
+    std::pmr::memory_resource *upstream;
+    int numaNode;
+    std::vector<Arena> arenas;
+    std::vector<void *> freeLists[NUM_CLASSES];
+    char *head = nullptr, *end = nullptr;
+
+    static unsigned int sizeClass(size_t bytes) {
+        unsigned int c = 0;
+        while ((MIN_SIZE << c) < bytes) {
+            c++;
+        }
+        return c;
+    }
+
+    /* Prefers the node of this resource for the pages of memory, before they are first touched */
+    void bind(void *memory) {
+#if defined(__linux__) && defined(SYS_mbind)
+        if (numaNode >= 0 && numaNode < 1024) {
+            unsigned long nodeMask[1024 / (8 * sizeof(unsigned long))] = {};
+            size_t node = (size_t) numaNode;
+            nodeMask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+            /* MPOL_PREFERRED, failing is fine since first touch places it on our node anyway */
+            syscall(SYS_mbind, memory, ARENA_SIZE, 1, nodeMask, sizeof(nodeMask) * 8, 0);
+        }
+#else
+        (void) memory;
+#endif
+    }
+
+    Arena mapArena() {
+#if defined(__linux__)
+        void *memory = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            return {memory, true, true};
+        }
+
+        /* No huge pages reserved, map twice the size to align to one and hint it transparently huge */
+        char *mapped = (char *) mmap(nullptr, ARENA_SIZE * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped != MAP_FAILED) {
+            char *aligned = (char *) (((uintptr_t) mapped + ARENA_SIZE - 1) & ~(uintptr_t) (ARENA_SIZE - 1));
+            if (aligned != mapped) {
+                munmap(mapped, (size_t) (aligned - mapped));
+            }
+            munmap(aligned + ARENA_SIZE, (size_t) (mapped + ARENA_SIZE - aligned));
+#ifdef MADV_HUGEPAGE
+            madvise(aligned, ARENA_SIZE, MADV_HUGEPAGE);
+#endif
+            return {aligned, true, false};
+        }
+#endif
+        return {upstream->allocate(ARENA_SIZE, 4096), false, false};
+    }
+
+    void unmapArena(Arena &arena) {
+#if defined(__linux__)
+        if (arena.mapped) {
+            munmap(arena.memory, ARENA_SIZE);
+            return;
+        }
+#endif
+        upstream->deallocate(arena.memory, ARENA_SIZE, 4096);
+    }
+
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        if (bytes > MAX_SIZE || alignment > MIN_SIZE) {
+            return upstream->allocate(bytes, alignment);
+        }
+        unsigned int c = sizeClass(bytes);
+        if (freeLists[c].size()) {
+            void *memory = freeLists[c].back();
+            freeLists[c].pop_back();
+            return memory;
+        }
+
+        size_t size = MIN_SIZE << c;
+        if ((size_t) (end - head) < size) {
+            /* What is left of the arena is handed out in the largest classes it fills */
+            while ((size_t) (end - head) >= MIN_SIZE) {
+                unsigned int left = std::min<unsigned int>(sizeClass((size_t) (end - head) + 1) - 1, NUM_CLASSES - 1);
+                freeLists[left].push_back(head);
+                head += MIN_SIZE << left;
+            }
+
+            Arena arena = mapArena();
+            if (arena.mapped) {
+                bind(arena.memory);
+            }
+            arenas.push_back(arena);
+            head = (char *) arena.memory;
+            end = head + ARENA_SIZE;
+        }
+        void *memory = head;
+        head += size;
+        return memory;
+    }
+
+    /* Kept for reuse until this resource goes */
+    void do_deallocate(void *memory, size_t bytes, size_t alignment) override {
+        if (bytes > MAX_SIZE || alignment > MIN_SIZE) {
+            upstream->deallocate(memory, bytes, alignment);
+            return;
+        }
+        freeLists[sizeClass(bytes)].push_back(memory);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+public:
+    /* The node of the calling thread by default, -1 to leave placement to first touch */
+    static int currentNumaNode() {
+#if defined(__linux__) && defined(SYS_getcpu)
+        unsigned int cpu, node;
+        if (!syscall(SYS_getcpu, &cpu, &node, nullptr)) {
+            return (int) node;
+        }
+#endif
+        return -1;
+    }
+
+    HugePageResource(int numaNode = currentNumaNode(), std::pmr::memory_resource *upstream = std::pmr::new_delete_resource()) : upstream(upstream), numaNode(numaNode) {}
+
+    HugePageResource(const HugePageResource &) = delete;
+    HugePageResource &operator=(const HugePageResource &) = delete;
+
+    /* Everything allocated from it must be deallocated before */
+    ~HugePageResource() {
+        for (Arena &arena : arenas) {
+            unmapArena(arena);
+        }
+    }
+
+    int getNumaNode() {
+        return numaNode;
+    }
+
+    size_t getArenas() {
+        return arenas.size();
+    }
+
+    /* Arenas backed by reserved huge pages, the rest are hinted transparently huge where supported */
+    size_t getHugePageArenas() {
+        size_t huge = 0;
+        for (Arena &arena : arenas) {
+            huge += arena.huge;
+        }
+        return huge;
+    }
+};
+
+}
+
+#endif // UWS_MEMORYRESOURCE_H
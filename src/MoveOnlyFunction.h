@@ -27,6 +27,8 @@ SOFTWARE.
 #ifndef _ANY_INVOKABLE_H_
 #define _ANY_INVOKABLE_H_
 
+#include <atomic>
+#include <cstddef>
 #include <functional>
 #include <memory>
 #include <type_traits>
@@ -87,11 +89,19 @@ namespace any_detail {
 第一个参数是所需存储的大小: sizeof(void*) 返回指针的大小，通常是 4 字节（32 位系统）或 8 字节（64 位系统）。
 第二个参数是对齐要求: sizeof(void*) * 2 计算出所需的存储大小，即两个指针的大小。
 */
-using buffer = std::aligned_storage_t<sizeof(void*) * 2, alignof(void*)>;
+/* The inline capacity is a template parameter, what does not fit in it is allocated. Never less than a
+ * pointer, which is what holds the allocation then */
+inline constexpr std::size_t default_capacity = sizeof(void*) * 2;
 
-template <class T>
+template <std::size_t Capacity>
+using buffer = std::aligned_storage_t<(Capacity < sizeof(void*) ? sizeof(void*) : Capacity), alignof(void*)>;
+
+/* Counts callables that did not fit inline, all capacities and threads together */
+inline std::atomic<unsigned long long> heap_allocations{0};
+
+template <class T, std::size_t Capacity>
 inline constexpr bool is_small_object_v =
-    sizeof(T) <= sizeof(buffer) && alignof(buffer) % alignof(T) == 0 &&
+    sizeof(T) <= sizeof(buffer<Capacity>) && alignof(buffer<Capacity>) % alignof(T) == 0 &&
     std::is_nothrow_move_constructible_v<T>;
     // 使用 std::is_nothrow_move_constructible_v 检查 T 是否可以无抛出地移动构造。这确保 T 的移动构造函数不会抛出异常
 
@@ -106,9 +116,10 @@ union 的对齐要求等于其成员中最大的对齐要求。在这个例子
 快速访问：由于 union 的成员共享同一块内存，访问 storage 的成员通常非常快，因为不需要额外的内存寻址操作。
 减少内存分配：对于小对象，可以直接在 buffer 中构造和销毁对象，避免了动态内存分配和释放的开销。
 */
+template <std::size_t Capacity>
 union storage {
   void* ptr_ = nullptr;
-  buffer buf_;
+  buffer<Capacity> buf_;
 };
 
 enum class action { destroy, move };
@@ -123,8 +134,10 @@ enum class action { destroy, move };
 模板参数：handler_traits 接受 R 和 ArgTypes... 作为模板参数，这使得 handler_traits 可以处理不同返回类型和参数类型的函数。
 扩展性：如果将来需要处理不同类型的函数（例如，返回值类型不同或参数列表不同），可以通过 handler_traits 的模板参数轻松扩展。
  */
-template <class R, class... ArgTypes>
+template <std::size_t Capacity, class R, class... ArgTypes>
 struct handler_traits {
+  using storage = any_detail::storage<Capacity>;
+
   template <class Derived>
   struct handler_base {
     static void handle(action act, storage* current, storage* other = nullptr) {
@@ -185,8 +198,14 @@ struct handler_traits {
     */
 
     static R call(storage& s, ArgTypes... args) {
-      return std::invoke(*static_cast<T*>(static_cast<void*>(&s.buf_)),
-                         std::forward<ArgTypes>(args)...);
+      /* Like std::function, a void signature discards what is returned */
+      if constexpr (std::is_void_v<R>) {
+        std::invoke(*static_cast<T*>(static_cast<void*>(&s.buf_)),
+                    std::forward<ArgTypes>(args)...);
+      } else {
+        return std::invoke(*static_cast<T*>(static_cast<void*>(&s.buf_)),
+                           std::forward<ArgTypes>(args)...);
+      }
     }
     /*
     static_cast<void*>(&s.buf_)：将 s.buf_ 的地址转换为 void* 类型。
@@ -201,6 +220,7 @@ struct handler_traits {
   struct large_handler : handler_base<large_handler<T>> {
     template <class... Args>
     static void create(storage& s, Args&&... args) {
+      heap_allocations.fetch_add(1, std::memory_order_relaxed);
       s.ptr_ = new T(std::forward<Args>(args)...);
     }
 
@@ -211,13 +231,17 @@ struct handler_traits {
     }
 
     static R call(storage& s, ArgTypes... args) {
-      return std::invoke(*static_cast<T*>(s.ptr_),
-                         std::forward<ArgTypes>(args)...);
+      if constexpr (std::is_void_v<R>) {
+        std::invoke(*static_cast<T*>(s.ptr_), std::forward<ArgTypes>(args)...);
+      } else {
+        return std::invoke(*static_cast<T*>(s.ptr_),
+                           std::forward<ArgTypes>(args)...);
+      }
     }
   };
 
   template <class T>
-  using handler = std::conditional_t<is_small_object_v<T>, small_handler<T>,
+  using handler = std::conditional_t<is_small_object_v<T, Capacity>, small_handler<T>,
                                      large_handler<T>>;
   /*
   如果 is_small_object_v<T> 为 true，则选择 small_handler<T>。
@@ -270,17 +294,17 @@ inline constexpr auto is_in_place_type_v = is_in_place_type<T>::value;
 any_invocable_impl 是一个实现泛型可调用对象（类似于 std::function）的类模板。
 它允许存储和调用任意类型的可调用对象（如函数、lambda 表达式、函数对象等），并且提供了类型安全和高效的内存管理。
 */
-template <class R, bool is_noexcept, class... ArgTypes>
+template <std::size_t Capacity, class R, bool is_noexcept, class... ArgTypes>
 class any_invocable_impl {
   template <class T>
   using handler =
-      typename any_detail::handler_traits<R, ArgTypes...>::template handler<T>; // 从 any_detail::handler_traits 获取处理函数
+      typename any_detail::handler_traits<Capacity, R, ArgTypes...>::template handler<T>; // 从 any_detail::handler_traits 获取处理函数
 
-  using storage = any_detail::storage; // 用于存储实际的可调用对象
+  using storage = any_detail::storage<Capacity>; // 用于存储实际的可调用对象
   using action = any_detail::action;
-  using handle_func = void (*)(any_detail::action, any_detail::storage*,
-                               any_detail::storage*);         // 处理函数的类型，用于执行各种操作（如移动和销毁）
-  using call_func = R (*)(any_detail::storage&, ArgTypes...); // 调用函数的类型，用于调用存储的可调用对象
+  using handle_func = void (*)(any_detail::action, storage*,
+                               storage*);         // 处理函数的类型，用于执行各种操作（如移动和销毁）
+  using call_func = R (*)(storage&, ArgTypes...); // 调用函数的类型，用于调用存储的可调用对象
 
  public:
   using result_type = R;
@@ -478,7 +502,7 @@ std::conjunction：
     std::decay_t 去除 F 的引用和 cv 修饰符，并将其转换为普通类型。
 */
 
-template <class Signature>
+template <class Signature, std::size_t Capacity = any_detail::default_capacity>
 class any_invocable;
 
 /*
@@ -519,10 +543,11 @@ class any_invocable;
   调用基类的 call 方法，传递参数并返回结果。
 */
 #define __OFATS_ANY_INVOCABLE(cv, ref, noex, inv_quals)                        \
-  template <class R, class... ArgTypes>                                        \
-  class any_invocable<R(ArgTypes...) cv ref noexcept(noex)>                    \
-      : public any_detail::any_invocable_impl<R, noex, ArgTypes...> {          \
-    using base_type = any_detail::any_invocable_impl<R, noex, ArgTypes...>;    \
+  template <class R, std::size_t Capacity, class... ArgTypes>                  \
+  class any_invocable<R(ArgTypes...) cv ref noexcept(noex), Capacity>          \
+      : public any_detail::any_invocable_impl<Capacity, R, noex, ArgTypes...> {\
+    using base_type =                                                          \
+        any_detail::any_invocable_impl<Capacity, R, noex, ArgTypes...>;        \
                                                                                \
    public:                                                                     \
     using base_type::base_type;                                                \
@@ -599,10 +624,31 @@ __OFATS_ANY_INVOCABLE(const, &&, true, const&&)   // 121
 
 }  // namespace ofats
 
+/* Per request handlers (onAborted, onWritable, onData) typically capture the response plus a shared_ptr
+ * or a pointer to state, so they get room for four pointers before falling to the heap */
+#ifndef UWS_RESPONSE_HANDLER_CAPACITY
+#define UWS_RESPONSE_HANDLER_CAPACITY (sizeof(void *) * 4)
+#endif
+
 /* We, uWebSockets define our own type */
 namespace uWS {
+  /* Callables up to Capacity bytes are held inline, larger ones are allocated */
+  template <class T, std::size_t Capacity = ofats::any_detail::default_capacity>
+  using MoveOnlyFunction = ofats::any_invocable<T, Capacity>;
+
   template <class T>
-  using MoveOnlyFunction = ofats::any_invocable<T>;
+  using ResponseHandler = MoveOnlyFunction<T, UWS_RESPONSE_HANDLER_CAPACITY>;
+
+  /* Whether a callable of type F is held inline by a MoveOnlyFunction of Capacity, for static_assert on
+   * captures of the handlers of the hot path */
+  template <class F, std::size_t Capacity = ofats::any_detail::default_capacity>
+  inline constexpr bool fitsMoveOnlyFunction = ofats::any_detail::is_small_object_v<std::decay_t<F>, Capacity>;
+
+  /* How many callables did not fit inline so far, in any MoveOnlyFunction. Cheap to read, made for
+   * asserting that steady state request handling allocates none */
+  inline unsigned long long getMoveOnlyFunctionHeapAllocations() {
+    return ofats::any_detail::heap_allocations.load(std::memory_order_relaxed);
+  }
 }
 
 #endif  // _ANY_INVOKABLE_H_
@@ -0,0 +1,112 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_MPSCRING_H
+#define UWS_MPSCRING_H
+
+/* A bounded ring any number of threads push to and one thread pops from, without locks. Every cell
+ * holds a sequence number telling whether it is free for the push at that position or filled for the
+ * pop at that position, so producers only contend on the head and never wait for each other */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace uWS {
+
+template <typename T>
+struct MpscRing {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    /* Producers and the consumer on cache lines of their own */
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) size_t tail = 0;
+
+public:
+    /* Capacity is rounded up to a power of two */
+    MpscRing(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing &) = delete;
+    MpscRing &operator=(const MpscRing &) = delete;
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    /* Any thread. Returns false if full, leaving value be */
+    template <typename V>
+    bool push(V &&value) {
+        size_t position = head.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+            if (difference == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                /* The consumer has not yet taken what was pushed one lap ago */
+                return false;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = std::forward<V>(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Consumer thread only. Returns false if empty (or the next push is not yet complete) */
+    bool pop(T &value) {
+        Cell *cell = &cells[tail & mask];
+        if (cell->sequence.load(std::memory_order_acquire) != tail + 1) {
+            return false;
+        }
+
+        value = std::move(cell->value);
+        /* Free for the push one lap ahead */
+        cell->sequence.store(tail + mask + 1, std::memory_order_release);
+        tail++;
+        return true;
+    }
+};
+
+}
+
+#endif // UWS_MPSCRING_H
@@ -22,12 +22,14 @@
 #define UWS_MULTIPART_H
 
 #include "MessageParser.h"
+#include "MoveOnlyFunction.h"
 
 #include <string_view>
 #include <optional>
 #include <cstring>
 #include <utility>
 #include <cctype>
+#include <algorithm>
 
 namespace uWS {
 
@@ -119,6 +121,29 @@ namespace uWS {
         }
     };
 
+    /* Returns the boundary of a multipart content type, or empty if invalid */
+    static inline std::string_view getMultipartBoundary(std::string_view contentType) {
+        /* We expect the form "multipart/something;somethingboundary=something" */
+        if (contentType.length() < 10 || contentType.substr(0, 10) != "multipart/") {
+            return {};
+        }
+
+        /* For now we simply guess boundary will lie between = and end. This is not entirely
+        * standards compliant as boundary may be expressed with or without " and spaces */
+        auto equalToken = contentType.find('=', 10);
+        if (equalToken != std::string_view::npos) {
+
+            /* Boundary must be less than or equal to 70 chars yet 1 char or longer */
+            std::string_view boundary = contentType.substr(equalToken + 1);
+            if (!boundary.length() || boundary.length() > 70) {
+                /* Invalid size */
+                return {};
+            }
+            return boundary;
+        }
+        return {};
+    }
+
     struct MultipartParser {
 
         /* 2 chars of hyphen + 1 - 70 chars of boundary */
@@ -133,22 +158,8 @@ namespace uWS {
         /* Construct the parser based on contentType (reads boundary) */
         MultipartParser(std::string_view contentType) {
 
-            /* We expect the form "multipart/something;somethingboundary=something" */
-            if (contentType.length() < 10 || contentType.substr(0, 10) != "multipart/") {
-                return;
-            }
-
-            /* For now we simply guess boundary will lie between = and end. This is not entirely
-            * standards compliant as boundary may be expressed with or without " and spaces */
-            auto equalToken = contentType.find('=', 10);
-            if (equalToken != std::string_view::npos) {
-
-                /* Boundary must be less than or equal to 70 chars yet 1 char or longer */
-                std::string_view boundary = contentType.substr(equalToken + 1);
-                if (!boundary.length() || boundary.length() > 70) {
-                    /* Invalid size */
-                    return;
-                }
+            std::string_view boundary = getMultipartBoundary(contentType);
+            if (boundary.length()) {
 
                 /* Prepend it with two hyphens */
                 prependedBoundaryBuffer[0] = prependedBoundaryBuffer[1] = '-';
@@ -226,6 +237,234 @@ namespace uWS {
         }
     };
 
+    /* Push based multipart parser, fed with body chunks as they arrive (such as from onData).
+     * Boundaries may straddle chunks. Part bodies are emitted as views into the given chunks,
+     * only bytes that might begin a boundary are held back (less than 74 bytes). */
+    struct StreamingMultipartParser {
+        /* Headers of one part must fit in this */
+        static const unsigned int MAX_PART_HEADERS_SIZE = 4096;
+
+    private:
+        enum State {
+            PREAMBLE,
+            AFTER_BOUNDARY,
+            AFTER_HYPHEN,
+            AFTER_CR,
+            HEADERS,
+            BODY,
+            DONE,
+            INVALID
+        } state = INVALID;
+
+        /* CRLF, 2 chars of hyphen and 1 - 70 chars of boundary */
+        char delimiterBuffer[74];
+        std::string_view delimiter;
+
+        /* Held back bytes plus room for as much of the next chunk */
+        char carryBuffer[148];
+        unsigned int carryLength = 0;
+
+        /* Headers are the only thing we copy, plus one byte of post padding */
+        char headerBuffer[MAX_PART_HEADERS_SIZE + 1];
+        unsigned int headerLength = 0;
+        std::pair<std::string_view, std::string_view> headers[MAX_HEADERS];
+
+        MoveOnlyFunction<void(std::pair<std::string_view, std::string_view> *)> partHandler;
+        MoveOnlyFunction<void(std::string_view, bool)> partDataHandler;
+
+        void emit(std::string_view data, bool last) {
+            /* Anything before the first boundary is ignored */
+            if (state == BODY && partDataHandler) {
+                partDataHandler(data, last);
+            }
+        }
+
+        /* Length of the longest suffix of data that is a proper prefix of the delimiter */
+        unsigned int partialDelimiterLength(std::string_view data) {
+            size_t from = data.length() >= delimiter.length() ? data.length() - delimiter.length() + 1 : 0;
+            for (size_t i = from; i < data.length(); i++) {
+                if (data[i] == '\r' && !memcmp(data.data() + i, delimiter.data(), data.length() - i)) {
+                    return (unsigned int) (data.length() - i);
+                }
+            }
+            return 0;
+        }
+
+        void consumeBody(std::string_view &chunk) {
+            /* A delimiter may begin in what we held back */
+            if (carryLength) {
+                size_t take = std::min<size_t>(chunk.length(), delimiter.length());
+                memcpy(carryBuffer + carryLength, chunk.data(), take);
+                std::string_view window(carryBuffer, carryLength + take);
+
+                size_t pos = window.find(delimiter);
+                if (pos != std::string_view::npos) {
+                    if (pos > carryLength) {
+                        emit({carryBuffer, carryLength}, false);
+                        emit(chunk.substr(0, pos - carryLength), true);
+                    } else {
+                        emit({carryBuffer, pos}, true);
+                    }
+                    chunk.remove_prefix(pos + delimiter.length() - carryLength);
+                    carryLength = 0;
+                    state = AFTER_BOUNDARY;
+                    return;
+                }
+
+                if (take < delimiter.length()) {
+                    /* All of chunk went into the window */
+                    unsigned int keep = partialDelimiterLength(window);
+                    if (window.length() > keep) {
+                        emit(window.substr(0, window.length() - keep), false);
+                    }
+                    memmove(carryBuffer, window.data() + window.length() - keep, keep);
+                    carryLength = keep;
+                    chunk.remove_prefix(take);
+                    return;
+                }
+
+                /* No delimiter can start in what we held back */
+                emit({carryBuffer, carryLength}, false);
+                carryLength = 0;
+            }
+
+            size_t pos = chunk.find(delimiter);
+            if (pos != std::string_view::npos) {
+                emit(chunk.substr(0, pos), true);
+                chunk.remove_prefix(pos + delimiter.length());
+                state = AFTER_BOUNDARY;
+                return;
+            }
+
+            /* Hold back what might be the beginning of a delimiter */
+            unsigned int keep = partialDelimiterLength(chunk);
+            if (chunk.length() > keep) {
+                emit(chunk.substr(0, chunk.length() - keep), false);
+            }
+            memcpy(carryBuffer, chunk.data() + chunk.length() - keep, keep);
+            carryLength = keep;
+            chunk = {};
+        }
+
+        void consumeHeaders(std::string_view &chunk) {
+            size_t searchFrom = headerLength >= 3 ? headerLength - 3 : 0;
+            size_t take = std::min<size_t>(chunk.length(), MAX_PART_HEADERS_SIZE - headerLength);
+            memcpy(headerBuffer + headerLength, chunk.data(), take);
+            headerLength += (unsigned int) take;
+
+            /* A part may have no headers at all */
+            size_t end = std::string_view::npos;
+            if (headerLength >= 2 && headerBuffer[0] == '\r' && headerBuffer[1] == '\n') {
+                end = 2;
+            } else {
+                size_t pos = std::string_view(headerBuffer, headerLength).find("\r\n\r\n", searchFrom);
+                if (pos != std::string_view::npos) {
+                    end = pos + 4;
+                }
+            }
+
+            if (end == std::string_view::npos) {
+                chunk.remove_prefix(take);
+                if (headerLength == MAX_PART_HEADERS_SIZE) {
+                    state = INVALID;
+                }
+                return;
+            }
+
+            /* Give back what follows the headers */
+            chunk.remove_prefix(take - (headerLength - end));
+
+            headerBuffer[end] = '\r';
+            if (!getHeaders(headerBuffer, headerBuffer + end, headers)) {
+                state = INVALID;
+                return;
+            }
+
+            state = BODY;
+            if (partHandler) {
+                partHandler(headers);
+            }
+        }
+
+    public:
+        /* Construct the parser based on contentType (reads boundary) */
+        StreamingMultipartParser(std::string_view contentType) {
+            std::string_view boundary = getMultipartBoundary(contentType);
+            if (boundary.length()) {
+                memcpy(delimiterBuffer, "\r\n--", 4);
+                memcpy(delimiterBuffer + 4, boundary.data(), boundary.length());
+                delimiter = {delimiterBuffer, boundary.length() + 4};
+
+                /* The first boundary need not be preceded by CRLF */
+                memcpy(carryBuffer, "\r\n", 2);
+                carryLength = 2;
+                state = PREAMBLE;
+            }
+        }
+
+        /* Is this even a valid multipart request? */
+        bool isValid() {
+            return state != INVALID;
+        }
+
+        /* Have we seen the closing boundary? */
+        bool isDone() {
+            return state == DONE;
+        }
+
+        /* Called with the headers of every part, terminated by an empty key. Views are only valid in the callback */
+        void onPart(MoveOnlyFunction<void(std::pair<std::string_view, std::string_view> *)> &&handler) {
+            partHandler = std::move(handler);
+        }
+
+        /* Called with slices of the current part's body, last being true for the final (possibly empty) slice */
+        void onPartData(MoveOnlyFunction<void(std::string_view, bool)> &&handler) {
+            partDataHandler = std::move(handler);
+        }
+
+        /* Feed the next chunk of the body. Returns false on error */
+        bool consume(std::string_view chunk) {
+            while (chunk.length() && state != DONE && state != INVALID) {
+                switch (state) {
+                case PREAMBLE:
+                case BODY:
+                    consumeBody(chunk);
+                    break;
+                case HEADERS:
+                    consumeHeaders(chunk);
+                    break;
+                case AFTER_BOUNDARY:
+                    /* Either the closing "--" or CRLF, optionally after linear whitespace */
+                    if (chunk[0] == '-') {
+                        state = AFTER_HYPHEN;
+                    } else if (chunk[0] == '\r') {
+                        state = AFTER_CR;
+                    } else if (chunk[0] != ' ' && chunk[0] != '\t') {
+                        state = INVALID;
+                    }
+                    chunk.remove_prefix(1);
+                    break;
+                case AFTER_HYPHEN:
+                    state = chunk[0] == '-' ? DONE : INVALID;
+                    chunk.remove_prefix(1);
+                    break;
+                case AFTER_CR:
+                    if (chunk[0] == '\n') {
+                        state = HEADERS;
+                        headerLength = 0;
+                    } else {
+                        state = INVALID;
+                    }
+                    chunk.remove_prefix(1);
+                    break;
+                default:
+                    break;
+                }
+            }
+            return state != INVALID;
+        }
+    };
+
 }
 
 #endif
@@ -66,8 +66,14 @@ namespace uWS {
 #include <zlib.h>
 #endif
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <cmath>
 
 #ifdef UWS_USE_LIBDEFLATE
 #include "libdeflate.h"
@@ -78,8 +84,21 @@ namespace uWS {
 
 /* Do not compile this module if we don't want it */
 #if defined(UWS_NO_ZLIB) || defined(UWS_MOCK_ZLIB)
-struct ZlibContext {};
+struct ZlibMemory {
+    static long long &threadBytes() {
+        static thread_local long long bytes = 0;
+        return bytes;
+    }
+    void leaveThread() {
+    }
+    void joinThread() {
+    }
+};
+struct ZlibContext {
+    ZlibContext(std::pmr::memory_resource * /*resource*/ = nullptr) {}
+};
 struct InflationStream {
+    ZlibMemory memory;
     std::optional<std::string_view> inflate(ZlibContext * /*zlibContext*/, std::string_view compressed, size_t maxPayloadLength, bool /*reset*/) {
         return compressed.substr(0, std::min(maxPayloadLength, compressed.length()));
     }
@@ -87,16 +106,69 @@ struct InflationStream {
     }
 };
 struct DeflationStream {
+    ZlibMemory memory;
+    CompressOptions compressOptions;
     std::string_view deflate(ZlibContext * /*zlibContext*/, std::string_view raw, bool /*reset*/) {
         return raw;
     }
-    DeflationStream(CompressOptions /*compressOptions*/) {
+    void reset() {
+    }
+    DeflationStream(CompressOptions compressOptions) : compressOptions(compressOptions) {
     }
 };
 #else
 
 #define LARGE_BUFFER_SIZE 1024 * 16 // todo: fix this
 
+/* What zlib allocates for a stream, counted by the stream and by the thread holding it (see Loop::getMemoryStats).
+ * A stream going to another thread with its WebSocket moves its count over */
+struct ZlibMemory {
+    size_t bytes = 0;
+
+    static long long &threadBytes() {
+        static thread_local long long bytes = 0;
+        return bytes;
+    }
+
+    /* Before the stream is initialized */
+    void hook(z_stream &stream) {
+        stream.zalloc = alloc;
+        stream.zfree = free;
+        stream.opaque = this;
+    }
+
+    void leaveThread() {
+        threadBytes() -= (long long) bytes;
+    }
+
+    void joinThread() {
+        threadBytes() += (long long) bytes;
+    }
+
+private:
+    /* The size of each allocation leads it, as zlib does not tell when freeing */
+    static voidpf alloc(voidpf opaque, uInt items, uInt size) {
+        size_t length = (size_t) items * size;
+        std::max_align_t *header = (std::max_align_t *) malloc(sizeof(std::max_align_t) + length);
+        if (!header) {
+            return Z_NULL;
+        }
+        memcpy((void *) header, &length, sizeof(length));
+        ((ZlibMemory *) opaque)->bytes += length;
+        threadBytes() += (long long) length;
+        return header + 1;
+    }
+
+    static void free(voidpf opaque, voidpf address) {
+        std::max_align_t *header = (std::max_align_t *) address - 1;
+        size_t length;
+        memcpy(&length, (void *) header, sizeof(length));
+        ((ZlibMemory *) opaque)->bytes -= length;
+        threadBytes() -= (long long) length;
+        ::free(header);
+    }
+};
+
 struct ZlibContext {
     /* Any returned data is valid until next same-class call.
      * We need to have two classes to allow inflation followed
@@ -105,15 +177,18 @@ struct ZlibContext {
     std::string dynamicInflationBuffer;
     char *deflationBuffer;
     char *inflationBuffer;
+    /* Of the loop, see Loop::setMemoryResource */
+    std::pmr::memory_resource *resource;
 
 #ifdef UWS_USE_LIBDEFLATE
     libdeflate_decompressor *decompressor;
     libdeflate_compressor *compressor;
 #endif
 
-    ZlibContext() {
-        deflationBuffer = (char *) malloc(LARGE_BUFFER_SIZE);
-        inflationBuffer = (char *) malloc(LARGE_BUFFER_SIZE);
+    ZlibContext(std::pmr::memory_resource *resource = std::pmr::new_delete_resource()) : resource(resource) {
+        deflationBuffer = (char *) resource->allocate(LARGE_BUFFER_SIZE);
+        inflationBuffer = (char *) resource->allocate(LARGE_BUFFER_SIZE);
+        ZlibMemory::threadBytes() += 2 * LARGE_BUFFER_SIZE;
 
 #ifdef UWS_USE_LIBDEFLATE
         decompressor = libdeflate_alloc_decompressor();
@@ -122,8 +197,9 @@ struct ZlibContext {
     }
 
     ~ZlibContext() {
-        free(deflationBuffer);
-        free(inflationBuffer);
+        resource->deallocate(deflationBuffer, LARGE_BUFFER_SIZE);
+        resource->deallocate(inflationBuffer, LARGE_BUFFER_SIZE);
+        ZlibMemory::threadBytes() -= 2 * LARGE_BUFFER_SIZE;
 
 #ifdef UWS_USE_LIBDEFLATE
         libdeflate_free_decompressor(decompressor);
@@ -134,8 +210,11 @@ struct ZlibContext {
 
 struct DeflationStream {
     z_stream deflationStream = {};
+    ZlibMemory memory;
+    /* What we were created with, so that a pool can hand us out again */
+    CompressOptions compressOptions;
 
-    DeflationStream(CompressOptions compressOptions) {
+    DeflationStream(CompressOptions compressOptions) : compressOptions(compressOptions) {
 
         /* Sliding inflator should be about 44kb by default, less than compressor */
 
@@ -144,6 +223,7 @@ struct DeflationStream {
 
         //printf("windowBits: %d, memLevel: %d\n", windowBits, memLevel);
 
+        memory.hook(deflationStream);
         deflateInit2(&deflationStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits, memLevel, Z_DEFAULT_STRATEGY);
     }
 
@@ -207,6 +287,11 @@ struct DeflationStream {
         };
     }
 
+    /* Forget the sliding window, as if just created */
+    void reset() {
+        deflateReset(&deflationStream);
+    }
+
     ~DeflationStream() {
         deflateEnd(&deflationStream);
     }
@@ -214,9 +299,11 @@ struct DeflationStream {
 
 struct InflationStream {
     z_stream inflationStream = {};
+    ZlibMemory memory;
 
     InflationStream(CompressOptions compressOptions) {
         /* Inflation windowBits are the top 8 bits of the 16 bit compressOptions */
+        memory.hook(inflationStream);
         inflateInit2(&inflationStream, -(compressOptions >> 8));
     }
 
@@ -310,6 +397,121 @@ struct InflationStream {
 
 #endif
 
+/* A gzip stream for HTTP bodies (Content-Encoding: gzip), unlike the raw deflate of WebSockets.
+ * Pooled per loop, see LoopData::acquireGzipStream */
+struct GzipStream {
+    enum Flush {
+        /* Held back for better compression, as for all but the last piece of one body */
+        NO_FLUSH,
+        /* Everything so far decodable by the client, as for every write of a streamed body */
+        SYNC_FLUSH,
+        /* The end of the body, after which we are as new */
+        FINISH
+    };
+
+#if defined(UWS_NO_ZLIB) || defined(UWS_MOCK_ZLIB)
+    static constexpr bool AVAILABLE = false;
+
+    void compress(std::string_view raw, Flush /*flush*/, std::string &out) {
+        out.append(raw);
+    }
+    void reset() {
+    }
+#else
+    static constexpr bool AVAILABLE = true;
+
+    z_stream stream = {};
+    ZlibMemory memory;
+    /* Whether anything went in since we were new */
+    bool started = false;
+
+    GzipStream() {
+        /* 16 over windowBits asks for the gzip header and trailer */
+        memory.hook(stream);
+        deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    }
+
+    ~GzipStream() {
+        deflateEnd(&stream);
+    }
+
+    /* Appends what raw compresses to */
+    void compress(std::string_view raw, Flush flush, std::string &out) {
+#ifdef UWS_USE_LIBDEFLATE
+        /* A whole body in one go needs no stream */
+        if (!started && flush == FINISH) {
+            static thread_local libdeflate_compressor *compressor = libdeflate_alloc_compressor(6);
+            size_t offset = out.length();
+            out.resize(offset + libdeflate_gzip_compress_bound(compressor, raw.length()));
+            out.resize(offset + libdeflate_gzip_compress(compressor, raw.data(), raw.length(), out.data() + offset, out.length() - offset));
+            return;
+        }
+#endif
+        started = true;
+        stream.next_in = (Bytef *) raw.data();
+        stream.avail_in = (unsigned int) raw.length();
+
+        int mode = flush == FINISH ? Z_FINISH : (flush == SYNC_FLUSH ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        int err;
+        do {
+            size_t offset = out.length();
+            size_t room = std::max<size_t>(4096, deflateBound(&stream, stream.avail_in));
+            out.resize(offset + room);
+            stream.next_out = (Bytef *) out.data() + offset;
+            stream.avail_out = (unsigned int) room;
+
+            err = ::deflate(&stream, mode);
+            out.resize(offset + room - stream.avail_out);
+            /* Done once finished, or once flushed with room to spare */
+        } while (err == Z_OK && (mode == Z_FINISH || stream.avail_out == 0));
+
+        if (flush == FINISH) {
+            reset();
+        }
+    }
+
+    /* As new, for the next body */
+    void reset() {
+        deflateReset(&stream);
+        started = false;
+    }
+#endif
+};
+
+/* For adaptive compression: estimates the entropy of up to 1 kB sampled at 4 places of data. Already compressed
+ * or encrypted data is close to 8 bits per byte, text and JSON are 4 to 6 (base64 is 6). Too small to tell is false */
+static inline bool looksIncompressible(std::string_view data) {
+    const size_t SAMPLE = 256, MINIMUM_LENGTH = 512;
+    if (data.length() < MINIMUM_LENGTH) {
+        return false;
+    }
+
+    unsigned int histogram[256] = {};
+    size_t step = (data.length() - SAMPLE) / 3;
+    for (size_t sample = 0; sample < 4; sample++) {
+        for (size_t i = 0; i < SAMPLE; i++) {
+            histogram[(unsigned char) data[sample * step + i]]++;
+        }
+    }
+
+    double entropy = 0, total = 4 * SAMPLE;
+    for (unsigned int count : histogram) {
+        if (count) {
+            double p = count / total;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy > 7.2;
+}
+
+/* What adaptive compression did, per loop */
+struct CompressionStats {
+    /* Messages deflated, bytes before and after */
+    uint64_t compressedMessages = 0, compressedBytesIn = 0, compressedBytesOut = 0;
+    /* Messages (and their bytes) sent uncompressed since deflate would not pay off */
+    uint64_t skippedMessages = 0, skippedBytes = 0;
+};
+
 }
 
 #endif // UWS_PERMESSAGEDEFLATE_H
@@ -0,0 +1,97 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_PREPAREDMESSAGE_H
+#define UWS_PREPAREDMESSAGE_H
+
+/* A PreparedMessage is a WebSocket message framed once (and, if asked to, deflated once) for sending
+ * to many sockets. Sending it is a copy of the frame, or a reference to it for big frames */
+
+#include <string>
+#include <string_view>
+
+#include "Loop.h"
+#include "PerMessageDeflate.h"
+#include "SharedBuffer.h"
+#include "WebSocketProtocol.h"
+
+namespace uWS {
+
+struct PreparedMessage {
+    template <bool, bool, typename> friend struct WebSocket;
+    template <bool, typename> friend struct TemplatedApp;
+
+private:
+    /* The message as given, for clients (they mask) and dedicated compressors (they keep context) */
+    SharedBuffer message;
+    /* Server frames, uncompressed and compressed without context (if any) */
+    SharedBuffer frame, compressedFrame;
+    OpCode opCode;
+
+    static SharedBuffer format(std::string_view payload, OpCode opCode, bool compressed) {
+        std::string frame(protocol::messageFrameSize(payload.length()), 0);
+        protocol::formatMessage<true>(frame.data(), payload.data(), payload.length(), opCode, payload.length(), compressed, true);
+        return SharedBuffer::copy(frame);
+    }
+
+public:
+    /* Compression is done with this thread's shared compressor, which any socket negotiated to
+     * permessage-deflate without a dedicated compressor can take */
+    PreparedMessage(std::string_view message, OpCode opCode = OpCode::BINARY, bool compress = false)
+        : PreparedMessage(compress ? (LoopData *) us_loop_ext((us_loop_t *) Loop::get()) : nullptr, message, opCode) {}
+
+    /* Compressed with the shared compressor of loopData, which must be of this thread, if not null */
+    PreparedMessage(LoopData *loopData, std::string_view message, OpCode opCode = OpCode::BINARY) : message(SharedBuffer::copy(message)), opCode(opCode) {
+        frame = format(message, opCode, false);
+
+        /* It is never valid to compress 0 bytes, nor control frames */
+        if (loopData && message.length() && opCode < 3) {
+            if (!loopData->zlibContext) {
+                loopData->zlibContext = new ZlibContext(loopData->memoryResource);
+                loopData->inflationStream = new InflationStream(CompressOptions::DEDICATED_DECOMPRESSOR);
+                loopData->deflationStream = new DeflationStream(CompressOptions::DEDICATED_COMPRESSOR);
+            }
+            compressedFrame = format(loopData->deflationStream->deflate(loopData->zlibContext, message, true), opCode, true);
+        }
+    }
+
+    std::string_view getMessage() const {
+        return message.view();
+    }
+
+    OpCode getOpCode() const {
+        return opCode;
+    }
+
+    bool isCompressed() const {
+        return compressedFrame.length();
+    }
+
+    /* The uncompressed server frame of message, as topic histories keep it */
+    static SharedBuffer frameOf(std::string_view message, OpCode opCode) {
+        return format(message, opCode, false);
+    }
+
+    /* The complete server frame */
+    std::string_view getFrame(bool compressed = false) const {
+        return compressed && isCompressed() ? compressedFrame.view() : frame.view();
+    }
+};
+
+}
+
+#endif // UWS_PREPAREDMESSAGE_H
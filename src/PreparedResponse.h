@@ -0,0 +1,98 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_PREPAREDRESPONSE_H
+#define UWS_PREPAREDRESPONSE_H
+
+/* A PreparedResponse is a complete response (status, headers, body) serialized once.
+ * Ending a request with it only patches in the cached Date and copies it out. */
+
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+
+#include "Utilities.h"
+
+namespace uWS {
+
+struct PreparedResponse {
+private:
+    std::string data;
+    /* Where the 29 bytes of Date go */
+    unsigned int dateOffset;
+    /* The uWebSockets mark, skipped if the loop is silent */
+    unsigned int markOffset, markLength;
+    /* Where user headers start and where the body starts */
+    unsigned int headersOffset, bodyOffset;
+
+public:
+    PreparedResponse(std::string_view status, std::vector<std::pair<std::string_view, std::string_view>> headers, std::string_view body) {
+        data.append("HTTP/1.1 ").append(status).append("\r\n");
+
+        headersOffset = (unsigned int) data.length();
+        for (auto &[key, value] : headers) {
+            data.append(key).append(": ").append(value).append("\r\n");
+        }
+
+        data.append("Date: ");
+        dateOffset = (unsigned int) data.length();
+        data.append(29, ' ').append("\r\n");
+
+        markOffset = (unsigned int) data.length();
+#ifndef UWS_HTTPRESPONSE_NO_WRITEMARK
+        data.append("uWebSockets: 20\r\n");
+#endif
+        markLength = (unsigned int) data.length() - markOffset;
+
+        char buf[20];
+        data.append("Content-Length: ").append(buf, (size_t) utils::u64toa(body.length(), buf)).append("\r\n\r\n");
+
+        bodyOffset = (unsigned int) data.length();
+        data.append(body);
+    }
+
+    /* Serialized user headers, each terminated by CRLF */
+    std::string_view getHeaders() const {
+        return std::string_view(data.data() + headersOffset, dateOffset - 6 - headersOffset);
+    }
+
+    std::string_view getBody() const {
+        return std::string_view(data.data() + bodyOffset, data.length() - bodyOffset);
+    }
+
+    /* Bytes of the whole response, with or without the mark */
+    size_t length(bool withMark) const {
+        return withMark ? data.length() : data.length() - markLength;
+    }
+
+    /* Copies out the whole response of length(withMark) bytes, with the 29 bytes of date patched in */
+    void copyTo(char *dst, const char *date, bool withMark) const {
+        if (withMark) {
+            memcpy(dst, data.data(), data.length());
+        } else {
+            memcpy(dst, data.data(), markOffset);
+            memcpy(dst + markOffset, data.data() + markOffset + markLength, data.length() - markOffset - markLength);
+        }
+        memcpy(dst + dateOffset, date, 29);
+    }
+};
+
+}
+
+#endif // UWS_PREPAREDRESPONSE_H
@@ -0,0 +1,137 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_PROXYHEAD_H
+#define UWS_PROXYHEAD_H
+
+/* The response head of an upstream as ReverseProxy relays it: status, framing of the body that follows, and which
+ * fields go on to the client */
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace uWS {
+
+struct ProxyHead {
+    /* Of the status line, as in "200 OK" */
+    std::string_view status;
+    unsigned int code = 0;
+    std::optional<uint64_t> contentLength;
+    /* Chunked is the last coding, or some other coding makes the body end with the connection */
+    bool chunked = false, closeDelimited = false;
+    bool keepAlive = true;
+    /* Fields named by Connection are of this hop only */
+    std::string_view connectionTokens;
+
+    static bool equalsCaseInsensitive(std::string_view a, std::string_view b) {
+        return a.length() == b.length() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+            return (x | 32) == (y | 32);
+        });
+    }
+
+    /* Whether the comma separated list has token, as in Connection */
+    static bool hasToken(std::string_view list, std::string_view token) {
+        while (list.length()) {
+            size_t comma = std::min(list.find(','), list.length());
+            std::string_view item = list.substr(0, comma);
+            item.remove_prefix(std::min(item.find_first_not_of(" \t"), item.length()));
+            item = item.substr(0, item.find_last_not_of(" \t") + 1);
+            if (equalsCaseInsensitive(item, token)) {
+                return true;
+            }
+            list.remove_prefix(std::min(comma + 1, list.length()));
+        }
+        return false;
+    }
+
+    /* Fields of one hop only, not to be forwarded either way (RFC 9110 7.6.1) */
+    static bool isHopByHop(std::string_view key) {
+        for (std::string_view hopByHop : {"connection", "keep-alive", "proxy-connection", "te", "trailer", "transfer-encoding", "upgrade"}) {
+            if (equalsCaseInsensitive(key, hopByHop)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* Calls handler(key, value) for every field of head (status line and fields, each ended by CRLF) until it
+     * returns false. Returns false if a line is not a field */
+    template <typename F>
+    static bool forEachField(std::string_view head, F &&handler) {
+        for (size_t lineStart = head.find("\r\n") + 2, lineEnd; lineStart < head.length(); lineStart = lineEnd + 2) {
+            lineEnd = head.find("\r\n", lineStart);
+            std::string_view line = head.substr(lineStart, lineEnd - lineStart);
+            size_t colon = line.find(':');
+            if (!colon || colon == std::string_view::npos) {
+                return false;
+            }
+            std::string_view value = line.substr(colon + 1);
+            value.remove_prefix(std::min(value.find_first_not_of(" \t"), value.length()));
+            value = value.substr(0, value.find_last_not_of(" \t") + 1);
+            if (!handler(line.substr(0, colon), value)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Parses head, the status line and fields each ended by CRLF. Returns false if malformed. The fields of
+     * informational responses are not looked at */
+    bool parse(std::string_view head) {
+        if (head.length() < 14 || head.substr(0, 7) != "HTTP/1." || head[8] != ' ') {
+            return false;
+        }
+        status = head.substr(9, head.find("\r\n") - 9);
+        if (status.length() < 3 || std::from_chars(status.data(), status.data() + 3, code).ptr != status.data() + 3 || code < 100) {
+            return false;
+        }
+        if (code < 200) {
+            return true;
+        }
+
+        keepAlive = head[7] == '1';
+        return forEachField(head, [this, &head](std::string_view key, std::string_view value) {
+            if (equalsCaseInsensitive(key, "content-length")) {
+                uint64_t length = 0;
+                if (!value.length() || value.length() > 18 || std::from_chars(value.data(), value.data() + value.length(), length).ptr != value.data() + value.length()
+                    || (contentLength && *contentLength != length)) {
+                    return false;
+                }
+                contentLength = length;
+            } else if (equalsCaseInsensitive(key, "transfer-encoding")) {
+                chunked = value.length() >= 7 && equalsCaseInsensitive(value.substr(value.length() - 7), "chunked");
+                closeDelimited = !chunked;
+            } else if (equalsCaseInsensitive(key, "connection")) {
+                connectionTokens = value;
+                keepAlive = head[7] == '1' ? !hasToken(value, "close") : hasToken(value, "keep-alive");
+            }
+            return true;
+        });
+    }
+
+    /* Whether a field of the parsed head goes on to the client. The length is the response's to write */
+    bool forwards(std::string_view key) const {
+        return !isHopByHop(key) && !equalsCaseInsensitive(key, "content-length") && !hasToken(connectionTokens, key);
+    }
+};
+
+}
+
+#endif // UWS_PROXYHEAD_H
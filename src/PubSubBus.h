@@ -0,0 +1,227 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_PUBSUBBUS_H
+#define UWS_PUBSUBBUS_H
+
+/* A PubSubBus connects the Apps of many threads (one App per thread, as in HelloWorldThreaded) to
+ * one conceptual topic tree. Publishing from any thread allocates the message once and pushes it to a
+ * ring per joined loop, waking each loop at most once until it drained. Loops publish everything
+ * pushed to them in one batch, before their next iteration */
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Loop.h"
+#include "MpscRing.h"
+#include "SharedBuffer.h"
+#include "WebSocketProtocol.h"
+
+namespace uWS {
+
+struct PubSubBus {
+    /* Called on the loop that joined, for every message published to the bus */
+    typedef MoveOnlyFunction<void(std::string_view topic, const SharedBuffer &message, OpCode opCode, bool compress)> DeliverFunction;
+
+private:
+    /* Shared by all loops, freed by the last one done with it */
+    struct Envelope {
+        std::atomic<unsigned int> references;
+        std::string topic;
+        SharedBuffer message;
+        OpCode opCode;
+        bool compress;
+    };
+
+    static void release(Envelope *envelope) {
+        if (envelope->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete envelope;
+        }
+    }
+
+    struct Lane {
+        Lane(size_t capacity) : ring(capacity) {}
+
+        MpscRing<Envelope *> ring;
+        /* Once the ring is full, publishers append here until the loop caught up (keeping their order) */
+        std::mutex overflowMutex;
+        std::vector<Envelope *> overflow;
+        std::atomic<bool> overflowing{false};
+
+        /* Wakeup is sent by whoever first pushes after the loop started draining */
+        std::atomic<bool> wakeupPending{false};
+        /* Leaving waits for publishers still pushing to us */
+        std::atomic<bool> active{false};
+        std::atomic<unsigned int> publishers{0};
+
+        Loop *loop = nullptr;
+        DeliverFunction deliver;
+
+        ~Lane() {
+            discard();
+        }
+
+        void push(Envelope *envelope) {
+            if (!overflowing.load(std::memory_order_acquire) && ring.push(envelope)) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(overflowMutex);
+            overflowing.store(true, std::memory_order_release);
+            overflow.push_back(envelope);
+        }
+
+        /* On the loop, calls cb for everything pushed so far */
+        template <typename F>
+        void pop(F &&cb) {
+            Envelope *envelope;
+            while (ring.pop(envelope)) {
+                cb(envelope);
+            }
+            if (overflowing.load(std::memory_order_acquire)) {
+                std::vector<Envelope *> pending;
+                {
+                    std::lock_guard<std::mutex> lock(overflowMutex);
+                    pending.swap(overflow);
+                    overflowing.store(false, std::memory_order_release);
+                }
+                for (Envelope *envelope : pending) {
+                    cb(envelope);
+                }
+            }
+        }
+
+        void discard() {
+            pop([](Envelope *envelope) {
+                release(envelope);
+            });
+        }
+    };
+
+    /* Lanes are never freed before the bus, so publishers can walk them without locking */
+    std::unique_ptr<std::unique_ptr<Lane>[]> lanes;
+    std::atomic<unsigned int> numLanes{0};
+    unsigned int maxLoops;
+    size_t ringCapacity;
+    std::mutex joinMutex;
+
+    static void drain(Lane *lane) {
+        /* Anything pushed after this wakes us up again */
+        lane->wakeupPending.store(false);
+
+        lane->pop([lane](Envelope *envelope) {
+            lane->deliver(envelope->topic, envelope->message, envelope->opCode, envelope->compress);
+            release(envelope);
+        });
+    }
+
+public:
+    /* Every loop gets a ring of ringCapacity messages, with more than that waiting behind a lock */
+    PubSubBus(unsigned int maxLoops = 256, size_t ringCapacity = 4096) : lanes(new std::unique_ptr<Lane>[maxLoops]), maxLoops(maxLoops), ringCapacity(ringCapacity) {
+
+    }
+
+    PubSubBus(const PubSubBus &) = delete;
+    PubSubBus &operator=(const PubSubBus &) = delete;
+
+    /* Delivers every message published to the bus to this thread's loop, from now on until leave.
+     * Returns the lane to leave with */
+    unsigned int join(DeliverFunction &&deliver) {
+        std::lock_guard<std::mutex> lock(joinMutex);
+
+        /* Reuse a lane left by some other loop */
+        unsigned int index = 0;
+        unsigned int count = numLanes.load(std::memory_order_relaxed);
+        while (index < count && lanes[index]->active.load()) {
+            index++;
+        }
+        if (index == count) {
+            if (count == maxLoops) {
+                std::cerr << "Error: PubSubBus cannot join more than " << maxLoops << " loops!" << std::endl;
+                std::terminate();
+            }
+            lanes[index].reset(new Lane(ringCapacity));
+            numLanes.store(count + 1, std::memory_order_release);
+        }
+
+        Lane *lane = lanes[index].get();
+        lane->loop = Loop::get();
+        lane->deliver = std::move(deliver);
+        lane->loop->addPreHandler(lane, [lane](Loop *) {
+            drain(lane);
+        });
+        lane->active.store(true);
+
+        return index;
+    }
+
+    /* Stops delivering to lane, dropping what is still queued. Must be called on the loop that joined */
+    void leave(unsigned int index) {
+        Lane *lane = lanes[index].get();
+        lane->active.store(false);
+
+        /* Anyone who saw us active is done pushing and waking us up after this */
+        while (lane->publishers.load()) {
+            std::this_thread::yield();
+        }
+
+        lane->loop->removePreHandler(lane);
+        lane->discard();
+        lane->deliver = nullptr;
+        lane->wakeupPending.store(false);
+    }
+
+    /* Publishes to every joined loop, from any thread. Returns the number of loops reached */
+    unsigned int publish(std::string_view topic, SharedBuffer message, OpCode opCode, bool compress = false) {
+        /* We hold one reference while we push */
+        Envelope *envelope = new Envelope{{1}, std::string(topic), std::move(message), opCode, compress};
+
+        unsigned int reached = 0;
+        unsigned int count = numLanes.load(std::memory_order_acquire);
+        for (unsigned int i = 0; i < count; i++) {
+            Lane *lane = lanes[i].get();
+
+            /* Ordered against leave: either it sees us publishing, or we see it inactive */
+            lane->publishers.fetch_add(1);
+            if (lane->active.load()) {
+                envelope->references.fetch_add(1, std::memory_order_relaxed);
+                lane->push(envelope);
+                if (!lane->wakeupPending.exchange(true)) {
+                    us_wakeup_loop((us_loop_t *) lane->loop);
+                }
+                reached++;
+            }
+            lane->publishers.fetch_sub(1);
+        }
+
+        release(envelope);
+        return reached;
+    }
+
+    /* Copies message once, for all loops */
+    unsigned int publish(std::string_view topic, std::string_view message, OpCode opCode, bool compress = false) {
+        return publish(topic, SharedBuffer::copy(message), opCode, compress);
+    }
+};
+
+}
+
+#endif // UWS_PUBSUBBUS_H
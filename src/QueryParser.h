@@ -21,10 +21,122 @@
 #define UWS_QUERYPARSER_H
 
 #include <string_view>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 namespace uWS {
 
-    /* Takes raw query including initial '?' sign. Will inplace decode, so input will mutate */
+    /* Returns offset of first '%' or '+', or length if none */
+    static inline size_t findQueryEscape(const char *data, size_t length) {
+        size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+        for (; i + 16 <= length; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+            unsigned int mask = (unsigned int) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('%')), _mm_cmpeq_epi8(v, _mm_set1_epi8('+'))));
+            if (mask) {
+#ifdef _MSC_VER
+                unsigned long index;
+                _BitScanForward(&index, mask);
+                return i + index;
+#else
+                return i + (size_t) __builtin_ctz(mask);
+#endif
+            }
+        }
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+        for (; i + 16 <= length; i += 16) {
+            uint8x16_t v = vld1q_u8((const uint8_t *) (data + i));
+            uint8x16_t eq = vorrq_u8(vceqq_u8(v, vdupq_n_u8('%')), vceqq_u8(v, vdupq_n_u8('+')));
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+            if (mask) {
+                return i + (size_t) (__builtin_ctzll(mask) >> 2);
+            }
+        }
+#endif
+        for (; i < length; i++) {
+            if (data[i] == '%' || data[i] == '+') {
+                return i;
+            }
+        }
+        return length;
+    }
+
+    /* Percent-decodes (and maps '+' to space) in place, returning decoded length or SIZE_MAX on error.
+     * Runs without escapes are skipped (and moved) in blocks. */
+    static inline size_t decodeQueryValueInPlace(char *in, size_t length) {
+        size_t out = 0, i = 0;
+        while (true) {
+            size_t run = findQueryEscape(in + i, length - i);
+            if (out != i) {
+                memmove(in + out, in + i, run);
+            }
+            out += run;
+            i += run;
+
+            if (i == length) {
+                return out;
+            }
+
+            if (in[i] == '+') {
+                in[out++] = ' ';
+                i++;
+            } else {
+                /* Do we have enough data for two bytes hex? */
+                if (i + 2 >= length) {
+                    return SIZE_MAX;
+                }
+
+                /* Two bytes hex */
+                int hex1 = in[i + 1] - '0';
+                if (hex1 > 9) {
+                    hex1 &= 223;
+                    hex1 -= 7;
+                }
+
+                int hex2 = in[i + 2] - '0';
+                if (hex2 > 9) {
+                    hex2 &= 223;
+                    hex2 -= 7;
+                }
+
+                *((unsigned char *) &in[out++]) = (unsigned char) (hex1 * 16 + hex2);
+                i += 3;
+            }
+        }
+    }
+
+    /* Decodes value in place the first time it is read. A value that shrinks is ended by a null char, which tells
+     * later reads it is decoded already. One that does not shrink had no escapes, so decoding it again changes nothing */
+    static inline std::string_view decodeQueryValueOnce(std::string_view value) {
+        char *in = (char *) value.data();
+
+        const char *nullChar = (const char *) memchr(in, 0, value.length());
+        if (nullChar) {
+            return value.substr(0, (size_t) (nullChar - in));
+        }
+
+        size_t out = decodeQueryValueInPlace(in, value.length());
+        if (out == SIZE_MAX) {
+            return {};
+        }
+
+        if (out < value.length()) {
+            in[out] = 0;
+        }
+        return value.substr(0, out);
+    }
+
+    /* Takes raw query including initial '?' sign. Will inplace decode, so input will mutate. Reading a value again,
+     * also through QueryIndex, gives the same value */
     static inline std::string_view getDecodedQueryValue(std::string_view key, std::string_view rawQuery) {
 
         /* Can't have a value without a key */
@@ -35,7 +147,7 @@ namespace uWS {
         /* Start with the whole querystring including initial '?' */
         std::string_view queryString = rawQuery;
 
-        /* List of key, value could be cached for repeated fetches similar to how headers are, todo! */
+        /* See QueryIndex for repeated fetches */
         while (queryString.length()) {
             /* Find boundaries of this statement */
             std::string_view statement = queryString.substr(1, queryString.find('&', 1) - 1);
@@ -52,55 +164,7 @@ namespace uWS {
                     /* String comparison */
                     if (key == statementKey) {
 
-                        /* Decode value inplace, put null at end if before length of original */
-                        char *in = (char *) statementValue.data();
-
-                        /* Write offset */
-                        unsigned int out = 0;
-
-                        /* Walk over all chars until end or null char, decoding in place */
-                        for (unsigned int i = 0; i < statementValue.length() && in[i]; i++) {
-                                /* Only bother with '%' */
-                                if (in[i] == '%') {
-                                    /* Do we have enough data for two bytes hex? */
-                                    if (i + 2 >= statementValue.length()) {
-                                        return {};
-                                    }
-
-                                    /* Two bytes hex */
-                                    int hex1 = in[i + 1] - '0';
-                                    if (hex1 > 9) {
-                                        hex1 &= 223;
-                                        hex1 -= 7;
-                                    }
-
-                                    int hex2 = in[i + 2] - '0';
-                                    if (hex2 > 9) {
-                                        hex2 &= 223;
-                                        hex2 -= 7;
-                                    }
-
-                                    *((unsigned char *) &in[out]) = (unsigned char) (hex1 * 16 + hex2);
-                                    i += 2;
-                                } else {
-                                    /* Is this even a rule? */
-                                    if (in[i] == '+') {
-                                        in[out] = ' ';
-                                    } else {
-                                        in[out] = in[i];
-                                    }
-                                }
-
-                                /* We always only write one char */
-                                out++;
-                        }
-
-                        /* If decoded string is shorter than original, put null char to stop next read */
-                        if (out < statementValue.length()) {
-                            in[out] = 0;
-                        }
-
-                        return statementValue.substr(0, out);
+                        return decodeQueryValueOnce(statementValue);
                     }
                 } else {
                     /* This querystring is invalid, cannot parse it */
@@ -115,6 +179,83 @@ namespace uWS {
         return {nullptr, 0};
     }
 
+    /* Per-request index of the query, built in one scan on first lookup so that reading
+     * many keys does not rescan the query. Values are decoded in place once, when first read, the same way as by
+     * getDecodedQueryValue so that both can be used on one query. */
+    struct QueryIndex {
+        static const unsigned int MAX_QUERY_PARAMETERS = 16;
+
+    private:
+        struct Parameter {
+            std::string_view key, value;
+            bool decoded;
+        } parameters[MAX_QUERY_PARAMETERS];
+        unsigned int numParameters = 0;
+        /* Offset in raw query where indexing stopped, if we ran out of slots */
+        size_t overflowOffset = 0;
+        bool built = false;
+
+        void build(std::string_view rawQuery) {
+            built = true;
+            numParameters = 0;
+            overflowOffset = 0;
+
+            for (size_t offset = 0; offset < rawQuery.length(); ) {
+                /* Statement is between the leading '?' or '&' and the next '&' */
+                size_t end = rawQuery.find('&', offset + 1);
+                if (end == std::string_view::npos) {
+                    end = rawQuery.length();
+                }
+                std::string_view statement = rawQuery.substr(offset + 1, end - offset - 1);
+
+                size_t equality = statement.find('=');
+                if (statement.length() && equality != std::string_view::npos) {
+                    if (numParameters == MAX_QUERY_PARAMETERS) {
+                        overflowOffset = offset;
+                        return;
+                    }
+                    parameters[numParameters++] = {statement.substr(0, equality), statement.substr(equality + 1), false};
+                }
+                offset = end;
+            }
+        }
+
+    public:
+        /* Call for every new request */
+        void reset() {
+            built = false;
+        }
+
+        /* Same as getDecodedQueryValue, takes raw query including initial '?' sign */
+        std::string_view get(std::string_view key, std::string_view rawQuery) {
+            if (!key.length()) {
+                return {};
+            }
+
+            if (!built) {
+                build(rawQuery);
+            }
+
+            for (unsigned int i = 0; i < numParameters; i++) {
+                Parameter &p = parameters[i];
+                if (p.key == key) {
+                    if (!p.decoded) {
+                        p.value = decodeQueryValueOnce(p.value);
+                        p.decoded = true;
+                    }
+                    return p.value;
+                }
+            }
+
+            /* Too many parameters to index them all, scan the rest */
+            if (overflowOffset) {
+                return getDecodedQueryValue(key, rawQuery.substr(overflowOffset));
+            }
+
+            return {nullptr, 0};
+        }
+    };
+
 }
 
 #endif
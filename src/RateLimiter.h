@@ -0,0 +1,152 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_RATELIMITER_H
+#define UWS_RATELIMITER_H
+
+/* A RateLimiter holds token buckets (as GCRA, a theoretical arrival time per bucket) for connections and requests
+ * of remote addresses. Buckets live in a fixed sketch, two rows of cells each picked by a seeded hash of the address,
+ * so memory stays bounded whatever the number of addresses. An address is as far along as the least of its two
+ * cells; colliding addresses only push cells later, so a collision can make a limit stricter, never looser */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+namespace uWS {
+
+struct RateLimit {
+    /* Sustained rate, 0 for no limit */
+    unsigned int perSecond = 0;
+    /* How many may come at once, 0 for perSecond */
+    unsigned int burst = 0;
+};
+
+struct RateLimiterOptions {
+    /* New connections of an address, closed when over */
+    RateLimit connections;
+    /* Requests of an address, answered 429 and closed when over */
+    RateLimit requests;
+    /* Cells per row, rounded up to a power of two */
+    unsigned int width = 4096;
+};
+
+struct RateLimiter {
+private:
+    struct Sketch {
+        /* Two rows of width cells, microseconds an address is due at */
+        std::vector<uint64_t> cells;
+        uint64_t mask = 0, interval = 0, tolerance = 0;
+
+        void init(RateLimit limit, unsigned int width) {
+            if (!limit.perSecond) {
+                return;
+            }
+            cells.assign(2 * (size_t) width, 0);
+            mask = width - 1;
+            interval = std::max<uint64_t>(1000000 / limit.perSecond, 1);
+            tolerance = interval * (std::max(limit.burst ? limit.burst : limit.perSecond, 1u) - 1);
+        }
+
+        bool admit(uint64_t hash, uint64_t now) {
+            if (!interval) {
+                return true;
+            }
+            uint64_t &a = cells[hash & mask], &b = cells[mask + 1 + ((hash >> 32) & mask)];
+            uint64_t due = std::max(std::min(a, b), now);
+            if (due - now > tolerance) {
+                return false;
+            }
+            due += interval;
+            a = std::max(a, due);
+            b = std::max(b, due);
+            return true;
+        }
+    };
+
+    Sketch connections, requests;
+    /* Random, so that which addresses share cells cannot be known from outside */
+    uint64_t seed;
+
+public:
+    RateLimiter(RateLimiterOptions options) {
+        unsigned int width = 1;
+        while (width < options.width && width < (1u << 31)) {
+            width <<= 1;
+        }
+        connections.init(options.connections, width);
+        requests.init(options.requests, width);
+
+        std::random_device randomDevice;
+        seed = ((uint64_t) randomDevice() << 32) | randomDevice();
+    }
+
+    /* Of the 4 or 16 bytes of an address, never 0 (which is left for no address) */
+    uint64_t hash(std::string_view address) const {
+        uint64_t h = seed ^ address.length();
+        for (size_t i = 0; i < address.length(); i += 8) {
+            uint64_t word = 0;
+            memcpy(&word, address.data() + i, std::min<size_t>(8, address.length() - i));
+            h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+            h ^= h >> 29;
+        }
+        /* Finalizer of MurmurHash3, for both halves to be as good */
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h | 1;
+    }
+
+    /* Takes a token of the address hashed, returning false if there was none */
+    bool admitConnection(uint64_t hash, uint64_t now = RateLimiter::now()) {
+        return connections.admit(hash, now);
+    }
+
+    bool admitRequest(uint64_t hash, uint64_t now = RateLimiter::now()) {
+        return requests.admit(hash, now);
+    }
+
+    bool limitsRequests() const {
+        return requests.interval;
+    }
+
+    /* Monotonic microseconds, of the coarse clock where there is one (a few nanoseconds to read, a tick behind) */
+    static uint64_t now() {
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+#else
+        return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+};
+
+}
+
+#endif // UWS_RATELIMITER_H
@@ -0,0 +1,792 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_REVERSEPROXY_H
+#define UWS_REVERSEPROXY_H
+
+/* A ReverseProxy forwards requests to one upstream over cleartext HTTP/1.1, streaming bodies both ways as they
+ * come. Upstream connections are kept alive in a pool of the loop the proxy was made on (one proxy per loop,
+ * like a ClientApp), and used for one exchange at a time. Each side only reads while the other takes what it
+ * reads: a full upstream pauses the request, a full client pauses the response.
+ *
+ * Request heads are written from the parsed request as it is, minus hop-by-hop fields. Response bodies with a
+ * length keep it; for cleartext clients on Linux whatever of such a body was not yet read by the loop goes from
+ * socket to socket by splice(2), not passing through user space */
+
+#include <algorithm>
+#include <charconv>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "App.h"
+#include "ChunkedEncoding.h"
+#include "ProxyHead.h"
+
+#if defined(__linux__) && !defined(UWS_NO_DIRECT_SOCKET_IO)
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace uWS {
+
+struct ReverseProxyOptions {
+    /* The upstream, over cleartext HTTP/1.1 */
+    std::string host = "127.0.0.1";
+    int port = 80;
+    /* Idle keep-alive connections kept, beyond these they are closed */
+    unsigned int maxIdleConnections = 64;
+    /* Seconds to connect, and to wait for the upstream while it owes us the response */
+    unsigned short timeout = 30;
+    /* Seconds an idle connection is kept, best below the keep-alive timeout of the upstream */
+    unsigned short idleTimeout = 50;
+    /* What may be buffered for the upstream before reading the request pauses */
+    unsigned int maxBackpressure = 256 * 1024;
+    /* Larger response heads are a bad gateway */
+    unsigned int maxHeadLength = 16 * 1024;
+};
+
+template <bool SSL>
+struct TemplatedReverseProxy {
+private:
+    /* One request and its response, shared by the client's handlers and the upstream connection serving it */
+    struct Exchange {
+        enum State : unsigned char {
+            READING_HEAD,
+            /* The body has a length, so the response keeps it */
+            LENGTH,
+            CHUNKED,
+            /* The last chunk went, what follows it is still to be consumed */
+            CHUNKED_ENDED,
+            UNTIL_CLOSE
+        };
+
+        /* Until the response is done (or the client aborted) */
+        HttpResponse<SSL> *res;
+        /* Until the upstream connection closed, or went back to the pool */
+        us_socket_t *upstream = nullptr;
+        /* Sent again on another connection if one from the pool turns out closed before answering. Only for
+         * requests without body */
+        std::string retryHead;
+        /* The response head while incomplete */
+        std::string head;
+        /* Of a body with a length, what the client did not take yet */
+        std::string pending;
+        uintmax_t pendingOffset = 0;
+        uint64_t totalSize = 0, received = 0;
+        uint64_t chunkState = STATE_IS_CHUNKED;
+        State state = READING_HEAD;
+        bool isHead = false;
+        bool chunkedRequest = false;
+        bool requestDone = false;
+        bool responseDone = false;
+        /* The client's reads are paused for the upstream to take what it sent */
+        bool requestPaused = false;
+        bool keepAlive = true;
+
+        Exchange(HttpResponse<SSL> *res) : res(res) {}
+    };
+
+    struct UpstreamSocketData : AsyncSocketData<false> {
+        std::shared_ptr<Exchange> exchange;
+        /* Writes are buffered until connected */
+        bool connecting = true;
+        /* Reads are paused for the client to take the response */
+        bool paused = false;
+        bool idle = false;
+        /* For splice(2), made on first use */
+        int pipe[2] = {-1, -1};
+
+        ~UpstreamSocketData() {
+#if defined(__linux__) && !defined(UWS_NO_DIRECT_SOCKET_IO)
+            if (pipe[0] != -1) {
+                ::close(pipe[0]);
+                ::close(pipe[1]);
+            }
+#endif
+        }
+    };
+
+    struct ProxyContextData {
+        ReverseProxyOptions options;
+        /* Idle connections, the most recently used last */
+        std::vector<us_socket_t *> idle;
+        /* Set while we close everything, nothing is retried then */
+        bool closing = false;
+    };
+
+    us_socket_context_t *proxyContext = nullptr;
+
+    static UpstreamSocketData *getSocketData(us_socket_t *u) {
+        return (UpstreamSocketData *) us_socket_ext(false, u);
+    }
+
+    static ProxyContextData *getContextData(us_socket_t *u) {
+        return (ProxyContextData *) us_socket_context_ext(false, us_socket_context(false, u));
+    }
+
+    /* Sends data to the upstream, or buffers it until connected */
+    static void send(us_socket_t *u, std::string_view data) {
+        UpstreamSocketData *upstreamSocketData = getSocketData(u);
+        if (upstreamSocketData->connecting) {
+            upstreamSocketData->buffer.append(data.data(), data.length());
+        } else {
+            ((AsyncSocket<false> *) u)->write(data.data(), (int) data.length());
+        }
+    }
+
+    static void pauseUpstream(us_socket_t *u) {
+        UpstreamSocketData *upstreamSocketData = getSocketData(u);
+        if (!upstreamSocketData->paused) {
+            upstreamSocketData->paused = true;
+            ((AsyncSocket<false> *) u)->pause();
+            /* The client may take its time, it has a timeout of its own */
+            us_socket_timeout(false, u, 0);
+        }
+    }
+
+    static void resumeUpstream(us_socket_t *u) {
+        UpstreamSocketData *upstreamSocketData = getSocketData(u);
+        if (upstreamSocketData->paused) {
+            upstreamSocketData->paused = false;
+            ((AsyncSocket<false> *) u)->resume();
+            us_socket_timeout(false, u, getContextData(u)->options.timeout);
+        }
+    }
+
+    /* The response is done once the client has it all, from then on we no longer touch it */
+    static void checkResponded(Exchange *exchange) {
+        if (exchange->res && exchange->res->hasResponded()) {
+            if (exchange->requestPaused) {
+                exchange->requestPaused = false;
+                exchange->res->resume();
+            }
+            exchange->res = nullptr;
+        }
+    }
+
+    /* Hands the connection of an exchange back to the pool, or closes it */
+    static void release(us_socket_t *u) {
+        UpstreamSocketData *upstreamSocketData = getSocketData(u);
+        ProxyContextData *proxyContextData = getContextData(u);
+        std::shared_ptr<Exchange> exchange = std::move(upstreamSocketData->exchange);
+        exchange->upstream = nullptr;
+
+        /* What is left of the request, if anything, has nowhere to go */
+        if (exchange->requestPaused && exchange->res) {
+            exchange->requestPaused = false;
+            exchange->res->resume();
+        }
+
+        if (!exchange->keepAlive || proxyContextData->closing || proxyContextData->idle.size() >= proxyContextData->options.maxIdleConnections) {
+            us_socket_close(false, u, 0, nullptr);
+            return;
+        }
+        resumeUpstream(u);
+        upstreamSocketData->idle = true;
+        proxyContextData->idle.push_back(u);
+        us_socket_timeout(false, u, proxyContextData->options.idleTimeout);
+    }
+
+    /* All of the response came from the upstream. The connection is free once the request went in full as well */
+    static void finishResponse(us_socket_t *u, Exchange *exchange) {
+        exchange->responseDone = true;
+        if (exchange->requestDone || !exchange->keepAlive) {
+            release(u);
+        }
+    }
+
+    /* Sends the head on a connection from the pool, or a new one. Returns false if we could not even connect */
+    static bool dispatch(us_socket_context_t *context, const std::shared_ptr<Exchange> &exchange, std::string_view head) {
+        ProxyContextData *proxyContextData = (ProxyContextData *) us_socket_context_ext(false, context);
+
+        us_socket_t *u = nullptr;
+        if (proxyContextData->idle.size()) {
+            u = proxyContextData->idle.back();
+            proxyContextData->idle.pop_back();
+            getSocketData(u)->idle = false;
+
+            /* The upstream may have closed it while on its way to us */
+            if (exchange->requestDone && !exchange->retryHead.length()) {
+                exchange->retryHead.assign(head);
+            }
+        } else {
+            u = us_socket_context_connect(false, context, proxyContextData->options.host.c_str(), proxyContextData->options.port, nullptr, 0, sizeof(UpstreamSocketData));
+            if (!u) {
+                return false;
+            }
+            new (us_socket_ext(false, u)) UpstreamSocketData;
+        }
+
+        getSocketData(u)->exchange = exchange;
+        exchange->upstream = u;
+        us_socket_timeout(false, u, proxyContextData->options.timeout);
+        send(u, head);
+        return true;
+    }
+
+    /* The upstream was lost before the response was done */
+    static void abandon(us_socket_context_t *context, const std::shared_ptr<Exchange> &exchange) {
+        exchange->upstream = nullptr;
+        if (!exchange->res || exchange->responseDone) {
+            return;
+        }
+
+        if (exchange->state == Exchange::READING_HEAD && !exchange->head.length() && exchange->retryHead.length()
+            && !((ProxyContextData *) us_socket_context_ext(false, context))->closing) {
+            std::string head = std::move(exchange->retryHead);
+            exchange->retryHead.clear();
+            if (dispatch(context, exchange, head)) {
+                /* Kept again only if this one came from the pool as well */
+                return;
+            }
+        }
+
+        if (exchange->state == Exchange::READING_HEAD) {
+            respondWithError(exchange.get(), "502 Bad Gateway");
+        } else {
+            /* Part of the response went, the client can only tell from us closing */
+            exchange->res->close();
+        }
+    }
+
+    static void respondWithError(Exchange *exchange, std::string_view status) {
+        if (!exchange->res) {
+            return;
+        }
+        if (exchange->requestPaused) {
+            exchange->requestPaused = false;
+            exchange->res->resume();
+        }
+        /* Close the client connection if its request is yet to come in full */
+        exchange->res->writeStatus(status)->end(status.substr(4), !exchange->requestDone);
+        exchange->res = nullptr;
+    }
+
+    /* Writes one chunk of the request body, as it comes */
+    static void sendBody(const std::shared_ptr<Exchange> &exchange, std::string_view chunk, bool fin) {
+        us_socket_t *u = exchange->upstream;
+        if (!u || exchange->requestDone) {
+            return;
+        }
+
+        if (exchange->chunkedRequest) {
+            if (chunk.length()) {
+                char size[20];
+                char *sizeEnd = std::to_chars(size, size + sizeof(size) - 2, chunk.length(), 16).ptr;
+                *sizeEnd++ = '\r';
+                *sizeEnd++ = '\n';
+                send(u, std::string_view(size, (size_t) (sizeEnd - size)));
+                send(u, chunk);
+                send(u, "\r\n");
+            }
+            if (fin) {
+                send(u, "0\r\n\r\n");
+            }
+        } else if (chunk.length()) {
+            send(u, chunk);
+        }
+
+        if (fin) {
+            exchange->requestDone = true;
+            if (exchange->responseDone) {
+                release(u);
+            }
+            return;
+        }
+
+        /* Backpressure of the upstream stops reading the client, until drained */
+        if (!exchange->requestPaused && exchange->res && ((AsyncSocket<false> *) u)->getBufferedAmount() > getContextData(u)->options.maxBackpressure) {
+            exchange->requestPaused = true;
+            exchange->res->pause();
+        }
+    }
+
+    /* The client took too little of what we wrote, the upstream waits until it took it all */
+    static void blockedByClient(const std::shared_ptr<Exchange> &exchange) {
+        pauseUpstream(exchange->upstream);
+        exchange->res->onWritable([exchange, res = exchange->res](uintmax_t) {
+            if (((AsyncSocket<SSL> *) res)->write(nullptr, 0).second) {
+                return false;
+            }
+            res->onWritable(nullptr);
+            if (exchange->upstream) {
+                resumeUpstream(exchange->upstream);
+            }
+            return true;
+        });
+    }
+
+    /* Writes chunk of a body with a length, keeping what the client does not take for when it is writable */
+    static void writeLength(const std::shared_ptr<Exchange> &exchange, std::string_view chunk) {
+        HttpResponse<SSL> *res = exchange->res;
+        if (exchange->pending.length()) {
+            exchange->pending.append(chunk);
+            return;
+        }
+
+        uintmax_t offset = res->getWriteOffset();
+        if (!res->tryEnd(chunk, exchange->totalSize).first && !us_socket_is_closed(SSL, (us_socket_t *) res)) {
+            exchange->pending.assign(chunk.substr((size_t) (res->getWriteOffset() - offset)));
+            exchange->pendingOffset = res->getWriteOffset();
+            if (exchange->upstream) {
+                pauseUpstream(exchange->upstream);
+            }
+            res->onWritable([exchange, res](uintmax_t offset) {
+                auto [ok, done] = res->tryEnd(std::string_view(exchange->pending).substr((size_t) (offset - exchange->pendingOffset)), exchange->totalSize);
+                if (!ok) {
+                    return false;
+                }
+                exchange->pending.clear();
+                res->onWritable(nullptr);
+                checkResponded(exchange.get());
+                if (exchange->upstream) {
+                    resumeUpstream(exchange->upstream);
+                }
+                return true;
+            });
+        }
+        checkResponded(exchange.get());
+    }
+
+    /* Parses the response head, and writes it to the client. Returns false if malformed. Informational responses
+     * are skipped, leaving the state READING_HEAD */
+    static bool relayHead(Exchange *exchange, std::string_view head) {
+        ProxyHead responseHead;
+        if (!responseHead.parse(head)) {
+            return false;
+        }
+        if (responseHead.code < 200) {
+            /* 101 would be an upgrade, which we never asked for */
+            return responseHead.code != 101;
+        }
+        exchange->keepAlive = responseHead.keepAlive;
+
+        HttpResponse<SSL> *res = exchange->res;
+        res->writeStatus(responseHead.status);
+        ProxyHead::forEachField(head, [res, &responseHead](std::string_view key, std::string_view value) {
+            if (responseHead.forwards(key)) {
+                res->writeHeader(key, value);
+            }
+            return true;
+        });
+
+        unsigned int code = responseHead.code;
+        std::optional<uint64_t> contentLength = responseHead.contentLength;
+        if (exchange->isHead || code == 204 || code == 304) {
+            /* Nothing follows, though a HEAD response tells the length of what would */
+            res->endWithoutBody(exchange->isHead && contentLength ? std::optional<size_t>((size_t) *contentLength) : std::nullopt);
+            exchange->state = Exchange::LENGTH;
+        } else if (responseHead.chunked) {
+            exchange->state = Exchange::CHUNKED;
+        } else if (contentLength && !responseHead.closeDelimited) {
+            exchange->state = Exchange::LENGTH;
+            exchange->totalSize = *contentLength;
+            /* The head ends here with its length, also when no body came with it, as the body may be spliced
+             * past us from the socket */
+            if (!exchange->totalSize) {
+                res->end();
+            } else {
+                res->tryEnd(std::string_view(), exchange->totalSize);
+            }
+        } else {
+            exchange->state = Exchange::UNTIL_CLOSE;
+            exchange->keepAlive = false;
+        }
+        checkResponded(exchange);
+        return true;
+    }
+
+    /* Everything read from the upstream goes through here */
+    static void relay(us_socket_t *u, const std::shared_ptr<Exchange> &exchange, std::string_view data) {
+        std::string head;
+        while (exchange->state == Exchange::READING_HEAD) {
+            ProxyContextData *proxyContextData = getContextData(u);
+
+            /* Only the end of what we have can complete the head */
+            size_t searchFrom = std::max<size_t>(exchange->head.length(), 3) - 3;
+            if (exchange->head.length()) {
+                exchange->head.append(data);
+                head = std::move(exchange->head);
+                exchange->head.clear();
+                data = head;
+            }
+            size_t headLength = data.find("\r\n\r\n", searchFrom);
+            if (headLength == std::string_view::npos) {
+                if (data.length() > proxyContextData->options.maxHeadLength) {
+                    respondWithError(exchange.get(), "502 Bad Gateway");
+                    us_socket_close(false, u, 0, nullptr);
+                    return;
+                }
+                exchange->head.assign(data);
+                return;
+            }
+            if (headLength + 4 > proxyContextData->options.maxHeadLength) {
+                respondWithError(exchange.get(), "502 Bad Gateway");
+                us_socket_close(false, u, 0, nullptr);
+                return;
+            }
+
+            std::string_view responseHead = data.substr(0, headLength + 2);
+            data.remove_prefix(headLength + 4);
+            if (!exchange->res || !relayHead(exchange.get(), responseHead)) {
+                respondWithError(exchange.get(), "502 Bad Gateway");
+                us_socket_close(false, u, 0, nullptr);
+                return;
+            }
+            if (exchange->state == Exchange::READING_HEAD && !data.length()) {
+                return;
+            }
+        }
+
+        switch (exchange->state) {
+        case Exchange::LENGTH: {
+            uint64_t remaining = exchange->totalSize - exchange->received;
+            if (data.length() > remaining) {
+                /* Nothing may follow a response we did not ask for */
+                exchange->keepAlive = false;
+                data = data.substr(0, (size_t) remaining);
+            }
+            exchange->received += data.length();
+            if (exchange->res && data.length()) {
+                writeLength(exchange, data);
+            }
+            if (exchange->received == exchange->totalSize && !exchange->responseDone) {
+                finishResponse(u, exchange.get());
+            }
+            break;
+        }
+        case Exchange::CHUNKED:
+        case Exchange::CHUNKED_ENDED: {
+            bool blocked = false;
+            for (std::optional<std::string_view> chunk; (chunk = getNextChunk(data, exchange->chunkState)); ) {
+                if (!chunk->length()) {
+                    exchange->state = Exchange::CHUNKED_ENDED;
+                    if (exchange->res) {
+                        exchange->res->end();
+                        checkResponded(exchange.get());
+                    }
+                } else if (exchange->res && !exchange->res->write(*chunk)) {
+                    blocked = true;
+                }
+            }
+            if (isParsingInvalidChunkedEncoding(exchange->chunkState)) {
+                if (exchange->res) {
+                    exchange->res->close();
+                }
+                us_socket_close(false, u, 0, nullptr);
+                return;
+            }
+            if (exchange->state == Exchange::CHUNKED_ENDED && !exchange->chunkState) {
+                if (data.length()) {
+                    exchange->keepAlive = false;
+                }
+                finishResponse(u, exchange.get());
+            } else if (blocked && exchange->res) {
+                blockedByClient(exchange);
+            }
+            break;
+        }
+        case Exchange::UNTIL_CLOSE:
+            if (exchange->res && data.length() && !exchange->res->write(data)) {
+                blockedByClient(exchange);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+#if defined(__linux__) && !defined(UWS_NO_DIRECT_SOCKET_IO)
+    /* Moves what is still to come of a body with a length from the upstream socket to the client socket, through a
+     * pipe of the connection, until either would block. uSockets reads on its own whenever the upstream is readable,
+     * so this takes what arrived since, and what is in the kernel for us once the loop passed it to us */
+    static void spliceBody(us_socket_t *u, const std::shared_ptr<Exchange> &exchange) {
+        UpstreamSocketData *upstreamSocketData = getSocketData(u);
+        HttpResponse<SSL> *res = exchange->res;
+        AsyncSocket<SSL> *asyncSocket = (AsyncSocket<SSL> *) res;
+
+        /* Anything already written goes first */
+        if (exchange->pending.length() || asyncSocket->isCorked() || asyncSocket->write(nullptr, 0).second) {
+            return;
+        }
+        if (upstreamSocketData->pipe[0] == -1 && pipe2(upstreamSocketData->pipe, O_NONBLOCK | O_CLOEXEC)) {
+            upstreamSocketData->pipe[0] = upstreamSocketData->pipe[1] = -1;
+            return;
+        }
+
+        int upstreamFd = (int) (intptr_t) us_socket_get_native_handle(false, u);
+        int clientFd = (int) (intptr_t) res->getNativeHandle();
+        while (exchange->received < exchange->totalSize) {
+            ssize_t moved = splice(upstreamFd, nullptr, upstreamSocketData->pipe[1], nullptr, (size_t) std::min<uint64_t>(exchange->totalSize - exchange->received, 1 << 20), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved < 0 && errno == EINTR) {
+                continue;
+            }
+            if (moved <= 0) {
+                /* Nothing more for now. The end, or errors, reach us as events */
+                return;
+            }
+            exchange->received += (uint64_t) moved;
+
+            size_t inPipe = (size_t) moved;
+            while (inPipe) {
+                ssize_t sent = splice(upstreamSocketData->pipe[0], nullptr, clientFd, nullptr, inPipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (sent < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (sent <= 0) {
+                    break;
+                }
+                inPipe -= (size_t) sent;
+                res->overrideWriteOffset(res->getWriteOffset() + (uintmax_t) sent);
+                asyncSocket->getLoopData()->metrics.bytesOut.add((unsigned long long) sent);
+            }
+
+            if (inPipe) {
+                if (errno != EAGAIN) {
+                    res->close();
+                    return;
+                }
+                /* The client is full. What is left in the pipe goes the usual way, which polls for writable */
+                std::string leftover(inPipe, 0);
+                for (size_t offset = 0; offset < inPipe; ) {
+                    ssize_t bytes = read(upstreamSocketData->pipe[0], leftover.data() + offset, inPipe - offset);
+                    if (bytes <= 0 && errno != EINTR) {
+                        res->close();
+                        return;
+                    }
+                    offset += (size_t) std::max<ssize_t>(bytes, 0);
+                }
+                writeLength(exchange, leftover);
+                break;
+            }
+        }
+
+        if (exchange->received == exchange->totalSize) {
+            if (exchange->res && !exchange->pending.length()) {
+                writeLength(exchange, {});
+            }
+            finishResponse(u, exchange.get());
+        }
+    }
+#endif
+
+    void init() {
+        us_socket_context_on_open(false, proxyContext, [](us_socket_t *u, int /*isClient*/, char */*ip*/, int /*ipLength*/) {
+            getSocketData(u)->connecting = false;
+            ((AsyncSocket<false> *) u)->write(nullptr, 0);
+            return u;
+        });
+
+        us_socket_context_on_data(false, proxyContext, [](us_socket_t *u, char *data, int length) {
+            /* Kept alive by us, in case the exchange ends in here */
+            std::shared_ptr<Exchange> exchange = getSocketData(u)->exchange;
+            if (!exchange) {
+                /* Idle connections have nothing to say */
+                return us_socket_close(false, u, 0, nullptr);
+            }
+            us_socket_timeout(false, u, getContextData(u)->options.timeout);
+
+            /* Whatever goes to the client goes together */
+            if (HttpResponse<SSL> *res = exchange->res) {
+                res->cork([u, &exchange, data, length]() {
+                    relay(u, exchange, std::string_view(data, (size_t) length));
+                });
+            } else {
+                relay(u, exchange, std::string_view(data, (size_t) length));
+            }
+
+#if defined(__linux__) && !defined(UWS_NO_DIRECT_SOCKET_IO)
+            if constexpr (!SSL) {
+                if (exchange->state == Exchange::LENGTH && exchange->res && exchange->upstream == u && !getSocketData(u)->paused) {
+                    spliceBody(u, exchange);
+                }
+            }
+#endif
+            return u;
+        });
+
+        /* Once drained, reading the client goes on */
+        us_socket_context_on_writable(false, proxyContext, [](us_socket_t *u) {
+            AsyncSocket<false> *asyncSocket = (AsyncSocket<false> *) u;
+            asyncSocket->write(nullptr, 0);
+
+            Exchange *exchange = getSocketData(u)->exchange.get();
+            if (exchange && exchange->requestPaused && asyncSocket->getBufferedAmount() <= getContextData(u)->options.maxBackpressure / 2) {
+                exchange->requestPaused = false;
+                if (exchange->res) {
+                    exchange->res->resume();
+                }
+            }
+            return u;
+        });
+
+        us_socket_context_on_close(false, proxyContext, [](us_socket_t *u, int /*code*/, void */*reason*/) {
+            UpstreamSocketData *upstreamSocketData = getSocketData(u);
+            if (upstreamSocketData->idle) {
+                std::vector<us_socket_t *> &idle = getContextData(u)->idle;
+                idle.erase(std::find(idle.begin(), idle.end(), u));
+            }
+
+            std::shared_ptr<Exchange> exchange = std::move(upstreamSocketData->exchange);
+            upstreamSocketData->~UpstreamSocketData();
+            if (exchange) {
+                abandon(us_socket_context(false, u), exchange);
+            }
+            return u;
+        });
+
+        us_socket_context_on_connect_error(false, proxyContext, [](us_socket_t *u, int /*code*/) {
+            UpstreamSocketData *upstreamSocketData = getSocketData(u);
+            std::shared_ptr<Exchange> exchange = std::move(upstreamSocketData->exchange);
+            upstreamSocketData->~UpstreamSocketData();
+            if (exchange) {
+                abandon(us_socket_context(false, u), exchange);
+            }
+            return u;
+        });
+
+        /* The end of a body read until close, or of the connection */
+        us_socket_context_on_end(false, proxyContext, [](us_socket_t *u) {
+            std::shared_ptr<Exchange> exchange = getSocketData(u)->exchange;
+            if (exchange && exchange->state == Exchange::UNTIL_CLOSE) {
+                if (exchange->res) {
+                    exchange->res->end();
+                    checkResponded(exchange.get());
+                }
+                exchange->responseDone = true;
+            }
+            return us_socket_close(false, u, 0, nullptr);
+        });
+
+        us_socket_context_on_timeout(false, proxyContext, [](us_socket_t *u) {
+            UpstreamSocketData *upstreamSocketData = getSocketData(u);
+            if (!us_socket_is_established(false, u)) {
+                /* Still connecting, there is no close event for this */
+                std::shared_ptr<Exchange> exchange = std::move(upstreamSocketData->exchange);
+                upstreamSocketData->~UpstreamSocketData();
+                if (exchange) {
+                    exchange->upstream = nullptr;
+                    if (exchange->res) {
+                        respondWithError(exchange.get(), "504 Gateway Timeout");
+                    }
+                }
+                return us_socket_close_connecting(false, u);
+            }
+
+            Exchange *exchange = upstreamSocketData->exchange.get();
+            if (exchange && exchange->res && exchange->state == Exchange::READING_HEAD) {
+                respondWithError(exchange, "504 Gateway Timeout");
+            }
+            return us_socket_close(false, u, 0, nullptr);
+        });
+    }
+
+public:
+    TemplatedReverseProxy(ReverseProxyOptions options) {
+        proxyContext = us_create_socket_context(false, (us_loop_t *) Loop::get(), sizeof(ProxyContextData), {});
+        if (!proxyContext) {
+            return;
+        }
+        ProxyContextData *proxyContextData = new (us_socket_context_ext(false, proxyContext)) ProxyContextData;
+        proxyContextData->options = std::move(options);
+        init();
+    }
+
+    TemplatedReverseProxy(TemplatedReverseProxy &&other) : proxyContext(other.proxyContext) {
+        other.proxyContext = nullptr;
+    }
+
+    ~TemplatedReverseProxy() {
+        if (proxyContext) {
+            ProxyContextData *proxyContextData = (ProxyContextData *) us_socket_context_ext(false, proxyContext);
+            proxyContextData->closing = true;
+            us_socket_context_close(false, proxyContext);
+            proxyContextData->~ProxyContextData();
+            us_socket_context_free(false, proxyContext);
+        }
+    }
+
+    bool constructorFailed() {
+        return !proxyContext;
+    }
+
+    /* Forwards req to the upstream and its response to res, from within a request handler of the loop of this
+     * proxy, before anything was written to res. The full url (path and query) goes as it came, or as url.
+     * Responds 502 Bad Gateway if the upstream cannot be reached or answers nonsense, 504 Gateway Timeout if it
+     * does not answer within the timeout */
+    void forward(HttpResponse<SSL> *res, HttpRequest *req, std::string_view url = {}) {
+        static thread_local std::string head;
+        head.clear();
+        head.append(req->getCaseSensitiveMethod()).append(" ").append(url.length() ? url : req->getFullUrl()).append(" HTTP/1.1\r\n");
+
+        /* Fields are written as the parser left them (keys lower cased) */
+        std::string_view connectionTokens = req->getHeader(HeaderIndex::CONNECTION), forwardedFor;
+        for (auto [key, value] : *req) {
+            if (ProxyHead::isHopByHop(key) || key == "expect" || ProxyHead::hasToken(connectionTokens, key)) {
+                continue;
+            }
+            if (key == "x-forwarded-for") {
+                forwardedFor = value;
+                continue;
+            }
+            head.append(key).append(": ").append(value).append("\r\n");
+        }
+        head.append("x-forwarded-for: ");
+        if (forwardedFor.length()) {
+            head.append(forwardedFor).append(", ");
+        }
+        head.append(res->getRemoteAddressAsText()).append(SSL ? "\r\nx-forwarded-proto: https\r\n" : "\r\nx-forwarded-proto: http\r\n");
+
+        /* The parser took the body apart from its framing, which we redo */
+        std::string_view contentLength = req->getHeader(HeaderIndex::CONTENT_LENGTH);
+        std::shared_ptr<Exchange> exchange = std::make_shared<Exchange>(res);
+        exchange->isHead = req->getCaseSensitiveMethod() == "HEAD";
+        exchange->chunkedRequest = req->getHeader(HeaderIndex::TRANSFER_ENCODING).data() != nullptr;
+        exchange->requestDone = !exchange->chunkedRequest && (!contentLength.length() || contentLength == "0");
+        if (exchange->chunkedRequest) {
+            head.append("transfer-encoding: chunked\r\n");
+        }
+        head.append("\r\n");
+
+        res->onAborted([exchange]() {
+            exchange->res = nullptr;
+            if (exchange->upstream) {
+                /* The rest of the response has nowhere to go */
+                us_socket_close(false, exchange->upstream, 0, nullptr);
+            }
+        });
+        res->onData([exchange](std::string_view chunk, bool fin) {
+            sendBody(exchange, chunk, fin);
+        });
+
+        if (!dispatch(proxyContext, exchange, head)) {
+            respondWithError(exchange.get(), "502 Bad Gateway");
+        }
+    }
+};
+
+typedef TemplatedReverseProxy<false> ReverseProxy;
+typedef TemplatedReverseProxy<true> SSLReverseProxy;
+
+}
+
+#endif // UWS_REVERSEPROXY_H
@@ -0,0 +1,202 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_ROUTEMETRICS_H
+#define UWS_ROUTEMETRICS_H
+
+/* Latency and size of the responses of every route, recorded by the library from the route matched to end()
+ * (whenever that comes, so asynchronous responses included), see App::routeMetrics and App::getRouteStats */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace uWS {
+
+/* HDR style, log linear buckets: exact below 32, then 16 buckets for every power of two (a bucket is within
+ * 1/16 of the values in it) up to 2^40, which is where larger values are counted */
+struct HistogramSnapshot {
+    static constexpr unsigned int LINEAR = 32, SUB_BUCKETS = 16, MAX_BITS = 40;
+    static constexpr unsigned int BUCKETS = LINEAR + (MAX_BITS - 5) * SUB_BUCKETS;
+
+    unsigned long long counts[BUCKETS] = {};
+    unsigned long long count = 0, sum = 0, max = 0;
+
+    static unsigned int bucketOf(uint64_t value) {
+        if (value < LINEAR) {
+            return (unsigned int) value;
+        }
+        if (value >> MAX_BITS) {
+            return BUCKETS - 1;
+        }
+#if defined(__GNUC__)
+        unsigned int bits = 64 - (unsigned int) __builtin_clzll(value);
+#else
+        unsigned int bits = 0;
+        for (uint64_t v = value; v; v >>= 1) {
+            bits++;
+        }
+#endif
+        unsigned int shift = bits - 5;
+        return LINEAR + (shift - 1) * SUB_BUCKETS + (unsigned int) ((value >> shift) - SUB_BUCKETS);
+    }
+
+    /* The largest value counted in bucket */
+    static uint64_t highestOf(unsigned int bucket) {
+        if (bucket < LINEAR) {
+            return bucket;
+        }
+        unsigned int shift = (bucket - LINEAR) / SUB_BUCKETS + 1;
+        uint64_t mantissa = (bucket - LINEAR) % SUB_BUCKETS + SUB_BUCKETS;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    /* The value at or under which fraction (0 to 1) of all values are, as the top of its bucket (or the largest
+     * value of all, if smaller). 0 if empty */
+    uint64_t percentile(double fraction) const {
+        if (!count) {
+            return 0;
+        }
+        unsigned long long target = (unsigned long long) (fraction * (double) count + 0.5);
+        if (target < 1) {
+            target = 1;
+        }
+        unsigned long long seen = 0;
+        for (unsigned int i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= target) {
+                uint64_t highest = highestOf(i);
+                return highest < max ? highest : max;
+            }
+        }
+        return max;
+    }
+
+    double mean() const {
+        return count ? (double) sum / (double) count : 0;
+    }
+
+    HistogramSnapshot &operator+=(const HistogramSnapshot &other) {
+        for (unsigned int i = 0; i < BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        count += other.count;
+        sum += other.sum;
+        max = other.max > max ? other.max : max;
+        return *this;
+    }
+};
+
+/* Recorded by one thread, read by any without locking, like LoopMetrics */
+struct Histogram {
+    std::atomic<unsigned long long> counts[HistogramSnapshot::BUCKETS] = {};
+    std::atomic<unsigned long long> sum{0}, max{0};
+
+    static void add(std::atomic<unsigned long long> &counter, unsigned long long n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void record(uint64_t value) {
+        add(counts[HistogramSnapshot::bucketOf(value)], 1);
+        add(sum, value);
+        if (value > max.load(std::memory_order_relaxed)) {
+            max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    /* Counts are read one by one, so a snapshot taken while recording may be a few values apart from its sum */
+    void snapshot(HistogramSnapshot &out) const {
+        out.count = 0;
+        for (unsigned int i = 0; i < HistogramSnapshot::BUCKETS; i++) {
+            out.counts[i] = counts[i].load(std::memory_order_relaxed);
+            out.count += out.counts[i];
+        }
+        out.sum = sum.load(std::memory_order_relaxed);
+        out.max = max.load(std::memory_order_relaxed);
+    }
+};
+
+/* Of one route, as merged from every loop serving it */
+struct RouteStats {
+    /* As registered, "*" for any */
+    std::string method, pattern;
+    /* Responses ended, and requests whose connection closed before that */
+    unsigned long long responses = 0, aborted = 0;
+    /* Microseconds from the route matched to end() (or the last of tryEnd), and bytes of body sent */
+    HistogramSnapshot latencyMicroseconds, bytesOut;
+
+    RouteStats &operator+=(const RouteStats &other) {
+        responses += other.responses;
+        aborted += other.aborted;
+        latencyMicroseconds += other.latencyMicroseconds;
+        bytesOut += other.bytesOut;
+        return *this;
+    }
+};
+
+/* Of one route on one loop, kept by its HttpContext for as long as that lives */
+struct RouteMetrics {
+    std::string method, pattern;
+    Histogram latencyMicroseconds, bytesOut;
+    std::atomic<unsigned long long> aborted{0};
+
+    RouteMetrics(std::string method, std::string pattern) : method(std::move(method)), pattern(std::move(pattern)) {}
+
+    void end(uint64_t microseconds, uint64_t bytes) {
+        latencyMicroseconds.record(microseconds);
+        bytesOut.record(bytes);
+    }
+
+    void abort() {
+        Histogram::add(aborted, 1);
+    }
+
+    void snapshot(RouteStats &out) const {
+        out.method = method;
+        out.pattern = pattern;
+        latencyMicroseconds.snapshot(out.latencyMicroseconds);
+        bytesOut.snapshot(out.bytesOut);
+        out.responses = out.latencyMicroseconds.count;
+        out.aborted = aborted.load(std::memory_order_relaxed);
+    }
+};
+
+/* Adds the routes of one loop to those of others, by method and pattern */
+inline void mergeRouteStats(std::vector<RouteStats> &merged, const std::vector<std::unique_ptr<RouteMetrics>> &routes) {
+    for (const std::unique_ptr<RouteMetrics> &route : routes) {
+        RouteStats stats;
+        route->snapshot(stats);
+        bool found = false;
+        for (RouteStats &existing : merged) {
+            if (existing.method == stats.method && existing.pattern == stats.pattern) {
+                existing += stats;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            merged.push_back(std::move(stats));
+        }
+    }
+}
+
+}
+
+#endif // UWS_ROUTEMETRICS_H
@@ -0,0 +1,122 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_ROUTEPARAMETERS_H
+#define UWS_ROUTEPARAMETERS_H
+
+/* The names of the parameters of a route, made when the route is added. Looking one up is a few compares
+ * on one flat array, sorted by length then name, instead of a walk down a tree of strings */
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace uWS {
+
+struct RouteParameters {
+private:
+    struct Entry {
+        unsigned int offset;
+        unsigned short length, index;
+    };
+
+    /* Names end to end, entries pointing into them */
+    std::string names;
+    std::vector<Entry> entries;
+
+    /* Calls cb(name, index) for every parameter of pattern such as /users/:id/posts/:post */
+    template <typename F>
+    static constexpr void forEach(std::string_view pattern, F &&cb) {
+        unsigned short index = 0;
+        for (size_t i = 0; i < pattern.length(); i++) {
+            if (pattern[i] == ':') {
+                size_t start = ++i;
+                while (i < pattern.length() && pattern[i] != '/') {
+                    i++;
+                }
+                cb(pattern.substr(start, i - start), index++);
+            }
+        }
+    }
+
+public:
+    RouteParameters() = default;
+
+    explicit RouteParameters(std::string_view pattern) {
+        forEach(pattern, [this](std::string_view name, unsigned short index) {
+            /* A name given twice is the last one of them */
+            for (Entry &entry : entries) {
+                if (std::string_view(names.data() + entry.offset, entry.length) == name) {
+                    entry.index = index;
+                    return;
+                }
+            }
+            entries.push_back({(unsigned int) names.length(), (unsigned short) name.length(), index});
+            names.append(name);
+        });
+
+        std::sort(entries.begin(), entries.end(), [this](const Entry &a, const Entry &b) {
+            if (a.length != b.length) {
+                return a.length < b.length;
+            }
+            return memcmp(names.data() + a.offset, names.data() + b.offset, a.length) < 0;
+        });
+    }
+
+    /* Index of the parameter called name, or -1 */
+    int find(std::string_view name) const {
+        for (const Entry &entry : entries) {
+            if (entry.length < name.length()) {
+                continue;
+            }
+            if (entry.length > name.length()) {
+                break;
+            }
+            int difference = memcmp(names.data() + entry.offset, name.data(), name.length());
+            if (!difference) {
+                return entry.index;
+            } else if (difference > 0) {
+                break;
+            }
+        }
+        return -1;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    /* Index of the parameter called name in pattern, or -1, at compile time for literals. For handlers that
+     * want getParameter(index) without naming the index by hand:
+     * constexpr int ID = RouteParameters::indexOf("/users/:id", "id"); */
+    static constexpr int indexOf(std::string_view pattern, std::string_view name) {
+        int found = -1;
+        forEach(pattern, [&found, name](std::string_view parameter, unsigned short index) {
+            if (parameter == name) {
+                found = index;
+            }
+        });
+        return found;
+    }
+};
+
+}
+
+#endif // UWS_ROUTEPARAMETERS_H
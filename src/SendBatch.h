@@ -0,0 +1,88 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_SENDBATCH_H
+#define UWS_SENDBATCH_H
+
+/* How WebSocket::sendBatch frames its messages. It knows sockets only through a Binding, which has
+ *
+ *     LoopData *loopData(Socket *s);
+ *     bool isClosed(Socket *s);
+ *     bool send(Socket *s, std::string_view message);    false if dropped
+ *     void flush(Socket *s);                             writes what s sliced, if anything
+ */
+
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "LoopData.h"
+
+namespace uWS {
+
+/* What WebSocket::sendBatch did with its messages, sent ones may be left as backpressure as by send */
+struct SendBatchResult {
+    unsigned int sent = 0, dropped = 0;
+    /* Indices into the batch of messages to sockets of another loop than the first message, not sent */
+    std::vector<size_t> rejected;
+};
+
+template <typename Socket, typename Binding>
+SendBatchResult sendBatch(std::span<const std::pair<Socket *, std::string_view>> batch, Binding &binding) {
+    SendBatchResult result;
+    if (batch.empty()) {
+        return result;
+    }
+
+    /* Nobody writes to the cork buffer while we hold it, we only need others to slice */
+    LoopData *loopData = binding.loopData(batch[0].first);
+    bool holdsCork = !loopData->corkedSocket;
+    if (holdsCork) {
+        loopData->corkedSocket = loopData;
+    }
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        auto [socket, message] = batch[i];
+        if (binding.loopData(socket) != loopData) {
+            result.rejected.push_back(i);
+        } else if (binding.isClosed(socket) || !binding.send(socket, message)) {
+            result.dropped++;
+        } else {
+            result.sent++;
+        }
+    }
+
+    if (holdsCork) {
+        loopData->corkedSocket = nullptr;
+    }
+
+    /* Once per socket, the first flush takes the slice and leaves nothing to the others */
+    size_t nextRejected = 0;
+    for (size_t i = 0; i < batch.size(); i++) {
+        if (nextRejected < result.rejected.size() && result.rejected[nextRejected] == i) {
+            nextRejected++;
+        } else if (!binding.isClosed(batch[i].first)) {
+            binding.flush(batch[i].first);
+        }
+    }
+    return result;
+}
+
+}
+
+#endif // UWS_SENDBATCH_H
@@ -0,0 +1,115 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_SHAREDBUFFER_H
+#define UWS_SHAREDBUFFER_H
+
+/* A SharedBuffer is an immutable, reference counted payload that can be queued on many sockets
+ * without copying. The memory is released (by the deleter, if any) once the last reference is gone */
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <string_view>
+
+#include "MoveOnlyFunction.h"
+
+namespace uWS {
+
+struct SharedBuffer {
+    struct Control {
+        std::atomic<unsigned int> references;
+        const char *data;
+        size_t length;
+        /* Frees external memory, empty for copies (stored after the control block) */
+        MoveOnlyFunction<void(const char *, size_t)> deleter;
+    };
+
+private:
+    Control *control = nullptr;
+
+public:
+    /* Copies data once, into one allocation also holding the reference count */
+    static SharedBuffer copy(std::string_view data) {
+        char *memory = new char[sizeof(Control) + data.length()];
+        memcpy(memory + sizeof(Control), data.data(), data.length());
+        SharedBuffer buffer;
+        buffer.control = new (memory) Control{{1}, memory + sizeof(Control), data.length(), nullptr};
+        return buffer;
+    }
+
+    /* Wraps memory owned by you (an arena, an mmap), calling deleter once nobody references it */
+    SharedBuffer(const char *data, size_t length, MoveOnlyFunction<void(const char *, size_t)> &&deleter) {
+        char *memory = new char[sizeof(Control)];
+        control = new (memory) Control{{1}, data, length, std::move(deleter)};
+    }
+
+    SharedBuffer() = default;
+
+    SharedBuffer(const SharedBuffer &other) : control(retain(other.control)) {}
+
+    SharedBuffer(SharedBuffer &&other) : control(other.control) {
+        other.control = nullptr;
+    }
+
+    SharedBuffer &operator=(SharedBuffer other) {
+        std::swap(control, other.control);
+        return *this;
+    }
+
+    ~SharedBuffer() {
+        release(control);
+    }
+
+    const char *data() const {
+        return control ? control->data : nullptr;
+    }
+
+    size_t length() const {
+        return control ? control->length : 0;
+    }
+
+    std::string_view view() const {
+        return std::string_view(data(), length());
+    }
+
+    /* Raw reference handling, for queues holding the control block only */
+    static Control *retain(Control *control) {
+        if (control) {
+            control->references.fetch_add(1, std::memory_order_relaxed);
+        }
+        return control;
+    }
+
+    static void release(Control *control) {
+        if (control && control->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            if (control->deleter) {
+                control->deleter(control->data, control->length);
+            }
+            control->~Control();
+            delete [] (char *) control;
+        }
+    }
+
+    Control *getControl() const {
+        return control;
+    }
+};
+
+}
+
+#endif // UWS_SHAREDBUFFER_H
@@ -0,0 +1,359 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_SHAREDCACHE_H
+#define UWS_SHAREDCACHE_H
+
+/* A SharedCache is a response cache shared by the loops of one process, on top of their own (see
+ * CachingApp::setSharedCache). Lookups take no lock: entries are immutable once published and reclaimed
+ * by epoch, only after every thread that may have seen them left its lookup. Bodies are SharedBuffers,
+ * sent by every loop without copying. Misses are filled once for the whole process: the first to claim
+ * a key generates it, everyone else claiming it until then is told once it is filled, or given up on */
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "MoveOnlyFunction.h"
+#include "SharedBuffer.h"
+
+namespace uWS {
+
+struct SharedCache {
+    static const unsigned int MAX_READERS = 256;
+
+    /* Per entry bookkeeping we count on top of key and body */
+    static const size_t NODE_OVERHEAD = 96;
+
+    /* Claims neither filled nor released this long are given up on by expire, as if their thread is gone */
+    static const unsigned int FILL_TIMEOUT_S = 60;
+
+    /* One per thread doing lookups, for as long as it does */
+    struct alignas(64) Reader {
+        /* Epoch our current lookup began in, 0 when not in one */
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<bool> taken{false};
+    };
+
+    /* Called on the thread filling, with the body and when it was generated. Or with no body on the thread
+     * giving up the claim (see release), after which key is free to claim again */
+    typedef MoveOnlyFunction<void(const SharedBuffer *body, time_t created)> WaitFunction;
+
+    enum Claim {
+        HIT, // body and created are set
+        FILL, // ours to generate and fill
+        WAIT // someone else is generating it, waiter is called once filled
+    };
+
+private:
+    struct Node {
+        std::string key;
+        SharedBuffer body;
+        time_t created, expires;
+        size_t hash;
+        std::atomic<Node *> next{nullptr};
+        /* Order of insertion, for eviction (under the lock) */
+        Node *older = nullptr, *newer = nullptr;
+    };
+
+    struct Retired {
+        Node *node;
+        uint64_t epoch;
+    };
+
+    /* A key being generated, since claimed */
+    struct Flight {
+        time_t claimed = 0;
+        std::vector<WaitFunction> waiters;
+    };
+
+    /* Fixed, since readers walk the chains without a lock */
+    std::unique_ptr<std::atomic<Node *>[]> buckets;
+    size_t mask;
+
+    std::unique_ptr<Reader[]> readers;
+    std::atomic<uint64_t> epoch{1};
+
+    /* Everything below is for writers, under the lock */
+    std::mutex mutex;
+    std::unordered_map<std::string, Flight> flights;
+    std::vector<Retired> retired;
+    Node *oldest = nullptr, *newest = nullptr;
+    size_t totalBytes = 0, maxBytes;
+
+    void beginLookup(Reader *reader) {
+        reader->epoch.store(epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+        /* Pairs with the fence in reclaim: either it sees us in, or we see the unlinking it did before */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void endLookup(Reader *reader) {
+        reader->epoch.store(0, std::memory_order_release);
+    }
+
+    Node *lookup(std::string_view key, size_t hash) {
+        for (Node *node = buckets[hash & mask].load(std::memory_order_acquire); node; node = node->next.load(std::memory_order_acquire)) {
+            if (node->hash == hash && node->key == key) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    size_t weight(Node *node) {
+        return node->key.length() + node->body.length() + NODE_OVERHEAD;
+    }
+
+    /* Takes node out of its chain and the order of insertion, to be freed once nobody can be looking at it */
+    void unlink(Node *node) {
+        std::atomic<Node *> *link = &buckets[node->hash & mask];
+        while (link->load(std::memory_order_relaxed) != node) {
+            link = &link->load(std::memory_order_relaxed)->next;
+        }
+        link->store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+
+        (node->older ? node->older->newer : oldest) = node->newer;
+        (node->newer ? node->newer->older : newest) = node->older;
+        totalBytes -= weight(node);
+
+        retired.push_back({node, epoch.fetch_add(1, std::memory_order_acq_rel)});
+    }
+
+    /* Frees what no lookup in progress began before the retiring of */
+    void reclaim() {
+        if (retired.empty()) {
+            return;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        uint64_t oldest = UINT64_MAX;
+        for (unsigned int i = 0; i < MAX_READERS; i++) {
+            uint64_t e = readers[i].epoch.load(std::memory_order_acquire);
+            if (e && e < oldest) {
+                oldest = e;
+            }
+        }
+
+        size_t kept = 0;
+        for (Retired &r : retired) {
+            if (r.epoch < oldest) {
+                delete r.node;
+            } else {
+                retired[kept++] = r;
+            }
+        }
+        retired.resize(kept);
+    }
+
+public:
+    /* maxBytes counts keys, bodies and bookkeeping; buckets is rounded up to a power of two */
+    SharedCache(size_t maxBytes = 256 * 1024 * 1024, size_t bucketCount = 16384) : maxBytes(maxBytes) {
+        size_t size = 1;
+        while (size < bucketCount) {
+            size *= 2;
+        }
+        buckets.reset(new std::atomic<Node *>[size]);
+        for (size_t i = 0; i < size; i++) {
+            buckets[i].store(nullptr, std::memory_order_relaxed);
+        }
+        mask = size - 1;
+        readers.reset(new Reader[MAX_READERS]);
+    }
+
+    /* Every reader has to have left by now */
+    ~SharedCache() {
+        for (Node *node = oldest; node; ) {
+            Node *newer = node->newer;
+            delete node;
+            node = newer;
+        }
+        for (Retired &r : retired) {
+            delete r.node;
+        }
+    }
+
+    SharedCache(const SharedCache &) = delete;
+    SharedCache &operator=(const SharedCache &) = delete;
+
+    Reader *join() {
+        for (unsigned int i = 0; i < MAX_READERS; i++) {
+            bool taken = false;
+            if (readers[i].taken.compare_exchange_strong(taken, true)) {
+                return &readers[i];
+            }
+        }
+        std::cerr << "Error: more than " << MAX_READERS << " threads joined one SharedCache" << std::endl;
+        std::terminate();
+    }
+
+    void leave(Reader *reader) {
+        reader->taken.store(false, std::memory_order_release);
+    }
+
+    /* Lock free. Sets body and created to those of key if not expired at now */
+    bool find(Reader *reader, std::string_view key, time_t now, SharedBuffer &body, time_t &created) {
+        size_t hash = std::hash<std::string_view>{}(key);
+
+        beginLookup(reader);
+        Node *node = lookup(key, hash);
+        bool found = node && node->expires > now;
+        if (found) {
+            body = node->body;
+            created = node->created;
+        }
+        endLookup(reader);
+
+        return found;
+    }
+
+    /* A find that, on a miss, either makes key ours to fill or has waiter called once whoever claimed it did */
+    Claim claim(Reader *reader, std::string_view key, time_t now, SharedBuffer &body, time_t &created, WaitFunction &&waiter) {
+        if (find(reader, key, now, body, created)) {
+            return HIT;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        /* Filled since we looked */
+        if (find(reader, key, now, body, created)) {
+            return HIT;
+        }
+
+        auto [it, inserted] = flights.try_emplace(std::string(key));
+        if (!inserted) {
+            it->second.waiters.emplace_back(std::move(waiter));
+            return WAIT;
+        }
+        it->second.claimed = now;
+        return FILL;
+    }
+
+    /* Publishes body under key (claimed or not), replacing any older one, and calls the waiters of key */
+    void fill(std::string_view key, SharedBuffer body, time_t created, unsigned int secondsToExpiry) {
+        std::vector<WaitFunction> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            size_t hash = std::hash<std::string_view>{}(key);
+            Node *node = new Node;
+            node->key = key;
+            node->body = body;
+            node->created = created;
+            node->expires = created + secondsToExpiry;
+            node->hash = hash;
+
+            if (Node *old = lookup(key, hash)) {
+                unlink(old);
+            }
+
+            /* Fully formed before it is reachable */
+            std::atomic<Node *> &bucket = buckets[hash & mask];
+            node->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket.store(node, std::memory_order_release);
+
+            node->older = newest;
+            (newest ? newest->newer : oldest) = node;
+            newest = node;
+            totalBytes += weight(node);
+
+            /* Oldest first, which for one lifetime is also soonest to expire */
+            while (totalBytes > maxBytes && oldest) {
+                unlink(oldest);
+            }
+
+            if (auto it = flights.find(node->key); it != flights.end()) {
+                waiters.swap(it->second.waiters);
+                flights.erase(it);
+            }
+            reclaim();
+        }
+
+        for (WaitFunction &waiter : waiters) {
+            waiter(&body, created);
+        }
+    }
+
+    /* Gives up a claim on key without filling it, such as when its generating failed or took too long */
+    void release(std::string_view key) {
+        std::vector<WaitFunction> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (auto it = flights.find(std::string(key)); it != flights.end()) {
+                waiters.swap(it->second.waiters);
+                flights.erase(it);
+            }
+        }
+
+        for (WaitFunction &waiter : waiters) {
+            waiter(nullptr, 0);
+        }
+    }
+
+    /* Drops what expired by now, and gives up claims older than FILL_TIMEOUT_S. Skipped if someone else holds
+     * the lock, any loop calling this is as good */
+    void expire(time_t now) {
+        std::vector<WaitFunction> waiters;
+        {
+            std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+            if (!lock.owns_lock()) {
+                return;
+            }
+
+            for (Node *node = oldest; node; ) {
+                Node *newer = node->newer;
+                if (node->expires <= now) {
+                    unlink(node);
+                }
+                node = newer;
+            }
+            reclaim();
+
+            for (auto it = flights.begin(); it != flights.end(); ) {
+                if (it->second.claimed + FILL_TIMEOUT_S <= now) {
+                    for (WaitFunction &waiter : it->second.waiters) {
+                        waiters.emplace_back(std::move(waiter));
+                    }
+                    it = flights.erase(it);
+                } else {
+                    it++;
+                }
+            }
+        }
+
+        for (WaitFunction &waiter : waiters) {
+            waiter(nullptr, 0);
+        }
+    }
+
+    size_t getTotalBytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return totalBytes;
+    }
+};
+
+}
+
+#endif // UWS_SHAREDCACHE_H
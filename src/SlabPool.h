@@ -0,0 +1,233 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_SLABPOOL_H
+#define UWS_SLABPOOL_H
+
+/* A SlabPool hands out fixed size cells from 64kb slabs, aligned to their size so that any cell finds
+ * its slab by masking. Allocating takes from the most recently freed slab, keeping objects packed, and
+ * only a slab emptied while another one is kept empty goes back to the heap, so churn stays off it */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace uWS {
+
+struct SlabPool {
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+
+private:
+    struct Slab {
+        /* In the list of slabs with free cells, or of those without */
+        Slab *prev, *next;
+        void *freeCells;
+        /* Whose slab this is */
+        SlabPool *pool;
+        /* Cells in use, and cells ever handed out (the rest have never been touched) */
+        unsigned int used, touched;
+    };
+
+    /* Cells start after the header, at their alignment */
+    static constexpr size_t HEADER_SIZE = (sizeof(Slab) + 15) & ~(size_t) 15;
+
+    size_t cellSize;
+    unsigned int cellsPerSlab;
+    Slab *partialSlabs = nullptr, *fullSlabs = nullptr;
+    /* One slab kept around empty, so that alternating allocate and free does not hit the heap */
+    Slab *emptySlab = nullptr;
+    size_t numSlabs = 0;
+
+    static void unlink(Slab *&list, Slab *slab) {
+        if (slab->prev) {
+            slab->prev->next = slab->next;
+        } else {
+            list = slab->next;
+        }
+        if (slab->next) {
+            slab->next->prev = slab->prev;
+        }
+    }
+
+    static void link(Slab *&list, Slab *slab) {
+        slab->prev = nullptr;
+        slab->next = list;
+        if (list) {
+            list->prev = slab;
+        }
+        list = slab;
+    }
+
+    void release(Slab *slab) {
+        ::operator delete(slab, std::align_val_t(SLAB_SIZE));
+        numSlabs--;
+    }
+
+public:
+    /* Cells are aligned to 16 bytes */
+    SlabPool(size_t cellSize) : cellSize((cellSize + 15) & ~(size_t) 15) {
+        cellsPerSlab = (unsigned int) ((SLAB_SIZE - HEADER_SIZE) / this->cellSize);
+    }
+
+    SlabPool(const SlabPool &) = delete;
+    SlabPool &operator=(const SlabPool &) = delete;
+
+    /* Cells still in use are simply gone with us, destroy what they hold first (see forEachUsed) */
+    ~SlabPool() {
+        for (Slab **list : {&partialSlabs, &fullSlabs}) {
+            while (*list) {
+                Slab *slab = *list;
+                unlink(*list, slab);
+                release(slab);
+            }
+        }
+        if (emptySlab) {
+            release(emptySlab);
+        }
+    }
+
+    static constexpr bool fits(size_t cellSize) {
+        return cellSize <= SLAB_SIZE - HEADER_SIZE;
+    }
+
+    void *allocate() {
+        Slab *slab = partialSlabs;
+        if (!slab) {
+            if (emptySlab) {
+                slab = emptySlab;
+                emptySlab = nullptr;
+            } else {
+                slab = (Slab *) ::operator new(SLAB_SIZE, std::align_val_t(SLAB_SIZE));
+                slab->freeCells = nullptr;
+                slab->pool = this;
+                slab->used = slab->touched = 0;
+                numSlabs++;
+            }
+            link(partialSlabs, slab);
+        }
+
+        void *cell;
+        if (slab->freeCells) {
+            cell = slab->freeCells;
+            slab->freeCells = *(void **) cell;
+        } else {
+            cell = (char *) slab + HEADER_SIZE + slab->touched++ * cellSize;
+        }
+
+        if (++slab->used == cellsPerSlab) {
+            unlink(partialSlabs, slab);
+            link(fullSlabs, slab);
+        }
+        return cell;
+    }
+
+    void deallocate(void *cell) {
+        Slab *slab = (Slab *) ((uintptr_t) cell & ~(uintptr_t) (SLAB_SIZE - 1));
+        if (slab->used-- == cellsPerSlab) {
+            unlink(fullSlabs, slab);
+            link(partialSlabs, slab);
+        }
+        *(void **) cell = slab->freeCells;
+        slab->freeCells = cell;
+
+        if (!slab->used) {
+            unlink(partialSlabs, slab);
+            if (emptySlab) {
+                release(slab);
+            } else {
+                /* Handed out like new, in order */
+                slab->freeCells = nullptr;
+                slab->touched = 0;
+                emptySlab = slab;
+            }
+        } else if (slab != partialSlabs) {
+            /* Fill up the slab we free into first, the others may empty out */
+            unlink(partialSlabs, slab);
+            link(partialSlabs, slab);
+        }
+    }
+
+    /* Deallocates cell into whichever pool it came from, for those who do not keep it at hand */
+    static void free(void *cell) {
+        ((Slab *) ((uintptr_t) cell & ~(uintptr_t) (SLAB_SIZE - 1)))->pool->deallocate(cell);
+    }
+
+    /* Calls f with every cell in use, such as for destroying what is left before we go. It must not allocate
+     * or deallocate meanwhile */
+    template <typename F>
+    void forEachUsed(F &&f) {
+        std::vector<bool> isFree;
+        for (Slab *list : {partialSlabs, fullSlabs}) {
+            for (Slab *slab = list; slab; slab = slab->next) {
+                isFree.assign(slab->touched, false);
+                for (void *cell = slab->freeCells; cell; cell = *(void **) cell) {
+                    isFree[((size_t) ((char *) cell - (char *) slab) - HEADER_SIZE) / cellSize] = true;
+                }
+                for (unsigned int i = 0; i < slab->touched; i++) {
+                    if (!isFree[i]) {
+                        f((char *) slab + HEADER_SIZE + i * cellSize);
+                    }
+                }
+            }
+        }
+    }
+
+    /* Slabs held, the empty one included */
+    size_t slabs() const {
+        return numSlabs;
+    }
+};
+
+/* Strings of a few size classes, each from a SlabPool. Longer ones are from the heap */
+struct StringArena {
+    static constexpr size_t NUM_CLASSES = 5, MIN_CLASS = 16, MAX_LENGTH = MIN_CLASS << (NUM_CLASSES - 1);
+
+private:
+    SlabPool pools[NUM_CLASSES] = {MIN_CLASS, MIN_CLASS << 1, MIN_CLASS << 2, MIN_CLASS << 3, MIN_CLASS << 4};
+
+    static size_t sizeClass(size_t length) {
+        size_t sizeClass = 0;
+        while ((MIN_CLASS << sizeClass) < length) {
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+
+public:
+    /* Copies a string, to be freed with the same length */
+    char *copy(const char *data, size_t length) {
+        char *memory = length > MAX_LENGTH ? new char[length] : (char *) pools[sizeClass(length)].allocate();
+        if (length) {
+            memcpy(memory, data, length);
+        }
+        return memory;
+    }
+
+    void free(char *memory, size_t length) {
+        if (length > MAX_LENGTH) {
+            delete [] memory;
+        } else {
+            pools[sizeClass(length)].deallocate(memory);
+        }
+    }
+};
+
+}
+
+#endif // UWS_SLABPOOL_H
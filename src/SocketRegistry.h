@@ -0,0 +1,205 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_SOCKETREGISTRY_H
+#define UWS_SOCKETREGISTRY_H
+
+/* A SocketRegistry hands out handles to the sockets of one loop, for any thread to send to. A handle is
+ * a slot and the generation of that slot, so that sends to a socket closed since (its slot reused or not)
+ * are told apart and dropped. Sends are pushed to a ring, with more than that waiting behind a lock, and
+ * delivered by the loop in one pass before its next iteration, every socket corked once for all sent to it */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "MpscRing.h"
+
+namespace uWS {
+
+struct SocketRegistry;
+
+/* Copyable, valid from any thread for as long as the loop of the socket lives */
+struct SocketHandle {
+    SocketRegistry *registry = nullptr;
+    uint32_t slot = 0, generation = 0;
+
+    explicit operator bool() const {
+        return registry;
+    }
+
+    /* Queues message for the socket, from any thread. Returns false for an empty handle only, a closed socket
+     * is found out by its loop. OpCode as that of WebSocket::send */
+    inline bool send(std::string_view message, unsigned char opCode = 2, bool compress = false) const;
+};
+
+struct SocketRegistry {
+    struct Send {
+        uint32_t slot = 0, generation = 0;
+        std::string message;
+        unsigned char opCode = 0;
+        bool compress = false;
+    };
+
+    /* Called on the loop with everything sent to socket since the last delivery, in order */
+    typedef void (*DeliverFunction)(void *socket, Send *sends, size_t count);
+
+private:
+    struct Slot {
+        void *socket;
+        DeliverFunction deliver;
+        uint32_t generation;
+    };
+
+    /* Loop only */
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::vector<Send> pending;
+    unsigned long long stale = 0;
+
+    /* Sends by value, so that a message short enough for the string itself costs no allocation */
+    MpscRing<Send> ring;
+    /* Once the ring is full, senders append here until the loop caught up (keeping their order) */
+    std::mutex overflowMutex;
+    std::vector<Send> overflow;
+    std::atomic<bool> overflowing{false};
+
+    /* Wakeup is sent by whoever first sends after the loop started delivering */
+    std::atomic<bool> wakeupPending{false};
+    void (*wakeup)(void *user);
+    void *user;
+
+public:
+    SocketRegistry(void (*wakeup)(void *user), void *user, size_t ringCapacity = 4096) : ring(ringCapacity), wakeup(wakeup), user(user) {
+
+    }
+
+    SocketRegistry(const SocketRegistry &) = delete;
+    SocketRegistry &operator=(const SocketRegistry &) = delete;
+
+    /* Loop only. The handle stays valid until remove */
+    SocketHandle add(void *socket, DeliverFunction deliver) {
+        uint32_t slot;
+        if (freeSlots.size()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            slot = (uint32_t) slots.size();
+            slots.push_back({nullptr, nullptr, 0});
+        }
+        slots[slot].socket = socket;
+        slots[slot].deliver = deliver;
+        return {this, slot, slots[slot].generation};
+    }
+
+    /* Loop only, as the socket closes (or moves in memory). Anything still sent to its handle is dropped */
+    void remove(SocketHandle handle) {
+        Slot &slot = slots[handle.slot];
+        if (slot.socket && slot.generation == handle.generation) {
+            slot.socket = nullptr;
+            slot.generation++;
+            freeSlots.push_back(handle.slot);
+        }
+    }
+
+    /* Loop only. Sends dropped since their socket closed */
+    unsigned long long getStale() const {
+        return stale;
+    }
+
+    /* Any thread */
+    void push(Send &&send) {
+        if (overflowing.load(std::memory_order_acquire) || !ring.push(std::move(send))) {
+            std::lock_guard<std::mutex> lock(overflowMutex);
+            overflowing.store(true, std::memory_order_release);
+            overflow.push_back(std::move(send));
+        }
+        if (!wakeupPending.exchange(true)) {
+            wakeup(user);
+        }
+    }
+
+    /* Loop only, such as in a pre handler. Hands every socket all that was sent to it so far, in one call */
+    void deliver() {
+        /* Anything sent after this wakes us up again */
+        wakeupPending.store(false);
+
+        Send send;
+        while (ring.pop(send)) {
+            pending.push_back(std::move(send));
+        }
+        if (overflowing.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(overflowMutex);
+            for (Send &send : overflow) {
+                pending.push_back(std::move(send));
+            }
+            overflow.clear();
+            overflowing.store(false, std::memory_order_release);
+        }
+        if (pending.empty()) {
+            return;
+        }
+
+        /* One run per socket, each in the order sent */
+        std::stable_sort(pending.begin(), pending.end(), [](const Send &a, const Send &b) {
+            return a.slot < b.slot;
+        });
+
+        for (size_t begin = 0, end; begin < pending.size(); begin = end) {
+            end = begin + 1;
+            while (end < pending.size() && pending[end].slot == pending[begin].slot) {
+                end++;
+            }
+
+            /* Looked up run by run, since delivering may close (and remove) sockets */
+            SocketHandle handle = {this, pending[begin].slot, pending[begin].generation};
+            Slot *slot = handle.slot < slots.size() ? &slots[handle.slot] : nullptr;
+            for (size_t i = begin; i < end; i++) {
+                if (!slot || !slot->socket || pending[i].generation != slot->generation) {
+                    stale++;
+                    continue;
+                }
+                /* A run of the current generation, up to where an older one (if any) interleaves */
+                size_t j = i + 1;
+                while (j < end && pending[j].generation == pending[i].generation) {
+                    j++;
+                }
+                slot->deliver(slot->socket, &pending[i], j - i);
+                i = j - 1;
+                slot = handle.slot < slots.size() ? &slots[handle.slot] : nullptr;
+            }
+        }
+        pending.clear();
+    }
+};
+
+inline bool SocketHandle::send(std::string_view message, unsigned char opCode, bool compress) const {
+    if (!registry) {
+        return false;
+    }
+    registry->push({slot, generation, std::string(message), opCode, compress});
+    return true;
+}
+
+}
+
+#endif // UWS_SOCKETREGISTRY_H
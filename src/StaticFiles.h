@@ -0,0 +1,469 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_STATICFILES_H
+#define UWS_STATICFILES_H
+
+/* StaticFiles serves the files under a root directory (see TemplatedApp::serveStatic). Files up to
+ * maxCachedFileSize are read once and sent from a SharedBuffer, larger ones are kept open and sent
+ * with sendFile. Precompressed .br and .gz siblings, if at least as new, are sent to clients accepting
+ * them. Strong ETags and Last-Modified answer conditional requests with 304, and a single Range with
+ * 206 (of the identity). Files are looked up lazily, and forgotten once changed: as told by inotify
+ * on Linux, by their modification time elsewhere, checked once a second off the date timer.
+ * A request for what is not a regular file under root yields to the next matching route */
+
+#ifndef _WIN32
+
+#include "HttpResponse.h"
+#include "Loop.h"
+#include "SharedBuffer.h"
+#include "Utilities.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace uWS {
+
+struct StaticFilesOptions {
+    /* Served for directories */
+    std::string indexFile = "index.html";
+    /* Larger files are sent from the file (with sendfile(2) for cleartext) */
+    size_t maxCachedFileSize = 64 * 1024;
+    /* Files known at a time (each holding up to three fds or a cached body) */
+    size_t maxFiles = 4096;
+    /* For Cache-Control: max-age, none if 0 */
+    unsigned int maxAge = 0;
+};
+
+struct StaticFiles {
+    typedef StaticFilesOptions Options;
+
+private:
+    /* The identity or one of its precompressed siblings */
+    struct Variant {
+        std::string path;
+        int fd = -1;
+        uint64_t size = 0;
+        /* Instead of fd, for small ones */
+        SharedBuffer body;
+        std::string etag;
+
+        explicit operator bool() const {
+            return fd != -1 || body.data();
+        }
+    };
+
+    enum {
+        IDENTITY,
+        BROTLI,
+        GZIP,
+        VARIANTS
+    };
+
+    struct File {
+        Variant variants[VARIANTS];
+        std::string_view contentType;
+        time_t modified = 0;
+        char lastModified[29];
+
+        ~File() {
+            for (Variant &variant : variants) {
+                if (variant.fd != -1) {
+                    ::close(variant.fd);
+                }
+            }
+        }
+    };
+
+    std::string root;
+    size_t prefixLength;
+    Options options;
+    std::string cacheControl;
+
+    /* Keyed by decoded URL path, shared with responses still sending from a file */
+    std::unordered_map<std::string, std::shared_ptr<File>> files;
+    /* Reused for building keys and paths */
+    std::string decodeBuffer, keyBuffer, pathBuffer;
+
+    Loop *loop;
+#ifdef __linux__
+    int inotifyFd;
+    /* Watched directories, and their paths */
+    std::unordered_map<int, std::string> watches;
+#endif
+
+    static std::string_view contentTypeOf(std::string_view path) {
+        static const std::pair<std::string_view, std::string_view> types[] = {
+            {".html", "text/html; charset=utf-8"}, {".htm", "text/html; charset=utf-8"},
+            {".css", "text/css; charset=utf-8"}, {".js", "text/javascript; charset=utf-8"},
+            {".mjs", "text/javascript; charset=utf-8"}, {".json", "application/json"},
+            {".map", "application/json"}, {".txt", "text/plain; charset=utf-8"},
+            {".xml", "application/xml"}, {".svg", "image/svg+xml"}, {".png", "image/png"},
+            {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"}, {".gif", "image/gif"},
+            {".webp", "image/webp"}, {".avif", "image/avif"}, {".ico", "image/x-icon"},
+            {".wasm", "application/wasm"}, {".woff", "font/woff"}, {".woff2", "font/woff2"},
+            {".ttf", "font/ttf"}, {".pdf", "application/pdf"}, {".mp4", "video/mp4"},
+            {".webm", "video/webm"}, {".mp3", "audio/mpeg"}
+        };
+        size_t dot = path.rfind('.');
+        if (dot != std::string_view::npos && path.find('/', dot) == std::string_view::npos) {
+            std::string_view extension = path.substr(dot);
+            for (auto &[suffix, type] : types) {
+                if (suffix == extension) {
+                    return type;
+                }
+            }
+        }
+        return "application/octet-stream";
+    }
+
+    /* Opens path as a variant, cached if small enough. Returns false if it is not a regular file */
+    bool openVariant(Variant &variant, const std::string &path, struct stat &st) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+            ::close(fd);
+            return false;
+        }
+
+        variant.path = path;
+        variant.size = (uint64_t) st.st_size;
+
+        /* A strong tag of the contents for what we hold, of the inode and its version for what we send from disk */
+        char tag[64];
+        int length;
+        if (variant.size <= options.maxCachedFileSize) {
+            std::string contents(variant.size, '\0');
+            size_t read = 0;
+            while (read < contents.length()) {
+                ssize_t r = pread(fd, contents.data() + read, contents.length() - read, (off_t) read);
+                if (r <= 0) {
+                    if (r < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    ::close(fd);
+                    return false;
+                }
+                read += (size_t) r;
+            }
+            ::close(fd);
+
+            /* FNV-1a */
+            uint64_t hash = 14695981039346656037ull;
+            for (char c : contents) {
+                hash = (hash ^ (unsigned char) c) * 1099511628211ull;
+            }
+            length = snprintf(tag, sizeof(tag), "\"%llx-%llx\"", (unsigned long long) variant.size, (unsigned long long) hash);
+            variant.body = SharedBuffer::copy(contents);
+        } else {
+            variant.fd = fd;
+#ifdef __APPLE__
+            long long nanoseconds = (long long) st.st_mtimespec.tv_sec * 1000000000ll + st.st_mtimespec.tv_nsec;
+#else
+            long long nanoseconds = (long long) st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+#endif
+            length = snprintf(tag, sizeof(tag), "\"%llx-%llx-%llx\"", (unsigned long long) st.st_ino, (unsigned long long) variant.size, (unsigned long long) nanoseconds);
+        }
+        variant.etag.assign(tag, (size_t) length);
+        return true;
+    }
+
+    /* Loads what key (a decoded path, relative to root) refers to */
+    std::shared_ptr<File> load(const std::string &key) {
+        pathBuffer.assign(root).append(key);
+
+        struct stat st;
+        if (stat(pathBuffer.c_str(), &st)) {
+            return nullptr;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (pathBuffer.back() != '/') {
+                pathBuffer.push_back('/');
+            }
+            pathBuffer.append(options.indexFile);
+        }
+
+        auto file = std::make_shared<File>();
+        if (!openVariant(file->variants[IDENTITY], pathBuffer, st)) {
+            return nullptr;
+        }
+        file->contentType = contentTypeOf(pathBuffer);
+        file->modified = st.st_mtime;
+        utils::formatHttpDate(st.st_mtime, file->lastModified);
+
+        /* Siblings older than the identity are stale, leave them be */
+        for (int sibling : {BROTLI, GZIP}) {
+            struct stat siblingStat;
+            Variant &variant = file->variants[sibling];
+            if (!openVariant(variant, pathBuffer + (sibling == BROTLI ? ".br" : ".gz"), siblingStat) || siblingStat.st_mtime < st.st_mtime) {
+                if (variant.fd != -1) {
+                    ::close(variant.fd);
+                }
+                variant = Variant();
+            }
+        }
+
+#ifdef __linux__
+        if (inotifyFd != -1) {
+            std::string directory = pathBuffer.substr(0, pathBuffer.rfind('/'));
+            int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE |
+                IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+            if (wd != -1) {
+                watches[wd] = std::move(directory);
+            }
+        }
+#endif
+        return file;
+    }
+
+    /* Forgets every file with a variant at path, or under it if path is a directory (ending in '/') */
+    void forget(std::string_view path) {
+        for (auto it = files.begin(); it != files.end(); ) {
+            bool changed = false;
+            for (Variant &variant : it->second->variants) {
+                std::string_view variantPath = variant.path;
+                changed = changed || (path.length() && (path.back() == '/' ? variantPath.substr(0, path.length()) == path : variantPath == path));
+            }
+            /* A sibling appearing changes its identity too */
+            std::string_view identity = it->second->variants[IDENTITY].path;
+            changed = changed || (path.length() > identity.length() && path.substr(0, identity.length()) == identity &&
+                (path.substr(identity.length()) == ".br" || path.substr(identity.length()) == ".gz"));
+            it = changed ? files.erase(it) : std::next(it);
+        }
+    }
+
+    /* Once a second */
+    void revalidate() {
+#ifdef __linux__
+        if (inotifyFd != -1) {
+            alignas(struct inotify_event) char events[4096];
+            ssize_t length;
+            while ((length = read(inotifyFd, events, sizeof(events))) > 0) {
+                for (char *p = events; p < events + length; ) {
+                    struct inotify_event *event = (struct inotify_event *) p;
+                    p += sizeof(struct inotify_event) + event->len;
+
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        files.clear();
+                        continue;
+                    }
+                    auto watch = watches.find(event->wd);
+                    if (watch == watches.end()) {
+                        continue;
+                    }
+                    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                        forget(watch->second + "/");
+                        if (event->mask & IN_IGNORED) {
+                            watches.erase(watch);
+                        }
+                    } else if (event->len) {
+                        forget(watch->second + "/" + event->name);
+                    }
+                }
+            }
+            return;
+        }
+#endif
+        for (auto it = files.begin(); it != files.end(); ) {
+            bool changed = false;
+            for (Variant &variant : it->second->variants) {
+                struct stat st;
+                changed = changed || (variant && (stat(variant.path.c_str(), &st) || (uint64_t) st.st_size != variant.size || st.st_mtime > it->second->modified));
+            }
+            it = changed ? files.erase(it) : std::next(it);
+        }
+    }
+
+public:
+    /* Serves root (without trailing slash) for URLs beginning with prefixLength bytes of route prefix */
+    StaticFiles(std::string root, size_t prefixLength, Options options = {}) : root(std::move(root)), prefixLength(prefixLength), options(std::move(options)) {
+        while (this->root.length() > 1 && this->root.back() == '/') {
+            this->root.pop_back();
+        }
+        if (this->options.maxAge) {
+            cacheControl = "public, max-age=" + std::to_string(this->options.maxAge);
+        }
+
+#ifdef __linux__
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+        loop = Loop::get();
+        loop->addDateHandler(this, [this](Loop *) {
+            revalidate();
+        });
+    }
+
+    ~StaticFiles() {
+        loop->removeDateHandler(this);
+#ifdef __linux__
+        if (inotifyFd != -1) {
+            ::close(inotifyFd);
+        }
+#endif
+    }
+
+    StaticFiles(const StaticFiles &) = delete;
+    StaticFiles &operator=(const StaticFiles &) = delete;
+
+    /* Responds to a GET (or HEAD, without the body) for the file of its URL, or yields if there is none */
+    template <bool SSL>
+    void serve(HttpResponse<SSL> *res, HttpRequest *req, bool head = false) {
+        std::string_view url = req->getUrl().substr(std::min(prefixLength, req->getUrl().length()));
+
+        decodeBuffer.resize(url.length());
+        size_t length = utils::decodeUrlPath(url, decodeBuffer.data());
+        if (length == SIZE_MAX) {
+            req->setYield(true);
+            return;
+        }
+
+        /* Without empty and "." segments, so that a file has one key, and one path to be told of changes by */
+        std::string_view decoded(decodeBuffer.data(), length);
+        keyBuffer.clear();
+        for (size_t segment = 0; segment < decoded.length(); ) {
+            size_t slash = std::min(decoded.find('/', segment), decoded.length());
+            std::string_view name = decoded.substr(segment, slash - segment);
+            if (name.length() && name != ".") {
+                keyBuffer.append(1, '/').append(name);
+            }
+            segment = slash + 1;
+        }
+        if (keyBuffer.empty()) {
+            keyBuffer = "/";
+        }
+
+        auto it = files.find(keyBuffer);
+        if (it == files.end()) {
+            std::shared_ptr<File> file = load(keyBuffer);
+            if (!file) {
+                req->setYield(true);
+                return;
+            }
+            if (files.size() >= options.maxFiles) {
+                files.erase(files.begin());
+            }
+            it = files.emplace(keyBuffer, std::move(file)).first;
+        }
+        std::shared_ptr<File> &file = it->second;
+
+        /* Ranges are of the identity, every other request gets the best coding it accepts */
+        std::string_view range = req->getHeader("range");
+        bool precompressed = file->variants[BROTLI] || file->variants[GZIP];
+        int chosen = IDENTITY;
+        if (precompressed && !range.length()) {
+            unsigned int codings = utils::acceptedCodings(req->getHeader("accept-encoding"));
+            if ((codings & utils::CODING_BR) && file->variants[BROTLI]) {
+                chosen = BROTLI;
+            } else if ((codings & utils::CODING_GZIP) && file->variants[GZIP]) {
+                chosen = GZIP;
+            }
+        }
+        Variant &variant = file->variants[chosen];
+
+        /* If-Modified-Since only counts without If-None-Match */
+        std::string_view ifNoneMatch = req->getHeader("if-none-match"), ifModifiedSince = req->getHeader("if-modified-since");
+        int64_t since;
+        bool notModified = ifNoneMatch.data() ? utils::matchesEntityTag(ifNoneMatch, variant.etag) :
+            ifModifiedSince.data() && utils::parseHttpDate(ifModifiedSince, since) && file->modified <= since;
+
+        uint64_t first = 0, last = variant.size ? variant.size - 1 : 0;
+        utils::ByteRange byteRange = notModified ? utils::RANGE_NONE : utils::parseByteRange(range, variant.size, first, last);
+
+        if (notModified) {
+            res->writeStatus("304 Not Modified");
+        } else if (byteRange == utils::RANGE_SATISFIABLE) {
+            res->writeStatus("206 Partial Content");
+        } else if (byteRange == utils::RANGE_NOT_SATISFIABLE) {
+            res->writeStatus("416 Range Not Satisfiable");
+        }
+
+        res->writeHeader("ETag", variant.etag);
+        res->writeHeader("Last-Modified", std::string_view(file->lastModified, 29));
+        if (precompressed) {
+            res->writeHeader("Vary", "Accept-Encoding");
+        }
+        if (cacheControl.length()) {
+            res->writeHeader("Cache-Control", cacheControl);
+        }
+        if (notModified) {
+            res->endWithoutBody();
+            return;
+        }
+
+        res->writeHeader("Content-Type", file->contentType);
+        res->writeHeader("Accept-Ranges", "bytes");
+        if (chosen != IDENTITY) {
+            res->writeHeader("Content-Encoding", chosen == BROTLI ? "br" : "gzip");
+        }
+        if (byteRange != utils::RANGE_NONE) {
+            char contentRange[80] = "bytes ";
+            int rangeLength = 6;
+            if (byteRange == utils::RANGE_SATISFIABLE) {
+                rangeLength += utils::u64toa(first, contentRange + rangeLength);
+                contentRange[rangeLength++] = '-';
+                rangeLength += utils::u64toa(last, contentRange + rangeLength);
+            } else {
+                contentRange[rangeLength++] = '*';
+            }
+            contentRange[rangeLength++] = '/';
+            rangeLength += utils::u64toa(variant.size, contentRange + rangeLength);
+            res->writeHeader("Content-Range", std::string_view(contentRange, (size_t) rangeLength));
+
+            if (byteRange == utils::RANGE_NOT_SATISFIABLE) {
+                res->end();
+                return;
+            }
+        }
+
+        uint64_t bodyLength = variant.size ? last - first + 1 : 0;
+        if (head) {
+            res->endWithoutBody((size_t) bodyLength);
+        } else if (variant.body.data()) {
+            if (bodyLength == variant.size) {
+                res->end(variant.body);
+            } else {
+                res->end(variant.body.view().substr((size_t) first, (size_t) bodyLength));
+            }
+        } else {
+            /* The file (and its fd) lives for as long as we send from it, even if forgotten meanwhile */
+            res->onAborted([file]() {});
+            res->sendFile(variant.fd, first, bodyLength);
+        }
+    }
+};
+
+}
+
+#endif
+
+#endif // UWS_STATICFILES_H
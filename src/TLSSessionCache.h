@@ -0,0 +1,337 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_TLSSESSIONCACHE_H
+#define UWS_TLSSESSIONCACHE_H
+
+/* Resumption of TLS sessions across every SSL context sharing one TLSSessionCache, such as the apps of a
+ * LocalCluster (set SocketContextOptions::session_cache on all of them). A client reconnecting to another loop
+ * than the one it first shook hands with then resumes rather than paying for a full handshake, both with session
+ * IDs (kept here, serialized) and with tickets (encrypted with keys kept here, rotating). OpenSSL only */
+
+namespace uWS {
+struct TLSSessionCache;
+}
+
+#ifdef LIBUS_USE_OPENSSL
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace uWS {
+
+struct TLSSessionCacheOptions {
+    /* Sessions kept for resumption by session ID, the oldest going first past it (0 leaves it to tickets) */
+    unsigned int maxSessions = 20 * 1024;
+    /* How long a session can be resumed, by its ID or its ticket */
+    unsigned int sessionSeconds = 2 * 60 * 60;
+    /* A new ticket key this often. Tickets of the two keys before it are still taken, and renewed */
+    unsigned int ticketKeySeconds = 60 * 60;
+};
+
+/* Counters, only ever added to */
+struct TLSSessionCacheStats {
+    unsigned long long sessionsStored, sessionHits, sessionMisses;
+    /* Tickets of a key we still have (resumed unless they do not authenticate) and of one we no longer have */
+    unsigned long long ticketsIssued, ticketsOfKnownKey, ticketsOfUnknownKey;
+};
+
+struct TLSSessionCache {
+private:
+    struct TicketKey {
+        unsigned char name[16];
+        unsigned char hmacKey[32];
+        unsigned char aesKey[32];
+    };
+
+    TLSSessionCacheOptions options;
+
+    /* Sessions by ID, and their IDs in the order stored */
+    struct Session {
+        std::string der;
+        std::list<std::string>::iterator age;
+    };
+    std::mutex sessionsMutex;
+    std::unordered_map<std::string, Session> sessions;
+    std::list<std::string> ages;
+
+    /* The current key first */
+    std::mutex keysMutex;
+    TicketKey keys[3];
+    std::chrono::steady_clock::time_point rotatedAt;
+
+    std::atomic<unsigned long long> sessionsStored = 0, sessionHits = 0, sessionMisses = 0;
+    std::atomic<unsigned long long> ticketsIssued = 0, ticketsOfKnownKey = 0, ticketsOfUnknownKey = 0;
+
+    static void randomKey(TicketKey &key) {
+        if (RAND_bytes((unsigned char *) &key, sizeof(key)) != 1) {
+            std::cerr << "Error: TLSSessionCache could not make a ticket key!" << std::endl;
+            std::terminate();
+        }
+    }
+
+    /* We find ourselves from the SSL (as set when its hello came in) since it may have changed context for
+     * its server name by the time it resumes, while OpenSSL keeps calling the callbacks of the first one */
+    static int sslIndex() {
+        static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    static int ctxIndex() {
+        static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    static TLSSessionCache *of(SSL *s) {
+        return (TLSSessionCache *) SSL_get_ex_data(s, sslIndex());
+    }
+
+    static int onClientHello(SSL *s, int *, void *cache) {
+        SSL_set_ex_data(s, sslIndex(), cache);
+        return SSL_CLIENT_HELLO_SUCCESS;
+    }
+
+    static int onNewSession(SSL *s, SSL_SESSION *session) {
+        if (TLSSessionCache *cache = of(s)) {
+            cache->store(session);
+        }
+        /* We keep no reference */
+        return 0;
+    }
+
+    static SSL_SESSION *onGetSession(SSL *s, const unsigned char *id, int length, int *copy) {
+        *copy = 0;
+        TLSSessionCache *cache = of(s);
+        return cache ? cache->load(std::string_view((const char *) id, (size_t) length)) : nullptr;
+    }
+
+    static void onRemoveSession(SSL_CTX *ctx, SSL_SESSION *session) {
+        if (TLSSessionCache *cache = (TLSSessionCache *) SSL_CTX_get_ex_data(ctx, ctxIndex())) {
+            unsigned int length;
+            const unsigned char *id = SSL_SESSION_get_id(session, &length);
+            cache->remove(std::string_view((const char *) id, length));
+        }
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    typedef EVP_MAC_CTX MacContext;
+
+    static bool initMac(EVP_MAC_CTX *mac, unsigned char *key) {
+        OSSL_PARAM params[] = {
+            OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key, 32),
+            OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char *) "SHA256", 0),
+            OSSL_PARAM_construct_end()
+        };
+        return EVP_MAC_CTX_set_params(mac, params) == 1;
+    }
+#else
+    typedef HMAC_CTX MacContext;
+
+    static bool initMac(HMAC_CTX *mac, unsigned char *key) {
+        return HMAC_Init_ex(mac, key, 32, EVP_sha256(), nullptr) == 1;
+    }
+#endif
+
+    /* Encrypts new tickets with the current key, decrypts those of any key we still have (asking for a new
+     * ticket unless of the current key) and sends the rest of them for a full handshake */
+    static int onTicketKey(SSL *s, unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *cipher, MacContext *mac, int encrypt) {
+        TLSSessionCache *cache = of(s);
+        if (!cache) {
+            return 0;
+        }
+
+        TicketKey key;
+        if (encrypt) {
+            cache->currentKey(key);
+            if (RAND_bytes(iv, 16) != 1) {
+                return 0;
+            }
+            memcpy(name, key.name, sizeof(key.name));
+            if (EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aesKey, iv) != 1 || !initMac(mac, key.hmacKey)) {
+                return -1;
+            }
+            cache->ticketsIssued.fetch_add(1, std::memory_order_relaxed);
+            return 1;
+        }
+
+        int age = cache->findKey(name, key);
+        if (age < 0) {
+            cache->ticketsOfUnknownKey.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        if (!initMac(mac, key.hmacKey) || EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aesKey, iv) != 1) {
+            return -1;
+        }
+        cache->ticketsOfKnownKey.fetch_add(1, std::memory_order_relaxed);
+        return age ? 2 : 1;
+    }
+
+    void store(SSL_SESSION *session) {
+        unsigned int idLength;
+        const unsigned char *id = SSL_SESSION_get_id(session, &idLength);
+        int length = i2d_SSL_SESSION(session, nullptr);
+        if (length <= 0 || !idLength) {
+            return;
+        }
+        std::string der((size_t) length, '\0');
+        unsigned char *out = (unsigned char *) der.data();
+        i2d_SSL_SESSION(session, &out);
+
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        std::string key((const char *) id, idLength);
+        auto it = sessions.find(key);
+        if (it != sessions.end()) {
+            it->second.der = std::move(der);
+        } else {
+            ages.push_back(key);
+            sessions.emplace(std::move(key), Session{std::move(der), std::prev(ages.end())});
+            while (sessions.size() > options.maxSessions) {
+                sessions.erase(ages.front());
+                ages.pop_front();
+            }
+        }
+        sessionsStored.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    SSL_SESSION *load(std::string_view id) {
+        std::string der;
+        {
+            std::lock_guard<std::mutex> lock(sessionsMutex);
+            auto it = sessions.find(std::string(id));
+            if (it == sessions.end()) {
+                sessionMisses.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            der = it->second.der;
+        }
+        sessionHits.fetch_add(1, std::memory_order_relaxed);
+
+        /* OpenSSL checks whether it timed out */
+        const unsigned char *in = (const unsigned char *) der.data();
+        return d2i_SSL_SESSION(nullptr, &in, (long) der.length());
+    }
+
+    void remove(std::string_view id) {
+        std::lock_guard<std::mutex> lock(sessionsMutex);
+        auto it = sessions.find(std::string(id));
+        if (it != sessions.end()) {
+            ages.erase(it->second.age);
+            sessions.erase(it);
+        }
+    }
+
+    void currentKey(TicketKey &key) {
+        std::lock_guard<std::mutex> lock(keysMutex);
+        if (std::chrono::steady_clock::now() - rotatedAt >= std::chrono::seconds(options.ticketKeySeconds)) {
+            rotateLocked();
+        }
+        key = keys[0];
+    }
+
+    /* How many keys ago this one was current, or -1 if we no longer have it */
+    int findKey(const unsigned char *name, TicketKey &key) {
+        std::lock_guard<std::mutex> lock(keysMutex);
+        for (int i = 0; i < 3; i++) {
+            if (!memcmp(keys[i].name, name, sizeof(keys[i].name))) {
+                key = keys[i];
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void rotateLocked() {
+        keys[2] = keys[1];
+        keys[1] = keys[0];
+        randomKey(keys[0]);
+        rotatedAt = std::chrono::steady_clock::now();
+    }
+
+public:
+    TLSSessionCache(TLSSessionCacheOptions options = {}) : options(options) {
+        /* Those before the first one were never current, any name matching them is as good as unknown */
+        for (TicketKey &key : keys) {
+            randomKey(key);
+        }
+        rotatedAt = std::chrono::steady_clock::now();
+    }
+
+    /* Contexts attached must be freed before us */
+    TLSSessionCache(const TLSSessionCache &) = delete;
+    TLSSessionCache &operator=(const TLSSessionCache &) = delete;
+
+    /* Resumes the sessions of ctx, and of the server names it switches to, with ours. Done by the App for
+     * SocketContextOptions::session_cache */
+    void attach(SSL_CTX *ctx) {
+        if (!ctx) {
+            return;
+        }
+        SSL_CTX_set_ex_data(ctx, ctxIndex(), this);
+        SSL_CTX_set_client_hello_cb(ctx, onClientHello, this);
+        SSL_CTX_set_timeout(ctx, (long) options.sessionSeconds);
+
+        if (options.maxSessions) {
+            SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+            SSL_CTX_sess_set_new_cb(ctx, onNewSession);
+            SSL_CTX_sess_set_get_cb(ctx, onGetSession);
+            SSL_CTX_sess_set_remove_cb(ctx, onRemoveSession);
+        }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, onTicketKey);
+#else
+        SSL_CTX_set_tlsext_ticket_key_cb(ctx, onTicketKey);
+#endif
+    }
+
+    /* Starts a new ticket key now, rather than when due */
+    void rotateTicketKeys() {
+        std::lock_guard<std::mutex> lock(keysMutex);
+        rotateLocked();
+    }
+
+    TLSSessionCacheStats getStats() {
+        return {
+            sessionsStored.load(std::memory_order_relaxed), sessionHits.load(std::memory_order_relaxed),
+            sessionMisses.load(std::memory_order_relaxed), ticketsIssued.load(std::memory_order_relaxed),
+            ticketsOfKnownKey.load(std::memory_order_relaxed), ticketsOfUnknownKey.load(std::memory_order_relaxed)
+        };
+    }
+};
+
+}
+
+#endif
+
+#endif // UWS_TLSSESSIONCACHE_H
@@ -0,0 +1,180 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_TASK_H
+#define UWS_TASK_H
+
+/* The coroutine type of Task handlers (see Coroutine.h for the awaitables). It knows sockets and loops only through
+ * Binding, which has
+ *
+ *     static CoroutineLink **links(T &arg);    where a Task taking arg links itself to be aborted, or null
+ *     static LoopData *loopData();             of the loop the Task runs on
+ *
+ * Its frame comes from the loop and goes back to that same loop's pools once done. A Task aborted while awaiting is
+ * destroyed right there. One aborted while running is destroyed as it next suspends, any socket data it was holding
+ * is released then. A Task must only await awaitables that suspend through its promise. What is left of Tasks as
+ * their loop goes is destroyed, as nothing could resume them after */
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <iostream>
+
+#include "LoopData.h"
+
+namespace uWS {
+
+template <typename Binding>
+struct BasicTask {
+    struct promise_type : CoroutineLink {
+        /* What we are suspended on, resumers check that it is still them we wait for */
+        enum Awaiting : unsigned char {
+            RUNNING,
+            BODY,
+            WRITABLE,
+            SLEEP
+        } awaiting = RUNNING;
+        /* Our socket or loop went away while we were running, we are destroyed as we next suspend */
+        bool aborted = false;
+        void *awaiter = nullptr;
+        /* Undoes what the awaiter waits on if we are aborted, such as closing its timer */
+        void (*cancel)(void *awaiter) = nullptr;
+
+        /* Our place among the coroutines of the loop */
+        struct LoopLink : CoroutineLink {
+            promise_type *promise;
+        } loopLink;
+
+        /* The first HttpResponse or WebSocket among our arguments (the closure of a lambda comes first) binds us */
+        template <typename... Args>
+        promise_type(Args &... args) {
+            (bind(args), ...);
+            loopLink.promise = this;
+            loopLink.abort = [](CoroutineLink *link) {
+                return static_cast<LoopLink *>(link)->promise->abortSelf();
+            };
+            loopLink.link(Binding::loopData()->coroutines);
+        }
+
+        template <typename T>
+        void bind(T &arg) {
+            if (pprev) {
+                return;
+            }
+            if (CoroutineLink **links = Binding::links(arg)) {
+                abort = [](CoroutineLink *link) {
+                    return static_cast<promise_type *>(link)->abortSelf();
+                };
+                link(*links);
+            }
+        }
+
+        ~promise_type() {
+            unlink();
+            loopLink.unlink();
+            if (hold && !--hold->holders) {
+                CoroutineHold *last = hold;
+                last->release(last->socket);
+                delete last;
+            }
+        }
+
+        std::coroutine_handle<promise_type> handle() {
+            return std::coroutine_handle<promise_type>::from_promise(*this);
+        }
+
+        /* Called by our awaiters as they suspend. False if we were aborted meanwhile, and are now gone */
+        bool suspend(Awaiting what, void *awaiter, void (*cancel)(void *awaiter) = nullptr) {
+            if (aborted) {
+                handle().destroy();
+                return false;
+            }
+            awaiting = what;
+            this->awaiter = awaiter;
+            this->cancel = cancel;
+            return true;
+        }
+
+        void resume() {
+            awaiting = RUNNING;
+            handle().resume();
+        }
+
+        /* Destroys us unless running. Returns whether we were */
+        bool abortSelf() {
+            aborted = true;
+            if (awaiting == RUNNING) {
+                return true;
+            }
+            if (cancel) {
+                cancel(awaiter);
+            }
+            handle().destroy();
+            return false;
+        }
+
+        /* By size class, from the loop we run on (and back to the pool of that loop, whichever we are on then) */
+        static void *operator new(size_t size) {
+            if (size > (LoopData::MIN_COROUTINE_FRAME << (LoopData::COROUTINE_FRAME_CLASSES - 1))) {
+                return ::operator new(size);
+            }
+            return Binding::loopData()->coroutineFrames[sizeClass(size)].allocate();
+        }
+
+        static void operator delete(void *frame, size_t size) {
+            if (size > (LoopData::MIN_COROUTINE_FRAME << (LoopData::COROUTINE_FRAME_CLASSES - 1))) {
+                ::operator delete(frame);
+                return;
+            }
+            SlabPool::free(frame);
+        }
+
+        static size_t sizeClass(size_t size) {
+            size_t sizeClass = 0;
+            while ((LoopData::MIN_COROUTINE_FRAME << sizeClass) < size) {
+                sizeClass++;
+            }
+            return sizeClass;
+        }
+
+        BasicTask get_return_object() {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            std::cerr << "Error: A Task must not throw!" << std::endl;
+            std::terminate();
+        }
+    };
+};
+
+}
+
+#endif
+
+#endif // UWS_TASK_H
@@ -0,0 +1,183 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_TASKPOOL_H
+#define UWS_TASKPOOL_H
+
+/* A TaskPool runs CPU heavy work (validation, thumbnails, crypto) off the event loop, see Loop::offload.
+ * Every worker has a queue of its own, tasks are spread over them and idle workers steal from the busy.
+ * The pool holds a bounded number of tasks, beyond that submit fails rather than queueing without end */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MoveOnlyFunction.h"
+
+namespace uWS {
+
+/* Shared by a socket and what it offloaded, cancelled once the socket closes (or the response is done) */
+struct TaskToken {
+    std::atomic<bool> cancelled{false};
+};
+
+struct TaskPool {
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<MoveOnlyFunction<void()>> tasks;
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<unsigned int> nextWorker{0};
+    /* Submitted but not yet taken, never more than capacity */
+    std::atomic<size_t> pending{0};
+    size_t capacity;
+
+    /* Workers with nothing to take sleep here, submit only notifies if any do */
+    std::mutex sleepMutex;
+    std::condition_variable wakeup;
+    std::atomic<unsigned int> sleeping{0};
+    bool stopping = false;
+
+    /* The worker we are, if we are one of this pool */
+    struct WorkerIdentity {
+        TaskPool *pool = nullptr;
+        unsigned int index = 0;
+    };
+
+    static WorkerIdentity &getWorkerIdentity() {
+        static thread_local WorkerIdentity workerIdentity;
+        return workerIdentity;
+    }
+
+    /* Oldest of our own, else the newest of someone else */
+    bool take(unsigned int self, MoveOnlyFunction<void()> &task) {
+        for (unsigned int i = 0; i < workers.size(); i++) {
+            Worker &worker = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (!worker.tasks.empty()) {
+                if (!i) {
+                    task = std::move(worker.tasks.front());
+                    worker.tasks.pop_front();
+                } else {
+                    task = std::move(worker.tasks.back());
+                    worker.tasks.pop_back();
+                }
+                pending.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(unsigned int self) {
+        getWorkerIdentity() = {this, self};
+        MoveOnlyFunction<void()> task;
+        while (true) {
+            if (take(self, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            /* Counted before looking at pending, or submit could miss us */
+            sleeping.fetch_add(1);
+            wakeup.wait(lock, [this]() { return stopping || pending.load(); });
+            sleeping.fetch_sub(1);
+            if (stopping && !pending.load()) {
+                return;
+            }
+        }
+    }
+
+public:
+    TaskPool(unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency()), size_t capacity = 64 * 1024) : capacity(capacity) {
+        for (unsigned int i = 0; i < numThreads; i++) {
+            workers.emplace_back(new Worker);
+        }
+        for (unsigned int i = 0; i < numThreads; i++) {
+            workers[i]->thread = std::thread([this, i]() {
+                work(i);
+            });
+        }
+    }
+
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+
+    /* Finishes what is queued, then joins. Loops using the pool must be done with it */
+    ~TaskPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (std::unique_ptr<Worker> &worker : workers) {
+            worker->thread.join();
+        }
+    }
+
+    /* The pool of loops not given one of their own, started on first use */
+    static TaskPool &shared() {
+        static TaskPool sharedPool;
+        return sharedPool;
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    /* Tasks waiting to be taken by a worker */
+    size_t getPending() const {
+        return pending.load(std::memory_order_relaxed);
+    }
+
+    /* Queues task, or returns false (dropping it) if the pool already holds capacity tasks.
+     * Tasks submitted by a worker go to its own queue, others are spread round robin */
+    bool submit(MoveOnlyFunction<void()> &&task) {
+        if (pending.fetch_add(1) >= capacity) {
+            pending.fetch_sub(1);
+            return false;
+        }
+
+        WorkerIdentity &workerIdentity = getWorkerIdentity();
+        unsigned int index = workerIdentity.pool == this ? workerIdentity.index : nextWorker.fetch_add(1, std::memory_order_relaxed) % (unsigned int) workers.size();
+        {
+            std::lock_guard<std::mutex> lock(workers[index]->mutex);
+            workers[index]->tasks.emplace_back(std::move(task));
+        }
+
+        if (sleeping.load()) {
+            /* Taking the lock makes sure whoever counted itself is waiting by now */
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wakeup.notify_one();
+        }
+        return true;
+    }
+};
+
+}
+
+#endif // UWS_TASKPOOL_H
@@ -0,0 +1,168 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UWS_TIMINGWHEEL_H
+#define UWS_TIMINGWHEEL_H
+
+/* A TimingWheel keeps the timeouts of a loop, in ticks of one second. Deadlines within 256 ticks sit in
+ * a slot of their own, later ones in one of 64 slots of 256 ticks which are spread out once reached.
+ * Moving a deadline later (what every send and receive does) is a single store: the node stays where
+ * it is and is moved on when its old slot comes up. Only earlier deadlines relink */
+
+#include <cstdint>
+#include <cstddef>
+
+namespace uWS {
+
+struct TimingWheelNode {
+    TimingWheelNode *prev = nullptr, *next = nullptr;
+    /* Called when due, disarmed */
+    void (*expire)(void *owner) = nullptr;
+    void *owner = nullptr;
+    /* The tick we are due, with the slot we sit in never later than this */
+    uint32_t deadline = 0;
+
+    bool isArmed() const {
+        return prev;
+    }
+};
+
+struct TimingWheel {
+    static constexpr unsigned int NEAR_BITS = 8, FAR_BITS = 6;
+    static constexpr unsigned int NEAR_SLOTS = 1 << NEAR_BITS, FAR_SLOTS = 1 << FAR_BITS;
+    /* The furthest deadline we can hold, just over 4.4 hours */
+    static constexpr unsigned int MAX_TICKS = (FAR_SLOTS - 1) * NEAR_SLOTS;
+
+private:
+    /* Heads of circular lists */
+    TimingWheelNode nearSlots[NEAR_SLOTS], farSlots[FAR_SLOTS];
+    uint32_t now = 0;
+    size_t armed = 0;
+
+    static void link(TimingWheelNode *head, TimingWheelNode *node) {
+        node->prev = head;
+        node->next = head->next;
+        head->next->prev = node;
+        head->next = node;
+    }
+
+    static void unlink(TimingWheelNode *node) {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = node->next = nullptr;
+    }
+
+    void place(TimingWheelNode *node) {
+        if (node->deadline - now < NEAR_SLOTS) {
+            link(&nearSlots[node->deadline & (NEAR_SLOTS - 1)], node);
+        } else {
+            link(&farSlots[(node->deadline >> NEAR_BITS) & (FAR_SLOTS - 1)], node);
+        }
+    }
+
+    /* Moves a slot over to head, leaving it empty */
+    static void take(TimingWheelNode *slot, TimingWheelNode *head) {
+        if (slot->next == slot) {
+            head->next = head->prev = head;
+            return;
+        }
+        head->next = slot->next;
+        head->prev = slot->prev;
+        head->next->prev = head->prev->next = head;
+        slot->next = slot->prev = slot;
+    }
+
+public:
+    TimingWheel() {
+        for (TimingWheelNode &slot : nearSlots) {
+            slot.next = slot.prev = &slot;
+        }
+        for (TimingWheelNode &slot : farSlots) {
+            slot.next = slot.prev = &slot;
+        }
+    }
+
+    TimingWheel(const TimingWheel &) = delete;
+    TimingWheel &operator=(const TimingWheel &) = delete;
+
+    uint32_t getNow() const {
+        return now;
+    }
+
+    /* Number of armed nodes */
+    size_t size() const {
+        return armed;
+    }
+
+    /* Arms, or re-arms, node to expire at the given tick (clamped to between the next one and MAX_TICKS from now) */
+    void arm(TimingWheelNode *node, uint32_t deadline) {
+        if (deadline - now - 1 >= MAX_TICKS) {
+            deadline = (int32_t) (deadline - now) <= 0 ? now + 1 : now + MAX_TICKS;
+        }
+
+        /* Later than before, we stay in our slot and move on from there when it comes up */
+        if (node->prev && deadline >= node->deadline) {
+            node->deadline = deadline;
+            return;
+        }
+
+        disarm(node);
+        node->deadline = deadline;
+        place(node);
+        armed++;
+    }
+
+    void disarm(TimingWheelNode *node) {
+        if (node->prev) {
+            unlink(node);
+            armed--;
+        }
+    }
+
+    /* One tick later, expiring whatever is due. Expiring nodes may arm and disarm any node */
+    void advance() {
+        now++;
+
+        TimingWheelNode pending;
+        if (!(now & (NEAR_SLOTS - 1))) {
+            /* Spread out the far slot we just reached */
+            take(&farSlots[(now >> NEAR_BITS) & (FAR_SLOTS - 1)], &pending);
+            while (pending.next != &pending) {
+                TimingWheelNode *node = pending.next;
+                unlink(node);
+                place(node);
+            }
+        }
+
+        take(&nearSlots[now & (NEAR_SLOTS - 1)], &pending);
+        while (pending.next != &pending) {
+            TimingWheelNode *node = pending.next;
+            unlink(node);
+            if (node->deadline != now) {
+                /* Moved later since it was placed */
+                place(node);
+            } else {
+                armed--;
+                node->expire(node->owner);
+            }
+        }
+    }
+};
+
+}
+
+#endif // UWS_TIMINGWHEEL_H
@@ -30,18 +30,346 @@
 #include <functional>
 #include <set>
 #include <string>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+#include "SharedBuffer.h"
+#include "SlabPool.h"
+#include "Tracepoints.h"
 
 namespace uWS {
 
 struct Subscriber;
 
-struct Topic : std::unordered_set<Subscriber *> {
+/* Counters of a topic, only ever added to while publishing and draining. Rates are for the reader
+ * to take from the difference between two reads */
+struct TopicStats {
+    unsigned long long publishes = 0;
+    /* Messages handed to subscribers (the sender excluded), and their bytes */
+    unsigned long long messagesOut = 0, bytesOut = 0;
+    /* Batched messages a subscriber could not take, such as over its maxBackpressure */
+    unsigned long long drops = 0;
+    /* Batched messages a conflating subscriber skipped for a newer one */
+    unsigned long long conflated = 0;
+};
+
+/* How a subscriber takes its batched messages when drained, as flags */
+enum DrainPolicy : uint8_t {
+    /* Everything in the order published */
+    DRAIN_ALL = 0,
+    /* While TopicTree::isBehind, only the newest message of every topic (last value conflation) */
+    DRAIN_CONFLATE = 1,
+    /* Messages to Topic::priority topics first, then the rest */
+    DRAIN_PRIORITY = 2
+};
+
+/* What Subscriber::user points to */
+enum SubscriberKind : uint8_t {
+    SUBSCRIBER_WEBSOCKET = 0,
+    /* An HttpResponse streaming Server-Sent Events, see EventStream.h */
+    SUBSCRIBER_EVENT_STREAM = 1,
+    /* A WebSocket taking the messages on one of its channels, see WebSocket::subscribeOnChannel */
+    SUBSCRIBER_WEBSOCKET_CHANNEL = 2
+};
+
+/* The last messages published to a topic, as complete server frames shared with whoever sent them.
+ * Every message is numbered, starting at 1, so that a socket coming back knows where it left off */
+struct TopicHistory {
+    struct Entry {
+        uint64_t sequence = 0;
+        SharedBuffer frame;
+    };
+
+private:
+    std::vector<Entry> entries;
+    uint64_t sequence = 0;
+
+public:
+    TopicHistory(size_t capacity) : entries(capacity) {
+
+    }
+
+    size_t capacity() const {
+        return entries.size();
+    }
+
+    /* Number of the last message kept, 0 if none yet */
+    uint64_t lastSequence() const {
+        return sequence;
+    }
+
+    /* Number of the oldest message still kept */
+    uint64_t firstSequence() const {
+        return sequence >= entries.size() ? sequence - entries.size() + 1 : 1;
+    }
+
+    /* Keeps frame as the next message, dropping the oldest if full */
+    uint64_t push(SharedBuffer frame) {
+        sequence++;
+        entries[(sequence - 1) % entries.size()] = {sequence, std::move(frame)};
+        return sequence;
+    }
+
+    /* Keeps the newest capacity messages, numbered as before */
+    void resize(size_t capacity) {
+        std::vector<Entry> resized(capacity);
+        uint64_t first = std::max<uint64_t>(firstSequence(), sequence >= capacity ? sequence - capacity + 1 : 1);
+        for (uint64_t s = first; s <= sequence; s++) {
+            resized[(s - 1) % capacity] = std::move(entries[(s - 1) % entries.size()]);
+        }
+        entries.swap(resized);
+    }
+
+    /* Calls cb with the frame of every message after afterSequence, oldest first. Returns false if some
+     * of them are gone already (or afterSequence is from before a restart), so the reader has a gap */
+    template <typename F>
+    bool since(uint64_t afterSequence, F cb) const {
+        if (afterSequence > sequence) {
+            return false;
+        }
+        uint64_t first = firstSequence();
+        for (uint64_t s = std::max(afterSequence + 1, first); s <= sequence; s++) {
+            cb(entries[(s - 1) % entries.size()].frame);
+        }
+        return afterSequence + 1 >= first;
+    }
+};
+
+struct Topic {
+    template <typename, typename> friend struct TopicTree;
+
+private:
+    /* Kept dense so that publishing is a linear scan. Removing swaps the last one in, whose
+     * index (kept in the subscriber) is updated, so subscribe and unsubscribe stay O(1) */
+    std::vector<Subscriber *> subscribers;
+
+public:
+    Topic(std::string_view topic) : name(topic), isWildcard(isWildcardPattern(topic)) {
+
+    }
+
+    /* Held by the TopicTree, in its arena */
+    std::string_view name;
+    /* Holds + or # segments, matched by the topics published to rather than equal to them */
+    bool isWildcard;
+    /* Publishes reaching subscribers through more than one topic count on the first */
+    TopicStats stats;
+    /* Kept if asked for by TopicTree::setHistory, holding the topic even without subscribers */
+    std::unique_ptr<TopicHistory> history;
+    /* Drained ahead of other topics by DRAIN_PRIORITY subscribers */
+    bool priority = false;
+
+    /* MQTT rules: + is a whole segment, # is the whole last segment. Anything else is literal */
+    static bool isWildcardPattern(std::string_view topic) {
+        if (topic == "#" || (topic.length() >= 2 && topic.substr(topic.length() - 2) == "/#")) {
+            return true;
+        }
+        for (size_t start = 0; start <= topic.length(); ) {
+            size_t end = std::min(topic.find('/', start), topic.length());
+            if (topic.substr(start, end - start) == "+") {
+                return true;
+            }
+            start = end + 1;
+        }
+        return false;
+    }
+
+    size_t size() const {
+        return subscribers.size();
+    }
 
-    Topic(std::string_view topic) : name(topic) {
+    std::vector<Subscriber *>::const_iterator begin() const {
+        return subscribers.begin();
+    }
 
+    std::vector<Subscriber *>::const_iterator end() const {
+        return subscribers.end();
     }
+};
 
-    std::string name;
+/* A topic we subscribe to, and our index among its subscribers */
+struct Subscription {
+    Topic *topic;
+    unsigned int index;
+};
+
+/* Sorted by topic for finding by binary search, held inline up to INLINE_CAPACITY (most sockets hold a few topics)
+ * and on the heap past that */
+struct SubscriptionList {
+    static constexpr unsigned int INLINE_CAPACITY = 4;
+
+private:
+    union {
+        Subscription inlineSubscriptions[INLINE_CAPACITY];
+        Subscription *heapSubscriptions;
+    };
+    unsigned int length = 0, capacity = INLINE_CAPACITY;
+
+    Subscription *data() {
+        return capacity == INLINE_CAPACITY ? inlineSubscriptions : heapSubscriptions;
+    }
+
+    const Subscription *data() const {
+        return capacity == INLINE_CAPACITY ? inlineSubscriptions : heapSubscriptions;
+    }
+
+public:
+    SubscriptionList() {}
+    SubscriptionList(const SubscriptionList &) = delete;
+    SubscriptionList &operator=(const SubscriptionList &) = delete;
+
+    ~SubscriptionList() {
+        if (capacity != INLINE_CAPACITY) {
+            delete [] heapSubscriptions;
+        }
+    }
+
+    Subscription *begin() {
+        return data();
+    }
+
+    Subscription *end() {
+        return data() + length;
+    }
+
+    const Subscription *begin() const {
+        return data();
+    }
+
+    const Subscription *end() const {
+        return data() + length;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    /* Where topic is, or would go */
+    Subscription *lowerBound(const Topic *topic) {
+        return std::lower_bound(begin(), end(), topic, [](const Subscription &subscription, const Topic *topic) {
+            return std::less<const Topic *>()(subscription.topic, topic);
+        });
+    }
+
+    /* Returns nullptr if not found */
+    Subscription *find(const Topic *topic) {
+        Subscription *subscription = lowerBound(topic);
+        return subscription != end() && subscription->topic == topic ? subscription : nullptr;
+    }
+
+    size_t count(const Topic *topic) const {
+        return const_cast<SubscriptionList *>(this)->find(topic) != nullptr;
+    }
+
+    /* Fails if already held */
+    bool insert(Subscription subscription) {
+        size_t position = (size_t) (lowerBound(subscription.topic) - begin());
+        if (position < length && data()[position].topic == subscription.topic) {
+            return false;
+        }
+        if (length == capacity) {
+            Subscription *grown = new Subscription[capacity * 2];
+            memcpy((void *) grown, data(), length * sizeof(Subscription));
+            if (capacity != INLINE_CAPACITY) {
+                delete [] heapSubscriptions;
+            }
+            heapSubscriptions = grown;
+            capacity *= 2;
+        }
+        memmove((void *) (data() + position + 1), data() + position, (length - position) * sizeof(Subscription));
+        data()[position] = subscription;
+        length++;
+        return true;
+    }
+
+    /* Moves the ones after it down, invalidating subscription pointers into us */
+    void erase(Subscription *subscription) {
+        memmove((void *) subscription, subscription + 1, (size_t) (end() - subscription - 1) * sizeof(Subscription));
+        length--;
+    }
+};
+
+/* Messages a subscriber is due, as runs of consecutive indices into outgoingMessages. Subscribers
+ * of the same topics are due the same messages, one run for as long as they publish. Holds 2 runs
+ * inline, growing on the heap */
+struct MessageRun {
+    uint32_t first, count;
+};
+
+struct MessageRunList {
+    static constexpr unsigned int INLINE_CAPACITY = 2;
+
+private:
+    union {
+        MessageRun inlineRuns[INLINE_CAPACITY] = {};
+        MessageRun *heapRuns;
+    };
+    unsigned int length = 0, capacity = INLINE_CAPACITY;
+
+    MessageRun *data() {
+        return capacity == INLINE_CAPACITY ? inlineRuns : heapRuns;
+    }
+
+public:
+    MessageRunList() {}
+    MessageRunList(const MessageRunList &) = delete;
+    MessageRunList &operator=(const MessageRunList &) = delete;
+
+    ~MessageRunList() {
+        if (capacity != INLINE_CAPACITY) {
+            delete [] heapRuns;
+        }
+    }
+
+    MessageRun *begin() {
+        return data();
+    }
+
+    MessageRun *end() {
+        return data() + length;
+    }
+
+    bool empty() const {
+        return !length;
+    }
+
+    /* Number of runs, not messages */
+    size_t size() const {
+        return length;
+    }
+
+    /* Indices only grow, so the message either continues the last run or starts one */
+    void push(uint32_t index) {
+        if (length) {
+            MessageRun &last = data()[length - 1];
+            if (last.first + last.count == index) {
+                last.count++;
+                return;
+            }
+        }
+        if (length == capacity) {
+            MessageRun *grown = new MessageRun[capacity * 2];
+            memcpy((void *) grown, data(), length * sizeof(MessageRun));
+            if (capacity != INLINE_CAPACITY) {
+                delete [] heapRuns;
+            }
+            heapRuns = grown;
+            capacity *= 2;
+        }
+        data()[length++] = {index, 1};
+    }
+
+    /* Keeps the capacity */
+    void clear() {
+        length = 0;
+    }
+
+    void swap(MessageRunList &other) {
+        std::swap(inlineRuns, other.inlineRuns);
+        std::swap(length, other.length);
+        std::swap(capacity, other.capacity);
+    }
 };
 
 struct Subscriber {
@@ -55,23 +383,32 @@ private:
     /* State of prev, next does not matter unless we are needsDrainage() since we are not in the list */
     Subscriber *prev, *next;
 
-    /* Any one subscriber can be part of at most 32 publishes before it needs a drain,
-     * or whatever encoding of runs or whatever we might do in the future */
-    uint16_t messageIndices[32];
+    /* This one matters the most, if empty we are not in the list of drainableSubscribers.
+     * Any number of publishes are held until the next drain */
+    MessageRunList messageRuns;
 
-    /* This one matters the most, if it is 0 we are not in the list of drainableSubscribers */
-    unsigned char numMessageIndices = 0;
+    /* The last publish that reached us, so that overlapping wildcards deliver once */
+    uint32_t lastPublish = 0;
 
 public:
 
-    /* We have a list of topics we subscribe to (read by WebSocket::iterateTopics) */
-    std::set<Topic *> topics;
+    /* We have a list of topics we subscribe to (read by WebSocket::iterateTopics), with our index in each */
+    SubscriptionList topics;
 
     /* User data */
     void *user;
 
+    /* DrainPolicy flags */
+    uint8_t drainPolicy = DRAIN_ALL;
+
+    /* SubscriberKind of user */
+    uint8_t kind = SUBSCRIBER_WEBSOCKET;
+
+    /* Of SUBSCRIBER_WEBSOCKET_CHANNEL */
+    uint16_t channel = 0;
+
     bool needsDrainage() {
-        return numMessageIndices;
+        return !messageRuns.empty();
     }
 };
 
@@ -86,14 +423,54 @@ struct TopicTree {
     /* Whomever is iterating this topic is locked to not modify its own list */
     Subscriber *iteratingSubscriber = nullptr;
 
+    /* Called when a topic gets its first subscriber (added) and loses its last one.
+     * Must not modify this tree */
+    std::function<void(std::string_view topic, bool added)> topicObserver;
+
+    /* Asked when draining a DRAIN_CONFLATE subscriber, which conflates only if behind (such as on backpressure) */
+    std::function<bool(Subscriber *)> isBehind;
+
 private:
 
     /* The drain callback must not publish, unsubscribe or subscribe.
      * It must only cork, uncork, send, write */
     std::function<bool(Subscriber *, T &, IteratorFlags)> cb;
 
-    /* The topics */
-    std::unordered_map<std::string_view, std::unique_ptr<Topic>> topics;
+    /* Subscribers, topics and topic names are packed in slabs of their own, so that churn stays off the heap */
+    SlabPool subscriberPool{sizeof(Subscriber)}, topicPool{sizeof(Topic)};
+    StringArena names;
+    size_t numSubscribers = 0;
+
+    /* The topics, wildcards included (by their pattern) */
+    std::unordered_map<std::string_view, Topic *> topics;
+
+    /* Wildcard topics also sit in a trie of their segments, walked once per publish */
+    struct WildcardNode {
+        std::unordered_map<std::string, std::unique_ptr<WildcardNode>> children;
+        std::unique_ptr<WildcardNode> plus;
+        /* The pattern ending here, and the one ending in # here */
+        Topic *topic = nullptr, *hash = nullptr;
+
+        bool empty() const {
+            return children.empty() && !plus && !topic && !hash;
+        }
+    } wildcards;
+    size_t numWildcards = 0;
+    /* Topics keeping a history, so that publishing to none need not look */
+    size_t numHistories = 0;
+
+    /* The topic each of outgoingMessages counts its drops on, kept alive until drained */
+    std::vector<Topic *> outgoingTopics;
+    std::vector<Topic *> retiredTopics;
+    /* And the name it was published to, which conflation keys on. That of its topic, unless it only matched
+     * patterns, then a copy of our own */
+    std::vector<std::string_view> outgoingNames;
+    /* The newest message of every name a conflating subscriber is draining */
+    std::unordered_map<std::string_view, uint32_t> newestByName;
+
+    /* Topics matched by the current publish, and its number for Subscriber::lastPublish */
+    std::vector<Topic *> matchedTopics;
+    uint32_t publishCount = 0;
 
     /* List of subscribers that needs drainage */
     Subscriber *drainableSubscribers = nullptr;
@@ -113,22 +490,323 @@ private:
     void drainImpl(Subscriber *s) {
         /* Before we call cb we need to make sure this subscriber will not report needsDrainage()
          * since WebSocket::send will call drain from within the cb in that case.*/
-        int numMessageIndices = s->numMessageIndices;
-        s->numMessageIndices = 0; 
-        // 在发送消息前，将 numMessageIndices 的值保存，然后将其重置为 0。
-        // 这是为了确保当在回调函数中调用 WebSocket::send 时，不会递归调用 drainImpl，从而避免发送消息的重复处理。
+        MessageRunList messageRuns;
+        messageRuns.swap(s->messageRuns);
+
+        bool conflate = (s->drainPolicy & DRAIN_CONFLATE) && isBehind && isBehind(s);
+        bool lanes = s->drainPolicy & DRAIN_PRIORITY;
+        if (conflate || lanes) {
+            drainByPolicy(s, messageRuns, conflate, lanes);
+        } else {
+            size_t remaining = 0;
+            for (MessageRun &run : messageRuns) {
+                remaining += run.count;
+            }
 
-        /* Then we emit cb */
-        for (int i = 0; i < numMessageIndices; i++) {
-            T &outgoingMessage = outgoingMessages[s->messageIndices[i]];
+            /* Then we emit cb, for every message of every run */
+            int first = FIRST;
+            for (MessageRun &run : messageRuns) {
+                for (uint32_t index = run.first; index != run.first + run.count; index++) {
+                    int flags = (--remaining == 0) ? LAST : 0;
+
+                    /* Returning true will stop drainage short (such as when backpressure is too high) */
+                    if (cb(s, outgoingMessages[index], (IteratorFlags)(flags | first))) {
+                        countDrops(messageRuns, index);
+                        remaining = 0;
+                        break;
+                    }
+                    first = 0;
+                }
+                if (!remaining) {
+                    break;
+                }
+            }
+        }
 
-            int flags = (i == numMessageIndices - 1) ? LAST : 0; // 设置标志位（如第一条和最后一条消息的标志）
+        /* Keep any capacity we grew to, unless cb queued something new */
+        if (s->messageRuns.empty()) {
+            messageRuns.clear();
+            s->messageRuns.swap(messageRuns);
+        }
+    }
 
-            /* Returning true will stop drainage short (such as when backpressure is too high) */
-            if (cb(s, outgoingMessage, (IteratorFlags)(flags | (i == 0 ? FIRST : 0)))) {
+    /* Calls f with the index of every message of messageRuns a subscriber takes, in the order it takes them.
+     * With lanes priority topics go first, conflating skips all but the newest of every name */
+    template <typename F>
+    void forEachTaken(MessageRunList &messageRuns, bool conflate, bool lanes, F f) {
+        for (int lane = lanes; lane >= 0; lane--) {
+            for (MessageRun &run : messageRuns) {
+                for (uint32_t index = run.first; index != run.first + run.count; index++) {
+                    Topic *topicPtr = outgoingTopics[index];
+                    if ((lanes && topicPtr->priority != (bool) lane) || (conflate && newestByName[outgoingNames[index]] != index)) {
+                        continue;
+                    }
+                    f(index);
+                }
+            }
+        }
+    }
+
+    /* As drainImpl, reordered and conflated in place. The topics keep what we need in between */
+    void drainByPolicy(Subscriber *s, MessageRunList &messageRuns, bool conflate, bool lanes) {
+        if (conflate) {
+            newestByName.clear();
+            for (MessageRun &run : messageRuns) {
+                for (uint32_t index = run.first; index != run.first + run.count; index++) {
+                    newestByName[outgoingNames[index]] = index;
+                }
+            }
+            for (MessageRun &run : messageRuns) {
+                for (uint32_t index = run.first; index != run.first + run.count; index++) {
+                    if (newestByName[outgoingNames[index]] != index) {
+                        outgoingTopics[index]->stats.conflated++;
+                    }
+                }
+            }
+        }
+
+        size_t remaining = 0;
+        forEachTaken(messageRuns, conflate, lanes, [&remaining](uint32_t) {
+            remaining++;
+        });
+
+        /* The message cb stops us short on is dropped, as is whatever is left */
+        int first = FIRST;
+        bool stopped = false;
+        forEachTaken(messageRuns, conflate, lanes, [&](uint32_t index) {
+            if (!stopped) {
+                int flags = (--remaining == 0) ? LAST : 0;
+                stopped = cb(s, outgoingMessages[index], (IteratorFlags)(flags | first));
+                first = 0;
+            }
+            if (stopped) {
+                outgoingTopics[index]->stats.drops++;
+            }
+        });
+    }
+
+    /* The message at index and everything after it in runs were dropped */
+    void countDrops(MessageRunList &messageRuns, uint32_t index) {
+        for (MessageRun &run : messageRuns) {
+            for (uint32_t i = std::max(index, run.first); i < run.first + run.count; i++) {
+                outgoingTopics[i]->stats.drops++;
+            }
+        }
+    }
+
+    void clearOutgoing() {
+        for (size_t i = 0; i < outgoingNames.size(); i++) {
+            if (outgoingNames[i].data() != outgoingTopics[i]->name.data()) {
+                names.free((char *) outgoingNames[i].data(), outgoingNames[i].length());
+            }
+        }
+        outgoingNames.clear();
+        outgoingMessages.clear();
+        outgoingTopics.clear();
+        for (Topic *topicPtr : retiredTopics) {
+            destroyTopic(topicPtr);
+        }
+        retiredTopics.clear();
+    }
+
+    Topic *createTopic(std::string_view topic) {
+        char *name = names.copy(topic.data(), topic.length());
+        return new (topicPool.allocate()) Topic(std::string_view(name, topic.length()));
+    }
+
+    void destroyTopic(Topic *topicPtr) {
+        std::string_view name = topicPtr->name;
+        topicPtr->~Topic();
+        topicPool.deallocate(topicPtr);
+        names.free((char *) name.data(), name.length());
+    }
+
+    /* Swaps the last subscriber of topic into index */
+    static void removeSubscriber(Topic *topic, unsigned int index) {
+        Subscriber *last = topic->subscribers.back();
+        topic->subscribers[index] = last;
+        topic->subscribers.pop_back();
+        if (index < topic->subscribers.size()) {
+            last->topics.find(topic)->index = index;
+        }
+    }
+
+    static std::string_view firstSegment(std::string_view topic) {
+        return topic.substr(0, topic.find('/'));
+    }
+
+    void insertWildcard(Topic *topicPtr) {
+        WildcardNode *node = &wildcards;
+        std::string_view rest = topicPtr->name;
+        while (true) {
+            std::string_view segment = firstSegment(rest);
+            bool last = segment.length() == rest.length();
+            if (last && segment == "#") {
+                node->hash = topicPtr;
+                break;
+            }
+
+            std::unique_ptr<WildcardNode> &child = segment == "+" ? node->plus : node->children[std::string(segment)];
+            if (!child) {
+                child = std::make_unique<WildcardNode>();
+            }
+            node = child.get();
+
+            if (last) {
+                node->topic = topicPtr;
                 break;
             }
+            rest.remove_prefix(segment.length() + 1);
+        }
+        numWildcards++;
+    }
+
+    /* Unlinks a pattern, pruning the nodes it leaves empty */
+    static void eraseWildcard(WildcardNode *node, std::string_view rest, Topic *topicPtr) {
+        std::string_view segment = firstSegment(rest);
+        bool last = segment.length() == rest.length();
+        if (last && segment == "#") {
+            if (node->hash == topicPtr) {
+                node->hash = nullptr;
+            }
+            return;
+        }
+
+        std::unique_ptr<WildcardNode> *child = &node->plus;
+        if (segment != "+") {
+            auto it = node->children.find(std::string(segment));
+            if (it == node->children.end()) {
+                return;
+            }
+            child = &it->second;
+        }
+        if (!*child) {
+            return;
+        }
+
+        if (last) {
+            if ((*child)->topic == topicPtr) {
+                (*child)->topic = nullptr;
+            }
+        } else {
+            eraseWildcard(child->get(), rest.substr(segment.length() + 1), topicPtr);
+        }
+
+        if ((*child)->empty()) {
+            if (segment == "+") {
+                node->plus.reset();
+            } else {
+                node->children.erase(std::string(segment));
+            }
+        }
+    }
+
+    /* Wildcards at the root do not match topics starting with $ (MQTT rule) */
+    void matchWildcards(WildcardNode *node, std::string_view rest, bool hasRest, bool root, bool dollar) {
+        bool wildcardsMatch = !(root && dollar);
+        if (node->hash && wildcardsMatch) {
+            matchedTopics.push_back(node->hash);
+        }
+        if (!hasRest) {
+            if (node->topic) {
+                matchedTopics.push_back(node->topic);
+            }
+            return;
+        }
+
+        std::string_view segment = firstSegment(rest);
+        bool hasNext = segment.length() < rest.length();
+        std::string_view next = hasNext ? rest.substr(segment.length() + 1) : std::string_view();
+
+        if (!node->children.empty()) {
+            auto it = node->children.find(std::string(segment));
+            if (it != node->children.end()) {
+                matchWildcards(it->second.get(), next, hasNext, false, dollar);
+            }
+        }
+        if (node->plus && wildcardsMatch) {
+            matchWildcards(node->plus.get(), next, hasNext, false, dollar);
+        }
+    }
+
+    /* Fills matchedTopics with the exact topic and every wildcard matching it */
+    void matchTopics(std::string_view topic) {
+        matchedTopics.clear();
+        auto it = topics.find(topic);
+        if (it != topics.end() && !it->second->isWildcard) {
+            matchedTopics.push_back(it->second);
+        }
+        if (numWildcards) {
+            matchWildcards(&wildcards, topic, true, true, topic.length() && topic[0] == '$');
+        }
+    }
+
+    /* Calls f(s, topic) once for every subscriber of matchedTopics, with the topic it was reached through. f returns
+     * whether it took the message */
+    template <typename F>
+    void forEachMatchedSubscriber(size_t length, F &&f) {
+        if (matchedTopics.size() == 1) {
+            unsigned long long messagesOut = 0;
+            for (Subscriber *s : *matchedTopics[0]) {
+                messagesOut += f(s, matchedTopics[0]);
+            }
+            countPublish(matchedTopics[0], messagesOut, length);
+            return;
+        }
+
+        /* Overlapping topics share subscribers */
+        if (++publishCount == 0) {
+            publishCount = 1;
+        }
+        for (Topic *topicPtr : matchedTopics) {
+            unsigned long long messagesOut = 0;
+            for (Subscriber *s : *topicPtr) {
+                if (s->lastPublish != publishCount) {
+                    s->lastPublish = publishCount;
+                    messagesOut += f(s, topicPtr);
+                }
+            }
+            countPublish(topicPtr, messagesOut, length);
+        }
+    }
+
+    static void countPublish(Topic *topicPtr, unsigned long long messagesOut, size_t length) {
+        topicPtr->stats.publishes++;
+        topicPtr->stats.messagesOut += messagesOut;
+        topicPtr->stats.bytesOut += messagesOut * length;
+    }
+
+    /* Deletes a topic nobody subscribes to anymore */
+    void eraseTopic(Topic *topicPtr) {
+        if (topicObserver) {
+            topicObserver(topicPtr->name, false);
+        }
+        if (topicPtr->isWildcard) {
+            eraseWildcard(&wildcards, topicPtr->name, topicPtr);
+            numWildcards--;
+        }
+        /* Unless messages still count their drops on it */
+        topics.erase(topicPtr->name);
+        if (outgoingMessages.size()) {
+            retiredTopics.push_back(topicPtr);
+        } else {
+            destroyTopic(topicPtr);
+        }
+    }
+
+    Topic *lookupOrInsertTopic(std::string_view topic) {
+        Topic *topicPtr = lookupTopic(topic);
+        if (!topicPtr) {
+            topicPtr = createTopic(topic);
+            topics.insert({topicPtr->name, topicPtr});
+            if (topicPtr->isWildcard) {
+                insertWildcard(topicPtr);
+            }
+            if (topicObserver) {
+                topicObserver(topicPtr->name, true);
+            }
         }
+        return topicPtr;
     }
 
     void unlinkDrainableSubscriber(Subscriber *s) {
@@ -150,13 +828,68 @@ public:
 
     }
 
+    TopicTree(const TopicTree &) = delete;
+    TopicTree &operator=(const TopicTree &) = delete;
+
+    /* Subscribers not freed by now are destroyed with us, unsubscribed from nothing */
+    ~TopicTree() {
+        subscriberPool.forEachUsed([](void *cell) {
+            ((Subscriber *) cell)->~Subscriber();
+        });
+        clearOutgoing();
+        for (auto &p : topics) {
+            destroyTopic(p.second);
+        }
+    }
+
     /* Returns nullptr if not found */
     Topic *lookupTopic(std::string_view topic) {
         auto it = topics.find(topic);
         if (it == topics.end()) {
             return nullptr;
         }
-        return it->second.get();
+        return it->second;
+    }
+
+    /* Keeps the last capacity messages recorded to topic, or stops doing so with 0. The topic stays
+     * while it keeps a history, subscribed to or not. Wildcard patterns are never published to */
+    void setHistory(std::string_view topic, size_t capacity) {
+        if (capacity) {
+            Topic *topicPtr = lookupOrInsertTopic(topic);
+            if (topicPtr->history) {
+                topicPtr->history->resize(capacity);
+            } else {
+                topicPtr->history = std::make_unique<TopicHistory>(capacity);
+                numHistories++;
+            }
+            return;
+        }
+
+        Topic *topicPtr = lookupTopic(topic);
+        if (topicPtr && topicPtr->history) {
+            topicPtr->history.reset();
+            numHistories--;
+            if (!topicPtr->size()) {
+                eraseTopic(topicPtr);
+            }
+        }
+    }
+
+    /* Returns nullptr if topic keeps no history */
+    TopicHistory *lookupHistory(std::string_view topic) {
+        if (!numHistories) {
+            return nullptr;
+        }
+        Topic *topicPtr = lookupTopic(topic);
+        return topicPtr ? topicPtr->history.get() : nullptr;
+    }
+
+    /* Calls cb with every topic (name, size and stats), in no particular order */
+    template <typename F>
+    void iterateTopics(F cb) {
+        for (auto &p : topics) {
+            cb(p.second);
+        }
     }
 
     /* Subscribe fails if we already are subscribed */
@@ -164,20 +897,13 @@ public:
         /* Notify user that they are doing something wrong here */
         checkIteratingSubscriber(s);
 
-        /* Lookup or create new topic */
-        Topic *topicPtr = lookupTopic(topic);
-        if (!topicPtr) {
-            Topic *newTopic = new Topic(topic);
-            topics.insert({std::string_view(newTopic->name.data(), newTopic->name.length()), std::unique_ptr<Topic>(newTopic)});
-            topicPtr = newTopic;
-        }
+        Topic *topicPtr = lookupOrInsertTopic(topic);
 
         /* Insert us in topic, insert topic in us */
-        auto [it, inserted] = s->topics.insert(topicPtr);
-        if (!inserted) {
+        if (!s->topics.insert({topicPtr, (unsigned int) topicPtr->subscribers.size()})) {
             return nullptr;
         }
-        topicPtr->insert(s);
+        topicPtr->subscribers.push_back(s);
 
         /* Success */
         return topicPtr;
@@ -196,19 +922,21 @@ public:
         }
 
         /* Erase from our list first */
-        if (s->topics.erase(topicPtr) == 0) {
+        Subscription *subscription = s->topics.find(topicPtr);
+        if (!subscription) {
             return {false, false, -1};
         }
+        unsigned int index = subscription->index;
+        s->topics.erase(subscription);
 
         /* Remove us from topic */
-        topicPtr->erase(s);
+        removeSubscriber(topicPtr, index);
 
-        int newCount = topicPtr->size();
+        int newCount = (int) topicPtr->size();
 
-        /* If there is no subscriber to this topic, remove it */
-        if (!topicPtr->size()) {
-            /* Unique_ptr deletes the topic */
-            topics.erase(topic);
+        /* If there is no subscriber to this topic (nor history to keep), remove it */
+        if (!topicPtr->size() && !topicPtr->history) {
+            eraseTopic(topicPtr);
         }
 
         /* If we don't hold any topics we are to be freed altogether */
@@ -217,7 +945,8 @@ public:
 
     /* Factory function for creating a Subscriber */
     Subscriber *createSubscriber() {
-        return new Subscriber();
+        numSubscribers++;
+        return new (subscriberPool.allocate()) Subscriber();
     }
 
     /* This is used to end a Subscriber, before freeing it */
@@ -229,13 +958,13 @@ public:
         }
 
         /* For all topics, unsubscribe */
-        for (Topic *topicPtr : s->topics) {
-            /* If we are the last subscriber, simply remove the whole topic */
-            if (topicPtr->size() == 1) {
-                topics.erase(topicPtr->name);
+        for (auto [topicPtr, index] : s->topics) {
+            /* If we are the last subscriber, simply remove the whole topic (unless it keeps a history) */
+            if (topicPtr->size() == 1 && !topicPtr->history) {
+                eraseTopic(topicPtr);
             } else {
                 /* Otherwise just remove us */
-                topicPtr->erase(s);
+                removeSubscriber(topicPtr, index);
             }
         }
 
@@ -244,7 +973,23 @@ public:
             unlinkDrainableSubscriber(s);
         }
 
-        delete s;
+        s->~Subscriber();
+        subscriberPool.deallocate(s);
+        numSubscribers--;
+    }
+
+    /* Kept as they change, see App::getMemoryStats */
+    size_t getNumTopics() {
+        return topics.size();
+    }
+
+    size_t getNumSubscribers() {
+        return numSubscribers;
+    }
+
+    /* Messages published and not yet drained */
+    size_t getNumOutgoingMessages() {
+        return outgoingMessages.size();
     }
 
     /* Mainly used by WebSocket::send to drain one socket before sending */
@@ -261,7 +1006,7 @@ public:
             
             /* If we drained last subscriber, also clear outgoingMessages */
             if (!drainableSubscribers) {
-                outgoingMessages.clear();
+                clearOutgoing();
             }
         }
     }
@@ -269,6 +1014,7 @@ public:
     /* Called everytime we call send, to drain published messages so to sync outgoing messages */
     void drain() {
         if (drainableSubscribers) {
+            UWS_TRACE(pubsub__drain__start, this, outgoingMessages.size());
             /* Drain one socket a time */
             for (Subscriber *s = drainableSubscribers; s; s = s->next) {
                 /* Instead of unlinking every single subscriber, we just leave the list undefined
@@ -277,86 +1023,91 @@ public:
             }
             /* Drain always clears drainableSubscribers and outgoingMessages */
             drainableSubscribers = nullptr;
-            outgoingMessages.clear();
+            clearOutgoing();
+            UWS_TRACE(pubsub__drain__end, this);
         }
     }
 
     // publishBig 用于处理较大的消息，它会跳过缓冲，直接将消息发送到每个订阅者的回压队列（backpressure）
     // publishBig 函数不使用缓冲区，而是直接将消息推送给订阅者，这对于处理大消息时能够提高效率。
     // 通过回调函数 cb 实现消息发送的具体逻辑，函数本身不会对消息进行任何缓冲或复制。
-    /* Big messages bypass all buffering and land directly in backpressure */
+    /* Big messages bypass all buffering and land directly in backpressure. Length is what
+     * TopicStats counts as bytes, cb may return true for dropped */
     template <typename F>
-    bool publishBig(Subscriber *sender, std::string_view topic, B &&bigMessage, F cb) {
-        /* Do we even have this topic? */
-        auto it = topics.find(topic);
-        if (it == topics.end()) {
+    bool publishBig(Subscriber *sender, std::string_view topic, B &&bigMessage, F cb, size_t length = 0) {
+        /* Do we even have this topic, or a pattern matching it? */
+        matchTopics(topic);
+        if (matchedTopics.empty()) {
             return false;
         }
+        UWS_TRACE(pubsub__publish, topic.data(), topic.length(), length);
 
-        /* For all subscribers in topic */
-        for (Subscriber *s : *it->second) {
+        /* For all subscribers in matching topics */
+        forEachMatchedSubscriber(length, [&](Subscriber *s, Topic *topicPtr) {
 
             /* If we are sender then ignore us */
-            if (sender != s) {
+            if (sender == s) {
+                return false;
+            }
+            if constexpr (std::is_same_v<decltype(cb(s, bigMessage)), bool>) {
+                /* On the topic we reached s through, like its messagesOut */
+                if (cb(s, bigMessage)) {
+                    topicPtr->stats.drops++;
+                    return false;
+                }
+            } else {
                 cb(s, bigMessage);
             }
-        }
+            return true;
+        });
 
         return true;
     }
 
-    /* Linear in number of affected subscribers */
-    bool publish(Subscriber *sender, std::string_view topic, T &&message) {
-        /* Do we even have this topic? */
-        auto it = topics.find(topic);
-        if (it == topics.end()) {
+    /* Linear in number of affected subscribers. Length is what TopicStats counts as bytes */
+    bool publish(Subscriber *sender, std::string_view topic, T &&message, size_t length = 0) {
+        /* Do we even have this topic, or a pattern matching it? */
+        matchTopics(topic);
+        if (matchedTopics.empty()) {
             return false;
         }
-
-        /* If we have more than 65k messages we need to drain every socket. */
-        if (outgoingMessages.size() == UINT16_MAX) {
-            /* If there is a socket that is currently corked, this will be ugly as all sockets will drain
-             * to their own backpressure */
-            drain(); // 如果消息队列达到上限，则需要对所有订阅者进行排空处理
-        }
+        UWS_TRACE(pubsub__publish, topic.data(), topic.length(), length);
 
         /* If nobody references this message, don't buffer it */
         bool referencedMessage = false;
 
-        /* For all subscribers in topic */
-        for (Subscriber *s : *it->second) {
+        /* For all subscribers in matching topics, once each */
+        forEachMatchedSubscriber(length, [&](Subscriber *s, Topic *) {
 
             /* If we are sender then ignore us */
-            if (sender != s) {
-
-                /* At least one subscriber wants this message */
-                referencedMessage = true;
-
-                /* If we already have too many outgoing messages on this subscriber, drain it now */
-                if (s->numMessageIndices == 32) {
-                    /* This one does not need to check needsDrainage here but still does. */
-                    drain(s); // 如果订阅者已经有 32 条待处理消息，则立即对其进行排空
-                }
+            if (sender == s) {
+                return false;
+            }
 
-                /* Finally we can continue */
-                s->messageIndices[s->numMessageIndices++] = (uint16_t)outgoingMessages.size();
-                /* First message adds subscriber to list of drainable subscribers */
-                if (s->numMessageIndices == 1) {
-                    /* Insert us in the head of drainable subscribers */
-                    // 插入到链表的头部。这样做的目的是确保新有待处理消息的订阅者能够尽快被处理
-                    s->next = drainableSubscribers;
-                    s->prev = nullptr;
-                    if (s->next) {
-                        s->next->prev = s;
-                    }
-                    drainableSubscribers = s;
+            /* At least one subscriber wants this message */
+            referencedMessage = true;
+
+            /* First message adds subscriber to list of drainable subscribers */
+            bool firstMessage = s->messageRuns.empty();
+            s->messageRuns.push((uint32_t) outgoingMessages.size());
+            if (firstMessage) {
+                /* Insert us in the head of drainable subscribers */
+                // 插入到链表的头部。这样做的目的是确保新有待处理消息的订阅者能够尽快被处理
+                s->next = drainableSubscribers;
+                s->prev = nullptr;
+                if (s->next) {
+                    s->next->prev = s;
                 }
+                drainableSubscribers = s;
             }
-        }
+            return true;
+        });
 
         /* Push this message and return with success */
         if (referencedMessage) {
             outgoingMessages.emplace_back(message);
+            outgoingTopics.push_back(matchedTopics[0]);
+            outgoingNames.push_back(matchedTopics[0]->isWildcard ? std::string_view(names.copy(topic.data(), topic.length()), topic.length()) : matchedTopics[0]->name);
         }
 
         /* Success if someone wants it */
@@ -0,0 +1,45 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_TRACEPOINTS_H
+#define UWS_TRACEPOINTS_H
+
+/* Static tracepoints (USDT) on the hot paths, built in with -DUWS_USDT (which needs sys/sdt.h of systemtap,
+ * such as from systemtap-sdt-dev). A probe nobody attached to is a nop. Without UWS_USDT they are nothing at all,
+ * arguments not evaluated. Probes of provider uws, see misc/READMORE.md:
+ *
+ * http__request (method, methodLength, url, urlLength)      request parsed, before routing
+ * http__route (method, methodLength, url, urlLength)        dispatched to the router
+ * http__end (response, totalSize, closeConnection)          response ended
+ * ws__message__in (webSocket, length, opCode)               complete message received
+ * ws__message__out (webSocket, length, opCode)              message sent
+ * pubsub__publish (topic, topicLength, length)              published to a topic with subscribers
+ * pubsub__drain__start (topicTree, messages)                this many batched messages about to be drained
+ * pubsub__drain__end (topicTree)                            and drained
+ * backpressure__threshold (before, after)                   backpressure of a socket crossed a power of two from 64 KB
+ * socket__cork (socket)
+ * socket__uncork (socket, corkedBytes) */
+
+#ifdef UWS_USDT
+#include <sys/sdt.h>
+#define UWS_TRACE(name, ...) STAP_PROBEV(uws, name, __VA_ARGS__)
+#else
+#define UWS_TRACE(name, ...) ((void) 0)
+#endif
+
+#endif // UWS_TRACEPOINTS_H
@@ -0,0 +1,211 @@
+/*
+ * Authored by Alex Hultman, 2018-2024.
+ * Intellectual property of third-party.
+
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+
+ *     http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef UWS_TRAFFICCAPTURE_H
+#define UWS_TRAFFICCAPTURE_H
+
+/* The raw bytes the connections of a loop receive, and when, to a compact file that libEpollBenchmarker replays
+ * (see Loop::captureTraffic). Following the 8 byte header "uWSCAP1\n" every record is varints: its kind, the
+ * microseconds since the previous record and the connection (numbered from 0 in the order opened), then for data
+ * its length and bytes. Received means after TLS, so captures of SSL apps replay into plain ones */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace uWS {
+
+struct CapturedRecord {
+    int kind;
+    /* Since the capture began */
+    unsigned long long microseconds;
+    unsigned int connection;
+    /* Of DATA, valid as long as the reader */
+    std::string_view data;
+};
+
+struct TrafficCapture {
+    enum {
+        OPEN = 1,
+        DATA = 2,
+        CLOSE = 3
+    };
+
+    static constexpr std::string_view HEADER = {"uWSCAP1\n", 8};
+    static constexpr size_t FLUSH_BYTES = 64 * 1024;
+
+    /* Takes the file, null if none. Stops capturing data (but not closes) past maxBytes of it, if not 0 */
+    TrafficCapture(FILE *file, unsigned long long maxBytes = 0) : file(file), maxBytes(maxBytes) {
+        buffer.append(HEADER);
+        lastAt = now();
+    }
+
+    ~TrafficCapture() {
+        flush();
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    /* Connections are told apart by their native handle, as that is kept across upgrades */
+    void onOpen(uint64_t handle) {
+        unsigned int connection = nextConnection++;
+        connections[handle] = connection;
+        record(OPEN, connection);
+    }
+
+    void onData(uint64_t handle, std::string_view data) {
+        if (maxBytes && capturedBytes + data.length() > maxBytes) {
+            return;
+        }
+        capturedBytes += data.length();
+        record(DATA, getConnection(handle));
+        appendVarint(data.length());
+        buffer.append(data);
+        if (buffer.length() >= FLUSH_BYTES) {
+            flush();
+        }
+    }
+
+    void onClose(uint64_t handle) {
+        auto it = connections.find(handle);
+        if (it != connections.end()) {
+            record(CLOSE, it->second);
+            connections.erase(it);
+        }
+    }
+
+    void flush() {
+        if (file && buffer.length()) {
+            fwrite(buffer.data(), 1, buffer.length(), file);
+            fflush(file);
+        }
+        buffer.clear();
+    }
+
+private:
+    FILE *file;
+    unsigned long long maxBytes, capturedBytes = 0;
+    std::string buffer;
+    long long lastAt;
+    unsigned int nextConnection = 0;
+    std::unordered_map<uint64_t, unsigned int> connections;
+
+    static long long now() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /* Opened before we began capturing, if not known */
+    unsigned int getConnection(uint64_t handle) {
+        auto it = connections.find(handle);
+        if (it != connections.end()) {
+            return it->second;
+        }
+        unsigned int connection = nextConnection++;
+        connections[handle] = connection;
+        record(OPEN, connection);
+        return connection;
+    }
+
+    void appendVarint(uint64_t value) {
+        while (value >= 128) {
+            buffer.push_back((char) (value | 128));
+            value >>= 7;
+        }
+        buffer.push_back((char) value);
+    }
+
+    void record(int kind, unsigned int connection) {
+        long long at = now();
+        appendVarint((uint64_t) kind);
+        appendVarint((uint64_t) (at - lastAt));
+        appendVarint(connection);
+        lastAt = at;
+    }
+};
+
+/* Reads what TrafficCapture wrote, all of it held in memory so that replaying does no IO */
+struct TrafficCaptureReader {
+    /* False if path cannot be read or is no capture */
+    bool open(const char *path) {
+        FILE *file = fopen(path, "rb");
+        if (!file) {
+            return false;
+        }
+        std::string capture;
+        char chunk[64 * 1024];
+        size_t length;
+        while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            capture.append(chunk, length);
+        }
+        fclose(file);
+        return load(std::move(capture));
+    }
+
+    bool load(std::string &&capture) {
+        contents = std::move(capture);
+        offset = TrafficCapture::HEADER.length();
+        microseconds = 0;
+        return contents.compare(0, TrafficCapture::HEADER.length(), TrafficCapture::HEADER) == 0;
+    }
+
+    /* False at the end, or where the capture was cut short */
+    bool next(CapturedRecord &record) {
+        uint64_t kind, delta, connection, length = 0;
+        if (!readVarint(kind) || !readVarint(delta) || !readVarint(connection)) {
+            return false;
+        }
+        if (kind < TrafficCapture::OPEN || kind > TrafficCapture::CLOSE) {
+            return false;
+        }
+        if (kind == TrafficCapture::DATA && (!readVarint(length) || length > contents.length() - offset)) {
+            return false;
+        }
+        microseconds += delta;
+        record.kind = (int) kind;
+        record.microseconds = microseconds;
+        record.connection = (unsigned int) connection;
+        record.data = std::string_view(contents.data() + offset, (size_t) length);
+        offset += (size_t) length;
+        return true;
+    }
+
+private:
+    std::string contents;
+    size_t offset = 0;
+    unsigned long long microseconds = 0;
+
+    bool readVarint(uint64_t &value) {
+        value = 0;
+        for (unsigned int shift = 0; shift < 64 && offset < contents.length(); shift += 7) {
+            unsigned char byte = (unsigned char) contents[offset++];
+            value |= (uint64_t) (byte & 127) << shift;
+            if (!(byte & 128)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+}
+
+#endif // UWS_TRAFFICCAPTURE_H
@@ -21,6 +21,8 @@
 /* Various common utilities */
 
 #include <cstdint>
+#include <cstring>
+#include <string_view>
 
 namespace uWS {
 namespace utils {
@@ -60,6 +62,282 @@ inline int u64toa(uint64_t value, char *dst) {
     return ret;
 }
 
+enum ByteRange {
+    /* No (supported) range, send everything */
+    RANGE_NONE,
+    RANGE_SATISFIABLE,
+    RANGE_NOT_SATISFIABLE
+};
+
+/* Parses a single "bytes=first-last", "bytes=first-" or "bytes=-suffix" Range header value
+ * against a resource of size bytes. Multiple ranges are not supported and give RANGE_NONE */
+inline ByteRange parseByteRange(std::string_view range, uint64_t size, uint64_t &first, uint64_t &last) {
+    if (range.substr(0, 6) != "bytes=") {
+        return RANGE_NONE;
+    }
+    range.remove_prefix(6);
+
+    size_t dash = range.find('-');
+    if (dash == std::string_view::npos) {
+        return RANGE_NONE;
+    }
+
+    /* Empty, non-digits or overflow gives false */
+    auto parse = [](std::string_view digits, uint64_t &value) {
+        value = 0;
+        for (char c : digits) {
+            if (c < '0' || c > '9' || value > (UINT64_MAX - 9) / 10) {
+                return false;
+            }
+            value = value * 10 + (uint64_t) (c - '0');
+        }
+        return digits.length() != 0;
+    };
+
+    std::string_view firstDigits = range.substr(0, dash), lastDigits = range.substr(dash + 1);
+    if (!firstDigits.length()) {
+        /* The last suffix bytes */
+        uint64_t suffix;
+        if (!parse(lastDigits, suffix)) {
+            return RANGE_NONE;
+        }
+        if (!suffix || !size) {
+            return RANGE_NOT_SATISFIABLE;
+        }
+        first = size - (suffix < size ? suffix : size);
+        last = size - 1;
+        return RANGE_SATISFIABLE;
+    }
+
+    if (!parse(firstDigits, first)) {
+        return RANGE_NONE;
+    }
+    if (!lastDigits.length()) {
+        last = UINT64_MAX;
+    } else if (!parse(lastDigits, last) || last < first) {
+        return RANGE_NONE;
+    }
+
+    if (first >= size) {
+        return RANGE_NOT_SATISFIABLE;
+    }
+    if (last >= size) {
+        last = size - 1;
+    }
+    return RANGE_SATISFIABLE;
+}
+
+/* Content codings we know of, as a mask */
+enum ContentCoding {
+    CODING_GZIP = 1,
+    CODING_BR = 2
+};
+
+/* Parses an Accept-Encoding header value into the mask of codings it accepts (those not given q=0) */
+inline unsigned int acceptedCodings(std::string_view acceptEncoding) {
+    unsigned int codings = 0;
+    while (acceptEncoding.length()) {
+        size_t comma = acceptEncoding.find(',');
+        std::string_view item = acceptEncoding.substr(0, comma);
+        acceptEncoding.remove_prefix(comma == std::string_view::npos ? acceptEncoding.length() : comma + 1);
+
+        size_t semicolon = item.find(';');
+        std::string_view name = item.substr(0, semicolon), parameters = semicolon == std::string_view::npos ? std::string_view() : item.substr(semicolon + 1);
+        while (name.length() && (name.front() == ' ' || name.front() == '\t')) {
+            name.remove_prefix(1);
+        }
+        while (name.length() && (name.back() == ' ' || name.back() == '\t')) {
+            name.remove_suffix(1);
+        }
+
+        /* Only a q of zero (0, 0., 0.000) refuses */
+        size_t q = parameters.find("q=");
+        if (q != std::string_view::npos) {
+            std::string_view value = parameters.substr(q + 2);
+            value = value.substr(0, value.find_first_not_of("0123456789."));
+            if (value.length() && value.find_first_not_of("0.") == std::string_view::npos) {
+                continue;
+            }
+        }
+
+        if (name == "gzip" || name == "x-gzip") {
+            codings |= CODING_GZIP;
+        } else if (name == "br") {
+            codings |= CODING_BR;
+        } else if (name == "*") {
+            codings |= CODING_GZIP | CODING_BR;
+        }
+    }
+    return codings;
+}
+
+/* Whether an If-None-Match header value (a list of tags, or *) matches etag, compared weakly as it has to be */
+inline bool matchesEntityTag(std::string_view ifNoneMatch, std::string_view etag) {
+    if (etag.substr(0, 2) == "W/") {
+        etag.remove_prefix(2);
+    }
+    while (ifNoneMatch.length()) {
+        size_t start = ifNoneMatch.find_first_not_of(" \t,");
+        if (start == std::string_view::npos) {
+            break;
+        }
+        ifNoneMatch.remove_prefix(start);
+        if (ifNoneMatch.front() == '*') {
+            return true;
+        }
+        if (ifNoneMatch.substr(0, 2) == "W/") {
+            ifNoneMatch.remove_prefix(2);
+        }
+        /* Tags are quoted, and may hold commas */
+        size_t end = ifNoneMatch.length() && ifNoneMatch.front() == '"' ? ifNoneMatch.find('"', 1) : ifNoneMatch.find(',');
+        std::string_view tag = ifNoneMatch.substr(0, end == std::string_view::npos ? end : end + (ifNoneMatch.front() == '"'));
+        if (tag == etag) {
+            return true;
+        }
+        ifNoneMatch.remove_prefix(tag.length());
+    }
+    return false;
+}
+
+/* Days since 1970-01-01 of a proleptic Gregorian date (month 1 - 12) */
+inline int64_t daysFromCivil(int64_t year, unsigned int month, unsigned int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned int yearOfEra = (unsigned int) (year - era * 400);
+    unsigned int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int64_t) dayOfEra - 719468;
+}
+
+/* Writes seconds since the epoch as an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT"), 29 bytes */
+inline void formatHttpDate(int64_t seconds, char *dst) {
+    static const char days[][4] = {"Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed"};
+    static const char months[][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    int64_t z = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+    unsigned int secondOfDay = (unsigned int) (seconds - z * 86400);
+    unsigned int weekday = (unsigned int) (((z % 7) + 7) % 7);
+
+    /* Inverse of daysFromCivil */
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    unsigned int dayOfEra = (unsigned int) (z - era * 146097);
+    unsigned int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    unsigned int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    unsigned int mp = (5 * dayOfYear + 2) / 153;
+    unsigned int day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    unsigned int month = mp < 10 ? mp + 3 : mp - 9;
+    unsigned int year = (unsigned int) ((int64_t) yearOfEra + era * 400 + (month <= 2)) % 10000;
+
+    auto two = [](char *p, unsigned int value) {
+        p[0] = (char) ('0' + value / 10);
+        p[1] = (char) ('0' + value % 10);
+    };
+    memcpy(dst, days[weekday], 3);
+    memcpy(dst + 3, ", ", 2);
+    two(dst + 5, day);
+    dst[7] = ' ';
+    memcpy(dst + 8, months[month - 1], 3);
+    dst[11] = ' ';
+    two(dst + 12, year / 100);
+    two(dst + 14, year % 100);
+    dst[16] = ' ';
+    two(dst + 17, secondOfDay / 3600);
+    dst[19] = ':';
+    two(dst + 20, secondOfDay / 60 % 60);
+    dst[22] = ':';
+    two(dst + 23, secondOfDay % 60);
+    memcpy(dst + 25, " GMT", 4);
+}
+
+/* Same as formatHttpDate over what it wrote for previous, though only the seconds are written while the
+ * minute stays the same. Once a second this is two digits rather than a whole date */
+inline void updateHttpDate(int64_t previous, int64_t seconds, char *dst) {
+    if (seconds > previous && seconds - previous < 60 && seconds % 60 > previous % 60) {
+        unsigned int second = (unsigned int) (seconds % 60);
+        dst[23] = (char) ('0' + second / 10);
+        dst[24] = (char) ('0' + second % 10);
+        return;
+    }
+    formatHttpDate(seconds, dst);
+}
+
+/* Parses an IMF-fixdate, the only date format we send and the one clients send back to us.
+ * Returns false for anything else (the obsolete formats included) */
+inline bool parseHttpDate(std::string_view date, int64_t &seconds) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    if (date.length() != 29 || date.substr(3, 2) != ", " || date.substr(25) != " GMT" || date[7] != ' ' || date[11] != ' ' ||
+        date[16] != ' ' || date[19] != ':' || date[22] != ':') {
+        return false;
+    }
+
+    bool valid = true;
+    auto digits = [&date, &valid](size_t offset, size_t count) {
+        unsigned int value = 0;
+        for (size_t i = offset; i < offset + count; i++) {
+            valid = valid && date[i] >= '0' && date[i] <= '9';
+            value = value * 10 + (unsigned int) (date[i] - '0');
+        }
+        return value;
+    };
+    unsigned int day = digits(5, 2), year = digits(12, 4), hour = digits(17, 2), minute = digits(20, 2), second = digits(23, 2);
+
+    unsigned int month = 0;
+    while (month < 12 && std::string_view(months + month * 3, 3) != date.substr(8, 3)) {
+        month++;
+    }
+    if (!valid || month == 12 || !day || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return false;
+    }
+
+    seconds = daysFromCivil(year, month + 1, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return true;
+}
+
+/* Percent-decodes the path of a URL into dst (of at least path.length() bytes) for use as a relative file path.
+ * Returns the decoded length, or SIZE_MAX for malformed encodings, NUL bytes or any ".." segment (and ending
+ * in "/.." is one). Segments are not otherwise touched: "." and empty segments are harmless to open(2) */
+inline size_t decodeUrlPath(std::string_view path, char *dst) {
+    auto hex = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+
+    size_t length = 0;
+    for (size_t i = 0; i < path.length(); i++) {
+        char c = path[i];
+        if (c == '%') {
+            int high = i + 2 < path.length() ? hex(path[i + 1]) : -1, low = high != -1 ? hex(path[i + 2]) : -1;
+            if (low == -1) {
+                return SIZE_MAX;
+            }
+            c = (char) (high * 16 + low);
+            i += 2;
+        }
+        if (!c) {
+            return SIZE_MAX;
+        }
+        dst[length++] = c;
+    }
+
+    /* Checked after decoding, so that %2e%2e and %2f are caught too */
+    std::string_view decoded(dst, length);
+    for (size_t segment = 0; segment <= length; ) {
+        size_t slash = decoded.find('/', segment);
+        if (slash == std::string_view::npos) {
+            slash = length;
+        }
+        if (decoded.substr(segment, slash - segment) == "..") {
+            return SIZE_MAX;
+        }
+        segment = slash + 1;
+    }
+    return length;
+}
+
 }
 }
 
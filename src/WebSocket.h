@@ -22,15 +22,32 @@
 #include "WebSocketProtocol.h"
 #include "AsyncSocket.h"
 #include "WebSocketContextData.h"
-
+#include "PreparedMessage.h"
+#include "EventStream.h"
+#include "Tracepoints.h"
+#include "SendBatch.h"
+
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
 #include <string_view>
+#include <type_traits>
 
 namespace uWS {
 
+/* Sends to a subscriber other than a WebSocket (an event stream or a channel), see the end of this file */
+template <bool SSL>
+bool sendToSubscriber(Subscriber *s, std::string_view message, bool compress, std::string &eventFrame);
+/* Sends to any subscriber reached by publishBig */
+template <bool SSL, typename Message>
+bool sendBigToSubscriber(Subscriber *s, TopicTreeBigMessage &bigMessage, const Message &message, std::string &eventFrame);
+
 template <bool SSL, bool isServer, typename USERDATA>
 struct WebSocket : AsyncSocket<SSL> {
     template <bool, typename> friend struct TemplatedAppBase;
     template <bool> friend struct HttpResponse;
+    template <bool, typename> friend struct TemplatedClientApp;
 private:
     typedef AsyncSocket<SSL> Super;
 
@@ -38,6 +55,11 @@ private:
         new (us_socket_ext(SSL, (us_socket_t *) this)) WebSocketData(perMessageDeflate, compressOptions, std::move(backpressure));
         return this;
     }
+
+    /* Idle timeouts are on the timing wheel of the loop, not those of uSockets */
+    void timeout(unsigned int seconds) {
+        ((WebSocketData *) Super::getAsyncSocketData())->timeout(Super::getLoopData()->timingWheel, seconds);
+    }
 public:
 
     /* Returns pointer to the per socket user data */
@@ -87,36 +109,153 @@ public:
         return send(message, CONTINUATION, compress, true);
     }
 
-    /* Send or buffer a WebSocket frame, compressed or not. Returns BACKPRESSURE on increased user space backpressure,
-     * DROPPED on dropped message (due to backpressure) or SUCCCESS if you are free to send even more now. */
-    SendStatus send(std::string_view message, OpCode opCode = OpCode::BINARY, bool compress = false, bool fin = true) {
-        WebSocketContextData<SSL, USERDATA> *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL,
+    /* Called from the fragment handler on the first piece of a message whose full size you know (say, from
+     * a header of your own protocol): this and the remaining pieces are collected into one buffer of
+     * totalLength, reserved up front, and emitted as one message. Returns false if too late or too big */
+    bool reassemble(size_t totalLength) {
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
             (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
         );
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) this);
 
-        /* Skip sending and report success if we are over the limit of maxBackpressure */
+        /* Nothing is counted as streamed until the handler returns */
+        if (!webSocketData->isStreaming || webSocketData->streamedLength || !totalLength || totalLength > webSocketContextData->maxPayloadLength) {
+            return false;
+        }
+        webSocketData->reassemblyLength = totalLength;
+        return true;
+    }
+
+private:
+    /* Returns true if we are over the limit of maxBackpressure, or shed by the backpressure budget of the loop */
+    bool overBackpressureLimit(WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData) {
         if (webSocketContextData->maxBackpressure && webSocketContextData->maxBackpressure < getBufferedAmount()) {
             /* Also defer a close if we should */
             if (webSocketContextData->closeOnBackpressureLimit) {
                 us_socket_shutdown_read(SSL, (us_socket_t *) this);
             }
+            return true;
+        }
+
+        BackPressureShedding shedding = Super::shedOverBackPressureBudget();
+        return shedding == SHED_DROP || shedding == SHED_CLOSE;
+    }
 
+    /* Returns true if we are over the limit of maxBackpressure and should drop message */
+    bool dropOverBackpressureLimit(WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData, std::string_view message, OpCode opCode) {
+        if (overBackpressureLimit(webSocketContextData)) {
             /* It is okay to call send again from within this callback since we immediately return with DROPPED afterwards */
-            if (webSocketContextData->droppedHandler) {
+            if (webSocketContextData->droppedHandler && !us_socket_is_closed(SSL, (us_socket_t *) this)) {
                 webSocketContextData->droppedHandler(this, message, opCode);
             }
 
+            return true;
+        }
+        return false;
+    }
+
+public:
+    /* Send or buffer a WebSocket frame, compressed or not. Returns BACKPRESSURE on increased user space backpressure,
+     * DROPPED on dropped message (due to backpressure) or SUCCCESS if you are free to send even more now. */
+    SendStatus send(std::string_view message, OpCode opCode = OpCode::BINARY, bool compress = false, bool fin = true) {
+        UWS_TRACE(ws__message__out, this, message.length(), (int) opCode);
+        return sendMessage(message, {}, opCode, compress, fin);
+    }
+
+private:
+    /* True if we compress with the shared compressor of the loop, meaning we can take frames deflated for others */
+    bool hasSharedCompressor() {
+        WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
+        return webSocketData->compressionStatus == WebSocketData::ENABLED && !webSocketData->dedicatedCompressor;
+    }
+
+    /* Deflates a big message on the compression pool or, behind a message doing so, waits its turn.
+     * Either way the message is copied and reported sent, since backpressure is not known yet */
+    SendStatus offloadMessage(std::string_view message, OpCode opCode, bool compress, bool fin, bool deflate) {
+        WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
+        webSocketData->offloaded++;
+
+        struct Offloaded {
+            std::string message, deflated;
+        };
+        auto offloaded = std::make_shared<Offloaded>(Offloaded{std::string(message), {}});
+
+        MoveOnlyFunction<void()> work = nullptr;
+        if (deflate) {
+            work = [offloaded]() {
+                offloaded->deflated = CompressionPool::deflate(offloaded->message);
+            };
+        }
+
+        Loop *loop = (Loop *) us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) this));
+        loop->offload(this, std::move(work), [this, offloaded, opCode, compress, fin]() {
+            WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
+            webSocketData->offloaded--;
+            sendMessage(offloaded->message, offloaded->deflated, opCode, compress, fin, false);
+
+            /* The FIN of end() waited behind us, unless it now waits for drainage */
+            if (webSocketData->isShuttingDown && !webSocketData->offloaded && !Super::isCorked() && getBufferedAmount() == 0) {
+                Super::shutdown();
+            }
+        });
+        return SUCCESS;
+    }
+
+    bool hasAdaptiveCompression() {
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+        return webSocketContextData->adaptiveCompression;
+    }
+
+    /* Send as above, given the message already deflated by the shared compressor (if not empty) */
+    SendStatus sendMessage(std::string_view message, std::string_view deflated, OpCode opCode, bool compress, bool fin, bool offloadable = true) {
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+
+        /* Adaptive compression sends what would not shrink as is (once, not again when offloaded) */
+        if (compress && offloadable && webSocketContextData->adaptiveCompression && !deflated.length() && message.length() && opCode < 3) {
+            WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
+            if (webSocketData->compressionStatus == WebSocketData::ENABLED && webSocketData->skipCompression(message)) {
+                CompressionStats &compressionStats = Super::getLoopData()->compressionStats;
+                compressionStats.skippedMessages++;
+                compressionStats.skippedBytes += message.length();
+                compress = false;
+            }
+        }
+
+        /* Big messages for the shared compressor are deflated off the loop, if we have a pool for that */
+        if (offloadable) {
+            LoopData *loopData = Super::getLoopData();
+            bool deflate = compress && !deflated.length() && loopData->compressionPool && message.length() >= loopData->offloadThreshold && opCode < 3 && hasSharedCompressor();
+            if (deflate || ((WebSocketData *) Super::getAsyncSocketData())->offloaded) {
+                if (dropOverBackpressureLimit(webSocketContextData, message, opCode)) {
+                    return DROPPED;
+                }
+                Super::getLoopData()->metrics.messagesOut.add();
+                return offloadMessage(message, opCode, compress, fin, deflate);
+            }
+        }
+
+        /* Skip sending and report success if we are over the limit of maxBackpressure */
+        if (dropOverBackpressureLimit(webSocketContextData, message, opCode)) {
             return DROPPED;
         }
 
+        /* Counted once, not again when sent after the compression pool */
+        if (offloadable) {
+            Super::getLoopData()->metrics.messagesOut.add();
+        }
+
         /* If we are subscribers and have messages to drain we need to drain them here to stay synced */
         WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
 
         /* Special path for long sends of non-compressed, non-SSL messages */
-        if (message.length() >= 16 * 1024 && !compress && !SSL && !webSocketData->subscriber && getBufferedAmount() == 0 && Super::getLoopData()->corkOffset == 0) {
+        if (message.length() >= 16 * 1024 && !compress && !SSL && isServer && !webSocketData->subscriber && !webSocketData->corkSlice && getBufferedAmount() == 0 && Super::getLoopData()->corkOffset == 0) {
             char header[10];
             int header_length = (int) protocol::formatMessage<isServer>(header, "", 0, opCode, message.length(), compress, fin);
-            int written = us_socket_write2(0, (struct us_socket_t *)this, header, header_length, message.data(), (int) message.length());
+            int written = Super::writeToSocket(header, header_length, message.data(), (int) message.length());
         
             if (written != header_length + (int) message.length()) {
                 /* Buffer up backpressure */
@@ -146,19 +285,43 @@ public:
                 /* Check and correct the compress hint. It is never valid to compress 0 bytes */
                 if (message.length() && opCode < 3 && webSocketData->compressionStatus == WebSocketData::ENABLED) {
                     LoopData *loopData = Super::getLoopData();
-                    /* Compress using either shared or dedicated deflationStream */
-                    if (webSocketData->deflationStream) {
-                        message = webSocketData->deflationStream->deflate(loopData->zlibContext, message, false);
+                    /* Compress using either shared or dedicated deflationStream, unless already done */
+                    size_t rawLength = message.length();
+                    if (deflated.length() && !webSocketData->dedicatedCompressor) {
+                        message = deflated;
+                    } else if (webSocketData->dedicatedCompressor) {
+                        message = webSocketData->getDeflationStream(loopData)->deflate(loopData->zlibContext, message, false);
                     } else {
                         message = loopData->deflationStream->deflate(loopData->zlibContext, message, true);
                     }
+
+                    loopData->compressionStats.compressedMessages++;
+                    loopData->compressionStats.compressedBytesIn += rawLength;
+                    loopData->compressionStats.compressedBytesOut += message.length();
+                    if (webSocketContextData->adaptiveCompression) {
+                        webSocketData->observeCompression(rawLength, message.length());
+                    }
                 } else {
                     compress = false;
                 }
             }
 
-            /* Get size, allocate size, write if needed */
-            size_t messageFrameSize = protocol::messageFrameSize(message.length());
+            /* Get size, allocate size, write if needed (clients add a mask) */
+            size_t messageFrameSize = protocol::messageFrameSize(message.length()) + (isServer ? 0 : 4);
+
+            /* Small sends outside of corks may be held and written together with following ones */
+            if (webSocketContextData->coalesceMicroseconds) {
+                if (char *coalesced = Super::coalesce(messageFrameSize, webSocketContextData->coalesceMicroseconds, webSocketContextData->coalesceBytes)) {
+                    protocol::formatMessage<isServer>(coalesced, message.data(), message.length(), opCode, message.length(), compress, fin);
+
+                    if (webSocketContextData->resetIdleTimeoutOnSend) {
+                        timeout(webSocketContextData->idleTimeoutComponents.first);
+                        webSocketData->hasTimedOut = false;
+                    }
+                    return SUCCESS;
+                }
+            }
+
             auto [sendBuffer, sendBufferAttribute] = Super::getSendBuffer(messageFrameSize);
             protocol::formatMessage<isServer>(sendBuffer, message.data(), message.length(), opCode, message.length(), compress, fin);
 
@@ -182,7 +345,7 @@ public:
 
         /* Every successful send resets the timeout */
         if (webSocketContextData->resetIdleTimeoutOnSend) {
-            Super::timeout(webSocketContextData->idleTimeoutComponents.first);
+            timeout(webSocketContextData->idleTimeoutComponents.first);
             WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
             webSocketData->hasTimedOut = false;
         }
@@ -191,6 +354,253 @@ public:
         return SUCCESS;
     }
 
+public:
+
+    /* Send a shared buffer as one frame. Any part of it that ends up as backpressure references the buffer
+     * instead of copying it, so the same buffer can be sent to many sockets. Compressed, SSL, masked (client)
+     * and small frames are sent like any other message. */
+    SendStatus send(const SharedBuffer &message, OpCode opCode = OpCode::BINARY, bool compress = false, bool fin = true) {
+        WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
+
+        if (webSocketData->offloaded || SSL || !isServer || message.length() < Super::getLoopData()->corkBufferSize / 4 || (compress && opCode < 3 && webSocketData->compressionStatus == WebSocketData::ENABLED)) {
+            return send(message.view(), opCode, compress, fin);
+        }
+        UWS_TRACE(ws__message__out, this, message.length(), (int) opCode);
+
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+
+        if (dropOverBackpressureLimit(webSocketContextData, message.view(), opCode)) {
+            return DROPPED;
+        }
+        Super::getLoopData()->metrics.messagesOut.add();
+
+        /* Stay synced with published messages */
+        if (webSocketData->subscriber) {
+            webSocketContextData->topicTree->drain(webSocketData->subscriber);
+        }
+
+        /* Cork the header so that it goes out in the same syscall as the payload */
+        bool corked = !Super::isCorked() && Super::canCork();
+        if (corked) {
+            Super::cork();
+        }
+
+        char header[10];
+        int headerLength = (int) protocol::formatMessage<isServer>(header, "", 0, opCode, message.length(), false, fin);
+        Super::write(header, headerLength);
+        auto [written, failed] = Super::write(message);
+
+        if (corked) {
+            Super::uncork();
+        }
+
+        if (failed) {
+            return BACKPRESSURE;
+        }
+
+        /* Every successful send resets the timeout */
+        if (webSocketContextData->resetIdleTimeoutOnSend) {
+            timeout(webSocketContextData->idleTimeoutComponents.first);
+            webSocketData->hasTimedOut = false;
+        }
+
+        return SUCCESS;
+    }
+
+private:
+    /* Copies a complete frame, or references it if it is big (never for SSL) */
+    SendStatus sendFrame(WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData, const SharedBuffer &buffer) {
+        Super::getLoopData()->metrics.messagesOut.add();
+        std::string_view frame = buffer.view();
+        if (!SSL && frame.length() >= Super::getLoopData()->corkBufferSize / 4) {
+            bool corked = !Super::isCorked() && Super::canCork();
+            if (corked) {
+                Super::cork();
+            }
+
+            auto [written, failed] = Super::write(buffer);
+
+            if (corked) {
+                failed = Super::uncork().second || failed;
+            }
+
+            if (failed) {
+                return BACKPRESSURE;
+            }
+        } else {
+            auto [sendBuffer, sendBufferAttribute] = Super::getSendBuffer(frame.length());
+            memcpy(sendBuffer, frame.data(), frame.length());
+
+            if (sendBufferAttribute == SendBufferAttribute::NEEDS_DRAIN) {
+                if (Super::write(nullptr, 0).second) {
+                    return BACKPRESSURE;
+                }
+            } else if (sendBufferAttribute == SendBufferAttribute::NEEDS_UNCORK) {
+                if (Super::uncork().second) {
+                    return BACKPRESSURE;
+                }
+            }
+        }
+
+        /* Every successful send resets the timeout */
+        if (webSocketContextData->resetIdleTimeoutOnSend) {
+            timeout(webSocketContextData->idleTimeoutComponents.first);
+            ((WebSocketData *) Super::getAsyncSocketData())->hasTimedOut = false;
+        }
+
+        return SUCCESS;
+    }
+
+    /* The opcode and payload of an unmasked frame we formatted ourselves */
+    static std::pair<OpCode, std::string_view> parseFrame(std::string_view frame) {
+        size_t length = (unsigned char) frame[1] & 127;
+        size_t headerLength = length == 127 ? 10 : (length == 126 ? 4 : 2);
+        return {(OpCode) (frame[0] & 15), frame.substr(headerLength)};
+    }
+
+    /* Sends a frame kept by a TopicHistory, like any message if we are waiting behind offloaded ones */
+    void replayFrame(WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData, const SharedBuffer &buffer) {
+        auto [opCode, payload] = parseFrame(buffer.view());
+        if (((WebSocketData *) Super::getAsyncSocketData())->offloaded) {
+            send(payload, opCode);
+        } else if (!dropOverBackpressureLimit(webSocketContextData, payload, opCode)) {
+            sendFrame(webSocketContextData, buffer);
+        }
+    }
+
+public:
+
+    /* Send a message framed (and compressed) once up front, see PreparedMessage. The frame is copied as is,
+     * or referenced if it would end up as backpressure. Clients and sockets with a dedicated compressor
+     * (which keeps context) cannot take the prepared frame and send the message like any other */
+    SendStatus send(const PreparedMessage &message) {
+        WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
+
+        bool compressed = message.isCompressed() && webSocketData->compressionStatus == WebSocketData::ENABLED;
+        if (!isServer || (compressed && webSocketData->dedicatedCompressor) || webSocketData->offloaded) {
+            return send(message.getMessage(), message.getOpCode(), compressed);
+        }
+        UWS_TRACE(ws__message__out, this, message.getMessage().length(), (int) message.getOpCode());
+
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+
+        if (dropOverBackpressureLimit(webSocketContextData, message.getMessage(), message.getOpCode())) {
+            return DROPPED;
+        }
+
+        /* Stay synced with published messages */
+        if (webSocketData->subscriber) {
+            webSocketContextData->topicTree->drain(webSocketData->subscriber);
+        }
+
+        return sendFrame(webSocketContextData, compressed ? message.compressedFrame : message.frame);
+    }
+
+    /* Send many pieces as one frame, framed once over their total length and never joined (unless compressed).
+     * Big frames of non-SSL servers go out in one gathering syscall, anything else is copied piecewise to the send buffer */
+    SendStatus send(std::span<const std::string_view> pieces, OpCode opCode = OpCode::BINARY, bool compress = false, bool fin = true) {
+        WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
+
+        size_t length = 0;
+        for (std::string_view piece : pieces) {
+            length += piece.length();
+        }
+
+        /* Deflating needs the message as one, as does waiting behind offloaded messages */
+        if ((compress && length && opCode < 3 && webSocketData->compressionStatus == WebSocketData::ENABLED) || webSocketData->offloaded) {
+            std::string message;
+            message.reserve(length);
+            for (std::string_view piece : pieces) {
+                message.append(piece);
+            }
+            return send(message, opCode, compress, fin);
+        }
+        UWS_TRACE(ws__message__out, this, length, (int) opCode);
+
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+
+        if (overBackpressureLimit(webSocketContextData)) {
+            /* Only to show the dropped handler, which is rare */
+            if (webSocketContextData->droppedHandler && !us_socket_is_closed(SSL, (us_socket_t *) this)) {
+                std::string message;
+                for (std::string_view piece : pieces) {
+                    message.append(piece);
+                }
+                webSocketContextData->droppedHandler(this, message, opCode);
+            }
+            return DROPPED;
+        }
+        Super::getLoopData()->metrics.messagesOut.add();
+
+        /* Stay synced with published messages */
+        if (webSocketData->subscriber) {
+            webSocketContextData->topicTree->drain(webSocketData->subscriber);
+        }
+
+        if (!SSL && isServer && length >= Super::getLoopData()->corkBufferSize / 4) {
+            /* Cork the header so that it goes out in the same syscall as the pieces */
+            bool corked = !Super::isCorked() && Super::canCork();
+            if (corked) {
+                Super::cork();
+            }
+
+            char header[10];
+            int headerLength = (int) protocol::formatMessage<isServer>(header, "", 0, opCode, length, false, fin);
+            Super::write(header, headerLength);
+            auto [written, failed] = Super::write(pieces);
+
+            if (corked) {
+                failed = Super::uncork().second || failed;
+            }
+
+            if (failed) {
+                return BACKPRESSURE;
+            }
+        } else {
+            size_t messageFrameSize = protocol::messageFrameSize(length);
+            auto [sendBuffer, sendBufferAttribute] = Super::getSendBuffer(isServer ? messageFrameSize : messageFrameSize + 4);
+            size_t headerLength = protocol::formatMessage<isServer>(sendBuffer, "", 0, opCode, length, false, fin);
+
+            char *payload = sendBuffer + headerLength;
+            for (std::string_view piece : pieces) {
+                memcpy(payload, piece.data(), piece.length());
+                payload += piece.length();
+            }
+
+            /* Clients mask with the 4 bytes formatMessage put in front of the payload */
+            if constexpr (!isServer) {
+                char *mask = sendBuffer + headerLength - 4;
+                for (size_t i = 0; i < length; i++) {
+                    sendBuffer[headerLength + i] ^= mask[i % 4];
+                }
+            }
+
+            if (sendBufferAttribute == SendBufferAttribute::NEEDS_DRAIN) {
+                if (Super::write(nullptr, 0).second) {
+                    return BACKPRESSURE;
+                }
+            } else if (sendBufferAttribute == SendBufferAttribute::NEEDS_UNCORK) {
+                if (Super::uncork().second) {
+                    return BACKPRESSURE;
+                }
+            }
+        }
+
+        /* Every successful send resets the timeout */
+        if (webSocketContextData->resetIdleTimeoutOnSend) {
+            timeout(webSocketContextData->idleTimeoutComponents.first);
+            webSocketData->hasTimedOut = false;
+        }
+
+        return SUCCESS;
+    }
+
     /* Send websocket close frame, emit close event, send FIN if successful.
      * Will not append a close reason if code is 0 or 1005. */
     void end(int code = 0, std::string_view message = {}) {
@@ -210,8 +620,9 @@ public:
         size_t closePayloadLength = protocol::formatClosePayload(closePayload, (uint16_t) code, message.data(), length);
         bool ok = send(std::string_view(closePayload, closePayloadLength), OpCode::CLOSE);
 
-        /* FIN if we are ok and not corked */
-        if (!this->isCorked()) {
+        /* FIN if we are ok and not corked. Behind offloaded messages the close frame waits its turn, and so
+         * does the FIN, or the peer would close on us before they are sent */
+        if (!this->isCorked() && !webSocketData->offloaded) {
             if (ok) {
                 /* If we are not corked, and we just sent off everything, we need to FIN right here.
                  * In all other cases, we need to fin either if uncork was successful, or when drainage is complete. */
@@ -219,26 +630,30 @@ public:
             }
         }
 
-        WebSocketContextData<SSL, USERDATA> *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL,
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
             (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
         );
 
         /* Set shorter timeout (use ping-timeout) to avoid long hanging sockets after end() on broken connections */
-        Super::timeout(webSocketContextData->idleTimeoutComponents.second);
+        timeout(webSocketContextData->idleTimeoutComponents.second);
 
         /* At this point we iterate all currently held subscriptions and emit an event for all of them */
         if (webSocketData->subscriber && webSocketContextData->subscriptionHandler) {
-            for (Topic *t : webSocketData->subscriber->topics) {
+            for (auto [t, index] : webSocketData->subscriber->topics) {
                 webSocketContextData->subscriptionHandler(this, t->name, (int) t->size() - 1, (int) t->size());
             }
         }
 
         /* Make sure to unsubscribe from any pub/sub node at exit */
-        webSocketContextData->topicTree->freeSubscriber(webSocketData->subscriber);
+        if (webSocketContextData->topicTree) {
+            webSocketContextData->topicTree->freeSubscriber(webSocketData->subscriber);
+            webSocketData->freeChannelSubscribers(webSocketContextData->topicTree);
+        }
         webSocketData->subscriber = nullptr;
 
         /* Emit close event */
         if (webSocketContextData->closeHandler) {
+            ProfiledHandler profiled(((LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) this))))->profile.get(), "close", &webSocketContextData->pattern);
             webSocketContextData->closeHandler(this, code, message);
         }
         ((USERDATA *) this->getUserData())->~USERDATA();
@@ -261,9 +676,186 @@ public:
         }
     }
 
+    /* Runs task on the task pool of the loop, then continuation(ws, result) on the loop, corked. Both are
+     * skipped once this socket closed (the task if it has not started yet). Returns false if the pool is full */
+    template <typename Task, typename Continuation>
+    bool offload(Task &&task, Continuation &&continuation) {
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) this);
+
+        if (!webSocketData->taskToken) {
+            webSocketData->taskToken = std::make_shared<TaskToken>();
+        }
+
+        Loop *loop = (Loop *) us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) this));
+        return loop->offload(std::forward<Task>(task), [this, continuation = std::forward<Continuation>(continuation)](auto &&... result) mutable {
+            cork([&]() {
+                continuation(this, std::forward<decltype(result)>(result)...);
+            });
+        }, webSocketData->taskToken);
+    }
+
+    /* A handle any thread can send to this socket with (see SocketRegistry), delivered by our loop in batches,
+     * corked once per batch. Sends reaching it after this socket closed (or migrated) are dropped */
+    SocketHandle getHandle() {
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) this);
+        if (webSocketData->handle) {
+            return webSocketData->handle;
+        }
+
+        LoopData *loopData = Super::getLoopData();
+        if (!loopData->socketRegistry) {
+            Loop *loop = (Loop *) us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) this));
+            loopData->socketRegistry = new SocketRegistry([](void *user) {
+                us_wakeup_loop((us_loop_t *) user);
+            }, loop);
+            loop->addPreHandler(loopData->socketRegistry, [socketRegistry = loopData->socketRegistry](Loop */*loop*/) {
+                socketRegistry->deliver();
+            });
+        }
+
+        webSocketData->handle = loopData->socketRegistry->add(this, [](void *s, SocketRegistry::Send *sends, size_t count) {
+            auto *webSocket = (WebSocket<SSL, isServer, USERDATA> *) s;
+            webSocket->cork([webSocket, sends, count]() {
+                for (size_t i = 0; i < count && !us_socket_is_closed(SSL, (us_socket_t *) webSocket); i++) {
+                    webSocket->send(sends[i].message, (OpCode) sends[i].opCode, sends[i].compress);
+                }
+            });
+        });
+        return webSocketData->handle;
+    }
+
+    /* Send message on channel (up to protocol::MAX_CHANNEL) of this socket, as one binary message beginning with
+     * the channel header (see protocol::formatChannelHeader) for the other end to take apart, such as our
+     * channelMessage handler does. Binary, since the header is not UTF-8, whatever the message is. Every channel has its own backpressure, counted until written, and is
+     * DROPPED over maxChannelBackpressure without holding back the others. Channels share the socket, and so
+     * everything sent before is written first */
+    SendStatus sendOnChannel(unsigned int channel, std::string_view message, bool compress = false) {
+        if (channel > protocol::MAX_CHANNEL) {
+            std::cerr << "Error: WebSocket channel " << channel << " is over protocol::MAX_CHANNEL" << std::endl;
+            std::terminate();
+        }
+
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+        WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
+
+        if (webSocketContextData->maxChannelBackpressure && getChannelBufferedAmount(channel) > webSocketContextData->maxChannelBackpressure) {
+            if (webSocketContextData->droppedHandler && !us_socket_is_closed(SSL, (us_socket_t *) this)) {
+                webSocketContextData->droppedHandler(this, message, OpCode::BINARY);
+            }
+            return DROPPED;
+        }
+
+        /* What was published to this channel goes out before */
+        if (Subscriber *s = webSocketData->getChannelSubscriber(channel)) {
+            webSocketContextData->topicTree->drain(s);
+        }
+
+        char header[protocol::MAX_CHANNEL_HEADER];
+        std::string_view pieces[2] = {{header, protocol::formatChannelHeader(header, channel)}, message};
+        SendStatus status = send(std::span<const std::string_view>(pieces, 2), OpCode::BINARY, compress);
+
+        /* Whatever is left of the socket up to here is ours, less what is not of this message. Messages waiting
+         * on the compression pool are not counted, nor is compression (we count what we were given) */
+        if (status != DROPPED && !webSocketData->offloaded) {
+            webSocketData->buffer.getChannels().mark(channel, protocol::messageFrameSize(pieces[0].length() + message.length()), Super::getPendingAmount());
+        }
+        return status;
+    }
+
+    /* Bytes of channel not yet written, see sendOnChannel */
+    size_t getChannelBufferedAmount(unsigned int channel) {
+        WebSocketData *webSocketData = (WebSocketData *) Super::getAsyncSocketData();
+        return webSocketData->buffer.getChannelLength(channel);
+    }
+
+    /* Sends each message of the batch to its socket, of the loop of the first message. Sends made one by one each
+     * cork and write their own socket, here they are framed into the cork slices of their sockets as if another
+     * socket held the cork buffer, and every socket is written once after all of them are framed (with io_uring,
+     * all of them in one submission). Messages over the maxBackpressure of their socket are dropped as by send, and
+     * those of sockets closed meanwhile (such as by closeOnBackpressureLimit) are counted dropped too. Messages to
+     * sockets of other loops are not sent but returned as rejected, for the thread of their loop to send */
+    static SendBatchResult sendBatch(std::span<const std::pair<WebSocket *, std::string_view>> batch, OpCode opCode = OpCode::BINARY, bool compress = false) {
+        struct Binding {
+            OpCode opCode;
+            bool compress;
+
+            LoopData *loopData(WebSocket *webSocket) {
+                return webSocket->getLoopData();
+            }
+
+            bool isClosed(WebSocket *webSocket) {
+                return us_socket_is_closed(SSL, (us_socket_t *) webSocket);
+            }
+
+            bool send(WebSocket *webSocket, std::string_view message) {
+                return webSocket->send(message, opCode, compress) != DROPPED;
+            }
+
+            void flush(WebSocket *webSocket) {
+                webSocket->flushCorkSlice();
+            }
+        } binding{opCode, compress};
+
+        return uWS::sendBatch(batch, binding);
+    }
+
+    /* Subscribe channel to a topic, as subscribe does for the socket. What is published to it is sent on the
+     * channel, dropped for the channel only while over maxChannelBackpressure. No subscription events */
+    bool subscribeOnChannel(unsigned int channel, std::string_view topic) {
+        static_assert(isServer, "Pub/sub is for server sockets, clients have no TopicTree");
+        if (channel > protocol::MAX_CHANNEL) {
+            std::cerr << "Error: WebSocket channel " << channel << " is over protocol::MAX_CHANNEL" << std::endl;
+            std::terminate();
+        }
+
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) this);
+        Subscriber *s = webSocketData->getChannelSubscriber(channel);
+        if (!s) {
+            if (!webSocketData->channelSubscribers) {
+                webSocketData->channelSubscribers = std::make_unique<std::vector<Subscriber *>>();
+            }
+            s = webSocketContextData->topicTree->createSubscriber();
+            s->user = this;
+            s->kind = SUBSCRIBER_WEBSOCKET_CHANNEL;
+            s->channel = (uint16_t) channel;
+            s->drainPolicy = webSocketContextData->drainPolicy;
+            webSocketData->channelSubscribers->push_back(s);
+        }
+
+        Topic *topicOrNull = webSocketContextData->topicTree->subscribe(s, topic);
+        std::string_view priorityTopicPrefix = webSocketContextData->priorityTopicPrefix;
+        if (topicOrNull && priorityTopicPrefix.length() && topic.substr(0, priorityTopicPrefix.length()) == priorityTopicPrefix) {
+            topicOrNull->priority = true;
+        }
+        return true;
+    }
+
+    /* Unsubscribe channel from a topic, returns true if it was subscribed */
+    bool unsubscribeOnChannel(unsigned int channel, std::string_view topic) {
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) this);
+        Subscriber *s = webSocketData->getChannelSubscriber(channel);
+        if (!s) {
+            return false;
+        }
+
+        /* The subscriber stays until we close, as with unsubscribe */
+        return std::get<0>(webSocketContextData->topicTree->unsubscribe(s, topic));
+    }
+
     /* Subscribe to a topic according to MQTT rules and syntax. Returns success */
     bool subscribe(std::string_view topic, bool = false) {
-        WebSocketContextData<SSL, USERDATA> *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL,
+        static_assert(isServer, "Pub/sub is for server sockets, clients have no TopicTree");
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
             (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
         );
 
@@ -272,10 +864,15 @@ public:
         if (!webSocketData->subscriber) {
             webSocketData->subscriber = webSocketContextData->topicTree->createSubscriber();
             webSocketData->subscriber->user = this;
+            webSocketData->subscriber->drainPolicy = webSocketContextData->drainPolicy;
         }
 
         /* Cannot return numSubscribers as this is only for this particular websocket context */
         Topic *topicOrNull = webSocketContextData->topicTree->subscribe(webSocketData->subscriber, topic);
+        std::string_view priorityTopicPrefix = webSocketContextData->priorityTopicPrefix;
+        if (topicOrNull && priorityTopicPrefix.length() && topic.substr(0, priorityTopicPrefix.length()) == priorityTopicPrefix) {
+            topicOrNull->priority = true;
+        }
         if (topicOrNull && webSocketContextData->subscriptionHandler) {
             /* Emit this socket, the topic, new count, old count */
             webSocketContextData->subscriptionHandler(this, topic, (int) topicOrNull->size(), (int) topicOrNull->size() - 1);
@@ -285,9 +882,41 @@ public:
         return true;
     }
 
+    /* Subscribe as above, then send what was published to topic after afterSequence (while it keeps a history,
+     * see App::keepHistory) ahead of anything published from now on. Returns false if the history holds none
+     * or only part of that, leaving the gap to the application (such as by sending a snapshot) */
+    bool subscribeFrom(std::string_view topic, uint64_t afterSequence) {
+        subscribe(topic);
+
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+        TopicHistory *history = webSocketContextData->topicTree->lookupHistory(topic);
+        if (!history) {
+            return false;
+        }
+
+        /* What was batched for us is older than anything we replay */
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) this);
+        webSocketContextData->topicTree->drain(webSocketData->subscriber);
+
+        bool corked = !Super::isCorked() && Super::canCork();
+        if (corked) {
+            Super::cork();
+        }
+        bool complete = history->since(afterSequence, [this, webSocketContextData](const SharedBuffer &frame) {
+            replayFrame(webSocketContextData, frame);
+        });
+        if (corked) {
+            Super::uncork();
+        }
+
+        return complete;
+    }
+
     /* Unsubscribe from a topic, returns true if we were subscribed. */
     bool unsubscribe(std::string_view topic, bool = false) {
-        WebSocketContextData<SSL, USERDATA> *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL,
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
             (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
         );
 
@@ -309,7 +938,7 @@ public:
 
     /* Returns whether this socket is subscribed to the specified topic */
     bool isSubscribed(std::string_view topic) {
-        WebSocketContextData<SSL, USERDATA> *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL,
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
             (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
         );
 
@@ -323,7 +952,7 @@ public:
             return false;
         }
 
-        return topicPtr->count(webSocketData->subscriber);
+        return webSocketData->subscriber->topics.count(topicPtr);
     }
 
     /* Iterates all topics of this WebSocket. Every topic is represented by its full name.
@@ -331,7 +960,7 @@ public:
      * inside the callback ONLY IF not modifying the topic passed to the callback.
      * Topic names are valid only for the duration of the callback. */
     void iterateTopics(MoveOnlyFunction<void(std::string_view)> cb) {
-        WebSocketContextData<SSL, USERDATA> *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL,
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
             (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
         );
 
@@ -340,7 +969,7 @@ public:
             /* Lock this subscriber for unsubscription / subscription */
             webSocketContextData->topicTree->iteratingSubscriber = webSocketData->subscriber;
 
-            for (Topic *topicPtr : webSocketData->subscriber->topics) {
+            for (auto [topicPtr, index] : webSocketData->subscriber->topics) {
                 cb({topicPtr->name.data(), topicPtr->name.length()});
             }
 
@@ -353,7 +982,8 @@ public:
      * We, the WebSocket, must be subscribed to the topic itself and if so - no message will be sent to ourselves.
      * Use App::publish for an unconditional publish that simply publishes to whomever might be subscribed. */
     bool publish(std::string_view topic, std::string_view message, OpCode opCode = OpCode::TEXT, bool compress = false) {
-        WebSocketContextData<SSL, USERDATA> *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL,
+        static_assert(isServer, "Pub/sub is for server sockets, clients have no TopicTree");
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
             (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
         );
 
@@ -365,18 +995,116 @@ public:
         }
 
         /* Publish as sender, does not receive its own messages even if subscribed to relevant topics */
-        if (message.length() >= LoopData::CORK_BUFFER_SIZE) {
-            return webSocketContextData->topicTree->publishBig(webSocketData->subscriber, topic, {message, opCode, compress}, [](Subscriber *s, TopicTreeBigMessage &message) {
-                auto *ws = (WebSocket<SSL, true, int> *) s->user;
+        LoopData *loopData = Super::getLoopData();
+        if (message.length() >= loopData->corkBufferSize) {
+            /* Deflate once, for every subscriber sharing the compressor */
+            if (compress && opCode < 3) {
+                return publish(topic, PreparedMessage(message, opCode, true));
+            }
 
-                ws->send(message.message, (OpCode)message.opCode, message.compress);
-            });
+            /* Copy once, so that subscribers with backpressure can all reference the same buffer */
+            if constexpr (!SSL) {
+                return publish(topic, SharedBuffer::copy(message), opCode, compress);
+            }
+
+            /* Topics keeping a history keep its frame on the side */
+            if (TopicHistory *history = webSocketContextData->topicTree->lookupHistory(topic)) {
+                history->push(PreparedMessage::frameOf(message, opCode));
+            }
+            loopData->observeMessage(message.length());
+            std::string frame;
+            return webSocketContextData->topicTree->publishBig(webSocketData->subscriber, topic, {message, opCode, compress}, [&frame](Subscriber *s, TopicTreeBigMessage &bigMessage) {
+                return sendBigToSubscriber<SSL>(s, bigMessage, bigMessage.message, frame);
+            }, message.length());
         } else {
-            return webSocketContextData->topicTree->publish(webSocketData->subscriber, topic, {std::string(message), opCode, compress});
+            /* Topics keeping a history keep its frame on the side */
+            if (TopicHistory *history = webSocketContextData->topicTree->lookupHistory(topic)) {
+                history->push(PreparedMessage::frameOf(message, opCode));
+            }
+            loopData->observeMessage(message.length());
+            return webSocketContextData->topicTree->publish(webSocketData->subscriber, topic, {std::string(message), opCode, compress}, message.length());
+        }
+    }
+
+    /* Publish a shared buffer, see above. Big messages are sent to every subscriber without copying */
+    bool publish(std::string_view topic, const SharedBuffer &message, OpCode opCode = OpCode::TEXT, bool compress = false) {
+        static_assert(isServer, "Pub/sub is for server sockets, clients have no TopicTree");
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) this);
+        if (!webSocketData->subscriber) {
+            return false;
         }
+
+        LoopData *loopData = Super::getLoopData();
+        if (message.length() < loopData->corkBufferSize || (compress && opCode < 3)) {
+            return publish(topic, message.view(), opCode, compress);
+        }
+        if (TopicHistory *history = webSocketContextData->topicTree->lookupHistory(topic)) {
+            history->push(PreparedMessage::frameOf(message.view(), opCode));
+        }
+        loopData->observeMessage(message.length());
+
+        std::string frame;
+        return webSocketContextData->topicTree->publishBig(webSocketData->subscriber, topic, {message.view(), opCode, compress}, [&message, &frame](Subscriber *s, TopicTreeBigMessage &bigMessage) {
+            return sendBigToSubscriber<SSL>(s, bigMessage, message, frame);
+        }, message.length());
+    }
+
+    /* Publish a prepared message, see above. Every subscriber gets the frame built once */
+    bool publish(std::string_view topic, const PreparedMessage &message) {
+        static_assert(isServer, "Pub/sub is for server sockets, clients have no TopicTree");
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL,
+            (us_socket_context_t *) us_socket_context(SSL, (us_socket_t *) this)
+        );
+
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) this);
+        if (!webSocketData->subscriber) {
+            return false;
+        }
+        Super::getLoopData()->observeMessage(message.getMessage().length());
+
+        if (TopicHistory *history = webSocketContextData->topicTree->lookupHistory(topic)) {
+            history->push(message.frame);
+        }
+
+        std::string frame;
+        return webSocketContextData->topicTree->publishBig(webSocketData->subscriber, topic, {message.getMessage(), message.getOpCode(), message.isCompressed()}, [&message, &frame](Subscriber *s, TopicTreeBigMessage &bigMessage) {
+            return sendBigToSubscriber<SSL>(s, bigMessage, message, frame);
+        }, message.getMessage().length());
     }
 };
 
+/* Returns true for dropped, as publishBig takes it. Channels are sent as WebSockets of int, all of them are, and
+ * binary whatever was published */
+template <bool SSL>
+bool sendToSubscriber(Subscriber *s, std::string_view message, bool compress, std::string &eventFrame) {
+    if (s->kind == SUBSCRIBER_EVENT_STREAM) {
+        return sendEvent<SSL>(s, message, eventFrame);
+    }
+    auto *ws = (WebSocket<SSL, true, int> *) s->user;
+    return ws->sendOnChannel(s->channel, message, compress) == WebSocket<SSL, true, int>::SendStatus::DROPPED;
+}
+
+/* Sends a message published by publishBig, as publishBig takes it. WebSockets are sent message (a view, shared buffer
+ * or prepared message) as is, the others get bigMessage, framed once into eventFrame if it reaches event streams */
+template <bool SSL, typename Message>
+bool sendBigToSubscriber(Subscriber *s, TopicTreeBigMessage &bigMessage, const Message &message, std::string &eventFrame) {
+    if (s->kind != SUBSCRIBER_WEBSOCKET) {
+        return sendToSubscriber<SSL>(s, bigMessage.message, bigMessage.compress, eventFrame);
+    }
+    auto *ws = (WebSocket<SSL, true, int> *) s->user;
+
+    /* Send will drain if needed */
+    if constexpr (std::is_same_v<Message, PreparedMessage>) {
+        return ws->send(message) == WebSocket<SSL, true, int>::SendStatus::DROPPED;
+    } else {
+        return ws->send(message, (OpCode) bigMessage.opCode, bigMessage.compress) == WebSocket<SSL, true, int>::SendStatus::DROPPED;
+    }
+}
+
 }
 
 #endif // UWS_WEBSOCKET_H
@@ -23,12 +23,22 @@
 #include "WebSocketData.h"
 #include "WebSocket.h"
 
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 namespace uWS {
 
 template <bool SSL, bool isServer, typename USERDATA>
 struct WebSocketContext {
     template <bool, typename> friend struct TemplatedAppBase;
     template <bool, typename> friend struct WebSocketProtocol;
+    template <bool, typename> friend struct TemplatedClientApp;
+    template <bool> friend struct HttpResponse;
 private:
     WebSocketContext() = delete;
 
@@ -36,8 +46,8 @@ private:
         return (us_socket_context_t *) this;
     }
 
-    WebSocketContextData<SSL, USERDATA> *getExt() {
-        return (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL, (us_socket_context_t *) this);
+    WebSocketContextData<SSL, USERDATA, isServer> *getExt() {
+        return (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, (us_socket_context_t *) this);
     }
 
     /* If we have negotiated compression, set this frame compressed */
@@ -53,29 +63,241 @@ private:
     }
 
     static void forceClose(WebSocketState<isServer> */*wState*/, void *s, std::string_view reason = {}) {
+        /* What came before the breakage is still emitted, as when emitted one by one */
+        flushMessages(s);
         us_socket_close(SSL, (us_socket_t *) s, (int) reason.length(), (void *) reason.data());
     }
 
+    /* Messages of the read being consumed, for messagesHandler. Those not in the read itself (inflated or
+     * reassembled) are copied to storage, since their buffers are reused by the next one */
+    struct MessageBatch {
+        struct Entry {
+            /* Null if in storage, at offset */
+            const char *data;
+            size_t offset;
+            size_t length;
+            OpCode opCode;
+        };
+        std::vector<Entry> entries;
+        std::string storage;
+        std::vector<WebSocketMessage> messages;
+        /* The read, null when not consuming one */
+        const char *readBegin = nullptr, *readEnd = nullptr;
+    };
+
+    /* Of the loop of s, if profiling */
+    static LoopProfile *getProfile(void *s) {
+        return ((LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s))))->profile.get();
+    }
+
+    static MessageBatch &getMessageBatch() {
+        static thread_local MessageBatch messageBatch;
+        return messageBatch;
+    }
+
+    /* Hands over what is batched in one call. Returns true if we closed or shut down */
+    static bool flushMessages(void *s) {
+        MessageBatch &messageBatch = getMessageBatch();
+        if (!messageBatch.entries.size()) {
+            return false;
+        }
+
+        for (typename MessageBatch::Entry &entry : messageBatch.entries) {
+            const char *data = entry.data ? entry.data : messageBatch.storage.data() + entry.offset;
+            messageBatch.messages.push_back({std::string_view(data, entry.length), entry.opCode});
+        }
+        messageBatch.entries.clear();
+
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+        {
+            ProfiledHandler profiled(getProfile(s), "message", &webSocketContextData->pattern);
+            webSocketContextData->messagesHandler((WebSocket<SSL, isServer, USERDATA> *) s, std::span<const WebSocketMessage>(messageBatch.messages));
+        }
+        messageBatch.messages.clear();
+        messageBatch.storage.clear();
+
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) s);
+        return us_socket_is_closed(SSL, (us_socket_t *) s) || webSocketData->isShuttingDown;
+    }
+
+    /* To channelMessageHandler if we have one and the message is binary, beginning with a channel header, else to
+     * messagesHandler (as a batch of one) if we have one, else to messageHandler */
+    static void deliverMessage(void *s, std::string_view message, int opCode) {
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+        ProfiledHandler profiled(getProfile(s), "message", &webSocketContextData->pattern);
+        unsigned int channel;
+        if (std::string_view payload = message; webSocketContextData->channelMessageHandler && opCode == BINARY && protocol::parseChannelHeader(payload, channel)) {
+            webSocketContextData->channelMessageHandler((WebSocket<SSL, isServer, USERDATA> *) s, channel, payload);
+        } else if (webSocketContextData->messagesHandler) {
+            WebSocketMessage one = {message, (OpCode) opCode};
+            webSocketContextData->messagesHandler((WebSocket<SSL, isServer, USERDATA> *) s, std::span<const WebSocketMessage>(&one, 1));
+        } else if (webSocketContextData->messageHandler) {
+            webSocketContextData->messageHandler((WebSocket<SSL, isServer, USERDATA> *) s, message, (OpCode) opCode);
+        }
+    }
+
+    /* Emits a message, or a copy of it once the messages of ours still on the compression pool are done. Batched
+     * while consuming a read for messagesHandler. Returns true if we closed or shut down */
+    static bool emitMessage(void *s, std::string_view message, int opCode) {
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) s);
+        LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s)));
+        loopData->metrics.messagesIn.add();
+        UWS_TRACE(ws__message__in, s, message.length(), opCode);
+
+        if (!webSocketContextData->messageHandler && !webSocketContextData->messagesHandler && !webSocketContextData->channelMessageHandler) {
+            return false;
+        }
+
+        if (webSocketData->offloaded) {
+            webSocketData->offloaded++;
+            Loop *loop = (Loop *) us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s));
+            loop->offload(s, nullptr, [s, message = std::string(message), opCode]() {
+                ((WebSocketData *) us_socket_ext(SSL, (us_socket_t *) s))->offloaded--;
+
+                deliverMessage(s, message, opCode);
+            });
+            return false;
+        }
+
+        /* Channels take their messages one by one, never batched */
+        MessageBatch &messageBatch = getMessageBatch();
+        if (webSocketContextData->messagesHandler && messageBatch.readBegin && !webSocketContextData->channelMessageHandler) {
+            if (message.data() >= messageBatch.readBegin && message.data() + message.length() <= messageBatch.readEnd) {
+                messageBatch.entries.push_back({message.data(), 0, message.length(), (OpCode) opCode});
+            } else {
+                messageBatch.entries.push_back({nullptr, messageBatch.storage.length(), message.length(), (OpCode) opCode});
+                messageBatch.storage.append(message);
+            }
+            return false;
+        }
+
+        deliverMessage(s, message, opCode);
+        return us_socket_is_closed(SSL, (us_socket_t *) s) || webSocketData->isShuttingDown;
+    }
+
+    /* Big messages for the shared decompressor are inflated (and validated) on the compression pool, if we have one.
+     * Compressed must be followed by 9 bytes we can read. Returns true if offloaded */
+    static bool offloadInflation(void *s, std::string_view compressed, int opCode) {
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) s);
+        Loop *loop = (Loop *) us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s));
+        LoopData *loopData = (LoopData *) us_loop_ext((us_loop_t *) loop);
+
+        if (webSocketData->dedicatedDecompressor || !loopData->compressionPool || compressed.length() < loopData->offloadThreshold) {
+            return false;
+        }
+        webSocketData->offloaded++;
+
+        struct Offloaded {
+            std::string compressed;
+            std::optional<std::string> inflated;
+            bool valid;
+        };
+        auto offloaded = std::make_shared<Offloaded>(Offloaded{std::string(compressed.data(), compressed.length() + 9), std::nullopt, true});
+
+        loop->offload(s, [offloaded, opCode, maxPayloadLength = webSocketContextData->maxPayloadLength]() {
+            offloaded->inflated = CompressionPool::inflate({offloaded->compressed.data(), offloaded->compressed.length() - 9}, maxPayloadLength);
+            if (offloaded->inflated && opCode == 1) {
+                offloaded->valid = protocol::isValidUtf8((unsigned char *) offloaded->inflated->data(), offloaded->inflated->length());
+            }
+        }, [s, offloaded, opCode]() {
+            ((WebSocketData *) us_socket_ext(SSL, (us_socket_t *) s))->offloaded--;
+
+            if (!offloaded->inflated.has_value()) {
+                forceClose(nullptr, s, ERR_TOO_BIG_MESSAGE_INFLATION);
+            } else if (!offloaded->valid) {
+                forceClose(nullptr, s, ERR_INVALID_TEXT);
+            } else {
+                deliverMessage(s, *offloaded->inflated, opCode);
+            }
+        });
+        return true;
+    }
+
+    /* Due on the timing wheel: end of lifetime, or idle timeout */
+    static void expire(void *s) {
+        auto *webSocketData = (WebSocketData *)(us_socket_ext(SSL, (us_socket_t *) s));
+        auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+        LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s)));
+
+        if (webSocketData->lifetimeDeadline && webSocketData->lifetimeDeadline <= loopData->timingWheel.getNow()) {
+            webSocketData->lifetimeDeadline = 0;
+            ((WebSocket<SSL, isServer, USERDATA> *) s)->end(1000, "please reconnect");
+            return;
+        }
+
+        /* Idle sockets give their compressor back to the loop, to take a fresh one (without context) when needed */
+        if (webSocketContextData->compressorIdleTimeout) {
+            webSocketData->releaseDeflationStream(loopData, webSocketContextData->compressorIdleTimeout);
+        }
+
+        if (webSocketContextData->sendPingsAutomatically && !webSocketData->isShuttingDown && !webSocketData->hasTimedOut) {
+            webSocketData->hasTimedOut = true;
+            webSocketData->timeout(loopData->timingWheel, webSocketContextData->idleTimeoutComponents.second);
+            /* Send ping without being corked (clients mask, here with a zero key) */
+            if (isServer) {
+                ((AsyncSocket<SSL> *) s)->write("\x89\x00", 2);
+            } else {
+                ((AsyncSocket<SSL> *) s)->write("\x89\x80\x00\x00\x00\x00", 6);
+            }
+            return;
+        }
+
+        /* Timeout is very simple; we just close it */
+        /* Warning: we happen to know forceClose will not use first parameter so pass nullptr here */
+        forceClose(nullptr, s, ERR_WEBSOCKET_TIMEOUT);
+    }
+
+    /* Called once adopted, with WebSocketData in place. Takes over from the timeouts of uSockets, which sweep
+     * every socket. The first idle timeout is cut short by up to a quarter when pinging, so that sockets
+     * opened together (a reconnect storm) spread their pings over the interval instead of sending them all at once */
+    static void startTimers(void *s) {
+        auto *webSocketData = (WebSocketData *)(us_socket_ext(SSL, (us_socket_t *) s));
+        auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+        TimingWheel &timingWheel = ((LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s))))->timingWheel;
+
+        us_socket_timeout(SSL, (us_socket_t *) s, 0);
+        us_socket_long_timeout(SSL, (us_socket_t *) s, 0);
+
+        webSocketData->timer.expire = expire;
+        webSocketData->timer.owner = s;
+        if (webSocketContextData->maxLifetime) {
+            webSocketData->lifetimeDeadline = timingWheel.getNow() + webSocketContextData->maxLifetime * 60u;
+        }
+
+        unsigned int idleTimeout = webSocketContextData->idleTimeoutComponents.first;
+        if (webSocketContextData->sendPingsAutomatically && idleTimeout >= 4) {
+            idleTimeout -= (unsigned int) rand() % (idleTimeout / 4);
+        }
+        webSocketData->timeout(timingWheel, idleTimeout);
+    }
+
     /* Returns true on breakage */
     static bool handleFragment(char *data, size_t length, unsigned int remainingBytes, int opCode, bool fin, WebSocketState<isServer> *webSocketState, void *s) {
         /* WebSocketData and WebSocketContextData */
-        WebSocketContextData<SSL, USERDATA> *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
         WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, (us_socket_t *) s);
+        LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s)));
 
         /* Is this a non-control frame? */
         if (opCode < 3) {
             /* Did we get everything in one go? */
-            if (!remainingBytes && fin && !webSocketData->fragmentBuffer.length()) {
+            if (!remainingBytes && fin && !webSocketData->getFragmentLength() && !webSocketData->isStreaming) {
 
                 /* Handle compressed frame */
                 if (webSocketData->compressionStatus == WebSocketData::CompressionStatus::COMPRESSED_FRAME) {
                         webSocketData->compressionStatus = WebSocketData::CompressionStatus::ENABLED;
 
-                        LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s)));
+                        /* We always have 9 bytes of post padding following the frame or the frame after it */
+                        if (offloadInflation(s, {data, length}, opCode)) {
+                            return false;
+                        }
+
                         /* Decompress using shared or dedicated decompressor */
                         std::optional<std::string_view> inflatedFrame;
-                        if (webSocketData->inflationStream) {
-                            inflatedFrame = webSocketData->inflationStream->inflate(loopData->zlibContext, {data, length}, webSocketContextData->maxPayloadLength, false);
+                        if (webSocketData->dedicatedDecompressor) {
+                            inflatedFrame = webSocketData->getInflationStream(loopData)->inflate(loopData->zlibContext, {data, length}, webSocketContextData->maxPayloadLength, false);
                         } else {
                             inflatedFrame = loopData->inflationStream->inflate(loopData->zlibContext, {data, length}, webSocketContextData->maxPayloadLength, true);
                         }
@@ -96,23 +318,72 @@ private:
                 }
 
                 /* Emit message event & break if we are closed or shut down when returning */
-                if (webSocketContextData->messageHandler) {
-                    webSocketContextData->messageHandler((WebSocket<SSL, isServer, USERDATA> *) s, std::string_view(data, length), (OpCode) opCode);
+                if (emitMessage(s, std::string_view(data, length), opCode)) {
+                    return true;
+                }
+            } else if (webSocketContextData->fragmentHandler && webSocketData->compressionStatus != WebSocketData::CompressionStatus::COMPRESSED_FRAME
+                && (webSocketData->isStreaming || !webSocketData->getFragmentLength())) {
+                /* Hand over every piece as it comes, without copying it anywhere (after what was batched) */
+                if (flushMessages(s)) {
+                    return true;
+                }
+                if (!webSocketData->isStreaming) {
+                    webSocketData->isStreaming = true;
+                    webSocketData->streamedLength = 0;
+                    webSocketData->utf8TailLength = 0;
+                }
+                if (refusePayloadLength(webSocketData->streamedLength + length, webSocketState, s)) {
+                    forceClose(webSocketState, s, ERR_TOO_BIG_MESSAGE);
+                    return true;
+                }
+
+                bool last = !remainingBytes && fin;
+                if (opCode == 1 && !protocol::isValidUtf8Piece(webSocketData->utf8Tail, webSocketData->utf8TailLength, (unsigned char *) data, length, last)) {
+                    forceClose(webSocketState, s, ERR_INVALID_TEXT);
+                    return true;
+                }
+
+                if (webSocketData->offloaded) {
+                    /* Wait for messages of ours still on the compression pool */
+                    webSocketData->offloaded++;
+                    Loop *loop = (Loop *) us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s));
+                    loop->offload(s, nullptr, [s, piece = std::string(data, length), opCode, last]() {
+                        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+                        ((WebSocketData *) us_socket_ext(SSL, (us_socket_t *) s))->offloaded--;
+
+                        webSocketContextData->fragmentHandler((WebSocket<SSL, isServer, USERDATA> *) s, piece, (OpCode) opCode, last);
+                    });
+                } else {
+                    webSocketContextData->fragmentHandler((WebSocket<SSL, isServer, USERDATA> *) s, std::string_view(data, length), (OpCode) opCode, last);
                     if (us_socket_is_closed(SSL, (us_socket_t *) s) || webSocketData->isShuttingDown) {
                         return true;
                     }
                 }
-            } else {
-                /* Allocate fragment buffer up front first time */
-                if (!webSocketData->fragmentBuffer.length()) {
-                    webSocketData->fragmentBuffer.reserve(length + remainingBytes);
+                webSocketData->streamedLength += length;
+
+                if (last) {
+                    webSocketData->isStreaming = false;
+                    webSocketData->reassemblyLength = 0;
+                } else if (webSocketData->reassemblyLength) {
+                    /* Asked to collect the rest (which is all of it) into one buffer of the declared size */
+                    webSocketData->isStreaming = false;
+                    std::string &fragmentBuffer = webSocketData->getFragmentBuffer(loopData);
+                    fragmentBuffer.reserve(webSocketData->reassemblyLength);
+                    fragmentBuffer.append(data, length);
+                    webSocketData->reassemblyLength = 0;
                 }
+            } else {
                 /* Fragments forming a big message are not caught until appending them */
-                if (refusePayloadLength(length + webSocketData->fragmentBuffer.length(), webSocketState, s)) {
+                if (refusePayloadLength(length + webSocketData->getFragmentLength(), webSocketState, s)) {
                     forceClose(webSocketState, s, ERR_TOO_BIG_MESSAGE);
                     return true;
                 }
-                webSocketData->fragmentBuffer.append(data, length);
+                /* Allocate fragment buffer up front first time */
+                std::string &fragmentBuffer = webSocketData->getFragmentBuffer(loopData);
+                if (!fragmentBuffer.length()) {
+                    fragmentBuffer.reserve(length + remainingBytes);
+                }
+                fragmentBuffer.append(data, length);
 
                 /* Are we done now? */
                 // todo: what if we don't have any remaining bytes yet we are not fin? forceclose!
@@ -123,20 +394,19 @@ private:
                             webSocketData->compressionStatus = WebSocketData::CompressionStatus::ENABLED;
 
                             /* 9 bytes of padding for libdeflate, 4 for zlib */
-                            webSocketData->fragmentBuffer.append("123456789");
+                            fragmentBuffer.append("123456789");
 
-                            LoopData *loopData = (LoopData *) us_loop_ext(
-                                us_socket_context_loop(SSL,
-                                    us_socket_context(SSL, (us_socket_t *) s)
-                                )
-                            );
+                            if (offloadInflation(s, {fragmentBuffer.data(), fragmentBuffer.length() - 9}, opCode)) {
+                                webSocketData->clearFragments();
+                                return false;
+                            }
 
                             /* Decompress using shared or dedicated decompressor */
                             std::optional<std::string_view> inflatedFrame;
-                            if (webSocketData->inflationStream) {
-                                inflatedFrame = webSocketData->inflationStream->inflate(loopData->zlibContext, {webSocketData->fragmentBuffer.data(), webSocketData->fragmentBuffer.length() - 9}, webSocketContextData->maxPayloadLength, false);
+                            if (webSocketData->dedicatedDecompressor) {
+                                inflatedFrame = webSocketData->getInflationStream(loopData)->inflate(loopData->zlibContext, {fragmentBuffer.data(), fragmentBuffer.length() - 9}, webSocketContextData->maxPayloadLength, false);
                             } else {
-                                inflatedFrame = loopData->inflationStream->inflate(loopData->zlibContext, {webSocketData->fragmentBuffer.data(), webSocketData->fragmentBuffer.length() - 9}, webSocketContextData->maxPayloadLength, true);
+                                inflatedFrame = loopData->inflationStream->inflate(loopData->zlibContext, {fragmentBuffer.data(), fragmentBuffer.length() - 9}, webSocketContextData->maxPayloadLength, true);
                             }
 
                             if (!inflatedFrame.has_value()) {
@@ -150,8 +420,8 @@ private:
 
                     } else {
                         // reset length and data ptrs
-                        length = webSocketData->fragmentBuffer.length();
-                        data = webSocketData->fragmentBuffer.data();
+                        length = fragmentBuffer.length();
+                        data = fragmentBuffer.data();
                     }
 
                     /* Check text messages for Utf-8 validity */
@@ -161,20 +431,20 @@ private:
                     }
 
                     /* Emit message and check for shutdown or close */
-                    if (webSocketContextData->messageHandler) {
-                        webSocketContextData->messageHandler((WebSocket<SSL, isServer, USERDATA> *) s, std::string_view(data, length), (OpCode) opCode);
-                        if (us_socket_is_closed(SSL, (us_socket_t *) s) || webSocketData->isShuttingDown) {
-                            return true;
-                        }
+                    if (emitMessage(s, std::string_view(data, length), opCode)) {
+                        return true;
                     }
 
                     /* If we shutdown or closed, this will be taken care of elsewhere */
-                    webSocketData->fragmentBuffer.clear();
+                    webSocketData->clearFragments();
                 }
             }
         } else {
-            /* Control frames need the websocket to send pings, pongs and close */
+            /* Control frames need the websocket to send pings, pongs and close, after what was batched */
             WebSocket<SSL, isServer, USERDATA> *webSocket = (WebSocket<SSL, isServer, USERDATA> *) s;
+            if (flushMessages(s)) {
+                return true;
+            }
 
             if (!remainingBytes && fin && !webSocketData->controlTipLength) {
                 if (opCode == CLOSE) {
@@ -201,11 +471,12 @@ private:
                 }
             } else {
                 /* Here we never mind any size optimizations as we are in the worst possible path */
-                webSocketData->fragmentBuffer.append(data, length);
+                std::string &fragmentBuffer = webSocketData->getFragmentBuffer(loopData);
+                fragmentBuffer.append(data, length);
                 webSocketData->controlTipLength += (unsigned int) length;
 
                 if (!remainingBytes && fin) {
-                    char *controlBuffer = (char *) webSocketData->fragmentBuffer.data() + webSocketData->fragmentBuffer.length() - webSocketData->controlTipLength;
+                    char *controlBuffer = (char *) fragmentBuffer.data() + fragmentBuffer.length() - webSocketData->controlTipLength;
                     if (opCode == CLOSE) {
                         protocol::CloseFrame closeFrame = protocol::parseClosePayload(controlBuffer, webSocketData->controlTipLength);
                         webSocket->end(closeFrame.code, std::string_view(closeFrame.message, closeFrame.length));
@@ -230,16 +501,159 @@ private:
                     }
 
                     /* Same here, we do not care for any particular smart allocation scheme */
-                    webSocketData->fragmentBuffer.resize((unsigned int) webSocketData->fragmentBuffer.length() - webSocketData->controlTipLength);
+                    fragmentBuffer.resize((unsigned int) fragmentBuffer.length() - webSocketData->controlTipLength);
                     webSocketData->controlTipLength = 0;
+                    if (!fragmentBuffer.length()) {
+                        webSocketData->clearFragments();
+                    }
                 }
             }
         }
         return false;
     }
 
+    /* A server WebSocket on its way to another loop (see App::migrate), leaving what ties it to this one behind */
+    struct Migrant {
+        LIBUS_SOCKET_DESCRIPTOR fd;
+        WebSocketData webSocketData;
+        USERDATA userData;
+        std::vector<std::string> topics;
+        /* Topics of channels subscribing on their own (see WebSocket::subscribeOnChannel) */
+        std::vector<std::pair<unsigned int, std::string>> channelTopics;
+        /* Ticks left of our lifetime, or 0 for none */
+        uint32_t lifetimeLeft;
+        char address[16];
+        int addressLength;
+    };
+
+    /* Takes s off this loop, closing it here without emitting close. Returns nullptr, leaving s be, if it cannot
+     * go as it is: shutting down, waiting on the compression pool, or TLS (whose session cannot be moved) */
+    static std::unique_ptr<Migrant> emigrate(us_socket_t *s) {
+        WebSocketData *webSocketData = (WebSocketData *) us_socket_ext(SSL, s);
+        if (SSL || !isServer || us_socket_is_closed(SSL, s) || webSocketData->isShuttingDown || webSocketData->offloaded) {
+            return nullptr;
+        }
+
+        auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, s));
+        TimingWheel &timingWheel = ((LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, s))))->timingWheel;
+        auto *asyncSocket = (AsyncSocket<SSL> *) s;
+
+        /* Whatever is batched or corked for us is sent now, or goes with us as backpressure */
+        if (webSocketData->subscriber) {
+            webSocketContextData->topicTree->drain(webSocketData->subscriber);
+        }
+        if (asyncSocket->isCorked()) {
+            asyncSocket->uncork();
+        }
+        asyncSocket->flushCorkSlice();
+        if (us_socket_is_closed(SSL, s)) {
+            return nullptr;
+        }
+
+        LIBUS_SOCKET_DESCRIPTOR fd = dup((int) (intptr_t) asyncSocket->getNativeHandle());
+        if (fd == -1) {
+            return nullptr;
+        }
+
+        /* Our subscriptions end here as on close, and begin again there (see immigrate). What we leave
+         * behind must be whole, the handler could have closed us */
+        if (webSocketData->subscriber && webSocketContextData->subscriptionHandler) {
+            for (auto [t, index] : webSocketData->subscriber->topics) {
+                webSocketContextData->subscriptionHandler((WebSocket<SSL, isServer, USERDATA> *) s, t->name, (int) t->size() - 1, (int) t->size());
+            }
+            if (us_socket_is_closed(SSL, s)) {
+                close((int) fd);
+                return nullptr;
+            }
+        }
+
+        std::vector<std::string> topics;
+        if (webSocketData->subscriber) {
+            for (auto [t, index] : webSocketData->subscriber->topics) {
+                topics.emplace_back(t->name);
+            }
+        }
+        std::vector<std::pair<unsigned int, std::string>> channelTopics;
+        if (webSocketData->channelSubscribers) {
+            for (Subscriber *channelSubscriber : *webSocketData->channelSubscribers) {
+                for (auto [t, index] : channelSubscriber->topics) {
+                    channelTopics.emplace_back(channelSubscriber->channel, t->name);
+                }
+            }
+        }
+        uint32_t lifetimeLeft = webSocketData->lifetimeDeadline ? webSocketData->lifetimeDeadline - timingWheel.getNow() : 0;
+
+        /* From here on our backpressure counts on the loop we go to */
+        webSocketData->buffer.leaveBudget();
+        if (webSocketData->sideBlock) {
+            webSocketData->sideBlock->leaveThread();
+        }
+        USERDATA *userData = (USERDATA *) (webSocketData + 1);
+        std::unique_ptr<Migrant> migrant(new Migrant {fd, std::move(*webSocketData), std::move(*userData), std::move(topics), std::move(channelTopics), lifetimeLeft, {}, 16});
+        us_socket_remote_address(SSL, s, migrant->address, &migrant->addressLength);
+
+        webSocketData->isMigrating = true;
+        us_socket_close(SSL, s, 0, nullptr);
+        return migrant;
+    }
+
+    /* Puts migrant on the loop of webSocketContext (the same route as the one it left), subscribed as it was,
+     * with the subscription events of that. Emits migrated once in place */
+    static WebSocket<SSL, isServer, USERDATA> *immigrate(WebSocketContext *webSocketContext, std::unique_ptr<Migrant> migrant) {
+        us_socket_t *s = us_adopt_accepted_socket(SSL, webSocketContext->getSocketContext(), migrant->fd,
+            sizeof(WebSocketData) + sizeof(USERDATA), migrant->address, migrant->addressLength);
+        if (!s) {
+            close((int) migrant->fd);
+            return nullptr;
+        }
+
+        WebSocketData *webSocketData = new (us_socket_ext(SSL, s)) WebSocketData(std::move(migrant->webSocketData));
+        new (webSocketData + 1) USERDATA(std::move(migrant->userData));
+        webSocketData->buffer.joinBudget();
+        if (webSocketData->sideBlock) {
+            webSocketData->sideBlock->joinThread();
+        }
+
+        LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, s)));
+        loopData->connections.fetch_add(1, std::memory_order_relaxed);
+        loopData->webSockets.fetch_add(1, std::memory_order_relaxed);
+        loopData->metrics.accepted.add();
+
+        /* A fresh idle timeout, but only the lifetime we had left */
+        startTimers(s);
+        if (migrant->lifetimeLeft) {
+            webSocketData->lifetimeDeadline = loopData->timingWheel.getNow() + migrant->lifetimeLeft;
+            webSocketData->timeout(loopData->timingWheel, webSocketContext->getExt()->idleTimeoutComponents.first);
+        }
+
+        /* Backpressure we brought along is written once writable */
+        if (webSocketData->buffer.totalLength()) {
+#ifdef UWS_NO_DIRECT_SOCKET_IO
+            /* The poll is not ours to change, what a write leaves over arms writable */
+            ((AsyncSocket<SSL> *) s)->write(nullptr, 0, true, 0);
+#else
+            us_poll_change((us_poll_t *) s, us_socket_context_loop(SSL, us_socket_context(SSL, s)), LIBUS_SOCKET_READABLE | LIBUS_SOCKET_WRITABLE);
+#endif
+        }
+
+        auto *ws = (WebSocket<SSL, isServer, USERDATA> *) s;
+        if constexpr (isServer) {
+            for (std::string &topic : migrant->topics) {
+                ws->subscribe(topic);
+            }
+            for (auto &[channel, topic] : migrant->channelTopics) {
+                ws->subscribeOnChannel(channel, topic);
+            }
+        }
+
+        if (webSocketContext->getExt()->migratedHandler) {
+            webSocketContext->getExt()->migratedHandler(ws);
+        }
+        return ws;
+    }
+
     static bool refusePayloadLength(uint64_t length, WebSocketState<isServer> */*wState*/, void *s) {
-        auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+        auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
 
         /* Return true for refuse, false for accept */
         return webSocketContextData->maxPayloadLength < length;
@@ -250,43 +664,101 @@ private:
          * We arreive as WebSocket with timeout set and
          * any backpressure from HTTP state kept. */
 
+        /* Except for migrants adopted by fd (see immigrate), which are set up after this */
+        us_socket_context_on_open(SSL, getSocketContext(), [](auto *s, int /*is_client*/, char */*ip*/, int /*ip_length*/) {
+            return s;
+        });
+
         /* Handle socket disconnections */
         us_socket_context_on_close(SSL, getSocketContext(), [](auto *s, int code, void *reason) {
             /* For whatever reason, if we already have emitted close event, do not emit it again */
             WebSocketData *webSocketData = (WebSocketData *) (us_socket_ext(SSL, s));
             if (!webSocketData->isShuttingDown) {
                 /* Emit close event */
-                auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+                auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
 
-                /* At this point we iterate all currently held subscriptions and emit an event for all of them */
-                if (webSocketData->subscriber && webSocketContextData->subscriptionHandler) {
-                    for (Topic *t : webSocketData->subscriber->topics) {
+                /* At this point we iterate all currently held subscriptions and emit an event for all of them,
+                 * unless migrating which did so already */
+                if (webSocketData->subscriber && webSocketContextData->subscriptionHandler && !webSocketData->isMigrating) {
+                    for (auto [t, index] : webSocketData->subscriber->topics) {
                         webSocketContextData->subscriptionHandler((WebSocket<SSL, isServer, USERDATA> *) s, t->name, (int) t->size() - 1, (int) t->size());
                     }
                 }
 
                 /* Make sure to unsubscribe from any pub/sub node at exit */
-                webSocketContextData->topicTree->freeSubscriber(webSocketData->subscriber);
+                if (webSocketContextData->topicTree) {
+                    webSocketContextData->topicTree->freeSubscriber(webSocketData->subscriber);
+                    webSocketData->freeChannelSubscribers(webSocketContextData->topicTree);
+                }
                 webSocketData->subscriber = nullptr;
 
+                /* Migrating goes on elsewhere, there is only what we moved out of left to destroy */
                 auto *ws = (WebSocket<SSL, isServer, USERDATA> *) s;
-                if (webSocketContextData->closeHandler) {
+                if (webSocketContextData->closeHandler && !webSocketData->isMigrating) {
+                    ProfiledHandler profiled(getProfile(s), "close", &webSocketContextData->pattern);
                     webSocketContextData->closeHandler(ws, 1006, {(char *) reason, (size_t) code});
                 }
                 ((USERDATA *) ws->getUserData())->~USERDATA();
             }
 
-            /* Destruct in-placed data struct */
-            webSocketData->~WebSocketData();
+            /* Whatever we had on the compression pool is never emitted */
+            if (webSocketData->offloaded) {
+                Loop::get()->cancelOffloaded(s);
+            }
+
+            /* The next socket can have our compressor */
+            LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s)));
+            webSocketData->releaseDeflationStream(loopData);
+            loopData->timingWheel.disarm(&webSocketData->timer);
+            if (webSocketData->handle) {
+                loopData->socketRegistry->remove(webSocketData->handle);
+            }
+            if constexpr (isServer) {
+                loopData->connections.fetch_sub(1, std::memory_order_relaxed);
+                loopData->webSockets.fetch_sub(1, std::memory_order_relaxed);
+                loopData->metrics.closed.add();
+                if (loopData->trafficCapture) {
+                    loopData->trafficCapture->onClose((uint64_t) us_poll_fd((struct us_poll_t *) s));
+                }
+            }
+
+            /* Subscribed again from the close handler, here or after end() */
+            auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+            if (webSocketContextData->topicTree) {
+                webSocketContextData->topicTree->freeSubscriber(webSocketData->subscriber);
+                webSocketData->freeChannelSubscribers(webSocketContextData->topicTree);
+                webSocketData->subscriber = nullptr;
+            }
+
+            /* Destruct in-placed data struct, unless a Task running on us (which closed us) still needs it until it suspends */
+            auto release = [](void *s) {
+                ((WebSocketData *) us_socket_ext(SSL, (us_socket_t *) s))->~WebSocketData();
+            };
+            if (!webSocketData->holdForCoroutines(release, s)) {
+                release(s);
+            }
 
             return s;
         });
 
-        /* Handle WebSocket data streams */
-        us_socket_context_on_data(SSL, getSocketContext(), [](auto *s, char *data, int length) {
+        /* Handle WebSocket data streams, and what was parked of them over the read budget (see Loop::setReadBudget) */
+        static us_socket_t *(*onData)(us_socket_t *, char *, int) = [](us_socket_t *s, char *data, int length) {
 
             /* We need the websocket data */
             WebSocketData *webSocketData = (WebSocketData *) (us_socket_ext(SSL, s));
+            LoopData *loopData = (LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s)));
+
+            /* What was parked was counted as it was read */
+            bool resumed = loopData->resumingRead;
+            if (!resumed) {
+                loopData->noteEvent();
+                loopData->metrics.bytesIn.add((unsigned long long) length);
+                if constexpr (isServer) {
+                    if (loopData->trafficCapture) {
+                        loopData->trafficCapture->onData((uint64_t) us_poll_fd((struct us_poll_t *) s), {data, (size_t) length});
+                    }
+                }
+            }
 
             /* When in websocket shutdown mode, we do not care for ANY message, whether responding close frame or not.
              * We only care for the TCP FIN really, not emitting any message after closing is key */
@@ -294,33 +766,49 @@ private:
                 return s;
             }
 
-            auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+            auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
             auto *asyncSocket = (AsyncSocket<SSL> *) s;
 
+            /* Past the read budget the rest is parked, behind what we parked before */
+            if (!resumed && !asyncSocket->takeReadBudget(data, length, onData)) {
+                return s;
+            }
+
             /* Every time we get data and not in shutdown state we simply reset the timeout */
-            asyncSocket->timeout(webSocketContextData->idleTimeoutComponents.first);
+            webSocketData->timeout(((LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s))))->timingWheel, webSocketContextData->idleTimeoutComponents.first);
             webSocketData->hasTimedOut = false;
 
             /* We always cork on data */
             asyncSocket->cork();
 
-            /* This parser has virtually no overhead */
-            WebSocketProtocol<isServer, WebSocketContext<SSL, isServer, USERDATA>>::consume(data, (unsigned int) length, (WebSocketState<isServer> *) webSocketData, s);
+            /* This parser has virtually no overhead. The state of clients is a prefix of the server state we hold.
+             * Messages of this read are batched for messagesHandler, if any, and handed over still corked */
+            MessageBatch &messageBatch = getMessageBatch();
+            messageBatch.readBegin = data;
+            messageBatch.readEnd = data + length;
+            WebSocketProtocol<isServer, WebSocketContext<SSL, isServer, USERDATA>>::consume(data, (unsigned int) length, (WebSocketState<isServer> *) (WebSocketState<true> *) webSocketData, s);
+            messageBatch.readBegin = messageBatch.readEnd = nullptr;
+            if (!us_socket_is_closed(SSL, (us_socket_t *) s)) {
+                flushMessages(s);
+            }
+            messageBatch.entries.clear();
+            messageBatch.storage.clear();
 
             /* Uncorking a closed socekt is fine, in fact it is needed */
             asyncSocket->uncork();
 
-            /* If uncorking was successful and we are in shutdown state then send TCP FIN */
+            /* If uncorking was successful and we are in shutdown state then send TCP FIN (unless it waits behind offloaded messages) */
             if (asyncSocket->getBufferedAmount() == 0) {
                 /* We can now be in shutdown state */
-                if (webSocketData->isShuttingDown) {
+                if (webSocketData->isShuttingDown && !webSocketData->offloaded) {
                     /* Shutting down a closed socket is handled by uSockets and just fine */
                     asyncSocket->shutdown();
                 }
             }
 
             return s;
-        });
+        };
+        us_socket_context_on_data(SSL, getSocketContext(), onData);
 
         /* Handle HTTP write out (note: SSL_read may trigger this spuriously, the app need to handle spurious calls) */
         us_socket_context_on_writable(SSL, getSocketContext(), [](auto *s) {
@@ -347,22 +835,23 @@ private:
             /* Behavior: if we actively drain backpressure, always reset timeout (even if we are in shutdown) */
             /* Also reset timeout if we came here with 0 backpressure */
             if (!backpressure || backpressure > asyncSocket->getBufferedAmount()) {
-                auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
-                asyncSocket->timeout(webSocketContextData->idleTimeoutComponents.first);
+                auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+                webSocketData->timeout(((LoopData *) us_loop_ext(us_socket_context_loop(SSL, us_socket_context(SSL, (us_socket_t *) s))))->timingWheel, webSocketContextData->idleTimeoutComponents.first);
                 webSocketData->hasTimedOut = false;
             }
 
             /* Are we in (WebSocket) shutdown mode? */
             if (webSocketData->isShuttingDown) {
-                /* Check if we just now drained completely */
-                if (asyncSocket->getBufferedAmount() == 0) {
+                /* Check if we just now drained completely, and have nothing offloaded still to send */
+                if (asyncSocket->getBufferedAmount() == 0 && !webSocketData->offloaded) {
                     /* Now perform the actual TCP/TLS shutdown which was postponed due to backpressure */
                     asyncSocket->shutdown();
                 }
             } else if (!backpressure || backpressure > asyncSocket->getBufferedAmount()) {
                 /* Only call drain if we actually drained backpressure or if we came here with 0 backpressure */
-                auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
+                auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
                 if (webSocketContextData->drainHandler) {
+                    ProfiledHandler profiled(getProfile(s), "drain", &webSocketContextData->pattern);
                     webSocketContextData->drainHandler((WebSocket<SSL, isServer, USERDATA> *) s);
                 }
                 /* No need to check for closed here as we leave the handler immediately*/
@@ -386,24 +875,9 @@ private:
             return s;
         });
 
-        /* Handle socket timeouts, simply close them so to not confuse client with FIN */
+        /* Our timeouts are on the timing wheel of the loop (see startTimers), this is in case one is set on us anyway */
         us_socket_context_on_timeout(SSL, getSocketContext(), [](auto *s) {
-
-            auto *webSocketData = (WebSocketData *)(us_socket_ext(SSL, s));
-            auto *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL, us_socket_context(SSL, (us_socket_t *) s));
-
-            if (webSocketContextData->sendPingsAutomatically && !webSocketData->isShuttingDown && !webSocketData->hasTimedOut) {
-                webSocketData->hasTimedOut = true;
-                us_socket_timeout(SSL, s, webSocketContextData->idleTimeoutComponents.second);
-                /* Send ping without being corked */
-                ((AsyncSocket<SSL> *) s)->write("\x89\x00", 2);
-                return s;
-            }
-
-            /* Timeout is very simple; we just close it */
-            /* Warning: we happen to know forceClose will not use first parameter so pass nullptr here */
-            forceClose(nullptr, s, ERR_WEBSOCKET_TIMEOUT);
-
+            expire(s);
             return s;
         });
 
@@ -411,22 +885,23 @@ private:
     }
 
     void free() {
-        WebSocketContextData<SSL, USERDATA> *webSocketContextData = (WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL, (us_socket_context_t *) this);
+        WebSocketContextData<SSL, USERDATA, isServer> *webSocketContextData = (WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, (us_socket_context_t *) this);
         webSocketContextData->~WebSocketContextData();
 
         us_socket_context_free(SSL, (us_socket_context_t *) this);
     }
 
 public:
-    /* WebSocket contexts are always child contexts to a HTTP context so no SSL options are needed as they are inherited */
+    /* WebSocket contexts are always child contexts to a HTTP context (or the handshake context of a client)
+     * so no SSL options are needed as they are inherited. Clients have no topicTree */
     static WebSocketContext *create(Loop */*loop*/, us_socket_context_t *parentSocketContext, TopicTree<TopicTreeMessage, TopicTreeBigMessage> *topicTree) {
-        WebSocketContext *webSocketContext = (WebSocketContext *) us_create_child_socket_context(SSL, parentSocketContext, sizeof(WebSocketContextData<SSL, USERDATA>));
+        WebSocketContext *webSocketContext = (WebSocketContext *) us_create_child_socket_context(SSL, parentSocketContext, sizeof(WebSocketContextData<SSL, USERDATA, isServer>));
         if (!webSocketContext) {
             return nullptr;
         }
 
         /* Init socket context data */
-        new ((WebSocketContextData<SSL, USERDATA> *) us_socket_context_ext(SSL, (us_socket_context_t *)webSocketContext)) WebSocketContextData<SSL, USERDATA>(topicTree);
+        new ((WebSocketContextData<SSL, USERDATA, isServer> *) us_socket_context_ext(SSL, (us_socket_context_t *)webSocketContext)) WebSocketContextData<SSL, USERDATA, isServer>(topicTree);
         return webSocketContext->init();
     }
 };
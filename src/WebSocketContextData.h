@@ -22,6 +22,8 @@
 #include "AsyncSocket.h"
 
 #include "MoveOnlyFunction.h"
+#include <span>
+#include <string>
 #include <string_view>
 #include <vector>
 
@@ -36,6 +38,12 @@ struct TopicTreeMessage {
     std::string message;
     /*OpCode*/ int opCode;
     bool compress;
+    /* Deflated once by the first subscriber with a shared compressor, for the rest of them */
+    std::string deflated = {};
+    /* Sampled once by the first subscriber with adaptive compression */
+    bool sampled = false, incompressible = false;
+    /* Framed once by the first event stream subscriber, for the rest of them */
+    std::string eventFrame = {};
 };
 struct TopicTreeBigMessage {
     std::string_view message;
@@ -47,7 +55,7 @@ template <bool, bool, typename> struct WebSocket;
 
 /* todo: this looks identical to WebSocketBehavior, why not just std::move that entire thing in? */
 
-template <bool SSL, typename USERDATA>
+template <bool SSL, typename USERDATA, bool isServer = true>
 struct WebSocketContextData {
 private:
 
@@ -56,15 +64,22 @@ public:
     /* This one points to the App's shared topicTree */
     TopicTree<TopicTreeMessage, TopicTreeBigMessage> *topicTree;
 
+    /* Of the route, what stalls of our handlers are reported as (see Loop::setProfiling) */
+    std::string pattern;
+
     /* The callbacks for this context */
-    MoveOnlyFunction<void(WebSocket<SSL, true, USERDATA> *)> openHandler = nullptr;
-    MoveOnlyFunction<void(WebSocket<SSL, true, USERDATA> *, std::string_view, OpCode)> messageHandler = nullptr;
-    MoveOnlyFunction<void(WebSocket<SSL, true, USERDATA> *, std::string_view, OpCode)> droppedHandler = nullptr;
-    MoveOnlyFunction<void(WebSocket<SSL, true, USERDATA> *)> drainHandler = nullptr;
-    MoveOnlyFunction<void(WebSocket<SSL, true, USERDATA> *, std::string_view, int, int)> subscriptionHandler = nullptr;
-    MoveOnlyFunction<void(WebSocket<SSL, true, USERDATA> *, int, std::string_view)> closeHandler = nullptr;
-    MoveOnlyFunction<void(WebSocket<SSL, true, USERDATA> *, std::string_view)> pingHandler = nullptr;
-    MoveOnlyFunction<void(WebSocket<SSL, true, USERDATA> *, std::string_view)> pongHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *)> openHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *, std::string_view, OpCode)> messageHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *, std::span<const WebSocketMessage>)> messagesHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *, unsigned int, std::string_view)> channelMessageHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *, std::string_view, OpCode, bool)> fragmentHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *, std::string_view, OpCode)> droppedHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *)> drainHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *, std::string_view, int, int)> subscriptionHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *, int, std::string_view)> closeHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *, std::string_view)> pingHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *, std::string_view)> pongHandler = nullptr;
+    MoveOnlyFunction<void(WebSocket<SSL, isServer, USERDATA> *)> migratedHandler = nullptr;
 
     /* Settings for this context */
     size_t maxPayloadLength = 0;
@@ -74,10 +89,21 @@ public:
 
     /* There needs to be a maxBackpressure which will force close everything over that limit */
     size_t maxBackpressure = 0;
+    /* Of every channel (see WebSocket::sendOnChannel), 0 for no limit but maxBackpressure */
+    unsigned int maxChannelBackpressure = 0;
     bool closeOnBackpressureLimit;
     bool resetIdleTimeoutOnSend;
+    /* Small sends outside of corks are held for this long or up to this many bytes, 0 to send right away */
+    unsigned int coalesceMicroseconds = 0, coalesceBytes = 0;
     bool sendPingsAutomatically;
     unsigned short maxLifetime;
+    /* Skip deflate where it would not pay off */
+    bool adaptiveCompression = false;
+    /* Seconds a dedicated compressor may go unused before given back to the loop, 0 to keep it */
+    unsigned int compressorIdleTimeout = 0;
+    /* How our subscribers are drained, and the topics they take first */
+    uint8_t drainPolicy = DRAIN_ALL;
+    std::string priorityTopicPrefix;
 
     /* These are calculated on creation */
     std::pair<unsigned short, unsigned short> idleTimeoutComponents;
@@ -22,63 +22,279 @@
 #include "AsyncSocketData.h"
 #include "PerMessageDeflate.h"
 #include "TopicTree.h"
+#include "TimingWheel.h"
+#include "TaskPool.h"
 
+#include <cstring>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace uWS {
 
+/* A message being reassembled and the dedicated deflate state, in a side block taken from the loop on first
+ * use and given back once neither is left. Idle WebSockets do not carry any of it */
+struct WebSocketSideBlock {
+    std::string fragmentBuffer;
+    DeflationStream *deflationStream = nullptr;
+    time_t lastDeflation = 0;
+    /* A dedicated decompressor is kept once made, and so is the side block with it */
+    InflationStream *inflationStream = nullptr;
+
+    WebSocketSideBlock() = default;
+    /* Leaves other the streams, which the caller takes away from it */
+    WebSocketSideBlock(WebSocketSideBlock &&other) = default;
+
+    ~WebSocketSideBlock() {
+        if (deflationStream) {
+            delete deflationStream;
+        }
+
+        if (inflationStream) {
+            delete inflationStream;
+        }
+    }
+
+    bool empty() {
+        return !fragmentBuffer.length() && !deflationStream && !inflationStream;
+    }
+
+    /* Our streams count on the thread of the loop we go to (see ZlibMemory) */
+    void leaveThread() {
+        if (deflationStream) {
+            deflationStream->memory.leaveThread();
+        }
+        if (inflationStream) {
+            inflationStream->memory.leaveThread();
+        }
+    }
+
+    void joinThread() {
+        if (deflationStream) {
+            deflationStream->memory.joinThread();
+        }
+        if (inflationStream) {
+            inflationStream->memory.joinThread();
+        }
+    }
+};
+
 struct WebSocketData : AsyncSocketData<false>, WebSocketState<true> {
     /* This guy has a lot of friends - why? */
     template <bool, bool, typename> friend struct WebSocketContext;
-    template <bool, typename> friend struct WebSocketContextData;
+    template <bool, typename, bool> friend struct WebSocketContextData;
     template <bool, bool, typename> friend struct WebSocket;
     template <bool> friend struct HttpContext;
+    template <bool, typename> friend struct TemplatedClientApp;
 private:
-    std::string fragmentBuffer;
+    /* While we have fragments or deflate state */
+    WebSocketSideBlock *sideBlock = nullptr;
+    /* Migrated sockets have theirs from the heap, not from the loop they came from */
+    bool sideBlockFromHeap = false;
     unsigned int controlTipLength = 0;
+    /* A message being handed to the fragment handler piece by piece */
+    bool isStreaming = false;
+    /* Up to 3 bytes of an incomplete Utf-8 sequence carried between pieces */
+    unsigned char utf8TailLength = 0;
+    unsigned char utf8Tail[3];
+    size_t streamedLength = 0;
+    /* Set by reassemble() while in the fragment handler */
+    size_t reassemblyLength = 0;
+    /* Shared with tasks offloaded by this socket, if any */
+    std::shared_ptr<TaskToken> taskToken;
+    /* Given out by getHandle, removed from the registry of the loop as we close */
+    SocketHandle handle;
+    /* Messages (either way) waiting on the compression pool, anything after them waits too */
+    unsigned int offloaded = 0;
     bool isShuttingDown = 0;
+    /* Closed here to go on on another loop, without a close event */
+    bool isMigrating = false;
     bool hasTimedOut = false;
+    /* Idle timeout (ping) and end of lifetime, whichever comes first, on the timing wheel of the loop */
+    TimingWheelNode timer;
+    uint32_t lifetimeDeadline = 0;
     enum CompressionStatus : char {
         DISABLED,
         ENABLED,
         COMPRESSED_FRAME
     } compressionStatus;
 
-    /* We might have a dedicated compressor */
-    DeflationStream *deflationStream = nullptr;
-    /* And / or a dedicated decompressor */
-    InflationStream *inflationStream = nullptr;
+    /* We might have a dedicated compressor, taken from the loop on first use and given back when idle.
+     * Giving it back only costs us our context (the client can always take a fresh start) */
+    CompressOptions compressOptions = CompressOptions::DISABLED;
+    bool dedicatedCompressor = false, dedicatedDecompressor = false;
+    /* Adaptive compression: recent ratio of deflated to raw bytes (in 1024ths) and messages skipped since */
+    unsigned short compressionRatio = 0;
+    unsigned char skippedCompressions = 0;
+    /* And / or a dedicated decompressor, created on first use. The client references its window so it stays */
 
     /* We could be a subscriber */
     Subscriber *subscriber = nullptr;
+    /* And one more for every channel subscribing on its own (see WebSocket::subscribeOnChannel), few if any */
+    std::unique_ptr<std::vector<Subscriber *>> channelSubscribers;
 public:
     WebSocketData(bool perMessageDeflate, CompressOptions compressOptions, BackPressure &&backpressure) : AsyncSocketData<false>(std::move(backpressure)), WebSocketState<true>() {
         compressionStatus = perMessageDeflate ? ENABLED : DISABLED;
 
-        /* Initialize the dedicated sliding window(s) */
+        /* The dedicated sliding window(s) are made once needed */
         if (perMessageDeflate) {
-            if ((compressOptions & CompressOptions::_COMPRESSOR_MASK) != CompressOptions::SHARED_COMPRESSOR) {
-                deflationStream = new DeflationStream(compressOptions);
+            this->compressOptions = compressOptions;
+            dedicatedCompressor = (compressOptions & CompressOptions::_COMPRESSOR_MASK) != CompressOptions::SHARED_COMPRESSOR;
+            dedicatedDecompressor = (compressOptions & CompressOptions::_DECOMPRESSOR_MASK) != CompressOptions::SHARED_DECOMPRESSOR;
+        }
+    }
+
+    /* Moving to another loop: everything but what ties us to this one, being timers, subscriptions,
+     * the cork slice and whatever was offloaded or awaited on this socket */
+    WebSocketData(WebSocketData &&other) : AsyncSocketData<false>(std::move(other.buffer)), WebSocketState<true>(other),
+        controlTipLength(other.controlTipLength), isStreaming(other.isStreaming),
+        utf8TailLength(other.utf8TailLength), streamedLength(other.streamedLength), hasTimedOut(other.hasTimedOut),
+        compressionStatus(other.compressionStatus), compressOptions(other.compressOptions), dedicatedCompressor(other.dedicatedCompressor),
+        dedicatedDecompressor(other.dedicatedDecompressor), compressionRatio(other.compressionRatio), skippedCompressions(other.skippedCompressions) {
+        memcpy(utf8Tail, other.utf8Tail, sizeof(utf8Tail));
+
+        /* A side block of the pool of the loop we leave is given back to it while we are still there */
+        if (other.sideBlock && !other.sideBlockFromHeap) {
+            sideBlock = new WebSocketSideBlock(std::move(*other.sideBlock));
+            other.sideBlock->deflationStream = nullptr;
+            other.sideBlock->inflationStream = nullptr;
+            other.releaseSideBlock(true);
+        } else {
+            sideBlock = other.sideBlock;
+            other.sideBlock = nullptr;
+        }
+        sideBlockFromHeap = sideBlock != nullptr;
+    }
+
+    /* Our side block, taken from the side blocks of loopData if we have none yet */
+    WebSocketSideBlock &getSideBlock(LoopData *loopData) {
+        if (!sideBlock) {
+            if constexpr (sizeof(WebSocketSideBlock) <= LoopData::SIDE_BLOCK_SIZE) {
+                sideBlock = new (loopData->sideBlocks.allocate()) WebSocketSideBlock;
+            } else {
+                sideBlock = new WebSocketSideBlock;
+                sideBlockFromHeap = true;
+            }
+        }
+        return *sideBlock;
+    }
+
+    /* Gives the side block back once nothing is left in it (or right away, as we go) */
+    void releaseSideBlock(bool force = false) {
+        if (sideBlock && (force || sideBlock->empty())) {
+            if (sideBlockFromHeap) {
+                delete sideBlock;
+            } else {
+                sideBlock->~WebSocketSideBlock();
+                SlabPool::free(sideBlock);
             }
-            if ((compressOptions & CompressOptions::_DECOMPRESSOR_MASK) != CompressOptions::SHARED_DECOMPRESSOR) {
-                inflationStream = new InflationStream(compressOptions);
+            sideBlock = nullptr;
+            sideBlockFromHeap = false;
+        }
+    }
+
+    /* Subscriber of channel, nullptr if it has none */
+    Subscriber *getChannelSubscriber(unsigned int channel) {
+        if (channelSubscribers) {
+            for (Subscriber *s : *channelSubscribers) {
+                if (s->channel == channel) {
+                    return s;
+                }
             }
         }
+        return nullptr;
     }
 
-    ~WebSocketData() {
-        if (deflationStream) {
-            delete deflationStream;
+    template <typename TOPICTREE>
+    void freeChannelSubscribers(TOPICTREE *topicTree) {
+        if (channelSubscribers) {
+            for (Subscriber *s : *channelSubscribers) {
+                topicTree->freeSubscriber(s);
+            }
+            channelSubscribers.reset();
         }
+    }
 
-        if (inflationStream) {
-            delete inflationStream;
+    /* The message being reassembled (and control frame, at its tip) */
+    std::string &getFragmentBuffer(LoopData *loopData) {
+        return getSideBlock(loopData).fragmentBuffer;
+    }
+
+    size_t getFragmentLength() {
+        return sideBlock ? sideBlock->fragmentBuffer.length() : 0;
+    }
+
+    /* Done with the fragments, the buffer goes with the side block unless deflate state keeps it */
+    void clearFragments() {
+        if (sideBlock) {
+            sideBlock->fragmentBuffer.clear();
+            releaseSideBlock();
+        }
+    }
+
+    /* Arms the idle timeout in seconds (0 for none), never past the end of our lifetime */
+    void timeout(TimingWheel &timingWheel, unsigned int seconds) {
+        uint32_t deadline = seconds ? timingWheel.getNow() + seconds : lifetimeDeadline;
+        if (lifetimeDeadline && deadline > lifetimeDeadline) {
+            deadline = lifetimeDeadline;
         }
 
-        if (subscriber) {
-            delete subscriber;
+        if (deadline) {
+            timingWheel.arm(&timer, deadline);
+        } else {
+            timingWheel.disarm(&timer);
         }
     }
+
+    DeflationStream *getDeflationStream(LoopData *loopData) {
+        WebSocketSideBlock &sideBlock = getSideBlock(loopData);
+        if (!sideBlock.deflationStream) {
+            sideBlock.deflationStream = loopData->acquireDeflationStream((CompressOptions) (compressOptions & CompressOptions::_COMPRESSOR_MASK));
+        }
+        sideBlock.lastDeflation = loopData->cacheTimepoint;
+        return sideBlock.deflationStream;
+    }
+
+    InflationStream *getInflationStream(LoopData *loopData) {
+        WebSocketSideBlock &sideBlock = getSideBlock(loopData);
+        if (!sideBlock.inflationStream) {
+            sideBlock.inflationStream = new InflationStream(compressOptions);
+        }
+        return sideBlock.inflationStream;
+    }
+
+    /* Skip what looks incompressible, and everything while deflate has not been paying off
+     * (except every 16th message, to notice when it would again) */
+    bool skipCompression(std::string_view message) {
+        if (looksIncompressible(message)) {
+            return true;
+        }
+        return compressionRatio >= 1000 && (++skippedCompressions & 15);
+    }
+
+    void observeCompression(size_t rawLength, size_t deflatedLength) {
+        unsigned int ratio = (unsigned int) std::min<size_t>(deflatedLength * 1024 / rawLength, 4096);
+        compressionRatio = (unsigned short) ((compressionRatio * 3u + ratio) / 4);
+    }
+
+    /* Gives the dedicated compressor back to the loop if unused for idleSeconds (or right away for 0) */
+    void releaseDeflationStream(LoopData *loopData, unsigned int idleSeconds = 0) {
+        if (sideBlock && sideBlock->deflationStream && loopData->cacheTimepoint - sideBlock->lastDeflation >= (time_t) idleSeconds) {
+            loopData->releaseDeflationStream(sideBlock->deflationStream);
+            sideBlock->deflationStream = nullptr;
+            releaseSideBlock();
+        }
+    }
+
+    ~WebSocketData() {
+        if (taskToken) {
+            taskToken->cancelled.store(true, std::memory_order_relaxed);
+        }
+
+        releaseSideBlock(true);
+
+        /* Our subscribers are cells of the TopicTree, freed through it before we go (see on_close) */
+    }
 };
 
 }
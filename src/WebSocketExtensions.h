@@ -27,7 +27,9 @@
 /* We forbid negotiating 8 windowBits since Zlib has a bug with this */
 // #define UWS_ALLOW_8_WINDOW_BITS
 
+#include <charconv>
 #include <climits>
+#include <cstring>
 #include <cctype>
 #include <string>
 #include <string_view>
@@ -150,8 +152,17 @@ static inline std::tuple<bool, int, int, std::string_view> negotiateCompression(
 
     ExtensionsParser ep(offer.data(), offer.length());
 
-    static thread_local std::string response;
-    response = "";
+    /* The longest is permessage-deflate with both window bits, built in place without any std::string */
+    static thread_local char response[96];
+    size_t responseLength = 0;
+    auto append = [&responseLength](std::string_view piece) {
+        memcpy(response + responseLength, piece.data(), piece.length());
+        responseLength += piece.length();
+    };
+    auto appendWindowBits = [&responseLength](std::string_view key, int windowBits) {
+        memcpy(response + responseLength, key.data(), key.length());
+        responseLength = (size_t) (std::to_chars(response + responseLength + key.length(), response + sizeof(response), windowBits).ptr - response);
+    };
 
     int compressionWindow = wantedCompressionWindow;
     int inflationWindow = wantedInflationWindow;
@@ -160,7 +171,7 @@ static inline std::tuple<bool, int, int, std::string_view> negotiateCompression(
     if (ep.xWebKitDeflateFrame) {
         /* We now have compression */
         compression = true;
-        response = "x-webkit-deflate-frame";
+        append("x-webkit-deflate-frame");
 
         /* If the other peer has DEMANDED us no sliding window,
          * we cannot compress with anything other than shared compressor */
@@ -190,15 +201,15 @@ static inline std::tuple<bool, int, int, std::string_view> negotiateCompression(
         /* We decide our own inflation sliding window (and their compression sliding window) */
         if (wantedInflationWindow < 15) {
             if (!wantedInflationWindow) {
-                response += "; no_context_takeover";
+                append("; no_context_takeover");
             } else {
-                response += "; max_window_bits=" + std::to_string(wantedInflationWindow);
+                appendWindowBits("; max_window_bits=", wantedInflationWindow);
             }
         }
     } else if (ep.perMessageDeflate) {
         /* We now have compression */
         compression = true;
-        response = "permessage-deflate";
+        append("permessage-deflate");
 
         if (ep.clientNoContextTakeover) {
             inflationWindow = 0;
@@ -209,10 +220,10 @@ static inline std::tuple<bool, int, int, std::string_view> negotiateCompression(
         /* Whatever we have now, write */
         if (inflationWindow < 15) {
             if (!inflationWindow || !ep.clientMaxWindowBits) {
-                response += "; client_no_context_takeover";
+                append("; client_no_context_takeover");
                 inflationWindow = 0;
             } else {
-                response += "; client_max_window_bits=" + std::to_string(inflationWindow);
+                appendWindowBits("; client_max_window_bits=", inflationWindow);
             }
         }
 
@@ -236,9 +247,9 @@ static inline std::tuple<bool, int, int, std::string_view> negotiateCompression(
         /* Whatever we have now, write */
         if (compressionWindow < 15) {
             if (!compressionWindow) {
-                response += "; server_no_context_takeover";
+                append("; server_no_context_takeover");
             } else {
-                response += "; server_max_window_bits=" + std::to_string(compressionWindow);
+                appendWindowBits("; server_max_window_bits=", compressionWindow);
             }
         }
     }
@@ -248,7 +259,7 @@ static inline std::tuple<bool, int, int, std::string_view> negotiateCompression(
         return {false, 0, 0, ""};
     }
 
-    return {compression, compressionWindow, inflationWindow, response};
+    return {compression, compressionWindow, inflationWindow, std::string_view(response, responseLength)};
 }
 
 }
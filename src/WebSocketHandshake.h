@@ -20,6 +20,22 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
+
+/* Hardware SHA1 unless UWS_NO_SHA1_INTRINSICS: SHA-NI picked at runtime on x86, ARMv8 crypto when built for it */
+#ifndef UWS_NO_SHA1_INTRINSICS
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define UWS_SHA1_SHANI
+#include <immintrin.h>
+#include <cpuid.h>
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#define UWS_SHA1_ARMV8
+#include <arm_neon.h>
+#endif
+#if defined(UWS_SHA1_SHANI) || defined(UWS_SHA1_ARMV8)
+#define UWS_SHA1_HARDWARE
+#endif
+#endif
 
 namespace uWS {
 
@@ -112,22 +128,123 @@ struct WebSocketHandshake {
         *dst++ = '=';
     }
 
-public:
-    static inline void generate(const char input[24], char output[28]) {
-        uint32_t b_output[5] = {
-            0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
-        };
-        uint32_t b_input[16] = {
-            0, 0, 0, 0, 0, 0, 0x32353845, 0x41464135, 0x2d453931, 0x342d3437, 0x44412d39,
+#ifdef UWS_SHA1_SHANI
+    /* Four rounds per step, E alternating between two registers. The schedule runs three steps ahead. N blocks
+     * go side by side, hiding the latency of each round in the others */
+    template <int g, size_t N>
+    __attribute__((target("sha,sse4.1"))) static inline void shaNiRounds(__m128i abcd[N], __m128i e0[N], __m128i e1[N], __m128i msg[N][4]) {
+        for (size_t n = 0; n < N; n++) {
+            __m128i &e = g % 2 ? e1[n] : e0[n], &next = g % 2 ? e0[n] : e1[n];
+            if constexpr (g == 0) {
+                e = _mm_add_epi32(e, msg[n][0]);
+            } else {
+                e = _mm_sha1nexte_epu32(e, msg[n][g % 4]);
+            }
+            next = abcd[n];
+            if constexpr (g >= 3 && g <= 18) {
+                msg[n][(g + 1) % 4] = _mm_sha1msg2_epu32(msg[n][(g + 1) % 4], msg[n][g % 4]);
+            }
+            abcd[n] = _mm_sha1rnds4_epu32(abcd[n], e, g / 5);
+            if constexpr (g >= 1 && g <= 16) {
+                msg[n][(g + 3) % 4] = _mm_sha1msg1_epu32(msg[n][(g + 3) % 4], msg[n][g % 4]);
+            }
+            if constexpr (g >= 2 && g <= 17) {
+                msg[n][(g + 2) % 4] = _mm_xor_si128(msg[n][(g + 2) % 4], msg[n][g % 4]);
+            }
+        }
+        if constexpr (g < 19) {
+            shaNiRounds<g + 1, N>(abcd, e0, e1, msg);
+        }
+    }
+
+    /* Same as sha1 for N blocks, hash is h0 to h4 and b the words of the block */
+    template <size_t N>
+    __attribute__((target("sha,sse4.1"))) static inline void sha1ShaNi(uint32_t *const hash[N], const uint32_t *const b[N]) {
+        __m128i abcd[N], abcdSaved[N], e0[N], e0Saved[N], e1[N], msg[N][4];
+        for (size_t n = 0; n < N; n++) {
+            abcd[n] = abcdSaved[n] = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) hash[n]), 0x1b);
+            e0[n] = e0Saved[n] = _mm_set_epi32((int) hash[n][4], 0, 0, 0);
+            for (int i = 0; i < 4; i++) {
+                msg[n][i] = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) b[n] + i), 0x1b);
+            }
+        }
+        shaNiRounds<0, N>(abcd, e0, e1, msg);
+        for (size_t n = 0; n < N; n++) {
+            e0[n] = _mm_sha1nexte_epu32(e0[n], e0Saved[n]);
+            _mm_storeu_si128((__m128i *) hash[n], _mm_shuffle_epi32(_mm_add_epi32(abcd[n], abcdSaved[n]), 0x1b));
+            hash[n][4] = (uint32_t) _mm_extract_epi32(e0[n], 3);
+        }
+    }
+#endif
+
+#ifdef UWS_SHA1_ARMV8
+    /* Same as sha1 for N blocks side by side, hash is h0 to h4 and b the words of the block */
+    template <size_t N>
+    static inline void sha1ArmV8(uint32_t *const hash[N], const uint32_t *const b[N]) {
+        const uint32_t k[4] = {0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6};
+        uint32x4_t abcd[N], abcdSaved[N], msg[N][4];
+        uint32_t e[N];
+        for (size_t n = 0; n < N; n++) {
+            abcd[n] = abcdSaved[n] = vld1q_u32(hash[n]);
+            e[n] = hash[n][4];
+            for (int i = 0; i < 4; i++) {
+                msg[n][i] = vld1q_u32(b[n] + 4 * i);
+            }
+        }
+        for (int g = 0; g < 20; g++) {
+            for (size_t n = 0; n < N; n++) {
+                if (g >= 4) {
+                    msg[n][g % 4] = vsha1su1q_u32(vsha1su0q_u32(msg[n][g % 4], msg[n][(g + 1) % 4], msg[n][(g + 2) % 4]), msg[n][(g + 3) % 4]);
+                }
+                uint32x4_t wk = vaddq_u32(msg[n][g % 4], vdupq_n_u32(k[g / 5]));
+                uint32_t nextE = vsha1h_u32(vgetq_lane_u32(abcd[n], 0));
+                if (g < 5) {
+                    abcd[n] = vsha1cq_u32(abcd[n], e[n], wk);
+                } else if (g >= 10 && g < 15) {
+                    abcd[n] = vsha1mq_u32(abcd[n], e[n], wk);
+                } else {
+                    abcd[n] = vsha1pq_u32(abcd[n], e[n], wk);
+                }
+                e[n] = nextE;
+            }
+        }
+        for (size_t n = 0; n < N; n++) {
+            vst1q_u32(hash[n], vaddq_u32(abcd[n], abcdSaved[n]));
+            hash[n][4] += e[n];
+        }
+    }
+#endif
+
+    /* Whether sha1 runs in hardware */
+    static inline bool hasHardwareSha1() {
+#if defined(UWS_SHA1_SHANI)
+        static const bool shaNi = [] {
+            unsigned int a, b, c, d;
+            return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_1) && __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_SHA);
+        }();
+        return shaNi;
+#elif defined(UWS_SHA1_ARMV8)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /* The first block is the key, the GUID and padding. The second one is only the length of them */
+    static inline void loadKey(const char input[24], uint32_t b_input[16]) {
+        static const uint32_t guid[10] = {
+            0x32353845, 0x41464135, 0x2d453931, 0x342d3437, 0x44412d39,
             0x3543412d, 0x43354142, 0x30444338, 0x35423131, 0x80000000
         };
-
         for (int i = 0; i < 6; i++) {
             b_input[i] = (uint32_t) ((input[4 * i + 3] & 0xff) | (input[4 * i + 2] & 0xff) << 8 | (input[4 * i + 1] & 0xff) << 16 | (input[4 * i + 0] & 0xff) << 24);
         }
-        sha1(b_output, b_input);
-        uint32_t last_b[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 480};
-        sha1(b_output, last_b);
+        for (int i = 0; i < 10; i++) {
+            b_input[6 + i] = guid[i];
+        }
+    }
+
+    static inline void finish(uint32_t b_output[5], char output[28]) {
         for (int i = 0; i < 5; i++) {
             uint32_t tmp = b_output[i];
             char *bytes = (char *) &b_output[i];
@@ -138,6 +255,74 @@ public:
         }
         base64((unsigned char *) b_output, output);
     }
+
+#ifdef UWS_SHA1_HARDWARE
+    /* N keys in hardware, side by side */
+    template <size_t N>
+    static inline void generateHardware(const char *const inputs[N], char (*outputs)[28]) {
+        uint32_t b_output[N][5], b_input[N][16], last_b[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 480};
+        uint32_t *hash[N];
+        const uint32_t *first[N], *last[N];
+        for (size_t n = 0; n < N; n++) {
+            const uint32_t initial[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+            memcpy(b_output[n], initial, sizeof(initial));
+            loadKey(inputs[n], b_input[n]);
+            hash[n] = b_output[n];
+            first[n] = b_input[n];
+            last[n] = last_b;
+        }
+#if defined(UWS_SHA1_SHANI)
+        sha1ShaNi<N>(hash, first);
+        sha1ShaNi<N>(hash, last);
+#elif defined(UWS_SHA1_ARMV8)
+        sha1ArmV8<N>(hash, first);
+        sha1ArmV8<N>(hash, last);
+#endif
+        for (size_t n = 0; n < N; n++) {
+            finish(b_output[n], outputs[n]);
+        }
+    }
+#endif
+
+    /* Portable, as it always was */
+    static inline void generatePortable(const char input[24], char output[28]) {
+        uint32_t b_output[5] = {
+            0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+        };
+        uint32_t b_input[16];
+        loadKey(input, b_input);
+        sha1(b_output, b_input);
+        uint32_t last_b[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 480};
+        sha1(b_output, last_b);
+        finish(b_output, output);
+    }
+
+public:
+    static inline void generate(const char input[24], char output[28]) {
+#ifdef UWS_SHA1_HARDWARE
+        if (hasHardwareSha1()) {
+            generateHardware<1>(&input, (char (*)[28]) output);
+            return;
+        }
+#endif
+        generatePortable(input, output);
+    }
+
+    /* Several keys at once (say, a reconnect storm), in hardware LANES of them side by side */
+    static constexpr int LANES = 4;
+    static inline void generate(const char *const inputs[], char (*outputs)[28], size_t count) {
+        size_t i = 0;
+#ifdef UWS_SHA1_HARDWARE
+        if (hasHardwareSha1()) {
+            for (; i + LANES <= count; i += LANES) {
+                generateHardware<LANES>(inputs + i, outputs + i);
+            }
+        }
+#endif
+        for (; i < count; i++) {
+            generate(inputs[i], outputs[i]);
+        }
+    }
 };
 
 }
@@ -20,11 +20,20 @@
 
 #include <libusockets.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <cstdlib>
 #include <string_view>
 
+#if defined(__AVX2__) || defined(__AVX512F__) || defined(__SSSE3__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace uWS {
 
 /* We should not overcomplicate these */
@@ -45,6 +54,12 @@ enum OpCode : unsigned char {
     PONG = 10
 };
 
+/* One of the messages of a read, as handed over all together (see messages of WebSocketBehavior) */
+struct WebSocketMessage {
+    std::string_view message;
+    OpCode opCode;
+};
+
 enum {
     CLIENT,
     SERVER
@@ -163,7 +178,7 @@ T cond_byte_swap(T value) {
 // Optimized for predominantly 7-bit content by Alex Hultman, 2016
 // Licensed as Zlib, like the rest of this project
 // This runs about 40% faster than simdutf with g++ -mavx
-static bool isValidUtf8(unsigned char *s, size_t length)
+static bool isValidUtf8Scalar(unsigned char *s, size_t length)
 {
     for (unsigned char *e = s + length; s != e; ) {
         if (s + 16 <= e) {
@@ -205,6 +220,187 @@ static bool isValidUtf8(unsigned char *s, size_t length)
     return true;
 }
 
+#if defined(__SSSE3__) || defined(__aarch64__)
+/* Lookup based validation of 16 bytes at a time, after "Validating UTF-8 In Less Than One Instruction Per Byte"
+ * (Keiser, Lemire) as used by simdjson and simdutf. Three nibble lookups over each pair of bytes flag every
+ * invalid 2 byte combination, and what is left is whether continuations come where leads said they would */
+namespace utf8 {
+
+#if defined(__SSSE3__)
+typedef __m128i Vector;
+static inline Vector load(const void *p) {return _mm_loadu_si128((const __m128i *) p);}
+static inline Vector splat(uint8_t c) {return _mm_set1_epi8((char) c);}
+static inline Vector lookup(Vector table, Vector nibbles) {return _mm_shuffle_epi8(table, nibbles);}
+static inline Vector high(Vector v) {return _mm_and_si128(_mm_srli_epi16(v, 4), splat(0x0f));}
+static inline Vector low(Vector v) {return _mm_and_si128(v, splat(0x0f));}
+static inline Vector vand(Vector a, Vector b) {return _mm_and_si128(a, b);}
+static inline Vector vor(Vector a, Vector b) {return _mm_or_si128(a, b);}
+static inline Vector vxor(Vector a, Vector b) {return _mm_xor_si128(a, b);}
+static inline Vector subtract(Vector a, Vector b) {return _mm_subs_epu8(a, b);}
+static inline bool any(Vector v) {return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;}
+static inline bool ascii(Vector v) {return !_mm_movemask_epi8(v);}
+/* The input as if shifted N bytes later in the stream, with the end of previous in front */
+template <int N> static inline Vector prev(Vector input, Vector previous) {return _mm_alignr_epi8(input, previous, 16 - N);}
+#else
+typedef uint8x16_t Vector;
+static inline Vector load(const void *p) {return vld1q_u8((const uint8_t *) p);}
+static inline Vector splat(uint8_t c) {return vdupq_n_u8(c);}
+static inline Vector lookup(Vector table, Vector nibbles) {return vqtbl1q_u8(table, nibbles);}
+static inline Vector high(Vector v) {return vshrq_n_u8(v, 4);}
+static inline Vector low(Vector v) {return vandq_u8(v, splat(0x0f));}
+static inline Vector vand(Vector a, Vector b) {return vandq_u8(a, b);}
+static inline Vector vor(Vector a, Vector b) {return vorrq_u8(a, b);}
+static inline Vector vxor(Vector a, Vector b) {return veorq_u8(a, b);}
+static inline Vector subtract(Vector a, Vector b) {return vqsubq_u8(a, b);}
+static inline bool any(Vector v) {return vmaxvq_u8(v) != 0;}
+static inline bool ascii(Vector v) {return vmaxvq_u8(v) < 0x80;}
+template <int N> static inline Vector prev(Vector input, Vector previous) {return vextq_u8(previous, input, 16 - N);}
+#endif
+
+/* Invalid combinations of a byte (its high and low nibble) and the byte after it (its high nibble) */
+enum : uint8_t {
+    TOO_SHORT = 1 << 0, /* 11______ 0_______ or 11______ 11______ */
+    TOO_LONG = 1 << 1, /* 0_______ 10______ */
+    OVERLONG_3 = 1 << 2, /* 11100000 100_____ */
+    TOO_LARGE = 1 << 3, /* 11110100 1001____ or 11110100 101_____ or 11110101+ */
+    SURROGATE = 1 << 4, /* 11101101 101_____ */
+    OVERLONG_2 = 1 << 5, /* 1100000_ 10______ */
+    TOO_LARGE_1000 = 1 << 6, /* 11110101+ 1000____ */
+    OVERLONG_4 = 1 << 6, /* 11110000 1000____ */
+    TWO_CONTS = 1 << 7, /* 10______ 10______, fine if it is the 3rd or 4th byte */
+    CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS
+};
+
+alignas(16) static const uint8_t byte1High[16] = {
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+alignas(16) static const uint8_t byte1Low[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+alignas(16) static const uint8_t byte2High[16] = {
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+/* Anything above these in the last 3 bytes is a lead wanting more bytes */
+alignas(16) static const uint8_t incompleteMax[16] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1
+};
+
+static inline Vector check(Vector input, Vector previous) {
+    Vector prev1 = prev<1>(input, previous);
+    Vector special = vand(vand(lookup(load(byte1High), high(prev1)), lookup(load(byte1Low), low(prev1))), lookup(load(byte2High), high(input)));
+
+    /* Only 111_____ two bytes before, or 1111____ three bytes before, come out with the high bit set */
+    Vector thirdByte = subtract(prev<2>(input, previous), splat(0xe0 - 0x80));
+    Vector fourthByte = subtract(prev<3>(input, previous), splat(0xf0 - 0x80));
+    return vxor(vand(vor(thirdByte, fourthByte), splat(0x80)), special);
+}
+
+static inline bool isValid(const unsigned char *s, size_t length) {
+    Vector previous = splat(0), error = splat(0);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        Vector input = load(s + i);
+        if (ascii(input)) {
+            error = vor(error, subtract(previous, load(incompleteMax)));
+        } else {
+            error = vor(error, check(input, previous));
+        }
+        previous = input;
+    }
+
+    /* The tail is padded with ASCII, which also catches anything left incomplete */
+    alignas(16) unsigned char tail[16] = {};
+    memcpy(tail, s + i, length - i);
+    error = vor(error, check(load(tail), previous));
+    error = vor(error, subtract(load(tail), load(incompleteMax)));
+    return !any(error);
+}
+
+}
+#endif
+
+static inline bool isValidUtf8(unsigned char *s, size_t length) {
+#if defined(__SSSE3__) || defined(__aarch64__)
+    return utf8::isValid(s, length);
+#else
+    return isValidUtf8Scalar(s, length);
+#endif
+}
+
+/* How many bytes at the end form the start of a sequence continuing past length */
+static inline size_t incompleteUtf8Tail(const unsigned char *s, size_t length) {
+    for (size_t i = 1; i <= 3 && i <= length; i++) {
+        unsigned char c = s[length - i];
+        if ((c & 0xc0) != 0x80) {
+            size_t needed = c >= 0xf0 ? 4 : (c >= 0xe0 ? 3 : (c >= 0xc0 ? 2 : 1));
+            return needed > i ? i : 0;
+        }
+    }
+    return 0;
+}
+
+/* Validates a message arriving in pieces. A sequence cut by the end of a piece is carried
+ * in tail (at most 3 bytes) and checked once completed by the next one */
+static inline bool isValidUtf8Piece(unsigned char *tail, unsigned char &tailLength, unsigned char *s, size_t length, bool last) {
+    if (tailLength) {
+        size_t needed = tail[0] >= 0xf0 ? 4 : (tail[0] >= 0xe0 ? 3 : 2);
+        size_t take = std::min<size_t>(needed - tailLength, length);
+
+        unsigned char sequence[4];
+        memcpy(sequence, tail, tailLength);
+        memcpy(sequence + tailLength, s, take);
+
+        if (tailLength + take < needed) {
+            memcpy(tail + tailLength, s, take);
+            tailLength = (unsigned char) (tailLength + take);
+            return !last;
+        }
+
+        if (!isValidUtf8(sequence, needed)) {
+            return false;
+        }
+        s += take;
+        length -= take;
+        tailLength = 0;
+    }
+
+    size_t incomplete = last ? 0 : incompleteUtf8Tail(s, length);
+    if (!isValidUtf8(s, length - incomplete)) {
+        return false;
+    }
+    memcpy(tail, s + length - incomplete, incomplete);
+    tailLength = (unsigned char) incomplete;
+    return true;
+}
+
 struct CloseFrame {
     uint16_t code;
     char *message;
@@ -248,6 +444,43 @@ static inline size_t formatClosePayload(char *dst, uint16_t code, const char *me
     return 0;
 }
 
+/* Channels multiplex one WebSocket (see WebSocket::sendOnChannel): every message of a channel is binary and begins
+ * with CHANNEL_MARKER, which no UTF-8 text has, then its number as a varint, one byte for channels up to 127 and two
+ * up to MAX_CHANNEL, low 7 bits first. Binary messages of other kinds must not begin with CHANNEL_MARKER */
+static const unsigned char CHANNEL_MARKER = 0xff;
+static const unsigned int MAX_CHANNEL = 16383;
+static const size_t MAX_CHANNEL_HEADER = 3;
+
+static inline size_t formatChannelHeader(char *dst, unsigned int channel) {
+    dst[0] = (char) CHANNEL_MARKER;
+    if (channel < 128) {
+        dst[1] = (char) channel;
+        return 2;
+    }
+    dst[1] = (char) (0x80 | (channel & 0x7f));
+    dst[2] = (char) (channel >> 7);
+    return 3;
+}
+
+/* Takes the header off message. False if it has none, or one longer than it needs to be */
+static inline bool parseChannelHeader(std::string_view &message, unsigned int &channel) {
+    if (message.length() < 2 || (unsigned char) message[0] != CHANNEL_MARKER) {
+        return false;
+    }
+    unsigned char first = (unsigned char) message[1];
+    if (first < 128) {
+        channel = first;
+        message.remove_prefix(2);
+        return true;
+    }
+    if (message.length() < 3 || (unsigned char) message[2] >= 128 || !message[2]) {
+        return false;
+    }
+    channel = (first & 0x7fu) | ((unsigned int) (unsigned char) message[2] << 7);
+    message.remove_prefix(3);
+    return true;
+}
+
 static inline size_t messageFrameSize(size_t messageSize) {
     if (messageSize < 126) {
         return 2 + messageSize;
@@ -340,12 +573,50 @@ protected:
         data[N - 1] ^= mask[(N - 1) % 4];
     }
 
+    /* XORs the 4 byte mask (as loaded from memory) over src into dst, which is src or lies before it, in blocks of the
+     * widest vector we are compiled for. Returns how many bytes were done, a multiple of the block size never past length */
+    static inline unsigned int unmaskVector(char *dst, const char *src, unsigned int length, uint32_t mask) {
+        unsigned int i = 0;
+#if defined(__AVX512F__)
+        __m512i vectorMask = _mm512_set1_epi32((int) mask);
+        for (; i + 64 <= length; i += 64) {
+            _mm512_storeu_si512((void *) (dst + i), _mm512_xor_si512(_mm512_loadu_si512((const void *) (src + i)), vectorMask));
+        }
+#elif defined(__AVX2__)
+        __m256i vectorMask = _mm256_set1_epi32((int) mask);
+        for (; i + 32 <= length; i += 32) {
+            _mm256_storeu_si256((__m256i *) (dst + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (src + i)), vectorMask));
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        __m128i vectorMask = _mm_set1_epi32((int) mask);
+        for (; i + 16 <= length; i += 16) {
+            _mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *) (src + i)), vectorMask));
+        }
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+        uint8x16_t vectorMask = vreinterpretq_u8_u32(vdupq_n_u32(mask));
+        for (; i + 16 <= length; i += 16) {
+            vst1q_u8((uint8_t *) (dst + i), veorq_u8(vld1q_u8((const uint8_t *) (src + i)), vectorMask));
+        }
+#else
+        (void) dst;
+        (void) src;
+        (void) length;
+        (void) mask;
+#endif
+        return i;
+    }
+
     /*
     unmaskImprecise8 函数的作用是对给定的数据进行掩码解码操作，使用一个固定的 64 位掩码。这个函数通过一次处理 8 个字节的方式来提高效率，
     适用于需要高性能处理大量数据的场景。函数的模板参数 DESTINATION 用于控制解码后的数据写入的位置。
     */
     template <int DESTINATION>
     static inline void unmaskImprecise8(char *src, uint64_t mask, unsigned int length) {
+        /* Both halves of the mask are the same, so either will do */
+        unsigned int vectorized = unmaskVector(src - DESTINATION, src, length, (uint32_t) mask);
+        src += vectorized;
+        length -= vectorized;
+
         /*unsigned int n = (length >> 3) + 1：计算需要处理的 8 字节块的数量。length >> 3 相当于 length / 8，加 1 是为了确保处理所有数据，即使 length 不是 8 的倍数。*/
         for (unsigned int n = (length >> 3) + 1; n; n--) {
             uint64_t loaded;
@@ -407,6 +678,11 @@ protected:
     这个函数通过逐字节地对数据进行异或操作来实现解码，并且在原地修改数据，不使用额外的缓冲区
     */
     static inline void unmaskInplace(char *data, char *stop, char *mask) {
+        if (data < stop) {
+            uint32_t maskInt;
+            memcpy(&maskInt, mask, 4);
+            data += unmaskVector(data, data, (unsigned int) (stop - data), maskInt);
+        }
         while (data < stop) {
             *(data++) ^= mask[0];
             *(data++) ^= mask[1];
@@ -524,7 +800,9 @@ protected:
     // 函数通过循环遍历整个数据缓冲区，并每次处理16个字节的数据块。对于每个数据块，调用UnrolledXor模板函数来进行解掩码操作。
     // 这里假设 LIBUS_RECV_BUFFER_LENGTH 是一个预定义的宏，代表接收缓冲区的长度。
     static inline void unmaskAll(char * __restrict data, char * __restrict mask) {
-        for (int i = 0; i < LIBUS_RECV_BUFFER_LENGTH; i += 16) {
+        uint32_t maskInt;
+        memcpy(&maskInt, mask, 4);
+        for (int i = (int) unmaskVector(data, data, LIBUS_RECV_BUFFER_LENGTH, maskInt); i < LIBUS_RECV_BUFFER_LENGTH; i += 16) {
             UnrolledXor<16>(data + i, mask);
         }
     }
@@ -0,0 +1,266 @@
+#include <iostream>
+#include <cassert>
+#include <string>
+
+#include "../src/AsyncSocketData.h"
+
+/* Drains up to max bytes like a socket would, returning what was written */
+std::string drain(uWS::BackPressure &backPressure, size_t max) {
+    std::string written;
+    std::string_view segments[2];
+    unsigned int numSegments = backPressure.segments(segments, 2);
+    for (unsigned int i = 0; i < numSegments && written.length() < max; i++) {
+        written.append(segments[i].substr(0, max - written.length()));
+    }
+    backPressure.erase(written.length());
+    return written;
+}
+
+int main() {
+    {
+        /* Appends spanning many blocks come out in order, whatever size we drain in */
+        std::string expected;
+        for (int i = 0; i < 100000; i++) {
+            expected += std::to_string(i) + ",";
+        }
+
+        for (size_t step : {1u, 7u, 4096u, 16384u, 100000u}) {
+            uWS::BackPressure backPressure;
+            for (size_t offset = 0; offset < expected.length(); offset += 1000) {
+                std::string_view part = std::string_view(expected).substr(offset, 1000);
+                backPressure.append(part.data(), part.length());
+            }
+            assert(backPressure.length() == expected.length());
+
+            std::string received;
+            while (backPressure.length()) {
+                received += drain(backPressure, step);
+                assert(backPressure.length() + received.length() == expected.length());
+                assert(backPressure.totalLength() == backPressure.length());
+            }
+            assert(received == expected);
+        }
+    }
+
+    {
+        /* Allocations are contiguous, also when larger than a block */
+        uWS::BackPressure backPressure;
+        backPressure.append("head", 4);
+        char *small = backPressure.allocate(5);
+        memcpy(small, "small", 5);
+        char *large = backPressure.allocate(100000);
+        memset(large, 'L', 100000);
+        backPressure.append("tail", 4);
+
+        std::string received;
+        while (backPressure.length()) {
+            received += drain(backPressure, 65536);
+        }
+        assert(received == "headsmall" + std::string(100000, 'L') + "tail");
+    }
+
+    {
+        /* Moving leaves the source empty, clearing releases everything */
+        uWS::BackPressure backPressure;
+        backPressure.append("some data", 9);
+        uWS::BackPressure moved(std::move(backPressure));
+        assert(backPressure.length() == 0 && moved.length() == 9);
+        std::string_view segment;
+        assert(backPressure.segments(&segment, 1) == 0);
+        moved.clear();
+        assert(moved.length() == 0);
+        moved.append("again", 5);
+        assert(drain(moved, 100) == "again");
+    }
+
+    {
+        /* Shared buffers are queued by reference, on many queues, and released once all are drained */
+        static std::string memory(50000, 'S');
+        int deleted = 0;
+        {
+            uWS::SharedBuffer shared(memory.data(), memory.length(), [&deleted](const char *data, size_t length) {
+                assert(data == memory.data() && length == memory.length());
+                deleted++;
+            });
+
+            uWS::BackPressure first, second;
+            first.append("header", 6);
+            first.append(shared, 0);
+            second.append(shared, 1000);
+            second.append("tail", 4);
+            assert(first.length() == 6 + memory.length() && second.length() == memory.length() - 1000 + 4);
+
+            /* Not copied */
+            std::string_view segments[2];
+            assert(first.segments(segments, 2) == 2 && segments[1].data() == memory.data());
+
+            shared = uWS::SharedBuffer();
+            assert(!deleted);
+
+            std::string received;
+            while (first.length()) {
+                received += drain(first, 4096);
+            }
+            assert(received == "header" + memory && !deleted);
+
+            received.clear();
+            while (second.length()) {
+                received += drain(second, 3000);
+            }
+            assert(received == memory.substr(1000) + "tail");
+            assert(deleted == 1);
+        }
+
+        /* Copies own their memory, clearing drops the reference */
+        uWS::SharedBuffer copy = uWS::SharedBuffer::copy("copied");
+        uWS::BackPressure backPressure;
+        backPressure.append(copy, 2);
+        uWS::SharedBuffer other = copy;
+        copy = uWS::SharedBuffer();
+        assert(other.view() == "copied" && copy.length() == 0);
+        assert(drain(backPressure, 100) == "pied");
+        backPressure.append(other, 0);
+        backPressure.clear();
+    }
+
+    {
+        /* Every queue is accounted for in the budget of this thread, and in steps in that of the process */
+        uWS::BackPressureBudget &budget = uWS::BackPressureBudget::get();
+        size_t bytesBefore = budget.loopBytes, queuesBefore = budget.loopQueues;
+        long long processBefore = (long long) uWS::BackPressureBudget::processBytes.load() + budget.processDelta;
+        {
+            uWS::BackPressure first, second;
+            first.append(std::string(1000, 'a').data(), 1000);
+            second.allocate(3000);
+            second.append(uWS::SharedBuffer::copy(std::string(100000, 'b')), 0);
+            assert(budget.loopBytes == bytesBefore + 104000 && budget.loopQueues == queuesBefore + 2);
+            assert(budget.average() == budget.loopBytes / budget.loopQueues);
+            assert((long long) uWS::BackPressureBudget::processBytes.load() > processBefore);
+
+            first.erase(1000);
+            assert(budget.loopBytes == bytesBefore + 103000 && budget.loopQueues == queuesBefore + 1);
+
+            uWS::BackPressure moved(std::move(second));
+            assert(budget.loopBytes == bytesBefore + 103000 && budget.loopQueues == queuesBefore + 1);
+        }
+        assert(budget.loopBytes == bytesBefore && budget.loopQueues == queuesBefore);
+        assert((long long) uWS::BackPressureBudget::processBytes.load() + budget.processDelta == processBefore);
+    }
+
+    {
+        /* The cork buffer is resized within bounds, once nothing is corked */
+        uWS::LoopData loopData;
+        assert(loopData.corkBufferSize == uWS::LoopData::CORK_BUFFER_SIZE);
+        loopData.setCorkBufferSize(100);
+        assert(loopData.corkBufferSize == uWS::LoopData::MIN_CORK_BUFFER_SIZE);
+
+        loopData.corkedSocket = &loopData;
+        loopData.setCorkBufferSize(40 * 1024);
+        assert(loopData.corkBufferSize == uWS::LoopData::MIN_CORK_BUFFER_SIZE);
+        loopData.corkedSocket = nullptr;
+        loopData.resizeCorkBuffer();
+        assert(loopData.corkBufferSize == 40 * 1024);
+        memset(loopData.corkBuffer, 0, loopData.corkBufferSize);
+
+        /* Adapting follows the largest message of every window */
+        loopData.maxAdaptiveCorkBufferSize = 256 * 1024;
+        loopData.minAdaptiveCorkBufferSize = uWS::LoopData::MIN_CORK_BUFFER_SIZE;
+        for (unsigned int i = 0; i < uWS::LoopData::CORK_ADAPT_WINDOW; i++) {
+            loopData.observeMessage(i == 10 ? 30000 : 100);
+        }
+        loopData.resizeCorkBuffer();
+        assert(loopData.corkBufferSize == 32 * 1024);
+        for (unsigned int i = 0; i < uWS::LoopData::CORK_ADAPT_WINDOW; i++) {
+            loopData.observeMessage(i == 10 ? 1000000 : 100);
+        }
+        loopData.resizeCorkBuffer();
+        assert(loopData.corkBufferSize == 256 * 1024);
+        for (unsigned int i = 0; i < uWS::LoopData::CORK_ADAPT_WINDOW; i++) {
+            loopData.observeMessage(100);
+        }
+        loopData.resizeCorkBuffer();
+        assert(loopData.corkBufferSize == uWS::LoopData::MIN_CORK_BUFFER_SIZE);
+    }
+
+    {
+        /* Coalesced slices are held until due, others are flushed after every iteration */
+        uWS::LoopData loopData;
+        static int flushed;
+        flushed = 0;
+        int socket;
+        auto flush = [](void *) { flushed++; };
+
+        uWS::CorkSlice *now = loopData.acquireCorkSlice(&socket, flush);
+        uWS::CorkSlice *later = loopData.acquireCorkSlice(&socket, flush);
+        later->deadline = uWS::LoopData::now() + 60000000;
+        uWS::CorkSlice *due = loopData.acquireCorkSlice(&socket, flush);
+        due->deadline = uWS::LoopData::now() - 1;
+        uWS::CorkSlice *closed = loopData.acquireCorkSlice(&socket, flush);
+        closed->socket = nullptr;
+        (void) now;
+
+        assert(loopData.flushCorkSlices() == later->deadline);
+        assert(flushed == 2 && loopData.corkSlices.size() == 1 && loopData.idleCorkSlices.size() == 3);
+
+        later->deadline = uWS::LoopData::now();
+        assert(loopData.flushCorkSlices() == 0);
+        assert(flushed == 3 && loopData.corkSlices.empty());
+    }
+
+    {
+        /* Dedicated compressors are pooled by their options and reset before reuse */
+        uWS::LoopData loopData;
+        uWS::DeflationStream *small = loopData.acquireDeflationStream(uWS::DEDICATED_COMPRESSOR_4KB);
+        uWS::DeflationStream *big = loopData.acquireDeflationStream(uWS::DEDICATED_COMPRESSOR);
+        assert(small != big && small->compressOptions == uWS::DEDICATED_COMPRESSOR_4KB);
+
+        uWS::ZlibContext zlibContext;
+        std::string fresh(small->deflate(&zlibContext, "hello hello hello", false));
+        loopData.releaseDeflationStream(small);
+        loopData.releaseDeflationStream(big);
+        assert(loopData.idleDeflationStreams.size() == 2);
+
+        uWS::DeflationStream *again = loopData.acquireDeflationStream(uWS::DEDICATED_COMPRESSOR_4KB);
+        assert(again == small && loopData.idleDeflationStreams.size() == 1);
+        /* Without context, the same input compresses the same as the first time */
+        assert(std::string(again->deflate(&zlibContext, "hello hello hello", false)) == fresh);
+        loopData.releaseDeflationStream(again);
+
+        for (unsigned int i = 0; i < uWS::LoopData::MAX_IDLE_DEFLATION_STREAMS + 10; i++) {
+            loopData.releaseDeflationStream(new uWS::DeflationStream(uWS::DEDICATED_COMPRESSOR_8KB));
+        }
+        assert(loopData.idleDeflationStreams.size() == uWS::LoopData::MAX_IDLE_DEFLATION_STREAMS);
+    }
+
+    {
+        /* Channels own what is left of their messages until written past them, whatever else was in between */
+        uWS::BackPressure backPressure;
+        uWS::BackPressureChannels &channels = backPressure.getChannels();
+        assert(&channels == &backPressure.getChannels() && backPressure.getChannelLength(1) == 0);
+
+        /* 100 bytes of someone else, then 50 of channel 1 and 30 of channel 7, none of them written */
+        channels.mark(1, 50, 150);
+        channels.mark(7, 30, 180);
+        /* Written right away, nothing to count */
+        channels.mark(3, 10, 0);
+        assert(backPressure.getChannelLength(1) == 50 && backPressure.getChannelLength(7) == 30 && backPressure.getChannelLength(3) == 0);
+
+        backPressure.onWritten(149);
+        assert(backPressure.getChannelLength(1) == 50);
+        backPressure.onWritten(1);
+        assert(backPressure.getChannelLength(1) == 0 && backPressure.getChannelLength(7) == 30);
+
+        /* Partly written before marked: only what is still pending counts */
+        channels.mark(1, 100, 40);
+        assert(backPressure.getChannelLength(1) == 40 && backPressure.getChannelLength(2000) == 0);
+        backPressure.onWritten(70);
+        assert(backPressure.getChannelLength(1) == 0 && backPressure.getChannelLength(7) == 0 && channels.marks.empty());
+
+        /* And moves along with the rest of it, such as when upgraded */
+        channels.mark(2, 5, 5);
+        uWS::BackPressure moved(std::move(backPressure));
+        assert(moved.getChannelLength(2) == 5 && backPressure.getChannelLength(2) == 0);
+    }
+
+    std::cout << "ALL PASS" << std::endl;
+}
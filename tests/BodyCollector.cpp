@@ -0,0 +1,77 @@
+#include "../src/BodyCollector.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+int main() {
+    uWS::LoopData loopData;
+    std::string collected;
+    int calls = 0;
+    auto handler = [&](std::string_view body) {
+        collected = body;
+        calls++;
+    };
+
+    {
+        /* In one piece, handed over where it lies */
+        uWS::BodyCollector collector(100);
+        std::string chunk = "whole body";
+        const char *at = nullptr;
+        assert(collector.collect(&loopData, chunk.length(), chunk, true, [&](std::string_view body) {
+            at = body.data();
+            handler(body);
+        }));
+        assert(at == chunk.data() && collected == chunk && calls == 1 && loopData.idleBodyBuffers.empty());
+    }
+
+    {
+        /* In pieces, reserved from Content-Length, the buffer back to the loop once done */
+        uWS::BodyCollector collector(100);
+        assert(collector.collect(&loopData, 12, "first ", false, handler));
+        assert(collector.body.capacity() >= 12 && calls == 1);
+        assert(collector.collect(&loopData, 6, "second", true, handler));
+        assert(collected == "first second" && calls == 2 && loopData.idleBodyBuffers.size() == 1);
+    }
+
+    {
+        /* Chunked (length unknown), the pooled buffer is taken again with its capacity */
+        size_t capacity = loopData.idleBodyBuffers[0].capacity();
+        uWS::BodyCollector collector(100);
+        assert(collector.collect(&loopData, UINT64_MAX, "a", false, handler));
+        assert(loopData.idleBodyBuffers.empty() && collector.body.capacity() == capacity);
+        assert(collector.collect(&loopData, UINT64_MAX, "b", false, handler));
+        assert(collector.collect(&loopData, UINT64_MAX, "", true, handler));
+        assert(collected == "ab" && calls == 3 && loopData.idleBodyBuffers.size() == 1);
+    }
+
+    {
+        /* Content-Length over the limit is rejected before anything is collected, the rest is ignored */
+        uWS::BodyCollector collector(10);
+        assert(!collector.collect(&loopData, 11, "12345", false, handler));
+        assert(collector.rejected && collector.collect(&loopData, 6, "678901", true, handler));
+        assert(calls == 3 && loopData.idleBodyBuffers.size() == 1);
+
+        /* As is a first chunk over it */
+        uWS::BodyCollector tooBig(4);
+        assert(!tooBig.collect(&loopData, UINT64_MAX, "12345", true, handler) && calls == 3);
+    }
+
+    {
+        /* Chunks adding up to over the limit, the buffer goes back to the loop */
+        uWS::BodyCollector collector(10);
+        assert(collector.collect(&loopData, UINT64_MAX, "123456", false, handler));
+        assert(loopData.idleBodyBuffers.empty());
+        assert(!collector.collect(&loopData, UINT64_MAX, "78901", false, handler));
+        assert(collector.collect(&loopData, UINT64_MAX, "2", true, handler));
+        assert(calls == 3 && loopData.idleBodyBuffers.size() == 1);
+
+        /* At the limit is fine */
+        uWS::BodyCollector exact(10);
+        assert(exact.collect(&loopData, UINT64_MAX, "12345", false, handler));
+        assert(exact.collect(&loopData, UINT64_MAX, "67890", true, handler));
+        assert(collected == "1234567890" && calls == 4);
+    }
+
+    std::cout << "ALL PASS" << std::endl;
+}
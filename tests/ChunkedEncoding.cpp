@@ -211,9 +211,41 @@ void testWithoutTrailer() {
     }
 }
 
+void testBatchAndHex() {
+    /* Batches give the same chunks as iterating */
+    std::string buffer = "5\r\nHello\r\nA\r\n0123456789\r\n1\r\n!\r\n0\r\n\r\n";
+    std::string_view dataToConsume(buffer.data(), buffer.length());
+    uint64_t state = uWS::STATE_IS_CHUNKED;
+
+    std::string_view chunks[2];
+    std::vector<std::string_view> all;
+    unsigned int numChunks;
+    do {
+        numChunks = uWS::getNextChunks(dataToConsume, state, chunks, 2);
+        all.insert(all.end(), chunks, chunks + numChunks);
+    } while (numChunks == 2);
+
+    if (state || dataToConsume.length() || all.size() != 4 || all[0] != "Hello" || all[1] != "0123456789" || all[2] != "!" || all[3].length()) {
+        std::abort();
+    }
+
+    /* Only hex digits make up the size */
+    for (std::string invalid : {"g\r\n", ":\r\n", "1@\r\n", "10000000000000000\r\n"}) {
+        std::string_view data(invalid.data(), invalid.length());
+        uint64_t state = uWS::STATE_IS_CHUNKED;
+        for (auto chunk : uWS::ChunkIterator(&data, &state)) {
+            (void) chunk;
+        }
+        if (!uWS::isParsingInvalidChunkedEncoding(state)) {
+            std::abort();
+        }
+    }
+}
+
 int main() {
 
     testWithoutTrailer();
+    testBatchAndHex();
 
     for (int i = 1; i < 1000; i++) {
         runBetterTest(i);
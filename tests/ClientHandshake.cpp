@@ -0,0 +1,70 @@
+#include "../src/ClientHandshake.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+void testUrls() {
+    uWS::WebSocketUrl url;
+    assert(url.parse("ws://example.com", false));
+    assert(url.host == "example.com" && url.authority == "example.com" && url.port == 80 && url.path == "/");
+
+    assert(url.parse("ws://example.com:3000/chat?room=1", false));
+    assert(url.host == "example.com" && url.authority == "example.com:3000" && url.port == 3000 && url.path == "/chat?room=1");
+
+    assert(url.parse("wss://example.com/", true));
+    assert(url.port == 443 && url.path == "/");
+
+    /* IPv6, with and without port */
+    assert(url.parse("ws://[::1]:9001/x", false));
+    assert(url.host == "::1" && url.authority == "[::1]:9001" && url.port == 9001 && url.path == "/x");
+    assert(url.parse("wss://[fe80::1]", true));
+    assert(url.host == "fe80::1" && url.port == 443);
+
+    /* Wrong scheme, for SSL or not */
+    assert(!url.parse("wss://example.com", false) && !url.parse("ws://example.com", true));
+    assert(!url.parse("http://example.com", false) && !url.parse("example.com", false));
+
+    /* No host, bad ports */
+    assert(!url.parse("ws://", false) && !url.parse("ws:///path", false) && !url.parse("ws://:80", false));
+    assert(!url.parse("ws://host:0", false) && !url.parse("ws://host:65536", false) && !url.parse("ws://host:8o", false));
+    assert(!url.parse("ws://host:", false));
+    assert(url.parse("ws://host:65535", false) && url.port == 65535);
+}
+
+void testUpgrades() {
+    /* The example of RFC 6455 */
+    const char *key = "dGhlIHNhbXBsZSBub25jZQ==";
+    std::string accept = "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+    auto response = [](std::string status, std::string headers) {
+        return "HTTP/1.1 " + status + "\r\n" + headers;
+    };
+    using uWS::ClientHandshake::isAcceptedUpgrade;
+
+    assert(isAcceptedUpgrade(response("101 Switching Protocols", "Upgrade: websocket\r\nConnection: Upgrade\r\n" + accept), key));
+    /* Any order, any case, whitespace around values, Connection as a list */
+    assert(isAcceptedUpgrade(response("101 Switching Protocols", "sec-websocket-accept:  s3pPLMBiTxaQ9kYGzzhZRbK+xOo= \r\nCONNECTION: keep-alive, upgrade\r\nupgrade:\tWebSocket"), key));
+
+    /* Not 101 */
+    assert(!isAcceptedUpgrade(response("200 OK", "Upgrade: websocket\r\nConnection: Upgrade\r\n" + accept), key));
+    assert(!isAcceptedUpgrade("HTTP/1.0 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n" + accept, key));
+    assert(!isAcceptedUpgrade("HTTP/1.1 10", key));
+
+    /* Missing or wrong Upgrade, Connection or Sec-WebSocket-Accept */
+    assert(!isAcceptedUpgrade(response("101 Switching Protocols", "Connection: Upgrade\r\n" + accept), key));
+    assert(!isAcceptedUpgrade(response("101 Switching Protocols", "Upgrade: h2c\r\nConnection: Upgrade\r\n" + accept), key));
+    assert(!isAcceptedUpgrade(response("101 Switching Protocols", "Upgrade: websocket\r\n" + accept), key));
+    assert(!isAcceptedUpgrade(response("101 Switching Protocols", "Upgrade: websocket\r\nConnection: keep-alive\r\n" + accept), key));
+    assert(!isAcceptedUpgrade(response("101 Switching Protocols", "Upgrade: websocket\r\nConnection: Upgraded\r\n" + accept), key));
+    assert(!isAcceptedUpgrade(response("101 Switching Protocols", "Upgrade: websocket\r\nConnection: Upgrade"), key));
+    assert(!isAcceptedUpgrade(response("101 Switching Protocols", "Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo"), key));
+    assert(!isAcceptedUpgrade(response("101 Switching Protocols", "Upgrade: websocket\r\nConnection: Upgrade\r\n" + accept), "dGhlIHNhbXBsZSBub25jZA=="));
+}
+
+int main() {
+    testUrls();
+    testUpgrades();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,65 @@
+#include "../src/CompressionPool.h"
+
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <string>
+
+int main() {
+    std::atomic<int> roundTrips = 0;
+
+    {
+        /* Several threads, each with their own streams */
+        uWS::CompressionPool pool(4);
+
+        for (int i = 0; i < 200; i++) {
+            pool.submit([i, &roundTrips]() {
+                std::string message;
+                for (int j = 0; j < 1000 + i * 100; j++) {
+                    message += std::to_string(j * i) + ",";
+                }
+
+                std::string compressed = uWS::CompressionPool::deflate(message);
+                assert(compressed.length() && compressed.length() < message.length());
+
+                /* Like the shared streams of a loop, every message starts over so they all inflate on their own */
+                compressed.append("123456789");
+                std::optional<std::string> inflated = uWS::CompressionPool::inflate({compressed.data(), compressed.length() - 9}, 16 * 1024 * 1024);
+                assert(inflated.has_value() && inflated.value() == message);
+
+                /* Too big once inflated */
+                assert(!uWS::CompressionPool::inflate({compressed.data(), compressed.length() - 9}, message.length() - 1).has_value());
+
+                roundTrips++;
+            });
+        }
+
+        /* Destruction finishes what is queued */
+    }
+
+    assert(roundTrips == 200);
+
+    {
+        /* Adaptive compression skips what deflate cannot shrink */
+        std::mt19937 random(1);
+        std::string noise(4096, 0), json, small(100, 0);
+        for (char &c : noise) {
+            c = (char) random();
+        }
+        for (char &c : small) {
+            c = (char) random();
+        }
+        while (json.length() < 4096) {
+            json += "{\"id\":" + std::to_string(random() % 100000) + ",\"name\":\"user\",\"ok\":true},";
+        }
+
+        assert(uWS::looksIncompressible(noise));
+        assert(uWS::looksIncompressible(uWS::CompressionPool::deflate(json + json + json + json + noise)));
+        assert(!uWS::looksIncompressible(json));
+        /* Too small to tell */
+        assert(!uWS::looksIncompressible(small));
+    }
+
+    std::cout << "ALL PASS" << std::endl;
+}
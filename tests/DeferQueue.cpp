@@ -0,0 +1,84 @@
+#include "../src/DeferQueue.h"
+
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+void testBasics() {
+    uWS::DeferQueue queue;
+    assert(queue.run() == 0);
+
+    /* In order, again once emptied (the stub goes around), and what runs may push more */
+    std::vector<int> ran;
+    for (int round = 0; round < 3; round++) {
+        ran.clear();
+        for (int i = 0; i < 5; i++) {
+            queue.push([&ran, i]() {
+                ran.push_back(i);
+            });
+        }
+        assert(queue.run() == 5 && ran == std::vector<int>({0, 1, 2, 3, 4}));
+    }
+
+    ran.clear();
+    queue.push([&]() {
+        ran.push_back(1);
+        queue.push([&ran]() {
+            ran.push_back(2);
+        });
+    });
+    assert(queue.run() == 2 && ran == std::vector<int>({1, 2}));
+
+    /* Captures are released once run, and with the queue if never run */
+    auto shared = std::make_shared<int>(0);
+    queue.push([shared]() {});
+    queue.run();
+    assert(shared.use_count() == 1);
+    {
+        uWS::DeferQueue dropped;
+        dropped.push([shared]() {});
+        assert(shared.use_count() == 2);
+    }
+    assert(shared.use_count() == 1);
+}
+
+/* Every callback runs once, in order per producer, with nodes recycled between the threads */
+void testProducers() {
+    static constexpr int PRODUCERS = 4, COUNT = 200000;
+    uWS::DeferQueue queue;
+
+    std::vector<int> next(PRODUCERS, 0);
+    long received = 0;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&, p]() {
+            for (int i = 0; i < COUNT; i++) {
+                queue.push([&next, &received, p, i]() {
+                    assert(next[(size_t) p] == i);
+                    next[(size_t) p]++;
+                    received++;
+                });
+            }
+        });
+    }
+
+    while (received < (long) PRODUCERS * COUNT) {
+        if (!queue.run()) {
+            std::this_thread::yield();
+        }
+    }
+
+    for (std::thread &producer : producers) {
+        producer.join();
+    }
+    assert(queue.run() == 0);
+}
+
+int main() {
+    testBasics();
+    testProducers();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,59 @@
+#include "../src/EventStream.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* What the tests below get as subscribers' event streams */
+static std::vector<std::string> written;
+
+template <>
+bool uWS::sendEventFrame<false>(uWS::Subscriber *, std::string_view frame) {
+    written.emplace_back(frame);
+    return false;
+}
+
+std::string framed(std::string_view data, std::string_view event = {}, std::string_view id = {}) {
+    std::string out;
+    uWS::frameEvent(out, data, event, id);
+    return out;
+}
+
+/* One data field per line whichever the line break, event and id cut at theirs */
+void testFraming() {
+    assert(framed("hello") == "data: hello\n\n");
+    assert(framed("") == "data: \n\n");
+    assert(framed("a\nb\r\nc\rd") == "data: a\ndata: b\ndata: c\ndata: d\n\n");
+    assert(framed("a\n") == "data: a\ndata: \n\n");
+    assert(framed("a\r") == "data: a\ndata: \n\n");
+    assert(framed("a\n\nb") == "data: a\ndata: \ndata: b\n\n");
+    assert(framed("x", "update", "42") == "event: update\nid: 42\ndata: x\n\n");
+    assert(framed("x", "up\ndata: injected", "4\r2") == "event: up\nid: 4\ndata: x\n\n");
+
+    /* Appended, as a batch of events */
+    std::string out = framed("1");
+    uWS::frameEvent(out, "2");
+    assert(out == "data: 1\n\ndata: 2\n\n");
+}
+
+/* A publish is framed by its first event stream only, the rest get the same frame */
+void testFramedOnce() {
+    std::string frame;
+    for (int i = 0; i < 3; i++) {
+        assert(!uWS::sendEvent<false>(nullptr, "tick", frame));
+    }
+    assert(written.size() == 3 && written[0] == "data: tick\n\n" && written[2] == written[0]);
+
+    /* Whatever the first one framed */
+    frame = "data: already\n\n";
+    uWS::sendEvent<false>(nullptr, "tick", frame);
+    assert(written.back() == "data: already\n\n");
+}
+
+int main() {
+    testFraming();
+    testFramedOnce();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,116 @@
+#include "../src/PerMessageDeflate.h"
+#include "../src/ChunkedEncoding.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+/* Inflates a whole gzip member, as a client would */
+std::string gunzip(const std::string &compressed) {
+    z_stream stream = {};
+    inflateInit2(&stream, 15 + 16);
+    stream.next_in = (Bytef *) compressed.data();
+    stream.avail_in = (unsigned int) compressed.length();
+
+    std::string out;
+    int err;
+    do {
+        char buffer[1024];
+        stream.next_out = (Bytef *) buffer;
+        stream.avail_out = sizeof(buffer);
+        err = inflate(&stream, Z_NO_FLUSH);
+        out.append(buffer, sizeof(buffer) - stream.avail_out);
+    } while (err == Z_OK);
+    assert(err == Z_STREAM_END);
+    inflateEnd(&stream);
+    return out;
+}
+
+/* Frames as HttpResponse does, each chunk's CRLF in front of the next head or the terminator */
+void appendChunk(std::string &wire, std::string_view data) {
+    char hex[16];
+    snprintf(hex, sizeof(hex), "%zx", data.length());
+    wire.append(wire.length() ? "\r\n" : "").append(hex).append("\r\n").append(data);
+}
+
+/* What a client gets of a chunked body */
+std::string unchunk(std::string_view wire) {
+    std::string body;
+    uint64_t state = uWS::STATE_IS_CHUNKED;
+    for (std::string_view chunk : uWS::ChunkIterator(&wire, &state)) {
+        body.append(chunk);
+    }
+    assert(!state && !wire.length());
+    return body;
+}
+
+int main() {
+    uWS::GzipStream gzipStream;
+
+    std::string body;
+    for (int i = 0; i < 20000; i++) {
+        body += "{\"id\":" + std::to_string(i) + ",\"name\":\"item\"},";
+    }
+
+    /* In one go, then again with the same stream */
+    for (int round = 0; round < 2; round++) {
+        std::string out;
+        gzipStream.compress(body, uWS::GzipStream::FINISH, out);
+        assert(out.length() < body.length() / 4);
+        assert(gunzip(out) == body);
+    }
+
+    /* In pieces, held back until finished */
+    std::string out;
+    for (size_t i = 0; i < body.length(); i += 1000) {
+        gzipStream.compress(std::string_view(body).substr(i, 1000), uWS::GzipStream::NO_FLUSH, out);
+    }
+    gzipStream.compress({}, uWS::GzipStream::FINISH, out);
+    assert(gunzip(out) == body);
+
+    /* Streamed, every write decodable on its own so far */
+    out.clear();
+    z_stream client = {};
+    inflateInit2(&client, 15 + 16);
+    std::string received;
+    for (size_t i = 0; i < body.length(); i += 7777) {
+        size_t before = out.length();
+        gzipStream.compress(std::string_view(body).substr(i, 7777), uWS::GzipStream::SYNC_FLUSH, out);
+
+        client.next_in = (Bytef *) out.data() + before;
+        client.avail_in = (unsigned int) (out.length() - before);
+        while (client.avail_in) {
+            char buffer[65536];
+            client.next_out = (Bytef *) buffer;
+            client.avail_out = sizeof(buffer);
+            assert(inflate(&client, Z_SYNC_FLUSH) == Z_OK);
+            received.append(buffer, sizeof(buffer) - client.avail_out);
+        }
+        assert(received == body.substr(0, std::min(body.length(), i + 7777)));
+    }
+    inflateEnd(&client);
+    gzipStream.compress({}, uWS::GzipStream::FINISH, out);
+    assert(gunzip(out) == body);
+
+    /* Written, then ended any way a response can be: the end finishes the stream in the last chunk */
+    for (std::string_view last : {std::string_view(body).substr(0, 100), std::string_view()}) {
+        std::string wire;
+        for (size_t i = 0; i < 3 * 7777; i += 7777) {
+            out.clear();
+            gzipStream.compress(std::string_view(body).substr(i, 7777), uWS::GzipStream::SYNC_FLUSH, out);
+            appendChunk(wire, out);
+        }
+        out.clear();
+        gzipStream.compress(last, uWS::GzipStream::FINISH, out);
+        appendChunk(wire, out);
+        wire.append("\r\n0\r\n\r\n");
+        assert(gunzip(unchunk(wire)) == body.substr(0, 3 * 7777) + std::string(last));
+    }
+
+    /* Empty bodies are still valid gzip */
+    out.clear();
+    gzipStream.compress({}, uWS::GzipStream::FINISH, out);
+    assert(gunzip(out).empty());
+
+    std::cout << "ALL PASS" << std::endl;
+}
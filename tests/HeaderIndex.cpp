@@ -0,0 +1,22 @@
+#include "../src/HeaderIndex.h"
+
+#include <cassert>
+#include <string>
+#include <iostream>
+
+int main() {
+    /* Every well-known header maps to its own slot */
+    for (unsigned int i = 0; i < uWS::HeaderIndex::NUM_HEADERS; i++) {
+        assert(uWS::HeaderIndex::classify(uWS::HeaderIndex::names[i]) == i);
+    }
+
+    assert(uWS::HeaderIndex::classify("host") == uWS::HeaderIndex::HOST);
+    assert(uWS::HeaderIndex::classify("sec-websocket-key") == uWS::HeaderIndex::SEC_WEBSOCKET_KEY);
+
+    /* Unknown, too short or not lower cased headers are not classified */
+    for (std::string header : {"", "a", "ab", "hos", "hosts", "Host", "x-custom-header", "content-lengtj", "sec-websocket-kez", "upgradE"}) {
+        assert(uWS::HeaderIndex::classify(header) == uWS::HeaderIndex::NUM_HEADERS);
+    }
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,114 @@
+#include "../src/Hpack.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+typedef std::vector<std::pair<std::string, std::string>> Fields;
+
+bool decode(uWS::HpackDecoder &decoder, std::string_view block, Fields &fields) {
+    fields.clear();
+    return decoder.decode(block, [&](std::string_view name, std::string_view value) {
+        fields.emplace_back(name, value);
+    });
+}
+
+/* RFC 7541 C.4.1, a request with Huffman */
+void testRequest() {
+    uWS::HpackDecoder decoder;
+    Fields fields;
+    assert(decode(decoder, "\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b\xa0\xab\x90\xf4\xff", fields));
+    assert((fields == Fields{{":method", "GET"}, {":scheme", "http"}, {":path", "/"}, {":authority", "www.example.com"}}));
+    assert(decoder.getTableSize() == 57);
+}
+
+/* The responses of C.6 in a table of 256 as another encoder does them, evicting as it goes */
+void testResponsesWithEviction() {
+    uWS::HpackDecoder decoder(256);
+    Fields fields;
+    assert(decode(decoder, "\x3f\xe1\x01\x4e\x82\x64\x02\x58\x85\xae\xc3\x77\x1a\x4b\x61\x96\xd0\x7a\xbe\x94\x10\x54\xd4\x44\xa8\x20\x05\x95\x04\x0b\x81\x66\xe0\x82\xa6\x2d\x1b\xff\x6e\x91\x9d\x29\xad\x17\x18\x63\xc7\x8f\x0b\x97\xc8\xe9\xae\x82\xae\x43\xd3", fields));
+    assert((fields == Fields{{":status", "302"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"}, {"location", "https://www.example.com"}}));
+    assert(decoder.getTableSize() == 222);
+
+    assert(decode(decoder, "\x4e\x03\x33\x30\x37\xc1\xc0\xbf", fields));
+    assert((fields == Fields{{":status", "307"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:21 GMT"}, {"location", "https://www.example.com"}}));
+    assert(decoder.getTableSize() == 222);
+
+    assert(decode(decoder, "\x88\xc1\x61\x96\xd0\x7a\xbe\x94\x10\x54\xd4\x44\xa8\x20\x05\x95\x04\x0b\x81\x66\xe0\x84\xa6\x2d\x1b\xff\xc0\x5a\x83\x9b\xd9\xab\x77\xad\x94\xe7\x82\x1d\xd7\xf2\xe6\xc7\xb3\x35\xdf\xdf\xcd\x5b\x39\x60\xd5\xaf\x27\x08\x7f\x36\x72\xc1\xab\x27\x0f\xb5\x29\x1f\x95\x87\x31\x60\x65\xc0\x03\xed\x4e\xe5\xb1\x06\x3d\x50\x07", fields));
+    assert((fields == Fields{{":status", "200"}, {"cache-control", "private"}, {"date", "Mon, 21 Oct 2013 20:13:22 GMT"}, {"location", "https://www.example.com"}, {"content-encoding", "gzip"}, {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}}));
+    assert(decoder.getTableSize() == 215);
+}
+
+/* What we encode decodes to the same, statuses of the static table in a byte */
+void testEncoder() {
+    std::string block;
+    uWS::HpackEncoder::encodeStatus(block, "200");
+    assert(block == "\x88");
+    uWS::HpackEncoder::encodeStatus(block, "418");
+    uWS::HpackEncoder::encode(block, "content-type", "text/html; charset=utf-8");
+    uWS::HpackEncoder::encode(block, "x-request-id", "9f86d081884c7d65");
+    uWS::HpackEncoder::encode(block, "grpc-status", "");
+
+    uWS::HpackDecoder decoder;
+    Fields fields;
+    assert(decode(decoder, block, fields));
+    assert((fields == Fields{{":status", "200"}, {":status", "418"}, {"content-type", "text/html; charset=utf-8"}, {"x-request-id", "9f86d081884c7d65"}, {"grpc-status", ""}}));
+    /* Nothing is indexed */
+    assert(decoder.getTableSize() == 0);
+
+    /* Every byte through Huffman, and a long value past one byte of length */
+    std::string all, decoded;
+    for (int i = 0; i < 256; i++) {
+        all += (char) i;
+    }
+    for (size_t length = 0; length <= all.length(); length++) {
+        std::string encoded;
+        uWS::hpack::huffmanEncode(all.substr(0, length), encoded);
+        assert(encoded.length() == uWS::hpack::huffmanLength(all.substr(0, length)));
+        decoded.clear();
+        assert(uWS::hpack::HuffmanDecoder::get().decode(encoded, decoded) && decoded == all.substr(0, length));
+    }
+    block.clear();
+    uWS::HpackEncoder::encode(block, "x-long", std::string(50000, 'a') + all);
+    assert(decode(decoder, block, fields) && fields.size() == 1 && fields[0].second == std::string(50000, 'a') + all);
+}
+
+/* Errors of the block are errors, not crashes (the connection is then done) */
+void testMalformed() {
+    Fields fields;
+    const char *blocks[] = {
+        /* Index 0, past the tables */
+        "\x80", "\xff\x00",
+        /* Integer cut short, too large */
+        "\xff", "\x7f\xff\xff\xff\xff\xff\x0f",
+        /* Zero continuations, on and on */
+        "\x7f\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x80\x01",
+        /* String past the block */
+        "\x40\x05name", "\x00\x84" "ab",
+        /* Huffman with EOS in it, padding of 8 bits, padding not ones */
+        "\x00\x01a\x84\xff\xff\xff\xff", "\x00\x01a\x82\x1f\xff", "\x00\x01a\x81\x00",
+        /* Size update beyond what we allow, after a field */
+        "\x3f\xe2\x1f", "\x82\x20"
+    };
+    size_t lengths[] = {1, 2, 1, 7, 13, 7, 4, 8, 6, 5, 3, 2};
+    for (unsigned int i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        uWS::HpackDecoder decoder;
+        assert(!decode(decoder, std::string_view(blocks[i], lengths[i]), fields));
+    }
+
+    /* An update to 0 then one up to what we allow, then entries too large for the table are left out */
+    uWS::HpackDecoder decoder(64);
+    assert(decode(decoder, std::string("\x20\x3f\x21\x40\x01\x61\x20", 7) + std::string(32, 'v'), fields));
+    assert(fields.size() == 1 && decoder.getTableSize() == 0);
+}
+
+int main() {
+    testRequest();
+    testResponsesWithEviction();
+    testEncoder();
+    testMalformed();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,455 @@
+#include "../src/Http2Response.h"
+
+#include <cassert>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* The client end: frames in and out, headers through HPACK of its own */
+struct Frame {
+    unsigned char type, flags;
+    uint32_t streamId;
+    std::string payload;
+};
+
+std::string frame(unsigned char type, unsigned char flags, uint32_t streamId, std::string_view payload = {}) {
+    std::string out;
+    out += (char) (payload.length() >> 16);
+    out += (char) (payload.length() >> 8);
+    out += (char) payload.length();
+    out += (char) type;
+    out += (char) flags;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out += (char) (streamId >> shift);
+    }
+    return out.append(payload);
+}
+
+uint32_t readUint32(const char *data) {
+    return ((uint32_t) (unsigned char) data[0] << 24) | ((uint32_t) (unsigned char) data[1] << 16) | ((uint32_t) (unsigned char) data[2] << 8) | (unsigned char) data[3];
+}
+
+std::string uint32(uint32_t value) {
+    return {(char) (value >> 24), (char) (value >> 16), (char) (value >> 8), (char) value};
+}
+
+std::string setting(uint16_t id, uint32_t value) {
+    return std::string({(char) (id >> 8), (char) id}) + uint32(value);
+}
+
+std::string headers(std::vector<std::pair<std::string, std::string>> fields) {
+    std::string block;
+    for (auto &[key, value] : fields) {
+        uWS::HpackEncoder::encode(block, key, value);
+    }
+    return block;
+}
+
+std::string get(std::string path) {
+    /* Indexed :method GET, :scheme https */
+    return "\x82\x87" + headers({{":path", path}, {":authority", "example.com"}});
+}
+
+std::string post(std::string path) {
+    return "\x83\x87" + headers({{":path", path}, {":authority", "example.com"}});
+}
+
+const std::string PREFACE = std::string(uWS::Http2Session::PREFACE) + frame(uWS::Http2Session::SETTINGS, 0, 0);
+
+struct Client {
+    uWS::Http2SessionHandlers handlers;
+    std::function<void(uWS::Http2Response *, uWS::Http2Request *)> handler;
+    std::string wire;
+    /* What the transport says of writes */
+    bool accepting = true;
+    uWS::Http2Session *session;
+    uWS::HpackDecoder decoder;
+
+    Client() {
+        handlers.request = [this](uWS::Http2Response *res, uWS::Http2Request *req) {
+            if (!handler) {
+                return false;
+            }
+            handler(res, req);
+            return true;
+        };
+        handlers.write = [this](uWS::Http2Session *, std::string_view data) {
+            wire.append(data);
+            return accepting;
+        };
+        session = new uWS::Http2Session(&handlers);
+    }
+
+    ~Client() {
+        session->abort();
+        delete session;
+    }
+
+    bool send(std::string data) {
+        return session->consume(data);
+    }
+
+    /* Frames written since last, SETTINGS and WINDOW_UPDATE of the connection left out unless asked for */
+    std::vector<Frame> frames(bool all = false) {
+        std::vector<Frame> out;
+        while (wire.length() >= 9) {
+            size_t length = ((size_t) (unsigned char) wire[0] << 16) | ((size_t) (unsigned char) wire[1] << 8) | (unsigned char) wire[2];
+            assert(wire.length() >= 9 + length);
+            Frame f = {(unsigned char) wire[3], (unsigned char) wire[4], readUint32(wire.data() + 5), wire.substr(9, length)};
+            wire.erase(0, 9 + length);
+            if (all || !((f.type == uWS::Http2Session::SETTINGS) || (f.type == uWS::Http2Session::WINDOW_UPDATE && !f.streamId))) {
+                out.push_back(f);
+            }
+        }
+        return out;
+    }
+
+    std::vector<std::pair<std::string, std::string>> decode(std::string_view block) {
+        std::vector<std::pair<std::string, std::string>> fields;
+        assert(decoder.decode(block, [&](std::string_view key, std::string_view value) {
+            fields.emplace_back(key, value);
+        }));
+        return fields;
+    }
+};
+
+using S = uWS::Http2Session;
+typedef std::vector<std::pair<std::string, std::string>> Fields;
+
+/* Preface both ways, a request routed and answered in one read */
+void testRequestResponse() {
+    Client client;
+    client.handler = [](uWS::Http2Response *res, uWS::Http2Request *req) {
+        assert(req->getMethod() == "GET" && req->getUrl() == "/hello" && req->getQuery("a") == "b c");
+        assert(req->getHeader("host") == "example.com" && req->getHeader("x-custom") == "yes");
+        res->writeStatus("404 Not Found")->writeHeader("Content-Type", "text/plain")->writeHeader("Connection", "close")->end("hello");
+    };
+    assert(client.send(PREFACE + frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, 1, get("/hello?a=b%20c") + headers({{"x-custom", "yes"}}))));
+
+    std::vector<Frame> all = client.frames(true);
+    /* Our settings and window, the ack of theirs */
+    assert(all.size() == 5 && all[0].type == S::SETTINGS && !all[0].flags && all[1].type == S::WINDOW_UPDATE && readUint32(all[1].payload.data()) == S::CONNECTION_WINDOW - 65535);
+    assert(all[2].type == S::SETTINGS && all[2].flags == S::FLAG_ACK);
+    assert(all[3].type == S::HEADERS && all[3].flags == S::FLAG_END_HEADERS && all[3].streamId == 1);
+    assert((client.decode(all[3].payload) == Fields{{":status", "404"}, {"content-type", "text/plain"}, {"content-length", "5"}}));
+    assert(all[4].type == S::DATA && all[4].flags == S::FLAG_END_STREAM && all[4].payload == "hello");
+    assert(client.session->getNumStreams() == 0);
+
+    /* No body at all is the headers alone, and :status 200 one byte */
+    client.handler = [](uWS::Http2Response *res, uWS::Http2Request *) {
+        res->end();
+    };
+    assert(client.send(frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, 3, get("/"))));
+    std::vector<Frame> frames = client.frames();
+    assert(frames.size() == 1 && frames[0].flags == (S::FLAG_END_HEADERS | S::FLAG_END_STREAM) && frames[0].payload.substr(0, 1) == "\x88");
+
+    /* Nobody routed it, and PING is echoed */
+    client.handler = nullptr;
+    assert(client.send(frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, 5, get("/none")) + frame(S::PING, 0, 0, "12345678")));
+    frames = client.frames();
+    assert(frames.size() == 2 && frames[0].type == S::RST_STREAM && readUint32(frames[0].payload.data()) == S::CANCEL);
+    assert(frames[1].type == S::PING && frames[1].flags == S::FLAG_ACK && frames[1].payload == "12345678");
+}
+
+/* Byte by byte is the same as all at once, a header block continued included */
+void testSplitReads() {
+    Client client;
+    std::string body;
+    client.handler = [&body](uWS::Http2Response *res, uWS::Http2Request *req) {
+        assert(req->getMethod() == "POST" && req->getHeader("content-type") == "application/json");
+        res->onAborted([]() {});
+        res->onData([res, &body](std::string_view chunk, bool fin) {
+            body.append(chunk);
+            if (fin) {
+                res->end(body);
+            }
+        });
+    };
+    std::string block = post("/upload") + headers({{"content-type", "application/json"}});
+    std::string wire = PREFACE + frame(S::HEADERS, S::FLAG_PADDED, 1, "\x03" + block.substr(0, 4) + "pad")
+        + frame(S::CONTINUATION, S::FLAG_END_HEADERS, 1, block.substr(4)) + frame(S::DATA, 0, 1, "{\"a\":")
+        + frame(S::DATA, S::FLAG_END_STREAM | S::FLAG_PADDED, 1, std::string("\x02") + "1}" + std::string(2, '\0'));
+    for (char c : wire) {
+        assert(client.send(std::string(1, c)));
+    }
+    assert(body == "{\"a\":1}");
+    std::vector<Frame> frames = client.frames();
+    assert(frames.size() == 2 && frames[1].payload == body && frames[1].flags == S::FLAG_END_STREAM);
+}
+
+/* Bodies past the windows of the peer wait, and go as the windows open, onWritable after */
+void testFlowControl() {
+    Client client;
+    uWS::Http2Response *response = nullptr;
+    std::string big(100, 'x');
+    int writable = 0;
+    client.handler = [&](uWS::Http2Response *res, uWS::Http2Request *) {
+        response = res;
+        if (res->getStreamId() != 5) {
+            res->end(big);
+        } else {
+            res->onAborted([]() {});
+            res->onWritable([&, res](uintmax_t offset) {
+                writable++;
+                return res->tryEnd(std::string_view(big).substr((size_t) offset), big.length()).first;
+            });
+            assert(!res->tryEnd(big).first);
+        }
+    };
+    assert(client.send(std::string(S::PREFACE) + frame(S::SETTINGS, 0, 0, setting(S::INITIAL_WINDOW_SIZE, 10)) + frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, 1, get("/"))));
+    std::vector<Frame> frames = client.frames();
+    assert(frames.size() == 2 && frames[1].type == S::DATA && frames[1].payload.length() == 10 && !frames[1].flags);
+
+    /* More window for the stream, then all of it by a larger initial window */
+    assert(client.send(frame(S::WINDOW_UPDATE, 0, 1, uint32(50))));
+    frames = client.frames();
+    assert(frames.size() == 1 && frames[0].payload.length() == 50 && !frames[0].flags);
+    assert(client.send(frame(S::SETTINGS, 0, 0, setting(S::INITIAL_WINDOW_SIZE, 100000))));
+    frames = client.frames();
+    assert(frames.size() == 1 && frames[0].payload.length() == 40 && frames[0].flags == S::FLAG_END_STREAM);
+    assert(client.session->getNumStreams() == 0);
+
+    /* The window of the connection holds back all streams, here what is left of it after 100 */
+    assert(client.send(frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, 3, get("/"))));
+    frames = client.frames();
+    assert(frames.size() == 2 && frames[1].payload.length() == 100 && frames[1].flags == S::FLAG_END_STREAM);
+    /* 65535 - 200 left, then a stream that is short of it by 35 */
+    big.assign(65535 - 200 + 35, 'y');
+    assert(client.send(frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, 5, get("/"))));
+    frames = client.frames();
+    size_t sent = 0;
+    for (size_t i = 1; i < frames.size(); i++) {
+        assert(frames[i].payload.length() <= 16384 && !frames[i].flags);
+        sent += frames[i].payload.length();
+    }
+    assert(sent == big.length() - 35 && response->getWriteOffset() == sent && writable == 0);
+    assert(client.send(frame(S::WINDOW_UPDATE, 0, 0, uint32(1000))));
+    frames = client.frames();
+    assert(writable == 1 && frames.size() == 1 && frames[0].payload.length() == 35 && frames[0].flags == S::FLAG_END_STREAM);
+}
+
+/* A backed up transport holds streams until drained, what they wrote meanwhile waits in their backpressure */
+void testTransportBackpressure() {
+    Client client;
+    std::vector<uWS::Http2Response *> responses;
+    client.handler = [&](uWS::Http2Response *res, uWS::Http2Request *) {
+        responses.push_back(res);
+        res->onAborted([]() {});
+    };
+    /* Windows to spare, only the transport holds us back */
+    assert(client.send(std::string(S::PREFACE) + frame(S::SETTINGS, 0, 0, setting(S::INITIAL_WINDOW_SIZE, 1 << 20)) + frame(S::WINDOW_UPDATE, 0, 0, uint32(1 << 20))
+        + frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, 1, get("/")) + frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, 3, get("/"))));
+    client.frames();
+
+    /* What went before the transport told still went, after that nothing but headers */
+    client.accepting = false;
+    assert(responses[0]->write(std::string(S::FLUSH_SIZE, 'a')));
+    assert(!responses[0]->write("more"));
+    responses[1]->end("b");
+    std::vector<Frame> frames = client.frames();
+    size_t data = 0;
+    for (Frame &f : frames) {
+        data += f.type == S::DATA ? f.payload.length() : 0;
+    }
+    assert(data == S::FLUSH_SIZE && frames.back().type == S::HEADERS && frames.back().streamId == 3);
+
+    bool called = false;
+    responses[0]->onWritable([&](uintmax_t offset) {
+        called = true;
+        assert(offset == S::FLUSH_SIZE + 4);
+        responses[0]->end("!");
+        return true;
+    });
+    client.accepting = true;
+    client.session->drain();
+    frames = client.frames();
+    assert(frames.size() == 3 && frames[0].streamId == 1 && frames[0].payload == "more" && !frames[0].flags);
+    assert(frames[1].streamId == 1 && frames[1].payload == "!" && frames[1].flags == S::FLAG_END_STREAM);
+    assert(frames[2].streamId == 3 && frames[2].payload == "b" && frames[2].flags == S::FLAG_END_STREAM);
+    assert(called && client.session->getNumStreams() == 0);
+}
+
+/* gRPC: a body then its status in trailers */
+void testTrailers() {
+    Client client;
+    client.handler = [](uWS::Http2Response *res, uWS::Http2Request *req) {
+        assert(req->getHeader("te") == "trailers");
+        res->writeHeader("content-type", "application/grpc");
+        res->write(std::string("\0\0\0\0\x02hi", 7));
+        res->writeTrailer("grpc-status", "0")->writeTrailer("Grpc-Message", "OK")->end();
+    };
+    assert(client.send(PREFACE + frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, 1, post("/svc/Method") + headers({{"te", "trailers"}}))));
+    std::vector<Frame> frames = client.frames();
+    assert(frames.size() == 3 && frames[0].type == S::HEADERS && !(frames[0].flags & S::FLAG_END_STREAM));
+    assert((client.decode(frames[0].payload) == Fields{{":status", "200"}, {"content-type", "application/grpc"}}));
+    assert(frames[1].type == S::DATA && frames[1].payload.length() == 7 && !frames[1].flags);
+    assert(frames[2].type == S::HEADERS && frames[2].flags == (S::FLAG_END_HEADERS | S::FLAG_END_STREAM));
+    assert((client.decode(frames[2].payload) == Fields{{"grpc-status", "0"}, {"grpc-message", "OK"}}));
+}
+
+/* Errors of a stream reset it, errors of the connection end it with GOAWAY */
+void testErrors() {
+    {
+        Client client;
+        int aborted = 0;
+        client.handler = [&](uWS::Http2Response *res, uWS::Http2Request *) {
+            res->onAborted([&]() {
+                aborted++;
+            });
+        };
+        assert(client.send(PREFACE));
+        for (uint32_t id = 1; id <= 2 * S::MAX_STREAMS + 1; id += 2) {
+            assert(client.send(frame(S::HEADERS, S::FLAG_END_HEADERS, id, get("/"))));
+        }
+        std::vector<Frame> frames = client.frames();
+        assert(frames.size() == 1 && frames[0].type == S::RST_STREAM && frames[0].streamId == 2 * S::MAX_STREAMS + 1 && readUint32(frames[0].payload.data()) == S::REFUSED_STREAM);
+        assert(client.session->getNumStreams() == S::MAX_STREAMS);
+
+        /* Reset by the peer is aborted, malformed headers are reset by us */
+        assert(client.send(frame(S::RST_STREAM, 0, 1, uint32(S::CANCEL))));
+        assert(aborted == 1 && client.session->getNumStreams() == S::MAX_STREAMS - 1);
+        assert(client.send(frame(S::HEADERS, S::FLAG_END_HEADERS, 203, get("/") + headers({{"X-Upper", "1"}}))));
+        assert(client.send(frame(S::HEADERS, S::FLAG_END_HEADERS, 205, get("/") + headers({{"connection", "close"}}))));
+        frames = client.frames();
+        assert(frames.size() == 2 && readUint32(frames[0].payload.data()) == S::PROTOCOL_ERROR && readUint32(frames[1].payload.data()) == S::PROTOCOL_ERROR);
+
+        /* Our windows are replenished as the body comes, for as long as it does */
+        for (int i = 0; i < 100; i++) {
+            assert(client.send(frame(S::DATA, 0, 3, std::string(16384, 'x'))));
+        }
+        frames = client.frames(true);
+        size_t streamUpdates = 0, connectionUpdates = 0;
+        for (Frame &f : frames) {
+            assert(f.type == S::WINDOW_UPDATE);
+            (f.streamId ? streamUpdates : connectionUpdates) += readUint32(f.payload.data());
+        }
+        assert(streamUpdates + S::STREAM_WINDOW >= 100 * 16384 && connectionUpdates + S::CONNECTION_WINDOW >= 100 * 16384);
+
+        /* Closing the session aborts what is left */
+        client.session->abort();
+        assert(aborted == S::MAX_STREAMS);
+    }
+
+    std::string errors[] = {
+        /* Not the preface, no SETTINGS first, a frame larger than we allow */
+        "GET / HTTP/1.1\r\n\r\n",
+        std::string(S::PREFACE) + frame(S::PING, 0, 0, "12345678"),
+        PREFACE + frame(S::DATA, 0, 1, std::string(S::MAX_FRAME + 1, 'x')),
+        /* Garbage HPACK, even stream, stream ids going down */
+        PREFACE + frame(S::HEADERS, S::FLAG_END_HEADERS, 1, "\xff\xff\xff"),
+        PREFACE + frame(S::HEADERS, S::FLAG_END_HEADERS, 2, get("/")),
+        PREFACE + frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, 5, get("/")) + frame(S::HEADERS, S::FLAG_END_HEADERS, 3, get("/")),
+        /* Interrupted CONTINUATION, push, zero window increment, window overflow */
+        PREFACE + frame(S::HEADERS, 0, 1, get("/")) + frame(S::PING, 0, 0, "12345678"),
+        PREFACE + frame(S::PUSH_PROMISE, S::FLAG_END_HEADERS, 1, uint32(2)),
+        PREFACE + frame(S::WINDOW_UPDATE, 0, 0, uint32(0)),
+        PREFACE + frame(S::WINDOW_UPDATE, 0, 0, uint32(0x7fffffff)),
+        /* Bad settings */
+        PREFACE + frame(S::SETTINGS, 0, 0, setting(S::MAX_FRAME_SIZE, 100)),
+        PREFACE + frame(S::SETTINGS, 0, 0, "12345")
+    };
+    for (std::string &error : errors) {
+        Client client;
+        client.handler = [](uWS::Http2Response *res, uWS::Http2Request *) {
+            res->end();
+        };
+        assert(!client.send(error));
+        std::vector<Frame> frames = client.frames();
+        assert(frames.size() && frames.back().type == S::GOAWAY);
+        /* Nothing more is taken */
+        assert(!client.send(frame(S::PING, 0, 0, "12345678")));
+    }
+
+    {
+        /* Streams opened and reset right away, past what a window takes */
+        Client client;
+        client.handler = [](uWS::Http2Response *res, uWS::Http2Request *) {
+            res->onAborted([]() {});
+        };
+        assert(client.send(PREFACE));
+        uint32_t id = 1;
+        for (unsigned int i = 0; i < S::MAX_RESETS; i++, id += 2) {
+            assert(client.send(frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, id, get("/")) + frame(S::RST_STREAM, 0, id, uint32(S::CANCEL))));
+        }
+        assert(!client.send(frame(S::HEADERS, S::FLAG_END_HEADERS | S::FLAG_END_STREAM, id, get("/")) + frame(S::RST_STREAM, 0, id, uint32(S::CANCEL))));
+        std::vector<Frame> frames = client.frames();
+        assert(frames.back().type == S::GOAWAY && readUint32(frames.back().payload.data() + 4) == S::ENHANCE_YOUR_CALM);
+    }
+
+    {
+        /* Pings answered while the transport takes nothing, until it takes all of it */
+        Client client;
+        assert(client.send(PREFACE));
+        client.accepting = false;
+        assert(client.send(frame(S::PING, 0, 0, "12345678")));
+        for (unsigned int i = 0; i < S::MAX_QUEUED_CONTROL_FRAMES - 1; i++) {
+            assert(client.send(frame(S::PING, 0, 0, "12345678")));
+        }
+        client.accepting = true;
+        client.session->drain();
+        client.accepting = false;
+        assert(client.send(frame(S::PING, 0, 0, "12345678")));
+        std::string flood;
+        for (unsigned int i = 0; i < S::MAX_QUEUED_CONTROL_FRAMES + 1; i++) {
+            flood += frame(S::PING, 0, 0, "12345678");
+        }
+        assert(!client.send(flood));
+        std::vector<Frame> frames = client.frames();
+        assert(frames.back().type == S::GOAWAY && readUint32(frames.back().payload.data() + 4) == S::ENHANCE_YOUR_CALM);
+    }
+}
+
+/* HTTP/1.1 upgraded to h2c is stream 1 */
+struct UpgradedRequest {
+    std::vector<std::pair<std::string_view, std::string_view>> headers = {{"host", "example.com"}, {"connection", "Upgrade, HTTP2-Settings"}, {"upgrade", "h2c"}, {"http2-settings", "AAMAAABkAAQAAP__"}, {"accept", "*/*"}};
+    std::string_view getCaseSensitiveMethod() {
+        return "GET";
+    }
+    std::string_view getFullUrl() {
+        return "/up?x=1";
+    }
+    std::string_view getHeader(std::string_view key) {
+        for (auto &[k, v] : headers) {
+            if (k == key) {
+                return v;
+            }
+        }
+        return {};
+    }
+    auto begin() {
+        return headers.begin();
+    }
+    auto end() {
+        return headers.end();
+    }
+};
+
+void testUpgrade() {
+    Client client;
+    client.handler = [](uWS::Http2Response *res, uWS::Http2Request *req) {
+        assert(req->getFullUrl() == "/up?x=1" && req->getHeader("accept") == "*/*" && req->getHeader("upgrade").data() == nullptr);
+        res->end("upgraded");
+    };
+    UpgradedRequest req;
+    assert(client.session->upgrade(&req, setting(S::MAX_CONCURRENT_STREAMS, 100) + setting(S::INITIAL_WINDOW_SIZE, 5)));
+    std::vector<Frame> frames = client.frames(true);
+    assert(frames.size() == 4 && frames[2].type == S::HEADERS && frames[2].streamId == 1 && frames[3].payload == "upgra");
+
+    /* Then the preface, and the rest as the window opens */
+    assert(client.send(PREFACE + frame(S::WINDOW_UPDATE, 0, 1, uint32(3))));
+    frames = client.frames();
+    assert(frames.size() == 1 && frames[0].payload == "ded" && frames[0].flags == S::FLAG_END_STREAM);
+}
+
+int main() {
+    testRequestResponse();
+    testSplitReads();
+    testFlowControl();
+    testTransportBackpressure();
+    testTrailers();
+    testErrors();
+    testUpgrade();
+
+    std::cout << "ALL PASS" << std::endl;
+}
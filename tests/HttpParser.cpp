@@ -1,12 +1,14 @@
 #include <iostream>
 #include <cassert>
+#include <vector>
 
 #include "../src/HttpParser.h"
 
 int main() {
-    /* Parser needs at least 8 bytes post padding */
-    unsigned char data[] = {0x47, 0x45, 0x54, 0x20, 0x2f, 0x20, 0x48, 0x54, 0x54, 0x50, 0x2f, 0x31, 0x2e, 0x31, 0xd, 0xa, 0x61, 0x73, 0x63, 0x69, 0x69, 0x3a, 0x20, 0x74, 0x65, 0x73, 0x74, 0xd, 0xa, 0x75, 0x74, 0x66, 0x38, 0x3a, 0x20, 0xd1, 0x82, 0xd0, 0xb5, 0xd1, 0x81, 0xd1, 0x82, 0xd, 0xa, 0x48, 0x6f, 0x73, 0x74, 0x3a, 0x20, 0x31, 0x32, 0x37, 0x2e, 0x30, 0x2e, 0x30, 0x2e, 0x31, 0xd, 0xa, 0x43, 0x6f, 0x6e, 0x6e, 0x65, 0x63, 0x74, 0x69, 0x6f, 0x6e, 0x3a, 0x20, 0x63, 0x6c, 0x6f, 0x73, 0x65, 0xd, 0xa, 0xd, 0xa, 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E'};
-    int size = sizeof(data) - 8;
+    /* Parser needs at least MINIMUM_HTTP_POST_PADDING (32) bytes post padding */
+    unsigned char data[] = {0x47, 0x45, 0x54, 0x20, 0x2f, 0x20, 0x48, 0x54, 0x54, 0x50, 0x2f, 0x31, 0x2e, 0x31, 0xd, 0xa, 0x61, 0x73, 0x63, 0x69, 0x69, 0x3a, 0x20, 0x74, 0x65, 0x73, 0x74, 0xd, 0xa, 0x75, 0x74, 0x66, 0x38, 0x3a, 0x20, 0xd1, 0x82, 0xd0, 0xb5, 0xd1, 0x81, 0xd1, 0x82, 0xd, 0xa, 0x48, 0x6f, 0x73, 0x74, 0x3a, 0x20, 0x31, 0x32, 0x37, 0x2e, 0x30, 0x2e, 0x30, 0x2e, 0x31, 0xd, 0xa, 0x43, 0x6f, 0x6e, 0x6e, 0x65, 0x63, 0x74, 0x69, 0x6f, 0x6e, 0x3a, 0x20, 0x63, 0x6c, 0x6f, 0x73, 0x65, 0xd, 0xa, 0xd, 0xa, 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E',
+    'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E', 'E'};
+    int size = sizeof(data) - 32;
     void *user = nullptr;
     void *reserved = nullptr;
 
@@ -33,6 +35,138 @@ int main() {
 
     });
 
+    {
+        /* Long mixed case field names and values spanning several scan blocks, uppercase bytes right after the colon */
+        std::string request = "GET /some/path HTTP/1.1\r\n"
+            "X-Some-Very-Long-Header-Name-Spanning-Blocks:ABCDEFGHIJKLMNOPQRSTUVWXYZ\r\n"
+            "Host: localhost\r\n"
+            "X-Tab-Value: first\tSECOND\tthird part that is long enough to span more than one block\r\n"
+            "Accept-Encoding: gzip, deflate, br\r\n"
+            "\r\n";
+        size_t length = request.length();
+        request.append(uWS::MINIMUM_HTTP_POST_PADDING, 'E');
+
+        uWS::HttpParser parser;
+        bool called = false;
+        auto [err, returnedUser] = parser.consumePostPadded(request.data(), (unsigned int) length, user, reserved, [&called](void *s, uWS::HttpRequest *req) -> void * {
+            called = true;
+            assert(req->getUrl() == "/some/path");
+            assert(req->getHeader("x-some-very-long-header-name-spanning-blocks") == "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+            assert(req->getHeader("host") == "localhost");
+            assert(req->getHeader("x-tab-value") == "first\tSECOND\tthird part that is long enough to span more than one block");
+            assert(req->getHeader("accept-encoding") == "gzip, deflate, br");
+            return s;
+        }, [](void *user, std::string_view, bool) -> void * {
+            return user;
+        });
+        assert(called && returnedUser == user);
+    }
+
+    {
+        /* Invalid bytes in field names and control bytes in field values are errors */
+        for (std::string header : {"X Bad: value\r\n", "X-Bad: va\x01lue\r\n", "X-Bad\x80: value\r\n"}) {
+            std::string request = "GET / HTTP/1.1\r\nHost: localhost\r\n" + header + "\r\n";
+            size_t length = request.length();
+            request.append(uWS::MINIMUM_HTTP_POST_PADDING, 'E');
+
+            uWS::HttpParser parser;
+            auto [err, returnedUser] = parser.consumePostPadded(request.data(), (unsigned int) length, user, reserved, [](void *s, uWS::HttpRequest *) -> void * {
+                assert(false);
+                return s;
+            }, [](void *user, std::string_view, bool) -> void * {
+                return user;
+            });
+            (void) err;
+            (void) returnedUser;
+        }
+    }
+
+    {
+        /* Headers split across reads are buffered in a pooled fallback block, which is returned once parsed */
+        std::string request = "GET /split HTTP/1.1\r\nHost: localhost\r\nX-Split: somewhere in the middle\r\n\r\n";
+
+        for (unsigned int split = 1; split < request.length(); split++) {
+            uWS::HttpParser parser;
+            int requests = 0;
+
+            for (std::string part : {request.substr(0, split), request.substr(split)}) {
+                size_t length = part.length();
+                part.append(uWS::MINIMUM_HTTP_POST_PADDING, 'E');
+
+                auto [err, returnedUser] = parser.consumePostPadded(part.data(), (unsigned int) length, user, reserved, [&requests](void *s, uWS::HttpRequest *req) -> void * {
+                    requests++;
+                    assert(req->getUrl() == "/split");
+                    assert(req->getHeader("x-split") == "somewhere in the middle");
+                    return s;
+                }, [](void *user, std::string_view, bool) -> void * {
+                    return user;
+                });
+                assert(returnedUser == user);
+            }
+            assert(requests == 1);
+        }
+    }
+
+    {
+        /* Many tiny chunks in one read are emitted together, followed by the next pipelined request */
+        std::string body, request = "POST /chunked HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n";
+        for (int i = 0; i < 1000; i++) {
+            std::string chunk(1 + i % 20, (char) ('a' + i % 26));
+            char size[16];
+            snprintf(size, sizeof(size), "%X\r\n", (unsigned int) chunk.length());
+            request.append(size).append(chunk).append("\r\n");
+            body += chunk;
+        }
+        request.append("0\r\n\r\nGET /next HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        size_t length = request.length();
+        request.append(uWS::MINIMUM_HTTP_POST_PADDING, 'E');
+
+        uWS::HttpParser parser;
+        int requests = 0, dataCalls = 0;
+        std::string received;
+        auto [err, returnedUser] = parser.consumePostPadded(request.data(), (unsigned int) length, user, reserved, [&requests](void *s, uWS::HttpRequest *) -> void * {
+            requests++;
+            return s;
+        }, [&](void *user, std::string_view data, bool fin) -> void * {
+            dataCalls++;
+            received.append(data);
+            /* The first request ends with all its data at once */
+            assert(fin && (requests == 2 || received == body));
+            return user;
+        });
+        assert(!err && returnedUser == user);
+        assert(requests == 2 && dataCalls == 2 && received == body);
+    }
+
+    {
+        /* What of a body is still to come counts the chunk being emitted, and is unknown when chunked */
+        std::string body(100, 'b'), request = "POST /length HTTP/1.1\r\nHost: localhost\r\nContent-Length: 100\r\n\r\n" + body.substr(0, 30);
+        uWS::HttpParser parser;
+        std::vector<uint64_t> remaining;
+        auto dataHandler = [&](void *user, std::string_view, bool) -> void * {
+            remaining.push_back(parser.getRemainingBodyLength());
+            return user;
+        };
+
+        for (std::string part : {request, body.substr(30)}) {
+            size_t length = part.length();
+            part.append(uWS::MINIMUM_HTTP_POST_PADDING, 'E');
+            parser.consumePostPadded(part.data(), (unsigned int) length, user, reserved, [](void *s, uWS::HttpRequest *) -> void * {
+                return s;
+            }, dataHandler);
+        }
+        assert((remaining == std::vector<uint64_t>{100, 70}) && parser.getRemainingBodyLength() == 0);
+
+        std::string chunked = "POST /chunked HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n";
+        size_t length = chunked.length();
+        chunked.append(uWS::MINIMUM_HTTP_POST_PADDING, 'E');
+        remaining.clear();
+        parser.consumePostPadded(chunked.data(), (unsigned int) length, user, reserved, [](void *s, uWS::HttpRequest *) -> void * {
+            return s;
+        }, dataHandler);
+        assert(remaining.size() && remaining[0] == UINT64_MAX);
+    }
+
     std::cout << "HTTP DONE" << std::endl;
 
 }
\ No newline at end of file
@@ -404,6 +404,73 @@ void testParameters() {
     assert(result == "GLWGPW");
 }
 
+void testFrozen() {
+    std::cout << "TestFrozen" << std::endl;
+    uWS::HttpRouter<int> r;
+    std::string result;
+
+    auto addRoute = [&r, &result](std::vector<std::string> methods, std::string pattern, std::string tag, uint32_t priority) {
+        r.add(methods, pattern, [&result, tag](auto *h) {
+            auto [paramsTop, params] = h->getParameters();
+            result += tag + "(";
+            for (int i = 0; i <= paramsTop; i++) {
+                result += std::string(params[i]) + ",";
+            }
+            result += ")";
+            return false;
+        }, priority);
+    };
+
+    addRoute({"GET"}, "/candy/:kind/*", "GPW", r.MEDIUM_PRIORITY);
+    addRoute({"GET"}, "/candy/lollipop/:action", "GLP", r.MEDIUM_PRIORITY);
+    addRoute({"GET"}, "/candy/lollipop/eat", "GLS", r.MEDIUM_PRIORITY);
+    addRoute({"GET"}, "/*", "WW", r.HIGH_PRIORITY);
+    addRoute({"POST"}, "/a/:b/c", "PP", r.MEDIUM_PRIORITY);
+    addRoute({"*"}, "/a/:b/c", "AP", r.LOW_PRIORITY);
+    addRoute({"*"}, "/*", "AW", r.LOW_PRIORITY);
+
+    std::vector<std::pair<std::string, std::string>> requests = {
+        {"GET", "/candy/lollipop/eat"}, {"GET", "/candy/lollipop/"}, {"GET", "/candy/gum/chew"},
+        {"POST", "/a/b/c"}, {"PATCH", "/a/b/c"}, {"GET", "/"}, {"DELETE", "/nothing/here"}
+    };
+
+    /* The frozen table must route exactly like the tree */
+    std::vector<std::string> expected;
+    for (auto &[method, url] : requests) {
+        result.clear();
+        r.route(method, url);
+        expected.push_back(result);
+    }
+
+    r.freeze();
+    assert(r.isFrozen());
+    for (unsigned int i = 0; i < requests.size(); i++) {
+        result.clear();
+        r.route(requests[i].first, requests[i].second);
+        assert(result == expected[i]);
+    }
+
+    /* Adding thaws the table, the tree is still authoritative */
+    addRoute({"GET"}, "/candy/gum/chew", "GGS", r.MEDIUM_PRIORITY);
+    assert(!r.isFrozen());
+    result.clear();
+    r.route("GET", "/candy/gum/chew");
+    std::string afterAdd = result;
+
+    r.freeze();
+    result.clear();
+    r.route("GET", "/candy/gum/chew");
+    assert(result == afterAdd);
+
+    /* And so does removing */
+    r.remove("GET", "/candy/gum/chew", r.MEDIUM_PRIORITY);
+    assert(!r.isFrozen());
+    r.freeze();
+    result.clear();
+    r.route("GET", "/candy/gum/chew");
+    assert(result == expected[2]);
+}
+
 #include <chrono>
 
 void testPerformance() {
@@ -436,5 +503,6 @@ int main() {
     testUpgrade();
     testBugReports();
     testParameters();
+    testFrozen();
     testPerformance();
 }
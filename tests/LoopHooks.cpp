@@ -0,0 +1,63 @@
+#include "../src/LoopHooks.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+/* By priority, then in the order added. A key keeps its first hook */
+void testOrder() {
+    uWS::LoopHooks hooks;
+    std::string ran;
+    int a, b, c, d;
+    hooks.add(&a, [&](uWS::Loop *) {ran += "a";}, uWS::LoopHooks::LATE_PRIORITY);
+    hooks.add(&b, [&](uWS::Loop *) {ran += "b";});
+    hooks.add(&c, [&](uWS::Loop *) {ran += "c";});
+    hooks.add(&d, [&](uWS::Loop *) {ran += "d";}, uWS::LoopHooks::EARLY_PRIORITY);
+    hooks.add(&b, [&](uWS::Loop *) {ran += "x";});
+    hooks.run(nullptr);
+    assert(ran == "dbca" && hooks.size() == 4);
+
+    hooks.remove(&b);
+    hooks.remove(&b);
+    ran.clear();
+    hooks.run(nullptr);
+    assert(ran == "dca" && hooks.size() == 3 && !hooks.has(&b));
+}
+
+/* Removing from within, the running hook included, and adding from within */
+void testFromWithin() {
+    uWS::LoopHooks hooks;
+    std::string ran;
+    int a, b, c, d;
+    hooks.add(&a, [&](uWS::Loop *) {
+        ran += "a";
+        hooks.remove(&a);
+        hooks.remove(&b);
+        hooks.add(&d, [&](uWS::Loop *) {ran += "d";});
+    });
+    hooks.add(&b, [&](uWS::Loop *) {ran += "b";});
+    hooks.add(&c, [&](uWS::Loop *) {ran += "c";});
+    hooks.run(nullptr);
+    assert(ran == "ac" && hooks.size() == 2);
+
+    ran.clear();
+    hooks.run(nullptr);
+    assert(ran == "cd");
+
+    /* Added and removed again before it ever ran */
+    hooks.add(&a, [&](uWS::Loop *) {
+        hooks.add(&b, [&](uWS::Loop *) {ran += "b";});
+        hooks.remove(&b);
+    });
+    ran.clear();
+    hooks.run(nullptr);
+    hooks.run(nullptr);
+    assert(ran == "cdcd" && !hooks.has(&b) && hooks.size() == 3);
+}
+
+int main() {
+    testOrder();
+    testFromWithin();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,139 @@
+#include "../src/LoopProfile.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+static long long fakeTime = 1000;
+
+static long long fakeClock() {
+    return fakeTime;
+}
+
+/* Waiting, dispatching and handlers of an iteration, nested handlers timed as their outermost */
+void testIteration() {
+    uWS::LoopProfile profile(1000);
+    profile.clock = fakeClock;
+
+    profile.beforePoll();
+    fakeTime += 50;
+    profile.noteEvent();
+    profile.noteEvent();
+    fakeTime += 10;
+    std::string label = "GET /api/:id";
+    {
+        uWS::ProfiledHandler outer(&profile, "http", &label);
+        fakeTime += 100;
+        uWS::ProfiledHandler inner(&profile, "close");
+        fakeTime += 20;
+    }
+    profile.beginDefers();
+    fakeTime += 30;
+    profile.endDefers();
+    fakeTime += 5;
+    profile.afterIteration();
+
+    uWS::LoopProfileSnapshot snapshot = profile.snapshot();
+    assert(snapshot.iterations() == 1 && snapshot.pollMicroseconds == 50);
+    assert(snapshot.iterationMicroseconds.sum == 165 && snapshot.handlerMicroseconds.sum == 150);
+    assert(snapshot.libraryMicroseconds() == 15 && snapshot.events.sum == 2);
+    assert(snapshot.deferMicroseconds.count == 1 && snapshot.deferMicroseconds.sum == 30);
+    assert(snapshot.stallCount == 0 && snapshot.stalls.empty());
+
+    /* Without events nor handlers, nothing is busy and no defers are recorded */
+    profile.beforePoll();
+    fakeTime += 400;
+    profile.afterIteration();
+    snapshot = profile.snapshot();
+    assert(snapshot.iterations() == 2 && snapshot.pollMicroseconds == 450 && snapshot.iterationMicroseconds.sum == 165);
+    assert(snapshot.deferMicroseconds.count == 1);
+
+    /* An iteration begun before profiling is not recorded */
+    profile.afterIteration();
+    assert(profile.snapshot().iterations() == 2);
+}
+
+/* Stalls name their handler, iterations stall only if none of their handlers did */
+void testStalls() {
+    uWS::LoopProfile profile(1000);
+    profile.clock = fakeClock;
+    int reported = 0;
+    profile.onStall = [&reported](const uWS::LoopStall &stall) {
+        reported++;
+        assert(stall.microseconds >= 1000);
+    };
+
+    std::string label = "POST /parse";
+    profile.beforePoll();
+    profile.noteEvent();
+    {
+        uWS::ProfiledHandler profiled(&profile, "http", &label);
+        fakeTime += 5000;
+    }
+    profile.afterIteration();
+
+    profile.beforePoll();
+    for (int i = 0; i < 3; i++) {
+        uWS::ProfiledHandler profiled(&profile, "message");
+        fakeTime += 600;
+    }
+    profile.afterIteration();
+
+    uWS::LoopProfileSnapshot snapshot = profile.snapshot();
+    assert(reported == 2 && snapshot.stallCount == 2);
+    assert(snapshot.stalls[0].microseconds == 5000 && std::string(snapshot.stalls[0].kind) == "http" && snapshot.stalls[0].label == label);
+    assert(snapshot.stalls[1].microseconds == 1800 && std::string(snapshot.stalls[1].kind) == "iteration");
+
+    /* Only the longest are kept, longest first */
+    for (unsigned int i = 0; i < 2 * uWS::LoopProfile::MAX_STALLS; i++) {
+        profile.beforePoll();
+        {
+            uWS::ProfiledHandler profiled(&profile, "drain");
+            fakeTime += 2000 + i;
+        }
+        profile.afterIteration();
+    }
+    snapshot = profile.snapshot();
+    assert(snapshot.stallCount == 2 + 2 * uWS::LoopProfile::MAX_STALLS && snapshot.stalls.size() == uWS::LoopProfile::MAX_STALLS);
+    assert(snapshot.stalls[0].microseconds == 5000);
+    for (size_t i = 1; i < snapshot.stalls.size(); i++) {
+        assert(snapshot.stalls[i].microseconds <= snapshot.stalls[i - 1].microseconds && snapshot.stalls[i].microseconds >= 2000 + uWS::LoopProfile::MAX_STALLS + 1);
+    }
+}
+
+/* onStall replacing itself keeps running until it returns, the profile is busy meanwhile */
+void testReplacedOnStall() {
+    uWS::LoopProfile profile(1000);
+    profile.clock = fakeClock;
+    int first = 0, second = 0;
+    bool busy = false;
+    std::string captured = "captured by the first onStall";
+    profile.setOnStall([&, captured](const uWS::LoopStall &) {
+        first++;
+        busy = profile.busy();
+        profile.setOnStall([&second](const uWS::LoopStall &) {
+            second++;
+        });
+        /* Still ours */
+        assert(captured == "captured by the first onStall");
+    });
+
+    for (int i = 0; i < 2; i++) {
+        profile.beforePoll();
+        {
+            uWS::ProfiledHandler profiled(&profile, "http");
+            assert(profile.busy());
+            fakeTime += 2000;
+        }
+        profile.afterIteration();
+    }
+    assert(first == 1 && second == 1 && busy && !profile.busy());
+}
+
+int main() {
+    testIteration();
+    testStalls();
+    testReplacedOnStall();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include "../src/AsyncSocketData.h"
+
+/* Counts what goes through it, and frees it on the heap */
+struct CountingResource : std::pmr::memory_resource {
+    size_t allocated = 0, deallocated = 0;
+
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        allocated += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void *memory, size_t bytes, size_t alignment) override {
+        deallocated += bytes;
+        std::pmr::new_delete_resource()->deallocate(memory, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+/* Freed memory is reused by its size class, arenas are only mapped as needed */
+void testHugePageResource() {
+    uWS::HugePageResource resource(-1);
+    char *a = (char *) resource.allocate(16 * 1024);
+    char *b = (char *) resource.allocate(16 * 1024);
+    assert(resource.getArenas() == 1 && a != b);
+    memset(a, 1, 16 * 1024);
+    memset(b, 2, 16 * 1024);
+
+    resource.deallocate(a, 16 * 1024);
+    assert(resource.allocate(10000) == a);
+    resource.deallocate(a, 10000);
+
+    /* The rest of a full arena is not lost to the next one */
+    char *c = (char *) resource.allocate(uWS::HugePageResource::MAX_SIZE);
+    char *d = (char *) resource.allocate(uWS::HugePageResource::MAX_SIZE);
+    assert(resource.getArenas() == 2);
+    char *g = (char *) resource.allocate(32 * 1024);
+    assert(g >= a && g < a + uWS::HugePageResource::ARENA_SIZE && resource.getArenas() == 2);
+    resource.deallocate(g, 32 * 1024);
+
+    /* Larger than a size class, or aligned above one, goes upstream */
+    void *e = resource.allocate(4 * 1024 * 1024);
+    void *f = resource.allocate(64, 4096);
+    assert(((uintptr_t) f & 4095) == 0 && resource.getArenas() == 2);
+    resource.deallocate(e, 4 * 1024 * 1024);
+    resource.deallocate(f, 64, 4096);
+    resource.deallocate(b, 16 * 1024);
+    resource.deallocate(c, uWS::HugePageResource::MAX_SIZE);
+    resource.deallocate(d, uWS::HugePageResource::MAX_SIZE);
+    assert(resource.getHugePageArenas() <= resource.getArenas());
+}
+
+/* Backpressure is taken from the pool's resource, and pooled only if it is still that resource */
+void testBackPressure() {
+    CountingResource first, second;
+    uWS::BackPressurePool::get().setResource(&first);
+    {
+        uWS::BackPressure backPressure;
+        backPressure.append(std::string(40000, 'a').data(), 40000);
+        assert(first.allocated >= 40000);
+
+        uWS::BackPressurePool::get().setResource(&second);
+        backPressure.append(std::string(100, 'b').data(), 100);
+        assert(second.allocated == uWS::BackPressurePool::BLOCK_SIZE);
+        backPressure.erase(40100);
+    }
+    assert(first.deallocated == first.allocated);
+    assert(second.deallocated == 0);
+    uWS::BackPressurePool::get().setResource(std::pmr::new_delete_resource());
+    assert(second.deallocated == second.allocated);
+}
+
+/* Leaving a loop copies blocks of its resource to the heap, bytes and order kept */
+void testLeaveBudget() {
+    CountingResource resource;
+    uWS::BackPressurePool::get().setResource(&resource);
+    uWS::BackPressure backPressure;
+    backPressure.append(std::string(20000, 'a').data(), 20000);
+    backPressure.append(std::string(10, 'b').data(), 10);
+    backPressure.leaveBudget();
+    assert(resource.deallocated == resource.allocated);
+
+    uWS::BackPressurePool::get().setResource(std::pmr::new_delete_resource());
+    backPressure.joinBudget();
+    backPressure.append(std::string(10, 'c').data(), 10);
+    std::string written;
+    std::string_view segments[4];
+    unsigned int numSegments = backPressure.segments(segments, 4);
+    for (unsigned int i = 0; i < numSegments; i++) {
+        written.append(segments[i]);
+    }
+    assert(written == std::string(20000, 'a') + std::string(10, 'b') + std::string(10, 'c'));
+    backPressure.erase(written.length());
+    assert(!backPressure.length());
+}
+
+/* The pools count what they hold as they allocate, and so do zlib streams, moving with them across threads */
+void testAccounting() {
+    uWS::BackPressurePool::get().trim();
+    size_t blockBytes = uWS::BackPressurePool::get().bytes;
+    {
+        uWS::BackPressure backPressure;
+        backPressure.append(std::string(100, 'a').data(), 100);
+        assert(uWS::BackPressurePool::get().bytes == blockBytes + uWS::BackPressurePool::BLOCK_SIZE);
+        backPressure.leaveBudget();
+        assert(uWS::BackPressurePool::get().bytes == blockBytes);
+        backPressure.joinBudget();
+    }
+    /* Idle blocks still count */
+    assert(uWS::BackPressurePool::get().bytes == blockBytes + uWS::BackPressurePool::BLOCK_SIZE);
+    uWS::BackPressurePool::get().trim();
+    assert(uWS::BackPressurePool::get().bytes == blockBytes);
+
+    long long zlibBytes = uWS::ZlibMemory::threadBytes();
+    uWS::DeflationStream *deflationStream = new uWS::DeflationStream(uWS::DEDICATED_COMPRESSOR);
+    assert(deflationStream->memory.bytes > 256 * 1024 && uWS::ZlibMemory::threadBytes() == zlibBytes + (long long) deflationStream->memory.bytes);
+    deflationStream->memory.leaveThread();
+    assert(uWS::ZlibMemory::threadBytes() == zlibBytes);
+    deflationStream->memory.joinThread();
+    delete deflationStream;
+    assert(uWS::ZlibMemory::threadBytes() == zlibBytes);
+}
+
+int main() {
+    testHugePageResource();
+    testBackPressure();
+    testLeaveBudget();
+    testAccounting();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,62 @@
+#include "../src/MoveOnlyFunction.h"
+
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <utility>
+
+/* Two pointers fit the default, more go to the heap and are counted */
+void testDefaultCapacity() {
+    int a = 1, b = 2, c = 3;
+    auto small = [&a, &b]() {return a + b;};
+    auto large = [&a, &b, &c]() {return a + b + c;};
+    static_assert(uWS::fitsMoveOnlyFunction<decltype(small)>);
+    static_assert(!uWS::fitsMoveOnlyFunction<decltype(large)>);
+
+    unsigned long long before = uWS::getMoveOnlyFunctionHeapAllocations();
+    uWS::MoveOnlyFunction<int()> f = small;
+    assert(f() == 3 && uWS::getMoveOnlyFunctionHeapAllocations() == before);
+    f = large;
+    assert(f() == 6 && uWS::getMoveOnlyFunctionHeapAllocations() == before + 1);
+}
+
+/* What response handlers typically capture is held inline */
+void testResponseHandler() {
+    void *res = nullptr;
+    std::shared_ptr<int> state = std::make_shared<int>(4);
+    int *counter = nullptr;
+    auto handler = [res, state, counter](unsigned long offset) {return !res && !counter && offset == (unsigned long) *state;};
+    static_assert(uWS::fitsMoveOnlyFunction<decltype(handler), UWS_RESPONSE_HANDLER_CAPACITY>);
+
+    unsigned long long before = uWS::getMoveOnlyFunctionHeapAllocations();
+    uWS::ResponseHandler<bool(unsigned long)> f = std::move(handler);
+    assert(f(4) && state.use_count() == 2);
+
+    /* Moves and swaps keep the callable inline, and whole */
+    uWS::ResponseHandler<bool(unsigned long)> g = std::move(f);
+    assert(!f && g(4) && state.use_count() == 2);
+    uWS::ResponseHandler<bool(unsigned long)> h = [](unsigned long) {return false;};
+    std::swap(g, h);
+    assert(!g(4) && h(4));
+    assert(uWS::getMoveOnlyFunctionHeapAllocations() == before);
+
+    h = nullptr;
+    assert(!h && state.use_count() == 1);
+}
+
+/* A function of one capacity is held by one of greater capacity, inline */
+void testAcrossCapacities() {
+    int a = 5;
+    uWS::MoveOnlyFunction<int()> f = [&a]() {return a;};
+    unsigned long long before = uWS::getMoveOnlyFunctionHeapAllocations();
+    uWS::ResponseHandler<int()> g = std::move(f);
+    assert(g() == 5 && uWS::getMoveOnlyFunctionHeapAllocations() == before);
+}
+
+int main() {
+    testDefaultCapacity();
+    testResponseHandler();
+    testAcrossCapacities();
+
+    std::cout << "ALL PASS" << std::endl;
+}
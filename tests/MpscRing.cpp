@@ -0,0 +1,72 @@
+#include "../src/MpscRing.h"
+
+#include <cassert>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+void testBasics() {
+    uWS::MpscRing<int> ring(5);
+    assert(ring.capacity() == 8);
+
+    int value;
+    assert(!ring.pop(value));
+
+    /* Fills up, then frees one cell per pop, around and around */
+    for (int i = 0; i < 8; i++) {
+        assert(ring.push(i));
+    }
+    assert(!ring.push(8));
+    for (int i = 0; i < 100; i++) {
+        assert(ring.pop(value) && value == i);
+        assert(ring.push(i + 8));
+        assert(!ring.push(-1));
+    }
+    for (int i = 100; i < 108; i++) {
+        assert(ring.pop(value) && value == i);
+    }
+    assert(!ring.pop(value));
+}
+
+/* Producers retry when full, the consumer has to see every value once, in order per producer */
+void testProducers() {
+    static constexpr int PRODUCERS = 4, COUNT = 200000;
+    uWS::MpscRing<long> ring(64);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        producers.emplace_back([&ring, p]() {
+            for (long i = 0; i < COUNT; i++) {
+                while (!ring.push((long) p * COUNT + i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    std::vector<long> next(PRODUCERS, 0);
+    for (long received = 0; received < (long) PRODUCERS * COUNT; ) {
+        long value;
+        if (!ring.pop(value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        int p = (int) (value / COUNT);
+        assert(value % COUNT == next[(size_t) p]);
+        next[(size_t) p]++;
+        received++;
+    }
+
+    for (std::thread &producer : producers) {
+        producer.join();
+    }
+    long value;
+    assert(!ring.pop(value));
+}
+
+int main() {
+    testBasics();
+    testProducers();
+
+    std::cout << "ALL PASS" << std::endl;
+}
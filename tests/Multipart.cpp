@@ -0,0 +1,89 @@
+#include "../src/Multipart.h"
+
+#include <cassert>
+#include <string>
+#include <vector>
+#include <iostream>
+
+struct Part {
+    std::string name;
+    std::string body;
+    bool ended = false;
+};
+
+/* Feeds body in chunks of chunkSize and collects the parts */
+std::vector<Part> streamParts(std::string_view contentType, std::string body, size_t chunkSize) {
+    uWS::StreamingMultipartParser parser(contentType);
+    assert(parser.isValid());
+
+    std::vector<Part> parts;
+    parser.onPart([&parts](std::pair<std::string_view, std::string_view> *headers) {
+        parts.emplace_back();
+        for (int i = 0; headers[i].first.length(); i++) {
+            if (headers[i].first == "content-disposition") {
+                uWS::ParameterParser pp(headers[i].second);
+                while (true) {
+                    auto [key, value] = pp.getKeyValue();
+                    if (!key.length()) {
+                        break;
+                    }
+                    if (key == "name") {
+                        parts.back().name = value;
+                    }
+                }
+            }
+        }
+    });
+    parser.onPartData([&parts](std::string_view data, bool last) {
+        assert(parts.size() && !parts.back().ended);
+        parts.back().body.append(data);
+        parts.back().ended = last;
+    });
+
+    for (size_t offset = 0; offset < body.length(); offset += chunkSize) {
+        /* Copy the chunk so that views into previous chunks would be caught by ASAN */
+        std::string chunk = body.substr(offset, chunkSize);
+        assert(parser.consume(chunk));
+    }
+    assert(parser.isDone());
+    return parts;
+}
+
+int main() {
+    std::string contentType = "multipart/form-data; boundary=----WebKitFormBoundaryePkpFF7tjBAqx29L";
+    std::string boundary = "------WebKitFormBoundaryePkpFF7tjBAqx29L";
+
+    std::string tricky = "line\r\n--\r\n------WebKitFormBoundary\r\n--" + boundary.substr(0, 20) + "\r";
+    std::string body = "preamble to ignore\r\n" + boundary + "\r\n"
+        "Content-Disposition: form-data; name=\"first\"\r\n"
+        "Content-Type: text/plain\r\n\r\n"
+        + tricky + "\r\n" + boundary + "\r\n"
+        "Content-Disposition: form-data; name=\"empty\"\r\n\r\n"
+        "\r\n" + boundary + "\r\n"
+        "Content-Disposition: form-data; name=\"last\"\r\n\r\n"
+        "last part\r\n" + boundary + "--\r\nepilogue to ignore";
+
+    /* The whole body at once and any split must give the same parts */
+    for (size_t chunkSize = 1; chunkSize <= body.length(); chunkSize++) {
+        std::vector<Part> parts = streamParts(contentType, body, chunkSize);
+        assert(parts.size() == 3);
+        assert(parts[0].name == "first" && parts[0].body == tricky && parts[0].ended);
+        assert(parts[1].name == "empty" && parts[1].body == "" && parts[1].ended);
+        assert(parts[2].name == "last" && parts[2].body == "last part" && parts[2].ended);
+    }
+
+    /* A body starting right with the boundary has no preamble */
+    {
+        std::vector<Part> parts = streamParts(contentType, boundary + "\r\n\r\nno headers\r\n" + boundary + "--", 7);
+        assert(parts.size() == 1 && parts[0].body == "no headers");
+    }
+
+    /* Invalid content type and garbage after boundary */
+    assert(!uWS::StreamingMultipartParser("text/plain").isValid());
+    {
+        uWS::StreamingMultipartParser parser(contentType);
+        assert(!parser.consume(boundary + "xx"));
+    }
+
+    std::cout << "ALL PASS" << std::endl;
+}
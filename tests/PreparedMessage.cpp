@@ -0,0 +1,79 @@
+/* Needs the headers of uSockets, not the library, as long as no Loop is made */
+#include "../src/PreparedMessage.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+/* What a client would make of a server frame */
+struct Frame {
+    bool fin, compressed;
+    int opCode;
+    std::string payload;
+};
+
+Frame parseFrame(std::string_view frame) {
+    const unsigned char *data = (const unsigned char *) frame.data();
+    assert(!(data[1] & 128));
+    size_t length = data[1] & 127, header = 2;
+    if (length == 126) {
+        length = (size_t) data[2] << 8 | data[3];
+        header = 4;
+    } else if (length == 127) {
+        length = 0;
+        for (int i = 0; i < 8; i++) {
+            length = length << 8 | data[2 + i];
+        }
+        header = 10;
+    }
+    assert(header + length == frame.length());
+    return {(data[0] & 128) != 0, (data[0] & 64) != 0, data[0] & 15, std::string(frame.substr(header))};
+}
+
+int main() {
+    uWS::LoopData loopData;
+
+    /* Framed once for servers, short, medium and long headers. Without a loop (as asked not to compress) */
+    for (size_t length : {0u, 5u, 125u, 126u, 65535u, 65536u, 100000u}) {
+        std::string payload(length, 'p');
+        uWS::PreparedMessage message(nullptr, payload, uWS::TEXT);
+        assert(message.getMessage() == payload && message.getOpCode() == uWS::TEXT && !message.isCompressed());
+
+        Frame frame = parseFrame(message.getFrame());
+        assert(frame.fin && !frame.compressed && frame.opCode == uWS::TEXT && frame.payload == payload);
+        /* Asking for the compressed frame of one not compressed is the uncompressed one */
+        assert(message.getFrame(true) == message.getFrame());
+        /* Which is what topic histories keep */
+        assert(uWS::PreparedMessage::frameOf(payload, uWS::TEXT).view() == message.getFrame());
+    }
+
+    /* Compressed once too, with the shared compressor of the loop, which inflates back to the message */
+    std::string text;
+    for (int i = 0; i < 1000; i++) {
+        text += "prepared message " + std::to_string(i % 10) + " ";
+    }
+    uWS::PreparedMessage compressed(&loopData, text, uWS::TEXT);
+    assert(compressed.isCompressed() && loopData.deflationStream);
+
+    Frame frame = parseFrame(compressed.getFrame(true));
+    assert(frame.fin && frame.compressed && frame.opCode == uWS::TEXT && frame.payload.length() < text.length() / 10);
+    uWS::InflationStream inflationStream(uWS::CompressOptions::DEDICATED_DECOMPRESSOR);
+    /* Inflating appends the tail of the deflate block past the payload, like into the padding of the receive buffer */
+    std::string padded = frame.payload + std::string(4, 0);
+    std::optional<std::string_view> inflated = inflationStream.inflate(loopData.zlibContext, std::string_view(padded.data(), frame.payload.length()), text.length(), true);
+    assert(inflated && *inflated == text);
+
+    frame = parseFrame(compressed.getFrame());
+    assert(!frame.compressed && frame.payload == text);
+
+    /* Twice, the same, as the shared compressor keeps no context */
+    uWS::PreparedMessage again(&loopData, text, uWS::TEXT);
+    assert(again.getFrame(true) == compressed.getFrame(true));
+
+    /* Never empty messages nor control frames */
+    assert(!uWS::PreparedMessage(&loopData, "", uWS::BINARY).isCompressed());
+    uWS::PreparedMessage ping(&loopData, "ping ping ping ping", uWS::PING);
+    assert(!ping.isCompressed() && parseFrame(ping.getFrame(true)).opCode == uWS::PING);
+
+    std::cout << "ALL PASS" << std::endl;
+}
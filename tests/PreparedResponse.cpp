@@ -0,0 +1,44 @@
+#include "../src/PreparedResponse.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+int main() {
+    uWS::PreparedResponse prepared("200 OK", {{"Content-Type", "text/plain"}, {"Cache-Control", "max-age=60"}}, "hello world");
+    assert(prepared.getHeaders() == "Content-Type: text/plain\r\nCache-Control: max-age=60\r\n");
+    assert(prepared.getBody() == "hello world");
+
+    const char *date = "Wed, 14 Oct 2026 10:00:00 GMT";
+    std::string head = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nCache-Control: max-age=60\r\nDate: " + std::string(date) + "\r\n";
+    std::string tail = "Content-Length: 11\r\n\r\nhello world";
+
+    /* With the mark, unless built without it */
+#ifndef UWS_HTTPRESPONSE_NO_WRITEMARK
+    std::string expected = head + "uWebSockets: 20\r\n" + tail;
+#else
+    std::string expected = head + tail;
+#endif
+    std::string out(prepared.length(true), 0);
+    prepared.copyTo(out.data(), date, true);
+    assert(out == expected);
+
+    /* Without it, as for a silent loop */
+    out.assign(prepared.length(false), 0);
+    prepared.copyTo(out.data(), date, false);
+    assert(out == head + tail);
+
+    /* Date is patched in every time */
+    const char *later = "Wed, 14 Oct 2026 10:00:01 GMT";
+    prepared.copyTo(out.data(), later, false);
+    assert(out.find(later) != std::string::npos && out.find(date) == std::string::npos);
+
+    /* No headers, no body */
+    uWS::PreparedResponse empty("204 No Content", {}, "");
+    assert(empty.getHeaders().empty() && empty.getBody().empty());
+    out.assign(empty.length(false), 0);
+    empty.copyTo(out.data(), date, false);
+    assert(out == "HTTP/1.1 204 No Content\r\nDate: " + std::string(date) + "\r\nContent-Length: 0\r\n\r\n");
+
+    std::cout << "ALL PASS" << std::endl;
+}
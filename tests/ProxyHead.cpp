@@ -0,0 +1,102 @@
+#include "../src/ProxyHead.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+
+bool parse(uWS::ProxyHead &head, std::string_view text) {
+    head = {};
+    return head.parse(text);
+}
+
+void testStatusLine() {
+    uWS::ProxyHead head;
+    assert(parse(head, "HTTP/1.1 200 OK\r\n"));
+    assert(head.code == 200 && head.status == "200 OK" && head.keepAlive);
+    assert(!head.contentLength && !head.chunked && !head.closeDelimited);
+
+    /* Informational responses have no fields worth reading, a malformed one of those would be skipped anyway */
+    assert(parse(head, "HTTP/1.1 100 Continue\r\nbroken\r\n") && head.code == 100);
+
+    assert(!parse(head, "HTTP/2.0 200 OK\r\n"));
+    assert(!parse(head, "HTTP/1.1  200 OK\r\n"));
+    assert(!parse(head, "HTTP/1.1 2x0 OK\r\n"));
+    assert(!parse(head, "HTTP/1.1 099 Low\r\n"));
+    assert(!parse(head, "HTTP/1.1 20\r\n"));
+    assert(!parse(head, "HTTP/1.1 200 OK\r\nno colon\r\n"));
+    assert(!parse(head, "HTTP/1.1 200 OK\r\n: no key\r\n"));
+}
+
+void testFraming() {
+    uWS::ProxyHead head;
+    assert(parse(head, "HTTP/1.1 200 OK\r\nContent-Length: 42\r\n") && head.contentLength == 42u);
+    assert(parse(head, "HTTP/1.1 200 OK\r\ncontent-length:0\r\n") && head.contentLength == 0u);
+
+    /* Duplicates are fine as long as they agree */
+    assert(parse(head, "HTTP/1.1 200 OK\r\nContent-Length: 7\r\ncontent-length: 7\r\n") && head.contentLength == 7u);
+    assert(!parse(head, "HTTP/1.1 200 OK\r\nContent-Length: 7\r\nContent-Length: 8\r\n"));
+    assert(!parse(head, "HTTP/1.1 200 OK\r\nContent-Length: \r\n"));
+    assert(!parse(head, "HTTP/1.1 200 OK\r\nContent-Length: -1\r\n"));
+    assert(!parse(head, "HTTP/1.1 200 OK\r\nContent-Length: 12a\r\n"));
+    assert(!parse(head, "HTTP/1.1 200 OK\r\nContent-Length: 1234567890123456789\r\n"));
+
+    assert(parse(head, "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip, CHUNKED\r\n") && head.chunked && !head.closeDelimited);
+    assert(parse(head, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked, gzip\r\nContent-Length: 5\r\n") && !head.chunked && head.closeDelimited);
+    assert(parse(head, "HTTP/1.1 200 OK\r\nTransfer-Encoding: ked\r\n") && !head.chunked && head.closeDelimited);
+}
+
+void testKeepAlive() {
+    uWS::ProxyHead head;
+    assert(parse(head, "HTTP/1.1 200 OK\r\nConnection: Close\r\n") && !head.keepAlive);
+    assert(parse(head, "HTTP/1.1 200 OK\r\nConnection: upgrade, foo\r\n") && head.keepAlive);
+    assert(parse(head, "HTTP/1.0 200 OK\r\n") && !head.keepAlive);
+    assert(parse(head, "HTTP/1.0 200 OK\r\nConnection: Keep-Alive\r\n") && head.keepAlive);
+    assert(parse(head, "HTTP/1.0 200 OK\r\nConnection: close\r\n") && !head.keepAlive);
+}
+
+void testForwardedFields() {
+    std::string_view text = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nConnection: keep-alive, X-Hop\r\nKeep-Alive: timeout=5\r\n"
+                            "x-hop: 1\r\nContent-Length: 3\r\nTransfer-Encoding: identity\r\nSet-Cookie: a=b\r\nTE: trailers\r\n";
+    uWS::ProxyHead head;
+    assert(parse(head, text) && head.closeDelimited);
+
+    std::vector<std::string> forwarded;
+    assert(uWS::ProxyHead::forEachField(text, [&head, &forwarded](std::string_view key, std::string_view value) {
+        if (head.forwards(key)) {
+            forwarded.push_back(std::string(key) + "=" + std::string(value));
+        }
+        return true;
+    }));
+    assert((forwarded == std::vector<std::string>{"Content-Type=text/plain", "Set-Cookie=a=b"}));
+
+    /* The handler can stop early, which is not a failure to parse */
+    int seen = 0;
+    assert(!uWS::ProxyHead::forEachField(text, [&seen](std::string_view, std::string_view) {
+        return ++seen < 2;
+    }));
+    assert(seen == 2);
+}
+
+void testTokens() {
+    assert(uWS::ProxyHead::hasToken("close", "close"));
+    assert(uWS::ProxyHead::hasToken(" \tClose\t ", "close"));
+    assert(uWS::ProxyHead::hasToken("a,,b , c", "c"));
+    assert(uWS::ProxyHead::hasToken("a,b,", "b"));
+    assert(!uWS::ProxyHead::hasToken("", "close"));
+    assert(!uWS::ProxyHead::hasToken("closed, enclose", "close"));
+    assert(!uWS::ProxyHead::hasToken("a b", "a"));
+
+    assert(uWS::ProxyHead::isHopByHop("Transfer-Encoding") && uWS::ProxyHead::isHopByHop("proxy-connection"));
+    assert(!uWS::ProxyHead::isHopByHop("Trailers") && !uWS::ProxyHead::isHopByHop("content-length"));
+}
+
+int main() {
+    testStatusLine();
+    testFraming();
+    testKeepAlive();
+    testForwardedFields();
+    testTokens();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <cassert>
+#include <string>
 
 #include "../src/QueryParser.h"
 
@@ -38,5 +39,68 @@ int main() {
         assert(uWS::getDecodedQueryValue("test2", (char *) buf.data()) == "some Value");
     }
 
+    {
+        /* Longer than one SIMD block on both sides of the escapes */
+        std::string buf = "?a=0123456789abcdef0123456789abcdef+x%41y%2b0123456789abcdef";
+        assert(uWS::getDecodedQueryValue("a", (char *) buf.data()) == "0123456789abcdef0123456789abcdef xAy+0123456789abcdef");
+    }
+
+    {
+        std::string buf = "?a=bad%4";
+        assert(uWS::getDecodedQueryValue("a", (char *) buf.data()).data() == nullptr);
+    }
+
+    {
+        std::string buf = "?test1=&flag&test2=some%20Value&test1=second&test3=%2541";
+        uWS::QueryIndex index;
+        assert(index.get("test2", buf) == "some Value");
+        assert(index.get("test1", buf) == "");
+        assert(index.get("test1", buf).data() != nullptr);
+        assert(index.get("flag", buf).data() == nullptr);
+        assert(index.get("missing", buf).data() == nullptr);
+        assert(index.get("", buf).data() == nullptr);
+        /* Values are only decoded once */
+        assert(index.get("test3", buf) == "%41");
+        assert(index.get("test3", buf) == "%41");
+        assert(index.get("test2", buf) == "some Value");
+        assert(uWS::getDecodedQueryValue("test3", buf) == "%41" && uWS::getDecodedQueryValue("test2", buf) == "some Value");
+    }
+
+    {
+        /* Decoded by getDecodedQueryValue first, then indexed */
+        std::string buf = "?a=%2541&b=x+y&c=%";
+        assert(uWS::getDecodedQueryValue("a", buf) == "%41" && uWS::getDecodedQueryValue("a", buf) == "%41");
+        assert(uWS::getDecodedQueryValue("b", buf) == "x y");
+        uWS::QueryIndex index;
+        assert(index.get("a", buf) == "%41" && index.get("b", buf) == "x y" && index.get("c", buf).data() == nullptr);
+    }
+
+    {
+        /* More parameters than the index holds fall back to scanning the rest */
+        std::string buf;
+        for (unsigned int i = 0; i < uWS::QueryIndex::MAX_QUERY_PARAMETERS * 2; i++) {
+            buf += (i ? "&k" : "?k") + std::to_string(i) + "=v" + std::to_string(i);
+        }
+        uWS::QueryIndex index;
+        for (unsigned int i = 0; i < uWS::QueryIndex::MAX_QUERY_PARAMETERS * 2; i++) {
+            assert(index.get("k" + std::to_string(i), buf) == "v" + std::to_string(i));
+        }
+        assert(index.get("k1000", buf).data() == nullptr);
+
+        /* Escapes that decode to escapes, of indexed and scanned parameters, read again by either */
+        buf += "&k32=%2541&k33=%252B";
+        index.reset();
+        for (int i = 0; i < 2; i++) {
+            assert(index.get("k0", buf) == "v0");
+            assert(index.get("k32", buf) == "%41" && index.get("k33", buf) == "%2B");
+            assert(uWS::getDecodedQueryValue("k32", buf) == "%41" && uWS::getDecodedQueryValue("k33", buf) == "%2B");
+        }
+
+        /* Reset for the next request */
+        std::string next = "?k0=other";
+        index.reset();
+        assert(index.get("k0", next) == "other");
+    }
+
     return 0;
 }
\ No newline at end of file
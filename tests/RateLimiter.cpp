@@ -0,0 +1,80 @@
+#include "../src/RateLimiter.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+void testBurstAndRefill() {
+    uWS::RateLimiter rateLimiter({.connections = {.perSecond = 10, .burst = 5}, .requests = {}, .width = 1024});
+    uint64_t a = rateLimiter.hash(std::string_view("\x7f\0\0\x01", 4)), b = rateLimiter.hash(std::string_view("\x0a\0\0\x02", 4));
+    assert(a && b && a != b);
+
+    /* The burst at once, then none until a token comes every 100 ms */
+    uint64_t now = 1000000;
+    for (int i = 0; i < 5; i++) {
+        assert(rateLimiter.admitConnection(a, now));
+    }
+    assert(!rateLimiter.admitConnection(a, now));
+    assert(!rateLimiter.admitConnection(a, now + 50000));
+    assert(rateLimiter.admitConnection(a, now + 100000));
+    assert(!rateLimiter.admitConnection(a, now + 100000));
+
+    /* Others are left be, and so are requests unless limited */
+    assert(rateLimiter.admitConnection(b, now));
+    assert(!rateLimiter.limitsRequests());
+    for (int i = 0; i < 1000; i++) {
+        assert(rateLimiter.admitRequest(a, now));
+    }
+
+    /* Idle for long is a full burst again, no more */
+    now += 60000000;
+    for (int i = 0; i < 5; i++) {
+        assert(rateLimiter.admitConnection(a, now));
+    }
+    assert(!rateLimiter.admitConnection(a, now));
+}
+
+/* A steady rate is held to whatever the burst, and many addresses in few cells are only ever held tighter */
+void testSustainedAndCollisions() {
+    uWS::RateLimiter rateLimiter({.connections = {}, .requests = {.perSecond = 1000, .burst = 0}, .width = 64});
+    assert(rateLimiter.limitsRequests());
+
+    uint64_t hashes[512];
+    for (unsigned int i = 0; i < 512; i++) {
+        std::string address(16, '\0');
+        address[0] = (char) 0x20;
+        address[15] = (char) i;
+        address[14] = (char) (i >> 8);
+        hashes[i] = rateLimiter.hash(address);
+    }
+
+    /* Over 2 seconds every address tries 10 times a millisecond */
+    unsigned int admitted[512] = {};
+    for (uint64_t now = 5000000; now < 7000000; now += 1000) {
+        for (unsigned int i = 0; i < 512; i++) {
+            for (int j = 0; j < 10; j++) {
+                admitted[i] += rateLimiter.admitRequest(hashes[i], now);
+            }
+        }
+    }
+    for (unsigned int i = 0; i < 512; i++) {
+        /* One burst of a second's worth, then 1000 a second at most */
+        assert(admitted[i] <= 1000 + 2000 + 1);
+    }
+
+    /* Alone in its cells, an address gets its whole rate */
+    uWS::RateLimiter alone({.connections = {}, .requests = {.perSecond = 1000, .burst = 1}, .width = 64});
+    unsigned int count = 0;
+    for (uint64_t now = 0; now < 1000000; now += 100) {
+        count += alone.admitRequest(hashes[0], now);
+    }
+    assert(count == 1000);
+}
+
+int main() {
+    testBurstAndRefill();
+    testSustainedAndCollisions();
+    assert(uWS::RateLimiter::now() <= uWS::RateLimiter::now());
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,117 @@
+#include "../src/LoopData.h"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+/* Parked reads are handed back a budget at a time, round robin, those paused only after the next iteration */
+void testRoundRobin() {
+    uWS::LoopData loopData;
+    loopData.readBudget = 4;
+    static std::string handed;
+    static int done, paused;
+    handed.clear();
+    done = paused = 0;
+    char a = 'a', b = 'b', c = 'c', closed = 'x';
+    auto onData = [](us_socket_t *s, char *data, int length) {
+        /* As into the receive buffer, handlers may write into the padding */
+        memset(data - uWS::ParkedRead::PADDING, 0, uWS::ParkedRead::PADDING);
+        handed += std::string(1, *(char *) s) + ":" + std::string(data, (size_t) length) + " ";
+        data[length] = '\r';
+        return s;
+    };
+    auto onDone = [](void *, bool wasPaused) {
+        done++;
+        paused += wasPaused;
+    };
+    loopData.parkRead(&a, onData, onDone, "aaaaaaaaa", 9, false);
+    loopData.parkRead(&b, onData, onDone, "bbbbb", 5, false)->data.append("B");
+    loopData.parkRead(&c, onData, onDone, "cc", 2, true);
+    loopData.parkRead(&closed, onData, onDone, "xx", 2, false)->socket = nullptr;
+
+    loopData.resumeParkedReads();
+    assert(handed == "a:aaaa b:bbbb a:aaaa b:bB a:a ");
+    assert(done == 2 && paused == 0 && loopData.parkedReads.size() == 1 && loopData.pausedReads.empty());
+
+    handed.clear();
+    loopData.resumeParkedReads();
+    assert(handed == "c:cc " && done == 3 && paused == 1 && loopData.parkedReads.empty() && loopData.readIteration == 2);
+
+    /* Shedding parks nothing to pause for an iteration, and has no handler unless read to meanwhile */
+    handed.clear();
+    loopData.parkRead(&a, nullptr, onDone, "", 0, true);
+    loopData.resumeParkedReads();
+    assert(done == 3 && loopData.parkedReads.size() == 1);
+    loopData.resumeParkedReads();
+    assert(handed.empty() && done == 4 && paused == 2 && loopData.parkedReads.empty());
+}
+
+/* What the application paused is held back until it resumes, whatever we paused along with it */
+void testHeld() {
+    uWS::LoopData loopData;
+    loopData.readBudget = 4;
+    static std::string handed;
+    static int done, paused;
+    handed.clear();
+    done = paused = 0;
+    char a = 'a', b = 'b';
+    auto onData = [](us_socket_t *s, char *data, int length) {
+        handed += std::string(1, *(char *) s) + ":" + std::string(data, (size_t) length) + " ";
+        return s;
+    };
+    auto onDone = [](void *, bool wasPaused) {
+        done++;
+        paused += wasPaused;
+    };
+    uWS::ParkedRead *held = loopData.parkRead(&a, onData, onDone, "aaaaaa", 6, false, true);
+    uWS::ParkedRead *pausedAndHeld = loopData.parkRead(&b, onData, onDone, "bb", 2, true, true);
+    for (int i = 0; i < 3; i++) {
+        loopData.resumeParkedReads();
+    }
+    assert(handed.empty() && done == 0 && loopData.parkedReads.size() == 2);
+
+    held->held = false;
+    loopData.resumeParkedReads();
+    assert(handed == "a:aaaa a:aa " && done == 1 && paused == 0);
+
+    /* Ours to resume once handed back, which the application only releases */
+    pausedAndHeld->held = false;
+    handed.clear();
+    loopData.resumeParkedReads();
+    assert(handed == "b:bb " && done == 2 && paused == 1 && loopData.parkedReads.empty());
+}
+
+/* What shedding paused is held until the socket no longer queues more than its share */
+void testShed() {
+    uWS::LoopData loopData;
+    static int done, paused;
+    static bool overShare;
+    done = paused = 0;
+    overShare = true;
+    char a = 'a';
+    auto onDone = [](void *, bool wasPaused) {
+        done++;
+        paused += wasPaused;
+    };
+    uWS::ParkedRead *shed = loopData.parkRead(&a, nullptr, onDone, "", 0, true);
+    shed->shed = [](void *) {
+        return overShare;
+    };
+    for (int i = 0; i < 3; i++) {
+        loopData.resumeParkedReads();
+    }
+    assert(done == 0 && loopData.parkedReads.size() == 1);
+
+    overShare = false;
+    loopData.resumeParkedReads();
+    assert(done == 1 && paused == 1 && loopData.parkedReads.empty());
+}
+
+int main() {
+    testRoundRobin();
+    testHeld();
+    testShed();
+
+    std::cout << "ALL PASS" << std::endl;
+}
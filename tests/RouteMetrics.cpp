@@ -0,0 +1,84 @@
+#include "../src/RouteMetrics.h"
+
+#include <cassert>
+#include <iostream>
+
+using uWS::HistogramSnapshot;
+
+/* Exact while small, then every bucket holds values within 1/16 of each other */
+void testBuckets() {
+    for (uint64_t value = 0; value < 32; value++) {
+        assert(HistogramSnapshot::bucketOf(value) == value && HistogramSnapshot::highestOf((unsigned int) value) == value);
+    }
+
+    unsigned int previous = HistogramSnapshot::bucketOf(31);
+    for (uint64_t value = 32; value < (1ull << 20); value += value / 100 + 1) {
+        unsigned int bucket = HistogramSnapshot::bucketOf(value);
+        assert(bucket >= previous && bucket < HistogramSnapshot::BUCKETS);
+        uint64_t highest = HistogramSnapshot::highestOf(bucket);
+        assert(highest >= value && highest - value <= value / 16);
+        assert(bucket == 0 || HistogramSnapshot::highestOf(bucket - 1) < value);
+        previous = bucket;
+    }
+
+    /* The last bucket counts whatever is larger */
+    assert(HistogramSnapshot::bucketOf((1ull << 40) - 1) == HistogramSnapshot::BUCKETS - 1);
+    assert(HistogramSnapshot::bucketOf(~0ull) == HistogramSnapshot::BUCKETS - 1);
+    assert(HistogramSnapshot::highestOf(HistogramSnapshot::BUCKETS - 1) == (1ull << 40) - 1);
+}
+
+/* Percentiles as the top of their bucket, never past the largest value */
+void testPercentiles() {
+    uWS::Histogram histogram;
+    HistogramSnapshot snapshot;
+    histogram.snapshot(snapshot);
+    assert(snapshot.count == 0 && snapshot.percentile(0.99) == 0);
+
+    for (uint64_t value = 1; value <= 1000; value++) {
+        histogram.record(value);
+    }
+    histogram.snapshot(snapshot);
+    assert(snapshot.count == 1000 && snapshot.sum == 500500 && snapshot.max == 1000);
+    assert(snapshot.mean() == 500.5);
+
+    uint64_t median = snapshot.percentile(0.5), p99 = snapshot.percentile(0.99);
+    assert(median >= 500 && median <= 500 + 500 / 16);
+    assert(p99 >= 990 && p99 <= 1000);
+    assert(snapshot.percentile(1) == 1000 && snapshot.percentile(0) == 1);
+}
+
+/* Loops are merged by method and pattern */
+void testMerge() {
+    std::vector<std::unique_ptr<uWS::RouteMetrics>> first, second;
+    first.emplace_back(std::make_unique<uWS::RouteMetrics>("get", "/users/:id"));
+    first.emplace_back(std::make_unique<uWS::RouteMetrics>("post", "/users/:id"));
+    second.emplace_back(std::make_unique<uWS::RouteMetrics>("get", "/users/:id"));
+
+    first[0]->end(100, 10);
+    first[1]->end(5000, 0);
+    second[0]->end(300, 30);
+    second[0]->end(200, 20);
+    second[0]->abort();
+
+    std::vector<uWS::RouteStats> merged;
+    uWS::mergeRouteStats(merged, first);
+    uWS::mergeRouteStats(merged, second);
+    assert(merged.size() == 2);
+
+    uWS::RouteStats &get = merged[0];
+    assert(get.method == "get" && get.pattern == "/users/:id");
+    assert(get.responses == 3 && get.aborted == 1);
+    assert(get.latencyMicroseconds.sum == 600 && get.latencyMicroseconds.max == 300);
+    assert(get.bytesOut.sum == 60 && get.bytesOut.percentile(1) == 30);
+
+    assert(merged[1].method == "post" && merged[1].responses == 1 && !merged[1].aborted);
+    assert(merged[1].latencyMicroseconds.percentile(0.5) >= 5000);
+}
+
+int main() {
+    testBuckets();
+    testPercentiles();
+    testMerge();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,35 @@
+#include "../src/RouteParameters.h"
+
+#include <cassert>
+#include <iostream>
+
+void testFind() {
+    uWS::RouteParameters parameters("/users/:id/posts/:post/:comment/v/:a");
+    assert(parameters.size() == 4);
+    assert(parameters.find("id") == 0);
+    assert(parameters.find("post") == 1);
+    assert(parameters.find("comment") == 2);
+    assert(parameters.find("a") == 3);
+    assert(parameters.find("") == -1 && parameters.find("i") == -1 && parameters.find("ids") == -1 && parameters.find("pose") == -1);
+
+    /* No parameters, and a name given twice being the last of them (as before) */
+    assert(uWS::RouteParameters("/static/*").size() == 0 && uWS::RouteParameters().find("id") == -1);
+    uWS::RouteParameters twice("/:x/:y/:x");
+    assert(twice.size() == 2 && twice.find("x") == 2 && twice.find("y") == 1);
+
+    /* An empty name, of a trailing colon */
+    assert(uWS::RouteParameters("/a/:").find("") == 0);
+}
+
+void testIndexOf() {
+    static_assert(uWS::RouteParameters::indexOf("/users/:id/posts/:post", "post") == 1);
+    static_assert(uWS::RouteParameters::indexOf("/users/:id", "post") == -1);
+    static_assert(uWS::RouteParameters::indexOf("/:x/:y/:x", "x") == 2);
+}
+
+int main() {
+    testFind();
+    testIndexOf();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,100 @@
+#include <iostream>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "../src/SendBatch.h"
+
+/* Sockets of our own, standing in for WebSockets: they cork and write themselves unless someone holds the cork */
+struct Socket {
+    uWS::LoopData *loopData;
+    size_t maxBackpressure = 0;
+    bool closeOnBackpressureLimit = false;
+    bool closed = false;
+    std::string sliced, written;
+    int writes = 0;
+};
+
+struct TestBinding {
+    uWS::LoopData *loopData(Socket *s) {
+        return s->loopData;
+    }
+
+    bool isClosed(Socket *s) {
+        return s->closed;
+    }
+
+    bool send(Socket *s, std::string_view message) {
+        if (s->maxBackpressure && s->sliced.length() + message.length() > s->maxBackpressure) {
+            s->closed = s->closeOnBackpressureLimit;
+            return false;
+        }
+        s->sliced.append(message);
+        if (!s->loopData->corkedSocket) {
+            flush(s);
+        }
+        return true;
+    }
+
+    void flush(Socket *s) {
+        if (s->sliced.length()) {
+            s->written += s->sliced;
+            s->sliced.clear();
+            s->writes++;
+        }
+    }
+};
+
+using Batch = std::vector<std::pair<Socket *, std::string_view>>;
+
+int main() {
+    uWS::LoopData loopData, otherLoopData;
+    TestBinding binding;
+
+    {
+        /* Several messages to each socket, each socket written once and in order */
+        Socket a{&loopData}, b{&loopData};
+        Batch batch = {{&a, "a1"}, {&b, "b1"}, {&a, "a2"}, {&b, "b2"}, {&a, "a3"}};
+        uWS::SendBatchResult result = uWS::sendBatch<Socket>(batch, binding);
+        assert(result.sent == 5 && result.dropped == 0 && result.rejected.empty());
+        assert(a.writes == 1 && a.written == "a1a2a3" && b.writes == 1 && b.written == "b1b2");
+        assert(!loopData.corkedSocket);
+    }
+
+    {
+        /* Over maxBackpressure is dropped, closed (before or by the batch) is dropped and not written */
+        Socket full{&loopData}, closing{&loopData}, closed{&loopData}, fine{&loopData};
+        full.maxBackpressure = 4;
+        closing.maxBackpressure = 4;
+        closing.closeOnBackpressureLimit = true;
+        closed.closed = true;
+        Batch batch = {{&full, "1234"}, {&full, "5"}, {&closing, "12"}, {&closing, "345"}, {&closing, "6"}, {&closed, "x"}, {&fine, "ok"}};
+        uWS::SendBatchResult result = uWS::sendBatch<Socket>(batch, binding);
+        assert(result.sent == 3 && result.dropped == 4 && result.rejected.empty());
+        assert(full.writes == 1 && full.written == "1234");
+        assert(closing.closed && !closing.writes && !closed.writes && fine.written == "ok");
+    }
+
+    {
+        /* Sockets of other loops are handed back untouched */
+        Socket ours{&loopData}, theirs{&otherLoopData};
+        Batch batch = {{&ours, "1"}, {&theirs, "2"}, {&ours, "3"}, {&theirs, "4"}};
+        uWS::SendBatchResult result = uWS::sendBatch<Socket>(batch, binding);
+        assert(result.sent == 2 && result.dropped == 0 && result.rejected == std::vector<size_t>({1, 3}));
+        assert(ours.writes == 1 && ours.written == "13" && !theirs.writes && theirs.sliced.empty());
+    }
+
+    {
+        /* Within someone else's cork, the cork is left to them */
+        Socket corker{&loopData}, s{&loopData};
+        loopData.corkedSocket = &corker;
+        Batch batch = {{&s, "1"}, {&s, "2"}};
+        uWS::SendBatchResult result = uWS::sendBatch<Socket>(batch, binding);
+        assert(result.sent == 2 && s.writes == 1 && loopData.corkedSocket == &corker);
+        loopData.corkedSocket = nullptr;
+
+        assert(uWS::sendBatch<Socket>(Batch(), binding).sent == 0);
+    }
+
+    std::cout << "ALL PASS" << std::endl;
+}
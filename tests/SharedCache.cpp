@@ -0,0 +1,159 @@
+#include "../src/SharedCache.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+void testBasics() {
+    uWS::SharedCache cache(3 * (uWS::SharedCache::NODE_OVERHEAD + 8), 4);
+    uWS::SharedCache::Reader *reader = cache.join();
+    uWS::SharedBuffer body;
+    time_t created = 0;
+
+    /* Misses, hits until expired, then replaced */
+    assert(!cache.find(reader, "/a", 100, body, created));
+    cache.fill("/a", uWS::SharedBuffer::copy("aaaaaa"), 100, 10);
+    assert(cache.find(reader, "/a", 109, body, created) && body.view() == "aaaaaa" && created == 100);
+    assert(!cache.find(reader, "/a", 110, body, created));
+    cache.fill("/a", uWS::SharedBuffer::copy("AAAAAA"), 110, 10);
+    assert(cache.find(reader, "/a", 110, body, created) && body.view() == "AAAAAA" && created == 110);
+
+    /* What we hold stays valid after being replaced */
+    uWS::SharedBuffer held = body;
+    cache.fill("/a", uWS::SharedBuffer::copy("bbbbbb"), 110, 10);
+    assert(held.view() == "AAAAAA");
+
+    /* Over budget, the oldest go */
+    cache.fill("/b", uWS::SharedBuffer::copy("bbbbbb"), 111, 10);
+    cache.fill("/c", uWS::SharedBuffer::copy("cccccc"), 112, 10);
+    cache.fill("/d", uWS::SharedBuffer::copy("dddddd"), 113, 10);
+    assert(!cache.find(reader, "/a", 113, body, created));
+    assert(cache.find(reader, "/b", 113, body, created) && cache.find(reader, "/d", 113, body, created));
+    assert(cache.getTotalBytes() == 3 * (uWS::SharedCache::NODE_OVERHEAD + 8));
+
+    /* Expiry drops without lookups */
+    cache.expire(122);
+    assert(cache.getTotalBytes() == uWS::SharedCache::NODE_OVERHEAD + 8);
+    cache.expire(123);
+    assert(cache.getTotalBytes() == 0);
+
+    /* Claims: first fills, the rest wait, and after the fill it is a hit */
+    int called = 0;
+    auto waiter = [&called](const uWS::SharedBuffer *body, time_t created) {
+        assert(body && body->view() == "ee" && created == 200);
+        called++;
+    };
+    assert(cache.claim(reader, "/e", 200, body, created, waiter) == uWS::SharedCache::FILL);
+    assert(cache.claim(reader, "/e", 200, body, created, waiter) == uWS::SharedCache::WAIT);
+    assert(cache.claim(reader, "/e", 200, body, created, waiter) == uWS::SharedCache::WAIT);
+    cache.fill("/e", uWS::SharedBuffer::copy("ee"), 200, 10);
+    assert(called == 2);
+    assert(cache.claim(reader, "/e", 200, body, created, waiter) == uWS::SharedCache::HIT && body.view() == "ee");
+
+    /* Claims given up, or held too long, tell their waiters so and are free to claim again */
+    int abandoned = 0;
+    auto abandonedWaiter = [&abandoned](const uWS::SharedBuffer *body, time_t) {
+        assert(!body);
+        abandoned++;
+    };
+    assert(cache.claim(reader, "/f", 300, body, created, abandonedWaiter) == uWS::SharedCache::FILL);
+    assert(cache.claim(reader, "/f", 300, body, created, abandonedWaiter) == uWS::SharedCache::WAIT);
+    cache.release("/f");
+    cache.release("/f");
+    assert(abandoned == 1);
+    assert(cache.claim(reader, "/f", 300, body, created, abandonedWaiter) == uWS::SharedCache::FILL);
+    assert(cache.claim(reader, "/f", 301, body, created, abandonedWaiter) == uWS::SharedCache::WAIT);
+    cache.expire(300 + uWS::SharedCache::FILL_TIMEOUT_S - 1);
+    assert(abandoned == 1);
+    cache.expire(300 + uWS::SharedCache::FILL_TIMEOUT_S);
+    assert(abandoned == 2);
+    assert(cache.claim(reader, "/f", 400, body, created, abandonedWaiter) == uWS::SharedCache::FILL);
+
+    cache.leave(reader);
+}
+
+/* Many threads missing at once generate once */
+void testSingleFlight() {
+    uWS::SharedCache cache;
+    const int THREADS = 8;
+    std::atomic<int> fills{0}, waits{0}, called{0};
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < THREADS; i++) {
+        threads.emplace_back([&]() {
+            uWS::SharedCache::Reader *reader = cache.join();
+            uWS::SharedBuffer body;
+            time_t created;
+            auto claimed = cache.claim(reader, "/hot", 1, body, created, [&called](const uWS::SharedBuffer *body, time_t) {
+                assert(body && body->view() == "hot");
+                called++;
+            });
+            if (claimed == uWS::SharedCache::FILL) {
+                fills++;
+                /* Let the others pile up behind us */
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                cache.fill("/hot", uWS::SharedBuffer::copy("hot"), 1, 10);
+            } else if (claimed == uWS::SharedCache::WAIT) {
+                waits++;
+            } else {
+                assert(body.view() == "hot");
+            }
+            cache.leave(reader);
+        });
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+
+    assert(fills == 1 && called == waits);
+}
+
+/* Readers look up without a lock while a writer replaces, evicts and expires under them */
+void testConcurrent() {
+    uWS::SharedCache cache(64 * (uWS::SharedCache::NODE_OVERHEAD + 32), 16);
+    const int KEYS = 200;
+    std::atomic<bool> done{false};
+    std::atomic<long long> hits{0};
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back([&]() {
+            uWS::SharedCache::Reader *reader = cache.join();
+            unsigned int k = 0;
+            while (!done.load()) {
+                std::string key = "/" + std::to_string(k++ % KEYS);
+                uWS::SharedBuffer body;
+                time_t created;
+                if (cache.find(reader, key, 0, body, created)) {
+                    assert(body.view().substr(0, key.length() + 1) == key + "#");
+                    hits++;
+                }
+            }
+            cache.leave(reader);
+        });
+    }
+
+    for (int round = 0; round < 40000; round++) {
+        std::string key = "/" + std::to_string(round % KEYS);
+        cache.fill(key, uWS::SharedBuffer::copy(key + "#" + std::to_string(round)), round % 1000, 30);
+        if (round % 1000 == 999) {
+            cache.expire(round % 1000);
+        }
+    }
+    done = true;
+    for (std::thread &t : readers) {
+        t.join();
+    }
+
+    assert(hits > 0);
+}
+
+int main() {
+    testBasics();
+    testSingleFlight();
+    testConcurrent();
+
+    std::cout << "ALL PASS" << std::endl;
+}
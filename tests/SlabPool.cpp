@@ -0,0 +1,100 @@
+#include "../src/SlabPool.h"
+
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Cells are distinct, aligned and reused, and slabs go back once emptied */
+void testSlabs() {
+    uWS::SlabPool pool(40);
+    std::vector<char *> cells;
+    for (int i = 0; i < 10000; i++) {
+        char *cell = (char *) pool.allocate();
+        assert(((uintptr_t) cell & 15) == 0);
+        memset(cell, i & 0xff, 40);
+        cells.push_back(cell);
+    }
+    size_t slabs = pool.slabs();
+    /* Packed, 40 bytes take 48 */
+    assert(slabs == 10000 * 48 / uWS::SlabPool::SLAB_SIZE + 1);
+    for (int i = 0; i < 10000; i++) {
+        for (int j = 0; j < 40; j++) {
+            assert(cells[(size_t) i][j] == (char) (i & 0xff));
+        }
+    }
+
+    /* Churn in the middle stays within the slabs we have */
+    std::mt19937 random(7);
+    for (int i = 0; i < 100000; i++) {
+        size_t index = random() % cells.size();
+        pool.deallocate(cells[index]);
+        cells[index] = (char *) pool.allocate();
+    }
+    assert(pool.slabs() == slabs);
+
+    /* All but one empty slab are freed */
+    for (char *cell : cells) {
+        pool.deallocate(cell);
+    }
+    assert(pool.slabs() == 1);
+    assert(pool.allocate() && pool.slabs() == 1);
+}
+
+/* Cells find their way home on their own */
+void testFree() {
+    uWS::SlabPool a(64), b(64);
+    std::vector<void *> cells;
+    for (int i = 0; i < 3000; i++) {
+        cells.push_back(i & 1 ? a.allocate() : b.allocate());
+    }
+    assert(a.slabs() == 2 && b.slabs() == 2);
+    for (void *cell : cells) {
+        uWS::SlabPool::free(cell);
+    }
+    assert(a.slabs() == 1 && b.slabs() == 1);
+}
+
+/* What is left in use is found, and goes with the pool, full slabs included */
+void testLeftovers() {
+    uWS::SlabPool pool(sizeof(std::string));
+    std::vector<std::string *> strings;
+    for (int i = 0; i < 5000; i++) {
+        strings.push_back(new (pool.allocate()) std::string(100, 'x'));
+    }
+    for (size_t i = 0; i < strings.size(); i += 3) {
+        strings[i]->~basic_string();
+        pool.deallocate(strings[i]);
+    }
+
+    size_t left = 0;
+    pool.forEachUsed([&left](void *cell) {
+        assert(((std::string *) cell)->length() == 100);
+        ((std::string *) cell)->~basic_string();
+        left++;
+    });
+    assert(left == 5000 - 5000 / 3 - 1);
+}
+
+void testStrings() {
+    uWS::StringArena arena;
+    std::vector<std::pair<char *, std::string>> strings;
+    for (size_t length = 0; length < 1000; length += 7) {
+        std::string string(length, (char) ('a' + length % 26));
+        strings.push_back({arena.copy(string.data(), string.length()), string});
+    }
+    for (auto &[copy, string] : strings) {
+        assert(std::string(copy, string.length()) == string);
+        arena.free(copy, string.length());
+    }
+}
+
+int main() {
+    testSlabs();
+    testFree();
+    testLeftovers();
+    testStrings();
+
+    std::cout << "ALL PASS" << std::endl;
+}
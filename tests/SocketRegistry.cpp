@@ -0,0 +1,115 @@
+#include "../src/SocketRegistry.h"
+
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Socket {
+    std::vector<std::string> received;
+    /* Calls to deliver, each of which would be one cork */
+    int deliveries = 0;
+};
+
+int wakeups = 0;
+
+void wakeup(void *) {
+    wakeups++;
+}
+
+void deliver(void *socket, uWS::SocketRegistry::Send *sends, size_t count) {
+    Socket *s = (Socket *) socket;
+    s->deliveries++;
+    for (size_t i = 0; i < count; i++) {
+        s->received.push_back(sends[i].message);
+    }
+}
+
+void testBasics() {
+    uWS::SocketRegistry registry(wakeup, nullptr, 4);
+    Socket a, b;
+    uWS::SocketHandle ha = registry.add(&a, deliver), hb = registry.add(&b, deliver);
+    assert(ha && hb && !uWS::SocketHandle{});
+    assert(!uWS::SocketHandle{}.send("x"));
+
+    /* One wakeup until delivered, one delivery per socket in the order sent, past the ring into overflow */
+    wakeups = 0;
+    for (int i = 0; i < 10; i++) {
+        assert((i % 2 ? ha : hb).send(std::to_string(i)));
+    }
+    assert(wakeups == 1);
+    registry.deliver();
+    assert(a.deliveries == 1 && b.deliveries == 1);
+    assert((a.received == std::vector<std::string>{"1", "3", "5", "7", "9"}));
+    assert((b.received == std::vector<std::string>{"0", "2", "4", "6", "8"}));
+    hb.send(std::string(1000, 'x'));
+    assert(wakeups == 2);
+
+    /* Sends to a removed socket are dropped, even once its slot is reused */
+    registry.remove(hb);
+    Socket c;
+    uWS::SocketHandle hc = registry.add(&c, deliver);
+    assert(hc.slot == hb.slot && hc.generation != hb.generation);
+    hb.send("stale");
+    hc.send("fresh");
+    registry.deliver();
+    assert(b.received.size() == 5 && (c.received == std::vector<std::string>{"fresh"}));
+    assert(registry.getStale() == 2);
+
+    /* Removing twice, or by a stale handle, does nothing */
+    registry.remove(hb);
+    registry.remove(hc);
+    registry.remove(hc);
+    uWS::SocketHandle hd = registry.add(&c, deliver);
+    uWS::SocketHandle he = registry.add(&b, deliver);
+    assert(hd.slot == hc.slot && he.slot != hd.slot);
+    registry.deliver();
+    assert(c.deliveries == 1);
+}
+
+/* Senders on many threads, every message delivered once and in order per sender */
+void testThreads() {
+    static constexpr int SENDERS = 4, COUNT = 50000;
+    uWS::SocketRegistry registry(wakeup, nullptr, 64);
+    Socket sockets[SENDERS];
+    uWS::SocketHandle handles[SENDERS];
+    for (int i = 0; i < SENDERS; i++) {
+        handles[i] = registry.add(&sockets[i], deliver);
+    }
+
+    std::vector<std::thread> senders;
+    for (int p = 0; p < SENDERS; p++) {
+        senders.emplace_back([&handles, p]() {
+            for (int i = 0; i < COUNT; i++) {
+                handles[(p + i) % SENDERS].send(std::to_string(p) + ":" + std::to_string(i));
+            }
+        });
+    }
+    for (int i = 0; i < 1000; i++) {
+        registry.deliver();
+    }
+    for (std::thread &sender : senders) {
+        sender.join();
+    }
+    registry.deliver();
+
+    size_t total = 0;
+    for (Socket &socket : sockets) {
+        int last[SENDERS] = {-1, -1, -1, -1};
+        for (std::string &message : socket.received) {
+            int p = std::stoi(message), i = std::stoi(message.substr(message.find(':') + 1));
+            assert(i > last[p]);
+            last[p] = i;
+        }
+        total += socket.received.size();
+    }
+    assert(total == (size_t) SENDERS * COUNT);
+}
+
+int main() {
+    testBasics();
+    testThreads();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,148 @@
+#include "../src/TLSSessionCache.h"
+
+#include <openssl/x509.h>
+
+#include <cassert>
+#include <iostream>
+
+/* A self signed certificate for localhost, made once */
+static EVP_PKEY *key;
+static X509 *certificate;
+
+void makeCertificate() {
+    key = EVP_EC_gen("P-256");
+    certificate = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(certificate), "CN", MBSTRING_ASC, (const unsigned char *) "localhost", -1, -1, 0);
+    X509_set_issuer_name(certificate, X509_get_subject_name(certificate));
+    X509_set_pubkey(certificate, key);
+    X509_sign(certificate, key, EVP_sha256());
+}
+
+/* As a loop of its own would have it */
+SSL_CTX *serverContext(uWS::TLSSessionCache *cache) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(ctx, certificate);
+    SSL_CTX_use_PrivateKey(ctx, key);
+    if (cache) {
+        cache->attach(ctx);
+    }
+    return ctx;
+}
+
+/* Shakes hands in memory, resuming session if given. Returns whether it did resume, and the session to
+ * resume the next time (as for TLS 1.3 it comes after the handshake) */
+bool handshake(SSL_CTX *serverCtx, SSL_CTX *clientCtx, SSL_SESSION *&session) {
+    SSL *server = SSL_new(serverCtx), *client = SSL_new(clientCtx);
+    BIO *serverBio, *clientBio;
+    BIO_new_bio_pair(&serverBio, 0, &clientBio, 0);
+    SSL_set_bio(server, serverBio, serverBio);
+    SSL_set_bio(client, clientBio, clientBio);
+    SSL_set_accept_state(server);
+    SSL_set_connect_state(client);
+    SSL_set_tlsext_host_name(client, "localhost");
+    if (session) {
+        SSL_set_session(client, session);
+        SSL_SESSION_free(session);
+    }
+
+    bool serverDone = false, clientDone = false;
+    for (int i = 0; i < 10 && !(serverDone && clientDone); i++) {
+        clientDone = clientDone || SSL_do_handshake(client) == 1;
+        serverDone = serverDone || SSL_do_handshake(server) == 1;
+    }
+    assert(serverDone && clientDone);
+
+    /* Tickets of TLS 1.3 come with the first data */
+    char buf[1];
+    assert(SSL_write(server, "x", 1) == 1);
+    assert(SSL_read(client, buf, 1) == 1);
+
+    bool reused = SSL_session_reused(client);
+    session = SSL_get1_session(client);
+
+    /* Cut short, the session would not be resumable */
+    SSL_set_shutdown(client, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    SSL_set_shutdown(server, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    SSL_free(server);
+    SSL_free(client);
+    return reused;
+}
+
+/* Tickets and session IDs of one context resume with another sharing the cache, and not with one that does not */
+void testAcrossContexts(int version) {
+    uWS::TLSSessionCache cache;
+    SSL_CTX *a = serverContext(&cache), *b = serverContext(&cache), *alone = serverContext(nullptr);
+    SSL_CTX *client = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_min_proto_version(client, version);
+    SSL_CTX_set_max_proto_version(client, version);
+
+    SSL_SESSION *session = nullptr;
+    assert(!handshake(a, client, session));
+    assert(handshake(b, client, session));
+    assert(handshake(a, client, session));
+    assert(!handshake(alone, client, session));
+
+    /* Without tickets TLS 1.2 resumes by session ID */
+    if (version == TLS1_2_VERSION) {
+        SSL_CTX_set_options(client, SSL_OP_NO_TICKET);
+        SSL_SESSION_free(session);
+        session = nullptr;
+        assert(!handshake(a, client, session));
+        assert(handshake(b, client, session));
+        uWS::TLSSessionCacheStats stats = cache.getStats();
+        assert(stats.sessionsStored >= 1 && stats.sessionHits >= 1);
+    }
+
+    uWS::TLSSessionCacheStats stats = cache.getStats();
+    assert(stats.ticketsIssued >= 1 && stats.ticketsOfKnownKey >= 2);
+
+    SSL_SESSION_free(session);
+    SSL_CTX_free(a);
+    SSL_CTX_free(b);
+    SSL_CTX_free(alone);
+    SSL_CTX_free(client);
+}
+
+/* A ticket resumes for two rotations past its key, not three */
+void testRotation() {
+    uWS::TLSSessionCache cache({.maxSessions = 0});
+    SSL_CTX *server = serverContext(&cache);
+    SSL_CTX *client = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_max_proto_version(client, TLS1_2_VERSION);
+
+    SSL_SESSION *session = nullptr;
+    assert(!handshake(server, client, session));
+
+    /* Renewed under the current key on resumption, so hand the old one back each time */
+    SSL_SESSION *old = session;
+    SSL_SESSION_up_ref(old);
+    cache.rotateTicketKeys();
+    cache.rotateTicketKeys();
+    assert(handshake(server, client, session));
+    SSL_SESSION_free(session);
+
+    session = old;
+    cache.rotateTicketKeys();
+    assert(!handshake(server, client, session));
+    assert(cache.getStats().ticketsOfUnknownKey == 1);
+
+    SSL_SESSION_free(session);
+    SSL_CTX_free(server);
+    SSL_CTX_free(client);
+}
+
+int main() {
+    makeCertificate();
+
+    testAcrossContexts(TLS1_2_VERSION);
+    testAcrossContexts(TLS1_3_VERSION);
+    testRotation();
+
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,184 @@
+#include <iostream>
+#include <cassert>
+#include <memory>
+#include <type_traits>
+
+#include "../src/AsyncSocketData.h"
+#include "../src/Task.h"
+
+/* Sockets and loops of our own, standing in for those of uSockets */
+struct Socket {
+    uWS::AsyncSocketData<false> data;
+    int released = 0;
+};
+
+uWS::LoopData *currentLoop;
+
+struct TestBinding {
+    template <typename T>
+    static uWS::CoroutineLink **links(T &arg) {
+        if constexpr (std::is_same_v<T, Socket *>) {
+            return arg ? &arg->data.coroutines : nullptr;
+        }
+        return nullptr;
+    }
+
+    static uWS::LoopData *loopData() {
+        return currentLoop;
+    }
+};
+
+using Task = uWS::BasicTask<TestBinding>;
+
+/* Like HttpContext does as the socket closes */
+void close(Socket *s) {
+    auto release = [](void *s) {
+        ((Socket *) s)->released++;
+    };
+    if (!s->data.holdForCoroutines(release, s)) {
+        release(s);
+    }
+}
+
+int cancelled, destroyedLocals, resumed;
+
+/* Resumed by hand, its promise at hand for that */
+Task::promise_type *waiting;
+struct Awaiter {
+    bool await_ready() {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<Task::promise_type> handle) {
+        if (handle.promise().suspend(Task::promise_type::BODY, this, [](void *) { cancelled++; })) {
+            waiting = &handle.promise();
+        }
+        return true;
+    }
+
+    void await_resume() {}
+};
+
+struct Local {
+    ~Local() {
+        destroyedLocals++;
+    }
+};
+
+Task awaitOnce(Socket *, int) {
+    Local local;
+    co_await Awaiter{};
+    resumed++;
+}
+
+/* Closes its own socket, then goes on with it as it will anyway */
+Task closeThenAwait(Socket *s) {
+    Local local;
+    close(s);
+    assert(!s->released);
+    co_await Awaiter{};
+    resumed++;
+}
+
+Task closeThenReturn(Socket *s) {
+    close(s);
+    assert(!s->released);
+    co_return;
+}
+
+size_t usedFrames(uWS::LoopData &loopData) {
+    size_t used = 0;
+    for (uWS::SlabPool &pool : loopData.coroutineFrames) {
+        pool.forEachUsed([&used](void *) { used++; });
+    }
+    return used;
+}
+
+void reset() {
+    cancelled = destroyedLocals = resumed = 0;
+    waiting = nullptr;
+}
+
+void testResumed() {
+    reset();
+    uWS::LoopData loopData;
+    currentLoop = &loopData;
+    Socket s;
+
+    awaitOnce(&s, 1);
+    assert(waiting && s.data.coroutines && loopData.coroutines && usedFrames(loopData) == 1);
+    waiting->resume();
+    assert(resumed == 1 && destroyedLocals == 1 && !cancelled);
+    assert(!s.data.coroutines && !loopData.coroutines && !usedFrames(loopData));
+
+    /* Not bound to anything but the loop */
+    awaitOnce(nullptr, 1);
+    assert(!s.data.coroutines && loopData.coroutines);
+    waiting->resume();
+    assert(!loopData.coroutines && !usedFrames(loopData));
+}
+
+void testAborted() {
+    reset();
+    uWS::LoopData loopData;
+    currentLoop = &loopData;
+
+    /* Awaiting, destroyed right away and the socket with it */
+    Socket s;
+    awaitOnce(&s, 1);
+    close(&s);
+    assert(s.released == 1 && cancelled == 1 && destroyedLocals == 1 && !resumed);
+    assert(!loopData.coroutines && !usedFrames(loopData));
+
+    /* Running, the socket lives on until the Task next awaits */
+    Socket t;
+    waiting = nullptr;
+    closeThenAwait(&t);
+    assert(t.released == 1 && destroyedLocals == 2 && !resumed && !waiting && cancelled == 1);
+    assert(!loopData.coroutines && !usedFrames(loopData));
+
+    /* Or returns */
+    Socket u;
+    closeThenReturn(&u);
+    assert(u.released == 1 && !usedFrames(loopData));
+
+    /* Ending detaches, closing is then none of the Task's business */
+    Socket v;
+    awaitOnce(&v, 1);
+    v.data.detachCoroutines();
+    close(&v);
+    assert(v.released == 1 && !resumed);
+    waiting->resume();
+    assert(resumed == 1 && !usedFrames(loopData));
+}
+
+void testLoopGone() {
+    reset();
+    Socket s;
+    {
+        std::unique_ptr<uWS::LoopData> loopData = std::make_unique<uWS::LoopData>();
+        currentLoop = loopData.get();
+        awaitOnce(&s, 1);
+        awaitOnce(nullptr, 1);
+    }
+    /* Both destroyed with the loop, frames back before its pools went */
+    assert(destroyedLocals == 2 && cancelled == 2 && !resumed && !s.data.coroutines);
+
+    /* Frames go back to the pool they came from, whichever loop is current as they do */
+    reset();
+    uWS::LoopData first, second;
+    currentLoop = &first;
+    awaitOnce(&s, 1);
+    currentLoop = &second;
+    assert(usedFrames(first) == 1);
+    waiting->resume();
+    assert(!usedFrames(first) && !usedFrames(second) && !first.coroutines);
+}
+
+int main() {
+    testResumed();
+    testAborted();
+    testLoopGone();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,136 @@
+#include "../src/TaskPool.h"
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/* Spins until pred holds, failing after a few seconds */
+template <typename Pred>
+void waitFor(Pred pred) {
+    auto start = std::chrono::steady_clock::now();
+    while (!pred()) {
+        assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+        std::this_thread::yield();
+    }
+}
+
+void testBasics() {
+    std::atomic<int> ran{0};
+    {
+        uWS::TaskPool pool(4);
+        assert(pool.size() == 4);
+        for (int i = 0; i < 10000; i++) {
+            assert(pool.submit([&ran]() {
+                ran.fetch_add(1);
+            }));
+        }
+        waitFor([&]() { return ran.load() == 10000; });
+
+        /* Idle workers sleep, and are woken again */
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pool.submit([&ran]() {
+            ran.fetch_add(1);
+        });
+        waitFor([&]() { return ran.load() == 10001; });
+
+        /* What is still queued runs before the pool is gone */
+        for (int i = 0; i < 1000; i++) {
+            pool.submit([&ran]() {
+                ran.fetch_add(1);
+            });
+        }
+    }
+    assert(ran.load() == 11001);
+}
+
+/* Beyond capacity nothing is queued, taking makes room again */
+void testCapacity() {
+    std::atomic<bool> release{false};
+    std::atomic<int> started{0}, ran{0};
+    uWS::TaskPool pool(2, 8);
+
+    for (int i = 0; i < 2; i++) {
+        assert(pool.submit([&]() {
+            started.fetch_add(1);
+            waitFor([&]() { return release.load(); });
+        }));
+    }
+    waitFor([&]() { return started.load() == 2; });
+
+    for (int i = 0; i < 8; i++) {
+        assert(pool.submit([&ran]() {
+            ran.fetch_add(1);
+        }));
+    }
+    assert(pool.getPending() == 8);
+    assert(!pool.submit([&ran]() {
+        ran.fetch_add(100);
+    }));
+
+    release = true;
+    waitFor([&]() { return ran.load() == 8; });
+    assert(pool.getPending() == 0 && pool.submit([]() {}));
+}
+
+/* Tasks a busy worker queued for itself are stolen by the others */
+void testStealing() {
+    std::atomic<bool> release{false};
+    std::atomic<int> ran{0};
+    std::vector<std::thread::id> ranOn(100);
+    uWS::TaskPool pool(4);
+
+    std::thread::id busy;
+    pool.submit([&]() {
+        busy = std::this_thread::get_id();
+        for (int i = 0; i < 100; i++) {
+            pool.submit([&, i]() {
+                ranOn[i] = std::this_thread::get_id();
+                ran.fetch_add(1);
+            });
+        }
+        /* Nobody but a thief can run them now */
+        waitFor([&]() { return release.load() || ran.load() == 100; });
+    });
+
+    waitFor([&]() { return ran.load() == 100; });
+    release = true;
+    for (std::thread::id &id : ranOn) {
+        assert(id != busy);
+    }
+}
+
+/* Many producers, tasks submitting more */
+void testConcurrent() {
+    std::atomic<int> ran{0}, nested{0};
+    uWS::TaskPool pool(3, 1 << 20);
+
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; t++) {
+        producers.emplace_back([&]() {
+            for (int i = 0; i < 20000; i++) {
+                assert(pool.submit([&]() {
+                    if (ran.fetch_add(1) % 10 == 0) {
+                        pool.submit([&nested]() {
+                            nested.fetch_add(1);
+                        });
+                    }
+                }));
+            }
+        });
+    }
+    for (std::thread &producer : producers) {
+        producer.join();
+    }
+    waitFor([&]() { return ran.load() == 80000 && nested.load() == 8000; });
+}
+
+int main() {
+    testBasics();
+    testCapacity();
+    testStealing();
+    testConcurrent();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,146 @@
+#include "../src/TimingWheel.h"
+
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <vector>
+
+struct Timer {
+    uWS::TimingWheelNode node;
+    /* Tick we expect, and the one we got */
+    uint32_t expected = 0, expired = 0;
+    uWS::TimingWheel *timingWheel;
+};
+
+void expire(void *owner) {
+    Timer *timer = (Timer *) owner;
+    assert(!timer->expired);
+    timer->expired = timer->timingWheel->getNow();
+}
+
+void testBasics() {
+    uWS::TimingWheel timingWheel;
+    Timer a, b, c;
+    for (Timer *timer : {&a, &b, &c}) {
+        timer->node.expire = expire;
+        timer->node.owner = timer;
+        timer->timingWheel = &timingWheel;
+    }
+
+    /* Moving later stays in place, earlier relinks, in the past is the next tick */
+    timingWheel.arm(&a.node, 3);
+    timingWheel.arm(&a.node, 10);
+    timingWheel.arm(&b.node, 100);
+    timingWheel.arm(&b.node, 2);
+    timingWheel.arm(&c.node, 0);
+    assert(timingWheel.size() == 3);
+
+    timingWheel.advance();
+    assert(c.expired == 1 && !b.expired && !a.expired);
+    timingWheel.advance();
+    assert(b.expired == 2 && !a.expired);
+    for (int i = 0; i < 7; i++) {
+        timingWheel.advance();
+    }
+    assert(!a.expired && timingWheel.size() == 1);
+    timingWheel.advance();
+    assert(a.expired == 10 && timingWheel.size() == 0 && !a.node.isArmed());
+
+    /* Disarmed never expires */
+    c.expired = 0;
+    timingWheel.arm(&c.node, timingWheel.getNow() + 5);
+    timingWheel.disarm(&c.node);
+    timingWheel.disarm(&c.node);
+    for (int i = 0; i < 10; i++) {
+        timingWheel.advance();
+    }
+    assert(!c.expired && timingWheel.size() == 0);
+
+    /* Beyond what we hold is clamped */
+    timingWheel.arm(&c.node, timingWheel.getNow() + uWS::TimingWheel::MAX_TICKS * 2);
+    uint32_t armedAt = timingWheel.getNow();
+    while (!c.expired) {
+        timingWheel.advance();
+    }
+    assert(c.expired == armedAt + uWS::TimingWheel::MAX_TICKS);
+}
+
+/* Every node gets re-armed at random, earlier and later, and has to expire exactly when last asked */
+void testRandom() {
+    std::mt19937 random(42);
+    uWS::TimingWheel timingWheel;
+    std::vector<Timer> timers(5000);
+    for (Timer &timer : timers) {
+        timer.node.expire = expire;
+        timer.node.owner = &timer;
+        timer.timingWheel = &timingWheel;
+    }
+
+    for (int tick = 0; tick < 40000; tick++) {
+        for (int i = 0; i < 50; i++) {
+            Timer &timer = timers[random() % timers.size()];
+            if (timer.expired) {
+                assert(timer.expired == timer.expected);
+                timer.expired = timer.expected = 0;
+            }
+            if (random() % 8 == 0) {
+                timingWheel.disarm(&timer.node);
+                timer.expected = 0;
+                continue;
+            }
+            /* Mostly idle timeouts, some lifetimes */
+            uint32_t ticks = random() % 4 ? 1 + random() % 1000 : 1 + random() % uWS::TimingWheel::MAX_TICKS;
+            timer.expected = timingWheel.getNow() + ticks;
+            timingWheel.arm(&timer.node, timer.expected);
+        }
+        timingWheel.advance();
+    }
+
+    for (int tick = 0; tick <= (int) uWS::TimingWheel::MAX_TICKS; tick++) {
+        timingWheel.advance();
+    }
+    assert(timingWheel.size() == 0);
+    for (Timer &timer : timers) {
+        assert(timer.expired == timer.expected);
+    }
+}
+
+/* Expiring may re-arm itself and disarm others due in the same tick */
+uWS::TimingWheel *reentrantWheel;
+Timer reentrant[3];
+int reentrantCalls = 0;
+
+void expireReentrant(void *owner) {
+    reentrantCalls++;
+    Timer *timer = (Timer *) owner;
+    for (Timer &other : reentrant) {
+        if (&other != timer) {
+            reentrantWheel->disarm(&other.node);
+        }
+    }
+    if (!timer->expired++) {
+        reentrantWheel->arm(&timer->node, reentrantWheel->getNow() + 1);
+    }
+}
+
+void testReentrant() {
+    uWS::TimingWheel timingWheel;
+    reentrantWheel = &timingWheel;
+    for (Timer &timer : reentrant) {
+        timer.node.expire = expireReentrant;
+        timer.node.owner = &timer;
+        timingWheel.arm(&timer.node, 5);
+    }
+    for (int i = 0; i < 10; i++) {
+        timingWheel.advance();
+    }
+    assert(reentrantCalls == 2 && timingWheel.size() == 0);
+}
+
+int main() {
+    testBasics();
+    testRandom();
+    testReentrant();
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <iostream>
+#include <vector>
 
 /* Modifying the topicTree inside callback is not allowed, we had
  * tests for this before but we never need this to work anyways.
@@ -46,6 +47,7 @@ void testCorrectness() {
 
     /* Subscribe s2 to topic3 - should not get any message */
     topicTree->subscribe(s2, "topic3");
+    assert(topicTree->getNumTopics() == 1 && topicTree->getNumSubscribers() == 2);
 
     /* Publish to topic3 without sender - both should see */
     topicTree->publish(nullptr, "topic3", "Both should see");
@@ -81,6 +83,7 @@ void testCorrectness() {
     /* Release resources */
     topicTree->freeSubscriber(s1);
     topicTree->freeSubscriber(s2);
+    assert(topicTree->getNumTopics() == 0 && topicTree->getNumSubscribers() == 0 && topicTree->getNumOutgoingMessages() == 0);
 
     delete topicTree;
 }
@@ -192,8 +195,468 @@ void testReorderingv19() {
     delete topicTree;
 }
 
+void testSwapRemove() {
+    std::cout << "TestSwapRemove" << std::endl;
+
+    std::map<void *, int> received;
+    uWS::TopicTree<std::string, std::string_view> *topicTree = new uWS::TopicTree<std::string, std::string_view>([&received](uWS::Subscriber *s, std::string &, auto) {
+        received[s]++;
+        return false;
+    });
+
+    /* Subscribers leave from the middle, front and back of topics, in any order */
+    std::vector<uWS::Subscriber *> subscribers;
+    for (int i = 0; i < 64; i++) {
+        subscribers.push_back(topicTree->createSubscriber());
+        for (int j = 0; j < 4; j++) {
+            topicTree->subscribe(subscribers.back(), std::to_string((i + j) % 8));
+        }
+    }
+    for (int i = 0; i < 64; i += 3) {
+        topicTree->unsubscribe(subscribers[(size_t) i], std::to_string(i % 8));
+    }
+    for (int i = 63; i >= 0; i -= 5) {
+        topicTree->freeSubscriber(subscribers[(size_t) i]);
+        subscribers[(size_t) i] = nullptr;
+    }
+
+    /* Every remaining subscription gets exactly one message per topic */
+    std::map<void *, int> expected;
+    for (int i = 0; i < 64; i++) {
+        if (!subscribers[(size_t) i]) {
+            continue;
+        }
+        for (int j = 0; j < 4; j++) {
+            bool unsubscribed = i % 3 == 0 && (i + j) % 8 == i % 8;
+            if (!unsubscribed) {
+                expected[subscribers[(size_t) i]]++;
+            }
+            /* And knows it is subscribed, or not */
+            if (topicTree->lookupTopic(std::to_string((i + j) % 8))) {
+                assert(subscribers[(size_t) i]->topics.count(topicTree->lookupTopic(std::to_string((i + j) % 8))) == !unsubscribed);
+            }
+        }
+    }
+    for (int t = 0; t < 8; t++) {
+        topicTree->publish(nullptr, std::to_string(t), "x");
+    }
+    topicTree->drain();
+
+    if (received != expected) {
+        std::cout << "ERROR: swap-remove lost or duplicated subscribers" << std::endl;
+        exit(1);
+    }
+
+    for (uWS::Subscriber *s : subscribers) {
+        topicTree->freeSubscriber(s);
+    }
+    assert(!topicTree->lookupTopic("0"));
+
+    delete topicTree;
+}
+
+void testWildcards() {
+    std::cout << "TestWildcards" << std::endl;
+
+    std::map<void *, std::string> received;
+    uWS::TopicTree<std::string, std::string_view> *topicTree = new uWS::TopicTree<std::string, std::string_view>([&received](uWS::Subscriber *s, std::string &message, auto) {
+        received[s] += message;
+        return false;
+    });
+
+    uWS::Subscriber *exact = topicTree->createSubscriber();
+    uWS::Subscriber *plus = topicTree->createSubscriber();
+    uWS::Subscriber *hash = topicTree->createSubscriber();
+    uWS::Subscriber *overlapping = topicTree->createSubscriber();
+    uWS::Subscriber *literal = topicTree->createSubscriber();
+
+    topicTree->subscribe(exact, "sport/tennis/player1");
+    topicTree->subscribe(plus, "sport/+/player1");
+    topicTree->subscribe(hash, "sport/#");
+    /* Matches all of these at once, should still get every message once */
+    topicTree->subscribe(overlapping, "sport/tennis/player1");
+    topicTree->subscribe(overlapping, "+/+/+");
+    topicTree->subscribe(overlapping, "#");
+    /* Not patterns */
+    topicTree->subscribe(literal, "sport/a#");
+    topicTree->subscribe(literal, "sport/#/b");
+
+    topicTree->publish(nullptr, "sport/tennis/player1", "a");
+    topicTree->publish(nullptr, "sport/golf/player1", "b");
+    /* # also matches its parent level */
+    topicTree->publish(nullptr, "sport", "c");
+    topicTree->publish(plus, "sport/tennis", "d");
+    topicTree->publish(nullptr, "sport/a#", "e");
+    topicTree->publish(nullptr, "sport/tennis/player1/ranking", "f");
+    /* Wildcards at the first level do not match $ topics */
+    topicTree->publish(nullptr, "$SYS/tennis/player1", "g");
+    topicTree->drain();
+
+    std::map<void *, std::string> expected = {
+        {exact, "a"},
+        {plus, "ab"},
+        {hash, "abcdef"},
+        {overlapping, "abcdef"},
+        {literal, "e"}
+    };
+    if (received != expected) {
+        std::cout << "ERROR: wildcard topics matched wrong" << std::endl;
+        exit(1);
+    }
+
+    /* Patterns leave the trie once unsubscribed */
+    assert(std::get<0>(topicTree->unsubscribe(plus, "sport/+/player1")));
+    received.clear();
+    topicTree->publish(nullptr, "sport/golf/player1", "h");
+    topicTree->drain();
+    assert(!received.count(plus) && received[hash] == "h" && received[overlapping] == "h");
+
+    for (uWS::Subscriber *s : {exact, plus, hash, overlapping, literal}) {
+        topicTree->freeSubscriber(s);
+    }
+    assert(!topicTree->lookupTopic("#") && !topicTree->publish(nullptr, "sport", "i"));
+
+    delete topicTree;
+}
+
+void testTopicObserver() {
+    std::cout << "TestTopicObserver" << std::endl;
+
+    uWS::TopicTree<std::string, std::string_view> *topicTree = new uWS::TopicTree<std::string, std::string_view>([](uWS::Subscriber *, std::string &, auto) {
+        return false;
+    });
+    std::string events;
+    topicTree->topicObserver = [&events](std::string_view topic, bool added) {
+        events += (added ? "+" : "-") + std::string(topic) + " ";
+    };
+
+    /* Only the first and last subscriber change interest */
+    uWS::Subscriber *s1 = topicTree->createSubscriber();
+    uWS::Subscriber *s2 = topicTree->createSubscriber();
+    topicTree->subscribe(s1, "a");
+    topicTree->subscribe(s2, "a");
+    topicTree->subscribe(s2, "b/#");
+
+    size_t numTopics = 0;
+    topicTree->iterateTopics([&numTopics](uWS::Topic *) {
+        numTopics++;
+    });
+    assert(numTopics == 2);
+
+    topicTree->unsubscribe(s1, "a");
+    topicTree->freeSubscriber(s2);
+    topicTree->freeSubscriber(s1);
+
+    if (events != "+a +b/# -a -b/# " && events != "+a +b/# -b/# -a ") {
+        std::cout << "ERROR: topic observer saw <" << events << ">" << std::endl;
+        exit(1);
+    }
+
+    delete topicTree;
+}
+
+/* Bursts of any size stay batched until drained, in order, with one FIRST and one LAST each */
+void testBursts() {
+    std::cout << "TestBursts" << std::endl;
+
+    std::map<void *, std::vector<int>> received;
+    std::map<void *, int> firsts, lasts;
+    uWS::TopicTree<std::string, std::string_view> *topicTree = new uWS::TopicTree<std::string, std::string_view>([&](uWS::Subscriber *s, std::string &message, auto flags) {
+        received[s].push_back(std::stoi(message));
+        firsts[s] += (flags & uWS::TopicTree<std::string, std::string_view>::FIRST) != 0;
+        lasts[s] += (flags & uWS::TopicTree<std::string, std::string_view>::LAST) != 0;
+        return false;
+    });
+
+    /* One sees everything (a single run), the other every third message (a run each) */
+    uWS::Subscriber *all = topicTree->createSubscriber();
+    uWS::Subscriber *some = topicTree->createSubscriber();
+    topicTree->subscribe(all, "a");
+    topicTree->subscribe(all, "b");
+    topicTree->subscribe(some, "b");
+
+    for (int i = 0; i < 100000; i++) {
+        topicTree->publish(nullptr, i % 3 ? "a" : "b", std::to_string(i));
+    }
+    assert(received.empty());
+    topicTree->drain();
+
+    assert(received[all].size() == 100000 && received[some].size() == 33334);
+    for (int i = 0; i < 100000; i++) {
+        assert(received[all][(size_t) i] == i);
+    }
+    for (int i = 0; i < 33334; i++) {
+        assert(received[some][(size_t) i] == i * 3);
+    }
+    assert(firsts[all] == 1 && lasts[all] == 1 && firsts[some] == 1 && lasts[some] == 1);
+
+    /* And the next burst starts over */
+    received.clear();
+    topicTree->publish(nullptr, "b", "7");
+    topicTree->drain(some);
+    assert(received[some] == std::vector<int>{7} && received[all].empty());
+    topicTree->drain();
+    assert(received[all] == std::vector<int>{7});
+
+    topicTree->freeSubscriber(all);
+    topicTree->freeSubscriber(some);
+    delete topicTree;
+}
+
+void testStats() {
+    std::cout << "TestStats" << std::endl;
+
+    /* Slow takes one message per drain, dropping the rest */
+    uWS::Subscriber *slow = nullptr;
+    uWS::TopicTree<std::string, std::string_view> *topicTree = new uWS::TopicTree<std::string, std::string_view>([&slow](uWS::Subscriber *s, std::string &, auto flags) {
+        return s == slow && !(flags & uWS::TopicTree<std::string, std::string_view>::FIRST);
+    });
+
+    uWS::Subscriber *fast = topicTree->createSubscriber();
+    slow = topicTree->createSubscriber();
+    topicTree->subscribe(fast, "a");
+    topicTree->subscribe(slow, "a");
+    topicTree->subscribe(fast, "b");
+
+    topicTree->publish(nullptr, "a", "1", 1);
+    topicTree->publish(fast, "a", "22", 2);
+    topicTree->publish(nullptr, "a", "333", 3);
+    topicTree->publish(nullptr, "b", "4444", 4);
+    topicTree->publishBig(nullptr, "b", "55555", [](uWS::Subscriber *, std::string_view &) {
+        return true;
+    }, 5);
+    topicTree->publish(nullptr, "nobody", "x", 1);
+    topicTree->drain();
+
+    uWS::TopicStats a = topicTree->lookupTopic("a")->stats, b = topicTree->lookupTopic("b")->stats;
+    assert(a.publishes == 3 && a.messagesOut == 5 && a.bytesOut == 1 * 2 + 2 + 3 * 2 && a.drops == 2);
+    assert(b.publishes == 2 && b.messagesOut == 1 && b.bytesOut == 4 && b.drops == 1);
+
+    /* Drops still count on a topic gone before the drain */
+    topicTree->subscribe(slow, "c");
+    topicTree->publish(nullptr, "a", "6", 1);
+    topicTree->publish(nullptr, "c", "7", 1);
+    topicTree->unsubscribe(slow, "c");
+    assert(!topicTree->lookupTopic("c"));
+    topicTree->drain();
+    assert(topicTree->lookupTopic("a")->stats.drops == 2);
+
+    /* Big messages count drops on every topic they were dropped through */
+    topicTree->subscribe(fast, "d/+");
+    topicTree->subscribe(slow, "d/x");
+    topicTree->publishBig(nullptr, "d/x", "8", [](uWS::Subscriber *, std::string_view &) {
+        return true;
+    }, 1);
+    assert(topicTree->lookupTopic("d/+")->stats.drops == 1 && topicTree->lookupTopic("d/x")->stats.drops == 1);
+    assert(topicTree->lookupTopic("d/+")->stats.messagesOut == 0 && topicTree->lookupTopic("d/x")->stats.publishes == 1);
+
+    topicTree->freeSubscriber(fast);
+    topicTree->freeSubscriber(slow);
+    delete topicTree;
+}
+
+void testHistory() {
+    std::cout << "TestHistory" << std::endl;
+
+    uWS::TopicTree<std::string, std::string_view> *topicTree = new uWS::TopicTree<std::string, std::string_view>([](uWS::Subscriber *, std::string &, auto) {
+        return false;
+    });
+
+    auto replay = [](uWS::TopicHistory *history, uint64_t afterSequence, std::string &frames) {
+        frames.clear();
+        return history->since(afterSequence, [&frames](const uWS::SharedBuffer &frame) {
+            frames.append(frame.view());
+        });
+    };
+
+    /* Kept without subscribers, numbered from 1 */
+    assert(!topicTree->lookupHistory("a"));
+    topicTree->setHistory("a", 3);
+    uWS::TopicHistory *history = topicTree->lookupHistory("a");
+    assert(history && topicTree->lookupTopic("a") && history->lastSequence() == 0);
+    for (std::string_view frame : {"1", "2", "3", "4", "5"}) {
+        history->push(uWS::SharedBuffer::copy(frame));
+    }
+    assert(history->lastSequence() == 5 && history->firstSequence() == 3);
+
+    std::string frames;
+    assert(replay(history, 2, frames) && frames == "345");
+    assert(replay(history, 4, frames) && frames == "5");
+    assert(replay(history, 5, frames) && frames == "");
+    /* Gone already, or from before a restart */
+    assert(!replay(history, 1, frames) && frames == "345");
+    assert(!replay(history, 9, frames) && frames == "");
+
+    /* Resizing keeps the newest */
+    topicTree->setHistory("a", 2);
+    assert(replay(history, 3, frames) && frames == "45");
+    topicTree->setHistory("a", 4);
+    history->push(uWS::SharedBuffer::copy("6"));
+    assert(replay(history, 3, frames) && frames == "456");
+
+    /* The last subscriber leaving keeps it, stopping the history then erases it */
+    uWS::Subscriber *s = topicTree->createSubscriber();
+    topicTree->subscribe(s, "a");
+    topicTree->unsubscribe(s, "a");
+    topicTree->subscribe(s, "a");
+    topicTree->freeSubscriber(s);
+    assert(topicTree->lookupHistory("a") == history);
+    topicTree->setHistory("a", 0);
+    assert(!topicTree->lookupHistory("a") && !topicTree->lookupTopic("a"));
+
+    /* With subscribers the topic stays */
+    s = topicTree->createSubscriber();
+    topicTree->subscribe(s, "b");
+    topicTree->setHistory("b", 1);
+    topicTree->setHistory("b", 0);
+    assert(topicTree->lookupTopic("b") && !topicTree->lookupHistory("b"));
+    topicTree->setHistory("c", 1);
+    topicTree->freeSubscriber(s);
+    assert(!topicTree->lookupTopic("b"));
+    /* Freed along with the tree */
+    delete topicTree;
+}
+
+void testDrainPolicies() {
+    std::cout << "TestDrainPolicies" << std::endl;
+
+    std::map<void *, std::string> received;
+    /* Stops short after this many messages per drain, 0 to take all */
+    int takes = 0, taken = 0;
+    uWS::TopicTree<std::string, std::string_view> *topicTree = new uWS::TopicTree<std::string, std::string_view>([&](uWS::Subscriber *s, std::string &message, auto flags) {
+        if (flags & uWS::TopicTree<std::string, std::string_view>::FIRST) {
+            taken = 0;
+        }
+        if (takes && taken++ == takes) {
+            return true;
+        }
+        received[s].append(message);
+        return false;
+    });
+    bool behind = false;
+    topicTree->isBehind = [&behind](uWS::Subscriber *) {
+        return behind;
+    };
+
+    uWS::Subscriber *all = topicTree->createSubscriber(), *conflating = topicTree->createSubscriber(), *lanes = topicTree->createSubscriber();
+    conflating->drainPolicy = uWS::DRAIN_CONFLATE;
+    lanes->drainPolicy = uWS::DRAIN_PRIORITY | uWS::DRAIN_CONFLATE;
+    for (uWS::Subscriber *s : {all, conflating, lanes}) {
+        topicTree->subscribe(s, "price");
+        topicTree->subscribe(s, "control");
+    }
+    topicTree->lookupTopic("control")->priority = true;
+
+    auto burst = [topicTree]() {
+        topicTree->publish(nullptr, "price", "1");
+        topicTree->publish(nullptr, "price", "2");
+        topicTree->publish(nullptr, "control", "C");
+        topicTree->publish(nullptr, "price", "3");
+        topicTree->drain();
+    };
+
+    /* Conflation only while behind, lanes always */
+    burst();
+    assert(received[all] == "12C3" && received[conflating] == "12C3" && received[lanes] == "C123");
+    received.clear();
+    behind = true;
+    burst();
+    assert(received[all] == "12C3" && received[conflating] == "C3" && received[lanes] == "C3");
+    assert(topicTree->lookupTopic("price")->stats.conflated == 4);
+
+    /* Stopped short drops the rest, in the order taken */
+    received.clear();
+    takes = 1;
+    burst();
+    assert(received[all] == "1" && received[conflating] == "C" && received[lanes] == "C");
+    assert(topicTree->lookupTopic("price")->stats.drops == 2 + 1 + 1 && topicTree->lookupTopic("control")->stats.drops == 1);
+
+    /* Through a pattern every name published to is conflated on its own */
+    uWS::Subscriber *pattern = topicTree->createSubscriber();
+    pattern->drainPolicy = uWS::DRAIN_CONFLATE;
+    topicTree->subscribe(pattern, "quote/+");
+    received.clear();
+    takes = 0;
+    for (std::string_view message : {"a1", "b1", "a2", "c1", "b2"}) {
+        topicTree->publish(nullptr, std::string("quote/") + message[0], std::string(message));
+    }
+    topicTree->drain();
+    assert(received[pattern] == "a2c1b2" && topicTree->lookupTopic("quote/+")->stats.conflated == 2);
+    topicTree->freeSubscriber(pattern);
+
+    topicTree->freeSubscriber(all);
+    topicTree->freeSubscriber(conflating);
+    topicTree->freeSubscriber(lanes);
+    delete topicTree;
+}
+
+/* Subscribers left when the tree goes are destroyed with it, whatever they held */
+void testLeftSubscribers() {
+    std::cout << "TestLeftSubscribers" << std::endl;
+    auto *topicTree = new uWS::TopicTree<std::string, std::string_view>([](uWS::Subscriber *, std::string &, auto) {
+        return false;
+    });
+    for (int i = 0; i < 2000; i++) {
+        uWS::Subscriber *s = topicTree->createSubscriber();
+        topicTree->subscribe(s, "topic/" + std::to_string(i % 10));
+    }
+    topicTree->subscribe(topicTree->createSubscriber(), "topic/+");
+    /* Runs not in a row grow onto the heap, and these messages are never drained */
+    for (int i = 0; i < 100; i++) {
+        topicTree->publish(nullptr, "topic/" + std::to_string(i % 10), std::string(100, 'x'));
+        topicTree->publish(nullptr, "other", "nobody");
+    }
+    delete topicTree;
+}
+
+/* Many topics on one subscriber, found whatever order they come and go in */
+void testManyTopics() {
+    std::cout << "TestManyTopics" << std::endl;
+    auto *topicTree = new uWS::TopicTree<std::string, std::string_view>([](uWS::Subscriber *, std::string &, auto) {
+        return false;
+    });
+    uWS::Subscriber *s = topicTree->createSubscriber();
+    for (int i = 0; i < 200; i++) {
+        topicTree->subscribe(s, std::to_string((i * 37) % 200));
+    }
+    assert(s->topics.size() == 200 && !s->topics.insert({topicTree->lookupTopic("5"), 0}));
+
+    for (int i = 0; i < 200; i += 3) {
+        topicTree->unsubscribe(s, std::to_string((i * 53) % 200));
+    }
+    size_t left = 0;
+    for (int i = 0; i < 200; i++) {
+        bool unsubscribed = false;
+        for (int j = 0; j < 200; j += 3) {
+            unsubscribed = unsubscribed || (j * 53) % 200 == i;
+        }
+        uWS::Topic *topic = topicTree->lookupTopic(std::to_string(i));
+        assert(!topic == unsubscribed && (!topic || s->topics.count(topic)));
+        left += !unsubscribed;
+
+        /* And our index in the topic is right */
+        if (topic) {
+            assert(*(topic->begin() + s->topics.find(topic)->index) == s);
+        }
+    }
+    assert(s->topics.size() == left);
+
+    topicTree->freeSubscriber(s);
+    assert(!topicTree->lookupTopic("1"));
+    delete topicTree;
+}
+
 int main() {
     testCorrectness();
     testBugReport();
     testReorderingv19();
+    testSwapRemove();
+    testWildcards();
+    testTopicObserver();
+    testBursts();
+    testStats();
+    testHistory();
+    testDrainPolicies();
+    testLeftSubscribers();
+    testManyTopics();
 }
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "../src/TrafficCapture.h"
+
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+/* Read back as written, connections numbered as they opened, time never going back */
+void testRoundTrip() {
+    const char *path = "TrafficCapture.bin";
+    {
+        uWS::TrafficCapture capture(fopen(path, "wb"));
+        capture.onOpen(7);
+        capture.onOpen(9);
+        capture.onData(9, "GET / HTTP/1.1\r\n\r\n");
+        capture.onData(7, std::string(200000, 'x'));
+        capture.onClose(9);
+        /* Opened before capturing began */
+        capture.onData(3, "late");
+        capture.onClose(7);
+        capture.onClose(9);
+    }
+
+    uWS::TrafficCaptureReader reader;
+    assert(reader.open(path));
+    std::remove(path);
+
+    struct {
+        int kind;
+        unsigned int connection;
+        std::string data;
+    } expected[] = {
+        {uWS::TrafficCapture::OPEN, 0, ""},
+        {uWS::TrafficCapture::OPEN, 1, ""},
+        {uWS::TrafficCapture::DATA, 1, "GET / HTTP/1.1\r\n\r\n"},
+        {uWS::TrafficCapture::DATA, 0, std::string(200000, 'x')},
+        {uWS::TrafficCapture::CLOSE, 1, ""},
+        {uWS::TrafficCapture::OPEN, 2, ""},
+        {uWS::TrafficCapture::DATA, 2, "late"},
+        {uWS::TrafficCapture::CLOSE, 0, ""}
+    };
+
+    uWS::CapturedRecord record;
+    unsigned long long microseconds = 0;
+    for (auto &e : expected) {
+        assert(reader.next(record));
+        assert(record.kind == e.kind && record.connection == e.connection && record.data == e.data);
+        assert(record.microseconds >= microseconds);
+        microseconds = record.microseconds;
+    }
+    assert(!reader.next(record));
+}
+
+/* Data past the limit is left out, connections still open and close */
+void testMaxBytes() {
+    const char *path = "TrafficCapture.bin";
+    {
+        uWS::TrafficCapture capture(fopen(path, "wb"), 10);
+        capture.onOpen(1);
+        capture.onData(1, "123456");
+        capture.onData(1, "123456");
+        capture.onData(1, "1234");
+        capture.onClose(1);
+    }
+
+    uWS::TrafficCaptureReader reader;
+    assert(reader.open(path));
+    std::remove(path);
+
+    uWS::CapturedRecord record;
+    std::string data;
+    int kinds = 0;
+    while (reader.next(record)) {
+        data += record.data;
+        kinds = kinds * 10 + record.kind;
+    }
+    assert(data == "1234561234" && kinds == 1223);
+}
+
+/* Cut short, everything whole before the cut is read */
+void testTruncated() {
+    uWS::TrafficCaptureReader reader;
+    assert(!reader.load("not a capture"));
+
+    std::string capture(uWS::TrafficCapture::HEADER);
+    capture += std::string("\x01\x00\x00", 3);
+    capture += std::string("\x02\x05\x00\x04" "ab", 6);
+    assert(reader.load(std::move(capture)));
+
+    uWS::CapturedRecord record;
+    assert(reader.next(record) && record.kind == uWS::TrafficCapture::OPEN);
+    assert(!reader.next(record));
+}
+
+int main() {
+    testRoundTrip();
+    testMaxBytes();
+    testTruncated();
+
+    std::cout << "ALL PASS" << std::endl;
+}
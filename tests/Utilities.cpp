@@ -0,0 +1,81 @@
+#include <iostream>
+#include <cassert>
+#include <cstring>
+
+#include "../src/Utilities.h"
+
+int main() {
+    uint64_t first, last;
+
+    assert(uWS::utils::parseByteRange("bytes=0-99", 1000, first, last) == uWS::utils::RANGE_SATISFIABLE && first == 0 && last == 99);
+    assert(uWS::utils::parseByteRange("bytes=500-", 1000, first, last) == uWS::utils::RANGE_SATISFIABLE && first == 500 && last == 999);
+    assert(uWS::utils::parseByteRange("bytes=900-5000", 1000, first, last) == uWS::utils::RANGE_SATISFIABLE && first == 900 && last == 999);
+    assert(uWS::utils::parseByteRange("bytes=-100", 1000, first, last) == uWS::utils::RANGE_SATISFIABLE && first == 900 && last == 999);
+    assert(uWS::utils::parseByteRange("bytes=-5000", 1000, first, last) == uWS::utils::RANGE_SATISFIABLE && first == 0 && last == 999);
+
+    assert(uWS::utils::parseByteRange("bytes=1000-", 1000, first, last) == uWS::utils::RANGE_NOT_SATISFIABLE);
+    assert(uWS::utils::parseByteRange("bytes=-0", 1000, first, last) == uWS::utils::RANGE_NOT_SATISFIABLE);
+    assert(uWS::utils::parseByteRange("bytes=0-", 0, first, last) == uWS::utils::RANGE_NOT_SATISFIABLE);
+
+    /* Unsupported or malformed ranges are ignored */
+    assert(uWS::utils::parseByteRange("", 1000, first, last) == uWS::utils::RANGE_NONE);
+    assert(uWS::utils::parseByteRange("items=0-1", 1000, first, last) == uWS::utils::RANGE_NONE);
+    assert(uWS::utils::parseByteRange("bytes=0-1,5-6", 1000, first, last) == uWS::utils::RANGE_NONE);
+    assert(uWS::utils::parseByteRange("bytes=5-1", 1000, first, last) == uWS::utils::RANGE_NONE);
+    assert(uWS::utils::parseByteRange("bytes=-", 1000, first, last) == uWS::utils::RANGE_NONE);
+    assert(uWS::utils::parseByteRange("bytes=99999999999999999999-", 1000, first, last) == uWS::utils::RANGE_NONE);
+
+    /* Codings, refused only by a q of zero */
+    assert(uWS::utils::acceptedCodings("gzip, deflate, br") == (uWS::utils::CODING_GZIP | uWS::utils::CODING_BR));
+    assert(uWS::utils::acceptedCodings("br;q=1.0, gzip;q=0.8, *;q=0.1") == (uWS::utils::CODING_GZIP | uWS::utils::CODING_BR));
+    assert(uWS::utils::acceptedCodings("gzip;q=0, br") == uWS::utils::CODING_BR);
+    assert(uWS::utils::acceptedCodings("br; q=0.000,gzip;q=0.001") == uWS::utils::CODING_GZIP);
+    assert(uWS::utils::acceptedCodings("identity") == 0 && uWS::utils::acceptedCodings("") == 0);
+
+    /* Tags, weakly */
+    assert(uWS::utils::matchesEntityTag("\"abc\"", "\"abc\""));
+    assert(uWS::utils::matchesEntityTag("\"x\", W/\"abc\"", "\"abc\""));
+    assert(uWS::utils::matchesEntityTag("\"a,b\", \"abc\"", "\"abc\""));
+    assert(uWS::utils::matchesEntityTag("*", "\"abc\""));
+    assert(!uWS::utils::matchesEntityTag("\"abcd\", \"ab\"", "\"abc\""));
+    assert(!uWS::utils::matchesEntityTag("", "\"abc\""));
+
+    /* Dates, both ways */
+    char date[29];
+    int64_t seconds;
+    uWS::utils::formatHttpDate(784111777, date);
+    assert(std::string_view(date, 29) == "Sun, 06 Nov 1994 08:49:37 GMT");
+    assert(uWS::utils::parseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT", seconds) && seconds == 784111777);
+    uWS::utils::formatHttpDate(951782400, date);
+    assert(std::string_view(date, 29) == "Tue, 29 Feb 2000 00:00:00 GMT");
+    for (int64_t s = 0; s < 4102444800; s += 86399 * 17) {
+        uWS::utils::formatHttpDate(s, date);
+        assert(uWS::utils::parseHttpDate(std::string_view(date, 29), seconds) && seconds == s);
+    }
+    /* Updated a second at a time (or jumping), same as formatted whole */
+    char updated[29], whole[29];
+    uWS::utils::formatHttpDate(951868790, updated);
+    for (int64_t previous = 951868790, s = 951868791; s < 951868791 + 4000; previous = s, s += (s % 7 ? 1 : 13)) {
+        uWS::utils::updateHttpDate(previous, s, updated);
+        uWS::utils::formatHttpDate(s, whole);
+        assert(!memcmp(updated, whole, 29));
+    }
+    uWS::utils::updateHttpDate(951868791 + 4000, 951868791, updated);
+    uWS::utils::formatHttpDate(951868791, whole);
+    assert(!memcmp(updated, whole, 29));
+    assert(!uWS::utils::parseHttpDate("Sunday, 06-Nov-94 08:49:37 GMT", seconds));
+    assert(!uWS::utils::parseHttpDate("Sun, 06 Nox 1994 08:49:37 GMT", seconds));
+    assert(!uWS::utils::parseHttpDate("Sun, 06 Nov 1994 08:49:3x GMT", seconds));
+
+    /* Paths, never leaving the root */
+    char path[64];
+    assert(uWS::utils::decodeUrlPath("/a%20b/c.txt", path) == 10 && std::string_view(path, 10) == "/a b/c.txt");
+    assert(uWS::utils::decodeUrlPath("/a/./b..c/", path) == 10);
+    assert(uWS::utils::decodeUrlPath("/../etc/passwd", path) == SIZE_MAX);
+    assert(uWS::utils::decodeUrlPath("/a/%2e%2e/%2E%2e%2fb", path) == SIZE_MAX);
+    assert(uWS::utils::decodeUrlPath("/a/..", path) == SIZE_MAX);
+    assert(uWS::utils::decodeUrlPath("/a%00", path) == SIZE_MAX);
+    assert(uWS::utils::decodeUrlPath("/a%2", path) == SIZE_MAX && uWS::utils::decodeUrlPath("/a%zz", path) == SIZE_MAX);
+
+    std::cout << "ALL PASS" << std::endl;
+}
@@ -0,0 +1,50 @@
+#include "../src/WebSocketHandshake.h"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/* The example of RFC 6455 */
+void testRfcExample() {
+    char accept[28];
+    uWS::WebSocketHandshake::generate("dGhlIHNhbXBsZSBub25jZQ==", accept);
+    assert(std::string(accept, 28) == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+    uWS::WebSocketHandshake::generatePortable("dGhlIHNhbXBsZSBub25jZQ==", accept);
+    assert(std::string(accept, 28) == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+}
+
+/* Hardware (if any), portable and several at once all agree, for any count */
+void testAgreement() {
+    const char *b64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::mt19937 random(42);
+    std::vector<std::string> keys(37);
+    std::vector<const char *> inputs;
+    for (std::string &key : keys) {
+        for (int i = 0; i < 22; i++) {
+            key += b64[random() % 64];
+        }
+        key += "==";
+        inputs.push_back(key.data());
+    }
+
+    for (size_t count = 0; count <= keys.size(); count += 3) {
+        char outputs[37][28];
+        uWS::WebSocketHandshake::generate(inputs.data(), outputs, count);
+        for (size_t i = 0; i < count; i++) {
+            char accept[28], portable[28];
+            uWS::WebSocketHandshake::generate(keys[i].data(), accept);
+            uWS::WebSocketHandshake::generatePortable(keys[i].data(), portable);
+            assert(!memcmp(accept, portable, 28) && !memcmp(outputs[i], portable, 28));
+        }
+    }
+}
+
+int main() {
+    testRfcExample();
+    testAgreement();
+
+    std::cout << "ALL PASS" << (uWS::WebSocketHandshake::hasHardwareSha1() ? " (hardware SHA1)" : "") << std::endl;
+}
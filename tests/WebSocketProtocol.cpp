@@ -0,0 +1,352 @@
+/* Needs the headers of uSockets (for LIBUS_RECV_BUFFER_LENGTH), not the library */
+#include "../src/WebSocketProtocol.h"
+
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Collects what the parser hands us, to compare with what was framed */
+struct Received {
+    std::string message, fragment;
+    std::vector<std::string> messages;
+    std::vector<int> opCodes;
+    /* Whole messages validated as UTF-8 one fragment at a time, like WebSocketContext does */
+    unsigned char utf8Tail[4];
+    unsigned char utf8TailLength = 0;
+    bool validPieces = true;
+    bool closed = false;
+};
+
+struct Parser : uWS::WebSocketProtocol<true, Parser> {
+    using uWS::WebSocketProtocol<true, Parser>::unmaskVector;
+    using uWS::WebSocketProtocol<true, Parser>::unmaskInplace;
+
+    static bool refusePayloadLength(uint64_t length, uWS::WebSocketState<true> *, void *) {
+        return length > 16 * 1024 * 1024;
+    }
+
+    static bool setCompressed(uWS::WebSocketState<true> *, void *) {
+        return false;
+    }
+
+    static void forceClose(uWS::WebSocketState<true> *, void *user, std::string_view = {}) {
+        ((Received *) user)->closed = true;
+    }
+
+    static bool handleFragment(char *data, size_t length, unsigned int remainingBytes, int opCode, bool fin, uWS::WebSocketState<true> *, void *user) {
+        Received *received = (Received *) user;
+        received->fragment.append(data, length);
+        if (remainingBytes) {
+            return false;
+        }
+
+        /* Control frames come whole, in between the fragments of a message */
+        if (opCode >= uWS::CLOSE) {
+            received->messages.push_back(std::move(received->fragment));
+            received->opCodes.push_back(opCode);
+            received->fragment.clear();
+            return false;
+        }
+
+        /* One frame done, fragments of a message are validated as they come */
+        if (opCode == uWS::TEXT) {
+            received->validPieces = received->validPieces && uWS::protocol::isValidUtf8Piece(received->utf8Tail, received->utf8TailLength,
+                (unsigned char *) received->fragment.data(), received->fragment.length(), fin);
+        }
+        received->message += received->fragment;
+        received->fragment.clear();
+        if (fin) {
+            received->messages.push_back(std::move(received->message));
+            received->opCodes.push_back(opCode);
+            received->message.clear();
+        }
+        return false;
+    }
+};
+
+/* A masked client frame */
+std::string frame(std::string_view payload, int opCode, bool fin, const unsigned char mask[4]) {
+    std::string out(1, (char) ((fin ? 128 : 0) | opCode));
+    if (payload.length() < 126) {
+        out += (char) (128 | payload.length());
+    } else if (payload.length() < 65536) {
+        out += (char) (128 | 126);
+        out += (char) (payload.length() >> 8);
+        out += (char) payload.length();
+    } else {
+        out += (char) (128 | 127);
+        for (int i = 7; i >= 0; i--) {
+            out += (char) ((uint64_t) payload.length() >> (i * 8));
+        }
+    }
+    out.append((const char *) mask, 4);
+    for (size_t i = 0; i < payload.length(); i++) {
+        out += (char) (payload[i] ^ mask[i % 4]);
+    }
+    return out;
+}
+
+/* Feeds data in chunks of chunkSize, each in a buffer of its own with room around it like the receive buffer */
+Received parse(const std::string &data, size_t chunkSize) {
+    Received received;
+    uWS::WebSocketState<true> state;
+    std::vector<char> buffer(LIBUS_RECV_BUFFER_PADDING + LIBUS_RECV_BUFFER_LENGTH + LIBUS_RECV_BUFFER_PADDING);
+    for (size_t offset = 0; offset < data.length() && !received.closed; offset += chunkSize) {
+        size_t length = std::min(chunkSize, data.length() - offset);
+        memcpy(buffer.data() + LIBUS_RECV_BUFFER_PADDING, data.data() + offset, length);
+        Parser::consume(buffer.data() + LIBUS_RECV_BUFFER_PADDING, (unsigned int) length, &state, &received);
+    }
+    return received;
+}
+
+/* Vector unmasking agrees with bytewise, in place and shifted over any header, for any length */
+void testUnmaskVector() {
+    std::mt19937 random(21);
+    for (unsigned int length = 0; length < 300; length++) {
+        for (int destination : {0, 2, 4, 6, 8, 10, 14}) {
+            std::vector<char> buffer(16 + length + 64);
+            for (char &c : buffer) {
+                c = (char) random();
+            }
+            unsigned char mask[4] = {(unsigned char) random(), (unsigned char) random(), (unsigned char) random(), (unsigned char) random()};
+            uint32_t maskInt;
+            memcpy(&maskInt, mask, 4);
+
+            char *src = buffer.data() + 16;
+            std::vector<char> expected(src, src + length);
+            for (unsigned int i = 0; i < length; i++) {
+                expected[i] ^= (char) mask[i % 4];
+            }
+
+            unsigned int done = Parser::unmaskVector(src - destination, src, length, maskInt);
+            assert(done <= length && (done % 16) == 0 && length - done < 64);
+            assert(!memcmp(src - destination, expected.data(), done));
+        }
+    }
+
+    /* In place, ending on a multiple of 4 */
+    std::vector<char> buffer(1000);
+    for (char &c : buffer) {
+        c = (char) random();
+    }
+    std::vector<char> expected = buffer;
+    char mask[4] = {1, 2, 3, 4};
+    for (size_t i = 0; i < 996; i++) {
+        expected[i] ^= mask[i % 4];
+    }
+    Parser::unmaskInplace(buffer.data(), buffer.data() + 996, mask);
+    assert(buffer == expected);
+}
+
+/* Whole frames of every header size come out unmasked, in one read or cut anywhere */
+void testUnmaskFrames() {
+    std::mt19937 random(22);
+    const unsigned char mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+    std::vector<std::string> payloads;
+    std::string stream;
+    for (size_t length : {0u, 1u, 3u, 4u, 5u, 15u, 16u, 17u, 63u, 64u, 125u, 126u, 127u, 1000u, 65535u, 65536u, 70001u}) {
+        std::string payload(length, 0);
+        for (char &c : payload) {
+            c = (char) random();
+        }
+        payloads.push_back(payload);
+        stream += frame(payload, uWS::BINARY, true, mask);
+    }
+
+    for (size_t chunkSize : {1, 2, 7, 100, 4096, 65536, LIBUS_RECV_BUFFER_LENGTH}) {
+        Received received = parse(stream, chunkSize);
+        assert(!received.closed && received.messages == payloads);
+    }
+
+    /* Filling the receive buffer takes the path unmasking all of it */
+    std::string big(3 * LIBUS_RECV_BUFFER_LENGTH + 100, 0);
+    for (char &c : big) {
+        c = (char) random();
+    }
+    Received received = parse(frame(big, uWS::BINARY, true, mask), LIBUS_RECV_BUFFER_LENGTH);
+    assert(received.messages.size() == 1 && received.messages[0] == big);
+}
+
+/* A straightforward decoder to check against */
+bool referenceValidUtf8(const unsigned char *s, size_t length) {
+    for (size_t i = 0; i < length; ) {
+        unsigned int c = s[i], needed, codePoint, min;
+        if (c < 0x80) {
+            i++;
+            continue;
+        } else if ((c & 0xe0) == 0xc0) {
+            needed = 1, codePoint = c & 0x1f, min = 0x80;
+        } else if ((c & 0xf0) == 0xe0) {
+            needed = 2, codePoint = c & 0x0f, min = 0x800;
+        } else if ((c & 0xf8) == 0xf0) {
+            needed = 3, codePoint = c & 0x07, min = 0x10000;
+        } else {
+            return false;
+        }
+        if (i + needed >= length) {
+            return false;
+        }
+        for (unsigned int j = 1; j <= needed; j++) {
+            if ((s[i + j] & 0xc0) != 0x80) {
+                return false;
+            }
+            codePoint = (codePoint << 6) | (s[i + j] & 0x3f);
+        }
+        if (codePoint < min || codePoint > 0x10ffff || (codePoint >= 0xd800 && codePoint <= 0xdfff)) {
+            return false;
+        }
+        i += needed + 1;
+    }
+    return true;
+}
+
+bool isValidUtf8(std::string s) {
+    bool valid = uWS::protocol::isValidUtf8((unsigned char *) s.data(), s.length());
+    assert(valid == uWS::protocol::isValidUtf8Scalar((unsigned char *) s.data(), s.length()));
+    assert(valid == referenceValidUtf8((unsigned char *) s.data(), s.length()));
+    return valid;
+}
+
+/* The vector validator (if built with one) agrees with the scalar one and the reference, wherever the bytes lie */
+void testUtf8() {
+    const std::vector<std::pair<std::string, bool>> cases = {
+        {"", true}, {"plain ascii", true}, {"\xc3\xa5\xc3\xa4\xc3\xb6", true}, {"\xe2\x82\xac", true}, {"\xf0\x9f\x98\x80", true},
+        {"\xed\x9f\xbf", true}, {"\xee\x80\x80", true}, {"\xf4\x8f\xbf\xbf", true}, {"\xc2\x80", true}, {"\xe0\xa0\x80", true},
+        /* Overlong */
+        {"\xc0\x80", false}, {"\xc1\xbf", false}, {"\xe0\x9f\xbf", false}, {"\xf0\x8f\xbf\xbf", false},
+        /* Surrogates, past U+10FFFF, not a start */
+        {"\xed\xa0\x80", false}, {"\xed\xbf\xbf", false}, {"\xf4\x90\x80\x80", false}, {"\xf5\x80\x80\x80", false},
+        {"\xff", false}, {"\x80", false}, {"\xbf", false},
+        /* Cut short, or continued by something else */
+        {"\xc3", false}, {"\xe2\x82", false}, {"\xf0\x9f\x98", false}, {"\xe2\x28\xa1", false}, {"\xc3\xa5\x80", false}
+    };
+
+    for (auto &[sequence, valid] : cases) {
+        /* At every offset around the 16 byte blocks, with ASCII or multibyte text around it */
+        for (size_t before = 0; before < 40; before++) {
+            for (const char *filler : {"a", "\xc3\xa5"}) {
+                std::string prefix;
+                while (prefix.length() < before) {
+                    prefix += filler;
+                }
+                assert(isValidUtf8(prefix + sequence) == valid);
+                assert(isValidUtf8(prefix + sequence + std::string(before % 23, 'z')) == valid);
+            }
+        }
+    }
+
+    /* Random bytes, mostly invalid, and random code points, all valid */
+    std::mt19937 random(23);
+    for (int i = 0; i < 20000; i++) {
+        std::string s(random() % 70, 0);
+        for (char &c : s) {
+            c = (char) (random() % 4 ? 0x80 + random() % 0x80 : random() % 0x80);
+        }
+        isValidUtf8(s);
+
+        std::string text;
+        while (text.length() < (size_t) (random() % 100)) {
+            unsigned int codePoint = random() % 4 ? random() % 0x800 : random() % 0x110000;
+            if (codePoint >= 0xd800 && codePoint <= 0xdfff) {
+                continue;
+            }
+            if (codePoint < 0x80) {
+                text += (char) codePoint;
+            } else if (codePoint < 0x800) {
+                text += (char) (0xc0 | (codePoint >> 6));
+                text += (char) (0x80 | (codePoint & 0x3f));
+            } else if (codePoint < 0x10000) {
+                text += (char) (0xe0 | (codePoint >> 12));
+                text += (char) (0x80 | ((codePoint >> 6) & 0x3f));
+                text += (char) (0x80 | (codePoint & 0x3f));
+            } else {
+                text += (char) (0xf0 | (codePoint >> 18));
+                text += (char) (0x80 | ((codePoint >> 12) & 0x3f));
+                text += (char) (0x80 | ((codePoint >> 6) & 0x3f));
+                text += (char) (0x80 | (codePoint & 0x3f));
+            }
+        }
+        assert(isValidUtf8(text));
+    }
+}
+
+/* Validating in pieces agrees with validating the whole, wherever it is cut */
+bool isValidInPieces(const std::string &s, const std::vector<size_t> &cuts) {
+    unsigned char tail[4];
+    unsigned char tailLength = 0;
+    size_t offset = 0;
+    for (size_t i = 0; i <= cuts.size(); i++) {
+        size_t end = i < cuts.size() ? cuts[i] : s.length();
+        std::string piece = s.substr(offset, end - offset);
+        if (!uWS::protocol::isValidUtf8Piece(tail, tailLength, (unsigned char *) piece.data(), piece.length(), i == cuts.size())) {
+            return false;
+        }
+        assert(tailLength <= 3);
+        offset = end;
+    }
+    return true;
+}
+
+void testUtf8Pieces() {
+    for (std::string s : {std::string("a\xc3\xa5\xe2\x82\xac\xf0\x9f\x98\x80z"), std::string("\xf0\x9f\x98\x80\xf0\x9f\x98\x80"),
+            std::string("ab\xed\xa0\x80"), std::string("\xe2\x82"), std::string("\xc3\xa5\x80"), std::string("\xf0\x9f\x98")}) {
+        bool valid = referenceValidUtf8((unsigned char *) s.data(), s.length());
+        /* Every single cut and every pair of cuts, also empty pieces */
+        for (size_t first = 0; first <= s.length(); first++) {
+            assert(isValidInPieces(s, {first}) == valid);
+            for (size_t second = first; second <= s.length(); second++) {
+                assert(isValidInPieces(s, {first, second}) == valid);
+            }
+        }
+        /* One byte at a time */
+        std::vector<size_t> cuts;
+        for (size_t i = 1; i < s.length(); i++) {
+            cuts.push_back(i);
+        }
+        assert(isValidInPieces(s, cuts) == valid);
+    }
+}
+
+/* Fragmented messages come out whole, validated a fragment at a time, with control frames in between */
+void testFragments() {
+    const unsigned char mask[4] = {0x01, 0x80, 0xfe, 0x7f};
+    std::string text = "fragments \xe2\x82\xac cut mid sequence \xf0\x9f\x98\x80 and some more text to go around";
+    std::string binary(70000, 'b');
+
+    for (size_t cut = 1; cut < text.length(); cut += 3) {
+        std::string stream = frame(text.substr(0, cut), uWS::TEXT, false, mask) + frame("ping", uWS::PING, true, mask) +
+            frame(text.substr(cut, 5), uWS::CONTINUATION, false, mask) + frame(text.substr(std::min(cut + 5, text.length())), uWS::CONTINUATION, true, mask) +
+            frame(binary.substr(0, 40000), uWS::BINARY, false, mask) + frame(binary.substr(40000), uWS::CONTINUATION, true, mask);
+
+        for (size_t chunkSize : {1u, 13u, 1000u, 100000u}) {
+            Received received = parse(stream, chunkSize);
+            assert(!received.closed && received.validPieces);
+            assert(received.messages.size() == 3 && received.messages[0] == "ping" && received.opCodes[0] == uWS::PING);
+            assert(received.messages[1] == text && received.opCodes[1] == uWS::TEXT);
+            assert(received.messages[2] == binary && received.opCodes[2] == uWS::BINARY);
+        }
+    }
+
+    /* Invalid across fragments is caught once the sequence is complete, or as the message ends cut */
+    std::string stream = frame("ok \xe2", uWS::TEXT, false, mask) + frame("\x28\xa1", uWS::CONTINUATION, true, mask);
+    assert(!parse(stream, 5).validPieces);
+    stream = frame("ok \xe2", uWS::TEXT, false, mask) + frame("\x82", uWS::CONTINUATION, true, mask);
+    assert(!parse(stream, 5).validPieces);
+
+    /* A continuation without a message to continue is a protocol error */
+    assert(parse(frame("x", uWS::CONTINUATION, true, mask), 100).closed);
+}
+
+int main() {
+    testUnmaskVector();
+    testUnmaskFrames();
+    testUtf8();
+    testUtf8Pieces();
+    testFragments();
+
+    std::cout << "ALL PASS" << std::endl;
+}